@@ -54,6 +54,7 @@ int main(int argc, char **argv)
     string input_s;
     size_t id_width = 0;
     size_t align_to = 1;
+    size_t page_align = 1;
     double high_node_weight = 1.0;
 
     po::options_description desc("Options:");
@@ -72,6 +73,10 @@ int main(int argc, char **argv)
             "add padding to align all node indices to be 0 mod this; "
             "default 1"
         )
+        ("page-align,p", po::value<size_t>(&page_align),
+            "add padding so that outputs start at 0 mod this, e.g., 4096 "
+            "for automata to be memory mapped; default 1"
+        )
         ("high-node-weight,h", po::value<double>(&high_node_weight),
             "Weight of high node cos; "
             "> 1 favors low nodes; < 1 favors high nodes; 1.0 = smallest; "
@@ -111,6 +116,18 @@ int main(int argc, char **argv)
           return 1;
     }
 
+    if (align_to == 0) {
+        cout << "align must be at least 1." << endl;
+        cout << desc << endl;
+        return 1;
+    }
+
+    if (page_align == 0) {
+        cout << "page-align must be at least 1." << endl;
+        cout << desc << endl;
+        return 1;
+    }
+
     fs::path input(input_s);
     fs::path output(output_s);
 
@@ -148,6 +165,7 @@ int main(int argc, char **argv)
         EudoxusCompiler::configuration_t configuration;
         configuration.id_width = id_width;
         configuration.align_to = align_to;
+        configuration.page_align = page_align;
         configuration.high_node_weight = high_node_weight;
         try {
             result = EudoxusCompiler::compile(automata, configuration);
@@ -161,6 +179,7 @@ int main(int argc, char **argv)
         cout << "bytes            = " << bytes << endl;
         cout << "id_width         = " << result.configuration.id_width << endl;
         cout << "align_to         = " << result.configuration.align_to << endl;
+        cout << "page_align       = " << result.configuration.page_align << endl;
         cout << "high_node_weight = " << result.configuration.high_node_weight << endl;
         cout << "ids_used         = " << result.ids_used << endl;
         cout << "padding          = " << result.padding << endl;
@@ -358,6 +358,7 @@ int main(int argc, char **argv)
     bool no_output = false;
     bool final = false;
     bool list_output = false;
+    bool mapped = false;
     size_t n = 1;
 
     po::options_description desc("Options:");
@@ -393,6 +394,10 @@ int main(int argc, char **argv)
         ("list-output,L", po::bool_switch(&list_output),
             "list all outputs of automata and exit"
         )
+        ("mmap,m", po::bool_switch(&mapped),
+            "execute out of a shared mapping of automata instead of reading "
+            "it into memory"
+        )
         ;
 
     po::positional_options_description pd;
@@ -445,7 +450,14 @@ int main(int argc, char **argv)
     ia_eudoxus_t* eudoxus;
 
     TimingInfo ti;
-    rc = ia_eudoxus_create_from_path(&eudoxus, automata_s.c_str());
+    if (mapped) {
+        rc = ia_eudoxus_create_from_path_mapped(
+            &eudoxus, automata_s.c_str(), IA_EUDOXUS_MAP_WILLNEED
+        );
+    }
+    else {
+        rc = ia_eudoxus_create_from_path(&eudoxus, automata_s.c_str());
+    }
     if (rc != IA_EUDOXUS_OK) {
         output_eudoxus_result(NULL, rc);
         return 1;
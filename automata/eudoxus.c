@@ -50,6 +50,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 struct ia_eudoxus_t
@@ -78,6 +81,15 @@ struct ia_eudoxus_t
      * otherwise.
      */
     bool free_error_message;
+
+    /**
+     * Length of the mapping holding @c automata.
+     *
+     * 0 if @c automata was allocated by malloc() and is freed on destroy;
+     * otherwise @c automata is a read only mapping that is unmapped on
+     * destroy.
+     */
+    size_t mapped_length;
 };
 
 struct ia_eudoxus_state_t
@@ -170,9 +182,24 @@ enum ia_eudoxus_extended_command_t
     IA_EUDOXUS_EXT_INSANITY
 };
 
-ia_eudoxus_result_t ia_eudoxus_create(
+/**
+ * Create a Eudoxus engine for @a data.
+ *
+ * Common implementation of ia_eudoxus_create() and
+ * ia_eudoxus_create_from_path_mapped().  On failure, @a data is left to
+ * the caller.
+ *
+ * @param[out] out_eudoxus   Variable to hold pointer to created engine.
+ * @param[in]  data          Data holding automata.
+ * @param[in]  mapped_length Length of mapping holding @a data or 0 if
+ *                           @a data was allocated with malloc().
+ * @return As ia_eudoxus_create().
+ */
+static
+ia_eudoxus_result_t ia_eudoxus_create_internal(
     ia_eudoxus_t **out_eudoxus,
-    char          *data
+    const char    *data,
+    size_t         mapped_length
 )
 {
     ia_eudoxus_t        *eudoxus = NULL;
@@ -187,9 +214,10 @@ ia_eudoxus_result_t ia_eudoxus_create(
         return IA_EUDOXUS_EINVAL;
     }
 
-    eudoxus->automata           = (ia_eudoxus_automata_t *)data;
+    eudoxus->automata           = (const ia_eudoxus_automata_t *)data;
     eudoxus->error_message      = NULL;
     eudoxus->free_error_message = false;
+    eudoxus->mapped_length      = mapped_length;
 
     if (eudoxus->automata->version != IA_EUDOXUS_VERSION) {
         rc = IA_EUDOXUS_EINCOMPAT;
@@ -214,6 +242,13 @@ finish:
     return rc;
 }
 
+ia_eudoxus_result_t ia_eudoxus_create(
+    ia_eudoxus_t **out_eudoxus,
+    char          *data
+)
+{
+    return ia_eudoxus_create_internal(out_eudoxus, data, 0);
+}
 
 ia_eudoxus_result_t ia_eudoxus_create_from_file(
     ia_eudoxus_t **out_eudoxus,
@@ -253,6 +288,86 @@ ia_eudoxus_result_t ia_eudoxus_create_from_path(
     return ia_eudoxus_create_from_file(out_eudoxus, fp);
 }
 
+ia_eudoxus_result_t ia_eudoxus_create_from_path_mapped(
+    ia_eudoxus_t **out_eudoxus,
+    const char    *path,
+    int            hints
+)
+{
+    const ia_eudoxus_automata_t *automata = NULL;
+    ia_eudoxus_result_t          rc       = IA_EUDOXUS_OK;
+    struct stat                  st;
+    size_t                       length   = 0;
+    int                          flags    = MAP_SHARED;
+    void                        *map      = MAP_FAILED;
+    int                          fd       = -1;
+
+    if (out_eudoxus == NULL || path == NULL) {
+        return IA_EUDOXUS_EINVAL;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return IA_EUDOXUS_END;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(*automata)) {
+        close(fd);
+        return IA_EUDOXUS_EINVAL;
+    }
+    length = (size_t)st.st_size;
+
+#ifdef MAP_POPULATE
+    if (hints & IA_EUDOXUS_MAP_PREFAULT) {
+        flags |= MAP_POPULATE;
+    }
+#endif
+
+    map = mmap(NULL, length, PROT_READ, flags, fd, 0);
+    /* The mapping keeps its own reference to the file. */
+    close(fd);
+    if (map == MAP_FAILED) {
+        return IA_EUDOXUS_EALLOC;
+    }
+    automata = (const ia_eudoxus_automata_t *)map;
+
+    if (
+        automata->data_length > length ||
+        automata->first_output > automata->data_length
+    ) {
+        rc = IA_EUDOXUS_EINVAL;
+        goto finish;
+    }
+
+    if (hints & IA_EUDOXUS_MAP_RANDOM) {
+        madvise(map, length, MADV_RANDOM);
+    }
+    if (hints & IA_EUDOXUS_MAP_WILLNEED) {
+        /* Nodes are at the front; outputs are only read on a match. */
+        madvise(map, automata->first_output, MADV_WILLNEED);
+    }
+#ifndef MAP_POPULATE
+    if (hints & IA_EUDOXUS_MAP_PREFAULT) {
+        long page_size = sysconf(_SC_PAGESIZE);
+        volatile char touch = 0;
+        size_t i;
+
+        for (i = 0; i < length; i += page_size) {
+            touch += ((const volatile char *)map)[i];
+        }
+    }
+#endif
+
+    rc = ia_eudoxus_create_internal(out_eudoxus, map, length);
+
+finish:
+    if (rc != IA_EUDOXUS_OK) {
+        munmap(map, length);
+    }
+
+    return rc;
+}
+
 void ia_eudoxus_destroy(
     ia_eudoxus_t *eudoxus
 )
@@ -264,7 +379,12 @@ void ia_eudoxus_destroy(
     /* Better to cast away const here than to not have const checks for
      * all uses. */
     if (eudoxus->automata) {
-        free((void *)eudoxus->automata);
+        if (eudoxus->mapped_length > 0) {
+            munmap((void *)eudoxus->automata, eudoxus->mapped_length);
+        }
+        else {
+            free((void *)eudoxus->automata);
+        }
     }
     if (eudoxus->error_message != NULL && eudoxus->free_error_message) {
         free((void *)eudoxus->error_message);
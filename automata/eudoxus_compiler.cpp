@@ -30,6 +30,7 @@
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 
+#include <algorithm>
 #include <queue>
 #include <set>
 
@@ -930,6 +931,27 @@ void Compiler<id_width>::compile(
         }
     }
 
+    // Page padding: start outputs on a fresh page.
+    {
+        // 0 is treated as 1, i.e., no page alignment.
+        size_t page_align = std::max(m_configuration.page_align, size_t(1));
+        size_t alignment = m_assembler.size() % page_align;
+        size_t padding = (
+            alignment == 0 ?
+            0 :
+            page_align - alignment
+        );
+        if (padding > 0) {
+            m_result.padding += padding;
+            for (size_t i = 0; i < padding; ++i) {
+                m_assembler.append_object(uint8_t(0xaa));
+            }
+        }
+        if (m_assembler.size() >= m_max_index) {
+            throw out_of_range("id_width too small");
+        }
+    }
+
     complete_outputs();
     append_outputs();
 
@@ -1017,6 +1039,7 @@ result_t compile_minimal(
 configuration_t::configuration_t() :
     id_width(0),
     align_to(1),
+    page_align(1),
     high_node_weight(1.0)
 {
     // nop
@@ -80,7 +80,8 @@ typedef enum ia_eudoxus_result_t ia_eudoxus_result_t;
  * A Eudoxus automata engine.
  *
  * An opaque data structure representing a Eudoxus engine.  It can be created
- * from file system (ia_eudoxus_create_from_path()), a FILE
+ * from file system (ia_eudoxus_create_from_path()), a read only shared
+ * mapping of a file (ia_eudoxus_create_from_path_mapped()), a FILE
  * (ia_eudoxus_create_from_file()), or a chunk of memory
  * (ia_eudoxus_create()).  When finished, it should be destroyed with
  * ia_eudoxus_destroy().  It can be used via ia_eudoxus_create_state().
@@ -154,6 +155,60 @@ ia_eudoxus_result_t ia_eudoxus_create_from_path(
     const char    *path
 );
 
+/**
+ * Hints for ia_eudoxus_create_from_path_mapped().
+ *
+ * Hints may be combined with bitwise or.
+ */
+enum ia_eudoxus_map_hint_t
+{
+    /** No hints; pages are read in as they are first used. */
+    IA_EUDOXUS_MAP_DEFAULT  = 0x00,
+
+    /** Ask the kernel to start reading in the nodes. */
+    IA_EUDOXUS_MAP_WILLNEED = 0x01,
+
+    /** Read in the entire automata before returning. */
+    IA_EUDOXUS_MAP_PREFAULT = 0x02,
+
+    /** Disable read ahead; execution jumps around the automata. */
+    IA_EUDOXUS_MAP_RANDOM   = 0x04
+};
+typedef enum ia_eudoxus_map_hint_t ia_eudoxus_map_hint_t;
+
+/**
+ * As ia_eudoxus_create_from_path(), but execute out of a mapping of the
+ * file.
+ *
+ * The file at @a path is mapped read only and shared, i.e., all processes
+ * that load the same automata share one physical copy of it via the page
+ * cache and loading does not read the file.  The mapping is released by
+ * ia_eudoxus_destroy().
+ *
+ * @attention The file must not be modified in place while mapped.  Replace
+ *            it by renaming a new file over it instead.
+ *
+ * Automata compiled with a @c page_align of the page size keep the nodes
+ * on their own pages which @a hints then apply to.
+ *
+ * @param[out] out_eudoxus Variable to hold pointer to created engine.
+ * @param[in]  path        Path to file on disk holding automata.
+ * @param[in]  hints       Bitwise or of @ref ia_eudoxus_map_hint_t values.
+ * @return
+ * - IA_EUDOXUS_END on failure to open file for reading.
+ * - IA_EUDOXUS_EINVAL if @a out_eudoxus or @a path is NULL or the file is
+ *   too short to hold its automata.
+ * - IA_EUDOXUS_EALLOC if the file can not be mapped.
+ * - Other codes as described in ia_eudoxus_create().
+ *
+ * @sa ia_eudoxus_t
+ */
+ia_eudoxus_result_t ia_eudoxus_create_from_path_mapped(
+    ia_eudoxus_t **out_eudoxus,
+    const char    *path,
+    int            hints
+);
+
 /**
  * Destroy engine @a eudoxus, releasing associated memory.
  *
@@ -51,6 +51,7 @@ struct configuration_t
      *
      * - id_width = 0, i.e., minimal.
      * - align_to = 1, i.e., no alignment
+     * - page_align = 1, i.e., no page alignment
      * - high_node_weight = 1.0, i.e., optimize space
      */
     configuration_t();
@@ -88,6 +89,21 @@ struct configuration_t
      */
     size_t align_to;
 
+    /**
+     * Align the end of the nodes to this value.
+     *
+     * This can be used to cause the compiler to insert padding after the
+     * last node so that the outputs, output lists, and metadata start on a
+     * new page.  When the automata is mapped into memory, see
+     * ia_eudoxus_create_from_path_mapped(), the nodes then occupy whole
+     * pages of their own which can be prefaulted or advised separately from
+     * the rarely accessed outputs.
+     *
+     * A value of 1 (or 0) indicates no alignment.  A useful value is the
+     * page size, usually 4096.
+     */
+    size_t page_align;
+
     /**
      * High Node Weight
      *
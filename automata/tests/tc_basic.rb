@@ -31,6 +31,21 @@ class TestBasic < Test::Unit::TestCase
     ac_test(words, text, "traditional")
   end
 
+  def test_mapped
+    words = ["he", "she", "his", "hers"]
+    text = "she saw his world as he saw hers..."
+
+    automata_test(words, ACGEN, "mapped") do |dir, eudoxus_path|
+      mapped_path = File.join(dir, "eudoxus_mapped")
+      result = system(EC, "-p", "4096", "-i", File.join(dir, "initial_automata"), "-o", mapped_path)
+      assert_block("EC failed.") {result}
+      assert(File.size(mapped_path) > 4096)
+
+      output_substrings = ee(mapped_path, dir, text, "input", "output", "auto", ["-m"])
+      assert_substrings_equal(substrings(words, text), output_substrings)
+    end
+  end
+
   def test_large
     n = 1000
 
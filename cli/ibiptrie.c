@@ -0,0 +1,88 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+/**
+ * @file ibiptrie.c
+ * @brief command line tool compiling network lists to IP trie images
+ *
+ * Usage: ibiptrie <image> <list>...
+ *
+ * The networks of all lists are compiled into a single image, for the
+ * LoadIPTrie directive of the iptrie module.
+ */
+
+#include "ironbee_config_auto.h"
+
+#include <ironbee/iptrie.h>
+#include <ironbee/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char *argv[])
+{
+    ib_iptrie_builder_t *builder;
+    ib_iptrie_t *trie;
+    ib_status_t rc;
+
+    if (argc < 3) {
+        fprintf(stderr, "Usage: ibiptrie <image> <list>...\n");
+        return EXIT_FAILURE;
+    }
+
+    rc = ib_iptrie_builder_create(&builder);
+    if (rc != IB_OK) {
+        fprintf(stderr, "Error creating builder: %s\n",
+                ib_status_to_string(rc));
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 2; i < argc; ++i) {
+        size_t line = 0;
+
+        rc = ib_iptrie_builder_add_file(builder, argv[i], &line);
+        if (rc == IB_EINVAL) {
+            fprintf(stderr, "%s:%zu: Invalid network.\n", argv[i], line);
+            ib_iptrie_builder_destroy(builder);
+            return EXIT_FAILURE;
+        }
+        else if (rc != IB_OK) {
+            fprintf(stderr, "%s: Error reading: %s\n",
+                    argv[i], ib_status_to_string(rc));
+            ib_iptrie_builder_destroy(builder);
+            return EXIT_FAILURE;
+        }
+    }
+
+    rc = ib_iptrie_builder_finish(builder, &trie);
+    ib_iptrie_builder_destroy(builder);
+    if (rc != IB_OK) {
+        fprintf(stderr, "Error building trie: %s\n", ib_status_to_string(rc));
+        return EXIT_FAILURE;
+    }
+
+    rc = ib_iptrie_write(trie, argv[1]);
+    if (rc != IB_OK) {
+        perror(argv[1]);
+        ib_iptrie_destroy(trie);
+        return EXIT_FAILURE;
+    }
+    printf("%s: %zu bytes\n", argv[1], ib_iptrie_size(trie));
+    ib_iptrie_destroy(trie);
+
+    return EXIT_SUCCESS;
+}
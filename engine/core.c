@@ -62,6 +62,7 @@
 #endif
 #include <fcntl.h>
 #include <inttypes.h>
+#include <sched.h>
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
@@ -279,6 +280,49 @@ static IB_PROVIDER_IFACE_TYPE(audit) core_audit_iface = {
 
 /* -- Logger API Implementations -- */
 
+/**
+ * Get the log file, opening it if required.
+ *
+ * @param[in] corecfg Main core configuration
+ *
+ * @returns The log file (stderr if the log file can't be opened).
+ */
+static FILE *core_log_file(ib_core_cfg_t *corecfg)
+{
+    /* Do we need to open the file? */
+    if (
+        corecfg->log_fp == NULL &&
+        corecfg->log_uri != NULL &&
+        *corecfg->log_uri != '\0'
+    ) {
+        /* If the URI looks like a file, try to open it. */
+        if (strncmp(corecfg->log_uri, "file://", 7) == 0) {
+            const char *path = corecfg->log_uri + 7;
+            corecfg->log_fp = fopen(path, "a");
+            if (corecfg->log_fp == NULL) {
+                fprintf(stderr,
+                        "Failed to open log file '%s' for writing: %s\n",
+                        path, strerror(errno));
+            }
+        }
+        else {
+            fprintf(
+                stderr,
+                "Only file:// log URIs current supported."
+            );
+        }
+    }
+
+    /* Finally, use stderr as a fallback. */
+    if (corecfg->log_fp == NULL) {
+        /* @todo Why fdup? */
+        corecfg->log_fp = ib_util_fdup(stderr, "a");
+        corecfg->log_uri = "stderr";
+    }
+
+    return corecfg->log_fp;
+}
+
 /**
  * Core data provider API implementation to log data via va_list args.
  *
@@ -305,8 +349,52 @@ void logger_vlogmsg(
 {
     ib_core_cfg_t *main_core_config = NULL;
     ib_context_t  *main_ctx = NULL;
+    ib_core_module_data_t *core_data;
     ib_status_t rc;
     ib_log_level_t logger_level = ib_log_get_level(ib);
+    static const size_t c_line_info_length = 35;
+    char line_info[c_line_info_length];
+
+    /* Check the log level, return if we're not interested. */
+    if (level > logger_level) {
+        return;
+    }
+
+    line_info[0] = '\0';
+    if ( (file != NULL) && (line > 0) && (logger_level >= IB_LOG_DEBUG)) {
+        while ( (file != NULL) && (strncmp(file, "../", 3) == 0) ) {
+            file += 3;
+        }
+
+        snprintf(
+            line_info,
+            c_line_info_length,
+            "(%23s:%-5d)",
+            file,
+            line
+        );
+    }
+
+    /* Hand the message to the asynchronous logger if there is one.  The
+     * user count keeps it alive until core_log_writer_vlog() returns. */
+    rc = ib_core_module_data(NULL, &core_data);
+    if (rc == IB_OK) {
+        core_log_writer_t *log_writer;
+
+        __atomic_fetch_add(&core_data->log_writer_users, 1, __ATOMIC_SEQ_CST);
+        log_writer = __atomic_load_n(&core_data->log_writer, __ATOMIC_SEQ_CST);
+        if (log_writer != NULL) {
+            va_list aq;
+
+            va_copy(aq, ap);
+            rc = core_log_writer_vlog(log_writer, level, line_info, fmt, aq);
+            va_end(aq);
+        }
+        __atomic_fetch_sub(&core_data->log_writer_users, 1, __ATOMIC_SEQ_CST);
+        if ( (log_writer != NULL) && (rc == IB_OK) ) {
+            return;
+        }
+    }
 
     /* Get the core context core configuration. */
     main_ctx = ib_context_main(ib);
@@ -324,46 +412,10 @@ void logger_vlogmsg(
         main_core_config = &core_global_cfg;
     }
 
-    /* Check the log level, return if we're not interested. */
-    if (level > logger_level) {
-        return;
-    }
-
-    /* Do we need to open the file? */
-    if (
-        main_core_config->log_fp == NULL &&
-        main_core_config->log_uri != NULL &&
-        *main_core_config->log_uri != '\0'
-    ) {
-        /* If the URI looks like a file, try to open it. */
-        if (strncmp(main_core_config->log_uri, "file://", 7) == 0) {
-            const char *path = main_core_config->log_uri + 7;
-            main_core_config->log_fp = fopen(path, "a");
-            if (main_core_config->log_fp == NULL) {
-                fprintf(stderr,
-                        "Failed to open log file '%s' for writing: %s\n",
-                        path, strerror(errno));
-            }
-        }
-        else {
-            fprintf(
-                stderr,
-                "Only file:// log URIs current supported."
-            );
-        }
-    }
-
-    /* Finally, use stderr as a fallback. */
-    if (main_core_config->log_fp == NULL) {
-        /* @todo Why fdup? */
-        main_core_config->log_fp = ib_util_fdup(stderr, "a");
-        main_core_config->log_uri = "stderr";
-    }
+    core_log_file(main_core_config);
 
     /* Compose message */
     {
-        static const size_t c_line_info_length = 35;
-        char line_info[c_line_info_length];
         size_t new_fmt_length = 0;
         char *new_fmt = NULL;
         const char *which_fmt;
@@ -371,21 +423,6 @@ void logger_vlogmsg(
 
         ib_clock_timestamp(time_info, NULL);
 
-        line_info[0] = '\0';
-        if ( (file != NULL) && (line > 0) && (logger_level >= IB_LOG_DEBUG)) {
-            while ( (file != NULL) && (strncmp(file, "../", 3) == 0) ) {
-                file += 3;
-            }
-
-            snprintf(
-                line_info,
-                c_line_info_length,
-                "(%23s:%-5d)",
-                file,
-                line
-            );
-        }
-
         new_fmt_length = strlen(line_info) + strlen(time_info) + strlen(fmt)  + 110;
         new_fmt = (char *)malloc(new_fmt_length);
         if (new_fmt == NULL) {
@@ -461,7 +498,9 @@ static ib_status_t audit_api_write_log(ib_provider_inst_t *lpi)
     IB_PROVIDER_IFACE_TYPE(audit) *iface =
         (IB_PROVIDER_IFACE_TYPE(audit) *)lpi->pr->iface;
     ib_auditlog_t *log = (ib_auditlog_t *)lpi->data;
+    ib_core_module_data_t *core_data;
     ib_list_node_t *node;
+    bool lock;
     ib_status_t rc;
 
     if (ib_list_elements(log->parts) == 0) {
@@ -469,19 +508,25 @@ static ib_status_t audit_api_write_log(ib_provider_inst_t *lpi)
         return IB_EINVAL;
     }
 
+    /* The asynchronous writer serializes the log in memory, so there's no
+     * need to hold the index lock while writing it. */
+    rc = ib_core_module_data(NULL, &core_data);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    lock = (log->ctx->auditlog->index != NULL) &&
+           (core_data->audit_writer == NULL);
+
     /* Open the log if required. This is thread safe. */
     if (iface->open != NULL) {
         rc = iface->open(lpi, log);
         if (rc != IB_OK) {
-            if (log->ctx->auditlog->index != NULL) {
-                ib_lock_unlock(&log->ctx->auditlog->index_fp_lock);
-            }
             return rc;
         }
     }
 
     /* Lock to write. */
-    if (log->ctx->auditlog->index != NULL) {
+    if (lock) {
         rc = ib_lock_lock(&log->ctx->auditlog->index_fp_lock);
         if (rc != IB_OK) {
             ib_log_error(lpi->pr->ib, "Cannot lock %s for write.",
@@ -494,7 +539,9 @@ static ib_status_t audit_api_write_log(ib_provider_inst_t *lpi)
     if (iface->write_header != NULL) {
         rc = iface->write_header(lpi, log);
         if (rc != IB_OK) {
-            ib_lock_unlock(&log->ctx->auditlog->index_fp_lock);
+            if (lock) {
+                ib_lock_unlock(&log->ctx->auditlog->index_fp_lock);
+            }
             return rc;
         }
     }
@@ -514,7 +561,7 @@ static ib_status_t audit_api_write_log(ib_provider_inst_t *lpi)
     if (iface->write_footer != NULL) {
         rc = iface->write_footer(lpi, log);
         if (rc != IB_OK) {
-            if (log->ctx->auditlog->index != NULL) {
+            if (lock) {
                 ib_lock_unlock(&log->ctx->auditlog->index_fp_lock);
             }
             return rc;
@@ -522,7 +569,7 @@ static ib_status_t audit_api_write_log(ib_provider_inst_t *lpi)
     }
 
     /* Writing is done. Unlock. Close is thread-safe. */
-    if (log->ctx->auditlog->index != NULL) {
+    if (lock) {
         ib_lock_unlock(&log->ctx->auditlog->index_fp_lock);
     }
 
@@ -2852,6 +2899,27 @@ ib_status_t ib_core_module_data(ib_module_t **core_module,
     return IB_OK;
 }
 
+ib_status_t ib_core_auditlog_stats(const ib_engine_t *ib,
+                                   ib_auditlog_stats_t *stats)
+{
+    assert(ib != NULL);
+    assert(stats != NULL);
+
+    ib_core_module_data_t *core_data;
+    ib_status_t rc;
+
+    rc = ib_core_module_data(NULL, &core_data);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    if (core_data->audit_writer == NULL) {
+        return IB_ENOENT;
+    }
+
+    core_audit_writer_stats(core_data->audit_writer, stats);
+    return IB_OK;
+}
+
 
 /* -- Directive Handlers -- */
 
@@ -3788,6 +3856,65 @@ static ib_status_t core_dir_param1(ib_cfgparser_t *cp,
         rc = ib_context_set_string(ctx, "auditlog_sdir_fmt", p1_unescaped);
         return rc;
     }
+    else if (strcasecmp("AuditLogWriter", name) == 0) {
+        ib_log_debug2(ib, "%s: \"%s\" ctx=%p", name, p1_unescaped, ctx);
+        if (strcasecmp("Sync", p1_unescaped) == 0) {
+            rc = ib_context_set_num(ctx, "auditlog_async", 0);
+            return rc;
+        }
+        else if (strcasecmp("Async", p1_unescaped) == 0) {
+            rc = ib_context_set_num(ctx, "auditlog_async", 1);
+            return rc;
+        }
+
+        ib_log_error(ib,
+                     "Failed to parse directive: %s \"%s\"",
+                     name,
+                     p1_unescaped);
+        return IB_EINVAL;
+    }
+    else if (strcasecmp("AuditLogQueueOverflow", name) == 0) {
+        ib_log_debug2(ib, "%s: \"%s\" ctx=%p", name, p1_unescaped, ctx);
+        if (strcasecmp("Block", p1_unescaped) == 0) {
+            rc = ib_context_set_num(ctx, "auditlog_queue_overflow",
+                                    CORE_AUDIT_OVERFLOW_BLOCK);
+            return rc;
+        }
+        else if (strcasecmp("Drop", p1_unescaped) == 0) {
+            rc = ib_context_set_num(ctx, "auditlog_queue_overflow",
+                                    CORE_AUDIT_OVERFLOW_DROP);
+            return rc;
+        }
+        else if (strcasecmp("Spill", p1_unescaped) == 0) {
+            rc = ib_context_set_num(ctx, "auditlog_queue_overflow",
+                                    CORE_AUDIT_OVERFLOW_SPILL);
+            return rc;
+        }
+
+        ib_log_error(ib,
+                     "Failed to parse directive: %s \"%s\"",
+                     name,
+                     p1_unescaped);
+        return IB_EINVAL;
+    }
+    else if ( (strcasecmp("AuditLogQueueSize", name) == 0) ||
+              (strcasecmp("AuditLogSegmentSize", name) == 0) )
+    {
+        ib_num_t size;
+        rc = ib_string_to_num(p1_unescaped, 0, &size);
+        if ( (rc != IB_OK) || (size <= 0) ) {
+            ib_log_error(ib, "Invalid size: %s \"%s\"", name, p1_unescaped);
+            return IB_EINVAL;
+        }
+        ib_log_debug2(ib, "%s: \"%s\" ctx=%p", name, p1_unescaped, ctx);
+        if (strcasecmp("AuditLogQueueSize", name) == 0) {
+            rc = ib_context_set_num(ctx, "auditlog_queue_size", size);
+        }
+        else {
+            rc = ib_context_set_num(ctx, "auditlog_segment_size", size);
+        }
+        return rc;
+    }
     /* Set the default block status for responding to blocked transactions. */
     else if (strcasecmp("DefaultBlockStatus", name) == 0) {
         int status;
@@ -3843,6 +3970,23 @@ static ib_status_t core_dir_param1(ib_cfgparser_t *cp,
         rc = ib_context_set_string(ctx, "logger.log_uri", uri);
         return rc;
     }
+    else if (strcasecmp("LogWriter", name) == 0) {
+        ib_log_debug2(ib, "%s: \"%s\" ctx=%p", name, p1_unescaped, ctx);
+        if (strcasecmp("Sync", p1_unescaped) == 0) {
+            rc = ib_context_set_num(ctx, "logger.log_async", 0);
+            return rc;
+        }
+        else if (strcasecmp("Async", p1_unescaped) == 0) {
+            rc = ib_context_set_num(ctx, "logger.log_async", 1);
+            return rc;
+        }
+
+        ib_log_error(ib,
+                     "Failed to parse directive: %s \"%s\"",
+                     name,
+                     p1_unescaped);
+        return IB_EINVAL;
+    }
     else if (strcasecmp("LoadModule", name) == 0) {
         char *absfile;
         ib_module_t *m;
@@ -4641,6 +4785,11 @@ static IB_DIRMAP_INIT_STRUCTURE(core_directive_map) = {
         core_dir_param1,
         NULL
     ),
+    IB_DIRMAP_INIT_PARAM1(
+        "LogWriter",
+        core_dir_param1,
+        NULL
+    ),
 
     /* Config */
     IB_DIRMAP_INIT_SBLK1(
@@ -4716,6 +4865,26 @@ static IB_DIRMAP_INIT_STRUCTURE(core_directive_map) = {
         core_dir_param1,
         NULL
     ),
+    IB_DIRMAP_INIT_PARAM1(
+        "AuditLogWriter",
+        core_dir_param1,
+        NULL
+    ),
+    IB_DIRMAP_INIT_PARAM1(
+        "AuditLogQueueSize",
+        core_dir_param1,
+        NULL
+    ),
+    IB_DIRMAP_INIT_PARAM1(
+        "AuditLogQueueOverflow",
+        core_dir_param1,
+        NULL
+    ),
+    IB_DIRMAP_INIT_PARAM1(
+        "AuditLogSegmentSize",
+        core_dir_param1,
+        NULL
+    ),
     IB_DIRMAP_INIT_OPFLAGS(
         "AuditLogParts",
         core_dir_auditlogparts,
@@ -4816,6 +4985,7 @@ static ib_status_t core_init(ib_engine_t *ib,
     /* Set defaults */
     corecfg->log_level            = 4;
     corecfg->log_uri              = "";
+    corecfg->log_async            = 0;
     corecfg->logevent             = MODULE_NAME_STR;
     corecfg->parser               = MODULE_NAME_STR;
     corecfg->buffer_req           = 0;
@@ -4827,6 +4997,10 @@ static ib_status_t core_init(ib_engine_t *ib,
     corecfg->auditlog_dir         = "/var/log/ironbee";
     corecfg->auditlog_sdir_fmt    = "";
     corecfg->auditlog_index_fmt   = IB_LOGFORMAT_DEFAULT;
+    corecfg->auditlog_async       = 0;
+    corecfg->auditlog_queue_size  = 1024;
+    corecfg->auditlog_queue_overflow = CORE_AUDIT_OVERFLOW_BLOCK;
+    corecfg->auditlog_segment_size = 64 * 1024 * 1024;
     corecfg->audit                = MODULE_NAME_STR;
     corecfg->data                 = MODULE_NAME_STR;
     corecfg->module_base_path     = X_MODULE_BASE_PATH;
@@ -5058,6 +5232,7 @@ ib_status_t core_finish(
 )
 {
     ib_core_cfg_t *corecfg;
+    ib_core_module_data_t *core_data;
     ib_status_t rc;
 
     /* Get the core module config. */
@@ -5068,6 +5243,27 @@ ib_status_t core_finish(
         return rc;
     }
 
+    /* Write out any queued audit logs */
+    rc = ib_core_module_data(NULL, &core_data);
+    if ( (rc == IB_OK) && (core_data->audit_writer != NULL) ) {
+        core_audit_writer_destroy(core_data->audit_writer);
+        core_data->audit_writer = NULL;
+    }
+
+    /* Write out any buffered log messages; log synchronously from now on.
+     * Threads still in core_log_writer_vlog() are waited for first. */
+    if ( (rc == IB_OK) && (core_data->log_writer != NULL) ) {
+        core_log_writer_t *log_writer = core_data->log_writer;
+
+        __atomic_store_n(&core_data->log_writer, NULL, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&core_data->log_writer_users,
+                               __ATOMIC_SEQ_CST) > 0)
+        {
+            sched_yield();
+        }
+        core_log_writer_destroy(log_writer);
+    }
+
     if (corecfg->log_fp != NULL && strcmp(corecfg->log_uri, "stderr") != 0) {
         fclose(corecfg->log_fp);
     }
@@ -5099,6 +5295,12 @@ static IB_CFGMAP_INIT_STRUCTURE(core_config_map) = {
         ib_core_cfg_t,
         log_uri
     ),
+    IB_CFGMAP_INIT_ENTRY(
+        "logger.log_async",
+        IB_FTYPE_NUM,
+        ib_core_cfg_t,
+        log_async
+    ),
 
     /* Logevent */
     IB_CFGMAP_INIT_ENTRY(
@@ -5193,6 +5395,30 @@ static IB_CFGMAP_INIT_STRUCTURE(core_config_map) = {
         ib_core_cfg_t,
         auditlog_sdir_fmt
     ),
+    IB_CFGMAP_INIT_ENTRY(
+        "auditlog_async",
+        IB_FTYPE_NUM,
+        ib_core_cfg_t,
+        auditlog_async
+    ),
+    IB_CFGMAP_INIT_ENTRY(
+        "auditlog_queue_size",
+        IB_FTYPE_NUM,
+        ib_core_cfg_t,
+        auditlog_queue_size
+    ),
+    IB_CFGMAP_INIT_ENTRY(
+        "auditlog_queue_overflow",
+        IB_FTYPE_NUM,
+        ib_core_cfg_t,
+        auditlog_queue_overflow
+    ),
+    IB_CFGMAP_INIT_ENTRY(
+        "auditlog_segment_size",
+        IB_FTYPE_NUM,
+        ib_core_cfg_t,
+        auditlog_segment_size
+    ),
     IB_CFGMAP_INIT_ENTRY(
         "auditlog_index_fmt",
         IB_FTYPE_NULSTR,
@@ -5294,6 +5520,48 @@ static ib_status_t core_ctx_close(ib_engine_t  *ib,
         }
     }
 
+    /* Start the asynchronous logger once configuration is done */
+    if ( (ib_context_type(ctx) == IB_CTYPE_MAIN) &&
+         (corecfg->log_async != 0) )
+    {
+        ib_core_module_data_t *core_data;
+
+        rc = ib_core_module_data(NULL, &core_data);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        if (core_data->log_writer == NULL) {
+            rc = core_log_writer_create(core_log_file(corecfg),
+                                        &(core_data->log_writer));
+            if (rc != IB_OK) {
+                ib_log_alert(ib, "Failed to start asynchronous logger: %s",
+                             ib_status_to_string(rc));
+                return rc;
+            }
+        }
+    }
+
+    /* Start the asynchronous audit log writer once configuration is done */
+    if ( (ib_context_type(ctx) == IB_CTYPE_MAIN) &&
+         (corecfg->auditlog_async != 0) )
+    {
+        ib_core_module_data_t *core_data;
+
+        rc = ib_core_module_data(NULL, &core_data);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        if (core_data->audit_writer == NULL) {
+            rc = core_audit_writer_create(ib, corecfg,
+                                          &(core_data->audit_writer));
+            if (rc != IB_OK) {
+                ib_log_alert(ib, "Failed to start audit log writer: %s",
+                             ib_status_to_string(rc));
+                return rc;
+            }
+        }
+    }
+
     return IB_OK;
 }
 
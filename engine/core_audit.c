@@ -383,6 +383,7 @@ ib_status_t core_audit_open(ib_provider_inst_t *lpi,
 {
     core_audit_cfg_t *cfg = (core_audit_cfg_t *)log->cfg_data;
     ib_core_cfg_t *corecfg;
+    ib_core_module_data_t *core_data;
     ib_status_t rc;
 
     /* Non const struct we will build and then assign to
@@ -403,6 +404,12 @@ ib_status_t core_audit_open(ib_provider_inst_t *lpi,
 
     assert(NULL != corecfg);
 
+    rc = ib_core_module_data(NULL, &core_data);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    cfg->writer = core_data->audit_writer;
+
     /* Copy the FILE* into the core_audit_cfg_t. */
     if (log->ctx->auditlog->index_fp != NULL) {
         cfg->index_fp = log->ctx->auditlog->index_fp;
@@ -423,6 +430,16 @@ ib_status_t core_audit_open(ib_provider_inst_t *lpi,
         }
     }
 
+    /* With the asynchronous writer, the audit log is written to memory and
+     * queued for the writer at close. */
+    if ( (cfg->fp == NULL) && (cfg->writer != NULL) ) {
+        cfg->fp = open_memstream(&cfg->buf, &cfg->buf_len);
+        if (cfg->fp == NULL) {
+            ib_log_error(log->ib,  "Failed to open audit log buffer.");
+            return IB_EALLOC;
+        }
+    }
+
     /* Open audit file that contains the record identified by the line
      * written in index_fp. */
     if (cfg->fp == NULL) {
@@ -485,7 +502,6 @@ ib_status_t core_audit_write_header(ib_provider_inst_t *lpi,
         ib_log_error(lpi->pr->ib,  "Failed to write audit log header");
         return IB_EUNKNOWN;
     }
-    fflush(cfg->fp);
 
     return IB_OK;
 }
@@ -519,9 +535,6 @@ ib_status_t core_audit_write_part(ib_provider_inst_t *lpi,
         cfg->parts_written++;
     }
 
-    /* Finish the part. */
-    fflush(cfg->fp);
-
     return IB_OK;
 }
 
@@ -644,6 +657,208 @@ static ib_status_t core_audit_get_index_line(ib_provider_inst_t *lpi,
     return rc;
 }
 
+/**
+ * Format the index line of an audit log for the asynchronous writer.
+ *
+ * This is core_audit_get_index_line() without the log file (%f) fields,
+ * whose offsets in the line are returned instead: the writer fills them in
+ * once it knows where the audit log was written.
+ *
+ * @param[in] log Audit log
+ * @param[out] line Line buffer
+ * @param[in] line_size Size of @a line
+ * @param[out] line_len Length of the line
+ * @param[out] file_fields Offsets of the log file fields
+ * @param[out] num_file_fields Number of log file fields
+ *
+ * @returns IB_OK, IB_ETRUNC if the line was truncated, or other errors.
+ */
+static ib_status_t core_audit_get_async_index_line(ib_auditlog_t *log,
+                                                   char *line,
+                                                   size_t line_size,
+                                                   size_t *line_len,
+                                                   size_t *file_fields,
+                                                   size_t *num_file_fields)
+{
+    assert(log != NULL);
+    assert(line != NULL);
+    assert(line_len != NULL);
+    assert(file_fields != NULL);
+    assert(num_file_fields != NULL);
+
+    core_audit_cfg_t *cfg = (core_audit_cfg_t *)log->cfg_data;
+    ib_core_cfg_t *corecfg;
+    const ib_site_t *site;
+    const ib_logformat_t *lf;
+    const ib_list_node_t *node;
+    auditlog_callback_data_t cbdata;
+    size_t cur = 0;
+    bool truncated = false;
+    ib_status_t rc;
+
+    rc = ib_context_site_get(log->ctx, &site);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    rc = ib_context_module_config(log->ctx, ib_core_module(),
+                                  (void *)&corecfg);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    lf = corecfg->auditlog_index_hp;
+
+    cbdata.cfg = cfg;
+    cbdata.log = log;
+    cbdata.tx = log->tx;
+    cbdata.conn = log->tx->conn;
+    cbdata.site = site;
+
+    *num_file_fields = 0;
+    IB_LIST_LOOP_CONST(lf->items, node) {
+        const ib_logformat_item_t *item =
+            (const ib_logformat_item_t *)ib_list_node_data_const(node);
+        const char *str;
+        size_t len;
+
+        if (item->itype == item_type_literal) {
+            len = item->item.literal.len;
+            if (len <= IB_LOGFORMAT_MAX_SHORT_LITERAL) {
+                str = item->item.literal.buf.short_str;
+            }
+            else {
+                str = item->item.literal.buf.str;
+            }
+        }
+        else if (item->item.field.fchar == IB_LOG_FIELD_LOG_FILE) {
+            if (*num_file_fields < CORE_AUDIT_MAX_FILE_FIELDS) {
+                file_fields[(*num_file_fields)++] = cur;
+            }
+            continue;
+        }
+        else {
+            rc = audit_add_line_item(lf, &(item->item.field), &cbdata, &str);
+            if (rc != IB_OK) {
+                return rc;
+            }
+            len = strlen(str);
+        }
+
+        if (len > line_size - cur) {
+            len = line_size - cur;
+            truncated = true;
+        }
+        memcpy(line + cur, str, len);
+        cur += len;
+    }
+
+    *line_len = cur;
+    return truncated ? IB_ETRUNC : IB_OK;
+}
+
+/**
+ * Queue an audit log written to memory for the asynchronous writer.
+ *
+ * @param[in] log Audit log
+ * @param[in] cfg Core audit configuration
+ * @param[in] corecfg Core configuration
+ * @param[in] line Buffer of LOGFORMAT_MAX_LINE_LENGTH for the index line
+ *
+ * @returns
+ * - IB_OK if the audit log was queued (or dropped).
+ * - IB_EAGAIN if the queue is full and it should be written synchronously.
+ * - Other errors.
+ */
+static ib_status_t core_audit_close_async(ib_auditlog_t *log,
+                                          core_audit_cfg_t *cfg,
+                                          const ib_core_cfg_t *corecfg,
+                                          char *line)
+{
+    core_audit_record_t *record;
+    size_t file_fields[CORE_AUDIT_MAX_FILE_FIELDS];
+    size_t num_file_fields = 0;
+    size_t len = 0;
+    bool indexed = false;
+    ib_status_t rc;
+
+    /* Closing the stream finalizes the buffer. */
+    if (cfg->fp != NULL) {
+        fclose(cfg->fp);
+        cfg->fp = NULL;
+    }
+    if (cfg->buf == NULL) {
+        return IB_EALLOC;
+    }
+
+    if ((cfg->index_fp != NULL) && (cfg->parts_written > 0)) {
+        rc = core_audit_get_async_index_line(log, line,
+                                             LOGFORMAT_MAX_LINE_LENGTH, &len,
+                                             file_fields, &num_file_fields);
+        if ( (rc != IB_ETRUNC) && (rc != IB_OK) ) {
+            return rc;
+        }
+        indexed = true;
+    }
+
+    rc = core_audit_record_create(cfg->buf, cfg->buf_len,
+                                  corecfg->auditlog_dir, cfg->tx->id,
+                                  indexed ? log->ctx->auditlog : NULL,
+                                  indexed ? line : NULL, len,
+                                  &record);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    memcpy(record->file_fields, file_fields, sizeof(file_fields));
+    record->num_file_fields = num_file_fields;
+
+    rc = core_audit_writer_submit(cfg->writer, record);
+    if (rc == IB_EAGAIN) {
+        /* Keep the buffer for the synchronous write. */
+        record->data = NULL;
+        core_audit_record_destroy(record);
+        return rc;
+    }
+
+    cfg->buf = NULL;
+    return rc;
+}
+
+/**
+ * Write an audit log written to memory to its own audit log file.
+ *
+ * This is used when the asynchronous writer's queue is full.  The file is
+ * then closed and indexed as it would be without the asynchronous writer.
+ *
+ * @param[in] lpi Audit provider instance
+ * @param[in] log Audit log
+ * @param[in] cfg Core audit configuration
+ * @param[in] corecfg Core configuration
+ *
+ * @returns IB_OK or errors from core_audit_open_auditfile().
+ */
+static ib_status_t core_audit_spill(ib_provider_inst_t *lpi,
+                                    ib_auditlog_t *log,
+                                    core_audit_cfg_t *cfg,
+                                    ib_core_cfg_t *corecfg)
+{
+    ib_status_t rc;
+
+    rc = core_audit_open_auditfile(lpi, log, cfg, corecfg);
+    if (rc != IB_OK) {
+        ib_log_error(log->ib,  "Failed to open audit log file.");
+        return rc;
+    }
+
+    if ( (cfg->buf_len > 0) &&
+         (fwrite(cfg->buf, cfg->buf_len, 1, cfg->fp) != 1) )
+    {
+        ib_log_error(log->ib,  "Failed to write audit log");
+    }
+    free(cfg->buf);
+    cfg->buf = NULL;
+
+    return IB_OK;
+}
+
 ib_status_t core_audit_close(ib_provider_inst_t *lpi, ib_auditlog_t *log)
 {
     core_audit_cfg_t *cfg = (core_audit_cfg_t *)log->cfg_data;
@@ -668,6 +883,21 @@ ib_status_t core_audit_close(ib_provider_inst_t *lpi, ib_auditlog_t *log)
         goto cleanup;
     }
 
+    /* Queue the audit log for the asynchronous writer. */
+    if (cfg->writer != NULL) {
+        ib_rc = core_audit_close_async(log, cfg, corecfg, line);
+        if (ib_rc != IB_EAGAIN) {
+            goto cleanup;
+        }
+
+        /* The queue is full (or the process has forked), so write it to
+         * its own file. */
+        ib_rc = core_audit_spill(lpi, log, cfg, corecfg);
+        if (ib_rc != IB_OK) {
+            goto cleanup;
+        }
+    }
+
     /* Close the audit log. */
     if (cfg->fp != NULL) {
         fclose(cfg->fp);
@@ -727,5 +957,9 @@ cleanup:
     if (line != NULL) {
         free(line);
     }
+    if (cfg->buf != NULL) {
+        free(cfg->buf);
+        cfg->buf = NULL;
+    }
     return ib_rc;
 }
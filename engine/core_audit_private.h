@@ -29,6 +29,8 @@
 
 #include <stdio.h>
 
+struct ib_auditlog_cfg_t;
+
 /* -- Audit Provider -- */
 
 /**
@@ -46,8 +48,10 @@
  */
 #define IB_AUDITLOG_VERSION 201212210
 
-/* Forward define this structure. */
+/* Forward define these structures. */
 typedef struct core_audit_cfg_t core_audit_cfg_t;
+typedef struct core_audit_writer_t core_audit_writer_t;
+typedef struct core_audit_record_t core_audit_record_t;
 
 /**
  * Core audit configuration structure
@@ -55,6 +59,9 @@ typedef struct core_audit_cfg_t core_audit_cfg_t;
 struct core_audit_cfg_t {
     FILE           *index_fp;       /**< Index file pointer */
     FILE           *fp;             /**< Audit log file pointer */
+    core_audit_writer_t *writer;    /**< Asynchronous writer / NULL */
+    char           *buf;            /**< Audit log buffer (asynchronous) */
+    size_t          buf_len;        /**< Length of buf */
     const char     *fn;             /**< Audit log file name */
     const char     *full_path;      /**< Audit log full path */
     const char     *temp_path;      /**< Full path to temporary filename */
@@ -131,4 +138,133 @@ ib_status_t core_audit_write_footer(ib_provider_inst_t *lpi,
 
 ib_status_t core_audit_close(ib_provider_inst_t *lpi, ib_auditlog_t *log);
 
+/* -- Asynchronous Audit Log Writer -- */
+
+/** Maximum number of log file fields (%f) in an asynchronous index line */
+#define CORE_AUDIT_MAX_FILE_FIELDS 4
+
+/**
+ * Audit log queue overflow policies (AuditLogQueueOverflow).
+ */
+typedef enum {
+    CORE_AUDIT_OVERFLOW_BLOCK,      /**< Wait for space in the queue */
+    CORE_AUDIT_OVERFLOW_DROP,       /**< Drop the audit log */
+    CORE_AUDIT_OVERFLOW_SPILL,      /**< Write the audit log synchronously */
+} core_audit_overflow_t;
+
+/**
+ * A serialized audit log handed to the asynchronous writer.
+ *
+ * Records outlive their transaction, so they are allocated with malloc()
+ * rather than from a memory pool.  @a data is owned by the record; the index
+ * line and transaction ID are stored in the same allocation as the record.
+ */
+struct core_audit_record_t {
+    char           *data;           /**< Audit log (malloc'd) */
+    size_t          data_len;       /**< Length of data */
+    const char     *dir;            /**< Audit log base directory */
+    const char     *tx_id;          /**< Transaction ID */
+    struct ib_auditlog_cfg_t *auditlog; /**< Index file config / NULL */
+    const char     *index_line;     /**< Index line without %f / NULL */
+    size_t          index_len;      /**< Length of index_line */
+    size_t          num_file_fields; /**< Number of %f fields */
+    /** Offsets of the %f fields in index_line */
+    size_t          file_fields[CORE_AUDIT_MAX_FILE_FIELDS];
+};
+
+/**
+ * Create an audit log record.
+ *
+ * @param[in] data Audit log; ownership passes to the record on success
+ * @param[in] data_len Length of @a data
+ * @param[in] dir Audit log base directory (must outlive the record)
+ * @param[in] tx_id Transaction ID
+ * @param[in] auditlog Index file config or NULL (must outlive the record)
+ * @param[in] index_line Index line without the %f fields, or NULL
+ * @param[in] index_len Length of @a index_line
+ * @param[out] precord The new record
+ *
+ * @returns IB_OK or IB_EALLOC.
+ */
+ib_status_t core_audit_record_create(char *data,
+                                     size_t data_len,
+                                     const char *dir,
+                                     const char *tx_id,
+                                     struct ib_auditlog_cfg_t *auditlog,
+                                     const char *index_line,
+                                     size_t index_len,
+                                     core_audit_record_t **precord);
+
+/**
+ * Destroy an audit log record and its data.
+ *
+ * @param[in] record Record to destroy
+ */
+void core_audit_record_destroy(core_audit_record_t *record);
+
+/**
+ * Create and start the asynchronous audit log writer.
+ *
+ * The writer takes records from a bounded lock-free queue on its own
+ * thread and appends them in batches to segment files in the record's
+ * audit log base directory, with one writev() per batch.  Each segment
+ * has a companion index (the segment name with a ".index" suffix) with a
+ * line for each record: "offset length transaction-id".  If the record has
+ * an index line, it is written to the AuditLogIndex file with the log file
+ * fields set to "segment:offset".
+ *
+ * @param[in] ib Engine
+ * @param[in] corecfg Main context core configuration
+ * @param[out] pwriter The new writer
+ *
+ * @returns IB_OK, IB_EALLOC or IB_EUNKNOWN if the thread can't be started.
+ */
+ib_status_t core_audit_writer_create(ib_engine_t *ib,
+                                     const ib_core_cfg_t *corecfg,
+                                     core_audit_writer_t **pwriter);
+
+/**
+ * Write all queued records, stop the writer and destroy it.
+ *
+ * No records may be submitted during or after this call.  In a process
+ * forked after the writer was created, the records queued before the fork
+ * are discarded: they are written by the parent.
+ *
+ * @param[in] writer Writer to destroy
+ */
+void core_audit_writer_destroy(core_audit_writer_t *writer);
+
+/**
+ * Queue a record for writing.
+ *
+ * If the queue is full, the writer's overflow policy applies: the caller
+ * blocks until there is space, the record is dropped, or IB_EAGAIN is
+ * returned so the caller can write the record synchronously.
+ *
+ * In a process forked after the writer was created, there is no writer
+ * thread and IB_EAGAIN is always returned.
+ *
+ * This is thread-safe.
+ *
+ * @param[in] writer Writer
+ * @param[in] record Record; owned by the writer unless IB_EAGAIN is
+ *            returned
+ *
+ * @returns
+ * - IB_OK if the record was queued or dropped.
+ * - IB_EAGAIN if the queue is full and the policy is to spill, or the
+ *   process has forked.
+ */
+ib_status_t core_audit_writer_submit(core_audit_writer_t *writer,
+                                     core_audit_record_t *record);
+
+/**
+ * Get the writer's statistics.
+ *
+ * @param[in] writer Writer
+ * @param[out] stats Statistics
+ */
+void core_audit_writer_stats(const core_audit_writer_t *writer,
+                             ib_auditlog_stats_t *stats);
+
 #endif // _IB_CORE_AUDIT_PRIVATE_H_
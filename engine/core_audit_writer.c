@@ -0,0 +1,957 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+/**
+ * @file
+ * @brief IronBee --- Asynchronous Audit Log Writer
+ *
+ * Transactions serialize their audit logs into memory and queue them on a
+ * bounded lock-free multi-producer / single-consumer ring.  A dedicated
+ * writer thread drains the ring in batches and appends each batch to the
+ * current segment file with a single writev(), followed by the segment's
+ * companion index and the AuditLogIndex lines.  Request threads never do
+ * file I/O or take the index lock (unless the queue overflows and the
+ * policy is to spill).
+ */
+
+#include "ironbee_config_auto.h"
+
+#include "core_audit_private.h"
+#include "engine_private.h"
+
+#include <ironbee/engine.h>
+#include <ironbee/path.h>
+#include <ironbee/util.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* POSIX doesn't define O_BINARY */
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/** Maximum number of records written in a batch */
+#define CORE_AUDIT_BATCH_MAX 64
+
+/** Maximum length of a companion index line */
+#define CORE_AUDIT_SEGMENT_INDEX_MAX 128
+
+/** Time the writer waits for records before checking for shutdown (ms) */
+#define CORE_AUDIT_IDLE_WAIT_MS 100
+
+/** Time a blocked submitter waits before retrying (us) */
+#define CORE_AUDIT_BLOCK_WAIT_US 50
+
+/** Queue slot */
+typedef struct {
+    size_t               seq;       /**< Sequence number (see below) */
+    core_audit_record_t *record;    /**< Record in the slot */
+} core_audit_slot_t;
+
+/** Open segment file for an audit log base directory */
+typedef struct core_audit_segment_t core_audit_segment_t;
+struct core_audit_segment_t {
+    core_audit_segment_t *next;     /**< Next segment */
+    char                 *dir;      /**< Audit log base directory */
+    char                 *name;     /**< Segment file name (in dir) / NULL */
+    int                   fd;       /**< Segment file descriptor */
+    int                   index_fd; /**< Companion index file descriptor */
+    size_t                offset;   /**< Current end of the segment */
+};
+
+/**
+ * Asynchronous audit log writer.
+ *
+ * The queue is a bounded ring of slots.  Each slot's sequence number says
+ * whose turn it is: a producer may fill slot (pos % size) when its sequence
+ * number is pos, and publishes the record by setting it to pos + 1; the
+ * writer may take the record when the sequence number is pos + 1, and
+ * releases the slot to the next lap by setting it to pos + size.
+ * Producers claim positions by compare-and-swap on @a tail; only the
+ * writer thread advances @a head.
+ */
+struct core_audit_writer_t {
+    ib_engine_t          *ib;           /**< Engine */
+    core_audit_slot_t    *slots;        /**< Queue slots */
+    size_t                size;         /**< Number of slots (power of 2) */
+    size_t                tail;         /**< Next position to fill */
+    size_t                head;         /**< Next position to take */
+    core_audit_overflow_t overflow;     /**< Queue full policy */
+    size_t                segment_size; /**< Segment rotation size */
+    mode_t                dmode;        /**< Directory create mode */
+    mode_t                fmode;        /**< File create mode */
+    core_audit_segment_t *segments;     /**< Open segments */
+    unsigned              segment_seq;  /**< Segment sequence number */
+    unsigned              forks;        /**< Fork count at creation */
+    pthread_t             thread;       /**< Writer thread */
+    pthread_mutex_t       mutex;        /**< Protects the wake up */
+    pthread_cond_t        cond;         /**< Wakes the writer thread */
+    int                   sleeping;     /**< Writer is waiting for records */
+    int                   stop;         /**< Writer should stop when idle */
+    ib_auditlog_stats_t   stats;        /**< Statistics */
+};
+
+/**
+ * Number of times this process has forked.
+ *
+ * The writer thread doesn't exist in a child process, so a writer created
+ * before a fork has no consumer after it: records are then written
+ * synchronously instead of being queued.
+ */
+static unsigned core_audit_forks = 0;
+
+/** Count forks. */
+static void core_audit_atfork_child(void)
+{
+    ++core_audit_forks;
+}
+
+/** Register core_audit_atfork_child(). */
+static void core_audit_atfork_register(void)
+{
+    pthread_atfork(NULL, NULL, core_audit_atfork_child);
+}
+
+ib_status_t core_audit_record_create(char *data,
+                                     size_t data_len,
+                                     const char *dir,
+                                     const char *tx_id,
+                                     struct ib_auditlog_cfg_t *auditlog,
+                                     const char *index_line,
+                                     size_t index_len,
+                                     core_audit_record_t **precord)
+{
+    assert(data != NULL);
+    assert(dir != NULL);
+    assert(tx_id != NULL);
+    assert(precord != NULL);
+
+    core_audit_record_t *record;
+    size_t id_len = strlen(tx_id);
+    char *p;
+
+    if (index_line == NULL) {
+        index_len = 0;
+    }
+
+    record = malloc(sizeof(*record) + id_len + 1 + index_len + 1);
+    if (record == NULL) {
+        return IB_EALLOC;
+    }
+    memset(record, 0, sizeof(*record));
+
+    p = (char *)(record + 1);
+    memcpy(p, tx_id, id_len + 1);
+    record->tx_id = p;
+    p += id_len + 1;
+
+    if (index_line != NULL) {
+        memcpy(p, index_line, index_len);
+        p[index_len] = '\0';
+        record->index_line = p;
+        record->index_len = index_len;
+    }
+
+    record->data = data;
+    record->data_len = data_len;
+    record->dir = dir;
+    record->auditlog = auditlog;
+
+    *precord = record;
+    return IB_OK;
+}
+
+void core_audit_record_destroy(core_audit_record_t *record)
+{
+    if (record != NULL) {
+        free(record->data);
+        free(record);
+    }
+}
+
+/**
+ * Add to a statistics counter.
+ *
+ * @param[in] counter Counter
+ * @param[in] n Amount to add
+ */
+static void core_audit_count(uint64_t *counter, uint64_t n)
+{
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+/**
+ * Try to add a record to the queue.
+ *
+ * @param[in] writer Writer
+ * @param[in] record Record
+ *
+ * @returns true if the record was queued, false if the queue is full.
+ */
+static bool core_audit_queue_push(core_audit_writer_t *writer,
+                                  core_audit_record_t *record)
+{
+    size_t pos = __atomic_load_n(&writer->tail, __ATOMIC_RELAXED);
+    core_audit_slot_t *slot;
+    size_t depth;
+    size_t max;
+
+    for (;;) {
+        size_t seq;
+        intptr_t diff;
+
+        slot = &(writer->slots[pos & (writer->size - 1)]);
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&writer->tail, &pos, pos + 1,
+                                            true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            /* The writer hasn't released this slot from the last lap. */
+            return false;
+        }
+        else {
+            pos = __atomic_load_n(&writer->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->record = record;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+    /* Track the high-water mark. */
+    depth = pos + 1 - __atomic_load_n(&writer->head, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&writer->stats.queue_max_depth, __ATOMIC_RELAXED);
+    while ( (depth > max) &&
+            ! __atomic_compare_exchange_n(&writer->stats.queue_max_depth,
+                                          &max, depth, true,
+                                          __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED) )
+    {
+        /* max has been reloaded */
+    }
+
+    return true;
+}
+
+/**
+ * Check if the queue is empty (writer thread only).
+ *
+ * @param[in] writer Writer
+ *
+ * @returns true if there is no record at the head of the queue.
+ */
+static bool core_audit_queue_empty(const core_audit_writer_t *writer)
+{
+    const core_audit_slot_t *slot =
+        &(writer->slots[writer->head & (writer->size - 1)]);
+
+    return __atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) != writer->head + 1;
+}
+
+/**
+ * Take the next record from the queue (writer thread only).
+ *
+ * @param[in] writer Writer
+ *
+ * @returns The next record or NULL if the queue is empty.
+ */
+static core_audit_record_t *core_audit_queue_pop(core_audit_writer_t *writer)
+{
+    size_t pos = writer->head;
+    core_audit_slot_t *slot = &(writer->slots[pos & (writer->size - 1)]);
+    core_audit_record_t *record;
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) != pos + 1) {
+        return NULL;
+    }
+
+    record = slot->record;
+    slot->record = NULL;
+    __atomic_store_n(&slot->seq, pos + writer->size, __ATOMIC_RELEASE);
+    __atomic_store_n(&writer->head, pos + 1, __ATOMIC_RELAXED);
+
+    return record;
+}
+
+/**
+ * Wake up the writer thread if it's waiting for records.
+ *
+ * @param[in] writer Writer
+ */
+static void core_audit_writer_wake(core_audit_writer_t *writer)
+{
+    if (__atomic_load_n(&writer->sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&writer->mutex);
+        pthread_cond_signal(&writer->cond);
+        pthread_mutex_unlock(&writer->mutex);
+    }
+}
+
+/**
+ * Write all of an I/O vector, retrying after short writes.
+ *
+ * @param[in] fd File descriptor
+ * @param[in,out] iov I/O vector (modified)
+ * @param[in] iovcnt Number of elements in @a iov
+ *
+ * @returns 0 on success or an errno value.
+ */
+static int core_audit_writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, (iovcnt > IOV_MAX) ? IOV_MAX : iovcnt);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+
+        /* Skip the parts that were written. */
+        while ( (iovcnt > 0) && ((size_t)n >= iov->iov_len) ) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Close a segment's files.
+ *
+ * @param[in] segment Segment
+ */
+static void core_audit_segment_close(core_audit_segment_t *segment)
+{
+    if (segment->fd >= 0) {
+        close(segment->fd);
+        segment->fd = -1;
+    }
+    if (segment->index_fd >= 0) {
+        close(segment->index_fd);
+        segment->index_fd = -1;
+    }
+    free(segment->name);
+    segment->name = NULL;
+    segment->offset = 0;
+}
+
+/**
+ * Open a new segment file and its companion index.
+ *
+ * @param[in] writer Writer
+ * @param[in] segment Segment (closed)
+ *
+ * @returns IB_OK, IB_EALLOC or IB_EOTHER.
+ */
+static ib_status_t core_audit_segment_open(core_audit_writer_t *writer,
+                                           core_audit_segment_t *segment)
+{
+    char stamp[32];
+    char *path;
+    size_t name_len;
+    size_t dir_len = strlen(segment->dir);
+    time_t now = time(NULL);
+    struct tm tm;
+    int sys_rc;
+    ib_status_t rc;
+
+    rc = ib_util_mkpath(segment->dir, writer->dmode);
+    if (rc != IB_OK) {
+        ib_log_error(writer->ib, "Could not create audit log dir: %s",
+                     segment->dir);
+        return rc;
+    }
+
+    gmtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+
+    /* ironbee-audit-YYYYmmdd-HHMMSS-pid-seq.log */
+    name_len = sizeof("ironbee-audit---.log") + strlen(stamp) + 40;
+    segment->name = malloc(name_len);
+    path = malloc(dir_len + name_len + sizeof(".index") + 1);
+    if ( (segment->name == NULL) || (path == NULL) ) {
+        free(path);
+        core_audit_segment_close(segment);
+        return IB_EALLOC;
+    }
+    snprintf(segment->name, name_len, "ironbee-audit-%s-%ld-%u.log",
+             stamp, (long)getpid(), writer->segment_seq++);
+
+    sprintf(path, "%s/%s", segment->dir, segment->name);
+    segment->fd = open(path,
+                       (O_WRONLY|O_APPEND|O_CREAT|O_EXCL|O_BINARY),
+                       writer->fmode);
+    if (segment->fd < 0) {
+        sys_rc = errno;
+        ib_log_error(writer->ib,
+                     "Failed to open audit log segment \"%s\": %s (%d)",
+                     path, strerror(sys_rc), sys_rc);
+        free(path);
+        core_audit_segment_close(segment);
+        return IB_EOTHER;
+    }
+
+    strcat(path, ".index");
+    segment->index_fd = open(path,
+                             (O_WRONLY|O_APPEND|O_CREAT|O_EXCL|O_BINARY),
+                             writer->fmode);
+    if (segment->index_fd < 0) {
+        sys_rc = errno;
+        ib_log_error(writer->ib,
+                     "Failed to open audit log segment index \"%s\": %s (%d)",
+                     path, strerror(sys_rc), sys_rc);
+        free(path);
+        core_audit_segment_close(segment);
+        return IB_EOTHER;
+    }
+
+    ib_log_debug(writer->ib, "Opened audit log segment \"%s/%s\"",
+                 segment->dir, segment->name);
+    free(path);
+    segment->offset = 0;
+    return IB_OK;
+}
+
+/**
+ * Get the segment for an audit log base directory.
+ *
+ * @param[in] writer Writer
+ * @param[in] dir Audit log base directory
+ *
+ * @returns The segment (which may be closed) or NULL on allocation failure.
+ */
+static core_audit_segment_t *core_audit_segment_get(
+    core_audit_writer_t *writer,
+    const char *dir)
+{
+    core_audit_segment_t *segment;
+
+    for (segment = writer->segments; segment != NULL; segment = segment->next) {
+        if (strcmp(segment->dir, dir) == 0) {
+            return segment;
+        }
+    }
+
+    segment = calloc(1, sizeof(*segment));
+    if (segment == NULL) {
+        return NULL;
+    }
+    segment->dir = strdup(dir);
+    if (segment->dir == NULL) {
+        free(segment);
+        return NULL;
+    }
+    segment->fd = -1;
+    segment->index_fd = -1;
+    segment->next = writer->segments;
+    writer->segments = segment;
+
+    return segment;
+}
+
+/**
+ * Write a record's line to the AuditLogIndex file.
+ *
+ * The log file fields are set to "segment:offset".
+ *
+ * @param[in] writer Writer
+ * @param[in] record Record
+ * @param[in] segment Segment the record was written to
+ * @param[in] offset Offset of the record in the segment
+ */
+static void core_audit_index_write(core_audit_writer_t *writer,
+                                   const core_audit_record_t *record,
+                                   const core_audit_segment_t *segment,
+                                   size_t offset)
+{
+    ib_auditlog_cfg_t *auditlog = record->auditlog;
+    char location[PATH_MAX];
+    size_t location_len;
+    size_t start = 0;
+    size_t n;
+    bool ok = true;
+
+    if ( (auditlog == NULL) || (record->index_line == NULL) ) {
+        return;
+    }
+
+    location_len = snprintf(location, sizeof(location), "%s:%zu",
+                            segment->name, offset);
+    if (location_len >= sizeof(location)) {
+        location_len = sizeof(location) - 1;
+    }
+
+    ib_lock_lock(&auditlog->index_fp_lock);
+    if (auditlog->index_fp == NULL) {
+        ib_lock_unlock(&auditlog->index_fp_lock);
+        return;
+    }
+
+    for (n = 0; n < record->num_file_fields; ++n) {
+        size_t pos = record->file_fields[n];
+
+        ok = ok && (fwrite(record->index_line + start, 1, pos - start,
+                           auditlog->index_fp) == pos - start);
+        ok = ok && (fwrite(location, 1, location_len,
+                           auditlog->index_fp) == location_len);
+        start = pos;
+    }
+    ok = ok && (fwrite(record->index_line + start, 1,
+                       record->index_len - start,
+                       auditlog->index_fp) == record->index_len - start);
+    ok = ok && (fputc('\n', auditlog->index_fp) != EOF);
+
+    if (! ok) {
+        int sys_rc = errno;
+        ib_log_error(writer->ib,
+                     "Could not write to audit log index: %s (%d)",
+                     strerror(sys_rc), sys_rc);
+
+        /* The next audit log opens the index again, which also restarts
+         * a piped logger that has died. */
+        fclose(auditlog->index_fp);
+        auditlog->index_fp = NULL;
+    }
+    ib_lock_unlock(&auditlog->index_fp_lock);
+}
+
+/**
+ * Write a run of records that go to the same segment.
+ *
+ * The records and their companion index lines are each written with a
+ * single writev() (group commit), then the AuditLogIndex lines are written.
+ *
+ * @param[in] writer Writer
+ * @param[in] segment Open segment
+ * @param[in] records Records
+ * @param[in] n Number of records
+ */
+static void core_audit_segment_write(core_audit_writer_t *writer,
+                                     core_audit_segment_t *segment,
+                                     core_audit_record_t **records,
+                                     size_t n)
+{
+    struct iovec iov[CORE_AUDIT_BATCH_MAX];
+    size_t offsets[CORE_AUDIT_BATCH_MAX];
+    char index[CORE_AUDIT_BATCH_MAX * CORE_AUDIT_SEGMENT_INDEX_MAX];
+    size_t index_len = 0;
+    size_t offset = segment->offset;
+    size_t i;
+    int sys_rc;
+
+    assert(n <= CORE_AUDIT_BATCH_MAX);
+
+    for (i = 0; i < n; ++i) {
+        int len;
+
+        iov[i].iov_base = records[i]->data;
+        iov[i].iov_len = records[i]->data_len;
+        offsets[i] = offset;
+
+        len = snprintf(index + index_len, CORE_AUDIT_SEGMENT_INDEX_MAX,
+                       "%zu %zu %s\n",
+                       offset, records[i]->data_len, records[i]->tx_id);
+        if (len >= CORE_AUDIT_SEGMENT_INDEX_MAX) {
+            len = CORE_AUDIT_SEGMENT_INDEX_MAX - 1;
+            index[index_len + len - 1] = '\n';
+        }
+        index_len += len;
+        offset += records[i]->data_len;
+    }
+
+    sys_rc = core_audit_writev_all(segment->fd, iov, n);
+    if (sys_rc != 0) {
+        ib_log_error(writer->ib,
+                     "Failed to write audit log segment \"%s/%s\": %s (%d)",
+                     segment->dir, segment->name, strerror(sys_rc), sys_rc);
+        core_audit_count(&writer->stats.failed, n);
+        core_audit_segment_close(segment);
+        return;
+    }
+    segment->offset = offset;
+
+    iov[0].iov_base = index;
+    iov[0].iov_len = index_len;
+    sys_rc = core_audit_writev_all(segment->index_fd, iov, 1);
+    if (sys_rc != 0) {
+        ib_log_error(writer->ib,
+                     "Failed to write audit log segment index \"%s/%s\": "
+                     "%s (%d)",
+                     segment->dir, segment->name, strerror(sys_rc), sys_rc);
+    }
+
+    for (i = 0; i < n; ++i) {
+        core_audit_index_write(writer, records[i], segment, offsets[i]);
+    }
+
+    core_audit_count(&writer->stats.written, n);
+}
+
+/**
+ * Write a batch of records.
+ *
+ * @param[in] writer Writer
+ * @param[in] records Records (destroyed)
+ * @param[in] n Number of records
+ */
+static void core_audit_batch_write(core_audit_writer_t *writer,
+                                   core_audit_record_t **records,
+                                   size_t n)
+{
+    size_t start = 0;
+    size_t i;
+
+    while (start < n) {
+        core_audit_segment_t *segment =
+            core_audit_segment_get(writer, records[start]->dir);
+        size_t run_len = 0;
+
+        if (segment == NULL) {
+            core_audit_count(&writer->stats.failed, 1);
+            ++start;
+            continue;
+        }
+
+        /* Rotate the segment if this record doesn't fit. */
+        if ( (segment->fd >= 0) &&
+             (segment->offset > 0) &&
+             (segment->offset + records[start]->data_len >
+              writer->segment_size) )
+        {
+            core_audit_segment_close(segment);
+        }
+        if ( (segment->fd < 0) &&
+             (core_audit_segment_open(writer, segment) != IB_OK) )
+        {
+            core_audit_count(&writer->stats.failed, 1);
+            ++start;
+            continue;
+        }
+
+        /* Take the following records for the same segment that fit. */
+        for (i = start; i < n; ++i) {
+            if ( (strcmp(records[i]->dir, segment->dir) != 0) ||
+                 ( (i > start) &&
+                   (segment->offset + run_len + records[i]->data_len >
+                    writer->segment_size) ) )
+            {
+                break;
+            }
+            run_len += records[i]->data_len;
+        }
+
+        core_audit_segment_write(writer, segment, records + start, i - start);
+        start = i;
+    }
+
+    /* Flush the index files, once for each index file in the batch. */
+    for (i = 0; i < n; ++i) {
+        ib_auditlog_cfg_t *auditlog = records[i]->auditlog;
+        size_t j;
+
+        for (j = 0; j < i; ++j) {
+            if (records[j]->auditlog == auditlog) {
+                break;
+            }
+        }
+        if ( (auditlog != NULL) && (j == i) ) {
+            ib_lock_lock(&auditlog->index_fp_lock);
+            if (auditlog->index_fp != NULL) {
+                fflush(auditlog->index_fp);
+            }
+            ib_lock_unlock(&auditlog->index_fp_lock);
+        }
+    }
+
+    for (i = 0; i < n; ++i) {
+        core_audit_record_destroy(records[i]);
+    }
+    core_audit_count(&writer->stats.batches, 1);
+}
+
+/**
+ * Writer thread.
+ *
+ * @param[in] arg Writer
+ *
+ * @returns NULL
+ */
+static void *core_audit_writer_thread(void *arg)
+{
+    core_audit_writer_t *writer = (core_audit_writer_t *)arg;
+    core_audit_record_t *batch[CORE_AUDIT_BATCH_MAX];
+    core_audit_segment_t *segment;
+
+    for (;;) {
+        size_t n = 0;
+
+        while (n < CORE_AUDIT_BATCH_MAX) {
+            core_audit_record_t *record = core_audit_queue_pop(writer);
+            if (record == NULL) {
+                break;
+            }
+            batch[n++] = record;
+        }
+        if (n > 0) {
+            core_audit_batch_write(writer, batch, n);
+            continue;
+        }
+
+        /* The queue is empty: stop or wait for more records.  The sleeping
+         * flag is set before the queue is checked again, and producers
+         * check it after publishing, so a wake up can't be missed. */
+        pthread_mutex_lock(&writer->mutex);
+        __atomic_store_n(&writer->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (core_audit_queue_empty(writer)) {
+            struct timespec ts;
+
+            if (__atomic_load_n(&writer->stop, __ATOMIC_SEQ_CST)) {
+                pthread_mutex_unlock(&writer->mutex);
+                break;
+            }
+
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += CORE_AUDIT_IDLE_WAIT_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec += 1;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&writer->cond, &writer->mutex, &ts);
+        }
+        __atomic_store_n(&writer->sleeping, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&writer->mutex);
+    }
+
+    for (segment = writer->segments; segment != NULL; segment = segment->next) {
+        core_audit_segment_close(segment);
+    }
+
+    return NULL;
+}
+
+ib_status_t core_audit_writer_create(ib_engine_t *ib,
+                                     const ib_core_cfg_t *corecfg,
+                                     core_audit_writer_t **pwriter)
+{
+    assert(ib != NULL);
+    assert(corecfg != NULL);
+    assert(pwriter != NULL);
+
+    static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+    core_audit_writer_t *writer;
+    size_t size = 2;
+    size_t i;
+    int sys_rc;
+
+    pthread_once(&atfork_once, core_audit_atfork_register);
+
+    writer = calloc(1, sizeof(*writer));
+    if (writer == NULL) {
+        return IB_EALLOC;
+    }
+
+    /* Round the queue size up to a power of 2. */
+    while ( (size < (size_t)corecfg->auditlog_queue_size) &&
+            (size < (SIZE_MAX / 2 / sizeof(*writer->slots))) )
+    {
+        size *= 2;
+    }
+    writer->slots = calloc(size, sizeof(*writer->slots));
+    if (writer->slots == NULL) {
+        free(writer);
+        return IB_EALLOC;
+    }
+    for (i = 0; i < size; ++i) {
+        writer->slots[i].seq = i;
+    }
+
+    writer->ib = ib;
+    writer->size = size;
+    writer->overflow = (core_audit_overflow_t)corecfg->auditlog_queue_overflow;
+    writer->segment_size = (size_t)corecfg->auditlog_segment_size;
+    writer->dmode = (mode_t)corecfg->auditlog_dmode;
+    writer->fmode = (mode_t)corecfg->auditlog_fmode;
+    writer->forks = core_audit_forks;
+    writer->stats.queue_size = size;
+
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+
+    sys_rc = pthread_create(&writer->thread, NULL,
+                            core_audit_writer_thread, writer);
+    if (sys_rc != 0) {
+        ib_log_error(ib, "Failed to start audit log writer thread: %s (%d)",
+                     strerror(sys_rc), sys_rc);
+        pthread_cond_destroy(&writer->cond);
+        pthread_mutex_destroy(&writer->mutex);
+        free(writer->slots);
+        free(writer);
+        return IB_EUNKNOWN;
+    }
+
+    ib_log_debug(ib, "Started audit log writer: queue size %zu", size);
+    *pwriter = writer;
+    return IB_OK;
+}
+
+void core_audit_writer_destroy(core_audit_writer_t *writer)
+{
+    core_audit_segment_t *segment;
+    ib_auditlog_stats_t stats;
+
+    if (writer == NULL) {
+        return;
+    }
+
+    if (writer->forks == core_audit_forks) {
+        pthread_mutex_lock(&writer->mutex);
+        __atomic_store_n(&writer->stop, 1, __ATOMIC_SEQ_CST);
+        pthread_cond_signal(&writer->cond);
+        pthread_mutex_unlock(&writer->mutex);
+        pthread_join(writer->thread, NULL);
+    }
+    else {
+        core_audit_record_t *record;
+
+        /* Records queued before the fork are the parent's to write. */
+        while ((record = core_audit_queue_pop(writer)) != NULL) {
+            core_audit_record_destroy(record);
+        }
+    }
+
+    core_audit_writer_stats(writer, &stats);
+    ib_log_info(writer->ib,
+                "Audit log writer: %" PRIu64 " written in %" PRIu64
+                " batches, %" PRIu64 " failed, %" PRIu64 " blocked, %" PRIu64
+                " dropped, %" PRIu64 " spilled, max queue depth %zu/%zu",
+                stats.written, stats.batches, stats.failed, stats.blocked,
+                stats.dropped, stats.spilled,
+                stats.queue_max_depth, stats.queue_size);
+
+    while (writer->segments != NULL) {
+        segment = writer->segments;
+        writer->segments = segment->next;
+        core_audit_segment_close(segment);
+        free(segment->dir);
+        free(segment);
+    }
+
+    pthread_cond_destroy(&writer->cond);
+    pthread_mutex_destroy(&writer->mutex);
+    free(writer->slots);
+    free(writer);
+}
+
+ib_status_t core_audit_writer_submit(core_audit_writer_t *writer,
+                                     core_audit_record_t *record)
+{
+    assert(writer != NULL);
+    assert(record != NULL);
+
+    bool blocked = false;
+
+    /* Nothing would take the record from the queue after a fork. */
+    if (writer->forks != core_audit_forks) {
+        core_audit_count(&writer->stats.spilled, 1);
+        return IB_EAGAIN;
+    }
+
+    while (! core_audit_queue_push(writer, record)) {
+        switch (writer->overflow) {
+        case CORE_AUDIT_OVERFLOW_DROP:
+            ib_log_warning(writer->ib,
+                           "Audit log queue full: "
+                           "dropped audit log for transaction %s",
+                           record->tx_id);
+            core_audit_count(&writer->stats.dropped, 1);
+            core_audit_record_destroy(record);
+            return IB_OK;
+
+        case CORE_AUDIT_OVERFLOW_SPILL:
+            core_audit_count(&writer->stats.spilled, 1);
+            return IB_EAGAIN;
+
+        case CORE_AUDIT_OVERFLOW_BLOCK:
+        default:
+            if (! blocked) {
+                core_audit_count(&writer->stats.blocked, 1);
+                blocked = true;
+            }
+            core_audit_writer_wake(writer);
+            usleep(CORE_AUDIT_BLOCK_WAIT_US);
+            break;
+        }
+    }
+
+    core_audit_count(&writer->stats.queued, 1);
+    core_audit_writer_wake(writer);
+
+    return IB_OK;
+}
+
+void core_audit_writer_stats(const core_audit_writer_t *writer,
+                             ib_auditlog_stats_t *stats)
+{
+    assert(writer != NULL);
+    assert(stats != NULL);
+
+    size_t tail = __atomic_load_n(&writer->tail, __ATOMIC_RELAXED);
+    size_t head = __atomic_load_n(&writer->head, __ATOMIC_RELAXED);
+
+    stats->queue_size = writer->size;
+    stats->queue_depth = (tail > head) ? (tail - head) : 0;
+    stats->queue_max_depth =
+        __atomic_load_n(&writer->stats.queue_max_depth, __ATOMIC_RELAXED);
+    stats->queued = __atomic_load_n(&writer->stats.queued, __ATOMIC_RELAXED);
+    stats->written = __atomic_load_n(&writer->stats.written, __ATOMIC_RELAXED);
+    stats->failed = __atomic_load_n(&writer->stats.failed, __ATOMIC_RELAXED);
+    stats->blocked = __atomic_load_n(&writer->stats.blocked, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&writer->stats.dropped, __ATOMIC_RELAXED);
+    stats->spilled = __atomic_load_n(&writer->stats.spilled, __ATOMIC_RELAXED);
+    stats->batches = __atomic_load_n(&writer->stats.batches, __ATOMIC_RELAXED);
+}
@@ -41,7 +41,9 @@
 #include <ironbee/util.h>
 
 #include <assert.h>
+#include <ctype.h>
 #include <inttypes.h>
+#include <stdio.h>
 #include <unistd.h>
 
 
@@ -73,12 +75,18 @@
  * do that.  If you do, the site selection will not do what you expect.
  */
 
+/** Core context selection trie node */
+typedef struct core_trie_node_t core_trie_node_t;
+
 /** Core context selection site structure */
 typedef struct core_site_t {
     ib_site_t              site;         /**< Site data */
     ib_list_t             *hosts;        /**< List of core_host_t* */
     ib_list_t             *services;     /**< List of core_service_t* */
     ib_list_t             *locations;    /**< List of core_location_t* */
+    size_t                 order;        /**< Position in the site list */
+    core_trie_node_t      *paths;        /**< Trie of location paths */
+    const struct core_location_t *any_location; /**< First 'match any' */
 } core_site_t;
 
 /** Core context selection host name entity */
@@ -100,16 +108,43 @@ typedef struct core_service_t {
 typedef struct core_location_t {
     ib_site_location_t     location;     /**< Site location data */
     size_t                 path_len;     /**< Length of path string */
+    size_t                 order;        /**< Position in the location list */
     bool                   match_any;    /** Is this a 'match any' location? */
 } core_location_t;
 
-/** Core site selection data */
-typedef struct core_site_selector_t {
-    const core_site_t     *site;         /**< Pointer to the site */
-    const core_service_t  *service;      /**< Service (IP/Port) */
-    const ib_list_t       *hosts;        /**< List of core_host_t* */
-    const ib_list_t       *locations;    /**< List of core_location_t* */
-} core_site_selector_t;
+/**
+ * Core context selection trie node.
+ *
+ * Each site's location paths are stored in a trie of path bytes, and the
+ * wildcard host name suffixes of all sites are stored in a single trie of
+ * reversed, lowercased host name bytes.  Walking a trie visits every
+ * location path that is a prefix of the request path (or every suffix that
+ * matches the end of the host name) in a single pass.
+ */
+struct core_trie_node_t {
+    core_trie_node_t      *children;     /**< First child node */
+    core_trie_node_t      *next;         /**< Next sibling node */
+    const core_location_t *location;     /**< Path trie: first location */
+    ib_list_t             *sites;        /**< Host trie: list of core_site_t* */
+    uint8_t                byte;         /**< Byte leading to this node */
+};
+
+/**
+ * Core site selection index
+ *
+ * Built by core_ctxsel_finalize().  All of the site lists are in site list
+ * order and contain each site at most once, so the first site in each list
+ * that matches is the only candidate from that list.
+ */
+typedef struct core_site_index_t {
+    ib_hash_t             *services;     /**< "IP port" -> ib_list_t* */
+    ib_hash_t             *hosts;        /**< Host name -> ib_list_t* */
+    ib_list_t             *any_host;     /**< Sites that match any host */
+    core_trie_node_t      *suffixes;     /**< Wildcard host name suffixes */
+} core_site_index_t;
+
+/** Size of the buffer used for service index keys */
+#define CORE_SERVICE_KEY_SIZE 128
 
 
 /**
@@ -140,180 +175,544 @@ static const core_location_t *core_ctxsel_matchany_location(
 }
 
 /**
- * Check for a matching host within a host list
- *
- * This function takes a list of hosts, and attempts to find the first
- * host that matches the transaction.  This function is intended to aid in
- * the development of context selection functions, but it's use is optional.
- * It is used by the core site selector.
+ * Find the child of a trie node for a byte
  *
- * @param[in] ib IronBee engine
- * @param[in] tx Transaction to match
- * @param[in] hosts List of ib_core_host_t
- * @param[out] match true if a match was found, else false
+ * @param[in] node Trie node
+ * @param[in] byte Byte to look for
  *
- * @returns IB_OK
+ * @returns Child node or NULL
  */
-static ib_status_t core_ctxsel_match_host(
-    const ib_engine_t *ib,
-    const ib_tx_t *tx,
-    const ib_list_t *hosts,
-    bool *match)
+static core_trie_node_t *core_trie_child(
+    const core_trie_node_t *node,
+    uint8_t byte)
 {
-    assert(ib != NULL);
-    assert(tx != NULL);
-    assert(match != NULL);
-
-    const ib_list_node_t *node;
-    size_t len;
+    core_trie_node_t *child;
 
-    /* If no hosts in the list, we have an automatic match */
-    if (hosts == NULL) {
-        *match = true;
-        return IB_OK;
+    for (child = node->children; child != NULL; child = child->next) {
+        if (child->byte == byte) {
+            return child;
+        }
     }
+    return NULL;
+}
 
-    /* Now, loop through the list of hostnames */
-    len = strlen(tx->hostname);
-    IB_LIST_LOOP_CONST(hosts, node) {
-        const core_host_t *core_host = (const core_host_t *)node->data;
-        const ib_site_host_t *host = &(core_host->host);
+/**
+ * Add a key to a trie
+ *
+ * @param[in] mp Memory pool to allocate nodes from
+ * @param[in] root Root node of the trie
+ * @param[in] key Key to add
+ * @param[in] len Length of @a key
+ * @param[in] host If true, @a key is a host name suffix, and is added
+ *                 reversed and lowercased
+ * @param[out] pnode Node for @a key
+ *
+ * @returns IB_OK or IB_EALLOC
+ */
+static ib_status_t core_trie_add(
+    ib_mpool_t *mp,
+    core_trie_node_t *root,
+    const char *key,
+    size_t len,
+    bool host,
+    core_trie_node_t **pnode)
+{
+    assert(mp != NULL);
+    assert(root != NULL);
+    assert(key != NULL);
+    assert(pnode != NULL);
 
-        /* If this is a "match any" host entry? */
-        if (core_host->match_any) {
-            *match = true;
-            return IB_OK;
+    core_trie_node_t *node = root;
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        uint8_t byte;
+        core_trie_node_t *child;
+
+        if (host) {
+            byte = (uint8_t)tolower((unsigned char)key[len - i - 1]);
+        }
+        else {
+            byte = (uint8_t)key[i];
         }
 
-        /* Check the suffix */
-        if ( (host->suffix != NULL) && (len >= core_host->suffix_len) ) {
-            const char *suffix = tx->hostname + len - core_host->suffix_len;
-            if (strcasecmp(host->suffix, suffix) == 0) {
-                *match = true;
-                return IB_OK;
+        child = core_trie_child(node, byte);
+        if (child == NULL) {
+            child = ib_mpool_calloc(mp, 1, sizeof(*child));
+            if (child == NULL) {
+                return IB_EALLOC;
             }
+            child->byte = byte;
+            child->next = node->children;
+            node->children = child;
         }
+        node = child;
+    }
 
-        /* Finally, do a full hostname match */
-        if ( (core_host->hostname_len == len) &&
-             (strcasecmp(host->hostname, tx->hostname) == 0) )
-        {
-            *match = true;
-            return IB_OK;
+    *pnode = node;
+    return IB_OK;
+}
+
+/**
+ * Append a site to a site list, creating the list if required
+ *
+ * Sites are indexed in order, so a site that is already in the list is
+ * always the last element.
+ *
+ * @param[in] mp Memory pool to allocate the list from
+ * @param[in,out] plist Pointer to the list (may point to NULL)
+ * @param[in] site Site to append
+ *
+ * @returns IB_OK or errors from ib_list_create() / ib_list_push()
+ */
+static ib_status_t core_site_list_add(
+    ib_mpool_t *mp,
+    ib_list_t **plist,
+    const core_site_t *site)
+{
+    assert(mp != NULL);
+    assert(plist != NULL);
+    assert(site != NULL);
+
+    ib_status_t rc;
+
+    if (*plist == NULL) {
+        rc = ib_list_create(plist, mp);
+        if (rc != IB_OK) {
+            return rc;
         }
     }
+    else if (ib_list_node_data_const(ib_list_last_const(*plist)) == site) {
+        return IB_OK;
+    }
 
-    /* No matches */
-    *match = false;
-    return IB_OK;
+    return ib_list_push(*plist, (void *)site);
 }
 
 /**
- * Check for a matching location within a location list
+ * Format a service index key
  *
- * This function takes a list of locations, and attempts to find the first
- * location that matches the transaction.  This function is intended to aid in
- * the development of context selection functions, but it's use is optional.
- * It is used by the core site selector.
+ * @param[out] key Buffer of CORE_SERVICE_KEY_SIZE bytes
+ * @param[in] ipstr IP address string or NULL for any IP address
+ * @param[in] port Port number or -1 for any port
  *
- * @param[in] ib IronBee engine
- * @param[in] tx Transaction to match
- * @param[in] locations List of ib_ctxsel_location_t
- * @param[out] match Pointer to matched location (or NULL)
+ * @returns Length of the key, or -1 if it doesn't fit in @a key
+ */
+static int core_service_key(
+    char *key,
+    const char *ipstr,
+    int port)
+{
+    int len;
+
+    if (port < 0) {
+        len = snprintf(key, CORE_SERVICE_KEY_SIZE, "%s *",
+                       (ipstr == NULL) ? "*" : ipstr);
+    }
+    else {
+        len = snprintf(key, CORE_SERVICE_KEY_SIZE, "%s %d",
+                       (ipstr == NULL) ? "*" : ipstr, port);
+    }
+    if ( (len < 0) || (len >= CORE_SERVICE_KEY_SIZE) ) {
+        return -1;
+    }
+    return len;
+}
+
+/**
+ * Get the list of sites for a service index key
+ *
+ * @param[in] hash Service index
+ * @param[in] ipstr IP address string or NULL for any IP address
+ * @param[in] port Port number or -1 for any port
+ * @param[out] psites List of sites (NULL if there are none)
  *
- * @returns IB_OK
+ * @returns IB_OK or errors from ib_hash_get_ex()
  */
-static ib_status_t core_ctxsel_match_location(
-    const ib_engine_t *ib,
-    const ib_tx_t *tx,
-    const ib_list_t *locations,
-    const core_location_t **match)
+static ib_status_t core_service_sites_get(
+    const ib_hash_t *hash,
+    const char *ipstr,
+    int port,
+    ib_list_t **psites)
 {
-    assert(ib != NULL);
-    assert(tx != NULL);
-    assert(locations != NULL);
-    assert(match != NULL);
+    assert(hash != NULL);
+    assert(psites != NULL);
+
+    char key[CORE_SERVICE_KEY_SIZE];
+    int len;
+    ib_status_t rc;
+
+    *psites = NULL;
+    len = core_service_key(key, ipstr, port);
+    if (len < 0) {
+        return IB_OK;
+    }
+
+    rc = ib_hash_get_ex(hash, psites, key, len);
+    if (rc == IB_ENOENT) {
+        *psites = NULL;
+        return IB_OK;
+    }
+    return rc;
+}
+
+/**
+ * Add a site to the service index
+ *
+ * @param[in] mp Memory pool
+ * @param[in] hash Service index
+ * @param[in] site Site to add
+ * @param[in] ipstr IP address string or NULL for any IP address
+ * @param[in] port Port number or -1 for any port
+ *
+ * @returns IB_OK, IB_EINVAL if the key is too long, or errors from the
+ * list and hash functions
+ */
+static ib_status_t core_service_sites_add(
+    ib_mpool_t *mp,
+    ib_hash_t *hash,
+    const core_site_t *site,
+    const char *ipstr,
+    int port)
+{
+    char key[CORE_SERVICE_KEY_SIZE];
+    ib_list_t *sites;
+    int len;
+    ib_status_t rc;
+
+    len = core_service_key(key, ipstr, port);
+    if (len < 0) {
+        return IB_EINVAL;
+    }
+
+    rc = core_service_sites_get(hash, ipstr, port, &sites);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    rc = core_site_list_add(mp, &sites, site);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    return ib_hash_set_ex(hash, ib_mpool_memdup(mp, key, len), len, sites);
+}
+
+/**
+ * Check if any of a site's services match a connection
+ *
+ * @param[in] site Site to check
+ * @param[in] conn Connection to match
+ *
+ * @returns true if a service matches
+ */
+static bool core_ctxsel_match_service(
+    const core_site_t *site,
+    const ib_conn_t *conn)
+{
+    assert(site != NULL);
+    assert(conn != NULL);
 
     const ib_list_node_t *node;
-    size_t len;
-
-    /* Now, loop through the list of locations */
-    len = strlen(tx->path);
-    IB_LIST_LOOP_CONST(locations, node) {
-        const core_location_t *core_location =
-            (const core_location_t *)node->data;
-        const ib_site_location_t *location = &(core_location->location);
-
-        /* Is this a "match any" location? */
-        if (core_location->match_any) {
-            *match = core_location;
-            return IB_OK;
+
+    /* If there are no services, match is automatic. */
+    if (site->services == NULL) {
+        return true;
+    }
+
+    IB_LIST_LOOP_CONST(site->services, node) {
+        const core_service_t *service = (const core_service_t *)node->data;
+
+        if (service->match_any) {
+            return true;
+        }
+        /* Check that the port matches the service (if specified) */
+        if ( (service->service.port >= 0) &&
+             (service->service.port != conn->local_port) )
+        {
+            continue;
+        }
+        /* Check that the IP address matches the service (if specified) */
+        if ( (service->service.ipstr != NULL) &&
+             (strcmp(service->service.ipstr, conn->local_ipstr) != 0) )
+        {
+            continue;
         }
+        return true;
+    }
+
+    return false;
+}
 
-        /* Check the path */
-        if ( (core_location->path_len <= len) &&
-             (strncmp(location->path, tx->path, core_location->path_len) == 0) )
+/**
+ * Find the first location of a site that matches a path
+ *
+ * Locations match if they are 'match any' or their path is a prefix of
+ * @a path.  The site's path trie is walked along @a path, and the matching
+ * location that comes first in the site's location list is returned.
+ *
+ * @param[in] site Site
+ * @param[in] path Request path
+ *
+ * @returns Matching location or NULL
+ */
+static const core_location_t *core_ctxsel_match_location(
+    const core_site_t *site,
+    const char *path)
+{
+    assert(site != NULL);
+    assert(path != NULL);
+
+    const core_location_t *match = site->any_location;
+    const core_trie_node_t *node = site->paths;
+
+    while (node != NULL) {
+        if ( (node->location != NULL) &&
+             ( (match == NULL) || (node->location->order < match->order) ) )
         {
-            *match = core_location;
-            return IB_OK;
+            match = node->location;
+        }
+        if (*path == '\0') {
+            break;
         }
+        node = core_trie_child(node, (uint8_t)*path);
+        ++path;
     }
 
-    /* No matches */
-    *match = NULL;
-    return IB_OK;
+    return match;
 }
 
 /**
- * Create a site selector object
+ * Find the first site in a list that matches a connection / transaction
  *
- * @param[in,out] core_data Core module data
- * @param[in] site Site object
- * @param[in] service Service object (can be NULL)
- * @param[out] selector New selector object (or NULL)
+ * Only sites that come before @a *psite in the site list are considered,
+ * so the lists from each index lookup can be checked in any order.
+ *
+ * @param[in] sites List of core_site_t* (may be NULL)
+ * @param[in] conn Connection to match
+ * @param[in] tx Transaction to match / NULL
+ * @param[in,out] psite Best matching site so far (may point to NULL)
+ * @param[in,out] plocation Location of @a psite (if @a tx is not NULL)
+ */
+static void core_ctxsel_match_sites(
+    const ib_list_t *sites,
+    const ib_conn_t *conn,
+    const ib_tx_t *tx,
+    const core_site_t **psite,
+    const core_location_t **plocation)
+{
+    assert(conn != NULL);
+    assert(psite != NULL);
+    assert(plocation != NULL);
+
+    const ib_list_node_t *node;
+
+    if (sites == NULL) {
+        return;
+    }
+
+    IB_LIST_LOOP_CONST(sites, node) {
+        const core_site_t *site = (const core_site_t *)node->data;
+        const core_location_t *location = NULL;
+
+        if ( (*psite != NULL) && (site->order >= (*psite)->order) ) {
+            return;
+        }
+        if (! core_ctxsel_match_service(site, conn)) {
+            continue;
+        }
+        if (tx != NULL) {
+            location = core_ctxsel_match_location(site, tx->path);
+            if (location == NULL) {
+                continue;
+            }
+        }
+
+        *psite = site;
+        *plocation = location;
+        return;
+    }
+}
+
+/**
+ * Add a site's locations to its path trie
+ *
+ * @param[in] mp Memory pool
+ * @param[in,out] site Site
  *
  * @returns IB_OK or IB_EALLOC
  */
-static ib_status_t core_create_site_selector(
-    ib_core_module_data_t *core_data,
-    const core_site_t *site,
-    const core_service_t *service,
-    core_site_selector_t **selector)
+static ib_status_t core_index_site_locations(
+    ib_mpool_t *mp,
+    core_site_t *site)
 {
-    assert(core_data != NULL);
+    assert(mp != NULL);
     assert(site != NULL);
 
+    const ib_list_node_t *node;
     ib_status_t rc;
-    core_site_selector_t *object;
 
-    /* Create & populate a site selector object */
-    object = ib_mpool_alloc(site->site.mp, sizeof(*object));
-    if (object == NULL) {
+    site->any_location = NULL;
+    site->paths = ib_mpool_calloc(mp, 1, sizeof(*site->paths));
+    if (site->paths == NULL) {
         return IB_EALLOC;
     }
-    object->service = service;
-    object->hosts = site->hosts;
-    object->locations = site->locations;
-    object->site = site;
 
-    /* Add it to the site selector list */
-    rc = ib_list_push(core_data->selector_list, object);
-    if (rc != IB_OK) {
-        return rc;
+    IB_LIST_LOOP_CONST(site->locations, node) {
+        const core_location_t *location = (const core_location_t *)node->data;
+        core_trie_node_t *trie_node;
+
+        if (location->match_any) {
+            if (site->any_location == NULL) {
+                site->any_location = location;
+            }
+            continue;
+        }
+
+        rc = core_trie_add(mp, site->paths,
+                           location->location.path, location->path_len,
+                           false, &trie_node);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        if (trie_node->location == NULL) {
+            trie_node->location = location;
+        }
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Add a site's services to the service index
+ *
+ * @param[in] mp Memory pool
+ * @param[in,out] index Site selection index
+ * @param[in] site Site
+ *
+ * @returns IB_OK or errors from core_service_sites_add()
+ */
+static ib_status_t core_index_site_services(
+    ib_mpool_t *mp,
+    core_site_index_t *index,
+    const core_site_t *site)
+{
+    assert(mp != NULL);
+    assert(index != NULL);
+    assert(site != NULL);
+
+    const ib_list_node_t *node;
+    ib_status_t rc;
+
+    if (site->services == NULL) {
+        return core_service_sites_add(mp, index->services, site, NULL, -1);
     }
 
-    if (selector != NULL) {
-        *selector = object;
+    IB_LIST_LOOP_CONST(site->services, node) {
+        const core_service_t *service = (const core_service_t *)node->data;
+
+        if (service->match_any) {
+            rc = core_service_sites_add(mp, index->services, site, NULL, -1);
+        }
+        else {
+            rc = core_service_sites_add(mp, index->services, site,
+                                        service->service.ipstr,
+                                        service->service.port);
+        }
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Add a site's hosts to the host index and wildcard suffix trie
+ *
+ * @param[in] mp Memory pool
+ * @param[in,out] index Site selection index
+ * @param[in] site Site
+ *
+ * @returns IB_OK or errors from the list, hash and trie functions
+ */
+static ib_status_t core_index_site_hosts(
+    ib_mpool_t *mp,
+    core_site_index_t *index,
+    const core_site_t *site)
+{
+    assert(mp != NULL);
+    assert(index != NULL);
+    assert(site != NULL);
+
+    const ib_list_node_t *node;
+    ib_status_t rc;
+
+    /* If no hosts in the list, the site matches any host */
+    if (site->hosts == NULL) {
+        return core_site_list_add(mp, &(index->any_host), site);
+    }
+
+    IB_LIST_LOOP_CONST(site->hosts, node) {
+        const core_host_t *core_host = (const core_host_t *)node->data;
+        const ib_site_host_t *host = &(core_host->host);
+        ib_list_t *sites;
+
+        if (core_host->match_any) {
+            rc = core_site_list_add(mp, &(index->any_host), site);
+            if (rc != IB_OK) {
+                return rc;
+            }
+            continue;
+        }
+
+        /* Wildcard suffix */
+        if (host->suffix != NULL) {
+            core_trie_node_t *trie_node;
+
+            rc = core_trie_add(mp, index->suffixes,
+                               host->suffix, core_host->suffix_len,
+                               true, &trie_node);
+            if (rc != IB_OK) {
+                return rc;
+            }
+            rc = core_site_list_add(mp, &(trie_node->sites), site);
+            if (rc != IB_OK) {
+                return rc;
+            }
+        }
+
+        /* Full host name */
+        rc = ib_hash_get_ex(index->hosts, &sites,
+                            host->hostname, core_host->hostname_len);
+        if (rc == IB_ENOENT) {
+            sites = NULL;
+        }
+        else if (rc != IB_OK) {
+            return rc;
+        }
+        rc = core_site_list_add(mp, &sites, site);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        rc = ib_hash_set_ex(index->hosts,
+                            host->hostname, core_host->hostname_len,
+                            sites);
+        if (rc != IB_OK) {
+            return rc;
+        }
     }
+
     return IB_OK;
 }
 
 /**
  * Finalize the core context selection.
  *
- * This functions creates the site selector list which is used during the site
- * selection process.  It walks through the list of sites / locations, and
- * creates corresponding site selector objects.
+ * This functions creates the site selection index which is used during the
+ * site selection process.  It walks through the list of sites, and indexes
+ * each site by its services (IP address / port), its host names (exact
+ * names in a hash, wildcard suffixes in a reversed trie) and its locations
+ * (a path prefix trie per site).
  *
  * @param[in] ib IronBee engine
  * @param[in] common_cb_data Common callback data
@@ -330,8 +729,10 @@ static ib_status_t core_ctxsel_finalize(
 {
     assert(ib != NULL);
 
-    const ib_list_node_t *site_node;
+    ib_list_node_t *site_node;
     ib_core_module_data_t *core_data = (ib_core_module_data_t *)common_cb_data;
+    core_site_index_t *index;
+    size_t order = 0;
     ib_status_t rc;
 
     /* Do nothing if we're not the current site selector */
@@ -340,6 +741,7 @@ static ib_status_t core_ctxsel_finalize(
     }
 
     /* If there are no sites, do nothing */
+    core_data->site_index = NULL;
     if (core_data->site_list == NULL) {
         ib_log_alert(ib, "No site list");
         return IB_OK;
@@ -349,54 +751,65 @@ static ib_status_t core_ctxsel_finalize(
         return IB_OK;
     }
 
-    /* Create the site selector list */
-    if (core_data->selector_list == NULL) {
-        rc = ib_list_create(&(core_data->selector_list), ib->mp);
-        if (rc != IB_OK) {
-            ib_log_error(ib, "Failed to create core site selector list: %s",
-                         ib_status_to_string(rc));
-            return rc;
-        }
+    /* Create the site selection index */
+    index = ib_mpool_calloc(ib->mp, 1, sizeof(*index));
+    if (index == NULL) {
+        return IB_EALLOC;
     }
-    else {
-        ib_list_clear(core_data->selector_list);
+    rc = ib_hash_create(&(index->services), ib->mp);
+    if (rc != IB_OK) {
+        goto failed;
+    }
+    rc = ib_hash_create_nocase(&(index->hosts), ib->mp);
+    if (rc != IB_OK) {
+        goto failed;
+    }
+    index->suffixes = ib_mpool_calloc(ib->mp, 1, sizeof(*index->suffixes));
+    if (index->suffixes == NULL) {
+        rc = IB_EALLOC;
+        goto failed;
     }
 
-    /* Build the site selector list from the site / location list */
+    /* Walk through all of the sites, and index their services, hosts and
+     * locations */
+    IB_LIST_LOOP(core_data->site_list, site_node) {
+        core_site_t *site = (core_site_t *)site_node->data;
 
-    /* Walk through all of the sites, and it's locations & services */
-    IB_LIST_LOOP_CONST(core_data->site_list, site_node) {
-        const core_site_t *site = (const core_site_t *)site_node->data;
-        const ib_list_node_t *service_node;
+        site->order = order++;
 
-        /* If no services defined, just create a single selector with
-         * a default service */
-        if (site->services == NULL) {
-            rc = core_create_site_selector(core_data, site, NULL, NULL);
-            if (rc != IB_OK) {
-                return rc;
-            }
-            continue;
+        rc = core_index_site_locations(ib->mp, site);
+        if (rc != IB_OK) {
+            goto failed;
         }
-
-        /* Otherwise, loop through all of the services, create a single
-         * selector for each */
-        IB_LIST_LOOP_CONST(site->services, service_node) {
-            const core_service_t *service =
-                (const core_service_t *)service_node->data;
-            rc = core_create_site_selector(core_data, site, service, NULL);
-            if (rc != IB_OK) {
-                return rc;
-            }
+        rc = core_index_site_services(ib->mp, index, site);
+        if (rc != IB_OK) {
+            goto failed;
+        }
+        rc = core_index_site_hosts(ib->mp, index, site);
+        if (rc != IB_OK) {
+            goto failed;
         }
     }
 
+    core_data->site_index = index;
     return IB_OK;
+
+failed:
+    ib_log_error(ib, "Failed to create core site selection index: %s",
+                 ib_status_to_string(rc));
+    return rc;
 }
 
 /**
  * Select the correct context for a connection / transaction.
  *
+ * The selected site is the first site in the site list with a service that
+ * matches the connection, a host that matches the transaction's host name
+ * and a location that matches the transaction's path.  Rather than walking
+ * the site list, the candidate sites are looked up in the site selection
+ * index, so the time taken depends on the length of the host name and path
+ * rather than on the number of sites.
+ *
  * @param[in] ib Engine
  * @param[in] conn Pointer to connection
  * @param[in] tx Pointer to transaction / NULL
@@ -419,103 +832,94 @@ static ib_status_t core_ctxsel_select(
     assert(common_cb_data != NULL);
     assert(pctx != NULL);
 
-    const ib_list_node_t *node;
-    size_t ip_len;
-    ib_status_t rc;
     ib_core_module_data_t *core_data = (ib_core_module_data_t *)common_cb_data;
+    const core_site_index_t *index = core_data->site_index;
+    const core_site_t *site = NULL;
+    const core_location_t *location = NULL;
+    ib_context_t *ctx;
+    const char *ctx_type;
 
     /* Verify that we're the current selector */
     if (ib_ctxsel_module_is_active(ib, ib_core_module()) == false) {
         return IB_EINVAL;
     }
 
-    if (core_data->selector_list == NULL) {
-        ib_log_alert(ib, "No site selection list: Using main context");
+    if (index == NULL) {
+        ib_log_alert(ib, "No site selection index: Using main context");
         goto select_main_context;
     }
 
-    /* Get the length of the IP address string before the main loop */
-    ip_len = strlen(conn->local_ipstr);
-
-    /*
-     * Walk through the list of site selectors, return when the first matching
-     * selector is found.  At any point in the loop if a non-match is found,
-     * we continue to the top of the loop, and try the next selector.
-     */
-    IB_LIST_LOOP_CONST(core_data->selector_list, node) {
-        const core_site_selector_t *selector =
-            (const core_site_selector_t *)node->data;
-        const core_service_t *service = selector->service;
-        const core_site_t *site = selector->site;
-        const core_location_t *location;
-        ib_context_t *ctx;
-        const char *ctx_type;
-        bool match;
-
+    if (tx == NULL) {
         /*
-         * If there is no service or it's a "match any", match is automatic.
+         * If we're looking for a connection context, there is no hostname or
+         * location, so go with the first site with a matching service.
          */
-        if ( (service != NULL) && (! service->match_any) ) {
-            /* Check that the port matches the service (if specified) */
-            if ( (service->service.port >= 0) &&
-                 (service->service.port != conn->local_port) ) {
-                continue;
-            }
-            /* Check that the host name matches the service (if specified) */
-            if ( (service->service.ipstr != NULL) &&
-                 (service->ip_len == ip_len) &&
-                 (strcmp(service->service.ipstr, conn->local_ipstr) != 0) )
-            {
+        static const bool any_ip[] = { false, false, true, true };
+        static const bool any_port[] = { false, true, false, true };
+        size_t n;
+
+        for (n = 0; n < sizeof(any_ip) / sizeof(any_ip[0]); ++n) {
+            ib_list_t *sites;
+            ib_status_t rc;
+
+            rc = core_service_sites_get(index->services,
+                                        any_ip[n] ? NULL : conn->local_ipstr,
+                                        any_port[n] ? -1 : conn->local_port,
+                                        &sites);
+            if (rc != IB_OK) {
                 continue;
             }
+            core_ctxsel_match_sites(sites, conn, NULL, &site, &location);
         }
+    }
+    else {
+        const core_trie_node_t *node = index->suffixes;
+        ib_list_t *sites;
+        size_t len = strlen(tx->hostname);
 
-        /*
-         * If we're looking for a connection context, there is no hostname or
-         * location, so go with this selector.
-         */
-        if (tx == NULL) {
-            ctx = selector->site->site.context;
-            ctx_type = "site";
-            goto found;
-        }
+        /* Sites that match any host name */
+        core_ctxsel_match_sites(index->any_host, conn, tx, &site, &location);
 
-        /* Check if the hostname matches */
-        rc = core_ctxsel_match_host(ib, tx, selector->hosts, &match);
-        if (rc != IB_OK) {
-            /* todo: What is the right thing to do here? */
-            continue;
-        }
-        if (! match) {
-            continue;
+        /* Sites with an exact host name match */
+        if (ib_hash_get_ex(index->hosts, &sites, tx->hostname, len) == IB_OK) {
+            core_ctxsel_match_sites(sites, conn, tx, &site, &location);
         }
 
-        /* Check if the location matches */
-        rc = core_ctxsel_match_location(ib, tx, selector->locations, &location);
-        if (rc != IB_OK) {
-            /* todo: What is the right thing to do here? */
-            continue;
-        }
-        if (location == NULL) {
-            continue;
+        /* Sites with a matching wildcard suffix; the root holds the sites
+         * with an empty suffix, which match any host name. */
+        core_ctxsel_match_sites(node->sites, conn, tx, &site, &location);
+        while ( (len > 0) && (node != NULL) ) {
+            --len;
+            node = core_trie_child(
+                node, (uint8_t)tolower((unsigned char)tx->hostname[len]));
+            if ( (node != NULL) && (node->sites != NULL) ) {
+                core_ctxsel_match_sites(node->sites, conn, tx,
+                                        &site, &location);
+            }
         }
+    }
 
-        /* Everything matches.  Use this selector's context */
+    if (site == NULL) {
+        goto not_found;
+    }
+    if (tx == NULL) {
+        ctx = site->site.context;
+        ctx_type = "site";
+    }
+    else {
         ctx = location->location.context;
         ctx_type = "location";
-
-  found:
-        ib_log_debug2(ib, "Selected %s context %p \"%s\" site=%s(%s)",
-                      ctx_type, ctx, ib_context_full_get(ctx),
-                      (site ? site->site.id_str : "none"),
-                      (site ? site->site.name : "none"));
-        *pctx = ctx;
-        return IB_OK;
     }
 
+    ib_log_debug2(ib, "Selected %s context %p \"%s\" site=%s(%s)",
+                  ctx_type, ctx, ib_context_full_get(ctx),
+                  site->site.id_str, site->site.name);
+    *pctx = ctx;
+    return IB_OK;
+
+not_found:
     /*
-     * If we get here, we've exhausted the list of selectors, with no matching
-     * selector found
+     * If we get here, there is no matching site.
      */
     if (tx == NULL) {
         ib_log_debug(ib, "No matching site found for connection:"
@@ -645,6 +1049,7 @@ static ib_status_t core_ctxsel_location_create(
 
     /* Fill in the context selection specific parts */
     core_location->path_len = strlen(location_str);
+    core_location->order = ib_list_elements(core_site->locations);
     core_location->match_any = (strcmp(location_str, "/") == 0);
 
     /* And, add it to the locations list */
@@ -86,6 +86,36 @@ static const ib_tx_flag_map_t core_tx_flag_map[] = {
     { NULL, NULL, IB_TX_FNONE, true, false },
 };
 
+/* Well-known fields, which get an index in the engine data registry. */
+static const char *core_indexed_fields[] = {
+    "ARGS",
+    "FLAGS",
+    "request_body_params",
+    "request_cookies",
+    "request_filename",
+    "request_headers",
+    "request_host",
+    "request_line",
+    "request_method",
+    "request_protocol",
+    "request_uri",
+    "request_uri_params",
+    "request_uri_path",
+    "request_uri_query",
+    "request_uri_raw",
+    "response_cookies",
+    "response_headers",
+    "response_line",
+    "response_message",
+    "response_protocol",
+    "response_status",
+    "remote_addr",
+    "remote_port",
+    "server_addr",
+    "server_port",
+    NULL
+};
+
 static ib_status_t core_field_placeholder_bytestr(ib_data_t *data,
                                                   const char *name)
 {
@@ -815,6 +845,17 @@ ib_status_t ib_core_fields_init(ib_engine_t *ib,
     assert(ib != NULL);
     assert(mod != NULL);
 
+    const char **name;
+    ib_status_t rc;
+
+    for (name = core_indexed_fields;  *name != NULL;  ++name) {
+        rc = ib_data_register_indexed(ib_engine_data_config_get(ib), *name);
+        if (rc != IB_OK) {
+            ib_log_alert(ib, "Failed to register indexed field %s: %s",
+                         *name, ib_status_to_string(rc));
+            return rc;
+        }
+    }
 
     ib_hook_conn_register(ib, handle_connect_event,
                           core_gen_connect_fields, NULL);
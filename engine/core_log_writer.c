@@ -0,0 +1,443 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+/**
+ * @file
+ * @brief IronBee --- Asynchronous Logger
+ *
+ * Each logging thread formats its messages into its own single-producer /
+ * single-consumer ring of fixed size records, so logging takes no locks
+ * and does no heap allocation or I/O.  A background thread drains all of
+ * the rings in batches, with one fflush() per batch.
+ */
+
+#include "ironbee_config_auto.h"
+
+#include "core_private.h"
+
+#include <ironbee/log.h>
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Number of records in each thread's ring (power of 2) */
+#define CORE_LOG_RING_SIZE 128
+
+/** Maximum length of a log line, including the newline */
+#define CORE_LOG_LINE_MAX 1024
+
+/** Time between writes of the buffered messages (ms) */
+#define CORE_LOG_FLUSH_MS 50
+
+/** Time a logging thread waits for room in its ring (us) */
+#define CORE_LOG_FULL_WAIT_US 50
+
+/** Suffix for truncated messages */
+#define CORE_LOG_TRUNCATED "...\n"
+
+/** A formatted log line */
+typedef struct {
+    size_t len;                         /**< Length of text */
+    char   text[CORE_LOG_LINE_MAX];     /**< Text */
+} core_log_record_t;
+
+/**
+ * A logging thread's ring.
+ *
+ * Only the owning thread advances @a tail and only the writer thread
+ * advances @a head.  When a thread exits, its ring is released and reused
+ * by the next new logging thread.
+ */
+typedef struct core_log_ring_t core_log_ring_t;
+struct core_log_ring_t {
+    core_log_ring_t   *next;        /**< Next ring */
+    int                owned;       /**< Ring belongs to a live thread */
+    size_t             head;        /**< Next record to write */
+    size_t             tail;        /**< Next record to fill */
+    time_t             ts_sec;      /**< Second of cached time stamp */
+    char               ts_date[20]; /**< Cached YYYY-mm-ddTHH:MM:SS */
+    char               ts_zone[6];  /**< Cached time zone offset */
+    core_log_record_t  records[CORE_LOG_RING_SIZE]; /**< Records */
+};
+
+/** Asynchronous logger */
+struct core_log_writer_t {
+    FILE              *fp;          /**< Log file */
+    pid_t              pid;         /**< Process ID */
+    unsigned           forks;       /**< Fork count at creation */
+    pthread_key_t      key;         /**< Thread's ring */
+    core_log_ring_t   *rings;       /**< All rings */
+    pthread_t          thread;      /**< Writer thread */
+    pthread_mutex_t    mutex;       /**< Protects the wake up */
+    pthread_cond_t     cond;        /**< Wakes the writer thread */
+    int                sleeping;    /**< Writer is waiting */
+    int                stop;        /**< Writer should stop */
+};
+
+/**
+ * Number of times this process has forked.
+ *
+ * The writer thread doesn't exist in a child process, so a writer created
+ * before a fork is not used after it.
+ */
+static unsigned core_log_forks = 0;
+
+/** Count forks. */
+static void core_log_atfork_child(void)
+{
+    ++core_log_forks;
+}
+
+/** Register core_log_atfork_child(). */
+static void core_log_atfork_register(void)
+{
+    pthread_atfork(NULL, NULL, core_log_atfork_child);
+}
+
+/**
+ * Release a thread's ring when the thread exits.
+ *
+ * @param[in] arg Ring
+ */
+static void core_log_ring_release(void *arg)
+{
+    core_log_ring_t *ring = (core_log_ring_t *)arg;
+
+    __atomic_store_n(&ring->owned, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Get the calling thread's ring, claiming or creating one if needed.
+ *
+ * @param[in] writer Writer
+ *
+ * @returns The ring, or NULL on allocation failure.
+ */
+static core_log_ring_t *core_log_ring_get(core_log_writer_t *writer)
+{
+    core_log_ring_t *ring = pthread_getspecific(writer->key);
+
+    if (ring != NULL) {
+        return ring;
+    }
+
+    /* Reuse the ring of a thread that has exited. */
+    for (ring = __atomic_load_n(&writer->rings, __ATOMIC_ACQUIRE);
+         ring != NULL;
+         ring = ring->next)
+    {
+        int owned = 0;
+
+        if (__atomic_compare_exchange_n(&ring->owned, &owned, 1, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            break;
+        }
+    }
+
+    if (ring == NULL) {
+        ring = malloc(sizeof(*ring));
+        if (ring == NULL) {
+            return NULL;
+        }
+        ring->owned = 1;
+        ring->head = 0;
+        ring->tail = 0;
+        ring->ts_sec = (time_t)-1;
+        ring->next = __atomic_load_n(&writer->rings, __ATOMIC_RELAXED);
+        while (! __atomic_compare_exchange_n(&writer->rings, &ring->next,
+                                             ring, true,
+                                             __ATOMIC_RELEASE,
+                                             __ATOMIC_RELAXED))
+        {
+            /* ring->next has been reloaded */
+        }
+    }
+
+    if (pthread_setspecific(writer->key, ring) != 0) {
+        core_log_ring_release(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+/**
+ * Wake up the writer thread if it's waiting.
+ *
+ * @param[in] writer Writer
+ */
+static void core_log_writer_wake(core_log_writer_t *writer)
+{
+    if (__atomic_load_n(&writer->sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&writer->mutex);
+        pthread_cond_signal(&writer->cond);
+        pthread_mutex_unlock(&writer->mutex);
+    }
+}
+
+/**
+ * Format the current time as ib_clock_timestamp() does.
+ *
+ * The date and time zone are only formatted once per second.
+ *
+ * @param[in] ring Calling thread's ring (holds the cache)
+ * @param[out] buf Buffer of at least 30 bytes
+ */
+static void core_log_timestamp(core_log_ring_t *ring, char *buf)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec != ring->ts_sec) {
+        time_t t = tv.tv_sec;
+        struct tm tm;
+
+        localtime_r(&t, &tm);
+        strftime(ring->ts_date, sizeof(ring->ts_date), "%Y-%m-%dT%H:%M:%S",
+                 &tm);
+        strftime(ring->ts_zone, sizeof(ring->ts_zone), "%z", &tm);
+        ring->ts_sec = tv.tv_sec;
+    }
+
+    snprintf(buf, 30, "%.19s.%04u%.5s",
+             ring->ts_date, (unsigned)(tv.tv_usec / 100) % 10000,
+             ring->ts_zone);
+}
+
+ib_status_t core_log_writer_vlog(core_log_writer_t *writer,
+                                 ib_log_level_t level,
+                                 const char *line_info,
+                                 const char *fmt,
+                                 va_list ap)
+{
+    assert(writer != NULL);
+    assert(line_info != NULL);
+    assert(fmt != NULL);
+
+    core_log_ring_t *ring;
+    core_log_record_t *record;
+    char time_info[30];
+    size_t tail;
+    size_t len;
+    int n;
+
+    if (writer->forks != core_log_forks) {
+        return IB_EOTHER;
+    }
+
+    ring = core_log_ring_get(writer);
+    if (ring == NULL) {
+        return IB_EALLOC;
+    }
+
+    /* Wait for room in the ring. */
+    tail = ring->tail;
+    while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >=
+           CORE_LOG_RING_SIZE)
+    {
+        core_log_writer_wake(writer);
+        usleep(CORE_LOG_FULL_WAIT_US);
+    }
+    record = &(ring->records[tail & (CORE_LOG_RING_SIZE - 1)]);
+
+    core_log_timestamp(ring, time_info);
+    n = snprintf(record->text, CORE_LOG_LINE_MAX, "%s %-10s- %s [%d] ",
+                 time_info, ib_log_level_to_string(level), line_info,
+                 (int)writer->pid);
+    len = (n < 0) ? 0 : (size_t)n;
+    if (len < CORE_LOG_LINE_MAX) {
+        n = vsnprintf(record->text + len, CORE_LOG_LINE_MAX - len, fmt, ap);
+        len += (n < 0) ? 0 : (size_t)n;
+    }
+    if (len < CORE_LOG_LINE_MAX - 1) {
+        record->text[len++] = '\n';
+    }
+    else {
+        len = CORE_LOG_LINE_MAX - 1;
+        memcpy(record->text + len - (sizeof(CORE_LOG_TRUNCATED) - 1),
+               CORE_LOG_TRUNCATED, sizeof(CORE_LOG_TRUNCATED) - 1);
+    }
+    record->len = len;
+
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+    /* Errors are written right away, and so is a filling ring. */
+    if ( (level <= IB_LOG_ERROR) ||
+         (tail + 1 - __atomic_load_n(&ring->head, __ATOMIC_RELAXED) >=
+          CORE_LOG_RING_SIZE / 2) )
+    {
+        core_log_writer_wake(writer);
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Write all of the records in the rings (writer thread only).
+ *
+ * @param[in] writer Writer
+ *
+ * @returns Number of records written.
+ */
+static size_t core_log_writer_drain(core_log_writer_t *writer)
+{
+    core_log_ring_t *ring;
+    size_t written = 0;
+
+    for (ring = __atomic_load_n(&writer->rings, __ATOMIC_ACQUIRE);
+         ring != NULL;
+         ring = ring->next)
+    {
+        size_t head = ring->head;
+        size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; ++head) {
+            const core_log_record_t *record =
+                &(ring->records[head & (CORE_LOG_RING_SIZE - 1)]);
+
+            fwrite(record->text, 1, record->len, writer->fp);
+            ++written;
+        }
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    }
+
+    if (written > 0) {
+        fflush(writer->fp);
+    }
+
+    return written;
+}
+
+/**
+ * Writer thread.
+ *
+ * @param[in] arg Writer
+ *
+ * @returns NULL
+ */
+static void *core_log_writer_thread(void *arg)
+{
+    core_log_writer_t *writer = (core_log_writer_t *)arg;
+
+    for (;;) {
+        struct timespec ts;
+        bool stop;
+
+        core_log_writer_drain(writer);
+
+        pthread_mutex_lock(&writer->mutex);
+        stop = __atomic_load_n(&writer->stop, __ATOMIC_SEQ_CST);
+        if (! stop) {
+            __atomic_store_n(&writer->sleeping, 1, __ATOMIC_SEQ_CST);
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += CORE_LOG_FLUSH_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec += 1;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&writer->cond, &writer->mutex, &ts);
+            __atomic_store_n(&writer->sleeping, 0, __ATOMIC_SEQ_CST);
+        }
+        pthread_mutex_unlock(&writer->mutex);
+
+        if (stop) {
+            break;
+        }
+    }
+
+    /* Anything logged before the stop was requested. */
+    core_log_writer_drain(writer);
+
+    return NULL;
+}
+
+ib_status_t core_log_writer_create(FILE *fp, core_log_writer_t **pwriter)
+{
+    assert(fp != NULL);
+    assert(pwriter != NULL);
+
+    static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+    core_log_writer_t *writer;
+
+    pthread_once(&atfork_once, core_log_atfork_register);
+
+    writer = calloc(1, sizeof(*writer));
+    if (writer == NULL) {
+        return IB_EALLOC;
+    }
+    writer->fp = fp;
+    writer->pid = getpid();
+    writer->forks = core_log_forks;
+
+    if (pthread_key_create(&writer->key, core_log_ring_release) != 0) {
+        free(writer);
+        return IB_EUNKNOWN;
+    }
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+
+    if (pthread_create(&writer->thread, NULL,
+                       core_log_writer_thread, writer) != 0)
+    {
+        pthread_cond_destroy(&writer->cond);
+        pthread_mutex_destroy(&writer->mutex);
+        pthread_key_delete(writer->key);
+        free(writer);
+        return IB_EUNKNOWN;
+    }
+
+    *pwriter = writer;
+    return IB_OK;
+}
+
+void core_log_writer_destroy(core_log_writer_t *writer)
+{
+    core_log_ring_t *ring;
+
+    if (writer == NULL) {
+        return;
+    }
+
+    if (writer->forks == core_log_forks) {
+        pthread_mutex_lock(&writer->mutex);
+        __atomic_store_n(&writer->stop, 1, __ATOMIC_SEQ_CST);
+        pthread_cond_signal(&writer->cond);
+        pthread_mutex_unlock(&writer->mutex);
+        pthread_join(writer->thread, NULL);
+    }
+
+    /* No more ring releases once the key is gone. */
+    pthread_key_delete(writer->key);
+
+    while (writer->rings != NULL) {
+        ring = writer->rings;
+        writer->rings = ring->next;
+        free(ring);
+    }
+
+    pthread_cond_destroy(&writer->cond);
+    pthread_mutex_destroy(&writer->mutex);
+    free(writer);
+}
@@ -29,8 +29,12 @@
 
 #include <ironbee/context_selection.h>
 #include <ironbee/engine.h>
+#include <ironbee/log.h>
 #include <ironbee/types.h>
 
+#include <stdarg.h>
+#include <stdio.h>
+
 typedef struct {
     const char      *name;          /**< Flag name */
     const char      *tx_name;       /**< Name in the TX "FLAGS" collection */
@@ -42,7 +46,10 @@ typedef struct {
 /** Core-module-specific non-context-aware data accessed via module->data */
 typedef struct {
     ib_list_t            *site_list;      /**< List: ib_site_t */
-    ib_list_t            *selector_list;  /**< List: core_site_selector_t */
+    struct core_site_index_t *site_index; /**< Site selection index */
+    struct core_audit_writer_t *audit_writer; /**< Async audit log writer */
+    struct core_log_writer_t *log_writer; /**< Async logger */
+    int                   log_writer_users; /**< Threads using log_writer */
     ib_context_t         *cur_ctx;        /**< Current context */
     ib_site_t            *cur_site;       /**< Current site */
     ib_site_location_t   *cur_location;   /**< Current location */
@@ -160,4 +167,54 @@ ib_status_t ib_core_collection_managers_register(
     const ib_module_t *module);
 
 
+/** Core asynchronous logger functions */
+
+typedef struct core_log_writer_t core_log_writer_t;
+
+/**
+ * Create an asynchronous logger and start its writer thread.
+ *
+ * @param[in] fp Log file (must outlive the logger)
+ * @param[out] pwriter The new logger
+ *
+ * @returns IB_OK, IB_EALLOC or IB_EUNKNOWN if the thread can't be started.
+ */
+ib_status_t core_log_writer_create(FILE *fp, core_log_writer_t **pwriter);
+
+/**
+ * Write out any buffered messages and destroy an asynchronous logger.
+ *
+ * No thread may be in core_log_writer_vlog() during or after this call;
+ * the core unpublishes the logger and waits for its users first.
+ *
+ * @param[in] writer Logger to destroy
+ */
+void core_log_writer_destroy(core_log_writer_t *writer);
+
+/**
+ * Format a log message into the calling thread's buffer.
+ *
+ * The message is written by the writer thread.  This doesn't allocate
+ * memory, except the first time a thread logs.
+ *
+ * @param[in] writer Logger
+ * @param[in] level Log level
+ * @param[in] line_info Source location prefix (may be empty)
+ * @param[in] fmt Printf-like format string
+ * @param[in] ap Argument list
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC if the thread's buffer can't be allocated.
+ * - IB_EOTHER if the writer thread doesn't exist in this process (the
+ *   process has forked).
+ */
+ib_status_t core_log_writer_vlog(core_log_writer_t *writer,
+                                 ib_log_level_t level,
+                                 const char *line_info,
+                                 const char *fmt,
+                                 va_list ap)
+VPRINTF_ATTRIBUTE(4);
+
+
 #endif /* _IB_CORE_PRIVATE_H_ */
@@ -40,6 +40,27 @@
 #include <assert.h>
 #include <ctype.h>
 
+/**
+ * Convert string operation result flags to transformation flags.
+ *
+ * @param[in] result String operation result flags (@c IB_STRFLAG_xx).
+ * @param[out] pflags Transformation flags.
+ *
+ * @returns IB_OK
+ */
+static ib_status_t tfn_inplace_flags(ib_flags_t result,
+                                     ib_flags_t *pflags)
+{
+    if (ib_flags_all(result, IB_STRFLAG_MODIFIED)) {
+        *pflags = IB_TFN_FMODIFIED;
+    }
+    else {
+        *pflags = IB_TFN_NONE;
+    }
+
+    return IB_OK;
+}
+
 /**
  * String modification transformation core
  *
@@ -91,6 +112,11 @@ static ib_status_t tfn_strmod(ib_engine_t *ib,
         if (rc != IB_OK) {
             return rc;
         }
+        /* Unmodified values are passed through rather than copied */
+        if (! ib_flags_all(result, IB_STRFLAG_MODIFIED)) {
+            *fout = (ib_field_t *)fin;
+            break;
+        }
         rc = ib_field_create(fout, mp,
                              fin->name, fin->nlen,
                              IB_FTYPE_NULSTR,
@@ -126,6 +152,10 @@ static ib_status_t tfn_strmod(ib_engine_t *ib,
         if (rc != IB_OK) {
             return rc;
         }
+        if (! ib_flags_all(result, IB_STRFLAG_MODIFIED)) {
+            *fout = (ib_field_t *)fin;
+            break;
+        }
         rc = ib_field_create_bytestr_alias(fout, mp,
                                            fin->name, fin->nlen,
                                            dout, dlen);
@@ -150,6 +180,48 @@ static ib_status_t tfn_strmod(ib_engine_t *ib,
     return IB_OK;
 }
 
+/**
+ * In-place string modification transformation core
+ *
+ * @param[in] mp Memory pool to use for allocations.
+ * @param[in] ex_fn EX (string/length) transformation function
+ * @param[in,out] data_in Input data.
+ * @param[in] dlen_in Length of @a data_in.
+ * @param[out] data_out Output data.
+ * @param[out] dlen_out Length of @a data_out.
+ * @param[out] pflags Transformation flags.
+ *
+ * @returns IB_OK if successful.
+ */
+static ib_status_t tfn_strmod_inplace(ib_mpool_t *mp,
+                                      ib_strmod_ex_fn_t ex_fn,
+                                      uint8_t *data_in,
+                                      size_t dlen_in,
+                                      uint8_t **data_out,
+                                      size_t *dlen_out,
+                                      ib_flags_t *pflags)
+{
+    ib_status_t rc;
+    ib_flags_t result;
+
+    assert(mp != NULL);
+    assert(ex_fn != NULL);
+    assert(data_in != NULL);
+    assert(data_out != NULL);
+    assert(dlen_out != NULL);
+    assert(pflags != NULL);
+
+    rc = ex_fn(IB_STROP_INPLACE, mp,
+               data_in, dlen_in,
+               data_out, dlen_out,
+               &result);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    return tfn_inplace_flags(result, pflags);
+}
+
 /**
  * Simple ASCII lowercase function.
  *
@@ -176,6 +248,36 @@ static ib_status_t tfn_lowercase(ib_engine_t *ib,
     return rc;
 }
 
+/**
+ * Simple ASCII lowercase function (in-place version)
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] mp Memory pool to use for allocations.
+ * @param[in] fndata Function specific data.
+ * @param[in,out] data_in Input data.
+ * @param[in] dlen_in Length of @a data_in.
+ * @param[out] data_out Output data.
+ * @param[out] dlen_out Length of @a data_out.
+ * @param[out] pflags Transformation flags.
+ *
+ * @returns IB_OK if successful.
+ */
+static ib_status_t tfn_lowercase_inplace(ib_engine_t *ib,
+                                         ib_mpool_t *mp,
+                                         void *fndata,
+                                         uint8_t *data_in,
+                                         size_t dlen_in,
+                                         uint8_t **data_out,
+                                         size_t *dlen_out,
+                                         ib_flags_t *pflags)
+{
+    ib_status_t rc = tfn_strmod_inplace(mp, ib_strlower_ex,
+                                        data_in, dlen_in,
+                                        data_out, dlen_out, pflags);
+
+    return rc;
+}
+
 /**
  * Simple ASCII trim (left) transformation.
  *
@@ -202,6 +304,36 @@ static ib_status_t tfn_trim_left(ib_engine_t *ib,
     return rc;
 }
 
+/**
+ * Simple ASCII trim (left) transformation (in-place version)
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] mp Memory pool to use for allocations.
+ * @param[in] fndata Function specific data.
+ * @param[in,out] data_in Input data.
+ * @param[in] dlen_in Length of @a data_in.
+ * @param[out] data_out Output data.
+ * @param[out] dlen_out Length of @a data_out.
+ * @param[out] pflags Transformation flags.
+ *
+ * @returns IB_OK if successful.
+ */
+static ib_status_t tfn_trim_left_inplace(ib_engine_t *ib,
+                                         ib_mpool_t *mp,
+                                         void *fndata,
+                                         uint8_t *data_in,
+                                         size_t dlen_in,
+                                         uint8_t **data_out,
+                                         size_t *dlen_out,
+                                         ib_flags_t *pflags)
+{
+    ib_status_t rc = tfn_strmod_inplace(mp, ib_strtrim_left_ex,
+                                        data_in, dlen_in,
+                                        data_out, dlen_out, pflags);
+
+    return rc;
+}
+
 /**
  * Simple ASCII trim (right) transformation.
  *
@@ -228,6 +360,36 @@ static ib_status_t tfn_trim_right(ib_engine_t *ib,
     return rc;
 }
 
+/**
+ * Simple ASCII trim (right) transformation (in-place version)
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] mp Memory pool to use for allocations.
+ * @param[in] fndata Function specific data.
+ * @param[in,out] data_in Input data.
+ * @param[in] dlen_in Length of @a data_in.
+ * @param[out] data_out Output data.
+ * @param[out] dlen_out Length of @a data_out.
+ * @param[out] pflags Transformation flags.
+ *
+ * @returns IB_OK if successful.
+ */
+static ib_status_t tfn_trim_right_inplace(ib_engine_t *ib,
+                                          ib_mpool_t *mp,
+                                          void *fndata,
+                                          uint8_t *data_in,
+                                          size_t dlen_in,
+                                          uint8_t **data_out,
+                                          size_t *dlen_out,
+                                          ib_flags_t *pflags)
+{
+    ib_status_t rc = tfn_strmod_inplace(mp, ib_strtrim_right_ex,
+                                        data_in, dlen_in,
+                                        data_out, dlen_out, pflags);
+
+    return rc;
+}
+
 /**
  * Simple ASCII trim transformation.
  *
@@ -254,6 +416,36 @@ static ib_status_t tfn_trim(ib_engine_t *ib,
     return rc;
 }
 
+/**
+ * Simple ASCII trim transformation (in-place version)
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] mp Memory pool to use for allocations.
+ * @param[in] fndata Function specific data.
+ * @param[in,out] data_in Input data.
+ * @param[in] dlen_in Length of @a data_in.
+ * @param[out] data_out Output data.
+ * @param[out] dlen_out Length of @a data_out.
+ * @param[out] pflags Transformation flags.
+ *
+ * @returns IB_OK if successful.
+ */
+static ib_status_t tfn_trim_inplace(ib_engine_t *ib,
+                                    ib_mpool_t *mp,
+                                    void *fndata,
+                                    uint8_t *data_in,
+                                    size_t dlen_in,
+                                    uint8_t **data_out,
+                                    size_t *dlen_out,
+                                    ib_flags_t *pflags)
+{
+    ib_status_t rc = tfn_strmod_inplace(mp, ib_strtrim_lr_ex,
+                                        data_in, dlen_in,
+                                        data_out, dlen_out, pflags);
+
+    return rc;
+}
+
 /**
  * Remove all whitespace from a string
  *
@@ -280,6 +472,36 @@ static ib_status_t tfn_wspc_remove(ib_engine_t *ib,
     return rc;
 }
 
+/**
+ * Remove all whitespace from a string (in-place version)
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] mp Memory pool to use for allocations.
+ * @param[in] fndata Function specific data.
+ * @param[in,out] data_in Input data.
+ * @param[in] dlen_in Length of @a data_in.
+ * @param[out] data_out Output data.
+ * @param[out] dlen_out Length of @a data_out.
+ * @param[out] pflags Transformation flags.
+ *
+ * @returns IB_OK if successful.
+ */
+static ib_status_t tfn_wspc_remove_inplace(ib_engine_t *ib,
+                                           ib_mpool_t *mp,
+                                           void *fndata,
+                                           uint8_t *data_in,
+                                           size_t dlen_in,
+                                           uint8_t **data_out,
+                                           size_t *dlen_out,
+                                           ib_flags_t *pflags)
+{
+    ib_status_t rc = tfn_strmod_inplace(mp, ib_str_wspc_remove_ex,
+                                        data_in, dlen_in,
+                                        data_out, dlen_out, pflags);
+
+    return rc;
+}
+
 /**
  * Compress whitespace in a string
  *
@@ -306,6 +528,36 @@ static ib_status_t tfn_wspc_compress(ib_engine_t *ib,
     return rc;
 }
 
+/**
+ * Compress whitespace in a string (in-place version)
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] mp Memory pool to use for allocations.
+ * @param[in] fndata Function specific data.
+ * @param[in,out] data_in Input data.
+ * @param[in] dlen_in Length of @a data_in.
+ * @param[out] data_out Output data.
+ * @param[out] dlen_out Length of @a data_out.
+ * @param[out] pflags Transformation flags.
+ *
+ * @returns IB_OK if successful.
+ */
+static ib_status_t tfn_wspc_compress_inplace(ib_engine_t *ib,
+                                             ib_mpool_t *mp,
+                                             void *fndata,
+                                             uint8_t *data_in,
+                                             size_t dlen_in,
+                                             uint8_t **data_out,
+                                             size_t *dlen_out,
+                                             ib_flags_t *pflags)
+{
+    ib_status_t rc = tfn_strmod_inplace(mp, ib_str_wspc_compress_ex,
+                                        data_in, dlen_in,
+                                        data_out, dlen_out, pflags);
+
+    return rc;
+}
+
 /**
  * Length transformation
  *
@@ -721,6 +973,10 @@ static ib_status_t tfn_url_decode(ib_engine_t *ib,
         if (rc != IB_OK) {
             return rc;
         }
+        if (! ib_flags_all(result, IB_STRFLAG_MODIFIED)) {
+            *fout = (ib_field_t *)fin;
+            break;
+        }
         rc = ib_field_create(fout, mp,
                              fin->name, fin->nlen,
                              IB_FTYPE_NULSTR,
@@ -756,6 +1012,10 @@ static ib_status_t tfn_url_decode(ib_engine_t *ib,
         if (rc != IB_OK) {
             return rc;
         }
+        if (! ib_flags_all(result, IB_STRFLAG_MODIFIED)) {
+            *fout = (ib_field_t *)fin;
+            break;
+        }
         rc = ib_field_create_bytestr_alias(fout, mp,
                                            fin->name, fin->nlen,
                                            dout, dlen);
@@ -779,6 +1039,46 @@ static ib_status_t tfn_url_decode(ib_engine_t *ib,
     return IB_OK;
 }
 
+/**
+ * URL Decode transformation (in-place version)
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] mp Memory pool to use for allocations.
+ * @param[in] fndata Function specific data.
+ * @param[in,out] data_in Input data.
+ * @param[in] dlen_in Length of @a data_in.
+ * @param[out] data_out Output data.
+ * @param[out] dlen_out Length of @a data_out.
+ * @param[out] pflags Transformation flags.
+ *
+ * @returns IB_OK if successful.
+ */
+static ib_status_t tfn_url_decode_inplace(ib_engine_t *ib,
+                                          ib_mpool_t *mp,
+                                          void *fndata,
+                                          uint8_t *data_in,
+                                          size_t dlen_in,
+                                          uint8_t **data_out,
+                                          size_t *dlen_out,
+                                          ib_flags_t *pflags)
+{
+    ib_status_t rc;
+    ib_flags_t result;
+
+    assert(data_in != NULL);
+    assert(data_out != NULL);
+    assert(dlen_out != NULL);
+    assert(pflags != NULL);
+
+    rc = ib_util_decode_url_ex(data_in, dlen_in, dlen_out, &result);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    *data_out = data_in;
+
+    return tfn_inplace_flags(result, pflags);
+}
+
 /**
  * HTML entity decode transformation
  *
@@ -826,6 +1126,10 @@ static ib_status_t tfn_html_entity_decode(ib_engine_t *ib,
         if (rc != IB_OK) {
             return rc;
         }
+        if (! ib_flags_all(result, IB_STRFLAG_MODIFIED)) {
+            *fout = (ib_field_t *)fin;
+            break;
+        }
         rc = ib_field_create(fout, mp,
                              fin->name, fin->nlen,
                              IB_FTYPE_NULSTR,
@@ -861,6 +1165,10 @@ static ib_status_t tfn_html_entity_decode(ib_engine_t *ib,
         if (rc != IB_OK) {
             return rc;
         }
+        if (! ib_flags_all(result, IB_STRFLAG_MODIFIED)) {
+            *fout = (ib_field_t *)fin;
+            break;
+        }
         rc = ib_field_create_bytestr_alias(fout, mp,
                                            fin->name, fin->nlen,
                                            dout, dlen);
@@ -884,6 +1192,46 @@ static ib_status_t tfn_html_entity_decode(ib_engine_t *ib,
     return IB_OK;
 }
 
+/**
+ * HTML entity decode transformation (in-place version)
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] mp Memory pool to use for allocations.
+ * @param[in] fndata Function specific data.
+ * @param[in,out] data_in Input data.
+ * @param[in] dlen_in Length of @a data_in.
+ * @param[out] data_out Output data.
+ * @param[out] dlen_out Length of @a data_out.
+ * @param[out] pflags Transformation flags.
+ *
+ * @returns IB_OK if successful.
+ */
+static ib_status_t tfn_html_entity_decode_inplace(ib_engine_t *ib,
+                                                  ib_mpool_t *mp,
+                                                  void *fndata,
+                                                  uint8_t *data_in,
+                                                  size_t dlen_in,
+                                                  uint8_t **data_out,
+                                                  size_t *dlen_out,
+                                                  ib_flags_t *pflags)
+{
+    ib_status_t rc;
+    ib_flags_t result;
+
+    assert(data_in != NULL);
+    assert(data_out != NULL);
+    assert(dlen_out != NULL);
+    assert(pflags != NULL);
+
+    rc = ib_util_decode_html_entity_ex(data_in, dlen_in, dlen_out, &result);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    *data_out = data_in;
+
+    return tfn_inplace_flags(result, pflags);
+}
+
 /**
  * Path normalization transformation
  *
@@ -931,6 +1279,10 @@ static ib_status_t normalize_path(ib_engine_t *ib,
         if (rc != IB_OK) {
             return rc;
         }
+        if (! ib_flags_all(result, IB_STRFLAG_MODIFIED)) {
+            *fout = (ib_field_t *)fin;
+            break;
+        }
         rc = ib_field_create(fout, mp,
                              fin->name, fin->nlen,
                              IB_FTYPE_NULSTR,
@@ -966,6 +1318,10 @@ static ib_status_t normalize_path(ib_engine_t *ib,
         if (rc != IB_OK) {
             return rc;
         }
+        if (! ib_flags_all(result, IB_STRFLAG_MODIFIED)) {
+            *fout = (ib_field_t *)fin;
+            break;
+        }
         rc = ib_field_create_bytestr_alias(fout, mp,
                                            fin->name, fin->nlen,
                                            dout, dlen);
@@ -1020,6 +1376,47 @@ static ib_status_t tfn_normalize_path(ib_engine_t *ib,
     return rc;
 }
 
+/**
+ * Path normalization transformation (in-place version)
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] mp Memory pool to use for allocations.
+ * @param[in] fndata Function specific data.
+ * @param[in,out] data_in Input data.
+ * @param[in] dlen_in Length of @a data_in.
+ * @param[out] data_out Output data.
+ * @param[out] dlen_out Length of @a data_out.
+ * @param[out] pflags Transformation flags.
+ *
+ * @returns IB_OK if successful.
+ */
+static ib_status_t tfn_normalize_path_inplace(ib_engine_t *ib,
+                                              ib_mpool_t *mp,
+                                              void *fndata,
+                                              uint8_t *data_in,
+                                              size_t dlen_in,
+                                              uint8_t **data_out,
+                                              size_t *dlen_out,
+                                              ib_flags_t *pflags)
+{
+    ib_status_t rc;
+    ib_flags_t result;
+
+    assert(data_in != NULL);
+    assert(data_out != NULL);
+    assert(dlen_out != NULL);
+    assert(pflags != NULL);
+
+    rc = ib_util_normalize_path_ex(data_in, dlen_in, false,
+                                   dlen_out, &result);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    *data_out = data_in;
+
+    return tfn_inplace_flags(result, pflags);
+}
+
 /**
  * Path normalization transformation with support for Windows path separator
  *
@@ -1051,6 +1448,47 @@ static ib_status_t tfn_normalize_path_win(ib_engine_t *ib,
     return rc;
 }
 
+/**
+ * Path normalization transformation with support for Windows path separator (in-place version)
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] mp Memory pool to use for allocations.
+ * @param[in] fndata Function specific data.
+ * @param[in,out] data_in Input data.
+ * @param[in] dlen_in Length of @a data_in.
+ * @param[out] data_out Output data.
+ * @param[out] dlen_out Length of @a data_out.
+ * @param[out] pflags Transformation flags.
+ *
+ * @returns IB_OK if successful.
+ */
+static ib_status_t tfn_normalize_path_win_inplace(ib_engine_t *ib,
+                                                  ib_mpool_t *mp,
+                                                  void *fndata,
+                                                  uint8_t *data_in,
+                                                  size_t dlen_in,
+                                                  uint8_t **data_out,
+                                                  size_t *dlen_out,
+                                                  ib_flags_t *pflags)
+{
+    ib_status_t rc;
+    ib_flags_t result;
+
+    assert(data_in != NULL);
+    assert(data_out != NULL);
+    assert(dlen_out != NULL);
+    assert(pflags != NULL);
+
+    rc = ib_util_normalize_path_ex(data_in, dlen_in, true,
+                                   dlen_out, &result);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    *data_out = data_in;
+
+    return tfn_inplace_flags(result, pflags);
+}
+
 /**
  * Initialize the core transformations
  **/
@@ -1059,43 +1497,50 @@ ib_status_t ib_core_transformations_init(ib_engine_t *ib, ib_module_t *mod)
     ib_status_t rc;
 
     /* Define transformations. */
-    rc = ib_tfn_register(ib, "lowercase", tfn_lowercase,
-                         IB_TFN_FLAG_NONE, NULL);
+    rc = ib_tfn_register_inplace(ib, "lowercase",
+                                 tfn_lowercase, tfn_lowercase_inplace,
+                                 IB_TFN_FLAG_NONE, NULL);
     if (rc != IB_OK) {
         return rc;
     }
-    rc = ib_tfn_register(ib, "lc", tfn_lowercase,
-                         IB_TFN_FLAG_NONE, NULL);
+    rc = ib_tfn_register_inplace(ib, "lc",
+                                 tfn_lowercase, tfn_lowercase_inplace,
+                                 IB_TFN_FLAG_NONE, NULL);
     if (rc != IB_OK) {
         return rc;
     }
 
-    rc = ib_tfn_register(ib, "trimLeft", tfn_trim_left,
-                         IB_TFN_FLAG_NONE, NULL);
+    rc = ib_tfn_register_inplace(ib, "trimLeft",
+                                 tfn_trim_left, tfn_trim_left_inplace,
+                                 IB_TFN_FLAG_NONE, NULL);
     if (rc != IB_OK) {
         return rc;
     }
 
-    rc = ib_tfn_register(ib, "trimRight", tfn_trim_right,
-                         IB_TFN_FLAG_NONE, NULL);
+    rc = ib_tfn_register_inplace(ib, "trimRight",
+                                 tfn_trim_right, tfn_trim_right_inplace,
+                                 IB_TFN_FLAG_NONE, NULL);
     if (rc != IB_OK) {
         return rc;
     }
 
-    rc = ib_tfn_register(ib, "trim", tfn_trim,
-                         IB_TFN_FLAG_NONE, NULL);
+    rc = ib_tfn_register_inplace(ib, "trim",
+                                 tfn_trim, tfn_trim_inplace,
+                                 IB_TFN_FLAG_NONE, NULL);
     if (rc != IB_OK) {
         return rc;
     }
 
-    rc = ib_tfn_register(ib, "removeWhitespace", tfn_wspc_remove,
-                         IB_TFN_FLAG_NONE, NULL);
+    rc = ib_tfn_register_inplace(ib, "removeWhitespace",
+                                 tfn_wspc_remove, tfn_wspc_remove_inplace,
+                                 IB_TFN_FLAG_NONE, NULL);
     if (rc != IB_OK) {
         return rc;
     }
 
-    rc = ib_tfn_register(ib, "compressWhitespace", tfn_wspc_compress,
-                         IB_TFN_FLAG_NONE, NULL);
+    rc = ib_tfn_register_inplace(ib, "compressWhitespace",
+                                 tfn_wspc_compress, tfn_wspc_compress_inplace,
+                                 IB_TFN_FLAG_NONE, NULL);
     if (rc != IB_OK) {
         return rc;
     }
@@ -1124,26 +1569,30 @@ ib_status_t ib_core_transformations_init(ib_engine_t *ib, ib_module_t *mod)
         return rc;
     }
 
-    rc = ib_tfn_register(ib, "urlDecode", tfn_url_decode,
-                         IB_TFN_FLAG_NONE, NULL);
+    rc = ib_tfn_register_inplace(ib, "urlDecode",
+                                 tfn_url_decode, tfn_url_decode_inplace,
+                                 IB_TFN_FLAG_NONE, NULL);
     if (rc != IB_OK) {
         return rc;
     }
 
-    rc = ib_tfn_register(ib, "htmlEntityDecode", tfn_html_entity_decode,
-                         IB_TFN_FLAG_NONE, NULL);
+    rc = ib_tfn_register_inplace(ib, "htmlEntityDecode",
+                                 tfn_html_entity_decode, tfn_html_entity_decode_inplace,
+                                 IB_TFN_FLAG_NONE, NULL);
     if (rc != IB_OK) {
         return rc;
     }
 
-    rc = ib_tfn_register(ib, "normalizePath", tfn_normalize_path,
-                         IB_TFN_FLAG_NONE, NULL);
+    rc = ib_tfn_register_inplace(ib, "normalizePath",
+                                 tfn_normalize_path, tfn_normalize_path_inplace,
+                                 IB_TFN_FLAG_NONE, NULL);
     if (rc != IB_OK) {
         return rc;
     }
 
-    rc = ib_tfn_register(ib, "normalizePathWin", tfn_normalize_path_win,
-                         IB_TFN_FLAG_NONE, NULL);
+    rc = ib_tfn_register_inplace(ib, "normalizePathWin",
+                                 tfn_normalize_path_win, tfn_normalize_path_win_inplace,
+                                 IB_TFN_FLAG_NONE, NULL);
     if (rc != IB_OK) {
         return rc;
     }
@@ -27,6 +27,7 @@
 
 #include <ironbee/data.h>
 
+#include <ironbee/array.h>
 #include <ironbee/bytestr.h>
 #include <ironbee/engine.h>
 #include <ironbee/expand.h>
@@ -60,17 +61,317 @@ static const char *IB_VARIABLE_EXPANSION_POSTFIX = "}";
 
 struct ib_data_t
 {
-    ib_mpool_t *mp;    /**< Memory pool. */
-    ib_hash_t  *hash;  /**< Hash of data fields. */
+    ib_mpool_t *mp;          /**< Memory pool. */
+    ib_hash_t  *hash;        /**< Hash of data fields. */
+    ib_hash_t  *index;       /**< List -> data_index_t (see below). */
+    size_t      generation;  /**< Bumped when a new top-level key appears. */
+
+    const ib_data_config_t *config; /**< Indexed names or NULL. */
+    ib_field_t **slots;      /**< Fields of indexed names, by index. */
+    size_t       num_slots;  /**< Size of @c slots. */
+};
+
+/**
+ * An indexed field name.
+ */
+typedef struct {
+    const char *name;        /**< Name. */
+    size_t      nlen;        /**< Length of @c name. */
+    size_t      index;       /**< Index. */
+} data_config_entry_t;
+
+/**
+ * Registry of indexed field names.
+ */
+struct ib_data_config_t
+{
+    ib_mpool_t *mp;          /**< Memory pool. */
+    ib_hash_t  *by_name;     /**< Name -> data_config_entry_t. */
+    ib_array_t *by_index;    /**< Index -> data_config_entry_t. */
+};
+
+/**
+ * Lists with fewer elements than this are scanned for subfields rather
+ * than indexed.
+ */
+#define DATA_INDEX_MIN_ELEMENTS 8
+
+/**
+ * Subfield name index of a list field.
+ *
+ * Built the first time a subfield of a list is looked up and rebuilt when
+ * the list has changed since.  Lists are only ever appended to or have
+ * elements removed, so the number of elements and the last node identify
+ * the state of a list.
+ */
+typedef struct {
+    const ib_list_t      *list;      /**< Indexed list (and index key). */
+    size_t                elements;  /**< Elements of @c list when indexed. */
+    const ib_list_node_t *last;      /**< Last node of @c list when indexed. */
+    ib_hash_t            *names;     /**< Name -> ib_list_t of fields. */
+} data_index_t;
+
+/**
+ * Precompiled field selector.
+ */
+struct ib_data_selector_t
+{
+    const char *name;        /**< Top-level field name. */
+    size_t      nlen;        /**< Length of @c name. */
+    const ib_data_config_t *config; /**< Registry of @c index or NULL. */
+    size_t      index;       /**< Index of @c name in @c config. */
+    const char *subfield;    /**< Subfield name or NULL. */
+    size_t      sublen;      /**< Length of @c subfield. */
+    pcre       *re;          /**< Subfield name pattern or NULL. */
+    pcre_extra *re_extra;    /**< Study data of @c re or NULL. */
 };
 
 /* Internal helper functions */
 
+/**
+ * Update the slot of an indexed field name, if @a name is indexed.
+ *
+ * @param[in] data Data.
+ * @param[in] name Name of field.
+ * @param[in] nlen Length of @a name.
+ * @param[in] field Field stored under @a name (or NULL if removed).
+ */
+static
+void data_slot_set(
+    ib_data_t  *data,
+    const char *name,
+    size_t      nlen,
+    ib_field_t *field
+)
+{
+    assert(data != NULL);
+
+    const data_config_entry_t *entry;
+    ib_status_t                rc;
+
+    if (data->num_slots == 0) {
+        return;
+    }
+
+    rc = ib_hash_get_ex(data->config->by_name, &entry, name, nlen);
+    if ( (rc == IB_OK) && (entry->index < data->num_slots) ) {
+        data->slots[entry->index] = field;
+    }
+}
+
+/**
+ * Set a top-level field in @a data, tracking the data generation.
+ *
+ * @param[in] data Data.
+ * @param[in] name Name of field.
+ * @param[in] nlen Length of @a name.
+ * @param[in] field Field to store (or NULL to remove).
+ *
+ * @returns Status code of ib_hash_set_ex().
+ */
+static
+ib_status_t ib_data_hash_set(
+    ib_data_t  *data,
+    const char *name,
+    size_t      nlen,
+    ib_field_t *field
+)
+{
+    assert(data != NULL);
+
+    size_t      size = ib_hash_size(data->hash);
+    ib_status_t rc;
+
+    rc = ib_hash_set_ex(data->hash, name, nlen, field);
+    if (ib_hash_size(data->hash) > size) {
+        ++data->generation;
+    }
+    if (rc == IB_OK) {
+        data_slot_set(data, name, nlen, field);
+    }
+
+    return rc;
+}
+
+/**
+ * Split a field name into top-level name and subfield name or pattern.
+ *
+ * The name is one of @c NAME, @c NAME:subfield or @c NAME:/pattern/.
+ *
+ * @param[in] name Field name.
+ * @param[in] name_len Length of @a name.
+ * @param[out] parent_len Length of the top-level name.
+ * @param[out] sub Subfield name or pattern; NULL if there is none.
+ * @param[out] sub_len Length of @a sub.
+ * @param[out] is_pattern True if @a sub is a pattern.
+ *
+ * @returns
+ *  - IB_OK on success.
+ *  - IB_EINVAL if the pattern is malformed (e.g. @c FOO:// ).
+ */
+static
+ib_status_t data_parse_name(
+    const char  *name,
+    size_t       name_len,
+    size_t      *parent_len,
+    const char **sub,
+    size_t      *sub_len,
+    bool        *is_pattern
+)
+{
+    assert(name != NULL);
+    assert(parent_len != NULL);
+    assert(sub != NULL);
+    assert(sub_len != NULL);
+    assert(is_pattern != NULL);
+
+    const char *filter_marker = memchr(name, DPI_LIST_FILTER_MARKER, name_len);
+    const char *filter_start;
+    const char *filter_end;
+
+    /* Typical no-expansion name. */
+    if (filter_marker == NULL) {
+        *parent_len = name_len;
+        *sub = NULL;
+        *sub_len = 0;
+        *is_pattern = false;
+        return IB_OK;
+    }
+
+    *parent_len = filter_marker - name;
+
+    filter_start = memchr(name, DPI_LIST_FILTER_PREFIX, name_len);
+    if ( filter_start && filter_start + 1 < name + name_len ) {
+        filter_end = memchr(filter_start+1,
+                            DPI_LIST_FILTER_SUFFIX,
+                            name_len - (filter_start+1-name));
+    }
+    else {
+        filter_end = NULL;
+    }
+
+    /* No pattern match.  Just a sub-field. */
+    if (filter_start == NULL || filter_end == NULL) {
+        *sub = filter_marker + 1;
+        *sub_len = name_len - (filter_marker+1-name);
+        *is_pattern = false;
+        return IB_OK;
+    }
+
+    /* Bad filter: FOO/: */
+    if (filter_marker != filter_start-1) {
+        return IB_EINVAL;
+    }
+
+    /* Bad filter: FOO:// */
+    if (filter_start == filter_end-1) {
+        return IB_EINVAL;
+    }
+
+    *sub = filter_start + 1;
+    *sub_len = filter_end - filter_start - 1;
+    *is_pattern = true;
+    return IB_OK;
+}
+
+/**
+ * Get the subfield name index of @a list, building it if needed.
+ *
+ * @param[in] data Data.
+ * @param[in] list List to index.
+ * @param[out] names Name index; case insensitive hash of names to lists
+ *                   of fields.
+ *
+ * @returns
+ *  - IB_OK on success.
+ *  - IB_EALLOC on allocation errors.
+ */
+static
+ib_status_t data_list_index(
+    const ib_data_t  *data,
+    const ib_list_t  *list,
+    ib_hash_t       **names
+)
+{
+    assert(data != NULL);
+    assert(list != NULL);
+    assert(names != NULL);
+
+    ib_status_t           rc;
+    data_index_t         *index;
+    const ib_list_node_t *node;
+
+    rc = ib_hash_get_ex(data->index, &index, &list, sizeof(list));
+    if (rc == IB_ENOENT) {
+        index = ib_mpool_calloc(data->mp, 1, sizeof(*index));
+        if (index == NULL) {
+            return IB_EALLOC;
+        }
+        index->list = list;
+        rc = ib_hash_set_ex(data->index,
+                            &index->list, sizeof(index->list),
+                            index);
+    }
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    /* Up to date? */
+    if ( (index->names != NULL) &&
+         (index->elements == ib_list_elements(list)) &&
+         (index->last == ib_list_last_const(list)) )
+    {
+        *names = index->names;
+        return IB_OK;
+    }
+
+    if (index->names == NULL) {
+        rc = ib_hash_create_nocase(&index->names, data->mp);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+    else {
+        ib_hash_clear(index->names);
+    }
+
+    IB_LIST_LOOP_CONST(list, node) {
+        ib_field_t *field = (ib_field_t *)ib_list_node_data_const(node);
+        ib_list_t  *fields;
+
+        rc = ib_hash_get_ex(index->names, &fields, field->name, field->nlen);
+        if (rc == IB_ENOENT) {
+            rc = ib_list_create(&fields, data->mp);
+            if (rc != IB_OK) {
+                return rc;
+            }
+            rc = ib_hash_set_ex(index->names,
+                                field->name, field->nlen,
+                                fields);
+        }
+        if (rc != IB_OK) {
+            return rc;
+        }
+
+        rc = ib_list_push(fields, field);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+
+    index->elements = ib_list_elements(list);
+    index->last = ib_list_last_const(list);
+    *names = index->names;
+
+    return IB_OK;
+}
+
 /**
  * Get a subfield from @a data.
  *
  * If @a parent_field is a list (IB_FTYPE_LIST) then a case insensitive
- * string comparison is done to find the first list element that matches.
+ * string comparison is done to find the list elements that match.  Large
+ * lists are indexed (see data_list_index()).
  *
  * If @a parent_field is a dynamic field, then the field @a name
  * is fetched from it and the return code from that operation is returned.
@@ -78,9 +379,8 @@ struct ib_data_t
  * @param[in] data         Data.
  * @param[in] parent_field The parent field that contains the requested field.
  *                         This must be an IB_FTYPE_LIST.
- * @param[in] name The regex to use to match member field names in
- *                 @a field_name.
- * @param[in] name_len The length of @a pattern.
+ * @param[in] name The name of the member fields to get.
+ * @param[in] name_len The length of @a name.
  * @param[out] result_field The result field.
  *
  * @returns
@@ -138,16 +438,41 @@ ib_status_t ib_data_get_subfields(
                 return rc;
             }
 
-            IB_LIST_LOOP(list, list_node) {
-                ib_field_t *list_field =
-                    (ib_field_t *) IB_LIST_NODE_DATA(list_node);
+            if (ib_list_elements(list) >= DATA_INDEX_MIN_ELEMENTS) {
+                ib_hash_t *names;
+                ib_list_t *fields;
+
+                rc = data_list_index(data, list, &names);
+                if (rc != IB_OK) {
+                    return rc;
+                }
 
-                if (list_field->nlen == name_len &&
-                    strncasecmp(list_field->name, name, name_len) == 0)
-                {
-                    rc = ib_list_push(result_list, list_field);
-                    if (rc != IB_OK) {
-                        return rc;
+                rc = ib_hash_get_ex(names, &fields, name, name_len);
+                if (rc == IB_OK) {
+                    IB_LIST_LOOP(fields, list_node) {
+                        rc = ib_list_push(result_list,
+                                          ib_list_node_data(list_node));
+                        if (rc != IB_OK) {
+                            return rc;
+                        }
+                    }
+                }
+                else if (rc != IB_ENOENT) {
+                    return rc;
+                }
+            }
+            else {
+                IB_LIST_LOOP(list, list_node) {
+                    ib_field_t *list_field =
+                        (ib_field_t *) IB_LIST_NODE_DATA(list_node);
+
+                    if (list_field->nlen == name_len &&
+                        strncasecmp(list_field->name, name, name_len) == 0)
+                    {
+                        rc = ib_list_push(result_list, list_field);
+                        if (rc != IB_OK) {
+                            return rc;
+                        }
                     }
                 }
             }
@@ -168,93 +493,63 @@ ib_status_t ib_data_get_subfields(
 }
 
 /**
- * Return a list of fields whose name matches @a pattern.
+ * Return a list of fields whose name matches the compiled pattern @a re.
  *
- * The list @a field_name is retrieved from @a data. Its members are iterated
- * through and the names of those fields compared against @a pattern. If the
- * name matches, the field is added to an @c ib_list_t* which will be returned
- * via @a result_field.
+ * The members of the list @a parent_field are iterated through and their
+ * names matched against @a re. If the name matches, the field is added to
+ * an @c ib_list_t* which will be returned via @a result_field.
  *
  * @param[in] data         Data.
  * @param[in] parent_field The parent field whose member fields will
- *                         be filtered with @a pattern.
+ *                         be filtered with @a re.
  *                         This must be an IB_FTYPE_LIST.
- * @param[in] pattern The regex to use to match member field names in
- *                    @a field_name.
- * @param[in] pattern_len The length of @a pattern.
+ * @param[in] re The regex to use to match member field names.
+ * @param[in] re_extra Study data of @a re (may be NULL).
  * @param[out] result_field The result field.
  *
  * @returns
  *  - IB_OK if a successful search is performed.
- *  - IB_EINVAL if field is not a list or the pattern cannot compile.
- *  - IB_ENOENT if the field name is not found.
+ *  - IB_EINVAL if field is not a list.
  */
 static
 ib_status_t ib_data_get_filtered_list(
     const ib_data_t           *data,
     const ib_field_t          *parent_field,
-    const char                *pattern,
-    size_t                     pattern_len,
+    const pcre                *re,
+    const pcre_extra          *re_extra,
     ib_field_t               **result_field
 )
 {
     assert(data != NULL);
-    assert(pattern != NULL);
+    assert(re != NULL);
     assert(parent_field != NULL);
-    assert(pattern_len > 0);
     assert(result_field != NULL);
 
     ib_status_t rc;
-    char *pattern_str = NULL; /* NULL terminated string to pass to pcre. */
-    pcre *pcre_pattern = NULL; /* PCRE pattern. */
-    const char *errptr = NULL; /* PCRE Error reporter. */
-    int erroffset; /* PCRE Error offset into subject reporter. */
     ib_list_t *list = NULL; /* Holds the value of field when fetched. */
     ib_list_node_t *list_node = NULL; /* A node in list. */
     ib_list_t *result_list = NULL; /* Holds matched list_node values. */
 
     /* Check that our input field is a list type. */
     if (parent_field->type != IB_FTYPE_LIST) {
-        rc = IB_EINVAL;
-        goto exit_label;
-    }
-
-    /* Allocate pattern_str to hold null terminated string. */
-    pattern_str = (char *)malloc(pattern_len+1);
-    if (pattern_str == NULL) {
-        rc = IB_EALLOC;
-        goto exit_label;
+        return IB_EINVAL;
     }
 
-    /* Build a string to hand to the pcre library. */
-    memcpy(pattern_str, pattern, pattern_len);
-    pattern_str[pattern_len] = '\0';
-
     rc = ib_field_value(parent_field, &list);
     if (rc != IB_OK) {
-        goto exit_label;
-    }
-
-    pcre_pattern = pcre_compile(pattern_str, 0, &errptr, &erroffset, NULL);
-    if (pcre_pattern == NULL) {
-        rc = IB_EINVAL;
-        goto exit_label;
-    }
-    if (errptr) {
-        rc = IB_EINVAL;
-        goto exit_label;
+        return rc;
     }
 
     rc = ib_list_create(&result_list, data->mp);
     if (rc != IB_OK) {
-        goto exit_label;
+        return rc;
     }
 
     IB_LIST_LOOP(list, list_node) {
         int pcre_rc;
         ib_field_t *list_field = (ib_field_t *)list_node->data;
-        pcre_rc = pcre_exec(pcre_pattern,
-                            NULL,
+        pcre_rc = pcre_exec(re,
+                            re_extra,
                             list_field->name,
                             list_field->nlen,
                             0,
@@ -265,7 +560,7 @@ ib_status_t ib_data_get_filtered_list(
         if (pcre_rc == 0) {
             rc = ib_list_push(result_list, list_node->data);
             if (rc != IB_OK) {
-                goto exit_label;
+                return rc;
             }
         }
     }
@@ -277,15 +572,104 @@ ib_status_t ib_data_get_filtered_list(
                          IB_FTYPE_LIST,
                          result_list);
 
+    return rc;
+}
 
-exit_label:
-    if (pattern_str) {
-        free(pattern_str);
+/**
+ * Compile a subfield name pattern.
+ *
+ * @param[in] pattern Pattern.
+ * @param[in] pattern_len Length of @a pattern.
+ * @param[in] study Study (and JIT compile, if available) the pattern?
+ * @param[out] re Compiled pattern; free with pcre_free().
+ * @param[out] re_extra Study data; free with data_pattern_free_study().
+ *
+ * @returns
+ *  - IB_OK on success.
+ *  - IB_EALLOC on allocation errors.
+ *  - IB_EINVAL if the pattern does not compile.
+ */
+static
+ib_status_t data_pattern_compile(
+    const char  *pattern,
+    size_t       pattern_len,
+    bool         study,
+    pcre       **re,
+    pcre_extra **re_extra
+)
+{
+    assert(pattern != NULL);
+    assert(re != NULL);
+    assert(re_extra != NULL);
+
+    char *pattern_str; /* NULL terminated string to pass to pcre. */
+    const char *errptr = NULL; /* PCRE Error reporter. */
+    int erroffset; /* PCRE Error offset into subject reporter. */
+
+    /* Build a string to hand to the pcre library. */
+    pattern_str = (char *)malloc(pattern_len+1);
+    if (pattern_str == NULL) {
+        return IB_EALLOC;
     }
-    if (pcre_pattern) {
-        pcre_free(pcre_pattern);
+    memcpy(pattern_str, pattern, pattern_len);
+    pattern_str[pattern_len] = '\0';
+
+    *re = pcre_compile(pattern_str, 0, &errptr, &erroffset, NULL);
+    free(pattern_str);
+    if (*re == NULL) {
+        return IB_EINVAL;
     }
-    return rc;
+
+    *re_extra = NULL;
+    if (study) {
+#ifdef PCRE_HAVE_JIT
+        *re_extra = pcre_study(*re, PCRE_STUDY_JIT_COMPILE, &errptr);
+#else
+        *re_extra = pcre_study(*re, 0, &errptr);
+#endif
+        /* A failed study is not fatal; the pattern works without it. */
+        if (errptr != NULL) {
+            *re_extra = NULL;
+        }
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Free study data from data_pattern_compile().
+ *
+ * @param[in] re_extra Study data (may be NULL).
+ */
+static
+void data_pattern_free_study(
+    pcre_extra *re_extra
+)
+{
+    if (re_extra == NULL) {
+        return;
+    }
+#ifdef PCRE_HAVE_JIT
+    pcre_free_study(re_extra);
+#else
+    pcre_free(re_extra);
+#endif
+}
+
+/**
+ * Memory pool cleanup function to free the pattern of a selector.
+ *
+ * @param[in] cbdata The selector.
+ */
+static
+void data_selector_cleanup(
+    void *cbdata
+)
+{
+    ib_data_selector_t *sel = (ib_data_selector_t *)cbdata;
+
+    data_pattern_free_study(sel->re_extra);
+    pcre_free(sel->re);
 }
 
 /**
@@ -382,7 +766,7 @@ ib_status_t ib_data_add_internal(
 
     /* Normal add. */
     else {
-        return ib_hash_set_ex(data->hash, name, nlen, field);
+        return ib_data_hash_set(data, name, nlen, field);
     }
 
     return IB_OK;
@@ -409,10 +793,122 @@ ib_status_t expand_lookup_fn(
 
 /* -- Exported Data Access Routines -- */
 
+ib_status_t ib_data_config_create(
+    ib_mpool_t        *mp,
+    ib_data_config_t **config
+)
+{
+    assert(mp != NULL);
+    assert(config != NULL);
+
+    ib_status_t rc;
+
+    *config = ib_mpool_calloc(mp, 1, sizeof(**config));
+    if (*config == NULL) {
+        return IB_EALLOC;
+    }
+
+    (*config)->mp = mp;
+    rc = ib_hash_create_nocase(&(*config)->by_name, mp);
+    if (rc != IB_OK) {
+        *config = NULL;
+        return rc;
+    }
+    rc = ib_array_create(&(*config)->by_index, mp, 32, 8);
+    if (rc != IB_OK) {
+        *config = NULL;
+        return rc;
+    }
+
+    return IB_OK;
+}
+
+ib_status_t ib_data_register_indexed_ex(
+    ib_data_config_t *config,
+    const char       *name,
+    size_t            nlen,
+    size_t           *index
+)
+{
+    assert(config != NULL);
+    assert(name != NULL);
+
+    data_config_entry_t *entry;
+    ib_status_t          rc;
+
+    rc = ib_hash_get_ex(config->by_name, &entry, name, nlen);
+    if (rc == IB_ENOENT) {
+        entry = ib_mpool_alloc(config->mp, sizeof(*entry));
+        if (entry == NULL) {
+            return IB_EALLOC;
+        }
+        entry->name = ib_mpool_memdup(config->mp, name, nlen);
+        if (entry->name == NULL) {
+            return IB_EALLOC;
+        }
+        entry->nlen = nlen;
+        entry->index = ib_array_elements(config->by_index);
+
+        rc = ib_array_appendn(config->by_index, entry);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        rc = ib_hash_set_ex(config->by_name, entry->name, nlen, entry);
+    }
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    if (index != NULL) {
+        *index = entry->index;
+    }
+    return IB_OK;
+}
+
+ib_status_t ib_data_register_indexed(
+    ib_data_config_t *config,
+    const char       *name
+)
+{
+    return ib_data_register_indexed_ex(config, name, strlen(name), NULL);
+}
+
+ib_status_t ib_data_lookup_index_ex(
+    const ib_data_config_t *config,
+    const char             *name,
+    size_t                  nlen,
+    size_t                 *index
+)
+{
+    assert(config != NULL);
+    assert(name != NULL);
+    assert(index != NULL);
+
+    const data_config_entry_t *entry;
+    ib_status_t                rc;
+
+    rc = ib_hash_get_ex(config->by_name, &entry, name, nlen);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    *index = entry->index;
+    return IB_OK;
+}
+
 ib_status_t ib_data_create(
     ib_mpool_t  *mp,
     ib_data_t  **data
 )
+{
+    return ib_data_create_indexed(NULL, mp, data);
+}
+
+ib_status_t ib_data_create_indexed(
+    const ib_data_config_t  *config,
+    ib_mpool_t              *mp,
+    ib_data_t              **data
+)
 {
     assert(mp != NULL);
     assert(data != NULL);
@@ -424,12 +920,31 @@ ib_status_t ib_data_create(
         return IB_EALLOC;
     }
 
+    /* Names registered after this have no slot; see ib_data_get_indexed() */
+    (*data)->config = config;
+    if (config != NULL) {
+        (*data)->num_slots = ib_array_elements(config->by_index);
+        if ((*data)->num_slots > 0) {
+            (*data)->slots = ib_mpool_calloc(mp, (*data)->num_slots,
+                                             sizeof(*(*data)->slots));
+            if ((*data)->slots == NULL) {
+                *data = NULL;
+                return IB_EALLOC;
+            }
+        }
+    }
+
     (*data)->mp = mp;
     rc = ib_hash_create_nocase(&(*data)->hash, mp);
     if (rc != IB_OK) {
         *data = NULL;
         return rc;
     }
+    rc = ib_hash_create(&(*data)->index, mp);
+    if (rc != IB_OK) {
+        *data = NULL;
+        return rc;
+    }
 
     return IB_OK;
 }
@@ -636,107 +1151,191 @@ ib_status_t ib_data_get_ex(
     assert(data != NULL);
 
     ib_status_t rc;
-    char *name_str = NULL;
-
-    char *filter_marker = memchr(name, DPI_LIST_FILTER_MARKER, name_len);
+    ib_field_t *parent_field;
+    size_t      parent_len;
+    const char *sub;
+    size_t      sub_len;
+    bool        is_pattern;
+    pcre       *re;
+    pcre_extra *re_extra;
 
     /*
-     * If there is a filter_marker then we are going to
-     * extract sub-values.
-     *
-     * A sub-value might be a pattern-match on a list: ARGV:/foo\d?/
+     * A name might be a plain field: ARGV
+     * A pattern-match on a list: ARGV:/foo\d?/
      * Or a sub field: ARGV:my_var
      * Or a dynamic field: ARGV:my_var
+     *
+     * Rules use precompiled selectors (see ib_data_get_selected()) so the
+     * pattern is compiled here for one-off lookups only.
      */
-    if ( filter_marker ) {
+    rc = data_parse_name(name, name_len,
+                         &parent_len, &sub, &sub_len, &is_pattern);
+    if (rc != IB_OK) {
+        return rc;
+    }
 
-        /* If there is a filter mark (':') get the parent field. */
-        ib_field_t *parent_field;
+    /* Typical no-expansion fetch of a value. */
+    if (sub == NULL) {
+        return ib_hash_get_ex(data->hash, pf, name, name_len);
+    }
 
-        char *filter_start = memchr(name, DPI_LIST_FILTER_PREFIX, name_len);
-        char *filter_end;
+    rc = ib_hash_get_ex(data->hash, &parent_field, name, parent_len);
+    if (rc != IB_OK) {
+        return rc;
+    }
 
-        /* Fetch the field name, but the length is (filter_mark - name).
-         * That is, the string before the ':' we found. */
-        rc = ib_hash_get_ex(data->hash, &parent_field, name, filter_marker - name);
-        if (rc != IB_OK) {
-            return rc;
-        }
+    /* No pattern match. Just extract the sub-field. */
+    if (! is_pattern) {
+        return ib_data_get_subfields(data, parent_field, sub, sub_len, pf);
+    }
 
-        if ( filter_start && filter_start + 1 < name + name_len ) {
-            filter_end = memchr(filter_start+1,
-                                DPI_LIST_FILTER_SUFFIX,
-                                name_len - (filter_start+1-name));
-        }
-        else {
-            filter_end = NULL;
+    rc = data_pattern_compile(sub, sub_len, false, &re, &re_extra);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    rc = ib_data_get_filtered_list(data, parent_field, re, re_extra, pf);
+    pcre_free(re);
+
+    return rc;
+}
+
+ib_status_t ib_data_get_indexed(
+    const ib_data_t  *data,
+    size_t            index,
+    ib_field_t      **pf
+)
+{
+    assert(data != NULL);
+    assert(pf != NULL);
+
+    data_config_entry_t *entry;
+    ib_status_t          rc;
+
+    if (index < data->num_slots) {
+        if (data->slots[index] == NULL) {
+            return IB_ENOENT;
         }
+        *pf = data->slots[index];
+        return IB_OK;
+    }
 
+    /* Registered after @a data was created; look it up by name. */
+    if (data->config == NULL) {
+        return IB_EINVAL;
+    }
+    rc = ib_array_get(data->config->by_index, index, &entry);
+    if (rc != IB_OK) {
+        return IB_EINVAL;
+    }
 
-        /* Does the expansions use a pattern match or not? */
-        if (filter_start && filter_end) {
+    return ib_hash_get_ex(data->hash, pf, entry->name, entry->nlen);
+}
 
-            /* Bad filter: FOO/: */
-            if (filter_marker != filter_start-1) {
-                rc = IB_EINVAL;
-                goto error_handler;
-            }
+ib_status_t ib_data_selector_create(
+    ib_mpool_t          *mp,
+    ib_data_config_t    *config,
+    const char          *name,
+    size_t               nlen,
+    ib_data_selector_t **psel
+)
+{
+    assert(mp != NULL);
+    assert(name != NULL);
+    assert(psel != NULL);
 
-            /* Bad filter: FOO:/ */
-            if (filter_start == filter_end) {
-                rc = IB_EINVAL;
-                goto error_handler;
-            }
+    ib_status_t         rc;
+    ib_data_selector_t *sel;
+    size_t              parent_len;
+    const char         *sub;
+    size_t              sub_len;
+    bool                is_pattern;
 
-            /* Bad filter: FOO:// */
-            if (filter_start == filter_end-1) {
-                rc = IB_EINVAL;
-                goto error_handler;
-            }
+    rc = data_parse_name(name, nlen, &parent_len, &sub, &sub_len, &is_pattern);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    if ( (sub != NULL) && (sub_len == 0) ) {
+        return IB_EINVAL;
+    }
 
-            /* Validated that filter_start and filter_end are sane. */
-            rc = ib_data_get_filtered_list(
-                data,
-                parent_field,
-                filter_start+1,
-                filter_end - filter_start - 1,
-                pf
-            );
-        }
+    sel = ib_mpool_calloc(mp, 1, sizeof(*sel));
+    if (sel == NULL) {
+        return IB_EALLOC;
+    }
 
-        /* No pattern match. Just extract the sub-field. */
-        else {
+    sel->name = ib_mpool_memdup(mp, name, parent_len);
+    if (sel->name == NULL) {
+        return IB_EALLOC;
+    }
+    sel->nlen = parent_len;
 
-            /* Handle extracting a subfield for a list of a dynamic field. */
-            rc = ib_data_get_subfields(
-                data,
-                parent_field,
-                filter_marker+1,
-                name_len - (filter_marker+1-name),
-                pf
-            );
+    if (config != NULL) {
+        rc = ib_data_register_indexed_ex(config, name, parent_len,
+                                         &sel->index);
+        if (rc != IB_OK) {
+            return rc;
         }
+        sel->config = config;
     }
 
-    /* Typical no-expansion fetch of a value. */
-    else {
-        rc = ib_hash_get_ex(data->hash, pf, name, name_len);
+    if (is_pattern) {
+        rc = data_pattern_compile(sub, sub_len, true,
+                                  &sel->re, &sel->re_extra);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        rc = ib_mpool_cleanup_register(mp, data_selector_cleanup, sel);
+        if (rc != IB_OK) {
+            data_selector_cleanup(sel);
+            return rc;
+        }
+    }
+    else if (sub != NULL) {
+        sel->subfield = ib_mpool_memdup(mp, sub, sub_len);
+        if (sel->subfield == NULL) {
+            return IB_EALLOC;
+        }
+        sel->sublen = sub_len;
     }
 
-    return rc;
+    *psel = sel;
+    return IB_OK;
+}
 
-    /* Error handling routine. */
-error_handler:
-    name_str = malloc(name_len+1);
-    if ( name_str == NULL ) {
-        return IB_EALLOC;
+ib_status_t ib_data_get_selected(
+    const ib_data_t          *data,
+    const ib_data_selector_t *sel,
+    ib_field_t              **pf
+)
+{
+    assert(data != NULL);
+    assert(sel != NULL);
+    assert(pf != NULL);
+
+    ib_status_t rc;
+    ib_field_t *parent_field;
+
+    if ( (sel->config != NULL) && (sel->config == data->config) ) {
+        rc = ib_data_get_indexed(data, sel->index, &parent_field);
+    }
+    else {
+        rc = ib_hash_get_ex(data->hash, &parent_field, sel->name, sel->nlen);
+    }
+    if (rc != IB_OK) {
+        return rc;
     }
 
-    memcpy(name_str, name, name_len);
-    name_str[name_len] = '\0';
-    free(name_str);
+    if (sel->re != NULL) {
+        return ib_data_get_filtered_list(data, parent_field,
+                                         sel->re, sel->re_extra, pf);
+    }
+    if (sel->subfield != NULL) {
+        return ib_data_get_subfields(data, parent_field,
+                                     sel->subfield, sel->sublen, pf);
+    }
 
-    return rc;
+    *pf = parent_field;
+    return IB_OK;
 }
 
 ib_status_t ib_data_get_all(
@@ -824,7 +1423,14 @@ ib_status_t ib_data_remove_ex(ib_data_t *data,
 {
     assert(data != NULL);
 
-    return ib_hash_remove_ex(data->hash, pf, name, nlen);
+    ib_status_t rc;
+
+    rc = ib_hash_remove_ex(data->hash, pf, name, nlen);
+    if (rc == IB_OK) {
+        data_slot_set(data, name, nlen, NULL);
+    }
+
+    return rc;
 }
 
 ib_status_t ib_data_set(
@@ -835,7 +1441,7 @@ ib_status_t ib_data_set(
 )
 {
     assert(data != NULL);
-    return ib_hash_set_ex(data->hash, name, nlen, f);
+    return ib_data_hash_set(data, name, nlen, f);
 }
 
 ib_status_t ib_data_set_relative(
@@ -872,6 +1478,15 @@ ib_status_t ib_data_set_relative(
     return rc;
 }
 
+size_t ib_data_generation(
+    const ib_data_t *data
+)
+{
+    assert(data != NULL);
+
+    return data->generation;
+}
+
 ib_status_t ib_data_expand_str(
     const ib_data_t  *data,
     const char       *str,
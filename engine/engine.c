@@ -57,6 +57,9 @@
 /** Constant max path used in calls to getcwd() */
 const size_t maxpath = 512;
 
+/** Pages per thread kept for reuse by connection and transaction pools */
+static const size_t engine_page_cache_size = 256;
+
 /** Constant String Values */
 const ib_default_string_t ib_default_string = {
     "",          /* empty */
@@ -212,6 +215,14 @@ ib_status_t ib_engine_create(ib_engine_t **pib, ib_server_t *server)
         goto failed;
     }
 
+    /* Recycle pages of connection and transaction pools */
+    rc = ib_mpool_enable_page_cache(pool, engine_page_cache_size);
+    if (rc != IB_OK) {
+        ib_mpool_destroy(pool);
+        *pib = NULL;
+        return rc;
+    }
+
     /* Create the main structure in the primary memory pool */
     *pib = (ib_engine_t *)ib_mpool_calloc(pool, 1, sizeof(**pib));
     if (*pib == NULL) {
@@ -333,6 +344,12 @@ ib_status_t ib_engine_create(ib_engine_t **pib, ib_server_t *server)
         goto failed;
     }
 
+    /* Create the registry of indexed data field names */
+    rc = ib_data_config_create((*pib)->mp, &((*pib)->data_config));
+    if (rc != IB_OK) {
+        goto failed;
+    }
+
     /* Initialize the core static module. */
     /// @todo Probably want to do this in a less hard-coded manner.
     rc = ib_module_init(ib_core_module(), *pib);
@@ -489,6 +506,11 @@ ib_mpool_t *ib_engine_pool_temp_get(const ib_engine_t *ib)
     return ib->temp_mp;
 }
 
+ib_data_config_t *ib_engine_data_config_get(const ib_engine_t *ib)
+{
+    return ib->data_config;
+}
+
 void ib_engine_pool_temp_destroy(ib_engine_t *ib)
 {
     ib_engine_pool_destroy(ib, ib->temp_mp);
@@ -651,7 +673,8 @@ ib_status_t ib_conn_create(ib_engine_t *ib,
     (*pconn)->server_ctx = server_ctx;
 
     /* Data */
-    rc = ib_data_create((*pconn)->mp, &(*pconn)->data);
+    rc = ib_data_create_indexed(ib->data_config,
+                                (*pconn)->mp, &(*pconn)->data);
     if (rc != IB_OK) {
         ib_log_alert(ib, "Failed to create conn data: %s",
                      ib_status_to_string(rc));
@@ -870,7 +893,7 @@ ib_status_t ib_tx_create(ib_tx_t **ptx,
     ib_tx_generate_id(tx, tx->mp);
 
     /* Create data */
-    rc = ib_data_create(tx->mp, &tx->data);
+    rc = ib_data_create_indexed(ib->data_config, tx->mp, &tx->data);
     if (rc != IB_OK) {
         ib_log_alert_tx(tx,
                         "Failed to create tx data: %s",
@@ -33,6 +33,12 @@
 #include <stdlib.h>
 #include <time.h>
 
+/** Size of the stack buffers for log formats */
+#define IB_LOG_FMT_MAX 512
+
+/** Maximum length of the transaction prefix ("[tx:<id>] ") plus NUL */
+#define IB_LOG_TX_PREFIX_MAX 45
+
 /**
  * Engine default logger.
  *
@@ -52,9 +58,11 @@ static void default_logger(FILE *fp, int level,
                            const char *file, int line,
                            const char *fmt, va_list ap)
 {
-    char *new_fmt;
+    char buf[IB_LOG_FMT_MAX];
+    char *new_fmt = buf;
+    size_t fmt_len;
     char time_info[32 + 1];
-    struct tm *tminfo;
+    struct tm tminfo;
     time_t timet;
 
     if (level > 4) {
@@ -62,11 +70,17 @@ static void default_logger(FILE *fp, int level,
     }
 
     timet = time(NULL);
-    tminfo = localtime(&timet);
-    strftime(time_info, sizeof(time_info)-1, "%d%m%Y.%Hh%Mm%Ss", tminfo);
+    localtime_r(&timet, &tminfo);
+    strftime(time_info, sizeof(time_info)-1, "%d%m%Y.%Hh%Mm%Ss", &tminfo);
 
     /* 100 is more than sufficient. */
-    new_fmt = (char *)malloc(strlen(time_info) + strlen(fmt) + 100);
+    fmt_len = strlen(time_info) + strlen(fmt) + 100;
+    if (fmt_len > sizeof(buf)) {
+        new_fmt = (char *)malloc(fmt_len);
+        if (new_fmt == NULL) {
+            return;
+        }
+    }
     sprintf(new_fmt, "%s %-10s- ", time_info, ib_log_level_to_string(level));
 
     if ( (file != NULL) && (line > 0) ) {
@@ -92,7 +106,9 @@ static void default_logger(FILE *fp, int level,
     vfprintf(fp, new_fmt, ap);
     fflush(fp);
 
-    free(new_fmt);
+    if (new_fmt != buf) {
+        free(new_fmt);
+    }
 
     return;
 }
@@ -210,20 +226,33 @@ void DLL_PUBLIC ib_log_tx_vex(
      va_list         ap
 )
 {
-    char *new_fmt = malloc(strlen(fmt) + 45);
-    const char *which_fmt = new_fmt;
-    if (! new_fmt) {
-        /* Do our best */
-        which_fmt = fmt;
+    /* Most formats fit on the stack. */
+    char buf[IB_LOG_FMT_MAX];
+    char *new_fmt = buf;
+    size_t fmt_len;
+
+    if (level > ib_log_get_level(tx->ib)) {
+        return;
     }
-    else {
-        sprintf(new_fmt, "[tx:%.36s] ", tx->id);
-        strcat(new_fmt, fmt);
+
+    fmt_len = strlen(fmt);
+    if (fmt_len + IB_LOG_TX_PREFIX_MAX > sizeof(buf)) {
+        new_fmt = malloc(fmt_len + IB_LOG_TX_PREFIX_MAX);
+    }
+    if (new_fmt == NULL) {
+        /* Do our best */
+        ib_log_vex_ex(tx->ib, level, file, line, fmt, ap);
+        return;
     }
 
-    ib_log_vex_ex(tx->ib, level, file, line, which_fmt, ap);
+    sprintf(new_fmt, "[tx:%.36s] ", tx->id);
+    strcat(new_fmt, fmt);
 
-    free(new_fmt);
+    ib_log_vex_ex(tx->ib, level, file, line, new_fmt, ap);
+
+    if (new_fmt != buf) {
+        free(new_fmt);
+    }
 
     return;
 }
@@ -237,6 +266,11 @@ void DLL_PUBLIC ib_log_vex_ex(
     va_list            ap
 )
 {
+    /* Check the level before the logger formats anything. */
+    if (level > ib_log_get_level(ib)) {
+        return;
+    }
+
     if (ib->logger_fn != NULL) {
         ib->logger_fn(ib, level, file, line, fmt, ap, ib->logger_cbdata);
     }
@@ -35,6 +35,7 @@
 #include <ironbee/engine.h>
 #include <ironbee/escape.h>
 #include <ironbee/field.h>
+#include <ironbee/hash.h>
 #include <ironbee/mpool.h>
 #include <ironbee/operator.h>
 #include <ironbee/transformation.h>
@@ -42,6 +43,7 @@
 
 #include <assert.h>
 #include <inttypes.h>
+#include <stddef.h>
 
 /**
  * Phase Flags
@@ -237,6 +239,48 @@ typedef struct {
     ib_num_t                result;      /**< Rule execution result */
 } rule_exec_stack_frame_t;
 
+/**
+ * Dispatch group: the rules of a phase that read a given top-level field.
+ */
+typedef struct {
+    const char             *name;        /**< Top-level field name */
+    size_t                  nlen;        /**< Length of @a name */
+    size_t                 *rules;       /**< Indexes of rules (ascending) */
+    size_t                  num_rules;   /**< # of elements in @a rules */
+} rule_dispatch_field_t;
+
+/**
+ * Precompiled rule dispatch index for a phase.
+ *
+ * All rule indexes refer to the @a rules array, which holds the phase's
+ * rules in execution order.
+ */
+struct ib_rule_dispatch_t {
+    ib_rule_ctx_data_t    **rules;       /**< Rules in execution order */
+    size_t                  num_rules;   /**< # of elements in @a rules */
+    size_t                 *always;      /**< Rules that are always visited */
+    size_t                  num_always;  /**< # of elements in @a always */
+    rule_dispatch_field_t **fields;      /**< Field dispatch groups */
+    size_t                  num_fields;  /**< # of elements in @a fields */
+};
+
+/**
+ * Iterator over the rules of a phase.
+ *
+ * If the phase has a dispatch index, only rules that are always visited or
+ * that read at least one top-level field that exists in the transaction's
+ * data are returned; otherwise the phase's rule list is walked.
+ */
+typedef struct {
+    const ib_rule_dispatch_t *dispatch;  /**< Dispatch index (or NULL) */
+    const ib_list_node_t     *node;      /**< Next node (linear walk) */
+    const ib_rule_exec_t     *rule_exec; /**< Rule execution object */
+    size_t                    gen;       /**< Data generation of last scan */
+    bool                     *present;   /**< Field groups found present */
+    uint32_t                 *pending;   /**< Bitmap of rules to visit */
+    size_t                    next;      /**< Next rule index to consider */
+} rule_dispatch_iter_t;
+
 /**
  * The rule engine uses recursion to walk through lists and chains.  These
  * define the limits of the recursion depth.
@@ -391,6 +435,23 @@ ib_status_t ib_rule_exec_create(ib_tx_t *tx,
         return rc;
     }
 
+    /* Create the transformation result cache */
+    rc = ib_hash_create(&(exec->tfn_cache), tx->mp);
+    if (rc != IB_OK) {
+        ib_rule_log_tx_warn(tx, "Failed to create transformation cache: %s",
+                            ib_status_to_string(rc));
+        exec->tfn_cache = NULL;
+    }
+
+    /* Create the stream operator states */
+    rc = ib_hash_create(&(exec->stream_states), tx->mp);
+    if (rc != IB_OK) {
+        ib_rule_log_tx_error(tx, "Failed to create stream states: %s",
+                             ib_status_to_string(rc));
+        return rc;
+    }
+    exec->txdata_stream = false;
+
     /* Create the TX log object */
     rc = ib_rule_log_tx_create(exec, &(exec->tx_log));
     if (rc != IB_OK) {
@@ -402,6 +463,9 @@ ib_status_t ib_rule_exec_create(ib_tx_t *tx,
     exec->rule = NULL;
     exec->target = NULL;
     exec->result = 0;
+    exec->field_gen = 0;
+    exec->tfn_buf = NULL;
+    exec->tfn_buf_size = 0;
     tx->rule_exec = exec;
 
     exec->exec_log = NULL;
@@ -575,6 +639,169 @@ static void rule_exec_pop_value(ib_rule_exec_t *rule_exec,
     return;
 }
 
+/**
+ * Maximum number of transformations in a transformation result cache key
+ */
+#define TFN_CACHE_MAX_CHAIN  (16)
+
+/**
+ * Key of the transformation result cache.
+ *
+ * The input field is identified by its address, but since fields can be
+ * modified in place, the key also holds a fingerprint of the value that
+ * was transformed.  Only the first @c ntfns entries of @c tfns are part
+ * of the key.
+ */
+typedef struct {
+    const ib_field_t       *value;       /**< Input field */
+    const void             *ptr;         /**< Input value pointer */
+    ib_num_t                num;         /**< Input value length / number */
+    size_t                  ntfns;       /**< # of transformations */
+    const ib_tfn_t         *tfns[TFN_CACHE_MAX_CHAIN]; /**< Tfn chain */
+} tfn_cache_key_t;
+
+/**
+ * Length of the significant part of a transformation result cache key.
+ *
+ * @param[in] key Cache key
+ *
+ * @returns Length of @a key in bytes
+ */
+static size_t tfn_cache_key_length(const tfn_cache_key_t *key)
+{
+    return offsetof(tfn_cache_key_t, tfns) +
+        (key->ntfns * sizeof(key->tfns[0]));
+}
+
+/**
+ * Build the transformation result cache key for @a value.
+ *
+ * Only static scalar values are cached; the values of dynamic fields and
+ * lists can change without their fields changing.  The key is returned
+ * with an empty transformation chain.
+ *
+ * @param[in] value Input field
+ * @param[out] key The key
+ *
+ * @returns true if transformation results of @a value can be cached
+ */
+static bool tfn_cache_key(const ib_field_t *value,
+                          tfn_cache_key_t *key)
+{
+    ib_status_t rc;
+
+    assert(value != NULL);
+    assert(key != NULL);
+
+    if (ib_field_is_dynamic(value)) {
+        return false;
+    }
+
+    /* Clear the padding, the key is hashed as a block of memory */
+    memset(key, 0, offsetof(tfn_cache_key_t, tfns));
+    key->value = value;
+
+    switch (value->type) {
+    case IB_FTYPE_NUM:
+        rc = ib_field_value(value, ib_ftype_num_out(&key->num));
+        break;
+
+    case IB_FTYPE_FLOAT:
+    {
+        ib_float_t fnum;
+
+        rc = ib_field_value(value, ib_ftype_float_out(&fnum));
+        memcpy(&key->num, &fnum,
+               sizeof(fnum) < sizeof(key->num) ? sizeof(fnum)
+                                                : sizeof(key->num));
+        break;
+    }
+
+    case IB_FTYPE_NULSTR:
+    {
+        const char *s;
+
+        rc = ib_field_value(value, ib_ftype_nulstr_out(&s));
+        key->ptr = s;
+        break;
+    }
+
+    case IB_FTYPE_BYTESTR:
+    {
+        const ib_bytestr_t *bs;
+
+        rc = ib_field_value(value, ib_ftype_bytestr_out(&bs));
+        if (rc == IB_OK && bs != NULL) {
+            key->ptr = ib_bytestr_const_ptr(bs);
+            key->num = (ib_num_t)ib_bytestr_length(bs);
+        }
+        break;
+    }
+
+    default:
+        return false;
+    }
+
+    return (rc == IB_OK);
+}
+
+/**
+ * Look up the result of a transformation chain in the transaction's cache.
+ *
+ * @param[in] rule_exec The rule execution object
+ * @param[in] key Cache key
+ *
+ * @returns The cached result or NULL if not found
+ */
+static ib_field_t *tfn_cache_get(const ib_rule_exec_t *rule_exec,
+                                 const tfn_cache_key_t *key)
+{
+    ib_status_t  rc;
+    ib_field_t  *out;
+
+    if (rule_exec->tfn_cache == NULL) {
+        return NULL;
+    }
+
+    rc = ib_hash_get_ex(rule_exec->tfn_cache, &out,
+                        key, tfn_cache_key_length(key));
+
+    return (rc == IB_OK) ? out : NULL;
+}
+
+/**
+ * Store the result of a transformation chain in the transaction's cache.
+ *
+ * @param[in] rule_exec The rule execution object
+ * @param[in] key Cache key
+ * @param[in] out The transformation result
+ */
+static void tfn_cache_set(const ib_rule_exec_t *rule_exec,
+                          const tfn_cache_key_t *key,
+                          ib_field_t *out)
+{
+    ib_status_t      rc;
+    size_t           length = tfn_cache_key_length(key);
+    tfn_cache_key_t *stored;
+
+    if (rule_exec->tfn_cache == NULL) {
+        return;
+    }
+
+    /* The hash doesn't copy keys */
+    stored = ib_mpool_memdup(rule_exec->tx->mp, key, length);
+    if (stored == NULL) {
+        return;
+    }
+    rc = ib_hash_set_ex(rule_exec->tfn_cache, stored, length, out);
+    if (rc != IB_OK) {
+        ib_rule_log_debug(rule_exec,
+                          "Failed to cache result of transformation %s: %s",
+                          key->tfns[key->ntfns - 1]->name,
+                          ib_status_to_string(rc));
+    }
+}
+
 /**
  * Execute a single transformation on a target.
  *
@@ -696,9 +923,29 @@ static ib_status_t execute_tfn_single(const ib_rule_exec_t *rule_exec,
         }
     }
 
-    /* OK, no unrolling required.  Just execute the transformation. */
+    /*
+     * OK, no unrolling required.  Other rules may already have run the
+     * transformation on this value; if not, execute it.
+     */
     else {
         ib_flags_t flags;
+        tfn_cache_key_t key;
+        bool cacheable = tfn_cache_key(value, &key);
+
+        if (cacheable) {
+            key.tfns[key.ntfns++] = tfn;
+            out = tfn_cache_get(rule_exec, &key);
+            ib_rule_log_tx_tfn_cache(rule_exec->tx_log, out != NULL);
+            if (out != NULL) {
+                ib_rule_log_trace(rule_exec,
+                                  "Using cached result of transformation "
+                                  "\"%s\" on \"%.*s\"",
+                                  tfn->name, (int)value->nlen, value->name);
+                *result = out;
+                return IB_OK;
+            }
+        }
+
         rc = ib_tfn_transform(rule_exec->ib, rule_exec->tx->mp,
                               tfn, value, &out, &flags);
         if (rc != IB_OK) {
@@ -714,6 +961,10 @@ static ib_status_t execute_tfn_single(const ib_rule_exec_t *rule_exec,
                               "Transformation returned NULL");
             return IB_EINVAL;
         }
+
+        if (cacheable) {
+            tfn_cache_set(rule_exec, &key, out);
+        }
     }
 
     /* The output of the final operator is the result */
@@ -725,16 +976,271 @@ static ib_status_t execute_tfn_single(const ib_rule_exec_t *rule_exec,
     return rc;
 }
 
+/**
+ * Get the string value of a field for in-place transformation.
+ *
+ * @param[in] value Field
+ * @param[out] data Value data
+ * @param[out] dlen Length of @a data
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EINVAL if @a value isn't a string.
+ *   - Errors from ib_field_value().
+ */
+static ib_status_t tfn_string_value(const ib_field_t *value,
+                                    const uint8_t **data,
+                                    size_t *dlen)
+{
+    ib_status_t rc;
+
+    assert(value != NULL);
+    assert(data != NULL);
+    assert(dlen != NULL);
+
+    if (value->type == IB_FTYPE_NULSTR) {
+        const char *s;
+
+        rc = ib_field_value(value, ib_ftype_nulstr_out(&s));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        if (s == NULL) {
+            return IB_EINVAL;
+        }
+        *data = (const uint8_t *)s;
+        *dlen = strlen(s);
+    }
+    else if (value->type == IB_FTYPE_BYTESTR) {
+        const ib_bytestr_t *bs;
+
+        rc = ib_field_value(value, ib_ftype_bytestr_out(&bs));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        if ( (bs == NULL) || (ib_bytestr_const_ptr(bs) == NULL) ) {
+            return IB_EINVAL;
+        }
+        *data = ib_bytestr_const_ptr(bs);
+        *dlen = ib_bytestr_length(bs);
+    }
+    else {
+        return IB_EINVAL;
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Count the transformations, starting at @a node, that can run in-place.
+ *
+ * @param[in] node First transformation node
+ *
+ * @returns Number of in-place transformations (at most TFN_CACHE_MAX_CHAIN)
+ */
+static size_t tfn_inplace_run_length(const ib_list_node_t *node)
+{
+    size_t count = 0;
+
+    while ( (node != NULL) && (count < TFN_CACHE_MAX_CHAIN) ) {
+        const ib_tfn_t *tfn = (const ib_tfn_t *)ib_list_node_data_const(node);
+
+        if (tfn->fn_inplace == NULL) {
+            break;
+        }
+        ++count;
+        node = ib_list_node_next_const(node);
+    }
+
+    return count;
+}
+
+/**
+ * Execute a chain of in-place transformations on a string target.
+ *
+ * The value is copied into the rule execution's scratch buffer, and all
+ * of the transformations are run on it in-place.  Only the final value is
+ * stored in a new field, and only if it was modified.  The result of the
+ * chain is cached; if the result of the chain (or of a prefix of it) is
+ * already in the cache, only the remaining transformations are executed.
+ *
+ * @param[in] rule_exec The rule execution object
+ * @param[in] node First transformation node of the chain
+ * @param[in] count Number of transformations in the chain
+ * @param[in] value Initial value of the target field
+ * @param[out] result Pointer to field in which to store the result
+ *
+ * @returns Status code
+ */
+static ib_status_t execute_tfn_run(ib_rule_exec_t *rule_exec,
+                                   const ib_list_node_t *node,
+                                   size_t count,
+                                   const ib_field_t *value,
+                                   ib_field_t **result)
+{
+    ib_status_t        rc;
+    ib_mpool_t        *mp = rule_exec->tx->mp;
+    tfn_cache_key_t    key;
+    bool               cacheable;
+    const ib_field_t  *start = value;
+    const uint8_t     *din;
+    uint8_t           *data;
+    size_t             dlen;
+    size_t             done = 0;
+    size_t             n;
+    bool               modified = false;
+    ib_field_t        *out = NULL;
+
+    assert(rule_exec != NULL);
+    assert(node != NULL);
+    assert(count > 0 && count <= TFN_CACHE_MAX_CHAIN);
+    assert(value != NULL);
+    assert(result != NULL);
+
+    *result = NULL;
+
+    /* Build the key of the whole chain */
+    cacheable = tfn_cache_key(value, &key);
+    if (cacheable) {
+        key.ntfns = count;
+        for (n = 0;  n < count;  ++n) {
+            key.tfns[n] = (const ib_tfn_t *)ib_list_node_data_const(node);
+            node = ib_list_node_next_const(node);
+        }
+
+        /* Start after the longest prefix of the chain already computed */
+        for (n = count;  n > 0;  --n) {
+            key.ntfns = n;
+            out = tfn_cache_get(rule_exec, &key);
+            if (out != NULL) {
+                break;
+            }
+        }
+        ib_rule_log_tx_tfn_cache(rule_exec->tx_log, out != NULL);
+        key.ntfns = count;
+
+        if (n == count) {
+            ib_rule_log_trace(rule_exec,
+                              "Using cached result of %zd transformations "
+                              "on \"%.*s\"",
+                              count, (int)value->nlen, value->name);
+            *result = out;
+            return IB_OK;
+        }
+        if (out != NULL) {
+            start = out;
+            done = n;
+        }
+    }
+    else {
+        for (n = 0;  n < count;  ++n) {
+            key.tfns[n] = (const ib_tfn_t *)ib_list_node_data_const(node);
+            node = ib_list_node_next_const(node);
+        }
+    }
+
+    rc = tfn_string_value(start, &din, &dlen);
+    if (rc != IB_OK) {
+        ib_rule_log_error(rule_exec,
+                          "Error getting value of \"%.*s\": %s",
+                          (int)start->nlen, start->name,
+                          ib_status_to_string(rc));
+        return rc;
+    }
+
+    /* Copy the value into the scratch buffer, growing it if required */
+    if (dlen > rule_exec->tfn_buf_size || rule_exec->tfn_buf == NULL) {
+        size_t size = (rule_exec->tfn_buf_size * 2);
+
+        if (size < dlen) {
+            size = dlen;
+        }
+        if (size < 256) {
+            size = 256;
+        }
+        rule_exec->tfn_buf = ib_mpool_alloc(mp, size);
+        if (rule_exec->tfn_buf == NULL) {
+            rule_exec->tfn_buf_size = 0;
+            return IB_EALLOC;
+        }
+        rule_exec->tfn_buf_size = size;
+    }
+    data = rule_exec->tfn_buf;
+    memcpy(data, din, dlen);
+
+    /* Run the transformations */
+    for (n = done;  n < count;  ++n) {
+        const ib_tfn_t *tfn = key.tfns[n];
+        ib_flags_t flags;
+
+        ib_rule_log_trace(rule_exec,
+                          "Executing transformation %s in-place", tfn->name);
+        rc = ib_tfn_transform_inplace(rule_exec->ib, mp, tfn,
+                                      data, dlen, &data, &dlen, &flags);
+        if (rc != IB_OK) {
+            ib_rule_log_error(rule_exec,
+                              "Error executing target transformation %s: %s",
+                              tfn->name, ib_status_to_string(rc));
+            return rc;
+        }
+        if (IB_TFN_CHECK_FMODIFIED(flags)) {
+            modified = true;
+        }
+    }
+
+    /* Create the field for the final value */
+    if (! modified) {
+        out = (ib_field_t *)start;
+    }
+    else if (start->type == IB_FTYPE_NULSTR) {
+        char *s = ib_mpool_memdup_to_str(mp, data, dlen);
+
+        if (s == NULL) {
+            return IB_EALLOC;
+        }
+        rc = ib_field_create(&out, mp, value->name, value->nlen,
+                             IB_FTYPE_NULSTR, ib_ftype_nulstr_in(s));
+    }
+    else {
+        uint8_t *d = ib_mpool_alloc(mp, (dlen == 0) ? 1 : dlen);
+
+        if (d == NULL) {
+            return IB_EALLOC;
+        }
+        memcpy(d, data, dlen);
+        rc = ib_field_create_bytestr_alias(&out, mp,
+                                           value->name, value->nlen,
+                                           d, dlen);
+    }
+    if (rc != IB_OK) {
+        ib_rule_log_error(rule_exec,
+                          "Error creating transformation result field: %s",
+                          ib_status_to_string(rc));
+        return rc;
+    }
+
+    if (cacheable) {
+        tfn_cache_set(rule_exec, &key, out);
+    }
+
+    *result = out;
+    return IB_OK;
+}
+
 /**
  * Execute list of transformations on a target.
  *
+ * Consecutive transformations that can run in-place are executed on a
+ * scratch buffer by execute_tfn_run(), unless the transformations are
+ * logged (the logger needs the intermediate values).
+ *
  * @param[in] rule_exec The rule execution object
  * @param[in] value Initial value of the target field
  * @param[out] result Pointer to field in which to store the result
  *
  * @returns Status code
  */
-static ib_status_t execute_tfns(const ib_rule_exec_t *rule_exec,
+static ib_status_t execute_tfns(ib_rule_exec_t *rule_exec,
                                 const ib_field_t *value,
                                 const ib_field_t **result)
 {
@@ -742,6 +1248,7 @@ static ib_status_t execute_tfns(const ib_rule_exec_t *rule_exec,
     const ib_list_node_t *node = NULL;
     const ib_field_t     *in_field;
     ib_field_t           *out = NULL;
+    bool                  inplace;
 
     assert(rule_exec != NULL);
     assert(result != NULL);
@@ -760,24 +1267,51 @@ static ib_status_t execute_tfns(const ib_rule_exec_t *rule_exec,
     ib_rule_log_trace(rule_exec, "Executing %zd transformations",
                       IB_LIST_ELEMENTS(rule_exec->target->tfn_list));
 
+    inplace = ! ib_rule_log_exec_tfn_enabled(rule_exec->exec_log);
+
     /*
      * Loop through all of the target's transformations.
      */
     in_field = value;
-    IB_LIST_LOOP_CONST(rule_exec->target->tfn_list, node) {
+    node = ib_list_first_const(rule_exec->target->tfn_list);
+    while (node != NULL) {
         const ib_tfn_t  *tfn = (const ib_tfn_t *)node->data;
+        size_t           run = 0;
+
+        if ( inplace &&
+             ( (in_field->type == IB_FTYPE_NULSTR) ||
+               (in_field->type == IB_FTYPE_BYTESTR) ) )
+        {
+            run = tfn_inplace_run_length(node);
+        }
+
+        /* Run a chain of in-place transformations */
+        if (run > 1) {
+            rc = execute_tfn_run(rule_exec, node, run, in_field, &out);
+            if (rc != IB_OK) {
+                return rc;
+            }
+            while (--run > 0) {
+                node = ib_list_node_next_const(node);
+            }
+        }
 
         /* Run it */
-        ib_rule_log_trace(rule_exec, "Executing transformation %s", tfn->name);
-        ib_rule_log_exec_tfn_add(rule_exec->exec_log, tfn);
-        rc = execute_tfn_single(rule_exec, tfn, in_field,
-                                MAX_TFN_RECURSION, &out);
-        if (rc != IB_OK) {
-            ib_rule_log_error(rule_exec,
-                              "Error executing target transformation %s: %s",
-                              tfn->name, ib_status_to_string(rc));
+        else {
+            ib_rule_log_trace(rule_exec,
+                              "Executing transformation %s", tfn->name);
+            ib_rule_log_exec_tfn_add(rule_exec->exec_log, tfn);
+            rc = execute_tfn_single(rule_exec, tfn, in_field,
+                                    MAX_TFN_RECURSION, &out);
+            if (rc != IB_OK) {
+                ib_rule_log_error(rule_exec,
+                                  "Error executing target transformation "
+                                  "%s: %s",
+                                  tfn->name, ib_status_to_string(rc));
+            }
+            ib_rule_log_exec_tfn_fin(rule_exec->exec_log,
+                                     tfn, in_field, out, rc);
         }
-        ib_rule_log_exec_tfn_fin(rule_exec->exec_log, tfn, in_field, out, rc);
 
         /* Verify that out isn't NULL */
         if (out == NULL) {
@@ -789,6 +1323,7 @@ static ib_status_t execute_tfns(const ib_rule_exec_t *rule_exec,
 
         /* The output of the operator is now input for the next field op. */
         in_field = out;
+        node = ib_list_node_next_const(node);
     }
 
     /* The output of the final operator is the result */
@@ -978,6 +1513,7 @@ static ib_status_t set_target_fields(ib_rule_exec_t *rule_exec,
     int                   n;
     char                 *name;
     ib_rule_target_t     *target = rule_exec->target;
+    size_t                gen = ib_data_generation(tx->data);
 
 
     /* The current value is the top of the stack */
@@ -1077,6 +1613,7 @@ static ib_status_t set_target_fields(ib_rule_exec_t *rule_exec,
     }
     name = ib_mpool_alloc(tx->mp, namelen + 1);
     if (name == NULL) {
+        rule_exec->field_gen += ib_data_generation(tx->data) - gen;
         return IB_EALLOC;
     }
 
@@ -1119,6 +1656,9 @@ static ib_status_t set_target_fields(ib_rule_exec_t *rule_exec,
         rc = trc;
     }
 
+    /* Hide the FIELD* fields from the dispatch index (they're temporary) */
+    rule_exec->field_gen += ib_data_generation(tx->data) - gen;
+
     return rc;
 }
 
@@ -1407,7 +1947,12 @@ static ib_status_t execute_phase_rule_targets(ib_rule_exec_t *rule_exec)
         rule_exec_set_target(rule_exec, target);
 
         /* Get the field value */
-        getrc = ib_data_get(tx->data, fname, &value);
+        if (target->selector != NULL) {
+            getrc = ib_data_get_selected(tx->data, target->selector, &value);
+        }
+        else {
+            getrc = ib_data_get(tx->data, fname, &value);
+        }
         if (getrc == IB_ENOENT) {
             bool allow  =
                 ib_flags_all(opinst->op->flags, IB_OP_FLAG_ALLOW_NULL);
@@ -1692,6 +2237,158 @@ static bool rule_allow(const ib_tx_t *tx,
     return false;
 }
 
+/**
+ * Get the data generation of a transaction, ignoring FIELD* targets.
+ *
+ * @param[in] rule_exec Rule execution object
+ *
+ * @returns Data generation
+ */
+static size_t rule_dispatch_generation(const ib_rule_exec_t *rule_exec)
+{
+    return ib_data_generation(rule_exec->tx->data) - rule_exec->field_gen;
+}
+
+/**
+ * Mark the rules of all newly present fields as pending.
+ *
+ * Only rules that have not yet been considered by the iterator are marked,
+ * which keeps the ordering of the phase's rule list intact.
+ *
+ * @param[in,out] iter Rule dispatch iterator
+ */
+static void rule_dispatch_scan(rule_dispatch_iter_t *iter)
+{
+    assert(iter != NULL);
+    assert(iter->dispatch != NULL);
+
+    const ib_rule_dispatch_t *dispatch = iter->dispatch;
+    ib_data_t                *data = iter->rule_exec->tx->data;
+    size_t                    fnum;
+
+    iter->gen = rule_dispatch_generation(iter->rule_exec);
+
+    for (fnum = 0;  fnum < dispatch->num_fields;  ++fnum) {
+        const rule_dispatch_field_t *field = dispatch->fields[fnum];
+        ib_field_t                  *f;
+        size_t                       n;
+
+        if (iter->present[fnum]) {
+            continue;
+        }
+        if (ib_data_get_ex(data, field->name, field->nlen, &f) != IB_OK) {
+            continue;
+        }
+
+        iter->present[fnum] = true;
+        for (n = 0;  n < field->num_rules;  ++n) {
+            size_t rnum = field->rules[n];
+            if (rnum >= iter->next) {
+                iter->pending[rnum / 32] |= (1U << (rnum % 32));
+            }
+        }
+    }
+}
+
+/**
+ * Initialize a phase rule iterator.
+ *
+ * @param[in] rule_exec Rule execution object
+ * @param[in] ruleset_phase The phase's rule set
+ * @param[out] iter Iterator to initialize
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on allocation failure.
+ */
+static ib_status_t rule_dispatch_iter_init(
+    const ib_rule_exec_t      *rule_exec,
+    const ib_ruleset_phase_t  *ruleset_phase,
+    rule_dispatch_iter_t      *iter)
+{
+    assert(rule_exec != NULL);
+    assert(ruleset_phase != NULL);
+    assert(iter != NULL);
+
+    const ib_rule_dispatch_t *dispatch = ruleset_phase->dispatch;
+    ib_mpool_t               *mp = rule_exec->tx->mp;
+    size_t                    n;
+
+    iter->dispatch = dispatch;
+    iter->node = ib_list_first_const(ruleset_phase->rule_list);
+    iter->rule_exec = rule_exec;
+    iter->next = 0;
+    if (dispatch == NULL) {
+        return IB_OK;
+    }
+
+    iter->pending = ib_mpool_calloc(mp, (dispatch->num_rules / 32) + 1,
+                                    sizeof(*iter->pending));
+    iter->present = ib_mpool_calloc(mp, dispatch->num_fields + 1,
+                                    sizeof(*iter->present));
+    if ( (iter->pending == NULL) || (iter->present == NULL) ) {
+        return IB_EALLOC;
+    }
+
+    for (n = 0;  n < dispatch->num_always;  ++n) {
+        size_t rnum = dispatch->always[n];
+        iter->pending[rnum / 32] |= (1U << (rnum % 32));
+    }
+    rule_dispatch_scan(iter);
+
+    return IB_OK;
+}
+
+/**
+ * Get the next rule to visit from a phase rule iterator.
+ *
+ * If new top-level fields have appeared in the transaction's data since
+ * the last call (i.e. created by the actions of the previous rule), the
+ * rules reading them are added before the next rule is picked.
+ *
+ * @param[in,out] iter Rule dispatch iterator
+ *
+ * @returns Next rule's context data, or NULL when done.
+ */
+static ib_rule_ctx_data_t *rule_dispatch_iter_next(rule_dispatch_iter_t *iter)
+{
+    assert(iter != NULL);
+
+    const ib_rule_dispatch_t *dispatch = iter->dispatch;
+    size_t                    rnum;
+
+    /* No index: walk the list */
+    if (dispatch == NULL) {
+        const ib_list_node_t *node = iter->node;
+        if (node == NULL) {
+            return NULL;
+        }
+        iter->node = ib_list_node_next_const(node);
+        return (ib_rule_ctx_data_t *)ib_list_node_data_const(node);
+    }
+
+    if (rule_dispatch_generation(iter->rule_exec) != iter->gen) {
+        rule_dispatch_scan(iter);
+    }
+
+    for (rnum = iter->next;  rnum < dispatch->num_rules;  ++rnum) {
+        uint32_t word = iter->pending[rnum / 32];
+
+        /* Skip entire empty words */
+        if ( (word == 0) && ((rnum % 32) == 0) ) {
+            rnum += 31;
+            continue;
+        }
+        if ( (word & (1U << (rnum % 32))) != 0) {
+            iter->next = rnum + 1;
+            return dispatch->rules[rnum];
+        }
+    }
+    iter->next = dispatch->num_rules;
+
+    return NULL;
+}
+
 /**
  * Run a set of phase rules.
  *
@@ -1719,7 +2416,8 @@ static ib_status_t run_phase_rules(ib_engine_t *ib,
     const ib_ruleset_phase_t   *ruleset_phase;
     ib_rule_exec_t             *rule_exec;
     ib_list_t                  *rules;
-    ib_list_node_t             *node = NULL;
+    ib_rule_ctx_data_t         *ctx_rule;
+    rule_dispatch_iter_t        iter;
     ib_status_t                rc = IB_OK;
 
     ruleset_phase = &(ctx->rules->ruleset.phases[meta->phase_num]);
@@ -1792,15 +2490,23 @@ static ib_status_t run_phase_rules(ib_engine_t *ib,
                          meta->phase_num, phase_name(meta),
                          ib_context_full_get(ctx));
 
+    rc = rule_dispatch_iter_init(rule_exec, ruleset_phase, &iter);
+    if (rc != IB_OK) {
+        ib_rule_log_tx_error(tx,
+                             "Failed to initialize rule dispatch: %s",
+                             ib_status_to_string(rc));
+        goto finish;
+    }
+
     /*
-     * Loop through all of the rules for this phase, execute them.
+     * Loop through all of the rules for this phase, execute them.  Rules
+     * whose targets are all absent are skipped by the dispatch iterator.
      *
      * @todo The current behavior is to keep running even after rule execution
      * returns an error.  This needs further discussion to determine what the
      * correct behavior should be.
      */
-    IB_LIST_LOOP(rules, node) {
-        ib_rule_ctx_data_t *ctx_rule = (ib_rule_ctx_data_t *)node->data;
+    while ( (ctx_rule = rule_dispatch_iter_next(&iter)) != NULL) {
         ib_rule_t          *rule;
         ib_status_t         rule_rc;
 
@@ -2002,7 +2708,10 @@ static ib_status_t execute_stream_txdata_rule(ib_rule_exec_t *rule_exec,
         return rc;
     }
 
+    /* The operator may keep state from a chunk to the next. */
+    rule_exec->txdata_stream = true;
     rc = execute_stream_operator(rule_exec, value);
+    rule_exec->txdata_stream = false;
 
     return rc;
 }
@@ -2423,6 +3132,7 @@ static ib_status_t init_ruleset(ib_engine_t *ib,
                          ib_status_to_string(rc));
             return rc;
         }
+        ruleset_phase->dispatch = NULL;
     }
 
     /* Create a hash to hold rules indexed by ID */
@@ -2973,6 +3683,252 @@ static ib_status_t enable_rules(ib_engine_t *ib,
     return IB_OK;
 }
 
+/**
+ * Check if a rule must always be visited by the dispatch index.
+ *
+ * Rules that don't read their targets, and rules that can produce a result
+ * (or chain) even when all of their targets are absent, are never skipped.
+ *
+ * @param[in] rule Rule to check
+ *
+ * @returns true if @a rule must always be visited
+ */
+static bool rule_dispatch_always(const ib_rule_t *rule)
+{
+    const ib_operator_inst_t *opinst = rule->opinst;
+
+    if (ib_flags_any(rule->flags, IB_RULE_FLAG_EXTERNAL|IB_RULE_FLAG_NO_TGT)) {
+        return true;
+    }
+    if ( (opinst == NULL) || (opinst->op == NULL) ) {
+        return true;
+    }
+    if (ib_flags_all(opinst->flags, IB_OPINST_FLAG_INVERT) ||
+        ib_flags_all(opinst->op->flags, IB_OP_FLAG_ALLOW_NULL) )
+    {
+        return true;
+    }
+    if ( (rule->target_fields == NULL) ||
+         (ib_list_elements(rule->target_fields) == 0) )
+    {
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Get the length of the top-level field name of a rule target.
+ *
+ * For a target such as "ARGS:foo" or "ARGS:/^foo/", this is the length of
+ * "ARGS".
+ *
+ * @param[in] target Rule target
+ *
+ * @returns Length of the top-level field name
+ */
+static size_t rule_target_base_len(const ib_rule_target_t *target)
+{
+    const char *marker = strchr(target->field_name, ':');
+
+    if (marker == NULL) {
+        return strlen(target->field_name);
+    }
+    return (size_t)(marker - target->field_name);
+}
+
+/**
+ * Check if a previous target of a rule reads the same top-level field.
+ *
+ * @param[in] rule Rule
+ * @param[in] tnode Node of the target to check
+ *
+ * @returns true if a target before @a tnode has the same top-level field
+ */
+static bool rule_target_base_seen(const ib_rule_t *rule,
+                                  const ib_list_node_t *tnode)
+{
+    const ib_rule_target_t *target = ib_list_node_data_const(tnode);
+    size_t                  len = rule_target_base_len(target);
+    const ib_list_node_t   *node;
+
+    IB_LIST_LOOP_CONST(rule->target_fields, node) {
+        const ib_rule_target_t *prev = ib_list_node_data_const(node);
+
+        if (node == tnode) {
+            break;
+        }
+        if ( (rule_target_base_len(prev) == len) &&
+             (strncasecmp(prev->field_name, target->field_name, len) == 0) )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Build the dispatch index for a phase rule set.
+ *
+ * The index is built in two passes over the phase's rule list: the first
+ * one creates the field groups and counts their rules, the second one
+ * fills in the rule indexes.
+ *
+ * @param[in] ib Engine
+ * @param[in] ctx Context
+ * @param[in,out] ruleset_phase Phase rule set
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on allocation failure.
+ *   - Errors from ib_hash_create_nocase() / ib_list_create()
+ */
+static ib_status_t build_rule_dispatch(ib_engine_t *ib,
+                                       ib_context_t *ctx,
+                                       ib_ruleset_phase_t *ruleset_phase)
+{
+    assert(ib != NULL);
+    assert(ctx != NULL);
+    assert(ruleset_phase != NULL);
+
+    ib_mpool_t            *mp = ctx->mp;
+    ib_rule_dispatch_t    *dispatch;
+    ib_hash_t             *field_hash;
+    ib_list_t             *field_list;
+    const ib_list_node_t  *node;
+    const ib_list_node_t  *tnode;
+    rule_dispatch_field_t *field;
+    ib_status_t            rc;
+    size_t                 rnum;
+    size_t                 fnum;
+
+    dispatch = ib_mpool_calloc(mp, 1, sizeof(*dispatch));
+    if (dispatch == NULL) {
+        return IB_EALLOC;
+    }
+    rc = ib_hash_create_nocase(&field_hash, mp);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    rc = ib_list_create(&field_list, mp);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    /* Pass 1: Create the field groups, count the rules in each */
+    IB_LIST_LOOP_CONST(ruleset_phase->rule_list, node) {
+        const ib_rule_ctx_data_t *ctx_rule = ib_list_node_data_const(node);
+        const ib_rule_t          *rule = ctx_rule->rule;
+
+        ++(dispatch->num_rules);
+        if (rule_dispatch_always(rule)) {
+            ++(dispatch->num_always);
+            continue;
+        }
+
+        IB_LIST_LOOP_CONST(rule->target_fields, tnode) {
+            const ib_rule_target_t *target = ib_list_node_data_const(tnode);
+            size_t                  len = rule_target_base_len(target);
+
+            if (rule_target_base_seen(rule, tnode)) {
+                continue;
+            }
+
+            rc = ib_hash_get_ex(field_hash, &field, target->field_name, len);
+            if (rc == IB_ENOENT) {
+                field = ib_mpool_calloc(mp, 1, sizeof(*field));
+                if (field == NULL) {
+                    return IB_EALLOC;
+                }
+                field->name = target->field_name;
+                field->nlen = len;
+                rc = ib_hash_set_ex(field_hash, field->name, len, field);
+                if (rc != IB_OK) {
+                    return rc;
+                }
+                rc = ib_list_push(field_list, field);
+                if (rc != IB_OK) {
+                    return rc;
+                }
+            }
+            else if (rc != IB_OK) {
+                return rc;
+            }
+            ++(field->num_rules);
+        }
+    }
+
+    /* Allocate the arrays */
+    dispatch->num_fields = ib_list_elements(field_list);
+    dispatch->rules = ib_mpool_calloc(mp, dispatch->num_rules + 1,
+                                      sizeof(*dispatch->rules));
+    dispatch->always = ib_mpool_calloc(mp, dispatch->num_always + 1,
+                                       sizeof(*dispatch->always));
+    dispatch->fields = ib_mpool_calloc(mp, dispatch->num_fields + 1,
+                                       sizeof(*dispatch->fields));
+    if ( (dispatch->rules == NULL) ||
+         (dispatch->always == NULL) ||
+         (dispatch->fields == NULL) )
+    {
+        return IB_EALLOC;
+    }
+    fnum = 0;
+    IB_LIST_LOOP_CONST(field_list, node) {
+        field = (rule_dispatch_field_t *)ib_list_node_data_const(node);
+        field->rules = ib_mpool_alloc(mp,
+                                      field->num_rules * sizeof(*field->rules));
+        if (field->rules == NULL) {
+            return IB_EALLOC;
+        }
+        field->num_rules = 0;
+        dispatch->fields[fnum++] = field;
+    }
+
+    /* Pass 2: Fill in the rule indexes */
+    rnum = 0;
+    dispatch->num_always = 0;
+    IB_LIST_LOOP_CONST(ruleset_phase->rule_list, node) {
+        ib_rule_ctx_data_t *ctx_rule =
+            (ib_rule_ctx_data_t *)ib_list_node_data_const(node);
+        const ib_rule_t    *rule = ctx_rule->rule;
+
+        dispatch->rules[rnum] = ctx_rule;
+        if (rule_dispatch_always(rule)) {
+            dispatch->always[dispatch->num_always++] = rnum;
+            ++rnum;
+            continue;
+        }
+
+        IB_LIST_LOOP_CONST(rule->target_fields, tnode) {
+            const ib_rule_target_t *target = ib_list_node_data_const(tnode);
+
+            if (rule_target_base_seen(rule, tnode)) {
+                continue;
+            }
+            rc = ib_hash_get_ex(field_hash, &field, target->field_name,
+                                rule_target_base_len(target));
+            if (rc != IB_OK) {
+                return rc;
+            }
+            field->rules[field->num_rules++] = rnum;
+        }
+        ++rnum;
+    }
+
+    ib_log_debug2(ib,
+                  "Rule dispatch for phase %d/\"%s\" in context \"%s\": "
+                  "%zd rules, %zd always visited, %zd field groups",
+                  ruleset_phase->phase_num,
+                  phase_name(ruleset_phase->phase_meta),
+                  ib_context_full_get(ctx),
+                  dispatch->num_rules, dispatch->num_always,
+                  dispatch->num_fields);
+
+    ruleset_phase->dispatch = dispatch;
+    return IB_OK;
+}
+
 ib_status_t ib_rule_engine_ctx_close(ib_engine_t *ib,
                                      ib_module_t *mod,
                                      ib_context_t *ctx)
@@ -2981,11 +3937,12 @@ ib_status_t ib_rule_engine_ctx_close(ib_engine_t *ib,
     assert(mod != NULL);
     assert(ctx != NULL);
 
-    ib_list_t      *all_rules;
-    ib_list_node_t *node;
-    ib_flags_t      skip_flags;
-    ib_context_t   *main_ctx = ib_context_main(ib);
-    ib_status_t     rc;
+    ib_list_t          *all_rules;
+    ib_list_node_t     *node;
+    ib_flags_t          skip_flags;
+    ib_context_t       *main_ctx = ib_context_main(ib);
+    ib_rule_phase_num_t phase_num;
+    ib_status_t         rc;
 
     /* Don't enable rules for non-location contexts */
     if (ctx->ctype != IB_CTYPE_LOCATION) {
@@ -3156,7 +4113,6 @@ ib_status_t ib_rule_engine_ctx_close(ib_engine_t *ib,
         ib_rule_ctx_data_t *ctx_rule;
         ib_ruleset_phase_t *ruleset_phase;
         ib_list_t          *phase_rule_list;
-        ib_rule_phase_num_t phase_num;
         ib_rule_t          *rule;
 
         ctx_rule = (ib_rule_ctx_data_t *)ib_list_node_data(node);
@@ -3200,6 +4156,30 @@ ib_status_t ib_rule_engine_ctx_close(ib_engine_t *ib,
                      ib_context_full_get(ctx));
     }
 
+    /* Step 8: Build the dispatch index for each (non-stream) phase */
+    for (phase_num = PHASE_NONE;
+         phase_num < IB_RULE_PHASE_COUNT;
+         ++phase_num)
+    {
+        ib_ruleset_phase_t *ruleset_phase =
+            &(ctx->rules->ruleset.phases[phase_num]);
+
+        if ( (ruleset_phase->phase_meta == NULL) ||
+             ruleset_phase->phase_meta->is_stream )
+        {
+            continue;
+        }
+        rc = build_rule_dispatch(ib, ctx, ruleset_phase);
+        if (rc != IB_OK) {
+            ib_log_error(ib,
+                         "Failed to build rule dispatch for phase %d "
+                         "in context \"%s\": %s",
+                         phase_num, ib_context_full_get(ctx),
+                         ib_status_to_string(rc));
+            return rc;
+        }
+    }
+
     ib_rule_log_flags_dump(ib, ctx);
 
     return IB_OK;
@@ -3287,6 +4267,59 @@ bool ib_rule_should_capture(const ib_rule_exec_t *rule_exec,
     }
 }
 
+ib_status_t ib_rule_exec_stream_state(
+    const ib_rule_exec_t  *rule_exec,
+    size_t                 size,
+    ib_mpool_cleanup_fn_t  cleanup,
+    void                 **state)
+{
+    assert(rule_exec != NULL);
+    assert(rule_exec->tx != NULL);
+    assert(state != NULL);
+
+    const ib_rule_t *rule = rule_exec->rule;
+    ib_mpool_t      *mp = rule_exec->tx->mp;
+    ib_status_t      rc;
+    void            *s;
+    void            *key;
+
+    if (! rule_exec->txdata_stream || rule == NULL) {
+        return IB_ENOENT;
+    }
+    assert(rule_exec->stream_states != NULL);
+
+    /* Rules are keyed by address: rule IDs are not unique across
+     * contexts. */
+    rc = ib_hash_get_ex(rule_exec->stream_states, &s,
+                        (const char *)&rule, sizeof(rule));
+    if (rc == IB_OK) {
+        *state = s;
+        return IB_OK;
+    }
+    else if (rc != IB_ENOENT) {
+        return rc;
+    }
+
+    s = ib_mpool_calloc(mp, 1, size);
+    key = ib_mpool_memdup(mp, &rule, sizeof(rule));
+    if (s == NULL || key == NULL) {
+        return IB_EALLOC;
+    }
+    rc = ib_hash_set_ex(rule_exec->stream_states, key, sizeof(rule), s);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    if (cleanup != NULL) {
+        rc = ib_mpool_cleanup_register(mp, cleanup, s);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+
+    *state = s;
+    return IB_OK;
+}
+
 ib_status_t ib_rule_create(ib_engine_t *ib,
                            ib_context_t *ctx,
                            const char *file,
@@ -4196,6 +5229,17 @@ ib_status_t ib_rule_create_target(ib_engine_t *ib,
         return IB_EALLOC;
     }
 
+    /* Parse the name (and compile its pattern) once, here */
+    rc = ib_data_selector_create(ib_rule_mpool(ib),
+                                 ib_engine_data_config_get(ib),
+                                 name, strlen(name),
+                                 &(*target)->selector);
+    if (rc != IB_OK) {
+        ib_log_error(ib, "Error compiling target field name \"%s\": %s",
+                     name, ib_status_to_string(rc));
+        return rc;
+    }
+
     /* Copy the original */
     if (str == NULL) {
         (*target)->target_str = NULL;
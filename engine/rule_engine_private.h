@@ -137,6 +137,8 @@ struct ib_rule_log_tx_t {
     bool                    empty_tx;    /**< Is this an empty transaction? */
     ib_rule_phase_num_t     cur_phase;   /**< Current phase # */
     const char             *phase_name;  /**< Name of current phase */
+    int                     tfn_hits;    /**< # of tfn cache hits */
+    int                     tfn_misses;  /**< # of tfn cache misses */
 };
 
 /**
@@ -404,6 +406,24 @@ ib_status_t ib_rule_log_exec_add_stream_tgt(ib_rule_log_exec_t *exec_log,
 ib_status_t ib_rule_log_exec_tfn_add(ib_rule_log_exec_t *exec_log,
                                      const ib_tfn_t *tfn);
 
+/**
+ * Count a lookup in the transaction's transformation result cache
+ *
+ * @param[in,out] tx_log The transaction logging object (or NULL)
+ * @param[in] hit true if the result was found in the cache
+ */
+void ib_rule_log_tx_tfn_cache(ib_rule_log_tx_t *tx_log,
+                              bool hit);
+
+/**
+ * Are the transformations of the current target being logged?
+ *
+ * @param[in] exec_log The execution logging object (or NULL)
+ *
+ * @returns true if the transformations are being logged
+ */
+bool ib_rule_log_exec_tfn_enabled(const ib_rule_log_exec_t *exec_log);
+
 /**
  * Add a transformation value for a rule execution log
  *
@@ -574,6 +574,7 @@ ib_status_t ib_rule_log_exec_add_stream_tgt(ib_rule_log_exec_t *exec_log,
     target->field_name = fname;
     target->tfn_list = NULL;
     target->target_str = NULL;
+    target->selector = NULL;
 
     rc = ib_rule_log_exec_add_target(exec_log, target, field);
     if (rc != IB_OK) {
@@ -617,6 +618,33 @@ ib_status_t ib_rule_log_exec_tfn_add(ib_rule_log_exec_t *exec_log,
     return rc;
 }
 
+bool ib_rule_log_exec_tfn_enabled(const ib_rule_log_exec_t *exec_log)
+{
+    if (exec_log == NULL) {
+        return false;
+    }
+
+    return (exec_log->tgt_cur != NULL) &&
+           (exec_log->tgt_cur->tfn_list != NULL);
+}
+
+void ib_rule_log_tx_tfn_cache(ib_rule_log_tx_t *tx_log,
+                              bool hit)
+{
+    if (tx_log == NULL) {
+        return;
+    }
+
+    if (hit) {
+        ++tx_log->tfn_hits;
+    }
+    else {
+        ++tx_log->tfn_misses;
+    }
+
+    return;
+}
+
 ib_status_t ib_rule_log_exec_tfn_value(ib_rule_log_exec_t *exec_log,
                                        const ib_field_t *in,
                                        const ib_field_t *out,
@@ -887,6 +915,24 @@ static void log_tx_start(
     return;
 }
 
+static void log_tx_tfn_cache(
+    const ib_rule_exec_t *rule_exec
+)
+{
+    const ib_rule_log_tx_t *tx_log = rule_exec->tx_log;
+    int lookups = tx_log->tfn_hits + tx_log->tfn_misses;
+
+    if ( ib_flags_all(tx_log->flags, IB_RULE_LOG_FLAG_TFN) &&
+         (lookups != 0) )
+    {
+        rule_log_exec(rule_exec,
+                      "TFN_CACHE hits=%d misses=%d hit-rate=%d%%",
+                      tx_log->tfn_hits, tx_log->tfn_misses,
+                      (tx_log->tfn_hits * 100) / lookups);
+    }
+    return;
+}
+
 static void log_tx_end(
     const ib_rule_exec_t *rule_exec
 )
@@ -1095,6 +1141,7 @@ void ib_rule_log_tx_event_end(
 
     switch(event) {
     case handle_postprocess_event :
+        log_tx_tfn_cache(rule_exec);
         log_tx_end(rule_exec);
         break;
 
@@ -44,6 +44,16 @@ ib_status_t ib_tfn_register(ib_engine_t *ib,
                             ib_tfn_fn_t fn_execute,
                             ib_flags_t flags,
                             void *fndata)
+{
+    return ib_tfn_register_inplace(ib, name, fn_execute, NULL, flags, fndata);
+}
+
+ib_status_t ib_tfn_register_inplace(ib_engine_t *ib,
+                                    const char *name,
+                                    ib_tfn_fn_t fn_execute,
+                                    ib_tfn_inplace_fn_t fn_inplace,
+                                    ib_flags_t flags,
+                                    void *fndata)
 {
     assert(ib != NULL);
     assert(name != NULL);
@@ -65,6 +75,7 @@ ib_status_t ib_tfn_register(ib_engine_t *ib,
     }
     tfn->name = name_copy;
     tfn->fn_execute = fn_execute;
+    tfn->fn_inplace = fn_inplace;
     tfn->tfn_flags = flags;
     tfn->fndata = fndata;
 
@@ -108,6 +119,33 @@ ib_status_t ib_tfn_transform(ib_engine_t *ib,
     return rc;
 }
 
+ib_status_t ib_tfn_transform_inplace(ib_engine_t *ib,
+                                     ib_mpool_t *mp,
+                                     const ib_tfn_t *tfn,
+                                     uint8_t *data_in,
+                                     size_t dlen_in,
+                                     uint8_t **data_out,
+                                     size_t *dlen_out,
+                                     ib_flags_t *pflags)
+{
+    assert(tfn != NULL);
+    assert(mp != NULL);
+    assert(data_in != NULL);
+    assert(data_out != NULL);
+    assert(dlen_out != NULL);
+    assert(pflags != NULL);
+
+    if (tfn->fn_inplace == NULL) {
+        return IB_ENOTIMPL;
+    }
+
+    ib_status_t rc = tfn->fn_inplace(ib, mp, tfn->fndata,
+                                     data_in, dlen_in,
+                                     data_out, dlen_out, pflags);
+
+    return rc;
+}
+
 ib_status_t ib_tfn_data_get_ex(
     ib_engine_t *ib,
     ib_data_t   *data,
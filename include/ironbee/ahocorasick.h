@@ -81,6 +81,7 @@ extern "C" {
 
 typedef struct ib_ac_t ib_ac_t;
 typedef struct ib_ac_state_t ib_ac_state_t;
+typedef struct ib_ac_table_t ib_ac_table_t;
 typedef struct ib_ac_context_t ib_ac_context_t;
 typedef struct ib_ac_match_t ib_ac_match_t;
 
@@ -94,6 +95,7 @@ struct ib_ac_t {
     ib_mpool_t *mp;         /**< mem pool */
 
     ib_ac_state_t *root;     /**< root of the direct tree */
+    ib_ac_table_t *table;    /**< flat state table (built with the links) */
 
     uint32_t pattern_cnt;   /**< number of patterns */
 };
@@ -197,7 +199,8 @@ ib_status_t ib_ac_create(ib_ac_t **ac_tree,
                          ib_mpool_t *pool);
 
 /**
- * builds links between states (the AC failure function)
+ * builds links between states (the AC failure function) and freezes
+ * the trie into a flat state table used by ib_ac_consume()
  *
  * @param ac_tree pointer to store the matcher
  *
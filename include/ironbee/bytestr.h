@@ -185,6 +185,29 @@ ib_status_t DLL_PUBLIC ib_bytestr_alias_nulstr(ib_bytestr_t **pdst,
                                                ib_mpool_t *pool,
                                                const char *data);
 
+/**
+ * Size of a byte string structure.
+ *
+ * Allows a byte string to be placed in a larger allocation, e.g., along with
+ * the field holding it.  See ib_bytestr_init().
+ *
+ * @returns sizeof(ib_bytestr_t)
+ */
+size_t DLL_PUBLIC ib_bytestr_struct_size(void);
+
+/**
+ * Initialize an empty byte string in caller provided storage.
+ *
+ * Set its value with ib_bytestr_setv() or ib_bytestr_setv_const().
+ *
+ * @param mem Storage of at least ib_bytestr_struct_size() bytes
+ * @param pool Memory pool used if the byte string grows
+ *
+ * @returns The byte string at @a mem
+ */
+ib_bytestr_t DLL_PUBLIC *ib_bytestr_init(void *mem,
+                                         ib_mpool_t *pool);
+
 /**
  * Set the value of the bytestring.
  *
@@ -75,6 +75,7 @@ struct ib_core_cfg_t {
     ib_num_t         log_level;         /**< Log level */
     const char      *log_uri;           /**< Log URI */
     FILE            *log_fp;            /**< File pointer for log. */
+    ib_num_t         log_async;         /**< Use asynchronous logger */
     const char      *logevent;          /**< Active logevent provider key */
     ib_list_t       *initvar_list;      /**< List of ib_field_t for InitVar */
     ib_list_t       *mancoll_list;      /**< List of ib_managed_collection_t */
@@ -88,6 +89,10 @@ struct ib_core_cfg_t {
     const ib_logformat_t *auditlog_index_hp; /**< Audit log index fmt helper */
     const char      *auditlog_dir;      /**< Audit log base directory */
     const char      *auditlog_sdir_fmt; /**< Audit log sub-directory format */
+    ib_num_t         auditlog_async;    /**< Use asynchronous audit writer */
+    ib_num_t         auditlog_queue_size; /**< Audit writer queue size */
+    ib_num_t         auditlog_queue_overflow; /**< Audit queue full policy */
+    ib_num_t         auditlog_segment_size; /**< Audit segment file size */
     const char      *audit;             /**< Active audit provider key */
     const char      *parser;            /**< Active parser provider key */
     const char      *data;              /**< Active data provider key */
@@ -100,6 +105,35 @@ struct ib_core_cfg_t {
     ib_num_t         block_status;      /**< Status codes when blocking. */
 };
 
+/**
+ * Asynchronous audit log writer statistics.
+ */
+typedef struct ib_auditlog_stats_t ib_auditlog_stats_t;
+struct ib_auditlog_stats_t {
+    size_t           queue_size;        /**< Queue capacity */
+    size_t           queue_depth;       /**< Audit logs currently queued */
+    size_t           queue_max_depth;   /**< Maximum queue depth seen */
+    uint64_t         queued;            /**< Audit logs queued */
+    uint64_t         written;           /**< Audit logs written */
+    uint64_t         failed;            /**< Audit logs that failed to write */
+    uint64_t         blocked;           /**< Submits that waited for space */
+    uint64_t         dropped;           /**< Audit logs dropped (queue full) */
+    uint64_t         spilled;           /**< Audit logs written synchronously */
+    uint64_t         batches;           /**< Batches written */
+};
+
+/**
+ * Get the asynchronous audit log writer statistics.
+ *
+ * @param[in] ib IronBee engine
+ * @param[out] stats Statistics
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_ENOENT if the asynchronous audit log writer is not in use.
+ */
+ib_status_t DLL_PUBLIC ib_core_auditlog_stats(const ib_engine_t *ib,
+                                              ib_auditlog_stats_t *stats);
 
 /**
  * @} IronBeeCore
@@ -45,9 +45,94 @@ extern "C" {
  */
 typedef struct ib_data_t ib_data_t;
 
+/**
+ * Registry of indexed field names.
+ *
+ * Top-level field names that are looked up often (well-known fields and
+ * rule targets) can be registered, at configuration time, to get a stable
+ * index.  Data stores created with the registry keep the fields of
+ * registered names in a slot array, so ib_data_get_indexed() gets them
+ * without parsing or hashing the name.  Fields are still stored and
+ * looked up by name as well.
+ */
+typedef struct ib_data_config_t ib_data_config_t;
+
+/**
+ * Create a registry of indexed field names.
+ *
+ * @param[in]  mp     Memory pool to use.
+ * @param[out] config The new registry.
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation failure.
+ */
+ib_status_t DLL_PUBLIC ib_data_config_create(
+    ib_mpool_t        *mp,
+    ib_data_config_t **config
+);
+
+/**
+ * Register an indexed field name.
+ *
+ * Registering a name that is already registered returns its index.
+ * Names should be registered at configuration time: registration is not
+ * thread safe, and data stores created before the registration don't
+ * have a slot for the name (ib_data_get_indexed() falls back to a lookup
+ * by name for them).
+ *
+ * @param[in]  config Registry.
+ * @param[in]  name   Top-level field name (case insensitive).
+ * @param[in]  nlen   Length of @a name.
+ * @param[out] index  Index of @a name, if not NULL.
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation failure.
+ */
+ib_status_t DLL_PUBLIC ib_data_register_indexed_ex(
+    ib_data_config_t *config,
+    const char       *name,
+    size_t            nlen,
+    size_t           *index
+);
+
+/**
+ * Register an indexed field name.
+ *
+ * @sa ib_data_register_indexed_ex()
+ *
+ * @param[in] config Registry.
+ * @param[in] name   NUL terminated top-level field name.
+ * @returns Status code of ib_data_register_indexed_ex().
+ */
+ib_status_t DLL_PUBLIC ib_data_register_indexed(
+    ib_data_config_t *config,
+    const char       *name
+);
+
+/**
+ * Get the index of a registered field name.
+ *
+ * @param[in]  config Registry.
+ * @param[in]  name   Top-level field name (case insensitive).
+ * @param[in]  nlen   Length of @a name.
+ * @param[out] index  Index of @a name.
+ * @returns
+ * - IB_OK on success.
+ * - IB_ENOENT if @a name is not registered.
+ */
+ib_status_t DLL_PUBLIC ib_data_lookup_index_ex(
+    const ib_data_config_t *config,
+    const char             *name,
+    size_t                  nlen,
+    size_t                 *index
+);
+
 /**
  * Create new data store.
  *
+ * This is ib_data_create_indexed() without a registry; no names are
+ * indexed.
+ *
  * @param[in]  mp   Memory pool to use.
  * @param[out] data The new data store.
  * @returns
@@ -59,6 +144,22 @@ ib_status_t DLL_PUBLIC ib_data_create(
     ib_data_t  **data
 );
 
+/**
+ * Create new data store with slots for the names of a registry.
+ *
+ * @param[in]  config Registry of indexed names (may be NULL).
+ * @param[in]  mp     Memory pool to use.
+ * @param[out] data   The new data store.
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation failure.
+ */
+ib_status_t DLL_PUBLIC ib_data_create_indexed(
+    const ib_data_config_t  *config,
+    ib_mpool_t              *mp,
+    ib_data_t              **data
+);
+
 /**
  * Access data pool of @a data.
  *
@@ -210,6 +311,78 @@ ib_status_t DLL_PUBLIC ib_data_get_ex(
     ib_field_t      **pf
 );
 
+/**
+ * Get a data field by index.
+ *
+ * @param[in]  data  Data.
+ * @param[in]  index Index of a name registered with the registry of
+ *                   @a data.
+ * @param[out] pf    Pointer where the field is written.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_ENOENT if there is no field with the name of @a index.
+ * - IB_EINVAL if @a index is not from the registry of @a data.
+ */
+ib_status_t DLL_PUBLIC ib_data_get_indexed(
+    const ib_data_t  *data,
+    size_t            index,
+    ib_field_t      **pf
+);
+
+/**
+ * Precompiled field selector.
+ *
+ * A selector is a field name as accepted by ib_data_get_ex() --
+ * @c NAME, @c NAME:subfield or @c NAME:/pattern/ -- parsed once.  The
+ * pattern of a selector is compiled (and studied) when the selector is
+ * created, so ib_data_get_selected() does no parsing or compilation.  If
+ * created with a registry, @c NAME is registered as an indexed name.
+ */
+typedef struct ib_data_selector_t ib_data_selector_t;
+
+/**
+ * Create a field selector.
+ *
+ * @param[in] mp Memory pool to allocate from.  The compiled pattern is
+ *               freed when @a mp is destroyed.
+ * @param[in] config Registry to register the top-level name with
+ *                   (may be NULL).
+ * @param[in] name Field name.
+ * @param[in] nlen Length of @a name.
+ * @param[out] psel The new selector.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EINVAL if @a name has an empty subfield or a malformed or invalid
+ *   pattern.
+ * - IB_EALLOC on allocation failure.
+ */
+ib_status_t DLL_PUBLIC ib_data_selector_create(
+    ib_mpool_t          *mp,
+    ib_data_config_t    *config,
+    const char          *name,
+    size_t               nlen,
+    ib_data_selector_t **psel
+);
+
+/**
+ * Get a data field using a selector.
+ *
+ * This is equivalent to ib_data_get_ex() with the name of @a sel.
+ *
+ * @param[in] data Data.
+ * @param[in] sel Selector.
+ * @param[out] pf Pointer where the field is written.
+ *
+ * @returns IB_OK on success or IB_ENOENT if the element is not found.
+ */
+ib_status_t DLL_PUBLIC ib_data_get_selected(
+    const ib_data_t          *data,
+    const ib_data_selector_t *sel,
+    ib_field_t              **pf
+);
+
 /**
  * Get all data fields from a data provider instance.
  *
@@ -380,6 +553,22 @@ ib_status_t DLL_PUBLIC ib_data_set_relative(
     intmax_t    adjval
 );
 
+/**
+ * Get the generation of @a data.
+ *
+ * The generation changes every time a new top-level field is added.  It
+ * does not change when fields are removed, replaced or modified.  Callers
+ * that cache the absence of top-level fields (e.g. the rule engine's
+ * dispatch index) use it to detect when their cache has become stale.
+ *
+ * @param[in] data Data.
+ *
+ * @returns Current generation of @a data.
+ */
+size_t DLL_PUBLIC ib_data_generation(
+    const ib_data_t *data
+);
+
 /**
  * Expand a string using fields from the data store.
  *
@@ -29,6 +29,7 @@
 #include <ironbee/build.h>
 #include <ironbee/cfgmap.h>
 #include <ironbee/clock.h>
+#include <ironbee/data.h>
 #include <ironbee/engine_types.h>
 #include <ironbee/field.h>
 #include <ironbee/hash.h>
@@ -192,6 +193,17 @@ ib_mpool_t DLL_PUBLIC *ib_engine_pool_main_get(const ib_engine_t *ib);
  */
 ib_mpool_t DLL_PUBLIC *ib_engine_pool_config_get(const ib_engine_t *ib);
 
+/**
+ * Get the engine registry of indexed data field names.
+ *
+ * The data of connections and transactions is created with this registry.
+ *
+ * @param ib Engine handle
+ *
+ * @returns Registry of indexed data field names
+ */
+ib_data_config_t DLL_PUBLIC *ib_engine_data_config_get(const ib_engine_t *ib);
+
 /**
  * Get the engine temporary memory pool.
  *
@@ -0,0 +1,138 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+#ifndef _IB_FIELD_BINARY_H_
+#define _IB_FIELD_BINARY_H_
+
+/**
+ * @file
+ * @brief IronBee --- Binary Field List Encoding
+ */
+
+#include <ironbee/build.h>
+#include <ironbee/list.h>
+#include <ironbee/mpool.h>
+#include <ironbee/types.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup IronBeeUtilFieldBinary Binary Field List Encoding
+ * @ingroup IronBeeUtil
+ *
+ * A compact, versioned encoding of lists of fields, used to persist
+ * collections without the cost of generating and parsing JSON.
+ *
+ * An encoded buffer is the four byte header "IBF" followed by the format
+ * version, and then the encoded list.  A list is a field count followed by
+ * the fields; each field is its type (one byte), its name length and name,
+ * and its value:
+ *
+ * - @c IB_FTYPE_NUM --- Zig-zag encoded variable length integer.
+ * - @c IB_FTYPE_FLOAT --- IEEE 754 double, little-endian.
+ * - @c IB_FTYPE_NULSTR --- Length, the string and its NUL terminator.
+ * - @c IB_FTYPE_BYTESTR --- Length and data.
+ * - @c IB_FTYPE_LIST --- A nested list.
+ *
+ * All counts and lengths are unsigned variable length integers (seven bits
+ * per byte, least significant group first).  As with the JSON encoding,
+ * fields of other types are not encoded.
+ *
+ * @{
+ */
+
+/** Current version of the binary field encoding. */
+#define IB_FIELD_BINARY_VERSION 1
+
+/**
+ * Does a buffer hold binary encoded fields (of any version)?
+ *
+ * @param[in] data Buffer.
+ * @param[in] dlen Length of @a data.
+ *
+ * @returns True if @a data starts with the binary encoding header.
+ */
+bool DLL_PUBLIC ib_field_binary_is_encoded(
+    const uint8_t *data,
+    size_t         dlen);
+
+/**
+ * Encode a list of fields.
+ *
+ * The encoded buffer is a single allocation from @a mp, sized exactly.
+ *
+ * @param[in] mp Memory pool to allocate the buffer from.
+ * @param[in] list List of fields to encode.
+ * @param[out] obuf Encoded buffer.
+ * @param[out] olen Length of @a obuf.
+ *
+ * @returns Status code:
+ *  - IB_OK - All OK
+ *  - IB_EALLOC - Allocation error
+ *  - IB_EINVAL - Lists nested too deeply
+ *  - IB_EOTHER - A dynamic field's value changed while encoding
+ *  - Errors from ib_field_value()
+ */
+ib_status_t DLL_PUBLIC ib_field_binary_encode(
+    ib_mpool_t       *mp,
+    const ib_list_t  *list,
+    uint8_t         **obuf,
+    size_t           *olen);
+
+/**
+ * Decode a buffer of binary encoded fields into a list of fields.
+ *
+ * If @a alias is true, string values point directly into @a data instead
+ * of being copied into @a mp; @a data must then outlive the fields and must
+ * not be modified.  Field names are always copied.
+ *
+ * @param[in] mp Memory pool to use for allocations.
+ * @param[in] data Encoded buffer.
+ * @param[in] dlen Length of @a data.
+ * @param[in] alias Alias string values rather than copy them.
+ * @param[out] list_out List to add the decoded fields to.
+ * @param[out] error Pointer to error string (or NULL)
+ *
+ * @returns Status code:
+ *  - IB_OK - All OK
+ *  - IB_EALLOC - Allocation error
+ *  - IB_EINVAL - Malformed data
+ *  - IB_ENOTIMPL - Unsupported encoding version
+ */
+ib_status_t DLL_PUBLIC ib_field_binary_decode(
+    ib_mpool_t     *mp,
+    const uint8_t  *data,
+    size_t          dlen,
+    bool            alias,
+    ib_list_t      *list_out,
+    const char    **error);
+
+/**
+ * @} IronBeeUtilFieldBinary
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _IB_FIELD_BINARY_H_ */
@@ -0,0 +1,286 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+#ifndef _IB_IPTRIE_H_
+#define _IB_IPTRIE_H_
+
+/**
+ * @file
+ * @brief IronBee --- IP Trie Utility Functions
+ */
+
+#include <ironbee/build.h>
+#include <ironbee/ip.h>
+#include <ironbee/types.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup IronBeeUtilIPTrie IP Trie
+ * @ingroup IronBeeUtil
+ *
+ * Longest prefix match of IP addresses against very large network lists.
+ *
+ * An IP trie maps IPv4 and IPv6 networks to non-zero values.  A query
+ * returns the value of the most specific network containing the IP.
+ *
+ * The trie is a compressed multibit trie (poptrie): each node covers
+ * @ref IB_IPTRIE_STRIDE bits of the address with two 64 bit vectors, one
+ * marking the children that are nodes and one marking where runs of equal
+ * leaves start, and finds children and leaves by counting bits.  A query
+ * thus reads at most \f$\lceil 32 / 6 \rceil = 6\f$ nodes for IPv4 and
+ * \f$\lceil 128 / 6 \rceil = 22\f$ nodes for IPv6, whatever the number of
+ * networks, and the trie takes a few bytes per network.
+ *
+ * Compared to @ref IronBeeUtilIPSet, IP tries do not support negative
+ * networks, nor retrieving all matching networks, but suit lists of
+ * millions of networks, such as IP reputation feeds.
+ *
+ * A trie is built with an ib_iptrie_builder_t, from networks or from a
+ * list file.  It is held as a single position independent image that can
+ * be written to a file with ib_iptrie_write() and mapped with
+ * ib_iptrie_load(), so that all processes share one copy of it.  Images
+ * are in host byte order.
+ *
+ * @{
+ */
+
+/** Number of address bits covered by a trie node. */
+#define IB_IPTRIE_STRIDE 6
+
+/**
+ * An IP trie.  Opaque datastructure.
+ *
+ * Tries are read-only and may be queried from several threads.
+ *
+ * @sa ib_iptrie_builder_finish()
+ * @sa ib_iptrie_load()
+ */
+typedef struct ib_iptrie_t ib_iptrie_t;
+
+/**
+ * An IP trie builder.  Opaque datastructure.
+ *
+ * @sa ib_iptrie_builder_create()
+ */
+typedef struct ib_iptrie_builder_t ib_iptrie_builder_t;
+
+/**
+ * Create an IP trie builder.
+ *
+ * @param[out] builder The new builder.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on memory allocation failure.
+ */
+ib_status_t DLL_PUBLIC ib_iptrie_builder_create(
+    ib_iptrie_builder_t **builder
+);
+
+/**
+ * Add an IPv4 network to @a builder.
+ *
+ * Adding a network again replaces its value.
+ *
+ * @param[in] builder Builder.
+ * @param[in] net     Network; bits past @c size are ignored.
+ * @param[in] value   Value of @a net; not 0.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EINVAL if @a value is 0 or the network size is over 32.
+ * - IB_EALLOC on memory allocation failure.
+ */
+ib_status_t DLL_PUBLIC ib_iptrie_builder_add4(
+    ib_iptrie_builder_t    *builder,
+    const ib_ip4_network_t *net,
+    uint32_t                value
+);
+
+/**
+ * As ib_iptrie_builder_add4() except for IPv6 networks.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EINVAL if @a value is 0 or the network size is over 128.
+ * - IB_EALLOC on memory allocation failure.
+ */
+ib_status_t DLL_PUBLIC ib_iptrie_builder_add6(
+    ib_iptrie_builder_t    *builder,
+    const ib_ip6_network_t *net,
+    uint32_t                value
+);
+
+/**
+ * Add the networks listed in the file @a path to @a builder.
+ *
+ * Each line holds an IPv4 or IPv6 network (e.g., @c 192.168.0.0/16 or
+ * @c 2001:db8::/32; a lone IP is a network of one), optionally followed by
+ * whitespace and a decimal value (1 if omitted).  Empty lines and lines
+ * starting with @c # are ignored.
+ *
+ * @param[in]  builder Builder.
+ * @param[in]  path    File to read.
+ * @param[out] line    If not NULL, set to the number of the line in error
+ *                     when IB_EINVAL is returned.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EINVAL if a line is not valid.
+ * - IB_ENOENT if @a path cannot be opened.
+ * - IB_EALLOC on memory allocation failure.
+ */
+ib_status_t DLL_PUBLIC ib_iptrie_builder_add_file(
+    ib_iptrie_builder_t *builder,
+    const char          *path,
+    size_t              *line
+);
+
+/**
+ * Build the trie of the networks added to @a builder.
+ *
+ * The builder may be used again or destroyed.
+ *
+ * @param[in]  builder Builder.
+ * @param[out] trie    The trie; destroy with ib_iptrie_destroy().
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on memory allocation failure.
+ */
+ib_status_t DLL_PUBLIC ib_iptrie_builder_finish(
+    const ib_iptrie_builder_t  *builder,
+    ib_iptrie_t               **trie
+);
+
+/**
+ * Destroy @a builder.
+ *
+ * @param[in] builder Builder.
+ */
+void DLL_PUBLIC ib_iptrie_builder_destroy(
+    ib_iptrie_builder_t *builder
+);
+
+/**
+ * Write the image of @a trie to the file @a path.
+ *
+ * @param[in] trie Trie.
+ * @param[in] path File to write.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EOTHER if the file cannot be written; see errno.
+ */
+ib_status_t DLL_PUBLIC ib_iptrie_write(
+    const ib_iptrie_t *trie,
+    const char        *path
+);
+
+/**
+ * Map a trie image written by ib_iptrie_write().
+ *
+ * The image is mapped read-only and shared, not read.  It is checked to be
+ * a well formed trie.
+ *
+ * @param[out] trie The trie; destroy with ib_iptrie_destroy().
+ * @param[in]  path File to map.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_ENOENT if @a path cannot be opened.
+ * - IB_EINVAL if @a path is not a trie image of this host.
+ * - IB_EALLOC on memory allocation failure.
+ * - IB_EOTHER if the file cannot be mapped; see errno.
+ */
+ib_status_t DLL_PUBLIC ib_iptrie_load(
+    ib_iptrie_t **trie,
+    const char   *path
+);
+
+/**
+ * Check whether the file @a path starts like a trie image.
+ *
+ * @param[in] path File to check.
+ *
+ * @returns True if @a path can be read and starts with the image magic.
+ */
+bool DLL_PUBLIC ib_iptrie_is_image(
+    const char *path
+);
+
+/**
+ * Find the value of the most specific network of @a trie containing @a ip.
+ *
+ * This function makes no allocations.
+ *
+ * @param[in]  trie  Trie.
+ * @param[in]  ip    IP to query.
+ * @param[out] value If not NULL, set to the value found.
+ *
+ * @returns
+ * - IB_OK if @a ip is in a network of @a trie.
+ * - IB_ENOENT otherwise.
+ */
+ib_status_t DLL_PUBLIC ib_iptrie_query4(
+    const ib_iptrie_t *trie,
+    ib_ip4_t           ip,
+    uint32_t          *value
+);
+
+/**
+ * As ib_iptrie_query4() except for IPv6 addresses.
+ */
+ib_status_t DLL_PUBLIC ib_iptrie_query6(
+    const ib_iptrie_t *trie,
+    const ib_ip6_t    *ip,
+    uint32_t          *value
+);
+
+/**
+ * Size of the image of @a trie, in bytes.
+ *
+ * @param[in] trie Trie.
+ *
+ * @returns Image size.
+ */
+size_t DLL_PUBLIC ib_iptrie_size(
+    const ib_iptrie_t *trie
+);
+
+/**
+ * Destroy @a trie, unmapping its image if it was loaded.
+ *
+ * @param[in] trie Trie.
+ */
+void DLL_PUBLIC ib_iptrie_destroy(
+    ib_iptrie_t *trie
+);
+
+/** @} IronBeeUtilIPTrie */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _IB_IPTRIE_H_ */
@@ -0,0 +1,156 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+#ifndef __IRONBEE__KVSTORE_CACHE_H
+#define __IRONBEE__KVSTORE_CACHE_H
+
+#include <ironbee/build.h>
+#include <ironbee/kvstore.h>
+#include <ironbee/types.h>
+
+#include <stdint.h>
+
+/**
+ * @file
+ * @brief IronBee --- Key-Value Store Cache Interface
+ */
+
+/**
+ * @addtogroup IronBeeKeyValueStore
+ * @ingroup IronBeeUtil
+ * @{
+ */
+
+/** Cache configuration. */
+typedef struct {
+    /** Bound on the memory used by cached keys and values (bytes). */
+    size_t max_bytes;
+    /** Number of independently locked shards. */
+    size_t shards;
+    /**
+     * Seconds a fetched value is used before it is fetched again; 0 uses it
+     * until it expires.  Bounds how stale a value written by another
+     * process can be.
+     */
+    uint32_t max_age;
+    /** Seconds a missing key is remembered as missing; 0 disables. */
+    uint32_t negative_ttl;
+    /**
+     * Seconds a set is held in the cache, so that further sets of the same
+     * key are coalesced into a single write; 0 writes through.
+     */
+    uint32_t write_delay;
+    /**
+     * Seconds past @c max_age a value is still used when fetching it again
+     * fails (e.g., times out); 0 disables.
+     */
+    uint32_t stale_if_error;
+    /**
+     * Merge policy applied when the backend returns several values for a
+     * key; NULL for the backend's default.
+     */
+    ib_kvstore_merge_policy_fn_t merge_policy;
+} ib_kvstore_cache_config_t;
+
+/** Cache counters. */
+typedef struct {
+    uint64_t hits;           /**< Gets answered with a cached value */
+    uint64_t negative_hits;  /**< Gets answered with a cached miss */
+    uint64_t stale_hits;     /**< Gets answered stale as the backend failed */
+    uint64_t misses;         /**< Gets passed to the backend */
+    uint64_t evictions;      /**< Entries evicted to bound memory */
+    uint64_t expirations;    /**< Entries dropped because they expired */
+    uint64_t writes;         /**< Sets written to the backend */
+    uint64_t coalesced;      /**< Sets absorbed by a pending write */
+    uint64_t write_errors;   /**< Failed backend writes */
+} ib_kvstore_cache_stats_t;
+
+/**
+ * Fill in the default cache configuration.
+ *
+ * The default is 4 MiB in 16 shards, with a max_age and negative_ttl of 5
+ * seconds, writes passed through and no stale values used.
+ *
+ * @param[out] config Configuration to fill in.
+ */
+void DLL_PUBLIC ib_kvstore_cache_config_default(
+    ib_kvstore_cache_config_t *config);
+
+/**
+ * Initialize a kvstore that caches another kvstore.
+ *
+ * Gets are answered from an in-memory LRU cache when possible, and
+ * fetched from @a backend (merged with the configured merge policy, once)
+ * otherwise.  Cached values honor their expiration, and are also refetched
+ * after @c max_age seconds.  Keys not found in @a backend are remembered
+ * for @c negative_ttl seconds.  If refetching fails with an error other
+ * than IB_ENOENT, the old value is used for up to @c stale_if_error more
+ * seconds.  When the cache is over @c max_bytes, the least recently used
+ * entries of the shard are evicted.
+ *
+ * Sets and removes update the cache.  Removes, and sets when
+ * @c write_delay is 0, go to @a backend immediately.  Otherwise sets are
+ * written to @a backend when the oldest pending set of the shard is
+ * @c write_delay seconds old and the shard is next used, when the entry is
+ * evicted, at ib_kvstore_cache_flush() and at disconnect.
+ *
+ * Connect and disconnect are passed to @a backend.  Destroying the cache
+ * flushes it but does not destroy @a backend, which must outlive it.
+ *
+ * The cache may be used from several threads, if @a backend can.
+ *
+ * @param[out] kvstore The cache.
+ * @param[in] backend The kvstore to cache.
+ * @param[in] config Configuration; NULL for the default.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EINVAL if @c max_bytes or @c shards is 0.
+ *   - IB_EALLOC on memory allocation failure using malloc.
+ *   - IB_EUNKNOWN if a lock could not be created.
+ */
+ib_status_t DLL_PUBLIC ib_kvstore_cache_init(
+    ib_kvstore_t *kvstore,
+    ib_kvstore_t *backend,
+    const ib_kvstore_cache_config_t *config);
+
+/**
+ * Write all pending sets to the backend.
+ *
+ * @param[in] kvstore A cache initialized by ib_kvstore_cache_init().
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - The first error returned by the backend; the failed sets are kept and
+ *     retried.
+ */
+ib_status_t DLL_PUBLIC ib_kvstore_cache_flush(ib_kvstore_t *kvstore);
+
+/**
+ * Get the cache counters.
+ *
+ * @param[in] kvstore A cache initialized by ib_kvstore_cache_init().
+ * @param[out] stats Counters, summed over the shards.
+ */
+void DLL_PUBLIC ib_kvstore_cache_stats(
+    ib_kvstore_t *kvstore,
+    ib_kvstore_cache_stats_t *stats);
+
+/**
+ * @}
+ */
+#endif /* __IRONBEE__KVSTORE_CACHE_H */
@@ -21,6 +21,7 @@
 #include "ironbee_config_auto.h"
 
 #include <ironbee/kvstore.h>
+#include <ironbee/lock.h>
 #include <ironbee/mpool.h>
 #include <ironbee/types.h>
 
@@ -41,8 +42,21 @@
  * @{
  */
 
+/** Default number of idle connections kept for reuse. */
+#define IB_KVSTORE_RIAK_DEFAULT_POOL_SIZE 8
+
+/** Default timeout of a request, in milliseconds. */
+#define IB_KVSTORE_RIAK_DEFAULT_TIMEOUT 1000
+
+/** Default timeout of establishing a connection, in milliseconds. */
+#define IB_KVSTORE_RIAK_DEFAULT_CONNECT_TIMEOUT 500
+
 /**
  * The riak server object.
+ *
+ * Requests are made on handles taken from a pool of idle handles, each
+ * of which keeps its connection to the server alive, so requests from
+ * several threads run concurrently and rarely need a new connection.
  */
 struct ib_kvstore_riak_server_t {
     char *riak_url;        /**< Riak URL. */
@@ -52,7 +66,13 @@ struct ib_kvstore_riak_server_t {
     char *bucket_url;      /**< riak_url with the bucket appended. */
     size_t bucket_url_len; /**< Length of bucket_url. */
     ib_mpool_t *mp;        /**< Memory pool. */
-    CURL *curl;            /**< Curl context for web requests. */
+    ib_lock_t mp_lock;     /**< Serializes allocations from mp. */
+    ib_lock_t lock;        /**< Protects the pool, vclock and etag. */
+    CURL **pool;           /**< Idle curl handles. */
+    size_t pool_idle;      /**< Number of handles in pool. */
+    size_t pool_size;      /**< Maximum number of idle handles. */
+    long timeout;          /**< Request timeout (ms); 0 for none. */
+    long connect_timeout;  /**< Connect timeout (ms); 0 for curl's. */
     char *client_id;       /**< The Riak client id. */
     char *vclock;          /**< NULL or vector clock for queries to riak. */
     char *etag;            /**< NULL or etag for queries to riak. */
@@ -64,7 +84,10 @@ typedef struct ib_kvstore_riak_server_t ib_kvstore_riak_server_t;
  * @param[in] client_id A unique identifier of this client.
  * @param[in] base_url The base URL where the Riak HTTP interface is rooted.
  * @param[in] bucket The riak bucket that keys are stored in.
- * @param[in,out] mp The memory pool allocations will be made out of.
+ * @param[in,out] mp The memory pool values returned by the store are
+ *                   allocated from; allocations are serialized, so @a mp
+ *                   may be shared by threads using the store.  Buffers
+ *                   used during a request always use malloc/free.
  *                   If this is NULL then the normal malloc/free
  *                   implementation will be used.
  * @returns
@@ -78,6 +101,67 @@ ib_status_t ib_kvstore_riak_init(
     const char *bucket,
     ib_mpool_t *mp);
 
+/**
+ * Set the number of idle connections kept for reuse.
+ *
+ * Connections beyond this are closed when their request completes.
+ *
+ * @param[in] kvstore Key-value store.
+ * @param[in] pool_size Number of idle connections; 0 disables reuse.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on memory allocation failure.
+ */
+ib_status_t ib_kvstore_riak_set_pool_size(
+    ib_kvstore_t *kvstore,
+    size_t pool_size);
+
+/**
+ * Set the timeouts of requests.
+ *
+ * A request that times out fails with IB_ETIMEDOUT.  Put a cache
+ * (ib_kvstore_cache_init()) with @c stale_if_error in front of the store to
+ * fall back to the last value fetched.
+ *
+ * @param[in] kvstore Key-value store.
+ * @param[in] timeout Timeout of a whole request (ms); 0 for none.
+ * @param[in] connect_timeout Timeout of connecting (ms); 0 for curl's
+ *            default.
+ */
+void ib_kvstore_riak_set_timeout(
+    ib_kvstore_t *kvstore,
+    long timeout,
+    long connect_timeout);
+
+/**
+ * Fetch several keys concurrently.
+ *
+ * All keys are requested at once, each on its own connection, and the
+ * call returns when all have completed or timed out.  Keys with siblings
+ * are then fetched one at a time and merged with the default merge
+ * policy.  The vclock and etag are updated as if the keys had been
+ * fetched one at a time, in order, with ib_kvstore_get().
+ *
+ * @param[in] kvstore Key-value store.
+ * @param[in] keys Keys to fetch.
+ * @param[in] nkeys Number of keys.
+ * @param[out] values Array of @a nkeys values; each is set to a value to
+ *             be freed with ib_kvstore_free_value(), or NULL.
+ * @param[out] results Array of @a nkeys statuses: IB_OK, IB_ENOENT,
+ *             IB_ETIMEDOUT, IB_EALLOC or IB_EOTHER.
+ *
+ * @returns
+ *   - IB_OK if every key was fetched or found missing.
+ *   - IB_EOTHER if any key failed; see @a results.
+ */
+ib_status_t ib_kvstore_riak_get_multi(
+    ib_kvstore_t *kvstore,
+    const ib_kvstore_key_t *keys,
+    size_t nkeys,
+    ib_kvstore_value_t **values,
+    ib_status_t *results);
+
 /**
  * Set (not copy) vclock in @a kvstore.
  *
@@ -0,0 +1,77 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+#ifndef __IRONBEE__KVSTORE_SHM_H
+#define __IRONBEE__KVSTORE_SHM_H
+
+#include <ironbee/kvstore.h>
+#include <ironbee/types.h>
+
+/**
+ * @file
+ * @brief IronBee --- Key-Value Shared Memory Store Interface
+ */
+
+/**
+ * @addtogroup IronBeeKeyValueStore
+ * @ingroup IronBeeUtil
+ * @{
+ */
+
+/** Default size of a shared memory store (bytes). */
+#define IB_KVSTORE_SHM_DEFAULT_SIZE (16 * 1024 * 1024)
+
+/**
+ * Initializes a kvstore that keeps values in a memory mapped file.
+ *
+ * The file holds a fixed size hash table, so all processes and threads
+ * that connect to the same file share its contents; a store connected
+ * before a fork is shared with the child.  Putting the file on a memory
+ * file system (such as @c /dev/shm) avoids disk I/O entirely.
+ *
+ * The table is split into lock stripes, each with its own buckets,
+ * storage and least recently used list.  Each key holds one value; setting
+ * a key replaces its value.  Expired values are removed when they are
+ * found, and when a stripe is full its least recently used values are
+ * evicted.  An expiration of 0 means the value does not expire.
+ *
+ * The file is created and initialized by the first connect.  A file that
+ * was not completely initialized, or has a different layout, is replaced
+ * by a new file, discarding its contents.  The old file is not modified
+ * other than being marked stale, so processes still mapping it keep
+ * working and switch to the new file on their next operation.  If a
+ * process dies while holding a stripe's lock, the values in that stripe
+ * are discarded by the next process to take the lock (where robust
+ * mutexes are supported).
+ *
+ * @param[out] kvstore Initialized with kvserver and some defaults.
+ * @param[in] path Path of the file to map.
+ * @param[in] size Size of the file in bytes, used when it is created.
+ *
+ * @returns
+ *   - IB_OK on success
+ *   - IB_EALLOC on memory allocation failure using malloc.
+ */
+ib_status_t ib_kvstore_shm_init(
+    ib_kvstore_t *kvstore,
+    const char *path,
+    size_t size);
+
+ /**
+  * @}
+  */
+#endif /* __IRONBEE__KVSTORE_SHM_H */
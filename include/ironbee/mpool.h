@@ -350,6 +350,34 @@ void DLL_PUBLIC ib_mpool_release(
     ib_mpool_t *mp
 );
 
+/**
+ * Give a pool a page cache shared with its descendants.
+ *
+ * Descendants created afterwards with the same pagesize, malloc, and free
+ * functions as @a mp return their pages to the cache when destroyed or
+ * released, instead of freeing them, and take pages from the cache before
+ * calling malloc.  Short lived pools, such as transaction pools, then
+ * rarely call malloc or free.
+ *
+ * The cache is split by thread, each part holding at most @a max_pages
+ * pages; pages beyond that are freed.  It is destroyed, and its pages freed,
+ * with @a mp.  Usage statistics are included in ib_mpool_analyze().
+ *
+ * @param[in] mp        Memory pool to own the cache.
+ * @param[in] max_pages Maximum number of cached pages per thread.
+ *
+ * @returns
+ * - IB_OK     -- Success.
+ * - IB_EINVAL -- @a mp is NULL, @a max_pages is 0, or @a mp already uses a
+ *                page cache.
+ * - IB_EALLOC -- Allocation error.
+ * - Other     -- Locking failure, see ib_lock_init().
+ */
+ib_status_t DLL_PUBLIC ib_mpool_enable_page_cache(
+    ib_mpool_t *mp,
+    size_t      max_pages
+);
+
 /**
  * Register a function to be called when a memory pool is cleared or
  * destroyed.
@@ -443,6 +471,10 @@ char DLL_PUBLIC *ib_mpool_debug_report(const ib_mpool_t *mp);
  * - Cleanups         -- Overhead for cleanup functions.
  * - Total            -- Aggregate of all of the above.
  *
+ * For a pool with a page cache (ib_mpool_enable_page_cache()) the number of
+ * cached pages and the cache hits, misses, returns, and overflows are also
+ * reported.
+ *
  * @param[in] mp Memory pool to analyze.
  * @returns Usage report.
  */
@@ -28,6 +28,7 @@
 #include <ironbee/action.h>
 #include <ironbee/build.h>
 #include <ironbee/config.h>
+#include <ironbee/data.h>
 #include <ironbee/operator.h>
 #include <ironbee/rule_defs.h>
 #include <ironbee/types.h>
@@ -119,6 +120,8 @@ struct ib_rule_target_t {
     const char            *field_name;    /**< The field name */
     const char            *target_str;    /**< The target string */
     ib_list_t             *tfn_list;      /**< List of transformations */
+    ib_data_selector_t    *selector;      /**< Compiled @c field_name
+                                               (NULL: use field_name) */
 };
 
 /**
@@ -161,6 +164,15 @@ typedef struct {
     ib_rule_t             *previous;     /**< Previous rule parsed */
 } ib_rule_parser_data_t;
 
+/**
+ * Precompiled rule dispatch index for a single phase.
+ *
+ * Built when a context is closed; groups the phase's rules by the target
+ * fields that they read so that rules whose inputs are absent are never
+ * visited.  The structure is private to the rule engine.
+ */
+typedef struct ib_rule_dispatch_t ib_rule_dispatch_t;
+
 /**
  * Ruleset for a single phase.
  *  rule_list is a list of pointers to ib_rule_ctx_data_t objects.
@@ -169,6 +181,7 @@ typedef struct {
     ib_rule_phase_num_t         phase_num;   /**< Phase number */
     const ib_rule_phase_meta_t *phase_meta;  /**< Rule phase meta-data */
     ib_list_t                  *rule_list;   /**< Rules to execute in phase */
+    ib_rule_dispatch_t         *dispatch;    /**< Dispatch index (or NULL) */
 } ib_ruleset_phase_t;
 
 /**
@@ -229,6 +242,20 @@ struct ib_rule_exec_t {
 
     /* Stack of values for the FIELD* targets */
     ib_list_t              *value_stack; /**< Stack of values */
+
+    /* Data generations consumed by creating the FIELD* targets */
+    size_t                  field_gen;   /**< See ib_data_generation() */
+
+    /* Transformation results, shared by all rules of the transaction */
+    ib_hash_t              *tfn_cache;   /**< (field, tfns) -> result field */
+
+    /* Scratch buffer for in-place transformations */
+    uint8_t                *tfn_buf;     /**< Buffer */
+    size_t                  tfn_buf_size; /**< Size of @c tfn_buf */
+
+    /* Operator state of body stream rules */
+    ib_hash_t              *stream_states; /**< rule -> state */
+    bool                    txdata_stream; /**< Executing a body rule */
 };
 
 /**
@@ -700,6 +727,40 @@ ib_mpool_t DLL_PUBLIC *ib_rule_mpool(ib_engine_t *ib);
 bool ib_rule_should_capture(const ib_rule_exec_t *rule_exec,
                             ib_num_t result);
 
+/**
+ * Get the stream state of the executing rule's operator.
+ *
+ * Request and response body stream rules see the body one chunk at a time.
+ * Their operators keep their matching state (automaton state, partial match
+ * workspace, ...) here from a chunk to the next, so that a match split
+ * between chunks is found without buffering the body.
+ *
+ * The state is allocated zeroed from the transaction memory pool the first
+ * time the rule asks for it, and returned as is for later chunks, so
+ * operators should treat a zeroed state as "start of stream".  If
+ * @a cleanup is not NULL, it is called with the state when the transaction
+ * is destroyed.
+ *
+ * Phase rules and header stream rules have no stream state: each of their
+ * values stands alone.
+ *
+ * @param[in]  rule_exec Rule execution object
+ * @param[in]  size      Size of the state
+ * @param[in]  cleanup   Called with the state at the end of the transaction
+ *                       (or NULL)
+ * @param[out] state     The state
+ *
+ * @returns
+ *   - IB_OK on success
+ *   - IB_ENOENT if not executing a body stream rule
+ *   - IB_EALLOC on allocation failure
+ */
+ib_status_t DLL_PUBLIC ib_rule_exec_stream_state(
+    const ib_rule_exec_t  *rule_exec,
+    size_t                 size,
+    ib_mpool_cleanup_fn_t  cleanup,
+    void                 **state);
+
 
 /**
  * Perform logging of a rule's execution
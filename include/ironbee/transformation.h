@@ -61,6 +61,33 @@ typedef ib_status_t (*ib_tfn_fn_t)(ib_engine_t *ib,
                                    ib_field_t **data_out,
                                    ib_flags_t *pflags);
 
+/**
+ * In-place transformation function.
+ *
+ * Transforms the string @a data_in, which is owned by the caller and may
+ * be modified.  The output must lie within the input buffer and must not
+ * be longer than the input.
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] pool Memory pool to use for allocations
+ * @param[in] fndata Transformation function data (config)
+ * @param[in,out] data_in Input data
+ * @param[in] dlen_in Length of @a data_in
+ * @param[out] data_out Output data (within @a data_in)
+ * @param[out] dlen_out Length of @a data_out
+ * @param[out] pflags Address of flags set by transformation
+ *
+ * @returns Status code
+ */
+typedef ib_status_t (*ib_tfn_inplace_fn_t)(ib_engine_t *ib,
+                                           ib_mpool_t *pool,
+                                           void *fndata,
+                                           uint8_t *data_in,
+                                           size_t dlen_in,
+                                           uint8_t **data_out,
+                                           size_t *dlen_out,
+                                           ib_flags_t *pflags);
+
 /** @cond Internal */
 
 /* Transformation flags */
@@ -73,6 +100,7 @@ typedef ib_status_t (*ib_tfn_fn_t)(ib_engine_t *ib,
 struct ib_tfn_t {
     const char         *name;              /**< Tfn name */
     ib_tfn_fn_t         fn_execute;        /**< Tfn execute function */
+    ib_tfn_inplace_fn_t fn_inplace;        /**< In-place function or NULL */
     ib_flags_t          tfn_flags;         /**< Tfn flags */
     void               *fndata;            /**< Tfn function data */
 };
@@ -109,6 +137,30 @@ ib_status_t DLL_PUBLIC ib_tfn_register(ib_engine_t *ib,
                                        ib_flags_t flags,
                                        void *fndata);
 
+/**
+ * Create and register a new transformation that can also transform
+ * strings in-place.
+ *
+ * The rule engine uses @a fn_inplace to run chains of such
+ * transformations on a single buffer, only creating a field for the
+ * final value.  Both functions must produce the same result.
+ *
+ * @param ib Engine handle
+ * @param name Transformation name
+ * @param fn_execute Transformation execute function
+ * @param fn_inplace Transformation in-place function
+ * @param flags Transformation flags
+ * @param fndata Transformation function data
+ *
+ * @returns Status code
+ */
+ib_status_t DLL_PUBLIC ib_tfn_register_inplace(ib_engine_t *ib,
+                                               const char *name,
+                                               ib_tfn_fn_t fn_execute,
+                                               ib_tfn_inplace_fn_t fn_inplace,
+                                               ib_flags_t flags,
+                                               void *fndata);
+
 /**
  * Lookup a transformation by name (extended version).
  *
@@ -161,6 +213,30 @@ ib_status_t DLL_PUBLIC ib_tfn_transform(ib_engine_t *ib,
                                         ib_field_t **fout,
                                         ib_flags_t *pflags);
 
+/**
+ * Transform a string in-place.
+ *
+ * @param ib IronBee Engine object
+ * @param mp Pool to use if memory needs to be allocated
+ * @param tfn Transformation
+ * @param data_in Input data; may be modified
+ * @param dlen_in Length of @a data_in
+ * @param data_out Address of output data (within @a data_in)
+ * @param dlen_out Address of length of @a data_out
+ * @param pflags Address of flags set by transformation
+ *
+ * @returns Status code
+ *   - IB_ENOTIMPL if @a tfn can't transform in-place
+ */
+ib_status_t DLL_PUBLIC ib_tfn_transform_inplace(ib_engine_t *ib,
+                                                ib_mpool_t *mp,
+                                                const ib_tfn_t *tfn,
+                                                uint8_t *data_in,
+                                                size_t dlen_in,
+                                                uint8_t **data_out,
+                                                size_t *dlen_out,
+                                                ib_flags_t *pflags);
+
 /**
  * Get a data field with a transformation (extended version).
  *
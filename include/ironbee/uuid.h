@@ -86,6 +86,9 @@ ib_status_t DLL_PUBLIC ib_uuid_ascii_to_bin(
 /**
  * Outputs a UUID to a string.
  *
+ * The UUID is written in lower case, as xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx.
+ * This function takes no lock.
+ *
  * @param str Pointer to already allocated buffer to hold string (37 bytes)
  * @param uuid UUID to write to @a str.
  *
@@ -99,6 +102,10 @@ ib_status_t DLL_PUBLIC ib_uuid_bin_to_ascii(
 /**
  * Creates a new, random, v4 uuid.
  *
+ * Each thread has its own generator, a ChaCha20 keystream seeded from
+ * /dev/urandom on first use and again after a fork, so this function
+ * takes no lock and makes no system call once seeded.
+ *
  * @param uuid Pointer to allocated ib_uuid_t to store result in.
  *
  * @returns Status code
@@ -161,6 +161,29 @@ void htp_txh_state_request_line(htp_tx_t *tx);
  */
 void htp_txh_req_set_header_c(htp_tx_t *tx, const char *name, const char *value, enum alloc_strategy alloc);
 
+/**
+ * Add one request header to a transaction whose request line was parsed
+ * by its connection parser, with the same result as the connection parser
+ * parsing a "name: value" header line: the header is added to the request
+ * header table (combined with any earlier header of the same name) and to
+ * the raw header lines. Data is always copied. This lets a container that
+ * has already parsed the headers skip serializing them for the parser.
+ *
+ * The connection parser must be waiting for the next request header line;
+ * otherwise (for example, after header data was fed to the parser and a
+ * folded continuation line is still possible) the header is declined, and
+ * should be fed to the parser as data instead.
+ *
+ * @param[in] tx
+ * @param[in] name
+ * @param[in] name_len
+ * @param[in] value
+ * @param[in] value_len
+ * @return HTP_OK on success, HTP_DECLINED if the header should be parsed
+ *         as data instead, or HTP_ERROR on memory allocation failure.
+ */
+int htp_txh_req_add_header(htp_tx_t *tx, const char *name, size_t name_len, const char *value, size_t value_len);
+
 /**
  * Removes all request headers associated with this transaction. This
  * function is needed because in some cases the container does not
@@ -277,6 +300,20 @@ void htp_txh_state_response_line(htp_tx_t *tx);
  */
 void htp_txh_res_set_header_c(htp_tx_t *tx, const char *name, const char *value, enum alloc_strategy alloc);
 
+/**
+ * Add one response header to a transaction whose response line was parsed
+ * by its connection parser. See htp_txh_req_add_header().
+ *
+ * @param[in] tx
+ * @param[in] name
+ * @param[in] name_len
+ * @param[in] value
+ * @param[in] value_len
+ * @return HTP_OK on success, HTP_DECLINED if the header should be parsed
+ *         as data instead, or HTP_ERROR on memory allocation failure.
+ */
+int htp_txh_res_add_header(htp_tx_t *tx, const char *name, size_t name_len, const char *value, size_t value_len);
+
 /**
  * Removes all response headers associated with this transaction. This
  * function is needed because in some cases the container does not
@@ -69,3 +69,164 @@ int htp_txh_state_transaction_start(htp_tx_t *tx) {
 
     return HTP_OK;
 }
+
+/**
+ * Adds one header, as parsed from a "name: value" header line.
+ *
+ * @param[in] headers Header table
+ * @param[in] lines Raw header lines
+ * @param[in] name
+ * @param[in] name_len
+ * @param[in] value
+ * @param[in] value_len
+ * @return HTP_OK or HTP_ERROR
+ */
+static int htp_txh_add_header(table_t *headers, list_t *lines,
+    const char *name, size_t name_len, const char *value, size_t value_len) {
+    // Trim the value, as the header parsers do
+    while ((value_len > 0) && (htp_is_lws(value[0]))) {
+        value++;
+        value_len--;
+    }
+
+    while ((value_len > 0) && (htp_is_lws(value[value_len - 1]))) {
+        value_len--;
+    }
+
+    // Keep the raw header line, so that the raw headers can be reconstructed
+    htp_header_line_t *hl = calloc(1, sizeof (htp_header_line_t));
+    if (hl == NULL) return HTP_ERROR;
+
+    hl->first_nul_offset = -1;
+    hl->line = bstr_alloc(name_len + 2 + value_len + 2);
+    if (hl->line == NULL) {
+        free(hl);
+        return HTP_ERROR;
+    }
+
+    bstr_add_mem_noex(hl->line, name, name_len);
+    bstr_add_mem_noex(hl->line, ": ", 2);
+    bstr_add_mem_noex(hl->line, value, value_len);
+    bstr_add_mem_noex(hl->line, "\r\n", 2);
+    hl->name_offset = 0;
+    hl->name_len = name_len;
+    hl->value_offset = name_len + 2;
+    hl->value_len = value_len;
+
+    // Create the header
+    htp_header_t *h = calloc(1, sizeof (htp_header_t));
+    if (h == NULL) {
+        bstr_free(&hl->line);
+        free(hl);
+        return HTP_ERROR;
+    }
+
+    h->name = bstr_dup_mem(name, name_len);
+    h->value = bstr_dup_mem(value, value_len);
+    if ((h->name == NULL) || (h->value == NULL)) {
+        bstr_free(&h->name);
+        bstr_free(&h->value);
+        free(h);
+        bstr_free(&hl->line);
+        free(hl);
+        return HTP_ERROR;
+    }
+
+    // Do we already have a header with the same name?
+    htp_header_t *h_existing = table_get(headers, h->name);
+    if (h_existing != NULL) {
+        // Add to existing header
+        bstr *new_value = bstr_expand(h_existing->value, bstr_len(h_existing->value)
+            + 2 + bstr_len(h->value));
+        if (new_value == NULL) {
+            bstr_free(&h->name);
+            bstr_free(&h->value);
+            free(h);
+            bstr_free(&hl->line);
+            free(hl);
+            return HTP_ERROR;
+        }
+
+        h_existing->value = new_value;
+        bstr_add_mem_noex(h_existing->value, ", ", 2);
+        bstr_add_noex(h_existing->value, h->value);
+
+        // The header fields are no longer needed
+        bstr_free(&h->name);
+        bstr_free(&h->value);
+        free(h);
+
+        // Keep track of same-name headers
+        h_existing->flags |= HTP_FIELD_REPEATED;
+        hl->header = h_existing;
+    } else {
+        // Add as a new header
+        if (table_add(headers, h->name, h) != 1) {
+            bstr_free(&h->name);
+            bstr_free(&h->value);
+            free(h);
+            bstr_free(&hl->line);
+            free(hl);
+            return HTP_ERROR;
+        }
+
+        hl->header = h;
+    }
+
+    if (list_add(lines, hl) != 1) {
+        // The header itself is now owned by the table
+        bstr_free(&hl->line);
+        free(hl);
+        return HTP_ERROR;
+    }
+
+    return HTP_OK;
+}
+
+int htp_txh_req_add_header(htp_tx_t *tx, const char *name, size_t name_len, const char *value, size_t value_len) {
+    htp_connp_t *connp = tx->connp;
+
+    // The parser must be waiting for a new header line, with
+    // no header waiting to be processed
+    if ((connp == NULL) || (connp->in_tx != tx)
+        || (connp->in_state != htp_connp_REQ_HEADERS)
+        || (connp->in_line_len != 0) || (connp->in_header_line != NULL)
+        || (connp->in_header_line_index != -1) || (name_len == 0))
+    {
+        return HTP_DECLINED;
+    }
+
+    if (htp_txh_add_header(tx->request_headers, tx->request_header_lines,
+        name, name_len, value, value_len) != HTP_OK)
+    {
+        return HTP_ERROR;
+    }
+
+    connp->in_header_line_counter++;
+
+    return HTP_OK;
+}
+
+int htp_txh_res_add_header(htp_tx_t *tx, const char *name, size_t name_len, const char *value, size_t value_len) {
+    htp_connp_t *connp = tx->connp;
+
+    // The parser must be waiting for a new header line, with
+    // no header waiting to be processed
+    if ((connp == NULL) || (connp->out_tx != tx)
+        || (connp->out_state != htp_connp_RES_HEADERS)
+        || (connp->out_line_len != 0) || (connp->out_header_line != NULL)
+        || (connp->out_header_line_index != -1) || (name_len == 0))
+    {
+        return HTP_DECLINED;
+    }
+
+    if (htp_txh_add_header(tx->response_headers, tx->response_header_lines,
+        name, name_len, value, value_len) != HTP_OK)
+    {
+        return HTP_ERROR;
+    }
+
+    connp->out_header_line_counter++;
+
+    return HTP_OK;
+}
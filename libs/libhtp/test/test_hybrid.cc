@@ -0,0 +1,206 @@
+/***************************************************************************
+ * Copyright (c) 2011-2012, Qualys, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Qualys, Inc. nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ***************************************************************************/
+
+/**
+ * @file
+ * @brief Tests for adding parsed headers to a transaction directly.
+ */
+
+#include <cstring>
+
+#include <gtest/gtest.h>
+
+#include <htp/htp.h>
+#include <htp/htp_hybrid.h>
+
+class HybridHeaderTest : public testing::Test {
+
+protected:
+
+    virtual void SetUp() {
+        cfg = htp_config_create();
+        htp_config_set_server_personality(cfg, HTP_SERVER_APACHE_2_2);
+
+        data_connp = open();
+        direct_connp = open();
+    }
+
+    virtual void TearDown() {
+        htp_connp_destroy_all(data_connp);
+        htp_connp_destroy_all(direct_connp);
+        htp_config_destroy(cfg);
+    }
+
+    htp_connp_t *open() {
+        htp_connp_t *connp = htp_connp_create(cfg);
+        htp_connp_open(connp, "127.0.0.1", 10000, "127.0.0.1", 80, NULL);
+        return connp;
+    }
+
+    static int req(htp_connp_t *connp, const char *data) {
+        return htp_connp_req_data(connp, NULL,
+            (unsigned char *)data, strlen(data));
+    }
+
+    static int res(htp_connp_t *connp, const char *data) {
+        return htp_connp_res_data(connp, NULL,
+            (unsigned char *)data, strlen(data));
+    }
+
+    static int req_add(htp_connp_t *connp, const char *name, const char *value) {
+        return htp_txh_req_add_header(connp->in_tx,
+            name, strlen(name), value, strlen(value));
+    }
+
+    static int res_add(htp_connp_t *connp, const char *name, const char *value) {
+        return htp_txh_res_add_header(connp->out_tx,
+            name, strlen(name), value, strlen(value));
+    }
+
+    static htp_tx_t *first_tx(htp_connp_t *connp) {
+        return (htp_tx_t *)list_get(connp->conn->transactions, 0);
+    }
+
+    static void expect_same_headers(table_t *expected, table_t *actual) {
+        ASSERT_EQ(table_size(expected), table_size(actual));
+
+        bstr *key = NULL;
+        htp_header_t *h = NULL;
+        table_iterator_reset(expected);
+        while ((key = table_iterator_next(expected, (void **) & h)) != NULL) {
+            htp_header_t *other = (htp_header_t *)table_get(actual, key);
+            ASSERT_TRUE(other != NULL);
+            EXPECT_EQ(0, bstr_cmp(h->name, other->name));
+            EXPECT_EQ(0, bstr_cmp(h->value, other->value));
+            EXPECT_EQ(h->flags, other->flags);
+        }
+    }
+
+    htp_cfg_t *cfg;
+
+    htp_connp_t *data_connp;
+
+    htp_connp_t *direct_connp;
+};
+
+TEST_F(HybridHeaderTest, RequestHeaders) {
+    req(data_connp,
+        "GET /x HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "Accept: text/html\r\n"
+        "Cookie: a=1\r\n"
+        "Cookie: b=2\r\n"
+        "\r\n");
+
+    req(direct_connp, "GET /x HTTP/1.1\r\n");
+    ASSERT_TRUE(direct_connp->in_tx != NULL);
+    ASSERT_EQ(HTP_OK, req_add(direct_connp, "Host", "www.example.com"));
+    ASSERT_EQ(HTP_OK, req_add(direct_connp, "Accept", " text/html "));
+    ASSERT_EQ(HTP_OK, req_add(direct_connp, "Cookie", "a=1"));
+    ASSERT_EQ(HTP_OK, req_add(direct_connp, "Cookie", "b=2"));
+    req(direct_connp, "\r\n");
+
+    htp_tx_t *expected = first_tx(data_connp);
+    htp_tx_t *actual = first_tx(direct_connp);
+    ASSERT_TRUE(expected != NULL);
+    ASSERT_TRUE(actual != NULL);
+
+    expect_same_headers(expected->request_headers, actual->request_headers);
+
+    htp_header_t *cookie = (htp_header_t *)table_get_c(actual->request_headers, "cookie");
+    ASSERT_TRUE(cookie != NULL);
+    EXPECT_EQ(0, bstr_cmp_c(cookie->value, "a=1, b=2"));
+    EXPECT_TRUE(cookie->flags & HTP_FIELD_REPEATED);
+
+    bstr *expected_raw = htp_tx_get_request_headers_raw(expected);
+    bstr *actual_raw = htp_tx_get_request_headers_raw(actual);
+    ASSERT_TRUE(expected_raw != NULL);
+    ASSERT_TRUE(actual_raw != NULL);
+    EXPECT_EQ(0, bstr_cmp(expected_raw, actual_raw));
+
+    // Headers are processed as usual once the terminator line arrives
+    ASSERT_TRUE(actual->parsed_uri->hostname != NULL);
+    EXPECT_EQ(0, bstr_cmp_c(actual->parsed_uri->hostname, "www.example.com"));
+    EXPECT_GE(actual->progress, TX_PROGRESS_REQ_HEADERS);
+}
+
+TEST_F(HybridHeaderTest, RequestHeaderDeclined) {
+    // No request line yet
+    req(direct_connp, "GET /x HT");
+    ASSERT_TRUE(direct_connp->in_tx != NULL);
+    EXPECT_EQ(HTP_DECLINED, req_add(direct_connp, "Host", "www.example.com"));
+
+    // A header line that may still be folded
+    req(direct_connp, "TP/1.1\r\nHost: www.example.com\r\n");
+    EXPECT_EQ(HTP_DECLINED, req_add(direct_connp, "Accept", "*/*"));
+
+    req(direct_connp, " folded\r\n\r\n");
+    htp_tx_t *tx = first_tx(direct_connp);
+    ASSERT_TRUE(tx != NULL);
+    EXPECT_EQ(1UL, table_size(tx->request_headers));
+
+    htp_header_t *h = (htp_header_t *)table_get_c(tx->request_headers, "host");
+    ASSERT_TRUE(h != NULL);
+    EXPECT_EQ(0, bstr_cmp_c(h->value, "www.example.com folded"));
+}
+
+TEST_F(HybridHeaderTest, ResponseHeaders) {
+    const char *request =
+        "GET / HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "\r\n";
+    req(data_connp, request);
+    req(direct_connp, request);
+
+    res(data_connp,
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/html\r\n"
+        "Content-Length: 5\r\n"
+        "\r\n"
+        "Hello");
+
+    res(direct_connp, "HTTP/1.1 200 OK\r\n");
+    ASSERT_TRUE(direct_connp->out_tx != NULL);
+    ASSERT_EQ(HTP_OK, res_add(direct_connp, "Content-Type", "text/html"));
+    ASSERT_EQ(HTP_OK, res_add(direct_connp, "Content-Length", "5"));
+    res(direct_connp, "\r\nHello");
+
+    htp_tx_t *expected = first_tx(data_connp);
+    htp_tx_t *actual = first_tx(direct_connp);
+    ASSERT_TRUE(expected != NULL);
+    ASSERT_TRUE(actual != NULL);
+
+    expect_same_headers(expected->response_headers, actual->response_headers);
+
+    // The body is framed by the directly added Content-Length
+    EXPECT_EQ(expected->response_message_len, actual->response_message_len);
+    EXPECT_EQ(expected->progress, actual->progress);
+    EXPECT_EQ(TX_PROGRESS_DONE, actual->progress);
+}
@@ -38,6 +38,19 @@ M._COPYRIGHT = "Copyright (C) 2010-2013 Qualys, Inc."
 M._DESCRIPTION = "IronBee Lua Module Framework."
 M._VERSION = "1.0"
 
+-- Memory pool of this Lua VM, set by C on the VMs created after
+-- configuration. Actions and operators are allocated from it, as other
+-- threads may be using the engine's main pool. nil on the configuration VM.
+M.vm_mpool = nil
+
+-- Return the memory pool for actions and operators of this Lua VM.
+local vm_mpool = function(ib_engine)
+    if M.vm_mpool ~= nil then
+        return M.vm_mpool
+    end
+    return ffi.C.ib_engine_pool_main_get(ib_engine)
+end
+
 -- Table of loaded lua modules objects.
 -- These are stored by lua module index after the lua module
 -- is registered with the ib_engine.
@@ -180,7 +193,7 @@ moduleapi.action = function(self, name, param, flags)
     local inst = ffi.new('ib_action_inst_t*[1]')
     local rc = ffi.C.ib_module_action_inst_create(
         self.ib_module,
-        ffi.C.ib_engine_pool_main_get(self.ib_engine),
+        vm_mpool(self.ib_engine),
         name,
         param,
         flags,
@@ -216,7 +229,7 @@ moduleapi.operator = function(self, name, param, flags)
     local inst = ffi.new('ib_operator_inst_t*[1]')
     local rc = ffi.C.ib_module_operator_inst_create(
         self.ib_module,
-        ffi.C.ib_engine_pool_main_get(self.ib_engine),
+        vm_mpool(self.ib_engine),
         name,
         param,
         flags,
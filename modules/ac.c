@@ -81,162 +81,6 @@ struct modac_provider_data_t {
 /* Instantiate a module global configuration. */
 typedef struct modac_provider_data_t modac_provider_data_t;
 
-/**
- * Workspace data stored per rule per transaction in tx.
- *
- * This is not directly stored in tx but in an ib_hash_t that is
- * stored in tx.
- */
-struct modac_workspace_t {
-    ib_ac_context_t *ctx; /**< Context. */
-};
-typedef struct modac_workspace_t modac_workspace_t;
-
-/* -- Helper Internal Functions -- */
-
-/**
- * Get or create an ib_hash_t inside tx for storing tx rule data.
- *
- * @param[in] tx The transaction containing the data which holds
- *            the @a rule_data object.
- * @param[out] rule_data The fetched or created rule data hash. This is set
- *             to NULL on failure.
- *
- * @return
- *   - IB_OK on success.
- *   - IB_EALLOC on allocation failure
- */
-static ib_status_t get_or_create_rule_data_hash(ib_tx_t *tx,
-                                                ib_hash_t **rule_data)
-{
-    assert(tx);
-    assert(tx->mp);
-
-    ib_status_t rc;
-
-    /* Get or create the hash that contains the rule data. */
-    rc = ib_tx_get_module_data(tx, IB_MODULE_STRUCT_PTR, (void **)rule_data);
-
-    if (rc == IB_OK && *rule_data != NULL) {
-        ib_log_debug2_tx(tx, "Found rule data hash in tx.");
-        return IB_OK;
-    }
-
-    ib_log_debug2_tx(tx, "Rule data hash did not exist in tx.");
-    ib_log_debug2_tx(tx, "Creating rule data hash.");
-
-    rc = ib_hash_create(rule_data, tx->mp);
-    if (rc != IB_OK) {
-        ib_log_debug2_tx(tx,
-                         "Failed to create hash: %d", rc);
-        return rc;
-    }
-
-    rc = ib_tx_set_module_data(tx, IB_MODULE_STRUCT_PTR, *rule_data);
-    if (rc != IB_OK) {
-        ib_log_debug2_tx(tx,
-                         "Failed to store hash: %d", rc);
-        *rule_data = NULL;
-    }
-
-    ib_log_debug2_tx(tx,
-                     "Returning rule hash at %p.",
-                     *rule_data);
-
-    return rc;
-
-}
-
-/**
- * Create the per-transaction data for use with the dfa operator.
- *
- * @param[in,out] tx Transaction to store the value in.
- * @param[in] ac The Ahocorasic engine object.
- * @param[in] id The operator identifier used to get it's workspace.
- * @param[out] workspace Created.
- *
- * @returns
- *   - IB_OK on success.
- *   - IB_EALLOC on an allocation error.
- */
-static ib_status_t alloc_ac_tx_data(ib_tx_t *tx,
-                                    ib_ac_t *ac,
-                                    const char *id,
-                                    modac_workspace_t **workspace)
-{
-    assert(tx);
-    assert(tx->mp);
-    assert(id);
-    assert(workspace);
-
-    ib_hash_t *rule_data;
-    ib_status_t rc;
-
-    rc = get_or_create_rule_data_hash(tx, &rule_data);
-    if (rc != IB_OK) {
-        return rc;
-    }
-
-    *workspace = (modac_workspace_t *)ib_mpool_alloc(tx->mp,
-                                                     sizeof(**workspace));
-
-    if (*workspace == NULL) {
-        return IB_EALLOC;
-    }
-
-    (*workspace)->ctx =
-        (ib_ac_context_t *)ib_mpool_alloc(tx->mp, sizeof(*(*workspace)->ctx));
-    if ((*workspace)->ctx == NULL) {
-        return IB_EALLOC;
-    }
-
-    ib_ac_init_ctx((*workspace)->ctx, ac);
-
-    rc = ib_hash_set(rule_data, id, *workspace);
-    if (rc != IB_OK) {
-        *workspace = NULL;
-    }
-
-    return rc;
-}
-
-/**
- * Return the per-transaction data for use with the dfa operator.
- *
- * @param[in,out] tx Transaction to store the value in.
- * @param[in] id The operator identifier used to get it's workspace.
- * @param[out] workspace Retrieved.
- *
- * @returns
- *   - IB_OK on success.
- *   - IB_ENOENT if the structure does not exist. Call alloc_ac_tx_data then.
- *   - IB_EALLOC on an allocation error.
- */
-static ib_status_t get_dfa_tx_data(ib_tx_t *tx,
-                                   const char *id,
-                                   modac_workspace_t **workspace)
-{
-    assert(tx);
-    assert(tx->mp);
-    assert(id);
-    assert(workspace);
-
-    ib_hash_t *rule_data;
-    ib_status_t rc;
-
-    rc = get_or_create_rule_data_hash(tx, &rule_data);
-    if (rc != IB_OK) {
-        return rc;
-    }
-
-    rc = ib_hash_get(rule_data, workspace, id);
-    if (rc != IB_OK) {
-        *workspace = NULL;
-    }
-
-    return rc;
-}
-
 /* -- Matcher Interface -- */
 
 /**
@@ -679,54 +523,53 @@ static ib_status_t pm_operator_create(ib_engine_t *ib,
     return IB_OK;
 }
 
-static ib_status_t initialize_ac_ctx(ib_tx_t *tx,
+/**
+ * Get the matching context of a pm operator execution.
+ *
+ * Body stream rules keep their context from a chunk to the next, so that a
+ * pattern split between chunks is found.  Other rules use a new context for
+ * every value.
+ *
+ * @param[in]  rule_exec Rule execution object.
+ * @param[in]  ac        Aho-Corasick automaton.
+ * @param[out] ac_ctx    Matching context.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on allocation failure.
+ */
+static ib_status_t initialize_ac_ctx(const ib_rule_exec_t *rule_exec,
                                      ib_ac_t *ac,
-                                     const ib_rule_t *rule,
                                      ib_ac_context_t **ac_ctx)
 {
-    assert(tx);
+    assert(rule_exec);
     assert(ac);
     assert(ac_ctx);
-    assert(rule);
 
+    ib_tx_t *tx = rule_exec->tx;
     ib_status_t rc;
 
-    /* Stream rules maintain state across calls.
-     * If a rule is a stream rule, try to fetch the rule context data. */
-    if (ib_rule_is_stream(rule)) {
-        modac_workspace_t *workspace = NULL;
-
-        ib_log_debug_tx(tx, "Fetching stream rule data.");
-
-        rc = get_dfa_tx_data(tx, ib_rule_id(rule), &workspace);
-
-        if ( (rc == IB_ENOENT) || (workspace == NULL) ) {
-            rc = alloc_ac_tx_data(tx, ac, ib_rule_id(rule), &workspace);
-            if (rc != IB_OK) {
-                ib_log_error_tx(tx,
-                                "Unexpected error creating tx data: %d",
-                                rc);
-                return rc;
-            }
-        }
-        else if (rc != IB_OK) {
-            ib_log_error_tx(tx, "Unexpected error retrieving tx data: %d", rc);
-            return rc;
+    rc = ib_rule_exec_stream_state(rule_exec, sizeof(**ac_ctx), NULL,
+                                   (void **)ac_ctx);
+    if (rc == IB_OK) {
+        /* A zeroed context is the start of the stream. */
+        if ((*ac_ctx)->ac_tree == NULL) {
+            ib_ac_init_ctx(*ac_ctx, ac);
         }
-
-        *ac_ctx = workspace->ctx;
+        return IB_OK;
+    }
+    else if (rc != IB_ENOENT) {
+        return rc;
     }
 
     /* Create a new context for every operator call. */
-    else {
-        *ac_ctx = (ib_ac_context_t *)ib_mpool_alloc(tx->mp, sizeof(**ac_ctx));
-        if (*ac_ctx == NULL) {
-            return IB_EALLOC;
-        }
-
-        ib_ac_init_ctx(*ac_ctx, ac);
+    *ac_ctx = (ib_ac_context_t *)ib_mpool_alloc(tx->mp, sizeof(**ac_ctx));
+    if (*ac_ctx == NULL) {
+        return IB_EALLOC;
     }
 
+    ib_ac_init_ctx(*ac_ctx, ac);
+
     return IB_OK;
 }
 
@@ -747,6 +590,7 @@ static ib_status_t pm_operator_execute(const ib_rule_exec_t *rule_exec,
     const char* subject;
     size_t subject_len;
     const ib_bytestr_t* bytestr;
+    size_t match_cnt;
 
     if (field->type == IB_FTYPE_NULSTR) {
         rc = ib_field_value(field, ib_ftype_nulstr_out(&subject));
@@ -769,12 +613,15 @@ static ib_status_t pm_operator_execute(const ib_rule_exec_t *rule_exec,
         return IB_EALLOC;
     }
 
-    rc = initialize_ac_ctx(tx, ac, rule_exec->rule, &ac_ctx);
+    rc = initialize_ac_ctx(rule_exec, ac, &ac_ctx);
     if (rc != IB_OK) {
         ib_log_error_tx(tx, "Cannot initialize AhoCorasic context: %d", rc);
         return rc;
     }
 
+    /* Only report matches ending in this value: a stream context still
+     * counts the matches of earlier chunks. */
+    match_cnt = ac_ctx->match_cnt;
     rc = ib_ac_consume(ac_ctx, subject, subject_len, 0, tx->mp);
 
     if (rc == IB_ENOENT) {
@@ -782,7 +629,7 @@ static ib_status_t pm_operator_execute(const ib_rule_exec_t *rule_exec,
         return IB_OK;
     }
     else if (rc == IB_OK) {
-        *result = (ac_ctx->match_cnt > 0) ? 1 : 0;
+        *result = (ac_ctx->match_cnt > match_cnt) ? 1 : 0;
 
         if (ib_rule_should_capture(rule_exec, *result)) {
             ib_field_t *f;
@@ -47,6 +47,25 @@ IB_MODULE_DECLARE();
 /* Global hash to store patterns */
 static ib_hash_t *g_eudoxus_pattern_hash = NULL;
 
+/**
+ * Callback data of ee_first_match_callback().
+ */
+typedef struct {
+    const ib_rule_exec_t *rule_exec; /**< Rule being executed */
+    const uint8_t        *input;     /**< Start of the current input */
+} ee_callback_data_t;
+
+/**
+ * Stream state of the @c ee_match_any operator in body stream rules.
+ *
+ * The automata state is kept from a chunk to the next, so that a match
+ * split between chunks is found.  It is started again after a match.
+ */
+typedef struct {
+    ia_eudoxus_state_t   *state;    /**< Automata state (or NULL) */
+    ee_callback_data_t    cbdata;   /**< Callback data of @c state */
+} ee_stream_state_t;
+
 /**
  * Load a eudoxus pattern so it can be used in rules.
  *
@@ -102,7 +121,10 @@ static ib_status_t load_eudoxus_pattern_param2(ib_cfgparser_t *cp,
         return IB_EINVAL;
     }
 
-    ia_rc = ia_eudoxus_create_from_path(&eudoxus, automata_file);
+    /* Map the automata rather than reading it in so that all worker
+     * processes share one copy of it. */
+    ia_rc = ia_eudoxus_create_from_path_mapped(&eudoxus, automata_file,
+                                               IA_EUDOXUS_MAP_WILLNEED);
     if (ia_rc != IA_EUDOXUS_OK) {
         ib_log_error(cp->ib,
                      MODULE_NAME_STR ": Error loading eudoxus automata file[%d]: %s.",
@@ -142,9 +164,9 @@ static IB_DIRMAP_INIT_STRUCTURE(eudoxus_directive_map) = {
  * @param[in] output_length Length of output.
  * @param[in] input Current location in the input (first character
  *                  after the match).
- * @param[in,out] cbdata Pointer to the ib_rule_exec_t instance we are
- *                       handling. This is needed for handling capture
- *                       of the match.
+ * @param[in,out] cbdata Pointer to the ee_callback_data_t of the rule
+ *                       execution we are handling. This is needed for
+ *                       handling capture of the match.
  */
 static ia_eudoxus_command_t ee_first_match_callback(const ia_eudoxus_t* engine,
                                                     const char *output,
@@ -154,7 +176,8 @@ static ia_eudoxus_command_t ee_first_match_callback(const ia_eudoxus_t* engine,
 {
     ib_status_t rc;
     uint32_t match_len;
-    const ib_rule_exec_t *rule_exec = cbdata;
+    const ee_callback_data_t *ee_cbdata = cbdata;
+    const ib_rule_exec_t *rule_exec = ee_cbdata->rule_exec;
     ib_tx_t *tx = rule_exec->tx;
     ib_bytestr_t *bs;
     ib_field_t *field;
@@ -170,6 +193,11 @@ static ia_eudoxus_command_t ee_first_match_callback(const ia_eudoxus_t* engine,
             return IA_EUDOXUS_CMD_ERROR;
         }
         match_len = *(uint32_t *)(output);
+        /* A match started in an earlier chunk of a stream is captured from
+         * the start of this one. */
+        if (match_len > (size_t)(input - ee_cbdata->input)) {
+            match_len = (uint32_t)(input - ee_cbdata->input);
+        }
         rc = ib_capture_clear(tx);
         if (rc != IB_OK) {
             ib_log_error_tx(tx, "Error clearing captures: %s",
@@ -199,6 +227,21 @@ static ia_eudoxus_command_t ee_first_match_callback(const ia_eudoxus_t* engine,
     return IA_EUDOXUS_CMD_STOP;
 }
 
+/**
+ * Destroy the automata state of a stream.
+ *
+ * @param[in] data Stream state (ee_stream_state_t).
+ */
+static void ee_stream_state_cleanup(void *data)
+{
+    ee_stream_state_t *stream = (ee_stream_state_t *)data;
+
+    if (stream->state != NULL) {
+        ia_eudoxus_destroy_state(stream->state);
+        stream->state = NULL;
+    }
+}
+
 /**
  * Create an instance of the @c ee_match_any operator.
  *
@@ -251,6 +294,9 @@ static ib_status_t ee_match_any_operator_create(ib_engine_t *ib,
  *
  * At first match the operator will stop searching and return true.
  *
+ * In body stream rules, the search continues from a chunk to the next until
+ * a match, then starts again.
+ *
  * The capture option is supported; the matched pattern will be placed in the
  * capture variable if a match occurs.
  *
@@ -272,6 +318,9 @@ static ib_status_t ee_match_any_operator_execute(
     ia_eudoxus_result_t ia_rc;
     ia_eudoxus_t* eudoxus = data;
     ia_eudoxus_state_t* state;
+    ee_stream_state_t *stream;
+    ee_callback_data_t local_cbdata;
+    ee_callback_data_t *cbdata;
     const char *input;
     size_t input_len;
 
@@ -303,10 +352,32 @@ static ib_status_t ee_match_any_operator_execute(
         return IB_EINVAL;
     }
 
-    ia_rc = ia_eudoxus_create_state(&state, eudoxus, ee_first_match_callback,
-                                    (void *)rule_exec);
-    if (ia_rc != IA_EUDOXUS_OK) {
-        return IB_EINVAL;
+    rc = ib_rule_exec_stream_state(rule_exec, sizeof(*stream),
+                                   ee_stream_state_cleanup,
+                                   (void **)&stream);
+    if (rc == IB_ENOENT) {
+        stream = NULL;
+        cbdata = &local_cbdata;
+    }
+    else if (rc != IB_OK) {
+        return rc;
+    }
+    else {
+        cbdata = &stream->cbdata;
+    }
+    cbdata->rule_exec = rule_exec;
+    cbdata->input = (const uint8_t *)input;
+
+    if (stream != NULL && stream->state != NULL) {
+        state = stream->state;
+    }
+    else {
+        ia_rc = ia_eudoxus_create_state(&state, eudoxus,
+                                        ee_first_match_callback,
+                                        (void *)cbdata);
+        if (ia_rc != IA_EUDOXUS_OK) {
+            return IB_EINVAL;
+        }
     }
     rc = IB_OK;
     ia_rc = ia_eudoxus_execute(state, (const uint8_t *)input, input_len);
@@ -317,7 +388,17 @@ static ib_status_t ee_match_any_operator_execute(
     else if (ia_rc == IA_EUDOXUS_ERROR) {
         rc = IB_EUNKNOWN;
     }
-    ia_eudoxus_destroy_state(state);
+
+    /* Keep the state for the next chunk unless the search is over. */
+    if (stream != NULL && ia_rc == IA_EUDOXUS_OK) {
+        stream->state = state;
+    }
+    else {
+        ia_eudoxus_destroy_state(state);
+        if (stream != NULL) {
+            stream->state = NULL;
+        }
+    }
 
     return rc;
 }
@@ -0,0 +1,434 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+/**
+ * @file
+ * @brief IronBee --- IP Trie operator Module
+ *
+ * This module adds the @c iptrie operator, which matches IP addresses
+ * against large network lists, e.g. IP reputation feeds.
+ *
+ * Lists are named and loaded with the LoadIPTrie directive:
+ *
+ * @code
+ * LoadIPTrie reputation /etc/ironbee/reputation.iptrie
+ * Rule REMOTE_ADDR @iptrie reputation id:rep/1 phase:REQUEST_HEADER block
+ * @endcode
+ *
+ * The file is either a list of networks (see ib_iptrie_builder_add_file())
+ * or a trie image written by ib_iptrie_write(), which is mapped so that
+ * all worker processes share one copy of it.
+ */
+
+#include <ironbee/bytestr.h>
+#include <ironbee/capture.h>
+#include <ironbee/hash.h>
+#include <ironbee/iptrie.h>
+#include <ironbee/module.h>
+#include <ironbee/operator.h>
+#include <ironbee/path.h>
+#include <ironbee/rule_engine.h>
+#include <ironbee/util.h>
+
+#include <assert.h>
+#include <string.h>
+
+/* Define the module name as well as a string version of it. */
+#define MODULE_NAME        iptrie
+#define MODULE_NAME_STR    IB_XSTRINGIFY(MODULE_NAME)
+
+/* Define the public module symbol. */
+IB_MODULE_DECLARE();
+
+/* Global hash to store tries */
+static ib_hash_t *g_iptrie_hash = NULL;
+
+/**
+ * Load an IP trie so it can be used in rules.
+ *
+ * If a relative path is given, it will be loaded relative to the current
+ * configuration file.
+ *
+ * @param[in] cp Configuration parser.
+ * @param[in] name Directive name.
+ * @param[in] trie_name Name to associate with the trie.
+ * @param[in] filename Filename to load.
+ * @param[in] cbdata Callback data (unused)
+ */
+static ib_status_t load_iptrie_param2(ib_cfgparser_t *cp,
+                                      const char *name,
+                                      const char *trie_name,
+                                      const char *filename,
+                                      void *cbdata)
+{
+    ib_status_t rc;
+    const char *trie_file;
+    ib_iptrie_t *trie;
+    ib_mpool_t *mp_tmp;
+    void *tmp;
+
+    assert(cp != NULL);
+    assert(cp->ib != NULL);
+    assert(g_iptrie_hash != NULL);
+    assert(trie_name != NULL);
+    assert(filename != NULL);
+
+    mp_tmp = ib_engine_pool_temp_get(cp->ib);
+
+    /* Check if the trie name is already in use */
+    rc = ib_hash_get(g_iptrie_hash, &tmp, trie_name);
+    if (rc == IB_OK) {
+        ib_cfg_log_error(cp,
+                         MODULE_NAME_STR ": IP trie named \"%s\" already defined",
+                         trie_name);
+        return IB_EEXIST;
+    }
+
+    trie_file = ib_util_relative_file(mp_tmp, cp->cur_file, filename);
+    if (trie_file == NULL) {
+        return IB_EALLOC;
+    }
+
+    if (ib_iptrie_is_image(trie_file)) {
+        rc = ib_iptrie_load(&trie, trie_file);
+        if (rc != IB_OK) {
+            ib_cfg_log_error(cp,
+                             MODULE_NAME_STR ": Error loading IP trie image %s: %s",
+                             trie_file, ib_status_to_string(rc));
+            return rc;
+        }
+    }
+    else {
+        ib_iptrie_builder_t *builder;
+        size_t line = 0;
+
+        rc = ib_iptrie_builder_create(&builder);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        rc = ib_iptrie_builder_add_file(builder, trie_file, &line);
+        if (rc == IB_EINVAL) {
+            ib_cfg_log_error(cp,
+                             MODULE_NAME_STR ": Invalid network at %s:%zd",
+                             trie_file, line);
+        }
+        else if (rc != IB_OK) {
+            ib_cfg_log_error(cp,
+                             MODULE_NAME_STR ": Error reading IP list %s: %s",
+                             trie_file, ib_status_to_string(rc));
+        }
+        else {
+            rc = ib_iptrie_builder_finish(builder, &trie);
+        }
+        ib_iptrie_builder_destroy(builder);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+
+    ib_cfg_log_debug(cp,
+                     MODULE_NAME_STR ": IP trie %s: %zd bytes from %s",
+                     trie_name, ib_iptrie_size(trie), trie_file);
+
+    rc = ib_hash_set(g_iptrie_hash, trie_name, trie);
+    if (rc != IB_OK) {
+        ib_iptrie_destroy(trie);
+        return rc;
+    }
+
+    return IB_OK;
+}
+
+static IB_DIRMAP_INIT_STRUCTURE(iptrie_directive_map) = {
+    IB_DIRMAP_INIT_PARAM2(
+        "LoadIPTrie",
+        load_iptrie_param2,
+        NULL
+    ),
+
+    /* signal the end of the list */
+    IB_DIRMAP_INIT_LAST
+};
+
+/**
+ * Create an instance of the @c iptrie operator.
+ *
+ * Looks up the trie name and adds the trie to the operator instance.
+ *
+ * @param[in] ib Ironbee engine.
+ * @param[in] ctx Current Context
+ * @param[in] rule The rule using this operator.
+ * @param[in] pool Memory pool to use.
+ * @param[in] trie_name The name of the trie to use.
+ *                      Defined via the LoadIPTrie directive.
+ * @param[in,out] op_inst The operator instance being created.
+ */
+static ib_status_t iptrie_operator_create(ib_engine_t *ib,
+                                          ib_context_t *ctx,
+                                          const ib_rule_t *rule,
+                                          ib_mpool_t *pool,
+                                          const char *trie_name,
+                                          ib_operator_inst_t *op_inst)
+{
+    ib_status_t rc;
+    ib_iptrie_t *trie;
+
+    assert(ib != NULL);
+    assert(g_iptrie_hash != NULL);
+    assert(trie_name != NULL);
+    assert(op_inst != NULL);
+
+    rc = ib_hash_get(g_iptrie_hash, &trie, trie_name);
+    if (rc == IB_ENOENT) {
+        ib_log_error(ib,
+                     MODULE_NAME_STR ": No IP trie named %s found.",
+                     trie_name);
+        return rc;
+    }
+    else if (rc != IB_OK) {
+        ib_log_error(ib,
+                     MODULE_NAME_STR ": Error setting up IP trie operator.");
+        return rc;
+    }
+
+    op_inst->data = trie;
+
+    return IB_OK;
+}
+
+/**
+ * Execute the @c iptrie operator.
+ *
+ * The field holds an IPv4 or IPv6 address.  The capture option is
+ * supported; the field will be placed in the capture variable if a match
+ * occurs.
+ *
+ * @param[in] rule_exec The rule being executed.
+ * @param[in] data The trie set by iptrie_operator_create().
+ * @param[in] flags Operator instance flags.
+ * @param[in] field The field to match.
+ * @param[out] result Set to 1 if a match is found 0 otherwise.
+ *
+ * @returns
+ * - IB_OK if no failure, regardless of match status.
+ * - IB_EINVAL on unable to parse @a field as IP address.
+ */
+static ib_status_t iptrie_operator_execute(
+    const ib_rule_exec_t *rule_exec,
+    void *data,
+    ib_flags_t flags,
+    ib_field_t *field,
+    ib_num_t *result)
+{
+    ib_status_t rc;
+    const ib_iptrie_t *trie = data;
+    const char *input;
+    size_t input_len;
+    char ipstr[48];
+
+    assert(rule_exec != NULL);
+    assert(data != NULL);
+    assert(field != NULL);
+    assert(result != NULL);
+
+    *result = 0;
+
+    if (field->type == IB_FTYPE_NULSTR) {
+        rc = ib_field_value(field, ib_ftype_nulstr_out(&input));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        input_len = strlen(input);
+    }
+    else if (field->type == IB_FTYPE_BYTESTR) {
+        const ib_bytestr_t *bs;
+        rc = ib_field_value(field, ib_ftype_bytestr_out(&bs));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        input = (const char *)ib_bytestr_const_ptr(bs);
+        input_len = ib_bytestr_length(bs);
+    }
+    else {
+        return IB_EINVAL;
+    }
+
+    if (input_len >= sizeof(ipstr)) {
+        ib_rule_log_debug(rule_exec, "Could not parse as IP: %.*s",
+                          (int)input_len, input);
+        return IB_EINVAL;
+    }
+    memcpy(ipstr, input, input_len);
+    ipstr[input_len] = '\0';
+
+    if (memchr(ipstr, ':', input_len) != NULL) {
+        ib_ip6_t ip;
+
+        rc = ib_ip6_str_to_ip(ipstr, &ip);
+        if (rc == IB_OK) {
+            rc = ib_iptrie_query6(trie, &ip, NULL);
+        }
+        else {
+            rc = IB_EINVAL;
+        }
+    }
+    else {
+        ib_ip4_t ip;
+
+        rc = ib_ip4_str_to_ip(ipstr, &ip);
+        if (rc == IB_OK) {
+            rc = ib_iptrie_query4(trie, ip, NULL);
+        }
+        else {
+            rc = IB_EINVAL;
+        }
+    }
+
+    if (rc == IB_EINVAL) {
+        ib_rule_log_debug(rule_exec, "Could not parse as IP: %s", ipstr);
+        return rc;
+    }
+    if (rc == IB_OK) {
+        *result = 1;
+        if (ib_rule_should_capture(rule_exec, *result)) {
+            ib_capture_clear(rule_exec->tx);
+            ib_capture_set_item(rule_exec->tx, 0, field);
+        }
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Noop.  No resources that need to be released are allocated when the
+ * operator is created.
+ */
+static ib_status_t iptrie_operator_destroy(ib_operator_inst_t *op_inst)
+{
+    return IB_OK;
+}
+
+/**
+ * Initialize the IP trie operator module.
+ *
+ * Registers the operator and the hash for storing the tries loaded by the
+ * LoadIPTrie directive.
+ *
+ * @param[in] ib Ironbee engine.
+ * @param[in] m Module instance.
+ * @param[in] cbdata Not used.
+ */
+static ib_status_t iptrie_module_init(ib_engine_t *ib,
+                                      ib_module_t *m,
+                                      void        *cbdata)
+{
+    ib_status_t rc;
+    ib_mpool_t *mp;
+
+    rc = ib_mpool_create(&mp, "iptrie_module", ib_engine_pool_main_get(ib));
+    if (rc != IB_OK) {
+        return rc;
+    }
+    if (g_iptrie_hash == NULL) {
+        rc = ib_hash_create_nocase(&g_iptrie_hash, mp);
+        if (rc != IB_OK ) {
+            ib_log_error(ib, MODULE_NAME_STR ": Error initializing module.");
+            return rc;
+        }
+    }
+
+    rc = ib_operator_register(ib,
+                              "iptrie",
+                              IB_OP_FLAG_PHASE | IB_OP_FLAG_CAPTURE,
+                              &iptrie_operator_create,
+                              NULL,
+                              &iptrie_operator_destroy,
+                              NULL,
+                              &iptrie_operator_execute,
+                              NULL);
+    if (rc != IB_OK) {
+        ib_log_error(ib, MODULE_NAME_STR ": Error registering operator.");
+        return rc;
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Release resources when the module is unloaded.
+ *
+ * All tries loaded by the LoadIPTrie directive are destroyed.
+ *
+ * @param[in] ib Ironbee engine.
+ * @param[in] m Module instance.
+ * @param[in] cbdata Not used.
+ */
+static ib_status_t iptrie_module_finish(ib_engine_t *ib,
+                                        ib_module_t *m,
+                                        void        *cbdata)
+{
+    ib_status_t rc;
+    ib_list_t *list  = NULL;
+    ib_list_node_t *node;
+    ib_mpool_t *pool;
+
+    if (g_iptrie_hash != NULL) {
+        pool = ib_hash_pool(g_iptrie_hash);
+
+        /* The only way to iterate over a hash is to covert it into a list. */
+        rc = ib_list_create(&list, pool);
+        if (rc != IB_OK) {
+            ib_log_error(ib, MODULE_NAME_STR ": Error unloading module.");
+            return rc;
+        }
+        rc = ib_hash_get_all(g_iptrie_hash, list);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        IB_LIST_LOOP(list, node) {
+            ib_iptrie_destroy(IB_LIST_NODE_DATA(node));
+        }
+        ib_hash_clear(g_iptrie_hash);
+        ib_mpool_release(pool);
+        g_iptrie_hash = NULL;
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Module structure.
+ *
+ * This structure defines some metadata, config data and various functions.
+ */
+IB_MODULE_INIT(
+    IB_MODULE_HEADER_DEFAULTS,            /**< Default metadata */
+    MODULE_NAME_STR,                      /**< Module name */
+    IB_MODULE_CONFIG_NULL,                /**< Global config data */
+    NULL,                                 /**< Configuration field map */
+    iptrie_directive_map,                 /**< Config directive map */
+    iptrie_module_init,                   /**< Initialize function */
+    NULL,                                 /**< Callback data */
+    iptrie_module_finish,                 /**< Finish function */
+    NULL,                                 /**< Callback data */
+    NULL,                                 /**< Context open function */
+    NULL,                                 /**< Callback data */
+    NULL,                                 /**< Context close function */
+    NULL,                                 /**< Callback data */
+    NULL,                                 /**< Context destroy function */
+    NULL                                  /**< Callback data */
+);
@@ -46,6 +46,8 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
 
 #if defined(__cplusplus) && !defined(__STDC_FORMAT_MACROS)
 /* C99 requires that inttypes.h only exposes PRI* macros
@@ -60,6 +62,7 @@
 #include <string.h>
 #include <strings.h>
 #include <time.h>
+#include <unistd.h>
 
 /* -- Module Setup -- */
 
@@ -70,28 +73,93 @@
 /* Define the public module symbol. */
 IB_MODULE_DECLARE();
 
-typedef struct modlua_runtime_t modlua_runtime_t;
+typedef struct modlua_vm_t modlua_vm_t;
+typedef struct modlua_vm_pool_t modlua_vm_pool_t;
+typedef struct modlua_replay_t modlua_replay_t;
 typedef struct modlua_cfg_t modlua_cfg_t;
 typedef struct modlua_lua_cbdata_t modlua_lua_cbdata_t;
 
+/** Default bound on the number of Lua VMs; 0 for one per online CPU. */
+#define MODLUA_VM_POOL_DEFAULT 0
+
+/**
+ * A Lua VM of the pool.
+ *
+ * Each VM is an independent Lua state with the same modules, rules and
+ * module configuration loaded, so VMs run concurrently.
+ */
+struct modlua_vm_t {
+    lua_State          *L;      /**< Lua state. */
+    ib_mpool_t         *mp;     /**< Pool of the VM's actions and operators. */
+    size_t              depth;  /**< Nested checkouts by the owning thread. */
+    int                 top;    /**< Stack top at the outer checkout. */
+};
+
 /**
- * Callback type for functions executed protected by global lock.
+ * Pool of Lua VMs.
  *
- * This callback should take a @c ib_engine_t* which is used
- * for logging, a @c lua_State* which is used to create the
- * new thread, and a @c lua_State** which will be assigned a
- * new @c lua_State*.
+ * Until configuration is finished, the configuration VM is used directly.
+ * Afterwards it becomes the first VM of the pool, and more VMs are created
+ * on demand, up to @c max, by replaying the configuration log.  When all
+ * VMs are in use, callers wait for one to be returned.
+ *
+ * Successive callbacks of a connection or transaction may run on different
+ * VMs, so Lua modules and rules keep such state in IronBee (e.g., in
+ * transaction data), not in Lua globals.  A global set once configuration
+ * is finished is logged with a warning; see modlua_vm_guard().
  */
-typedef ib_status_t(*critical_section_fn_t)(ib_engine_t *ib,
-                                            lua_State *parent,
-                                            lua_State **out_new);
+struct modlua_vm_pool_t {
+    pthread_mutex_t     mutex;        /**< Protects the fields below. */
+    pthread_cond_t      cond;         /**< Signaled when a VM is returned. */
+    modlua_vm_t       **idle;         /**< Idle VMs (LIFO). */
+    size_t              nidle;        /**< Number of idle VMs. */
+    size_t              count;        /**< VMs created or being created. */
+    size_t              max;          /**< Bound on count. */
+    bool                ready;        /**< Configuration is finished. */
+    pthread_key_t       key;          /**< VM held by the current thread. */
+    modlua_vm_t         main;         /**< The configuration VM. */
+    modlua_replay_t    *replay;       /**< Configuration log. */
+    modlua_replay_t    *replay_tail;  /**< Last entry of replay. */
+};
+
+/** Type of a configuration log entry. */
+typedef enum {
+    MODLUA_REPLAY_MODULE,    /**< A Lua module was loaded. */
+    MODLUA_REPLAY_RULE,      /**< A Lua rule was loaded. */
+    MODLUA_REPLAY_DIRECTIVE  /**< A Lua module directive was processed. */
+} modlua_replay_type_t;
+
+/** Type of a directive parameter. */
+typedef enum {
+    MODLUA_ARG_STRING,       /**< Pushed as a string. */
+    MODLUA_ARG_INTEGER,      /**< Pushed as an integer. */
+    MODLUA_ARG_LIST          /**< Pushed as a light userdata list. */
+} modlua_arg_type_t;
+
+/** A directive parameter. */
+typedef struct {
+    modlua_arg_type_t   type;     /**< Type. */
+    const char         *str;      /**< String value. */
+    lua_Integer         num;      /**< Integer value. */
+    const ib_list_t    *list;     /**< List value. */
+} modlua_arg_t;
+
 /**
- * Per-connection module data containing a Lua runtime.
+ * Configuration log entry.
  *
- * Created for each connection and stored as the module's connection data.
+ * Every configuration step that changes the Lua state is logged, so that
+ * it can be repeated on each new VM of the pool.
  */
-struct modlua_runtime_t {
-    lua_State          *L;            /**< Lua stack */
+struct modlua_replay_t {
+    modlua_replay_type_t type;    /**< Type. */
+    const char         *file;     /**< Module or rule file. */
+    const char         *name;     /**< Rule function or directive name. */
+    ib_module_t        *module;   /**< Module (modules and directives). */
+    ib_context_t       *ctx;      /**< Context of the directive. */
+    const char         *fn;       /**< modlua function handling directive. */
+    int                 nargs;    /**< Number of directive parameters. */
+    modlua_arg_t        args[2];  /**< Directive parameters. */
+    modlua_replay_t    *next;     /**< Next entry. */
 };
 
 /**
@@ -113,8 +181,10 @@ struct modlua_lua_cbdata_t {
 struct modlua_cfg_t {
     char               *pkg_path;  /**< Package path Lua Configuration. */
     char               *pkg_cpath; /**< Cpath Lua Configuration. */
-    lua_State          *L;         /**< Lua runtime stack. */
-    ib_lock_t          *L_lck;     /**< Lua runtime stack lock. */
+    lua_State          *L;         /**< Lua configuration stack. */
+    ib_lock_t          *L_lck;     /**< Serializes creating Lua VMs. */
+    modlua_vm_pool_t   *pool;      /**< Lua VMs. */
+    ib_num_t            pool_size; /**< Bound on the number of Lua VMs. */
 };
 
 /* Instantiate a module global configuration. */
@@ -122,7 +192,9 @@ static modlua_cfg_t modlua_global_cfg = {
     NULL, /* pkg_path */
     NULL, /* pkg_cpath */
     NULL,
-    NULL
+    NULL,
+    NULL,
+    MODLUA_VM_POOL_DEFAULT
 };
 
 ib_status_t modlua_rule_driver(
@@ -133,6 +205,20 @@ ib_status_t modlua_rule_driver(
     void *cbdata
 );
 
+static ib_status_t modlua_newstate(ib_engine_t *ib, lua_State **L);
+
+static ib_status_t modlua_module_load_lua(
+    ib_engine_t *ib,
+    const char *file,
+    ib_module_t *module,
+    lua_CFunction register_directive,
+    lua_State *L);
+
+static ib_status_t modlua_replay_directive(
+    ib_engine_t *ib,
+    lua_State *L,
+    const modlua_replay_t *replay);
+
 /* -- Lua Routines -- */
 
 #define IB_FFI_MODULE  ironbee-ffi
@@ -147,119 +233,478 @@ ib_status_t modlua_rule_driver(
 #define IB_FFI_MODULE_EVENT_WRAPPER     _IRONBEE_CALL_EVENT_HANDLER
 #define IB_FFI_MODULE_EVENT_WRAPPER_STR IB_XSTRINGIFY(IB_FFI_MODULE_EVENT_WRAPPER)
 
+/* -- Lua VM Pool -- */
+
 /**
- * Get the lua runtime from the connection.
+ * Append an entry to the configuration log.
  *
- * @param[in] conn Connection
- * @param[out] lua Lua runtime struct.
+ * @param[in] ib IronBee engine.
+ * @param[in] replay Entry to copy into the log. Strings are copied too.
  *
  * @returns
  *   - IB_OK on success.
- *   - Result of ib_engine_module_get() on error.
+ *   - IB_EALLOC on memory allocation error.
  */
-static ib_status_t modlua_runtime_get(
-    ib_conn_t *conn,
-    modlua_runtime_t **lua)
+static ib_status_t modlua_replay_add(
+    ib_engine_t *ib,
+    const modlua_replay_t *replay)
 {
-    assert(conn);
-    assert(conn->ib);
-    assert(lua);
+    assert(ib);
+    assert(replay);
 
-    ib_status_t rc;
-    ib_module_t *module;
+    modlua_vm_pool_t *pool = modlua_global_cfg.pool;
+    ib_mpool_t *mp = ib_engine_pool_main_get(ib);
+    modlua_replay_t *entry;
 
-    rc = ib_engine_module_get(conn->ib, MODULE_NAME_STR, &module);
-    if (rc != IB_OK) {
-        return rc;
+    entry = ib_mpool_memdup(mp, replay, sizeof(*entry));
+    if (entry == NULL) {
+        return IB_EALLOC;
+    }
+    entry->next = NULL;
+
+    if (replay->file != NULL) {
+        entry->file = ib_mpool_strdup(mp, replay->file);
+        if (entry->file == NULL) {
+            return IB_EALLOC;
+        }
+    }
+    if (replay->name != NULL) {
+        entry->name = ib_mpool_strdup(mp, replay->name);
+        if (entry->name == NULL) {
+            return IB_EALLOC;
+        }
+    }
+
+    for (int i = 0; i < replay->nargs; ++i) {
+        modlua_arg_t *arg = &entry->args[i];
+
+        if (arg->type == MODLUA_ARG_STRING) {
+            arg->str = ib_mpool_strdup(mp, arg->str);
+            if (arg->str == NULL) {
+                return IB_EALLOC;
+            }
+        }
+        else if (arg->type == MODLUA_ARG_LIST) {
+            /* Directive lists do not outlive configuration. */
+            const ib_list_node_t *node;
+            ib_list_t *list;
+            ib_status_t rc;
+
+            rc = ib_list_create(&list, mp);
+            if (rc != IB_OK) {
+                return rc;
+            }
+            IB_LIST_LOOP_CONST(arg->list, node) {
+                const char *s = ib_mpool_strdup(
+                    mp,
+                    (const char *)ib_list_node_data_const(node));
+                if (s == NULL) {
+                    return IB_EALLOC;
+                }
+                rc = ib_list_push(list, (void *)s);
+                if (rc != IB_OK) {
+                    return rc;
+                }
+            }
+            arg->list = list;
+        }
     }
 
-    ib_conn_get_module_data(conn, module, (void **)lua);
+    if (pool->replay_tail == NULL) {
+        pool->replay = entry;
+    }
+    else {
+        pool->replay_tail->next = entry;
+    }
+    pool->replay_tail = entry;
 
     return IB_OK;
 }
 
 /**
- * Set the lua runtime from the connection.
+ * Replacement of modlua_config_register_directive for VMs of the pool.
+ *
+ * The directives were registered with the engine by the configuration
+ * VM; the pool VMs only need the Lua side of the registration.
+ *
+ * @param[in] L Lua state.
+ *
+ * @returns The number of values returned: a status and a message.
+ */
+static int modlua_replay_register_directive(lua_State *L)
+{
+    assert(L);
+
+    lua_pop(L, lua_gettop(L));
+    lua_pushinteger(L, IB_OK);
+    lua_pushstring(L, "Success.");
+
+    return lua_gettop(L);
+}
+
+/**
+ * @c __newindex of the globals of a VM: warn, then set the global.
  *
- * @param[in] conn Connection
- * @param[in] lua Lua runtime struct.
+ * A global set by a callback or rule is only seen by the VM that ran it.
+ * The warning is logged once per VM and name, as later assignments find
+ * the global already set.
+ *
+ * @param[in] L Lua state.
+ *
+ * @returns 0, the number of values returned.
+ */
+static int modlua_vm_newindex(lua_State *L)
+{
+    assert(L);
+
+    ib_engine_t *ib = (ib_engine_t *)lua_touserdata(L, lua_upvalueindex(1));
+
+    if (lua_type(L, 2) == LUA_TSTRING) {
+        ib_log_warning(
+            ib,
+            "Lua global \"%s\" set after configuration is not shared "
+            "with the other Lua VMs; keep shared state in IronBee data.",
+            lua_tostring(L, 2));
+    }
+    lua_rawset(L, 1);
+
+    return 0;
+}
+
+/**
+ * Warn about globals set on @a L from now on.
+ *
+ * Nothing is done if the globals table already has a metatable (e.g., a
+ * module set up its own checks).
+ *
+ * @param[in] ib IronBee engine.
+ * @param[in] L Lua state.
+ */
+static void modlua_vm_guard(ib_engine_t *ib, lua_State *L)
+{
+    assert(ib);
+    assert(L);
+
+#if LUA_VERSION_NUM > 501
+    lua_pushglobaltable(L);
+#else
+    lua_pushvalue(L, LUA_GLOBALSINDEX);
+#endif
+    if (lua_getmetatable(L, -1)) {
+        lua_pop(L, 2);
+        return;
+    }
+    lua_newtable(L);
+    lua_pushlightuserdata(L, ib);
+    lua_pushcclosure(L, &modlua_vm_newindex, 1);
+    lua_setfield(L, -2, "__newindex");
+    lua_setmetatable(L, -2);
+    lua_pop(L, 1);
+}
+
+/**
+ * Create a Lua VM by replaying the configuration log.
+ *
+ * @param[in] ib IronBee engine.
+ * @param[out] vm The new VM.
  *
  * @returns
  *   - IB_OK on success.
- *   - Result of ib_engine_module_get() on error.
+ *   - IB_EALLOC on memory allocation error.
+ *   - Errors of the replayed configuration steps.
  */
-static ib_status_t modlua_runtime_set(
-    ib_conn_t *conn,
-    modlua_runtime_t *lua)
+static ib_status_t modlua_vm_create(ib_engine_t *ib, modlua_vm_t **vm)
 {
-    assert(conn);
-    assert(conn->ib);
-    assert(lua);
+    assert(ib);
+    assert(vm);
 
+    const modlua_replay_t *replay;
+    lua_State *L;
+    ib_mpool_t *mp;
     ib_status_t rc;
-    ib_module_t *module;
 
-    rc = ib_engine_module_get(conn->ib, MODULE_NAME_STR, &module);
+    *vm = malloc(sizeof(**vm));
+    if (*vm == NULL) {
+        return IB_EALLOC;
+    }
+
+    /* Actions and operators the replayed modules create are allocated from
+     * a pool of the VM: other threads may be using the engine's main pool
+     * (child pools are created under the parent's lock). */
+    rc = ib_mpool_create(&mp, "modlua_vm", ib_engine_pool_main_get(ib));
+    if (rc != IB_OK) {
+        free(*vm);
+        return rc;
+    }
+
+    /* Module code run by the replay may still use the engine's main pool. */
+    rc = ib_lock_lock(modlua_global_cfg.L_lck);
     if (rc != IB_OK) {
+        ib_mpool_destroy(mp);
+        free(*vm);
         return rc;
     }
 
-    ib_conn_set_module_data(conn, module, lua);
+    rc = modlua_newstate(ib, &L);
+    if (rc != IB_OK) {
+        goto failed;
+    }
+
+    /* Read by moduleapi.action() and moduleapi.operator(). */
+    lua_getglobal(L, "modlua");
+    lua_pushlightuserdata(L, mp);
+    lua_setfield(L, -2, "vm_mpool");
+    lua_pop(L, 1);
+
+    for (replay = modlua_global_cfg.pool->replay;
+         replay != NULL;
+         replay = replay->next)
+    {
+        switch (replay->type) {
+            case MODLUA_REPLAY_MODULE:
+                rc = modlua_module_load_lua(
+                    ib,
+                    replay->file,
+                    replay->module,
+                    &modlua_replay_register_directive,
+                    L);
+                break;
+            case MODLUA_REPLAY_RULE:
+                rc = ib_lua_load_func(ib, L, replay->file, replay->name);
+                break;
+            case MODLUA_REPLAY_DIRECTIVE:
+                rc = modlua_replay_directive(ib, L, replay);
+                break;
+        }
+        if (rc != IB_OK) {
+            lua_close(L);
+            goto failed;
+        }
+    }
+
+    ib_lock_unlock(modlua_global_cfg.L_lck);
+
+    modlua_vm_guard(ib, L);
+
+    (*vm)->L = L;
+    (*vm)->mp = mp;
+    (*vm)->depth = 0;
+    (*vm)->top = 0;
 
     return IB_OK;
+
+failed:
+    ib_lock_unlock(modlua_global_cfg.L_lck);
+    ib_mpool_destroy(mp);
+    free(*vm);
+    *vm = NULL;
+    return rc;
 }
 
 /**
- * This will use module lock to atomically call @a fn.
- *
- * The argument @a fn will be either
- * ib_lua_new_thread() or ib_lua_join_thread() which will be called
- * only if module lock can be locked using @c semop.
- *
- * @param[in] ib IronBee context. Used for logging.
- * @param[in] fn The function to execute. This is passed @a ib and @a fn.
- * @param[in,out] L The Lua State to create or destroy. Passed to @a fn.
- * @returns If any error locking or unlocking the
- *          semaphore is encountered, the error code is returned.
- *          Otherwise the result of @a fn is returned.
+ * Take a Lua VM for the current thread.
+ *
+ * A thread that already holds a VM (e.g., a Lua rule run from a Lua
+ * module callback) gets the same VM again.  Otherwise an idle VM is
+ * taken, a new one is created if there are fewer than the pool's bound,
+ * or the thread waits for a VM to be returned.
+ *
+ * @param[in] ib IronBee engine.
+ * @param[out] vm The VM, to be returned with modlua_vm_checkin().
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - Errors of modlua_vm_create().
  */
-static ib_status_t call_in_critical_section(ib_engine_t *ib,
-                                            critical_section_fn_t fn,
-                                            lua_State **L)
+static ib_status_t modlua_vm_checkout(ib_engine_t *ib, modlua_vm_t **vm)
 {
     assert(ib);
-    assert(fn);
-    assert(L);
+    assert(vm);
 
-    /* Return code from IronBee calls. */
-    ib_status_t ib_rc;
-    /* Return code form critical call. */
-    ib_status_t critical_rc;
+    modlua_vm_pool_t *pool = modlua_global_cfg.pool;
+    ib_status_t rc;
 
-    ib_rc  = ib_lock_lock(modlua_global_cfg.L_lck);
-    /* Report semop error and return. */
-    if (ib_rc != IB_OK) {
-        ib_log_error(ib, "Failed to lock Lua context.");
-        return ib_rc;
+    *vm = pthread_getspecific(pool->key);
+    if (*vm != NULL) {
+        ++(*vm)->depth;
+        return IB_OK;
     }
 
-    /* Execute lua call in critical section. */
-    critical_rc = fn(ib, modlua_global_cfg.L, L);
+    pthread_mutex_lock(&pool->mutex);
+    if (! pool->ready) {
+        /* Configuration is single threaded; use the configuration VM. */
+        *vm = &pool->main;
+    }
+    else {
+        while ( (pool->nidle == 0) && (pool->count >= pool->max) ) {
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        }
+        if (pool->nidle > 0) {
+            *vm = pool->idle[--pool->nidle];
+        }
+        else {
+            /* Reserve a place and create the VM without the lock held. */
+            ++pool->count;
+            pthread_mutex_unlock(&pool->mutex);
 
-    ib_rc = ib_lock_unlock(modlua_global_cfg.L_lck);
+            rc = modlua_vm_create(ib, vm);
+            if (rc != IB_OK) {
+                ib_log_error(ib, "Failed to create Lua VM: %s",
+                             ib_status_to_string(rc));
+                pthread_mutex_lock(&pool->mutex);
+                --pool->count;
+                pthread_cond_signal(&pool->cond);
+                pthread_mutex_unlock(&pool->mutex);
+                return rc;
+            }
+            ib_log_debug(ib, "Created Lua VM %zd of at most %zd.",
+                         pool->count, pool->max);
 
-    if (critical_rc != IB_OK) {
-        ib_log_error(ib, "Critical call failed: %s",
-                     ib_status_to_string(critical_rc));
+            pthread_mutex_lock(&pool->mutex);
+        }
     }
+    pthread_mutex_unlock(&pool->mutex);
 
-    /* Report semop error and return. */
-    if (ib_rc != IB_OK) {
-        ib_log_error(ib, "Failed to unlock Lua context.");
-        return ib_rc;
+    (*vm)->depth = 1;
+    (*vm)->top = lua_gettop((*vm)->L);
+    pthread_setspecific(pool->key, *vm);
+
+    return IB_OK;
+}
+
+/**
+ * Return a Lua VM taken with modlua_vm_checkout().
+ *
+ * @param[in] vm The VM.
+ */
+static void modlua_vm_checkin(modlua_vm_t *vm)
+{
+    assert(vm);
+    assert(vm->depth > 0);
+
+    modlua_vm_pool_t *pool = modlua_global_cfg.pool;
+
+    if (--vm->depth > 0) {
+        return;
+    }
+
+    /* Drop anything a failed call left on the stack. */
+    lua_settop(vm->L, vm->top);
+    pthread_setspecific(pool->key, NULL);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->ready) {
+        pool->idle[pool->nidle++] = vm;
+        pthread_cond_signal(&pool->cond);
     }
+    pthread_mutex_unlock(&pool->mutex);
+}
 
-    return critical_rc;
+/**
+ * Finish configuration: open the pool.
+ *
+ * @param[in] ib IronBee engine.
+ * @param[in] size Bound on the number of VMs; 0 for one per online CPU.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on memory allocation error.
+ */
+static ib_status_t modlua_vm_pool_ready(ib_engine_t *ib, ib_num_t size)
+{
+    assert(ib);
+
+    modlua_vm_pool_t *pool = modlua_global_cfg.pool;
+    size_t max = (size > 0) ? (size_t)size : 0;
+
+    if (max == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        max = (cpus > 0) ? (size_t)cpus : 1;
+    }
+
+    pool->idle = malloc(max * sizeof(*pool->idle));
+    if (pool->idle == NULL) {
+        return IB_EALLOC;
+    }
+
+    /* The configuration VM is the first VM of the pool. */
+    modlua_vm_guard(ib, pool->main.L);
+    pthread_mutex_lock(&pool->mutex);
+    pool->max = max;
+    pool->idle[0] = &pool->main;
+    pool->nidle = 1;
+    pool->count = 1;
+    pool->ready = true;
+    pthread_mutex_unlock(&pool->mutex);
+
+    ib_log_debug(ib, "Lua VM pool holds up to %zd VMs.", max);
+
+    return IB_OK;
+}
+
+/**
+ * Create the pool, with the configuration VM @a L.
+ *
+ * @param[in] L The configuration VM.
+ * @param[out] pool The pool.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on memory allocation error.
+ *   - IB_EUNKNOWN if a thread key or lock could not be created.
+ */
+static ib_status_t modlua_vm_pool_create(
+    lua_State *L,
+    modlua_vm_pool_t **pool)
+{
+    assert(L);
+    assert(pool);
+
+    *pool = calloc(1, sizeof(**pool));
+    if (*pool == NULL) {
+        return IB_EALLOC;
+    }
+    if (pthread_key_create(&(*pool)->key, NULL) != 0) {
+        free(*pool);
+        return IB_EUNKNOWN;
+    }
+    if (pthread_mutex_init(&(*pool)->mutex, NULL) != 0) {
+        pthread_key_delete((*pool)->key);
+        free(*pool);
+        return IB_EUNKNOWN;
+    }
+    if (pthread_cond_init(&(*pool)->cond, NULL) != 0) {
+        pthread_mutex_destroy(&(*pool)->mutex);
+        pthread_key_delete((*pool)->key);
+        free(*pool);
+        return IB_EUNKNOWN;
+    }
+    (*pool)->main.L = L;
+
+    return IB_OK;
+}
+
+/**
+ * Destroy the pool and all VMs but the configuration VM.
+ *
+ * All VMs must have been returned.
+ *
+ * @param[in] pool The pool.
+ */
+static void modlua_vm_pool_destroy(modlua_vm_pool_t *pool)
+{
+    for (size_t i = 0; i < pool->nidle; ++i) {
+        if (pool->idle[i] != &pool->main) {
+            lua_close(pool->idle[i]->L);
+            ib_mpool_destroy(pool->idle[i]->mp);
+            free(pool->idle[i]);
+        }
+    }
+    free(pool->idle);
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_key_delete(pool->key);
+    free(pool);
 }
 
 /**
@@ -466,249 +911,240 @@ static ib_status_t modlua_push_config_path(
 }
 
 /**
- * @param[in] cp Configuration parser.
- * @param[in] name Directive name for the block that is being closed.
- * @param[in,out] cbdata Callback data.
+ * Run a Lua module directive handler.
+ *
+ * This is used when the directive is processed, and when a VM of the
+ * pool replays the configuration.
+ *
+ * @param[in] ib IronBee engine.
+ * @param[in] L Lua state.
+ * @param[in] replay The directive.
+ *
+ * @returns
+ *   - The status returned by the directive handler.
+ *   - IB_EINVAL on a Lua runtime error.
  */
-static ib_status_t modlua_config_cb_blkend(
-    ib_cfgparser_t *cp,
-    const char *name,
-    void *cbdata)
+static ib_status_t modlua_replay_directive(
+    ib_engine_t *ib,
+    lua_State *L,
+    const modlua_replay_t *replay)
 {
-    assert(cp);
-    assert(name);
-    assert(cbdata);
+    assert(ib);
+    assert(L);
+    assert(replay);
 
     ib_status_t rc;
-    modlua_lua_cbdata_t *modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
-    lua_State *L = modlua_global_cfg.L;
-    ib_module_t *module = modlua_lua_cbdata->module;
-    ib_engine_t *ib = module->ib;
-    ib_context_t *ctx;
-
-    rc = ib_cfgparser_context_current(cp, &ctx);
-    if (rc != IB_OK) {
-        ib_cfg_log_error(cp, "Could not retrieve current context.");
-        return rc;
-    }
+    ib_module_t *module = replay->module;
 
     /* Push standard module directive arguments. */
     lua_getglobal(L, "modlua");
-    lua_getfield(L, -1, "modlua_config_cb_blkend");
+    lua_getfield(L, -1, replay->fn);
     lua_replace(L, -2); /* Effectively remove then modlua table. */
     lua_pushlightuserdata(L, module->ib);
     lua_pushinteger(L, module->idx);
-    rc = modlua_push_config_path(ib, ctx, L);
+    rc = modlua_push_config_path(ib, replay->ctx, L);
     if (rc != IB_OK) {
         lua_pop(L, 3);
         return rc;
     }
 
     /* Push config parameters. */
-    lua_pushstring(L, name);
+    lua_pushstring(L, replay->name);
+    for (int i = 0; i < replay->nargs; ++i) {
+        const modlua_arg_t *arg = &replay->args[i];
+
+        switch (arg->type) {
+            case MODLUA_ARG_STRING:
+                lua_pushstring(L, arg->str);
+                break;
+            case MODLUA_ARG_INTEGER:
+                lua_pushinteger(L, arg->num);
+                break;
+            case MODLUA_ARG_LIST:
+                lua_pushlightuserdata(L, (void *)arg->list);
+                break;
+        }
+    }
 
-    rc = modlua_config_cb_eval(L, ib, module, name, 4);
+    rc = modlua_config_cb_eval(L, ib, module, replay->name, 4 + replay->nargs);
     return rc;
 }
 
 /**
+ * Process a Lua module directive and log it for the VM pool.
+ *
  * @param[in] cp Configuration parser.
+ * @param[in] fn The modlua function handling the directive.
  * @param[in] name Configuration directive name.
- * @param[in] onoff On or off setting.
+ * @param[in] nargs Number of elements of @a args.
+ * @param[in] args Configuration parameters.
  * @param[in] cbdata Callback data.
+ *
+ * @returns
+ *   - The status returned by the directive handler.
+ *   - IB_EINVAL on a Lua runtime error.
+ *   - IB_EALLOC on memory allocation error.
  */
-static ib_status_t modlua_config_cb_onoff(
+static ib_status_t modlua_config_cb(
     ib_cfgparser_t *cp,
+    const char *fn,
     const char *name,
-    int onoff,
+    int nargs,
+    const modlua_arg_t *args,
     void *cbdata)
 {
     assert(cp);
+    assert(fn);
     assert(name);
+    assert(nargs >= 0 && nargs <= 2);
     assert(cbdata);
 
     ib_status_t rc;
     modlua_lua_cbdata_t *modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
-    lua_State *L = modlua_global_cfg.L;
     ib_module_t *module = modlua_lua_cbdata->module;
     ib_engine_t *ib = module->ib;
-    ib_context_t *ctx;
+    modlua_replay_t replay;
+
+    memset(&replay, 0, sizeof(replay));
+    replay.type = MODLUA_REPLAY_DIRECTIVE;
+    replay.fn = fn;
+    replay.name = name;
+    replay.module = module;
+    replay.nargs = nargs;
+    for (int i = 0; i < nargs; ++i) {
+        replay.args[i] = args[i];
+    }
 
-    rc = ib_cfgparser_context_current(cp, &ctx);
+    rc = ib_cfgparser_context_current(cp, &replay.ctx);
     if (rc != IB_OK) {
         ib_cfg_log_error(cp, "Could not retrieve current context.");
         return rc;
     }
 
-    /* Push standard module directive arguments. */
-    lua_getglobal(L, "modlua");
-    lua_getfield(L, -1, "modlua_config_cb_onoff");
-    lua_replace(L, -2); /* Effectively remove then modlua table. */
-    lua_pushlightuserdata(L, module->ib);
-    lua_pushinteger(L, module->idx);
-    rc = modlua_push_config_path(ib, ctx, L);
+    rc = modlua_replay_directive(ib, modlua_global_cfg.L, &replay);
     if (rc != IB_OK) {
-        lua_pop(L, 3);
         return rc;
     }
 
-    /* Push config parameters. */
-    lua_pushstring(L, name);
-    lua_pushinteger(L, onoff);
+    return modlua_replay_add(ib, &replay);
+}
 
-    rc = modlua_config_cb_eval(L, ib, module, name, 5);
-    return rc;
+/**
+ * @param[in] cp Configuration parser.
+ * @param[in] name Directive name for the block that is being closed.
+ * @param[in,out] cbdata Callback data.
+ */
+static ib_status_t modlua_config_cb_blkend(
+    ib_cfgparser_t *cp,
+    const char *name,
+    void *cbdata)
+{
+    assert(cp);
+    assert(name);
+    assert(cbdata);
+
+    return modlua_config_cb(
+        cp, "modlua_config_cb_blkend", name, 0, NULL, cbdata);
 }
+
 /**
  * @param[in] cp Configuration parser.
  * @param[in] name Configuration directive name.
- * @param[in] p1 The only parameter.
+ * @param[in] onoff On or off setting.
  * @param[in] cbdata Callback data.
  */
-static ib_status_t modlua_config_cb_param1(
+static ib_status_t modlua_config_cb_onoff(
     ib_cfgparser_t *cp,
     const char *name,
-    const char *p1,
+    int onoff,
     void *cbdata)
 {
     assert(cp);
     assert(name);
-    assert(p1);
     assert(cbdata);
 
-    ib_status_t rc;
-    modlua_lua_cbdata_t *modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
-    lua_State *L = modlua_global_cfg.L;
-    ib_module_t *module = modlua_lua_cbdata->module;
-    ib_engine_t *ib = module->ib;
-    ib_context_t *ctx;
-
-    rc = ib_cfgparser_context_current(cp, &ctx);
-    if (rc != IB_OK) {
-        ib_cfg_log_error(cp, "Could not retrieve current context.");
-        return rc;
-    }
+    modlua_arg_t args[1] = {
+        { MODLUA_ARG_INTEGER, NULL, onoff, NULL }
+    };
 
-    /* Push standard module directive arguments. */
-    lua_getglobal(L, "modlua");
-    lua_getfield(L, -1, "modlua_config_cb_param1");
-    lua_replace(L, -2); /* Effectively remove then modlua table. */
-    lua_pushlightuserdata(L, module->ib);
-    lua_pushinteger(L, module->idx);
-    rc = modlua_push_config_path(ib, ctx, L);
-    if (rc != IB_OK) {
-        lua_pop(L, 3);
-        return rc;
-    }
-
-    /* Push config parameters. */
-    lua_pushstring(L, name);
-    lua_pushstring(L, p1);
-
-    rc = modlua_config_cb_eval(L, ib, module, name, 5);
-    return rc;
+    return modlua_config_cb(
+        cp, "modlua_config_cb_onoff", name, 1, args, cbdata);
 }
 /**
  * @param[in] cp Configuration parser.
  * @param[in] name Configuration directive name.
- * @param[in] p1 The first parameter.
- * @param[in] p2 The second parameter.
+ * @param[in] p1 The only parameter.
  * @param[in] cbdata Callback data.
  */
-static ib_status_t modlua_config_cb_param2(
+static ib_status_t modlua_config_cb_param1(
     ib_cfgparser_t *cp,
     const char *name,
     const char *p1,
-    const char *p2,
     void *cbdata)
 {
     assert(cp);
     assert(name);
     assert(p1);
-    assert(p2);
     assert(cbdata);
 
-    ib_status_t rc;
-    modlua_lua_cbdata_t *modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
-    lua_State *L = modlua_global_cfg.L;
-    ib_module_t *module = modlua_lua_cbdata->module;
-    ib_engine_t *ib = module->ib;
-    ib_context_t *ctx;
+    modlua_arg_t args[1] = {
+        { MODLUA_ARG_STRING, p1, 0, NULL }
+    };
 
-    rc = ib_cfgparser_context_current(cp, &ctx);
-    if (rc != IB_OK) {
-        ib_cfg_log_error(cp, "Could not retrieve current context.");
-        return rc;
-    }
-
-    /* Push standard module directive arguments. */
-    lua_getglobal(L, "modlua");
-    lua_getfield(L, -1, "modlua_config_cb_param2");
-    lua_replace(L, -2); /* Effectively remove then modlua table. */
-    lua_pushlightuserdata(L, module->ib);
-    lua_pushinteger(L, module->idx);
-    rc = modlua_push_config_path(ib, ctx, L);
-    if (rc != IB_OK) {
-        lua_pop(L, 3);
-        return rc;
-    }
-
-    /* Push config parameters. */
-    lua_pushstring(L, name);
-    lua_pushstring(L, p1);
-    lua_pushstring(L, p2);
-
-    rc = modlua_config_cb_eval(L, ib, module, name, 6);
-    return rc;
+    return modlua_config_cb(
+        cp, "modlua_config_cb_param1", name, 1, args, cbdata);
 }
 /**
  * @param[in] cp Configuration parser.
  * @param[in] name Configuration directive name.
- * @param[in] list List of values.
+ * @param[in] p1 The first parameter.
+ * @param[in] p2 The second parameter.
  * @param[in] cbdata Callback data.
  */
-static ib_status_t modlua_config_cb_list(
+static ib_status_t modlua_config_cb_param2(
     ib_cfgparser_t *cp,
     const char *name,
-    const ib_list_t *list,
+    const char *p1,
+    const char *p2,
     void *cbdata)
 {
     assert(cp);
     assert(name);
-    assert(list);
+    assert(p1);
+    assert(p2);
     assert(cbdata);
 
-    ib_status_t rc;
-    modlua_lua_cbdata_t *modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
-    lua_State *L = modlua_global_cfg.L;
-    ib_module_t *module = modlua_lua_cbdata->module;
-    ib_engine_t *ib = module->ib;
-    ib_context_t *ctx;
-
-    rc = ib_cfgparser_context_current(cp, &ctx);
-    if (rc != IB_OK) {
-        ib_cfg_log_error(cp, "Could not retrieve current context.");
-        return rc;
-    }
+    modlua_arg_t args[2] = {
+        { MODLUA_ARG_STRING, p1, 0, NULL },
+        { MODLUA_ARG_STRING, p2, 0, NULL }
+    };
 
-    /* Push standard module directive arguments. */
-    lua_getglobal(L, "modlua");
-    lua_getfield(L, -1, "modlua_config_cb_list");
-    lua_replace(L, -2); /* Effectively remove then modlua table. */
-    lua_pushlightuserdata(L, module->ib);
-    lua_pushinteger(L, module->idx);
-    rc = modlua_push_config_path(ib, ctx, L);
-    if (rc != IB_OK) {
-        lua_pop(L, 3);
-        return rc;
-    }
+    return modlua_config_cb(
+        cp, "modlua_config_cb_param2", name, 2, args, cbdata);
+}
+/**
+ * @param[in] cp Configuration parser.
+ * @param[in] name Configuration directive name.
+ * @param[in] list List of values.
+ * @param[in] cbdata Callback data.
+ */
+static ib_status_t modlua_config_cb_list(
+    ib_cfgparser_t *cp,
+    const char *name,
+    const ib_list_t *list,
+    void *cbdata)
+{
+    assert(cp);
+    assert(name);
+    assert(list);
+    assert(cbdata);
 
-    /* Push config parameters. */
-    lua_pushstring(L, name);
-    lua_pushlightuserdata(L, (void *)list);
+    modlua_arg_t args[1] = {
+        { MODLUA_ARG_LIST, NULL, 0, list }
+    };
 
-    rc = modlua_config_cb_eval(L, ib, module, name, 5);
-    return rc;
+    return modlua_config_cb(
+        cp, "modlua_config_cb_list", name, 1, args, cbdata);
 }
 /**
  * @param[in] cp Configuration parser.
@@ -726,37 +1162,12 @@ static ib_status_t modlua_config_cb_opflags(
     assert(name);
     assert(cbdata);
 
-    ib_status_t rc;
-    modlua_lua_cbdata_t *modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
-    lua_State *L = modlua_global_cfg.L;
-    ib_module_t *module = modlua_lua_cbdata->module;
-    ib_engine_t *ib = module->ib;
-    ib_context_t *ctx;
-
-    rc = ib_cfgparser_context_current(cp, &ctx);
-    if (rc != IB_OK) {
-        ib_cfg_log_error(cp, "Could not retrieve current context.");
-        return rc;
-    }
-
-    /* Push standard module directive arguments. */
-    lua_getglobal(L, "modlua");
-    lua_getfield(L, -1, "modlua_config_cb_opflags");
-    lua_replace(L, -2); /* Effectively remove then modlua table. */
-    lua_pushlightuserdata(L, module->ib);
-    lua_pushinteger(L, module->idx);
-    rc = modlua_push_config_path(ib, ctx, L);
-    if (rc != IB_OK) {
-        lua_pop(L, 3);
-        return rc;
-    }
-
-    /* Push config parameters. */
-    lua_pushstring(L, name);
-    lua_pushinteger(L, mask);
+    modlua_arg_t args[1] = {
+        { MODLUA_ARG_INTEGER, NULL, mask, NULL }
+    };
 
-    rc = modlua_config_cb_eval(L, ib, module, name, 5);
-    return rc;
+    return modlua_config_cb(
+        cp, "modlua_config_cb_opflags", name, 1, args, cbdata);
 }
 /**
  * @param[in] cp Configuration parser.
@@ -775,37 +1186,12 @@ static ib_status_t modlua_config_cb_sblk1(
     assert(p1);
     assert(cbdata);
 
-    ib_status_t rc;
-    modlua_lua_cbdata_t *modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
-    lua_State *L = modlua_global_cfg.L;
-    ib_module_t *module = modlua_lua_cbdata->module;
-    ib_engine_t *ib = module->ib;
-    ib_context_t *ctx;
-
-    rc = ib_cfgparser_context_current(cp, &ctx);
-    if (rc != IB_OK) {
-        ib_cfg_log_error(cp, "Could not retrieve current context.");
-        return rc;
-    }
-
-    /* Push standard module directive arguments. */
-    lua_getglobal(L, "modlua");
-    lua_getfield(L, -1, "modlua_config_cb_sblk1");
-    lua_replace(L, -2); /* Effectively remove then modlua table. */
-    lua_pushlightuserdata(L, module->ib);
-    lua_pushinteger(L, module->idx);
-    rc = modlua_push_config_path(ib, ctx, L);
-    if (rc != IB_OK) {
-        lua_pop(L, 3);
-        return rc;
-    }
-
-    /* Push config parameters. */
-    lua_pushstring(L, name);
-    lua_pushstring(L, p1);
+    modlua_arg_t args[1] = {
+        { MODLUA_ARG_STRING, p1, 0, NULL }
+    };
 
-    rc = modlua_config_cb_eval(L, ib, module, name, 5);
-    return rc;
+    return modlua_config_cb(
+        cp, "modlua_config_cb_sblk1", name, 1, args, cbdata);
 }
 
 
@@ -1216,8 +1602,8 @@ static ib_status_t modlua_push_dispatcher(
  * @param[in] ib The IronBee engine. This may not be null.
  * @param[in] event The event type.
  * @param[in] tx The transaction. This may be null.
- * @param[in] conn The connection. This may not be null. We require it to,
- *            at a minimum, find the Lua runtime stack.
+ * @param[in] conn The connection. This may not be null.
+ * @param[in] L The Lua VM taken with modlua_vm_checkout().
  * @param[in] cbdata The callback data. This may not be null.
  *
  * @returns
@@ -1229,28 +1615,21 @@ static ib_status_t modlua_callback_setup(
     ib_state_event_type_t event,
     ib_tx_t *tx,
     ib_conn_t *conn,
+    lua_State *L,
     void *cbdata)
 {
     assert(ib);
     assert(conn);
+    assert(L);
     assert(cbdata);
 
     ib_status_t rc;
     modlua_lua_cbdata_t *modlua_lua_cbdata;
     ib_module_t *module;
-    lua_State *L;
-    modlua_runtime_t *lua;
 
     modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
     module = modlua_lua_cbdata->module;
 
-    rc = modlua_runtime_get(conn, &lua);
-    if (rc != IB_OK) {
-        return rc;
-    }
-
-    L = lua->L;
-
     /* Push Lua dispatch method to stack. */
     rc = modlua_push_dispatcher(ib, module, event, L);
     if (rc != IB_OK) {
@@ -1388,8 +1767,8 @@ static ib_status_t modlua_callback_dispatch_base(
  * @param[in] ib The IronBee engine. This may not be null.
  * @param[in] event The event type.
  * @param[in] tx The transaction. This may be null.
- * @param[in] conn The connection. This may not be null. We require it to,
- *            at a minimum, find the Lua runtime stack.
+ * @param[in] conn The connection. This may not be null.
+ * @param[in] L The Lua VM taken with modlua_vm_checkout().
  * @param[in] cbdata The callback data. This may not be null.
  *
  * @returns
@@ -1404,28 +1783,20 @@ static ib_status_t modlua_callback_dispatch(
     ib_state_event_type_t event,
     ib_tx_t *tx,
     ib_conn_t *conn,
+    lua_State *L,
     void *cbdata)
 {
     assert(ib);
     assert(conn);
+    assert(L);
     assert(cbdata);
 
-    ib_status_t rc;
     modlua_lua_cbdata_t *modlua_lua_cbdata;
     ib_module_t *module;
-    lua_State *L;
-    modlua_runtime_t *lua;
 
     modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
     module = modlua_lua_cbdata->module;
 
-    rc = modlua_runtime_get(conn, &lua);
-    if (rc != IB_OK) {
-        return rc;
-    }
-
-    L = lua->L;
-
     return modlua_callback_dispatch_base(ib, module, L);
 }
 
@@ -1441,7 +1812,7 @@ static ib_status_t modlua_null(
     assert(cbdata);
 
     ib_status_t rc;
-    ib_status_t join_rc; /* We need a temporary rc value for thread joins. */
+    modlua_vm_t *vm;
     lua_State *L;
     modlua_lua_cbdata_t *modlua_lua_cbdata;
     ib_module_t *module;
@@ -1449,25 +1820,25 @@ static ib_status_t modlua_null(
     modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
     module = modlua_lua_cbdata->module;
 
-    /* Since there is  no connection Lua stack, we make a new one. */
-    rc = call_in_critical_section(ib, &ib_lua_new_thread, &L);
+    rc = modlua_vm_checkout(ib, &vm);
     if (rc != IB_OK) {
-        ib_log_alert(ib, "Failed to allocate new Lua thread.");
+        ib_log_alert(ib, "Failed to acquire Lua VM.");
         return rc;
     }
+    L = vm->L;
 
     /* Push Lua dispatch method to stack. */
     rc = modlua_push_dispatcher(ib, module, event, L);
     if (rc != IB_OK) {
         ib_log_error(ib, "Cannot push modlua.dispatch_handler to stack.");
-        return rc;
+        goto exit;
     }
 
     /* Push Lua handler onto the table. */
     rc = modlua_push_lua_handler(ib, module, event, L);
     if (rc != IB_OK) {
         ib_log_error(ib, "Cannot push modlua event handler to stack.");
-        return rc;
+        goto exit;
     }
 
     lua_pushlightuserdata(L, ib);
@@ -1476,7 +1847,7 @@ static ib_status_t modlua_null(
     rc = modlua_push_config_path(ib, ib_context_main(ib), L);
     if (rc != IB_OK) {
         ib_log_error(ib, "Cannot push modlua.config_path to stack.");
-        return rc;
+        goto exit;
     }
     lua_pushnil(L); /* Connection (conn) is nil. */
     lua_pushnil(L); /* Transaction (tx) is nil. */
@@ -1484,18 +1855,10 @@ static ib_status_t modlua_null(
     rc = modlua_callback_dispatch_base(ib, module, L);
     if (rc != IB_OK) {
         ib_log_error(ib, "Failure while executing callback handler.");
-        /* Do not return. We must join the Lua thread. */
     }
 
-    join_rc = call_in_critical_section(ib, &ib_lua_join_thread, &L);
-    if (join_rc != IB_OK) {
-        ib_log_alert(ib, "Failed to join created Lua thread.");
-
-        /* If there is no other error, return the join error. */
-        if (rc == IB_OK) {
-            rc = join_rc;
-        }
-    }
+exit:
+    modlua_vm_checkin(vm);
 
     return rc;
 }
@@ -1514,19 +1877,24 @@ static ib_status_t modlua_conn(
     assert(cbdata);
 
     ib_status_t rc;
+    modlua_vm_t *vm;
 
-    rc = modlua_callback_setup(ib, event, NULL, conn, cbdata);
+    rc = modlua_vm_checkout(ib, &vm);
     if (rc != IB_OK) {
         return rc;
     }
 
-    /* Custom table setup */
-
-    rc = modlua_callback_dispatch(ib, event, NULL, conn, cbdata);
+    rc = modlua_callback_setup(ib, event, NULL, conn, vm->L, cbdata);
     if (rc != IB_OK) {
+        modlua_vm_checkin(vm);
         return rc;
     }
 
+    /* Custom table setup */
+
+    rc = modlua_callback_dispatch(ib, event, NULL, conn, vm->L, cbdata);
+    modlua_vm_checkin(vm);
+
     return rc;
 }
 
@@ -1545,19 +1913,24 @@ static ib_status_t modlua_conndata(
     assert(cbdata);
 
     ib_status_t rc;
+    modlua_vm_t *vm;
 
-    rc = modlua_callback_setup(ib, event, NULL, conndata->conn, cbdata);
+    rc = modlua_vm_checkout(ib, &vm);
     if (rc != IB_OK) {
         return rc;
     }
 
-    /* Custom table setup */
-
-    rc = modlua_callback_dispatch(ib, event, NULL, conndata->conn, cbdata);
+    rc = modlua_callback_setup(ib, event, NULL, conndata->conn, vm->L, cbdata);
     if (rc != IB_OK) {
+        modlua_vm_checkin(vm);
         return rc;
     }
 
+    /* Custom table setup */
+
+    rc = modlua_callback_dispatch(ib, event, NULL, conndata->conn, vm->L, cbdata);
+    modlua_vm_checkin(vm);
+
     return rc;
 }
 
@@ -1576,19 +1949,24 @@ static ib_status_t modlua_tx(
     assert(ib);
 
     ib_status_t rc;
+    modlua_vm_t *vm;
 
-    rc = modlua_callback_setup(ib, event, tx, tx->conn, cbdata);
+    rc = modlua_vm_checkout(ib, &vm);
     if (rc != IB_OK) {
         return rc;
     }
 
-    /* Custom table setup */
-
-    rc = modlua_callback_dispatch(ib, event, tx, tx->conn, cbdata);
+    rc = modlua_callback_setup(ib, event, tx, tx->conn, vm->L, cbdata);
     if (rc != IB_OK) {
+        modlua_vm_checkin(vm);
         return rc;
     }
 
+    /* Custom table setup */
+
+    rc = modlua_callback_dispatch(ib, event, tx, tx->conn, vm->L, cbdata);
+    modlua_vm_checkin(vm);
+
     return rc;
 }
 
@@ -1608,19 +1986,24 @@ static ib_status_t modlua_txdata(
     assert(cbdata);
 
     ib_status_t rc;
+    modlua_vm_t *vm;
 
-    rc = modlua_callback_setup(ib, event, tx, tx->conn, cbdata);
+    rc = modlua_vm_checkout(ib, &vm);
     if (rc != IB_OK) {
         return rc;
     }
 
-    /* Custom table setup */
-
-    rc = modlua_callback_dispatch(ib, event, tx, tx->conn, cbdata);
+    rc = modlua_callback_setup(ib, event, tx, tx->conn, vm->L, cbdata);
     if (rc != IB_OK) {
+        modlua_vm_checkin(vm);
         return rc;
     }
 
+    /* Custom table setup */
+
+    rc = modlua_callback_dispatch(ib, event, tx, tx->conn, vm->L, cbdata);
+    modlua_vm_checkin(vm);
+
     return rc;
 }
 
@@ -1640,19 +2023,24 @@ static ib_status_t modlua_header(
     assert(cbdata);
 
     ib_status_t rc;
+    modlua_vm_t *vm;
 
-    rc = modlua_callback_setup(ib, event, tx, tx->conn, cbdata);
+    rc = modlua_vm_checkout(ib, &vm);
     if (rc != IB_OK) {
         return rc;
     }
 
-    /* Custom table setup */
-
-    rc = modlua_callback_dispatch(ib, event, tx, tx->conn, cbdata);
+    rc = modlua_callback_setup(ib, event, tx, tx->conn, vm->L, cbdata);
     if (rc != IB_OK) {
+        modlua_vm_checkin(vm);
         return rc;
     }
 
+    /* Custom table setup */
+
+    rc = modlua_callback_dispatch(ib, event, tx, tx->conn, vm->L, cbdata);
+    modlua_vm_checkin(vm);
+
     return rc;
 }
 
@@ -1672,19 +2060,24 @@ static ib_status_t modlua_reqline(
     assert(cbdata);
 
     ib_status_t rc;
+    modlua_vm_t *vm;
 
-    rc = modlua_callback_setup(ib, event, tx, tx->conn, cbdata);
+    rc = modlua_vm_checkout(ib, &vm);
     if (rc != IB_OK) {
         return rc;
     }
 
-    /* Custom table setup */
-
-    rc = modlua_callback_dispatch(ib, event, tx, tx->conn, cbdata);
+    rc = modlua_callback_setup(ib, event, tx, tx->conn, vm->L, cbdata);
     if (rc != IB_OK) {
+        modlua_vm_checkin(vm);
         return rc;
     }
 
+    /* Custom table setup */
+
+    rc = modlua_callback_dispatch(ib, event, tx, tx->conn, vm->L, cbdata);
+    modlua_vm_checkin(vm);
+
     return rc;
 }
 
@@ -1704,19 +2097,24 @@ static ib_status_t modlua_respline(
     assert(cbdata);
 
     ib_status_t rc;
+    modlua_vm_t *vm;
 
-    rc = modlua_callback_setup(ib, event, tx, tx->conn, cbdata);
+    rc = modlua_vm_checkout(ib, &vm);
     if (rc != IB_OK) {
         return rc;
     }
 
-    /* Custom table setup */
-
-    rc = modlua_callback_dispatch(ib, event, tx, tx->conn, cbdata);
+    rc = modlua_callback_setup(ib, event, tx, tx->conn, vm->L, cbdata);
     if (rc != IB_OK) {
+        modlua_vm_checkin(vm);
         return rc;
     }
 
+    /* Custom table setup */
+
+    rc = modlua_callback_dispatch(ib, event, tx, tx->conn, vm->L, cbdata);
+    modlua_vm_checkin(vm);
+
     return rc;
 }
 
@@ -1726,6 +2124,8 @@ static ib_status_t modlua_respline(
  * @param[in] ib IronBee engine.
  * @param[in] file The file we are loading.
  * @param[in] module The registered module structure.
+ * @param[in] register_directive Function the module calls to register
+ *            its directives.
  * @param[in,out] L The lua context that @a file will be loaded into as
  *                @a module.
  * @returns
@@ -1735,11 +2135,13 @@ static ib_status_t modlua_module_load_lua(
     ib_engine_t *ib,
     const char *file,
     ib_module_t *module,
+    lua_CFunction register_directive,
     lua_State *L)
 {
     assert(ib);
     assert(file);
     assert(module);
+    assert(register_directive);
     assert(L);
 
     int lua_rc;
@@ -1771,7 +2173,7 @@ static ib_status_t modlua_module_load_lua(
     lua_pushlightuserdata(L, module); /* Push module engine. */
     lua_pushstring(L, file);
     lua_pushinteger(L, module->idx);
-    lua_pushcfunction(L, &modlua_config_register_directive);
+    lua_pushcfunction(L, register_directive);
     lua_rc = luaL_loadfile(L, file);
     switch(lua_rc) {
         case 0:
@@ -2015,6 +2417,7 @@ static ib_status_t modlua_module_load_wire_callbacks(
 static ib_status_t modlua_module_load(ib_engine_t *ib, const char *file) {
     lua_State *L;
     ib_module_t *module;
+    modlua_replay_t replay;
     ib_status_t rc;
 
     rc = build_near_empty_module(ib, file, &module);
@@ -2034,12 +2437,26 @@ static ib_status_t modlua_module_load(ib_engine_t *ib, const char *file) {
         return IB_OK;
     }
 
-    rc = modlua_module_load_lua(ib, file, module, L);
+    rc = modlua_module_load_lua(
+        ib,
+        file,
+        module,
+        &modlua_config_register_directive,
+        L);
     if (rc != IB_OK) {
         ib_log_error(ib, "Failed to load lua modules: %s", file);
         return rc;
     }
 
+    memset(&replay, 0, sizeof(replay));
+    replay.type = MODLUA_REPLAY_MODULE;
+    replay.file = file;
+    replay.module = module;
+    rc = modlua_replay_add(ib, &replay);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
     rc = modlua_module_load_wire_callbacks(ib, file, module, L);
     if (rc != IB_OK) {
         ib_log_error(ib, "Failed register lua callbacks for module : %s", file);
@@ -2148,111 +2565,6 @@ static ib_status_t modlua_preload(ib_engine_t *ib, lua_State *L) {
     return IB_OK;
 }
 
-/* -- Event Handlers -- */
-
-/**
- * Callback to initialize the per-connection Lua stack.
- *
- * Every Lua Module shares the same Lua stack for execution. This stack is
- * "owned" not by the module written in Lua by the user, but by this
- * module, the Lua Module.
- *
- * @param ib Engine.
- * @param event Event type.
- * @param conn Connection.
- * @param cbdata Unused.
- *
- * @return
- *   - IB_OK
- *   - IB_EALLOC on memory allocation failure.
- *   - Other upon failure of callback registration.
- */
-static ib_status_t modlua_conn_init_lua_runtime(ib_engine_t *ib,
-                                                ib_state_event_type_t event,
-                                                ib_conn_t *conn,
-                                                void *cbdata)
-{
-    assert(event == conn_started_event);
-    assert(ib);
-    assert(conn);
-
-    ib_status_t rc;
-    modlua_runtime_t *modlua_runtime;
-
-    modlua_runtime = ib_mpool_alloc(conn->mp, sizeof(modlua_runtime));
-    if (!modlua_runtime) {
-        return IB_EALLOC;
-    }
-
-    rc = call_in_critical_section(ib, &ib_lua_new_thread, &modlua_runtime->L);
-    if (rc != IB_OK) {
-        ib_log_alert(ib, "Failed to allocate new Lua thread for connection.");
-        return rc;
-    }
-
-    rc = modlua_runtime_set(conn, modlua_runtime);
-    if (rc != IB_OK) {
-        ib_log_alert(
-            ib,
-            "Could not store connection Lua stack in connection.");
-        return rc;
-    }
-
-    return IB_OK;
-}
-
-/**
- * Callback to destroy the per-connection Lua stack.
- *
- * Every Lua Module shares the same Lua stack for execution. This stack is
- * "owned" not by the module written in Lua by the user, but by this
- * module, the Lua Module.
- *
- * This is registered when the main context is closed to ensure that it
- * executes after all the Lua modules call backs (callbacks are executed
- * in the order of their registration).
- *
- * @param ib Engine.
- * @param event Event type.
- * @param conn Connection.
- * @param cbdata Unused.
- *
- * @return
- *   - IB_OK
- *   - IB_EALLOC on memory allocation failure.
- *   - IB_EOTHER if the stored Lua stack in the module's connection data
- *               is NULL.
- *   - Other upon failure of callback registration.
- */
-static ib_status_t modlua_conn_fini_lua_runtime(ib_engine_t *ib,
-                                                ib_state_event_type_t event,
-                                                ib_conn_t *conn,
-                                                void *cbdata)
-{
-    assert(event == conn_finished_event);
-    assert(ib);
-    assert(conn);
-
-    ib_status_t rc;
-
-    modlua_runtime_t *modlua_runtime;
-
-    rc = modlua_runtime_get(conn, &modlua_runtime);
-    if (rc != IB_OK) {
-        ib_log_alert(ib, "Could not fetch per-connection Lua execution stack.");
-        return rc;
-    }
-    if (modlua_runtime == NULL) {
-        ib_log_alert(ib, "Stored Lua execution stack was unexpectedly NULL.");
-        return IB_EOTHER;
-    }
-
-    /* Atomically destroy the Lua stack */
-    rc = call_in_critical_section(ib, &ib_lua_join_thread, &modlua_runtime->L);
-
-    return rc;
-}
-
 /* -- External Rule Driver -- */
 
 static ib_status_t rules_lua_init(ib_engine_t *ib, ib_module_t *m, void *cbdata)
@@ -2276,18 +2588,17 @@ static ib_status_t rules_lua_init(ib_engine_t *ib, ib_module_t *m, void *cbdata)
 }
 
 /**
- * @brief Call the rule named @a func_name on a new Lua stack.
- * @details This will atomically create and destroy a lua_State*
- *          allowing for concurrent execution of @a func_name
- *          by a ib_lua_func_eval(ib_engine_t*, ib_txt_t*, const char*).
+ * @brief Call the rule named @a func_name on a Lua VM of the pool.
+ * @details The VM is used by this thread only until the rule returns,
+ *          allowing for concurrent execution of @a func_name.
  *
  * @param[in,out] rule_exec Rule execution environment
  * @param[in] func_name The Lua function name to call.
  * @param[out] result The result integer value. This should be set to
  *             1 (true) or 0 (false).
  *
- * @returns IB_OK on success, IB_EUNKNOWN on semaphore locking error, and
- *          IB_EALLOC is returned if a new execution stack cannot be created.
+ * @returns IB_OK on success, or the error of modlua_vm_checkout() or
+ *          ib_lua_func_eval_int().
  */
 static ib_status_t ib_lua_func_eval_r(const ib_rule_exec_t *rule_exec,
                                       const char *func_name,
@@ -2299,28 +2610,21 @@ static ib_status_t ib_lua_func_eval_r(const ib_rule_exec_t *rule_exec,
     ib_tx_t *tx = rule_exec->tx;
     int result_int;
     ib_status_t ib_rc;
-    lua_State *L;
-
-    /* Atomically create a new Lua stack */
-    ib_rc = call_in_critical_section(ib, &ib_lua_new_thread, &L);
+    modlua_vm_t *vm;
 
+    ib_rc = modlua_vm_checkout(ib, &vm);
     if (ib_rc != IB_OK) {
         return ib_rc;
     }
 
-    /* Call the rule in isolation. */
-    ib_rc = ib_lua_func_eval_int(rule_exec, ib, tx, L, func_name, &result_int);
+    ib_rc = ib_lua_func_eval_int(rule_exec, ib, tx, vm->L, func_name,
+                                 &result_int);
+
+    modlua_vm_checkin(vm);
 
     /* Convert the passed in integer type to an ib_num_t. */
     *result = result_int;
 
-    if (ib_rc != IB_OK) {
-        return ib_rc;
-    }
-
-    /* Atomically destroy the Lua stack */
-    ib_rc = call_in_critical_section(ib, &ib_lua_join_thread, &L);
-
     return ib_rc;
 }
 
@@ -2388,6 +2692,7 @@ ib_status_t modlua_rule_driver(
 
     ib_status_t rc;
     ib_operator_inst_t *op_inst;
+    modlua_replay_t replay;
 
     if (strncmp(tag, "lua", 3) != 0) {
         ib_cfg_log_error(cp, "Lua rule driver called for non-lua tag.");
@@ -2412,6 +2717,15 @@ ib_status_t modlua_rule_driver(
 
     ib_cfg_log_debug3(cp, "Loaded lua file %s", location);
 
+    memset(&replay, 0, sizeof(replay));
+    replay.type = MODLUA_REPLAY_RULE;
+    replay.file = location;
+    replay.name = ib_rule_id(rule);
+    rc = modlua_replay_add(cp->ib, &replay);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
     rc = ib_operator_register(cp->ib,
                               location,
                               IB_OP_FLAG_PHASE,
@@ -2465,32 +2779,37 @@ ib_status_t modlua_rule_driver(
 }
 
 /**
- * Initialize the ModLua Module.
+ * Create a Lua state with the ffi, api, etc. loaded.
  *
- * This will create a common "global" runtime into which various APIs
- * will be loaded.
+ * @param[in] ib IronBee engine.
+ * @param[out] L The new Lua state.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EUNKNOWN if the state could not be created.
+ *   - Errors of modlua_preload().
  */
-static ib_status_t modlua_init(ib_engine_t *ib,
-                               ib_module_t *m,
-                               void        *cbdata)
+static ib_status_t modlua_newstate(ib_engine_t *ib, lua_State **L)
 {
-    ib_status_t rc;
+    assert(ib);
+    assert(L);
 
-    /* Set up defaults */
-    modlua_global_cfg.L = NULL;
+    ib_status_t rc;
 
-    modlua_global_cfg.L = luaL_newstate();
-    if (modlua_global_cfg.L == NULL) {
-        ib_log_error(ib, "Failed to initialize lua module.");
+    *L = luaL_newstate();
+    if (*L == NULL) {
+        ib_log_error(ib, "Failed to create Lua state.");
         return IB_EUNKNOWN;
     }
 
-    luaL_openlibs(modlua_global_cfg.L);
+    luaL_openlibs(*L);
 
     /* Load ffi, api, etc. */
-    rc = modlua_preload(ib, modlua_global_cfg.L);
+    rc = modlua_preload(ib, *L);
     if (rc != IB_OK) {
         ib_log_error(ib, "Failed to pre-load Lua files.");
+        lua_close(*L);
+        *L = NULL;
         return rc;
     }
 
@@ -2500,39 +2819,46 @@ static ib_status_t modlua_init(ib_engine_t *ib,
             ib,
             "Using lua package.path=\"%s\"",
              modlua_global_cfg.pkg_path);
-        lua_getfield(modlua_global_cfg.L, -1, "path");
-        lua_pushstring(modlua_global_cfg.L, modlua_global_cfg.pkg_path);
-        lua_setglobal(modlua_global_cfg.L, "path");
+        lua_getfield(*L, -1, "path");
+        lua_pushstring(*L, modlua_global_cfg.pkg_path);
+        lua_setglobal(*L, "path");
     }
     if (modlua_global_cfg.pkg_cpath) {
         ib_log_debug(
             ib,
             "Using lua package.cpath=\"%s\"",
             modlua_global_cfg.pkg_cpath);
-        lua_getfield(modlua_global_cfg.L, -1, "cpath");
-        lua_pushstring(modlua_global_cfg.L, modlua_global_cfg.pkg_cpath);
-        lua_setglobal(modlua_global_cfg.L, "cpath");
+        lua_getfield(*L, -1, "cpath");
+        lua_pushstring(*L, modlua_global_cfg.pkg_cpath);
+        lua_setglobal(*L, "cpath");
     }
 
-    /* Hook to initialize the lua runtime with the connection.
-     * There is a modlua_conn_fini_lua_runtime which is only registered
-     * when the main configuration context is being closed. This ensures
-     * that it is the last hook to fire relative to the various
-     * Lua-implemented modules this module may created and register. */
-    rc = ib_hook_conn_register(
-        ib,
-        conn_started_event,
-        modlua_conn_init_lua_runtime,
-        NULL);
+    return IB_OK;
+}
+
+/**
+ * Initialize the ModLua Module.
+ *
+ * This will create a common "global" runtime into which various APIs
+ * will be loaded.  It is the configuration VM, and the first VM of the
+ * pool once configuration is finished.
+ */
+static ib_status_t modlua_init(ib_engine_t *ib,
+                               ib_module_t *m,
+                               void        *cbdata)
+{
+    ib_status_t rc;
+
+    /* Set up defaults */
+    modlua_global_cfg.L = NULL;
+
+    rc = modlua_newstate(ib, &modlua_global_cfg.L);
     if (rc != IB_OK) {
-        ib_log_error(
-            ib,
-            "Failed to register conn_started_event hook: %s",
-            ib_status_to_string(rc));
+        ib_log_error(ib, "Failed to initialize lua module.");
         return rc;
     }
 
-    /* Initialize lock to protect making new lua threads. */
+    /* Initialize lock to protect making new lua VMs. */
     /* NOTE: To avoid any confusion as to whether the lock
      *       is thread-safe or all copies of the lock structure
      *       are thread safe we use a pointer to a lock structure
@@ -2549,6 +2875,12 @@ static ib_status_t modlua_init(ib_engine_t *ib,
         return rc;
     }
 
+    rc = modlua_vm_pool_create(modlua_global_cfg.L, &modlua_global_cfg.pool);
+    if (rc != IB_OK) {
+        ib_log_error(ib, "Failed to initialize lua VM pool.");
+        return rc;
+    }
+
     /* Set up rule support. */
     rc = rules_lua_init(ib, m, cbdata);
     if (rc != IB_OK) {
@@ -2567,20 +2899,21 @@ static ib_status_t modlua_context_close(ib_engine_t  *ib,
 
     /* Close of the main context signifies configuration finished. */
     if (ib_context_type(ctx) == IB_CTYPE_MAIN) {
+        modlua_cfg_t *cfg;
 
-        /* Register this callback after the main context is closed.
-         * This allows it to be executed LAST allowing all the Lua
-         * modules created during configuration to be executed first. */
-        rc = ib_hook_conn_register(
-            ib,
-            conn_finished_event,
-            modlua_conn_fini_lua_runtime,
-            NULL);
+        rc = ib_context_module_config(ctx, m, &cfg);
+        if (rc != IB_OK) {
+            ib_log_error(ib, "Failed to retrieve lua configuration.");
+            return rc;
+        }
+
+        rc = modlua_vm_pool_ready(ib, cfg->pool_size);
         if (rc != IB_OK) {
             ib_log_error(
                 ib,
-                "Failed to register conn_finished_event hook: %s",
+                "Failed to initialize lua VM pool: %s",
                 ib_status_to_string(rc));
+            return rc;
         }
     }
 
@@ -2603,6 +2936,12 @@ static IB_CFGMAP_INIT_STRUCTURE(modlua_config_map) = {
         modlua_cfg_t,
         pkg_cpath
     ),
+    IB_CFGMAP_INIT_ENTRY(
+        MODULE_NAME_STR ".pool_size",
+        IB_FTYPE_NUM,
+        modlua_cfg_t,
+        pool_size
+    ),
 
     IB_CFGMAP_INIT_LAST
 };
@@ -2728,6 +3067,26 @@ static ib_status_t modlua_dir_param1(ib_cfgparser_t *cp,
         free(p1_unescaped);
         return rc;
     }
+    else if (strcasecmp("LuaVMPoolSize", name) == 0) {
+        char *end;
+        long long size;
+
+        errno = 0;
+        size = strtoll(p1_unescaped, &end, 10);
+        if ( (errno != 0) || (*end != '\0') || (end == p1_unescaped) ||
+             (size < 0) )
+        {
+            ib_cfg_log_error(cp, "Invalid %s: %s", name, p1_unescaped);
+            free(p1_unescaped);
+            return IB_EINVAL;
+        }
+        ib_log_debug2(ib, "%s: %lld", name, size);
+        rc = ib_context_set_num(ib_context_main(ib),
+                                MODULE_NAME_STR ".pool_size",
+                                size);
+        free(p1_unescaped);
+        return rc;
+    }
     else {
         ib_log_error(ib, "Unhandled directive: %s %s", name, p1_unescaped);
         free(p1_unescaped);
@@ -2755,16 +3114,26 @@ static IB_DIRMAP_INIT_STRUCTURE(modlua_directive_map) = {
         modlua_dir_param1,
         NULL
     ),
+    IB_DIRMAP_INIT_PARAM1(
+        "LuaVMPoolSize",
+        modlua_dir_param1,
+        NULL
+    ),
 
     /* End */
     IB_DIRMAP_INIT_LAST
 };
 
 /**
- * Destroy global lock and Lua state.
+ * Destroy global lock, Lua VM pool and Lua state.
  */
 static ib_status_t modlua_fini(ib_engine_t *ib, ib_module_t *m, void *cbdata) {
 
+    if (modlua_global_cfg.pool != NULL) {
+        modlua_vm_pool_destroy(modlua_global_cfg.pool);
+        modlua_global_cfg.pool = NULL;
+    }
+
     ib_lock_destroy(modlua_global_cfg.L_lck);
     free(modlua_global_cfg.L_lck);
     modlua_global_cfg.L_lck = NULL;
@@ -42,6 +42,7 @@
 #pragma clang diagnostic ignored "-Wundef"
 #endif
 #include <htp.h>
+#include <htp_hybrid.h>
 #ifdef __clang__
 #pragma clang diagnostic pop
 #endif
@@ -1754,8 +1755,51 @@ typedef struct modhtp_header_data {
         write_fn,
         (ib_provider_inst_t *pi, ib_conndata_t *cdata)
     );
+    /* LibHTP transaction to add headers to directly, or NULL. */
+    htp_tx_t *tx;
+    int (*add_fn)(htp_tx_t *tx,
+                  const char *name, size_t name_len,
+                  const char *value, size_t value_len);
 } modhtp_header_data;
 
+/**
+ * Get the libhtp transaction that headers can be added to directly.
+ *
+ * @param[in] itx IronBee transaction
+ * @param[in] request Request (true) or response (false) headers?
+ *
+ * @returns The libhtp transaction, or NULL if the headers must be sent to
+ *          the parser as data.
+ */
+static htp_tx_t *modhtp_direct_header_tx(ib_tx_t *itx, bool request)
+{
+    modhtp_context_t *modctx;
+    htp_connp_t *htp;
+    htp_tx_t *tx;
+
+    modctx = (modhtp_context_t *)ib_conn_parser_context_get(itx->conn);
+    htp = modctx->htp;
+
+    /* The parser must be healthy and parsing this transaction. */
+    if (request) {
+        if (htp->in_status != STREAM_STATE_DATA) {
+            return NULL;
+        }
+        tx = htp->in_tx;
+    }
+    else {
+        if (htp->out_status != STREAM_STATE_DATA) {
+            return NULL;
+        }
+        tx = htp->out_tx;
+    }
+    if ( (tx == NULL) || (htp_tx_get_user_data(tx) != itx) ) {
+        return NULL;
+    }
+
+    return tx;
+}
+
 /* Send header data to libhtp via this header iteration callback. */
 static ib_status_t modhtp_send_header_data(const char *name,
                                            size_t name_len,
@@ -1765,9 +1809,24 @@ static ib_status_t modhtp_send_header_data(const char *name,
 {
     assert(user_data != NULL);
 
-    const modhtp_header_data *data = (const modhtp_header_data *)user_data;
+    modhtp_header_data *data = (modhtp_header_data *)user_data;
     ib_status_t rc;
 
+    /* Add the header to the libhtp transaction directly, rather than
+     * serializing it for the parser to parse again. */
+    if (data->tx != NULL) {
+        int ec = data->add_fn(data->tx, name, name_len, value, value_len);
+        if (ec == HTP_OK) {
+            return IB_OK;
+        }
+        else if (ec == HTP_ERROR) {
+            return IB_EALLOC;
+        }
+
+        /* Declined: the parser sees this and any later headers as data. */
+        data->tx = NULL;
+    }
+
     /* Write header name to libhtp. */
     data->conndata->dlen = name_len;
     data->conndata->data = (uint8_t *)name;
@@ -1824,6 +1883,8 @@ static ib_status_t modhtp_iface_request_header_data(ib_provider_inst_t *pi,
     cbdata.pi = pi;
     cbdata.conndata = &conndata;
     cbdata.write_fn = modhtp_iface_data_in;
+    cbdata.tx = modhtp_direct_header_tx(itx, true);
+    cbdata.add_fn = htp_txh_req_add_header;
 
     rc = ib_parsed_tx_each_header(header,
                                   modhtp_send_header_data,
@@ -1975,6 +2036,8 @@ static ib_status_t modhtp_iface_response_header_data(ib_provider_inst_t *pi,
     cbdata.pi = pi;
     cbdata.conndata = &conndata;
     cbdata.write_fn = modhtp_iface_data_out;
+    cbdata.tx = modhtp_direct_header_tx(itx, false);
+    cbdata.add_fn = htp_txh_res_add_header;
 
     rc = ib_parsed_tx_each_header(header,
                                   modhtp_send_header_data,
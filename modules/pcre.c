@@ -24,12 +24,16 @@
  * @author Brian Rectanus <brectanus@qualys.com>
  */
 
+#include <ironbee/ahocorasick.h>
 #include <ironbee/bytestr.h>
 #include <ironbee/capture.h>
 #include <ironbee/cfgmap.h>
 #include <ironbee/engine.h>
 #include <ironbee/escape.h>
 #include <ironbee/field.h>
+#include <ironbee/hash.h>
+#include <ironbee/list.h>
+#include <ironbee/lock.h>
 #include <ironbee/module.h>
 #include <ironbee/mpool.h>
 #include <ironbee/operator.h>
@@ -41,6 +45,8 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -57,7 +63,8 @@
 
 /* PCRE can use an independent stack or the machine stack.
  * If PCRE_JIT_STACK is true (conditional on PCRE_HAVE_JIT being true)
- * then pcrejit will use an independent stack. If PCRE_JIT_STACK is not
+ * then pcrejit will use an independent stack, one per thread, which is
+ * reused across calls and transactions. If PCRE_JIT_STACK is not
  * defined then the machine stack will be used.  */
 #ifdef PCRE_HAVE_JIT
 #define PCRE_JIT_STACK
@@ -80,6 +87,14 @@ const int PCRE_JIT_STACK_MAX_MULT   = 512;
  */
 #define WORKSPACE_SIZE_DEFAULT (WORKSPACE_SIZE_MIN * 10)
 
+/**
+ * Minimum length of a required literal used by the prefilter.
+ *
+ * Shorter literals are present in almost every subject, so scanning for
+ * them costs more than it saves.
+ */
+#define PREFILTER_LITERAL_MIN  3
+
 /* Define the public module symbol. */
 IB_MODULE_DECLARE();
 
@@ -94,8 +109,39 @@ typedef struct modpcre_cfg_t {
     ib_num_t       jit_stack_start;       /**< Starting JIT stack size */
     ib_num_t       jit_stack_max;         /**< Max JIT stack size */
     ib_num_t       dfa_workspace_size;    /**< Size of DFA workspace */
+    ib_num_t       prefilter;             /**< Bool: Use literal prefilter */
 } modpcre_cfg_t;
 
+#ifdef PCRE_JIT_STACK
+/**
+ * A thread's JIT stack.
+ */
+typedef struct modpcre_jit_tls_t modpcre_jit_tls_t;
+struct modpcre_jit_tls_t {
+    pcre_jit_stack      *stack;           /**< The stack (or NULL) */
+    int                  stack_max;       /**< Max size of @a stack */
+    struct modpcre_jit_cache_t *cache;    /**< Owning cache */
+    modpcre_jit_tls_t   *next;            /**< Next in list of all stacks */
+};
+
+/**
+ * Per-engine cache of per-thread JIT stacks.
+ *
+ * Stacks are handed to PCRE through the JIT stack callback, so a thread
+ * allocates its stack once and then reuses it for every JIT match.  A
+ * stack is only replaced when a pattern needs a larger maximum size.
+ */
+typedef struct modpcre_jit_cache_t {
+    pthread_key_t        key;             /**< Thread key for stacks */
+    ib_lock_t            lock;            /**< Protects the fields below */
+    modpcre_jit_tls_t   *stacks;          /**< All thread stacks */
+    uint64_t             created;         /**< Stacks allocated */
+    uint64_t             grown;           /**< Stacks replaced by larger */
+    uint64_t             failed;          /**< Failed stack allocations */
+    uint64_t             fallbacks;       /**< Interpreter fallbacks */
+} modpcre_jit_cache_t;
+#endif
+
 /**
  * Internal representation of PCRE compiled patterns.
  */
@@ -110,16 +156,74 @@ typedef struct modpcre_cpat_data_t {
     int                  jit_stack_start; /**< Starting JIT stack size */
     int                  jit_stack_max;   /**< Max JIT stack size */
     int                  dfa_ws_size;     /**< Size of DFA workspace */
+#ifdef PCRE_JIT_STACK
+    modpcre_jit_cache_t *jit_cache;       /**< JIT stack cache (or NULL) */
+#endif
 } modpcre_cpat_data_t;
 
+/**
+ * A literal that must be present in a subject for a pattern to match.
+ */
+typedef struct modpcre_literal_t {
+    const char          *str;             /**< Literal text */
+    size_t               len;             /**< Length of @a str */
+    size_t               id;              /**< Index into prefilter bitmaps */
+} modpcre_literal_t;
+
+/**
+ * Per-engine literal prefilter.
+ *
+ * The required literals of all rx patterns are collected while rules are
+ * created and compiled into a single case-insensitive Aho-Corasick
+ * automaton when the main context is closed.  A subject value is scanned
+ * once per transaction and the set of literals seen is cached; patterns
+ * whose literal was not seen are not executed.
+ */
+typedef struct modpcre_prefilter_t {
+    ib_mpool_t          *mp;              /**< Engine main memory pool */
+    ib_hash_t           *literal_hash;    /**< Literal text -> literal */
+    ib_list_t           *literals;        /**< List of modpcre_literal_t */
+    ib_ac_t             *ac;              /**< Automaton (or NULL) */
+    size_t               ac_literals;     /**< Literals in @a ac */
+} modpcre_prefilter_t;
+
+/**
+ * Per-engine module data.
+ */
+typedef struct modpcre_data_t {
+    modpcre_prefilter_t  prefilter;       /**< Literal prefilter */
+#ifdef PCRE_JIT_STACK
+    modpcre_jit_cache_t  jit_cache;       /**< JIT stack cache */
+#endif
+} modpcre_data_t;
+
 /**
  * PCRE and DFA rule data types are an alias for the compiled pattern structure.
  */
 typedef struct modpcre_rule_data_t {
     modpcre_cpat_data_t *cpdata;          /**< Compiled pattern data */
     const char          *id;              /**< ID for DFA rules */
+    modpcre_prefilter_t *prefilter;       /**< Prefilter (or NULL) */
+    const modpcre_literal_t *literal;     /**< Required literal (or NULL) */
 } modpcre_rule_data_t;
 
+/**
+ * Per-transaction module data.
+ */
+typedef struct modpcre_tx_data_t {
+    ib_hash_t           *dfa_workspaces;  /**< DFA rule id -> workspace */
+    ib_hash_t           *prefilter_cache; /**< Subject -> literal bitmap */
+    ib_rule_phase_num_t  prefilter_phase; /**< Phase of prefilter_cache */
+} modpcre_tx_data_t;
+
+/**
+ * Key of the per-transaction prefilter cache.
+ */
+typedef struct modpcre_subject_key_t {
+    const char          *ptr;             /**< Subject data */
+    size_t               len;             /**< Subject length */
+} modpcre_subject_key_t;
+
 /* Instantiate a module global configuration. */
 static modpcre_cfg_t modpcre_global_cfg = {
     1,                      /* study */
@@ -128,9 +232,190 @@ static modpcre_cfg_t modpcre_global_cfg = {
     5000,                   /* match_limit_recursion */
     0,                      /* jit_stack_start; 0 means auto */
     0,                      /* jit_stack_max; 0 means auto */
-    WORKSPACE_SIZE_DEFAULT  /* dfa_workspace_size */
+    WORKSPACE_SIZE_DEFAULT, /* dfa_workspace_size */
+    1                       /* prefilter */
 };
 
+#ifdef PCRE_JIT_STACK
+/* -- JIT Stack Cache -- */
+
+/**
+ * Increment a JIT stack cache counter.
+ *
+ * @param[in] cache The JIT stack cache.
+ * @param[in,out] counter The counter (a member of @a cache).
+ */
+static void jit_cache_count(modpcre_jit_cache_t *cache, uint64_t *counter)
+{
+    assert(cache != NULL);
+    assert(counter != NULL);
+
+    if (ib_lock_lock(&cache->lock) == IB_OK) {
+        ++(*counter);
+        ib_lock_unlock(&cache->lock);
+    }
+}
+
+/**
+ * Release the JIT stack of an exiting thread.
+ *
+ * @param[in] data The thread's modpcre_jit_tls_t.
+ */
+static void jit_cache_thread_exit(void *data)
+{
+    modpcre_jit_tls_t *tls = (modpcre_jit_tls_t *)data;
+    modpcre_jit_cache_t *cache = tls->cache;
+    modpcre_jit_tls_t **pnext;
+
+    if (ib_lock_lock(&cache->lock) == IB_OK) {
+        for (pnext = &cache->stacks; *pnext != NULL; pnext = &(*pnext)->next) {
+            if (*pnext == tls) {
+                *pnext = tls->next;
+                break;
+            }
+        }
+        ib_lock_unlock(&cache->lock);
+    }
+
+    if (tls->stack != NULL) {
+        pcre_jit_stack_free(tls->stack);
+    }
+    free(tls);
+}
+
+/**
+ * PCRE JIT stack callback: return the calling thread's stack.
+ *
+ * The stack is allocated on first use and grown if @a cbdata needs a
+ * larger maximum size than the current stack has.  If no stack can be
+ * allocated, NULL is returned and PCRE falls back to its small
+ * machine-stack area.
+ *
+ * @param[in] cbdata The modpcre_cpat_data_t being executed.
+ *
+ * @returns The stack to use.
+ */
+static pcre_jit_stack *jit_cache_stack(void *cbdata)
+{
+    const modpcre_cpat_data_t *cpdata = (const modpcre_cpat_data_t *)cbdata;
+    modpcre_jit_cache_t *cache = cpdata->jit_cache;
+    modpcre_jit_tls_t *tls;
+    pcre_jit_stack *stack;
+
+    tls = (modpcre_jit_tls_t *)pthread_getspecific(cache->key);
+    if ( (tls != NULL) &&
+         (tls->stack != NULL) &&
+         (tls->stack_max >= cpdata->jit_stack_max) )
+    {
+        return tls->stack;
+    }
+
+    if (tls == NULL) {
+        tls = (modpcre_jit_tls_t *)calloc(1, sizeof(*tls));
+        if (tls == NULL) {
+            jit_cache_count(cache, &cache->failed);
+            return NULL;
+        }
+        if (pthread_setspecific(cache->key, tls) != 0) {
+            free(tls);
+            jit_cache_count(cache, &cache->failed);
+            return NULL;
+        }
+        tls->cache = cache;
+        if (ib_lock_lock(&cache->lock) == IB_OK) {
+            tls->next = cache->stacks;
+            cache->stacks = tls;
+            ib_lock_unlock(&cache->lock);
+        }
+    }
+
+    stack = pcre_jit_stack_alloc(cpdata->jit_stack_start,
+                                 cpdata->jit_stack_max);
+    if (stack == NULL) {
+        /* Keep using the smaller stack, if there is one. */
+        jit_cache_count(cache, &cache->failed);
+        return tls->stack;
+    }
+
+    if (tls->stack != NULL) {
+        pcre_jit_stack_free(tls->stack);
+        jit_cache_count(cache, &cache->grown);
+    }
+    else {
+        jit_cache_count(cache, &cache->created);
+    }
+    tls->stack = stack;
+    tls->stack_max = cpdata->jit_stack_max;
+
+    return stack;
+}
+
+/**
+ * Initialize a JIT stack cache.
+ *
+ * @param[in] cache The JIT stack cache.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EUNKNOWN if the thread key or lock could not be created.
+ */
+static ib_status_t jit_cache_init(modpcre_jit_cache_t *cache)
+{
+    assert(cache != NULL);
+
+    ib_status_t rc;
+
+    memset(cache, 0, sizeof(*cache));
+
+    rc = ib_lock_init(&cache->lock);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    if (pthread_key_create(&cache->key, jit_cache_thread_exit) != 0) {
+        ib_lock_destroy(&cache->lock);
+        return IB_EUNKNOWN;
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Destroy a JIT stack cache, releasing the stacks of all threads.
+ *
+ * @param[in] ib IronBee engine for logging.
+ * @param[in] cache The JIT stack cache.
+ */
+static void jit_cache_destroy(ib_engine_t *ib, modpcre_jit_cache_t *cache)
+{
+    assert(ib != NULL);
+    assert(cache != NULL);
+
+    modpcre_jit_tls_t *tls;
+    modpcre_jit_tls_t *next;
+
+    ib_log_info(ib,
+                "PCRE JIT stacks: created=%" PRIu64 " grown=%" PRIu64
+                " failed=%" PRIu64 " interpreter-fallbacks=%" PRIu64,
+                cache->created, cache->grown,
+                cache->failed, cache->fallbacks);
+
+    /* No destructors run once the key is deleted. */
+    pthread_key_delete(cache->key);
+
+    for (tls = cache->stacks; tls != NULL; tls = next) {
+        next = tls->next;
+        if (tls->stack != NULL) {
+            pcre_jit_stack_free(tls->stack);
+        }
+        free(tls);
+    }
+    cache->stacks = NULL;
+
+    ib_lock_destroy(&cache->lock);
+}
+#endif /* PCRE_JIT_STACK */
+
 /**
  * Internal compilation of the modpcre pattern.
  *
@@ -288,113 +573,781 @@ static ib_status_t pcre_compile_internal(ib_engine_t *ib,
         return IB_EALLOC;
     }
 
-    /* Copy compiled pattern. */
-    cpdata->cpatt = ib_mpool_memdup(pool, cpatt, cpatt_sz);
-    pcre_free(cpatt);
-    if (cpdata->cpatt == NULL) {
-        pcre_free(edata);
-        ib_log_error(ib, "Failed to duplicate pattern of size: %zd", cpatt_sz);
-        return IB_EALLOC;
+    /* Copy compiled pattern. */
+    cpdata->cpatt = ib_mpool_memdup(pool, cpatt, cpatt_sz);
+    pcre_free(cpatt);
+    if (cpdata->cpatt == NULL) {
+        pcre_free(edata);
+        ib_log_error(ib, "Failed to duplicate pattern of size: %zd", cpatt_sz);
+        return IB_EALLOC;
+    }
+    ib_log_debug(ib, "PCRE copied cpatt @ %p -> %p (%zd bytes)",
+                 (void *)cpatt, (void *)cpdata->cpatt, cpatt_sz);
+
+    /* Copy extra data (study data). */
+    if (edata != NULL) {
+
+        /* Copy edata. */
+        cpdata->edata = ib_mpool_memdup(pool, edata, sizeof(*edata));
+        if (cpdata->edata == NULL) {
+            pcre_free(edata);
+            ib_log_error(ib, "Failed to duplicate edata.");
+            return IB_EALLOC;
+        }
+
+        /* Copy edata->study_data. */
+        if (edata->study_data != NULL) {
+            cpdata->edata->study_data =
+                ib_mpool_memdup(pool, edata->study_data, study_data_sz);
+
+            if (cpdata->edata->study_data == NULL) {
+                ib_log_error(ib, "Failed to study data of size: %zd",
+                             study_data_sz);
+                pcre_free(edata);
+                return IB_EALLOC;
+            }
+        }
+        pcre_free(edata);
+    }
+    else {
+        cpdata->edata = ib_mpool_calloc(pool, 1, sizeof(*edata));
+        if (cpdata->edata == NULL) {
+            pcre_free(edata);
+            ib_log_error(ib, "Failed to allocate edata.");
+            return IB_EALLOC;
+        }
+    }
+
+    /* Set the PCRE limits for non-DFA patterns */
+    if (! is_dfa) {
+        cpdata->edata->flags |=
+            (PCRE_EXTRA_MATCH_LIMIT | PCRE_EXTRA_MATCH_LIMIT_RECURSION);
+        cpdata->edata->match_limit =
+            (unsigned long)config->match_limit;
+        cpdata->edata->match_limit_recursion =
+            (unsigned long)config->match_limit_recursion;
+        cpdata->dfa_ws_size = 0;
+    }
+    else {
+        cpdata->edata->match_limit = 0U;
+        cpdata->edata->match_limit_recursion = 0U;
+        cpdata->dfa_ws_size = (int)config->dfa_workspace_size;
+    }
+
+    /* Set stack limits for JIT */
+    if (cpdata->is_jit) {
+#ifdef PCRE_HAVE_JIT
+        if (config->jit_stack_start == 0U) {
+            cpdata->jit_stack_start =
+                PCRE_JIT_STACK_START_MULT * config->match_limit_recursion;
+        }
+        else {
+            cpdata->jit_stack_start = (int)config->jit_stack_start;
+        }
+        if (config->jit_stack_max == 0U) {
+            cpdata->jit_stack_max =
+                PCRE_JIT_STACK_MAX_MULT * config->match_limit_recursion;
+        }
+        else {
+            cpdata->jit_stack_max = (int)config->jit_stack_max;
+        }
+#endif
+    }
+    else {
+        cpdata->jit_stack_start = 0;
+        cpdata->jit_stack_max = 0;
+    }
+
+#ifdef PCRE_JIT_STACK
+    /* Have PCRE get the stack of the executing thread from the cache */
+    if (cpdata->is_jit) {
+        ib_module_t *module;
+
+        if (ib_engine_module_get(ib, MODULE_NAME_STR, &module) == IB_OK) {
+            modpcre_data_t *mod_data = (modpcre_data_t *)module->data;
+
+            cpdata->jit_cache = &mod_data->jit_cache;
+            pcre_assign_jit_stack(cpdata->edata, jit_cache_stack, cpdata);
+        }
+    }
+#endif
+
+    ib_log_trace(ib,
+                 "Compiled pcre pattern \"%s\": "
+                 "cpatt=%p edata=%p limit=%ld rlimit=%ld study=%p "
+                 "dfa=%s dfa-ws-sz=%d "
+                 "jit=%s jit-stack: start=%d max=%d",
+                 patt,
+                 (void *)cpdata->cpatt,
+                 (void *)cpdata->edata,
+                 cpdata->edata->match_limit,
+                 cpdata->edata->match_limit_recursion,
+                 cpdata->edata->study_data,
+                 cpdata->is_dfa ? "yes" : "no",
+                 cpdata->dfa_ws_size,
+                 cpdata->is_jit ? "yes" : "no",
+                 cpdata->jit_stack_start,
+                 cpdata->jit_stack_max);
+    *pcpdata = cpdata;
+
+    return IB_OK;
+}
+
+
+/* -- Literal Prefilter -- */
+
+/**
+ * Skip past a bracketed character class.
+ *
+ * @param[in] p Pointer to the opening '['.
+ *
+ * @returns Pointer to the character following the closing ']', or NULL
+ *          if the class is not terminated.
+ */
+static const char *prefilter_skip_class(const char *p)
+{
+    assert(p != NULL);
+    assert(*p == '[');
+
+    ++p;
+    if (*p == '^') {
+        ++p;
+    }
+    /* A leading ']' is a literal member of the class. */
+    if (*p == ']') {
+        ++p;
+    }
+
+    while (*p != '\0') {
+        if (*p == '\\') {
+            if (*(p + 1) == '\0') {
+                return NULL;
+            }
+            p += 2;
+        }
+        else if ( (*p == '[') && (*(p + 1) == ':') ) {
+            const char *end = strstr(p + 2, ":]");
+            if (end == NULL) {
+                return NULL;
+            }
+            p = end + 2;
+        }
+        else if (*p == ']') {
+            return p + 1;
+        }
+        else {
+            ++p;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Skip past a parenthesized group.
+ *
+ * @param[in] p Pointer to the opening '('.
+ *
+ * @returns Pointer to the character following the closing ')', or NULL
+ *          if the group is not terminated or uses extended mode.
+ */
+static const char *prefilter_skip_group(const char *p)
+{
+    assert(p != NULL);
+    assert(*p == '(');
+
+    int depth = 0;
+
+    while (*p != '\0') {
+        if (*p == '\\') {
+            if (*(p + 1) == '\0') {
+                return NULL;
+            }
+            p += 2;
+        }
+        else if (*p == '[') {
+            p = prefilter_skip_class(p);
+            if (p == NULL) {
+                return NULL;
+            }
+        }
+        else if (*p == '(') {
+            /* Option settings such as (?x) change how literals are
+             * parsed; give up rather than guess. */
+            if (*(p + 1) == '?') {
+                const char *o;
+                for (o = p + 2; isalpha((unsigned char)*o) || (*o == '-'); ++o) {
+                    if (*o == 'x') {
+                        return NULL;
+                    }
+                }
+            }
+            ++depth;
+            ++p;
+        }
+        else if (*p == ')') {
+            ++p;
+            if (--depth == 0) {
+                return p;
+            }
+        }
+        else {
+            ++p;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Parse an escape sequence outside of a character class.
+ *
+ * @param[in] p Pointer to the backslash.
+ * @param[out] c The literal character, if @a is_literal is set.
+ * @param[out] is_literal Set to true if the escape is a literal character.
+ *
+ * @returns Pointer to the character following the escape sequence, or NULL
+ *          if the escape is not understood.
+ */
+static const char *prefilter_escape(const char *p, char *c, bool *is_literal)
+{
+    assert(p != NULL);
+    assert(*p == '\\');
+    assert(c != NULL);
+    assert(is_literal != NULL);
+
+    const char *close;
+    char e = *(p + 1);
+
+    *is_literal = false;
+    p += 2;
+
+    /* Escaped punctuation is a literal. */
+    if ( (e != '\0') && ! isalnum((unsigned char)e) ) {
+        *c = e;
+        *is_literal = true;
+        return p;
+    }
+
+    switch (e) {
+    case 'n': *c = '\n';   *is_literal = true; return p;
+    case 'r': *c = '\r';   *is_literal = true; return p;
+    case 't': *c = '\t';   *is_literal = true; return p;
+    case 'f': *c = '\f';   *is_literal = true; return p;
+    case 'e': *c = '\x1b'; *is_literal = true; return p;
+    case 'a': *c = '\a';   *is_literal = true; return p;
+
+    /* Classes and assertions */
+    case 'd': case 'D': case 'w': case 'W': case 's': case 'S':
+    case 'h': case 'H': case 'v': case 'V': case 'R': case 'X':
+    case 'b': case 'B': case 'A': case 'z': case 'Z': case 'G':
+    case 'K': case 'C':
+        return p;
+
+    /* Character codes and back references */
+    case 'x':
+        if (*p == '{') {
+            break;
+        }
+        /* Up to two hex digits */
+        if (isxdigit((unsigned char)*p)) {
+            ++p;
+            if (isxdigit((unsigned char)*p)) {
+                ++p;
+            }
+        }
+        return p;
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+        while (isdigit((unsigned char)*p)) {
+            ++p;
+        }
+        return p;
+    case 'c':
+        return (*p == '\0') ? NULL : p + 1;
+    case 'g':
+        if ( (*p == '<') || (*p == '\'') || (*p == '{') ) {
+            break;
+        }
+        if ( (*p == '-') || (*p == '+') ) {
+            ++p;
+        }
+        while (isdigit((unsigned char)*p)) {
+            ++p;
+        }
+        return p;
+    case 'p': case 'P':
+        if (*p != '{') {
+            return (*p == '\0') ? NULL : p + 1;
+        }
+        break;
+    case 'k':
+        break;
+    default:
+        return NULL;
+    }
+
+    /* Delimited argument: \x{..}, \g{..}, \k<..>, \p{..} etc. */
+    switch (*p) {
+    case '{':  close = strchr(p, '}');  break;
+    case '<':  close = strchr(p, '>');  break;
+    case '\'': close = strchr(p + 1, '\''); break;
+    default:   close = NULL;            break;
+    }
+
+    return (close == NULL) ? NULL : close + 1;
+}
+
+/**
+ * Parse a quantifier.
+ *
+ * @param[in] p Pointer to the character following an atom.
+ * @param[out] optional Set to true if the quantifier allows zero
+ *             repetitions of the atom.
+ *
+ * @returns Pointer to the character following the quantifier (and any
+ *          lazy / possessive modifier), or @a p if there is none.
+ */
+static const char *prefilter_quantifier(const char *p, bool *optional)
+{
+    assert(p != NULL);
+    assert(optional != NULL);
+
+    const char *q = p;
+
+    *optional = false;
+
+    if ( (*q == '*') || (*q == '?') ) {
+        *optional = true;
+        ++q;
+    }
+    else if (*q == '+') {
+        ++q;
+    }
+    else if ( (*q == '{') && isdigit((unsigned char)*(q + 1)) ) {
+        /* Only {n}, {n,} and {n,m} are quantifiers; anything else
+         * is a literal '{'. */
+        const char *d = q + 1;
+        bool zero = true;
+
+        for (; isdigit((unsigned char)*d); ++d) {
+            if (*d != '0') {
+                zero = false;
+            }
+        }
+        if (*d == ',') {
+            for (++d; isdigit((unsigned char)*d); ++d) {
+                /* Nothing */
+            }
+        }
+        if (*d != '}') {
+            return p;
+        }
+        *optional = zero;
+        q = d + 1;
+    }
+    else {
+        return p;
+    }
+
+    if ( (*q == '?') || (*q == '+') ) {
+        ++q;
+    }
+
+    return q;
+}
+
+/**
+ * Extract the longest literal that must appear in any subject matched
+ * by @a patt.
+ *
+ * The parser is conservative: anything it does not fully understand
+ * ends the current literal run, and constructs that make every run
+ * optional (top level alternation, \\Q quoting, extended mode) cause
+ * no literal to be returned at all.
+ *
+ * @param[in] mp Memory pool to allocate the literal from.
+ * @param[in] patt Regular expression.
+ * @param[out] literal Longest required literal (NUL terminated).
+ * @param[out] literal_len Length of @a literal.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_ENOENT if no usable literal exists.
+ *   - IB_EALLOC on allocation failure.
+ */
+static ib_status_t prefilter_extract(ib_mpool_t *mp,
+                                     const char *patt,
+                                     const char **literal,
+                                     size_t *literal_len)
+{
+    assert(mp != NULL);
+    assert(patt != NULL);
+    assert(literal != NULL);
+    assert(literal_len != NULL);
+
+    size_t patt_len = strlen(patt);
+    char *run;
+    char *best;
+    size_t run_len = 0;
+    size_t best_len = 0;
+    const char *p = patt;
+
+    /* Quoted sequences can hide any metacharacter from the parser. */
+    if (strstr(patt, "\\Q") != NULL) {
+        return IB_ENOENT;
+    }
+
+    run = ib_mpool_alloc(mp, patt_len + 1);
+    best = ib_mpool_alloc(mp, patt_len + 1);
+    if ( (run == NULL) || (best == NULL) ) {
+        return IB_EALLOC;
+    }
+
+    while (*p != '\0') {
+        const char *next;
+        bool is_literal = false;
+        bool optional;
+        char c = '\0';
+
+        if (*p == '\\') {
+            next = prefilter_escape(p, &c, &is_literal);
+        }
+        else if (*p == '[') {
+            next = prefilter_skip_class(p);
+        }
+        else if (*p == '(') {
+            next = prefilter_skip_group(p);
+        }
+        else if ( (*p == '|') || (*p == ')') ) {
+            return IB_ENOENT;
+        }
+        else if ( (*p == '.') || (*p == '^') || (*p == '$') ) {
+            next = p + 1;
+        }
+        else if ( (*p == '*') || (*p == '+') || (*p == '?') ) {
+            /* Quantifier without an atom; let PCRE be the judge. */
+            return IB_ENOENT;
+        }
+        else {
+            c = *p;
+            is_literal = true;
+            next = p + 1;
+        }
+
+        if (next == NULL) {
+            return IB_ENOENT;
+        }
+
+        p = prefilter_quantifier(next, &optional);
+        if (is_literal && ! optional) {
+            run[run_len++] = c;
+        }
+
+        /* Anything but a plain literal ends the current run. */
+        if ( (! is_literal) || (p != next) ) {
+            if (run_len > best_len) {
+                memcpy(best, run, run_len);
+                best_len = run_len;
+            }
+            run_len = 0;
+        }
+    }
+
+    if (run_len > best_len) {
+        memcpy(best, run, run_len);
+        best_len = run_len;
+    }
+
+    if (best_len < PREFILTER_LITERAL_MIN) {
+        return IB_ENOENT;
+    }
+
+    best[best_len] = '\0';
+    *literal = best;
+    *literal_len = best_len;
+
+    return IB_OK;
+}
+
+/**
+ * Register the required literal of a pattern with the prefilter.
+ *
+ * Literals are shared between patterns (compared case-insensitively).
+ *
+ * @param[in] ib IronBee engine for logging.
+ * @param[in] prefilter The prefilter.
+ * @param[in] patt Regular expression.
+ * @param[out] pliteral The literal, or NULL if @a patt has none.
+ *
+ * @returns
+ *   - IB_OK on success (even if no literal was found).
+ *   - IB_EALLOC on allocation failure.
+ */
+static ib_status_t prefilter_add_pattern(ib_engine_t *ib,
+                                         modpcre_prefilter_t *prefilter,
+                                         const char *patt,
+                                         const modpcre_literal_t **pliteral)
+{
+    assert(ib != NULL);
+    assert(prefilter != NULL);
+    assert(patt != NULL);
+    assert(pliteral != NULL);
+
+    ib_status_t rc;
+    modpcre_literal_t *literal;
+    const char *str;
+    size_t len;
+
+    *pliteral = NULL;
+
+    rc = prefilter_extract(prefilter->mp, patt, &str, &len);
+    if (rc == IB_ENOENT) {
+        ib_log_debug2(ib, "PCRE prefilter: no literal in \"%s\"", patt);
+        return IB_OK;
+    }
+    else if (rc != IB_OK) {
+        return rc;
+    }
+
+    rc = ib_hash_get_ex(prefilter->literal_hash, &literal, str, len);
+    if (rc == IB_ENOENT) {
+        literal = ib_mpool_alloc(prefilter->mp, sizeof(*literal));
+        if (literal == NULL) {
+            return IB_EALLOC;
+        }
+        literal->str = str;
+        literal->len = len;
+        literal->id = ib_list_elements(prefilter->literals);
+
+        rc = ib_hash_set_ex(prefilter->literal_hash, str, len, literal);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        rc = ib_list_push(prefilter->literals, literal);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+    else if (rc != IB_OK) {
+        return rc;
+    }
+
+    ib_log_debug2(ib, "PCRE prefilter: literal \"%s\" required by \"%s\"",
+                  literal->str, patt);
+    *pliteral = literal;
+
+    return IB_OK;
+}
+
+/**
+ * Build the prefilter automaton from all registered literals.
+ *
+ * @param[in] ib IronBee engine for logging.
+ * @param[in] prefilter The prefilter.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on allocation failure.
+ */
+static ib_status_t prefilter_build(ib_engine_t *ib,
+                                   modpcre_prefilter_t *prefilter)
+{
+    assert(ib != NULL);
+    assert(prefilter != NULL);
+
+    ib_status_t rc;
+    ib_ac_t *ac;
+    const ib_list_node_t *node;
+    size_t num = ib_list_elements(prefilter->literals);
+
+    if (num == prefilter->ac_literals) {
+        return IB_OK;
+    }
+
+    rc = ib_ac_create(&ac, IB_AC_FLAG_PARSER_NOCASE, prefilter->mp);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    IB_LIST_LOOP_CONST(prefilter->literals, node) {
+        modpcre_literal_t *literal =
+            (modpcre_literal_t *)ib_list_node_data_const(node);
+
+        rc = ib_ac_add_pattern(ac, literal->str, NULL, literal, literal->len);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+
+    rc = ib_ac_build_links(ac);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    prefilter->ac = ac;
+    prefilter->ac_literals = num;
+    ib_log_debug(ib, "PCRE prefilter: built automaton of %zd literals", num);
+
+    return IB_OK;
+}
+
+/**
+ * Get or create the per-transaction module data.
+ *
+ * @param[in] tx The transaction.
+ * @param[out] tx_data The fetched or created data.
+ *
+ * @return
+ *   - IB_OK on success.
+ *   - IB_EALLOC on allocation failure
+ */
+static ib_status_t get_or_create_tx_data(ib_tx_t *tx,
+                                         modpcre_tx_data_t **tx_data)
+{
+    assert(tx != NULL);
+    assert(tx->mp != NULL);
+    assert(tx_data != NULL);
+
+    ib_status_t rc;
+    modpcre_tx_data_t *data;
+
+    rc = ib_tx_get_module_data(tx, IB_MODULE_STRUCT_PTR, (void **)tx_data);
+    if ( (rc == IB_OK) && (*tx_data != NULL) ) {
+        return IB_OK;
+    }
+
+    data = ib_mpool_calloc(tx->mp, 1, sizeof(*data));
+    if (data == NULL) {
+        return IB_EALLOC;
+    }
+
+    rc = ib_hash_create(&data->dfa_workspaces, tx->mp);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    rc = ib_hash_create(&data->prefilter_cache, tx->mp);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    data->prefilter_phase = PHASE_NONE;
+
+    rc = ib_tx_set_module_data(tx, IB_MODULE_STRUCT_PTR, data);
+    if (rc != IB_OK) {
+        *tx_data = NULL;
+        return rc;
+    }
+
+    *tx_data = data;
+    return IB_OK;
+}
+
+/**
+ * Check if the required literal of a pattern is present in a subject.
+ *
+ * The subject is scanned at most once per phase; the set of literals
+ * found in it is cached in the transaction keyed on the subject buffer.
+ *
+ * @param[in] rule_exec The rule execution object.
+ * @param[in] rule_data The rule data.
+ * @param[in] subject The subject.
+ * @param[in] subject_len Length of @a subject.
+ * @param[out] present Set to false only if the literal is known to be
+ *             absent from @a subject.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on allocation failure.
+ */
+static ib_status_t prefilter_check(const ib_rule_exec_t *rule_exec,
+                                   const modpcre_rule_data_t *rule_data,
+                                   const char *subject,
+                                   size_t subject_len,
+                                   bool *present)
+{
+    assert(rule_exec != NULL);
+    assert(rule_data != NULL);
+    assert(subject != NULL);
+    assert(present != NULL);
+
+    ib_status_t rc;
+    ib_tx_t *tx = rule_exec->tx;
+    const modpcre_prefilter_t *prefilter = rule_data->prefilter;
+    const modpcre_literal_t *literal = rule_data->literal;
+    modpcre_tx_data_t *tx_data;
+    modpcre_subject_key_t key;
+    modpcre_subject_key_t *new_key;
+    uint8_t *found;
+
+    *present = true;
+
+    /* Literals added after the automaton was built are never filtered. */
+    if ( (literal == NULL) ||
+         (prefilter == NULL) ||
+         (prefilter->ac == NULL) ||
+         (literal->id >= prefilter->ac_literals) )
+    {
+        return IB_OK;
+    }
+
+    rc = get_or_create_tx_data(tx, &tx_data);
+    if (rc != IB_OK) {
+        return rc;
     }
-    ib_log_debug(ib, "PCRE copied cpatt @ %p -> %p (%zd bytes)",
-                 (void *)cpatt, (void *)cpdata->cpatt, cpatt_sz);
 
-    /* Copy extra data (study data). */
-    if (edata != NULL) {
+    /* Subject buffers are only assumed stable within a phase. */
+    if (tx_data->prefilter_phase != rule_exec->rule->meta.phase) {
+        ib_hash_clear(tx_data->prefilter_cache);
+        tx_data->prefilter_phase = rule_exec->rule->meta.phase;
+    }
 
-        /* Copy edata. */
-        cpdata->edata = ib_mpool_memdup(pool, edata, sizeof(*edata));
-        if (cpdata->edata == NULL) {
-            pcre_free(edata);
-            ib_log_error(ib, "Failed to duplicate edata.");
+    key.ptr = subject;
+    key.len = subject_len;
+    rc = ib_hash_get_ex(tx_data->prefilter_cache, &found, &key, sizeof(key));
+    if (rc == IB_ENOENT) {
+        ib_ac_context_t ac_ctx;
+        ib_list_node_t *node;
+
+        found = ib_mpool_calloc(tx->mp, 1, (prefilter->ac_literals + 7) / 8);
+        new_key = ib_mpool_memdup(tx->mp, &key, sizeof(key));
+        if ( (found == NULL) || (new_key == NULL) ) {
             return IB_EALLOC;
         }
 
-        /* Copy edata->study_data. */
-        if (edata->study_data != NULL) {
-            cpdata->edata->study_data =
-                ib_mpool_memdup(pool, edata->study_data, study_data_sz);
-
-            if (cpdata->edata->study_data == NULL) {
-                ib_log_error(ib, "Failed to study data of size: %zd",
-                             study_data_sz);
-                pcre_free(edata);
-                return IB_EALLOC;
+        ib_ac_init_ctx(&ac_ctx, prefilter->ac);
+        rc = ib_ac_consume(&ac_ctx, subject, subject_len,
+                           IB_AC_FLAG_CONSUME_DOLIST |
+                           IB_AC_FLAG_CONSUME_MATCHALL,
+                           tx->mp);
+        if (rc == IB_OK) {
+            IB_LIST_LOOP(ac_ctx.match_list, node) {
+                const ib_ac_match_t *mt =
+                    (const ib_ac_match_t *)ib_list_node_data(node);
+                const modpcre_literal_t *l =
+                    (const modpcre_literal_t *)mt->data;
+                found[l->id / 8] |= (uint8_t)(1 << (l->id % 8));
             }
         }
-        pcre_free(edata);
-    }
-    else {
-        cpdata->edata = ib_mpool_calloc(pool, 1, sizeof(*edata));
-        if (cpdata->edata == NULL) {
-            pcre_free(edata);
-            ib_log_error(ib, "Failed to allocate edata.");
-            return IB_EALLOC;
+        else if (rc != IB_ENOENT) {
+            return rc;
         }
-    }
-
-    /* Set the PCRE limits for non-DFA patterns */
-    if (! is_dfa) {
-        cpdata->edata->flags |=
-            (PCRE_EXTRA_MATCH_LIMIT | PCRE_EXTRA_MATCH_LIMIT_RECURSION);
-        cpdata->edata->match_limit =
-            (unsigned long)config->match_limit;
-        cpdata->edata->match_limit_recursion =
-            (unsigned long)config->match_limit_recursion;
-        cpdata->dfa_ws_size = 0;
-    }
-    else {
-        cpdata->edata->match_limit = 0U;
-        cpdata->edata->match_limit_recursion = 0U;
-        cpdata->dfa_ws_size = (int)config->dfa_workspace_size;
-    }
 
-    /* Set stack limits for JIT */
-    if (cpdata->is_jit) {
-#ifdef PCRE_HAVE_JIT
-        if (config->jit_stack_start == 0U) {
-            cpdata->jit_stack_start =
-                PCRE_JIT_STACK_START_MULT * config->match_limit_recursion;
-        }
-        else {
-            cpdata->jit_stack_start = (int)config->jit_stack_start;
-        }
-        if (config->jit_stack_max == 0U) {
-            cpdata->jit_stack_max =
-                PCRE_JIT_STACK_MAX_MULT * config->match_limit_recursion;
-        }
-        else {
-            cpdata->jit_stack_max = (int)config->jit_stack_max;
+        rc = ib_hash_set_ex(tx_data->prefilter_cache,
+                            new_key, sizeof(*new_key), found);
+        if (rc != IB_OK) {
+            return rc;
         }
-#endif
     }
-    else {
-        cpdata->jit_stack_start = 0;
-        cpdata->jit_stack_max = 0;
+    else if (rc != IB_OK) {
+        return rc;
     }
 
-    ib_log_trace(ib,
-                 "Compiled pcre pattern \"%s\": "
-                 "cpatt=%p edata=%p limit=%ld rlimit=%ld study=%p "
-                 "dfa=%s dfa-ws-sz=%d "
-                 "jit=%s jit-stack: start=%d max=%d",
-                 patt,
-                 (void *)cpdata->cpatt,
-                 (void *)cpdata->edata,
-                 cpdata->edata->match_limit,
-                 cpdata->edata->match_limit_recursion,
-                 cpdata->edata->study_data,
-                 cpdata->is_dfa ? "yes" : "no",
-                 cpdata->dfa_ws_size,
-                 cpdata->is_jit ? "yes" : "no",
-                 cpdata->jit_stack_start,
-                 cpdata->jit_stack_max);
-    *pcpdata = cpdata;
+    *present = (found[literal->id / 8] & (1 << (literal->id % 8))) != 0;
 
     return IB_OK;
 }
 
-
 /* -- Matcher Interface -- */
 
 /**
@@ -639,6 +1592,20 @@ static ib_status_t pcre_operator_create(ib_engine_t *ib,
     }
     rule_data->cpdata = cpdata;
     rule_data->id = NULL;           /* Not needed for rx rules */
+    rule_data->prefilter = NULL;
+    rule_data->literal = NULL;
+
+    /* Register the pattern's required literal with the prefilter */
+    if (config->prefilter != 0) {
+        rule_data->prefilter = &((modpcre_data_t *)module->data)->prefilter;
+        rc = prefilter_add_pattern(ib, rule_data->prefilter, pattern,
+                                   &rule_data->literal);
+        if (rc != IB_OK) {
+            ib_log_error(ib, "Failed to add pattern to prefilter: %s",
+                         ib_status_to_string(rc));
+            return rc;
+        }
+    }
 
     /* Rule data is an alias for the compiled pattern data */
     op_inst->data = rule_data;
@@ -779,9 +1746,6 @@ static ib_status_t pcre_operator_execute(const ib_rule_exec_t *rule_exec,
     const ib_bytestr_t *bytestr;
     modpcre_rule_data_t *rule_data = (modpcre_rule_data_t *)data;
     pcre_extra *edata = NULL;
-#ifdef PCRE_JIT_STACK
-    pcre_jit_stack *jit_stack = NULL;
-#endif
 
     assert(rule_data->cpdata->is_dfa == false);
 
@@ -837,28 +1801,31 @@ static ib_status_t pcre_operator_execute(const ib_rule_exec_t *rule_exec,
         }
     }
 
-    if (rule_data->cpdata->is_jit) {
-#ifdef PCRE_JIT_STACK
-        jit_stack = pcre_jit_stack_alloc(rule_data->cpdata->jit_stack_start,
-                                         rule_data->cpdata->jit_stack_max);
-        if (jit_stack == NULL) {
-            ib_rule_log_debug(rule_exec,
-                              "Failed to allocate a jit stack for a "
-                              "jit-compiled rule.  "
-                              "Not using jit for this call.");
-        }
-        /* If the study data is NULL or size zero, don't use it. */
-        else if (rule_data->cpdata->study_data_sz > 0) {
-            edata = rule_data->cpdata->edata;
+    /* Skip the regex entirely if its required literal is absent. */
+    if (rule_data->literal != NULL) {
+        bool present;
+
+        ib_rc = prefilter_check(rule_exec, rule_data,
+                                subject, subject_len, &present);
+        if (ib_rc != IB_OK) {
+            free(ovector);
+            return ib_rc;
         }
-        if (edata != NULL) {
-            pcre_assign_jit_stack(edata, NULL, jit_stack);
+        if (! present) {
+            ib_rule_log_trace(rule_exec,
+                              "Prefilter: literal \"%s\" not present; "
+                              "skipping pattern \"%s\".",
+                              rule_data->literal->str,
+                              rule_data->cpdata->patt);
+            free(ovector);
+            *result = 0;
+            return IB_OK;
         }
-#else
-        edata = NULL;
-#endif
     }
-    else if (rule_data->cpdata->study_data_sz > 0) {
+
+    /* If the study data is NULL or size zero, don't use it. For JIT
+     * patterns the thread's JIT stack is supplied by the stack cache. */
+    if (rule_data->cpdata->study_data_sz > 0) {
         edata = rule_data->cpdata->edata;
     }
     else {
@@ -875,8 +1842,29 @@ static ib_status_t pcre_operator_execute(const ib_rule_exec_t *rule_exec,
                         ovecsize);
 
 #ifdef PCRE_JIT_STACK
-    if (jit_stack != NULL) {
-        pcre_jit_stack_free(jit_stack);
+    /* The JIT stack is exhausted; retry with the interpreter, which is
+     * bound by the match limits instead. */
+    if ( (matches == PCRE_ERROR_JIT_STACKLIMIT) && (edata != NULL) ) {
+        pcre_extra interp_edata = *edata;
+
+        interp_edata.flags &= ~PCRE_EXTRA_EXECUTABLE_JIT;
+        if (rule_data->cpdata->jit_cache != NULL) {
+            jit_cache_count(rule_data->cpdata->jit_cache,
+                            &rule_data->cpdata->jit_cache->fallbacks);
+        }
+        ib_rule_log_debug(rule_exec,
+                          "JIT stack limit reached for pattern \"%s\".  "
+                          "Falling back to the PCRE interpreter.",
+                          rule_data->cpdata->patt);
+
+        matches = pcre_exec(rule_data->cpdata->cpatt,
+                            &interp_edata,
+                            subject,
+                            subject_len,
+                            0, /* Starting offset. */
+                            0, /* Options. */
+                            ovector,
+                            ovecsize);
     }
 #endif
 
@@ -1035,6 +2023,8 @@ static ib_status_t dfa_operator_create(ib_engine_t *ib,
         return IB_EALLOC;
     }
     rule_data->cpdata = cpdata;
+    rule_data->prefilter = NULL;
+    rule_data->literal = NULL;
     rc = dfa_id_set(rule, op_inst, pool, rule_data);
     if (rc != IB_OK) {
         ib_log_error(ib, "Error creating ID for DFA: %s",
@@ -1049,62 +2039,48 @@ static ib_status_t dfa_operator_create(ib_engine_t *ib,
 }
 
 /**
- * Get or create an ib_hash_t inside of @c tx for storing dfa rule data.
+ * DFA workspace.
  *
- * The hash is stored at the key @c HASH_NAME_STR.
+ * Phase rules use one per rule per transaction as scratch space.  Body
+ * stream rules keep theirs as stream state, and restart the match from it
+ * when the previous chunk ended in a partial match.
+ */
+struct dfa_workspace_t {
+    int *workspace;          /**< pcre_dfa_exec() workspace */
+    int *fresh;              /**< Workspace for a search from chunk start */
+    int wscount;             /**< Number of ints in each workspace */
+    bool partial;            /**< Previous chunk ended in a partial match */
+};
+typedef struct dfa_workspace_t dfa_workspace_t;
+
+/**
+ * Allocate the workspace array of @a ws.
  *
- * @param[in] tx The transaction containing @c tx->data which holds
- *            the @a rule_data object.
- * @param[out] hash The fetched or created rule data hash. This is set
- *             to NULL on failure.
+ * @param[in] tx Transaction.
+ * @param[in] cpatt_data Compiled pattern data
+ * @param[in,out] ws Workspace.
  *
- * @return
+ * @returns
  *   - IB_OK on success.
- *   - IB_EALLOC on allocation failure
+ *   - IB_EALLOC on an allocation error.
  */
-static ib_status_t get_or_create_rule_data_hash(ib_tx_t *tx,
-                                                ib_hash_t **hash)
+static ib_status_t dfa_workspace_alloc(ib_tx_t *tx,
+                                       const modpcre_cpat_data_t *cpatt_data,
+                                       dfa_workspace_t *ws)
 {
-    assert(tx);
-    assert(tx->mp);
-
-    ib_status_t rc;
-
-    /* Get or create the hash that contains the rule data. */
-    rc = ib_tx_get_module_data(tx, IB_MODULE_STRUCT_PTR, (void **)hash);
-    if ( (rc == IB_OK) && (*hash != NULL) ) {
-        ib_log_debug2_tx(tx, "Found rule data hash in tx.");
-        return IB_OK;
-    }
-
-    ib_log_debug2_tx(tx, "Rule data hash did not exist in tx.");
-
-    rc = ib_hash_create(hash, tx->mp);
-    if (rc != IB_OK) {
-        ib_log_debug2_tx(tx, "Failed to create hash: %s",
-                         ib_status_to_string(rc));
-        return rc;
-    }
-
-    rc = ib_tx_set_module_data(tx, IB_MODULE_STRUCT_PTR, *hash);
-    if (rc != IB_OK) {
-        ib_log_debug2_tx(tx, "Failed to store hash: %s",
-                         ib_status_to_string(rc));
-        *hash = NULL;
+    ws->wscount = cpatt_data->dfa_ws_size;
+    ws->workspace = (int *)ib_mpool_alloc(
+        tx->mp,
+        sizeof(*(ws->workspace)) * (ws->wscount));
+    if (ws->workspace == NULL) {
+        return IB_EALLOC;
     }
+    ws->fresh = NULL;
+    ws->partial = false;
 
-    ib_log_debug2_tx(tx, "Returning rule hash at %p.", *hash);
-
-    return rc;
-
+    return IB_OK;
 }
 
-struct dfa_workspace_t {
-    int *workspace;
-    int wscount;
-};
-typedef struct dfa_workspace_t dfa_workspace_t;
-
 /**
  * Create the per-transaction data for use with the dfa operator.
  *
@@ -1127,13 +2103,12 @@ static ib_status_t alloc_dfa_tx_data(ib_tx_t *tx,
     assert(id);
     assert(workspace);
 
-    ib_hash_t *hash;
+    modpcre_tx_data_t *tx_data;
     ib_status_t rc;
     dfa_workspace_t *ws;
-    size_t size;
 
     *workspace = NULL;
-    rc = get_or_create_rule_data_hash(tx, &hash);
+    rc = get_or_create_tx_data(tx, &tx_data);
     if (rc != IB_OK) {
         return rc;
     }
@@ -1143,14 +2118,12 @@ static ib_status_t alloc_dfa_tx_data(ib_tx_t *tx,
         return IB_EALLOC;
     }
 
-    ws->wscount = cpatt_data->dfa_ws_size;
-    size = sizeof(*(ws->workspace)) * (ws->wscount);
-    ws->workspace = (int *)ib_mpool_alloc(tx->mp, size);
-    if (ws->workspace == NULL) {
-        return IB_EALLOC;
+    rc = dfa_workspace_alloc(tx, cpatt_data, ws);
+    if (rc != IB_OK) {
+        return rc;
     }
 
-    rc = ib_hash_set(hash, id, ws);
+    rc = ib_hash_set(tx_data->dfa_workspaces, id, ws);
     if (rc == IB_OK) {
         *workspace = ws;
     }
@@ -1179,15 +2152,15 @@ static ib_status_t get_dfa_tx_data(ib_tx_t *tx,
     assert(id);
     assert(workspace);
 
-    ib_hash_t *hash;
+    modpcre_tx_data_t *tx_data;
     ib_status_t rc;
 
-    rc = get_or_create_rule_data_hash(tx, &hash);
+    rc = get_or_create_tx_data(tx, &tx_data);
     if (rc != IB_OK) {
         return rc;
     }
 
-    rc = ib_hash_get(hash, workspace, id);
+    rc = ib_hash_get(tx_data->dfa_workspaces, workspace, id);
     if (rc != IB_OK) {
         *workspace = NULL;
     }
@@ -1230,6 +2203,7 @@ static ib_status_t dfa_operator_execute(const ib_rule_exec_t *rule_exec,
     dfa_workspace_t *dfa_workspace;
     const char *id = ib_rule_id(rule_exec->rule);
     int options; /* dfa exec options. */
+    bool stream = false;
 
     assert(rule_data->cpdata->is_dfa == true);
 
@@ -1278,29 +2252,28 @@ static ib_status_t dfa_operator_execute(const ib_rule_exec_t *rule_exec,
         }
     }
 
-    /* Get the per-tx workspace data for this rule data id. */
-    ib_rc = get_dfa_tx_data(tx, id, &dfa_workspace);
-    if (ib_rc == IB_ENOENT) {
-        options = PCRE_PARTIAL_SOFT;
-
-        ib_rc = alloc_dfa_tx_data(tx, rule_data->cpdata, id, &dfa_workspace);
-        if (ib_rc != IB_OK) {
-            free(ovector);
-            ib_rule_log_error(rule_exec,
-                              "Error creating tx storage for dfa operator: %s",
-                              ib_status_to_string(ib_rc));
-            return ib_rc;
+    /* Body stream rules keep their workspace from a chunk to the next. */
+    ib_rc = ib_rule_exec_stream_state(rule_exec, sizeof(*dfa_workspace),
+                                      NULL, (void **)&dfa_workspace);
+    if (ib_rc == IB_OK) {
+        stream = true;
+        if (dfa_workspace->workspace == NULL) {
+            ib_rc = dfa_workspace_alloc(tx, rule_data->cpdata, dfa_workspace);
         }
-
-        ib_rule_log_debug(rule_exec, "Created DFA workspace at %p.",
-                          dfa_workspace);
     }
-    else if (ib_rc == IB_OK) {
-        options = PCRE_PARTIAL_SOFT | PCRE_DFA_RESTART;
-        ib_rule_log_debug(rule_exec, "Reusing existing DFA workspace %p.",
-                          dfa_workspace);
+    /* Other rules use the per-tx workspace of this rule data id. */
+    else if (ib_rc == IB_ENOENT) {
+        ib_rc = get_dfa_tx_data(tx, id, &dfa_workspace);
+        if (ib_rc == IB_ENOENT) {
+            ib_rc = alloc_dfa_tx_data(tx, rule_data->cpdata, id,
+                                      &dfa_workspace);
+            if (ib_rc == IB_OK) {
+                ib_rule_log_debug(rule_exec, "Created DFA workspace at %p.",
+                                  dfa_workspace);
+            }
+        }
     }
-    else {
+    if (ib_rc != IB_OK) {
         free(ovector);
         ib_rule_log_error(rule_exec,
                           "Error fetching dfa data for dfa operator: %s",
@@ -1308,6 +2281,13 @@ static ib_status_t dfa_operator_execute(const ib_rule_exec_t *rule_exec,
         return ib_rc;
     }
 
+    /* Resume a match that started in the previous chunk. */
+    options = PCRE_PARTIAL_SOFT;
+    if (dfa_workspace->partial) {
+        options |= PCRE_DFA_RESTART;
+        ib_rule_log_debug(rule_exec, "Restarting partial match.");
+    }
+
     /* Actually do the DFA match. */
     matches = pcre_dfa_exec(rule_data->cpdata->cpatt,
                             rule_data->cpdata->edata,
@@ -1320,6 +2300,48 @@ static ib_status_t dfa_operator_execute(const ib_rule_exec_t *rule_exec,
                             dfa_workspace->workspace,
                             dfa_workspace->wscount);
 
+    /* A restart only continues the partial match; unless it completed,
+     * look for matches starting in this chunk as well.  That search gets
+     * its own workspace so the restarted state survives it. */
+    if (matches < 0 && (options & PCRE_DFA_RESTART) != 0) {
+        int fresh_matches;
+        int *swap;
+
+        if (dfa_workspace->fresh == NULL) {
+            dfa_workspace->fresh = (int *)ib_mpool_alloc(
+                tx->mp,
+                sizeof(*(dfa_workspace->fresh)) * dfa_workspace->wscount);
+            if (dfa_workspace->fresh == NULL) {
+                free(ovector);
+                return IB_EALLOC;
+            }
+        }
+
+        fresh_matches = pcre_dfa_exec(rule_data->cpdata->cpatt,
+                                      rule_data->cpdata->edata,
+                                      subject,
+                                      subject_len,
+                                      0, /* Starting offset. */
+                                      PCRE_PARTIAL_SOFT,
+                                      ovector,
+                                      ovecsize,
+                                      dfa_workspace->fresh,
+                                      dfa_workspace->wscount);
+
+        /* A full match wins.  Otherwise a partial match carried over from
+         * the previous chunk is kept over one starting in this chunk,
+         * since only one partial state is carried forward. */
+        if (fresh_matches >= 0 || matches != PCRE_ERROR_PARTIAL) {
+            matches = fresh_matches;
+            swap = dfa_workspace->workspace;
+            dfa_workspace->workspace = dfa_workspace->fresh;
+            dfa_workspace->fresh = swap;
+        }
+    }
+    if (stream) {
+        dfa_workspace->partial = (matches == PCRE_ERROR_PARTIAL);
+    }
+
     if (matches >= 0) {
         ib_rc = IB_OK;
         *result = 1;
@@ -1420,6 +2442,12 @@ static IB_CFGMAP_INIT_STRUCTURE(config_map) = {
         modpcre_cfg_t,
         dfa_workspace_size
     ),
+    IB_CFGMAP_INIT_ENTRY(
+        MODULE_NAME_STR ".prefilter",
+        IB_FTYPE_NUM,
+        modpcre_cfg_t,
+        prefilter
+    ),
     IB_CFGMAP_INIT_LAST
 };
 
@@ -1471,6 +2499,9 @@ static ib_status_t handle_directive_onoff(ib_cfgparser_t *cp,
     else if (strcasecmp("PcreUseJit", name) == 0) {
         pname = MODULE_NAME_STR ".use_jit";
     }
+    else if (strcasecmp("PcrePrefilter", name) == 0) {
+        pname = MODULE_NAME_STR ".prefilter";
+    }
     else {
         ib_cfg_log_error(cp, "Unhandled directive \"%s\"", name);
         return IB_EINVAL;
@@ -1575,6 +2606,11 @@ static IB_DIRMAP_INIT_STRUCTURE(directive_map) = {
         handle_directive_onoff,
         NULL
     ),
+    IB_DIRMAP_INIT_ONOFF(
+        "PcrePrefilter",
+        handle_directive_onoff,
+        NULL
+    ),
     IB_DIRMAP_INIT_PARAM1(
         "PcreMatchLimit",
         handle_directive_param,
@@ -1610,6 +2646,37 @@ static ib_status_t modpcre_init(ib_engine_t *ib,
     assert(ib != NULL);
     assert(m != NULL);
     ib_status_t rc;
+    ib_mpool_t *mp = ib_engine_pool_main_get(ib);
+    modpcre_data_t *mod_data;
+    modpcre_prefilter_t *prefilter;
+
+    mod_data = ib_mpool_calloc(mp, 1, sizeof(*mod_data));
+    if (mod_data == NULL) {
+        return IB_EALLOC;
+    }
+
+    /* Create the literal prefilter, filled in as rx rules are created. */
+    prefilter = &mod_data->prefilter;
+    prefilter->mp = mp;
+    rc = ib_hash_create_nocase(&prefilter->literal_hash, mp);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    rc = ib_list_create(&prefilter->literals, mp);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+#ifdef PCRE_JIT_STACK
+    rc = jit_cache_init(&mod_data->jit_cache);
+    if (rc != IB_OK) {
+        ib_log_error(ib, "Failed to create PCRE JIT stack cache: %s",
+                     ib_status_to_string(rc));
+        return rc;
+    }
+#endif
+
+    m->data = mod_data;
 
     /* Register as a matcher provider. */
     rc = ib_provider_register(ib,
@@ -1665,6 +2732,67 @@ static ib_status_t modpcre_init(ib_engine_t *ib,
     return IB_OK;
 }
 
+/**
+ * Release module resources.
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] m Module
+ * @param[in] cbdata Callback data (unused)
+ *
+ * @returns IB_OK
+ */
+static ib_status_t modpcre_fini(ib_engine_t *ib,
+                                ib_module_t *m,
+                                void        *cbdata)
+{
+    assert(ib != NULL);
+    assert(m != NULL);
+
+#ifdef PCRE_JIT_STACK
+    if (m->data != NULL) {
+        jit_cache_destroy(ib, &((modpcre_data_t *)m->data)->jit_cache);
+    }
+#endif
+
+    return IB_OK;
+}
+
+/**
+ * Build the prefilter automaton once the main context is configured.
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] m Module
+ * @param[in] ctx Context being closed
+ * @param[in] cbdata Callback data (unused)
+ *
+ * @returns Status code
+ */
+static ib_status_t modpcre_context_close(ib_engine_t  *ib,
+                                         ib_module_t  *m,
+                                         ib_context_t *ctx,
+                                         void         *cbdata)
+{
+    assert(ib != NULL);
+    assert(m != NULL);
+    assert(ctx != NULL);
+
+    ib_status_t rc;
+
+    /* Rules of all contexts have been created by the time the main
+     * context is closed. */
+    if (ctx != ib_context_main(ib)) {
+        return IB_OK;
+    }
+
+    rc = prefilter_build(ib, &((modpcre_data_t *)m->data)->prefilter);
+    if (rc != IB_OK) {
+        ib_log_error(ib, "Failed to build PCRE prefilter: %s",
+                     ib_status_to_string(rc));
+    }
+
+    return rc;
+}
+
 /**
  * Module structure.
  *
@@ -1678,11 +2806,11 @@ IB_MODULE_INIT(
     directive_map,                        /**< Config directive map */
     modpcre_init,                         /**< Initialize function */
     NULL,                                 /**< Callback data */
-    NULL,                                 /**< Finish function */
+    modpcre_fini,                         /**< Finish function */
     NULL,                                 /**< Callback data */
     NULL,                                 /**< Context open function */
     NULL,                                 /**< Callback data */
-    NULL,                                 /**< Context close function */
+    modpcre_context_close,                /**< Context close function */
     NULL,                                 /**< Callback data */
     NULL,                                 /**< Context destroy function */
     NULL                                  /**< Callback data */
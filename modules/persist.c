@@ -18,9 +18,12 @@
 #include "ironbee_config_auto.h"
 
 #include <ironbee/engine.h>
+#include <ironbee/field_binary.h>
 #include <ironbee/json.h>
 #include <ironbee/kvstore.h>
+#include <ironbee/kvstore_cache.h>
 #include <ironbee/kvstore_filesystem.h>
+#include <ironbee/kvstore_shm.h>
 #include <ironbee/list.h>
 #include <ironbee/collection_manager.h>
 #include <ironbee/module.h>
@@ -33,6 +36,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -44,16 +48,40 @@ typedef struct {
 } mod_persist_param_data_t;
 static mod_persist_param_data_t mod_persist_param_data = { NULL, NULL };
 
-/** File system persistence kvstore data */
+/** Encoding of persisted collections */
+typedef enum {
+    PERSIST_FORMAT_BINARY,           /**< ib_field_binary_encode() */
+    PERSIST_FORMAT_JSON              /**< ib_json_encode() */
+} mod_persist_format_t;
+
+/** kvstore backing persisted collections */
+typedef enum {
+    PERSIST_BACKEND_FS,              /**< ib_kvstore_filesystem_init() */
+    PERSIST_BACKEND_SHM              /**< ib_kvstore_shm_init() */
+} mod_persist_backend_t;
+
+/** Register data of the collection managers */
+static const mod_persist_backend_t persist_backend_fs = PERSIST_BACKEND_FS;
+static const mod_persist_backend_t persist_backend_shm = PERSIST_BACKEND_SHM;
+
+/** Persistence kvstore data */
 typedef struct {
     const char    *collection_name;  /**< Name of the collection */
-    const char    *path;             /**< Path to the fs kvstore */
+    const char    *path;             /**< Path to the fs or shm kvstore */
     const char    *key;              /**< Key in TX data for population */
     bool           key_expand;       /**< Key is expandable */
     ib_kvstore_t  *kvstore;          /**< kvstore object */
+    ib_kvstore_t  *backend;          /**< Cached kvstore, or NULL */
     uint32_t       expiration;       /**< Expiration time in seconds */
+    mod_persist_format_t format;     /**< Encoding of stored collections */
 } mod_persist_kvstore_t;
 
+/** A kvstore value aliased by populated fields, freed with the TX */
+typedef struct {
+    ib_kvstore_t       *kvstore;     /**< kvstore the value came from */
+    ib_kvstore_value_t *value;       /**< Value to free */
+} mod_persist_value_ref_t;
+
 /** File system persistence configuration data */
 typedef struct {
     ib_list_t  *kvstore_list;        /**< List of persist_fs_kvstore_t */
@@ -63,6 +91,17 @@ static mod_persist_cfg_t mod_persist_global_cfg;
 /** Default expiration time of persisted collections (seconds) */
 static const int default_expiration = 60;
 
+/** kvstore type names of the encodings */
+static const char *format_type_binary = "ibfield";
+static const char *format_type_json = "json";
+
+static ib_status_t mod_persist_merge_fn(
+    ib_kvstore_t *kvstore,
+    ib_kvstore_value_t **values,
+    size_t value_size,
+    ib_kvstore_value_t **resultant_value,
+    ib_kvstore_cbdata_t *cbdata);
+
 /* Define the module name as well as a string version of it. */
 #define MODULE_NAME        persist
 #define MODULE_NAME_STR    IB_XSTRINGIFY(MODULE_NAME)
@@ -73,6 +112,9 @@ IB_MODULE_DECLARE();
 
 /**
  * Handle managed collection register for persistent file system
+ * and shared memory stores.
+ *
+ * @a register_data points to the mod_persist_backend_t of the manager.
  *
  * @param[in] ib Engine
  * @param[in] module Collection manager's module object
@@ -109,9 +151,13 @@ static ib_status_t mod_persist_register_fn(
     assert(mp != NULL);
     assert(collection_name != NULL);
     assert(params != NULL);
+    assert(register_data != NULL);
     assert(pmanager_inst_data != NULL);
     assert(mod_persist_param_data.key_pcre != NULL);
 
+    const mod_persist_backend_t backend =
+        *(const mod_persist_backend_t *)register_data;
+
     const ib_list_node_t *node;
     const char *nodestr;
     const char *path;
@@ -125,6 +171,10 @@ static ib_status_t mod_persist_register_fn(
     int ovector[ovecsize];
     int pcre_rc;
     ib_num_t expiration = default_expiration;
+    mod_persist_format_t format = PERSIST_FORMAT_BINARY;
+    ib_num_t size = IB_KVSTORE_SHM_DEFAULT_SIZE;
+    ib_num_t cache_seconds = 0;
+    ib_kvstore_t *cached = NULL;
 
     if (ib_list_elements(params) < 1) {
         return IB_EINVAL;
@@ -134,16 +184,20 @@ static ib_status_t mod_persist_register_fn(
         return IB_EALLOC;
     }
 
-    if (stat(path, &sbuf) < 0) {
-        ib_log_warning(ib, "persist: Declining \"%s\"; stat(\"%s\") failed: %s",
-                       uri, path, strerror(errno));
-        return IB_DECLINED;
-    }
-    if (! S_ISDIR(sbuf.st_mode)) {
-        ib_log_warning(ib,
-                       "JSON file: Declining \"%s\"; \"%s\" is not a directory",
-                       uri, path);
-        return IB_DECLINED;
+    /* The shared memory file is created on connect. */
+    if (backend == PERSIST_BACKEND_FS) {
+        if (stat(path, &sbuf) < 0) {
+            ib_log_warning(ib,
+                           "persist: Declining \"%s\"; stat(\"%s\") failed: %s",
+                           uri, path, strerror(errno));
+            return IB_DECLINED;
+        }
+        if (! S_ISDIR(sbuf.st_mode)) {
+            ib_log_warning(ib,
+                           "JSON file: Declining \"%s\"; \"%s\" is not a directory",
+                           uri, path);
+            return IB_DECLINED;
+        }
     }
 
     /* Extract the key name from the next param (only if it's key=<name>) */
@@ -179,6 +233,40 @@ static ib_status_t mod_persist_register_fn(
                 return rc;
             }
         }
+        else if ( (param_len == 6) && (strncasecmp(param, "format", 6) == 0) ) {
+            if ( (value_len == 6) && (strncasecmp(value, "binary", 6) == 0) ) {
+                format = PERSIST_FORMAT_BINARY;
+            }
+            else if ( (value_len == 4) && (strncasecmp(value, "json", 4) == 0) ) {
+                format = PERSIST_FORMAT_JSON;
+            }
+            else {
+                ib_log_error(ib, "Invalid format \"%.*s\"",
+                             (int)value_len, value);
+                return IB_EINVAL;
+            }
+        }
+        else if ( (param_len == 5) && (strncasecmp(param, "cache", 5) == 0) ) {
+            rc = ib_string_to_num_ex(value, value_len, 0, &cache_seconds);
+            if ( (rc != IB_OK) || (cache_seconds < 0) ) {
+                ib_log_error(ib, "Invalid cache value \"%.*s\"",
+                             (int)value_len, value);
+                return IB_EINVAL;
+            }
+        }
+        else if ( (param_len == 4) && (strncasecmp(param, "size", 4) == 0) ) {
+            if (backend != PERSIST_BACKEND_SHM) {
+                ib_log_error(ib, "persist: \"size\" is only valid for "
+                             "shared memory stores");
+                return IB_EINVAL;
+            }
+            rc = ib_string_to_num_ex(value, value_len, 0, &size);
+            if ( (rc != IB_OK) || (size <= 0) ) {
+                ib_log_error(ib, "Invalid size value \"%.*s\"",
+                             (int)value_len, value);
+                return IB_EINVAL;
+            }
+        }
     }
     if (key == NULL) {
         ib_log_error(ib, "No key specified");
@@ -194,12 +282,49 @@ static ib_status_t mod_persist_register_fn(
     if (kvstore == NULL) {
         return IB_EALLOC;
     }
-    rc = ib_kvstore_filesystem_init(kvstore, path);
+    if (backend == PERSIST_BACKEND_SHM) {
+        rc = ib_kvstore_shm_init(kvstore, path, (size_t)size);
+    }
+    else {
+        rc = ib_kvstore_filesystem_init(kvstore, path);
+    }
     if (rc != IB_OK) {
         return rc;
     }
+
+    /* Optionally put a cache in front of the store.  Values read and
+     * written through the cache may be up to cache_seconds stale. */
+    if (cache_seconds > 0) {
+        ib_kvstore_cache_config_t config;
+
+        cached = kvstore;
+        kvstore = ib_mpool_alloc(mp, sizeof(*kvstore));
+        if (kvstore == NULL) {
+            ib_kvstore_destroy(cached);
+            return IB_EALLOC;
+        }
+        ib_kvstore_cache_config_default(&config);
+        config.max_age = (uint32_t)cache_seconds;
+        config.negative_ttl = (uint32_t)cache_seconds;
+        config.write_delay = (uint32_t)cache_seconds;
+        config.merge_policy = mod_persist_merge_fn;
+        rc = ib_kvstore_cache_init(kvstore, cached, &config);
+        if (rc != IB_OK) {
+            ib_kvstore_destroy(cached);
+            return rc;
+        }
+    }
+
+    /* Connecting here, before the server forks its workers, maps the
+     * shared memory store into every worker. */
     rc = ib_kvstore_connect(kvstore);
     if (rc != IB_OK) {
+        ib_log_error(ib, "persist: Failed to connect to \"%s\": %s",
+                     uri, ib_status_to_string(rc));
+        ib_kvstore_destroy(kvstore);
+        if (cached != NULL) {
+            ib_kvstore_destroy(cached);
+        }
         return rc;
     }
 
@@ -216,7 +341,9 @@ static ib_status_t mod_persist_register_fn(
     persist->key = key;
     persist->key_expand = key_expand;
     persist->kvstore = kvstore;
+    persist->backend = cached;
     persist->expiration = expiration;
+    persist->format = format;
 
     /* Finally, store the list as the manager specific collection data */
     *pmanager_inst_data = persist;
@@ -256,7 +383,23 @@ ib_status_t mod_persist_unregister_fn(
         (const mod_persist_kvstore_t *)manager_inst_data;
 
     rc = ib_kvstore_disconnect(persist->kvstore);
+    if (persist->backend != NULL) {
+        ib_kvstore_cache_stats_t stats;
+
+        ib_kvstore_cache_stats(persist->kvstore, &stats);
+        ib_log_debug(ib,
+                     "persist: Cache of \"%s\": %" PRIu64 " hits, "
+                     "%" PRIu64 " negative hits, %" PRIu64 " misses, "
+                     "%" PRIu64 " evictions, %" PRIu64 " writes, "
+                     "%" PRIu64 " coalesced, %" PRIu64 " write errors",
+                     collection_name, stats.hits, stats.negative_hits,
+                     stats.misses, stats.evictions, stats.writes,
+                     stats.coalesced, stats.write_errors);
+    }
     ib_kvstore_destroy(persist->kvstore);
+    if (persist->backend != NULL) {
+        ib_kvstore_destroy(persist->backend);
+    }
 
     return rc;
 }
@@ -310,6 +453,18 @@ done:
     return IB_OK;
 }
 
+/**
+ * Free a kvstore value aliased by populated fields.
+ *
+ * @param[in] data The @ref mod_persist_value_ref_t.
+ */
+static void mod_persist_value_cleanup(void *data)
+{
+    mod_persist_value_ref_t *ref = (mod_persist_value_ref_t *)data;
+
+    ib_kvstore_free_value(ref->kvstore, ref->value);
+}
+
 /**
  * Handle managed collection kvstore / filesystem populate function
  *
@@ -326,7 +481,7 @@ done:
  *   - IB_OK If no errors encountered
  *   - IB_DECLINED If the configured key was not found in the kvstore
  *   - Errors returned by ib_data_expand_str(), ib_kvstore_get(),
- *     ib_json_decode()
+ *     ib_field_binary_decode(), ib_json_decode()
  *
  */
 static ib_status_t mod_persist_populate_fn(
@@ -354,6 +509,7 @@ static ib_status_t mod_persist_populate_fn(
     const char *error = NULL;
     ib_kvstore_key_t kvstore_key;
     ib_kvstore_value_t *kvstore_val;
+    mod_persist_value_ref_t *ref = NULL;
 
     /* Generate the key */
     if (persist->key_expand) {
@@ -382,13 +538,38 @@ static ib_status_t mod_persist_populate_fn(
     assert(kvstore_val != NULL);
     assert(kvstore_val->value != NULL);
 
-    /* OK, got the data, now decode the JSON */
-    rc = ib_json_decode_ex(tx->mp,
-                           kvstore_val->value, kvstore_val->value_length,
-                           collection, &error);
+    /* OK, got the data, now decode it.  The encoding is recognized from
+     * the data itself, so collections stored in either format can be read
+     * whatever the configured format is. */
+    if (ib_field_binary_is_encoded(kvstore_val->value,
+                                   kvstore_val->value_length))
+    {
+        /* Let the fields alias the value, and free it with the TX. */
+        ref = ib_mpool_alloc(tx->mp, sizeof(*ref));
+        if (ref != NULL) {
+            ref->kvstore = kvstore;
+            ref->value = kvstore_val;
+            if (ib_mpool_cleanup_register(tx->mp,
+                                          mod_persist_value_cleanup,
+                                          ref) != IB_OK)
+            {
+                ref = NULL;
+            }
+        }
+        rc = ib_field_binary_decode(tx->mp,
+                                    kvstore_val->value,
+                                    kvstore_val->value_length,
+                                    (ref != NULL),
+                                    collection, &error);
+    }
+    else {
+        rc = ib_json_decode_ex(tx->mp,
+                               kvstore_val->value, kvstore_val->value_length,
+                               collection, &error);
+    }
     if (rc != IB_OK) {
         ib_log_error(ib,
-                     "Error decoding JSON for \"%s\" key \"%s\": \"%s\"",
+                     "Error decoding \"%s\" key \"%s\": \"%s\"",
                      collection_name, key,
                      error == NULL ? ib_status_to_string(rc) : error);
     }
@@ -397,7 +578,9 @@ static ib_status_t mod_persist_populate_fn(
                      "Populated collection \"%s\" from kvstore \"%s\"",
                      collection_name, persist->path);
     }
-    ib_kvstore_free_value(kvstore, kvstore_val);
+    if (ref == NULL) {
+        ib_kvstore_free_value(kvstore, kvstore_val);
+    }
 
     return rc;
 }
@@ -416,8 +599,8 @@ static ib_status_t mod_persist_populate_fn(
  *
  * @returns
  *   - IB_OK on success or when @a collection_data is length 0.
- *   - Errors returned by ib_data_expand_str(), ib_json_encode(),
- *     ib_kvstore_set()
+ *   - Errors returned by ib_data_expand_str(), ib_field_binary_encode(),
+ *     ib_json_encode(), ib_kvstore_set()
  */
 static ib_status_t mod_persist_persist_fn(
     const ib_engine_t             *ib,
@@ -444,8 +627,9 @@ static ib_status_t mod_persist_persist_fn(
     const char *key;
     ib_kvstore_key_t kvstore_key;
     ib_kvstore_value_t kvstore_val;
-    char *buf;
+    void *buf;
     size_t bufsize;
+    const char *type;
 
     /* Generate the key */
     if (persist->key_expand) {
@@ -460,11 +644,24 @@ static ib_status_t mod_persist_persist_fn(
         key = ib_mpool_strdup(tx->mp, persist->key);
     }
 
-    /* Encode the buffer into JSON */
-    rc = ib_json_encode(tx->mp, collection, true, &buf, &bufsize);
+    /* Encode the collection */
+    if (persist->format == PERSIST_FORMAT_BINARY) {
+        uint8_t *bin;
+
+        rc = ib_field_binary_encode(tx->mp, collection, &bin, &bufsize);
+        buf = bin;
+        type = format_type_binary;
+    }
+    else {
+        char *json;
+
+        rc = ib_json_encode(tx->mp, collection, true, &json, &bufsize);
+        buf = json;
+        type = format_type_json;
+    }
     if (rc != IB_OK) {
         ib_log_warning(ib,
-                       "Error encoding JSON for \"%s\" key \"%s\": \"%s\"",
+                       "Error encoding \"%s\" key \"%s\": \"%s\"",
                        collection_name, key, ib_status_to_string(rc));
         return rc;
     }
@@ -474,11 +671,14 @@ static ib_status_t mod_persist_persist_fn(
     kvstore_key.length = strlen(key);
     kvstore_val.value = buf;
     kvstore_val.value_length = bufsize;
-    kvstore_val.type = ib_mpool_strdup(tx->mp, "json");
-    kvstore_val.type_length = 4;
+    kvstore_val.type = ib_mpool_strdup(tx->mp, type);
+    if (kvstore_val.type == NULL) {
+        return IB_EALLOC;
+    }
+    kvstore_val.type_length = strlen(type);
     kvstore_val.expiration = persist->expiration;
 
-    /* Save the JSON buffer into the kvstore */
+    /* Save the encoded buffer into the kvstore */
     rc = ib_kvstore_set(kvstore, NULL, &kvstore_key, &kvstore_val);
     if (rc != IB_OK) {
         return rc;
@@ -506,7 +706,7 @@ static ib_status_t mod_persist_init(
     assert(ib != NULL);
     assert(module != NULL);
 
-    const char *key_pattern = "^(?i)(key|expire)=(.+)$";
+    const char *key_pattern = "^(?i)(key|expire|format|size|cache)=(.+)$";
     const int compile_flags = PCRE_DOTALL | PCRE_DOLLAR_ENDONLY;
     pcre *compiled;
     const char *error;
@@ -517,7 +717,7 @@ static ib_status_t mod_persist_init(
     /* Register the name/value pair InitCollection handler */
     rc = ib_collection_manager_register(
         ib, module, "Filesystem K/V-Store", "persist-fs://",
-        mod_persist_register_fn, NULL,
+        mod_persist_register_fn, (void *)&persist_backend_fs,
         mod_persist_unregister_fn, NULL,
         mod_persist_populate_fn, NULL,
         mod_persist_persist_fn, NULL,
@@ -529,6 +729,21 @@ static ib_status_t mod_persist_init(
         return rc;
     }
 
+    /* Same collections, kept in shared memory instead of files */
+    rc = ib_collection_manager_register(
+        ib, module, "Shared Memory K/V-Store", "persist-shm://",
+        mod_persist_register_fn, (void *)&persist_backend_shm,
+        mod_persist_unregister_fn, NULL,
+        mod_persist_populate_fn, NULL,
+        mod_persist_persist_fn, NULL,
+        NULL);
+    if (rc != IB_OK) {
+        ib_log_alert(ib,
+                     "Failed to register shared memory persistence handler: %s",
+                     ib_status_to_string(rc));
+        return rc;
+    }
+
     /* Compile the patterns */
     compiled = pcre_compile(key_pattern, compile_flags, &error, &eoff, NULL);
     if (compiled == NULL) {
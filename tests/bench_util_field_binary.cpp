@@ -0,0 +1,246 @@
+//////////////////////////////////////////////////////////////////////////////
+// Licensed to Qualys, Inc. (QUALYS) under one or more
+// contributor license agreements.  See the NOTICE file distributed with
+// this work for additional information regarding copyright ownership.
+// QUALYS licenses this file to You under the Apache License, Version 2.0
+// (the "License"); you may not use this file except in compliance with
+// the License.  You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//////////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief IronBee --- Persisted Collection Encoding Microbenchmark
+///
+/// Times encoding and decoding of collections the size of typical IP,
+/// session and user collections with the binary field encoding and, when
+/// built with JSON support, the JSON encoding, and reports encoded sizes.
+///
+/// Usage: bench_util_field_binary [iterations]
+//////////////////////////////////////////////////////////////////////////////
+
+#include "ironbee_config_auto.h"
+
+#include <ironbee/bytestr.h>
+#include <ironbee/clock.h>
+#include <ironbee/field.h>
+#include <ironbee/field_binary.h>
+#if ENABLE_JSON
+#include <ironbee/json.h>
+#endif
+#include <ironbee/list.h>
+#include <ironbee/mpool.h>
+#include <ironbee/util.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+void fail(const char *what)
+{
+    fprintf(stderr, "%s failed.\n", what);
+    exit(1);
+}
+
+void add_num(ib_mpool_t *mp, ib_list_t *list, const char *name, ib_num_t num)
+{
+    ib_field_t *f;
+    if (ib_field_create(&f, mp, name, strlen(name),
+                        IB_FTYPE_NUM, ib_ftype_num_in(&num)) != IB_OK ||
+        ib_list_push(list, f) != IB_OK)
+    {
+        fail("Creating a field");
+    }
+}
+
+void add_str(ib_mpool_t *mp, ib_list_t *list, const char *name,
+             const char *str)
+{
+    ib_field_t *f;
+    ib_bytestr_t *bs;
+    if (ib_bytestr_dup_nulstr(&bs, mp, str) != IB_OK ||
+        ib_field_create(&f, mp, name, strlen(name),
+                        IB_FTYPE_BYTESTR, ib_ftype_bytestr_in(bs)) != IB_OK ||
+        ib_list_push(list, f) != IB_OK)
+    {
+        fail("Creating a field");
+    }
+}
+
+// A collection with @a n counters and @a n strings.
+ib_list_t *make_collection(ib_mpool_t *mp, size_t n)
+{
+    ib_list_t *list;
+    char name[32];
+    char value[64];
+
+    if (ib_list_create(&list, mp) != IB_OK) {
+        fail("Creating a list");
+    }
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "counter_%zu", i);
+        add_num(mp, list, name, (ib_num_t)(i * 37));
+        snprintf(name, sizeof(name), "value_%zu", i);
+        snprintf(value, sizeof(value),
+                 "Mozilla/5.0 (X11; Linux x86_64) session-%zu", i * 7919);
+        add_str(mp, list, name, value);
+    }
+    return list;
+}
+
+enum encoding_t {
+    BINARY_COPY,
+    BINARY_ALIAS,
+    JSON
+};
+
+const char *encoding_name(encoding_t e)
+{
+    switch (e) {
+    case BINARY_COPY:  return "binary";
+    case BINARY_ALIAS: return "binary-alias";
+    case JSON:         return "json";
+    }
+    return "?";
+}
+
+bool encode(encoding_t e, ib_mpool_t *mp, const ib_list_t *list,
+            const uint8_t **buf, size_t *len)
+{
+    if (e == JSON) {
+#if ENABLE_JSON
+        char *obuf;
+        if (ib_json_encode(mp, list, true, &obuf, len) != IB_OK) {
+            fail("ib_json_encode");
+        }
+        *buf = (const uint8_t *)obuf;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    uint8_t *obuf;
+    if (ib_field_binary_encode(mp, list, &obuf, len) != IB_OK) {
+        fail("ib_field_binary_encode");
+    }
+    *buf = obuf;
+    return true;
+}
+
+void decode(encoding_t e, ib_mpool_t *mp, const uint8_t *buf, size_t len)
+{
+    ib_list_t *list;
+    const char *error;
+
+    if (ib_list_create(&list, mp) != IB_OK) {
+        fail("Creating a list");
+    }
+    if (e == JSON) {
+#if ENABLE_JSON
+        if (ib_json_decode_ex(mp, buf, len, list, &error) != IB_OK) {
+            fail("ib_json_decode_ex");
+        }
+#endif
+        return;
+    }
+    if (ib_field_binary_decode(mp, buf, len, e == BINARY_ALIAS,
+                               list, &error) != IB_OK)
+    {
+        fail("ib_field_binary_decode");
+    }
+}
+
+// Returns microseconds per operation.
+double per_op(ib_time_t elapsed, size_t iterations)
+{
+    return (double)elapsed / (double)iterations;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t sizes[] = { 4, 32, 256 };
+    static const encoding_t encodings[] = { BINARY_COPY, BINARY_ALIAS, JSON };
+    size_t iterations = 20000;
+
+    if (argc > 1) {
+        iterations = strtoul(argv[1], NULL, 10);
+    }
+
+    if (ib_initialize() != IB_OK) {
+        fprintf(stderr, "Failed to initialize IronBee util.\n");
+        return 1;
+    }
+
+    printf("%-13s %6s %8s %12s %12s\n",
+           "encoding", "fields", "bytes", "encode(us)", "decode(us)");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        ib_mpool_t *mp;
+        ib_mpool_t *scratch;
+        ib_list_t *list;
+
+        if (ib_mpool_create(&mp, "bench", NULL) != IB_OK ||
+            ib_mpool_create(&scratch, "scratch", NULL) != IB_OK)
+        {
+            fail("Creating a memory pool");
+        }
+        list = make_collection(mp, sizes[s] / 2);
+
+        for (size_t e = 0; e < sizeof(encodings) / sizeof(encodings[0]); ++e) {
+            const uint8_t *buf;
+            size_t len;
+            ib_time_t start;
+            ib_time_t encode_time;
+            ib_time_t decode_time;
+
+            if (! encode(encodings[e], mp, list, &buf, &len)) {
+                printf("%-13s %6zu %8s %12s %12s\n",
+                       encoding_name(encodings[e]), sizes[s], "-", "-", "-");
+                continue;
+            }
+
+            start = ib_clock_get_time();
+            for (size_t i = 0; i < iterations; ++i) {
+                const uint8_t *obuf;
+                size_t olen;
+                if (i % 64 == 0) {
+                    ib_mpool_clear(scratch);
+                }
+                encode(encodings[e], scratch, list, &obuf, &olen);
+            }
+            encode_time = ib_clock_get_time() - start;
+
+            start = ib_clock_get_time();
+            for (size_t i = 0; i < iterations; ++i) {
+                if (i % 64 == 0) {
+                    ib_mpool_clear(scratch);
+                }
+                decode(encodings[e], scratch, buf, len);
+            }
+            decode_time = ib_clock_get_time() - start;
+
+            printf("%-13s %6zu %8zu %12.2f %12.2f\n",
+                   encoding_name(encodings[e]), sizes[s], len,
+                   per_op(encode_time, iterations),
+                   per_op(decode_time, iterations));
+        }
+
+        ib_mpool_destroy(scratch);
+        ib_mpool_destroy(mp);
+    }
+
+    ib_shutdown();
+    return 0;
+}
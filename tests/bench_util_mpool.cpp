@@ -0,0 +1,123 @@
+//////////////////////////////////////////////////////////////////////////////
+// Licensed to Qualys, Inc. (QUALYS) under one or more
+// contributor license agreements.  See the NOTICE file distributed with
+// this work for additional information regarding copyright ownership.
+// QUALYS licenses this file to You under the Apache License, Version 2.0
+// (the "License"); you may not use this file except in compliance with
+// the License.  You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//////////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief IronBee --- Memory Pool Child Creation Microbenchmark
+///
+/// Times a fixed number of children of one parent pool created and released
+/// by 1 to 64 threads.  Child creation should scale rather than serialize
+/// on the parent.
+///
+/// Usage: bench_util_mpool [children, power of 2]
+//////////////////////////////////////////////////////////////////////////////
+
+#include "ironbee_config_auto.h"
+
+#include <ironbee/clock.h>
+#include <ironbee/mpool.h>
+#include <ironbee/util.h>
+
+#include <pthread.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+struct worker_t
+{
+    ib_mpool_t *parent;
+    size_t      num_children;
+    bool        failed;
+};
+
+void *create_release_children(void *arg)
+{
+    worker_t *worker = static_cast<worker_t *>(arg);
+
+    for (size_t i = 0; i < worker->num_children; ++i) {
+        ib_mpool_t *mp;
+
+        if (ib_mpool_create(&mp, NULL, worker->parent) != IB_OK) {
+            worker->failed = true;
+            break;
+        }
+        ib_mpool_alloc(mp, 100);
+        ib_mpool_release(mp);
+    }
+
+    return NULL;
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    size_t num_children = (size_t)1 << 17;
+
+    if (argc > 1) {
+        num_children = strtoul(argv[1], NULL, 10);
+    }
+
+    if (ib_initialize() != IB_OK) {
+        fprintf(stderr, "Failed to initialize IronBee util.\n");
+        return 1;
+    }
+
+    printf("%8s %12s\n", "threads", "children/s");
+    for (size_t num_threads = 1; num_threads <= 64; num_threads *= 2) {
+        std::vector<pthread_t> threads(num_threads);
+        std::vector<worker_t>  workers(num_threads);
+        ib_mpool_t *mp;
+        ib_time_t start;
+        ib_time_t elapsed;
+        bool failed = false;
+
+        if (ib_mpool_create(&mp, NULL, NULL) != IB_OK) {
+            fprintf(stderr, "Failed to create memory pool.\n");
+            return 1;
+        }
+
+        start = ib_clock_get_time();
+        for (size_t i = 0; i < num_threads; ++i) {
+            workers[i].parent = mp;
+            workers[i].num_children = num_children / num_threads;
+            workers[i].failed = false;
+            pthread_create(&threads[i], NULL,
+                           create_release_children, &workers[i]);
+        }
+        for (size_t i = 0; i < num_threads; ++i) {
+            pthread_join(threads[i], NULL);
+            failed = failed || workers[i].failed;
+        }
+        elapsed = ib_clock_get_time() - start;
+
+        ib_mpool_destroy(mp);
+
+        if (failed) {
+            fprintf(stderr, "Failed to create child pool.\n");
+            return 1;
+        }
+        printf("%8zu %12.0f\n", num_threads,
+               num_children * 1e6 / (elapsed + 1));
+    }
+
+    ib_shutdown();
+    return 0;
+}
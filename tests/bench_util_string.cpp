@@ -0,0 +1,201 @@
+//////////////////////////////////////////////////////////////////////////////
+// Licensed to Qualys, Inc. (QUALYS) under one or more
+// contributor license agreements.  See the NOTICE file distributed with
+// this work for additional information regarding copyright ownership.
+// QUALYS licenses this file to You under the Apache License, Version 2.0
+// (the "License"); you may not use this file except in compliance with
+// the License.  You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//////////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief IronBee --- String Function Microbenchmark
+///
+/// Times the string functions used by the transformations with each
+/// kernel implementation supported by the CPU, on payloads ranging from a
+/// short header value to a large request body.
+///
+/// Usage: bench_util_string [total MB per measurement]
+//////////////////////////////////////////////////////////////////////////////
+
+#include "ironbee_config_auto.h"
+
+#include <ironbee/clock.h>
+#include <ironbee/decode.h>
+#include <ironbee/mpool.h>
+#include <ironbee/string.h>
+#include <ironbee/util.h>
+
+#include "util/string_simd_private.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+// Typical form post / query string text: mostly lowercase with some
+// uppercase, spaces and the odd escape.
+const char Sample[] =
+    "username=John+Smith&comment=This%20is%20a%20fairly%20typical"
+    "+comment+with+Some+Mixed+Case+text  and  a few\tspaces,"
+    "followed+by+a+longer+run+of+plain+parameter+data&session="
+    "b7f1e2d39c4a4f0e8d6a1c2b3e4f5a6b&redirect=%2Fapp%2Fhome\r\n";
+
+const size_t Sizes[] = { 64, 1024, 16 * 1024, 256 * 1024 };
+
+typedef ib_status_t (*bench_fn_t)(ib_mpool_t *mp,
+                                  uint8_t *data,
+                                  size_t dlen);
+
+ib_status_t bench_lower(ib_mpool_t *mp, uint8_t *data, size_t dlen)
+{
+    uint8_t *out;
+    size_t olen;
+    ib_flags_t result;
+
+    return ib_strlower_ex(IB_STROP_COW, mp, data, dlen, &out, &olen, &result);
+}
+
+ib_status_t bench_wspc_remove(ib_mpool_t *mp, uint8_t *data, size_t dlen)
+{
+    uint8_t *out;
+    size_t olen;
+    ib_flags_t result;
+
+    return ib_str_wspc_remove_ex(IB_STROP_COPY, mp, data, dlen,
+                                 &out, &olen, &result);
+}
+
+ib_status_t bench_wspc_compress(ib_mpool_t *mp, uint8_t *data, size_t dlen)
+{
+    uint8_t *out;
+    size_t olen;
+    ib_flags_t result;
+
+    return ib_str_wspc_compress_ex(IB_STROP_COPY, mp, data, dlen,
+                                   &out, &olen, &result);
+}
+
+ib_status_t bench_url_decode(ib_mpool_t *mp, uint8_t *data, size_t dlen)
+{
+    uint8_t *out;
+    size_t olen;
+    ib_flags_t result;
+
+    return ib_util_decode_url_cow_ex(mp, data, dlen, false,
+                                     &out, &olen, &result);
+}
+
+struct bench_t {
+    const char *name;
+    bench_fn_t  fn;
+};
+
+const bench_t Benchmarks[] = {
+    { "lowercase",     bench_lower },
+    { "wspc_remove",   bench_wspc_remove },
+    { "wspc_compress", bench_wspc_compress },
+    { "url_decode",    bench_url_decode },
+};
+
+// Returns MB/s.
+double run(const bench_t &bench,
+           const std::vector<uint8_t> &payload,
+           size_t total)
+{
+    ib_mpool_t *mp;
+    size_t iterations = total / payload.size() + 1;
+    ib_time_t start;
+    ib_time_t elapsed;
+
+    if (ib_mpool_create(&mp, "bench", NULL) != IB_OK) {
+        fprintf(stderr, "Failed to create memory pool.\n");
+        exit(1);
+    }
+
+    start = ib_clock_get_time();
+    for (size_t i = 0; i < iterations; ++i) {
+        if (i % 256 == 0) {
+            ib_mpool_clear(mp);
+        }
+        if (bench.fn(mp, const_cast<uint8_t *>(&payload[0]),
+                     payload.size()) != IB_OK)
+        {
+            fprintf(stderr, "%s failed.\n", bench.name);
+            exit(1);
+        }
+    }
+    elapsed = ib_clock_get_time() - start;
+
+    ib_mpool_destroy(mp);
+
+    if (elapsed == 0) {
+        elapsed = 1;
+    }
+    return (double)(iterations * payload.size()) / (double)elapsed;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    static const ib_simd_level_t levels[] = {
+        IB_SIMD_NONE, IB_SIMD_SSE2, IB_SIMD_AVX2
+    };
+    size_t total = 64;
+
+    if (argc > 1) {
+        total = strtoul(argv[1], NULL, 10);
+    }
+    total *= 1024 * 1024;
+
+    if (ib_initialize() != IB_OK) {
+        fprintf(stderr, "Failed to initialize IronBee util.\n");
+        return 1;
+    }
+
+    printf("%-14s %8s", "function", "size");
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+        printf(" %10s", ib_simd_level_name(levels[l]));
+    }
+    printf("  (MB/s)\n");
+
+    for (size_t b = 0; b < sizeof(Benchmarks) / sizeof(Benchmarks[0]); ++b) {
+        for (size_t s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); ++s) {
+            std::vector<uint8_t> payload(Sizes[s]);
+            for (size_t i = 0; i < Sizes[s]; ++i) {
+                payload[i] = Sample[i % (sizeof(Sample) - 1)];
+            }
+            // Already lowercase data, so lowercase measures the scan
+            // rather than the copy.
+            if (Benchmarks[b].fn == bench_lower) {
+                for (size_t i = 0; i < Sizes[s]; ++i) {
+                    payload[i] = tolower(payload[i]);
+                }
+            }
+
+            printf("%-14s %8zu", Benchmarks[b].name, Sizes[s]);
+            for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+                if (ib_simd_set_level(levels[l]) != levels[l]) {
+                    printf(" %10s", "-");
+                    continue;
+                }
+                printf(" %10.1f", run(Benchmarks[b], payload, total));
+            }
+            printf("\n");
+        }
+    }
+
+    ib_shutdown();
+    return 0;
+}
@@ -0,0 +1,446 @@
+//////////////////////////////////////////////////////////////////////////////
+// Licensed to Qualys, Inc. (QUALYS) under one or more
+// contributor license agreements.  See the NOTICE file distributed with
+// this work for additional information regarding copyright ownership.
+// QUALYS licenses this file to You under the Apache License, Version 2.0
+// (the "License"); you may not use this file except in compliance with
+// the License.  You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//////////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief IronBee --- Asynchronous audit log writer tests
+//////////////////////////////////////////////////////////////////////////////
+
+#include "gtest/gtest.h"
+
+#include "base_fixture.h"
+
+extern "C" {
+#include "core_audit_private.h"
+#include "engine_private.h"
+}
+
+#include <ironbee/lock.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+typedef std::map<std::string, int> id_counts_t;
+
+class TestCoreAuditWriter : public BaseFixture
+{
+public:
+    std::string dir;
+    ib_auditlog_cfg_t auditlog;
+    ib_core_cfg_t corecfg;
+
+    virtual void SetUp()
+    {
+        char tmpl[] = "TestCoreAuditWriter.XXXXXX";
+
+        BaseFixture::SetUp();
+
+        ASSERT_TRUE(mkdtemp(tmpl));
+        dir = tmpl;
+
+        memset(&auditlog, 0, sizeof(auditlog));
+        ASSERT_EQ(IB_OK, ib_lock_init(&auditlog.index_fp_lock));
+        auditlog.index_fp = fopen((dir + "/index").c_str(), "w");
+        ASSERT_TRUE(auditlog.index_fp);
+
+        memset(&corecfg, 0, sizeof(corecfg));
+        corecfg.auditlog_dmode = 0700;
+        corecfg.auditlog_fmode = 0600;
+        corecfg.auditlog_queue_size = 1024;
+        corecfg.auditlog_queue_overflow = CORE_AUDIT_OVERFLOW_BLOCK;
+        corecfg.auditlog_segment_size = 1024 * 1024;
+    }
+
+    virtual void TearDown()
+    {
+        if (auditlog.index_fp != NULL) {
+            fclose(auditlog.index_fp);
+        }
+        ib_lock_destroy(&auditlog.index_fp_lock);
+        boost::filesystem::remove_all(dir);
+
+        BaseFixture::TearDown();
+    }
+
+    // Submit the record of transaction @a id.  A spilled record is
+    // destroyed, as the caller would after writing it synchronously.
+    ib_status_t submit(core_audit_writer_t *writer, const std::string& id)
+    {
+        std::string data = "record " + id + "\n";
+        std::string line = id + " ";
+        core_audit_record_t *record;
+        ib_status_t rc;
+
+        rc = core_audit_record_create(strdup(data.c_str()), data.length(),
+                                      dir.c_str(), id.c_str(), &auditlog,
+                                      line.c_str(), line.length(), &record);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        record->num_file_fields = 1;
+        record->file_fields[0] = line.length();
+
+        rc = core_audit_writer_submit(writer, record);
+        if (rc == IB_EAGAIN) {
+            core_audit_record_destroy(record);
+        }
+        return rc;
+    }
+
+    ib_auditlog_stats_t stats(core_audit_writer_t *writer)
+    {
+        ib_auditlog_stats_t s;
+
+        core_audit_writer_stats(writer, &s);
+        return s;
+    }
+
+    // Wait (up to 5s) for the queue to drain to @a depth records.
+    bool wait_for_depth(core_audit_writer_t *writer, size_t depth)
+    {
+        for (int i = 0; i < 5000; ++i) {
+            if (stats(writer).queue_depth == depth) {
+                return true;
+            }
+            usleep(1000);
+        }
+        return false;
+    }
+
+    // Stall the writer: it takes @a id and then waits for the index lock.
+    void stall(core_audit_writer_t *writer, const std::string& id)
+    {
+        ASSERT_EQ(IB_OK, ib_lock_lock(&auditlog.index_fp_lock));
+        ASSERT_EQ(IB_OK, submit(writer, id));
+        ASSERT_TRUE(wait_for_depth(writer, 0));
+        usleep(100000);
+    }
+
+    // Count the records of each transaction in the segments, checking
+    // that each companion index entry points at its record.
+    id_counts_t segment_records()
+    {
+        using namespace boost::filesystem;
+        id_counts_t counts;
+
+        for (directory_iterator i(dir); i != directory_iterator(); ++i) {
+            std::string name = i->path().filename().string();
+            size_t offset;
+            size_t length;
+            std::string id;
+
+            if ( (name.find("ironbee-audit-") != 0) ||
+                 (name.rfind(".log") != name.length() - 4) )
+            {
+                continue;
+            }
+
+            std::ifstream segment((dir + "/" + name).c_str());
+            std::stringstream data;
+            data << segment.rdbuf();
+
+            std::ifstream index((dir + "/" + name + ".index").c_str());
+            while (index >> offset >> length >> id) {
+                EXPECT_EQ("record " + id + "\n",
+                          data.str().substr(offset, length));
+                ++counts[id];
+            }
+        }
+        return counts;
+    }
+
+    // Count the AuditLogIndex lines of each transaction.
+    id_counts_t index_records()
+    {
+        id_counts_t counts;
+        std::string id;
+        std::string location;
+
+        std::ifstream index((dir + "/index").c_str());
+        while (index >> id >> location) {
+            EXPECT_NE(std::string::npos, location.find(".log:"));
+            ++counts[id];
+        }
+        return counts;
+    }
+};
+
+struct submitter_t {
+    TestCoreAuditWriter *test;
+    core_audit_writer_t *writer;
+    int thread;
+    int records;
+    bool done;
+};
+
+static void *submitter(void *arg)
+{
+    submitter_t *s = static_cast<submitter_t *>(arg);
+
+    for (int i = 0; i < s->records; ++i) {
+        std::string id = "t" + boost::lexical_cast<std::string>(s->thread) +
+                         "-" + boost::lexical_cast<std::string>(i);
+        EXPECT_EQ(IB_OK, s->test->submit(s->writer, id));
+    }
+    __atomic_store_n(&s->done, true, __ATOMIC_SEQ_CST);
+
+    return NULL;
+}
+
+TEST_F(TestCoreAuditWriter, test_threads)
+{
+    const int num_threads = 8;
+    const int num_records = 500;
+    core_audit_writer_t *writer;
+    pthread_t threads[num_threads];
+    submitter_t submitters[num_threads];
+
+    // A small queue and segments: producers block and segments rotate.
+    corecfg.auditlog_queue_size = 16;
+    corecfg.auditlog_segment_size = 4096;
+    ASSERT_EQ(IB_OK, core_audit_writer_create(ib_engine, &corecfg, &writer));
+
+    for (int t = 0; t < num_threads; ++t) {
+        submitters[t].test = this;
+        submitters[t].writer = writer;
+        submitters[t].thread = t;
+        submitters[t].records = num_records;
+        submitters[t].done = false;
+        ASSERT_EQ(0, pthread_create(&threads[t], NULL,
+                                    submitter, &submitters[t]));
+    }
+    for (int t = 0; t < num_threads; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+
+    ASSERT_TRUE(wait_for_depth(writer, 0));
+    EXPECT_EQ(uint64_t(num_threads * num_records), stats(writer).queued);
+    EXPECT_EQ(0U, stats(writer).dropped);
+    core_audit_writer_destroy(writer);
+
+    id_counts_t segments = segment_records();
+    id_counts_t index = index_records();
+    EXPECT_EQ(size_t(num_threads * num_records), segments.size());
+    EXPECT_EQ(size_t(num_threads * num_records), index.size());
+    for (int t = 0; t < num_threads; ++t) {
+        for (int i = 0; i < num_records; ++i) {
+            std::string id = "t" + boost::lexical_cast<std::string>(t) +
+                             "-" + boost::lexical_cast<std::string>(i);
+            EXPECT_EQ(1, segments[id]) << id;
+            EXPECT_EQ(1, index[id]) << id;
+        }
+    }
+}
+
+TEST_F(TestCoreAuditWriter, test_overflow_block)
+{
+    core_audit_writer_t *writer;
+    pthread_t thread;
+    submitter_t s;
+
+    corecfg.auditlog_queue_size = 4;
+    corecfg.auditlog_queue_overflow = CORE_AUDIT_OVERFLOW_BLOCK;
+    ASSERT_EQ(IB_OK, core_audit_writer_create(ib_engine, &corecfg, &writer));
+
+    // Fill the queue, then block a fifth submitter.
+    stall(writer, "first");
+    s.test = this;
+    s.writer = writer;
+    s.thread = 0;
+    s.records = 5;
+    s.done = false;
+    ASSERT_EQ(0, pthread_create(&thread, NULL, submitter, &s));
+    for (int i = 0; i < 5000 && stats(writer).blocked == 0; ++i) {
+        usleep(1000);
+    }
+    EXPECT_EQ(1U, stats(writer).blocked);
+    EXPECT_EQ(4U, stats(writer).queue_depth);
+    EXPECT_FALSE(__atomic_load_n(&s.done, __ATOMIC_SEQ_CST));
+
+    // Once the writer moves on, the submitter does too.
+    ASSERT_EQ(IB_OK, ib_lock_unlock(&auditlog.index_fp_lock));
+    pthread_join(thread, NULL);
+    EXPECT_TRUE(s.done);
+    EXPECT_EQ(6U, stats(writer).queued);
+    EXPECT_EQ(0U, stats(writer).dropped);
+    EXPECT_EQ(0U, stats(writer).spilled);
+    core_audit_writer_destroy(writer);
+
+    id_counts_t segments = segment_records();
+    EXPECT_EQ(6U, segments.size());
+    EXPECT_EQ(1, segments["first"]);
+    EXPECT_EQ(1, segments["t0-4"]);
+}
+
+TEST_F(TestCoreAuditWriter, test_overflow_drop)
+{
+    core_audit_writer_t *writer;
+
+    corecfg.auditlog_queue_size = 4;
+    corecfg.auditlog_queue_overflow = CORE_AUDIT_OVERFLOW_DROP;
+    ASSERT_EQ(IB_OK, core_audit_writer_create(ib_engine, &corecfg, &writer));
+
+    stall(writer, "first");
+    for (int i = 0; i < 6; ++i) {
+        EXPECT_EQ(IB_OK,
+                  submit(writer, "r" + boost::lexical_cast<std::string>(i)));
+    }
+    EXPECT_EQ(2U, stats(writer).dropped);
+    EXPECT_EQ(5U, stats(writer).queued);
+    EXPECT_EQ(4U, stats(writer).queue_max_depth);
+
+    ASSERT_EQ(IB_OK, ib_lock_unlock(&auditlog.index_fp_lock));
+    core_audit_writer_destroy(writer);
+
+    id_counts_t segments = segment_records();
+    EXPECT_EQ(5U, segments.size());
+    EXPECT_EQ(1, segments["r3"]);
+    EXPECT_EQ(0U, segments.count("r4"));
+    EXPECT_EQ(0U, segments.count("r5"));
+}
+
+TEST_F(TestCoreAuditWriter, test_overflow_spill)
+{
+    core_audit_writer_t *writer;
+
+    corecfg.auditlog_queue_size = 4;
+    corecfg.auditlog_queue_overflow = CORE_AUDIT_OVERFLOW_SPILL;
+    ASSERT_EQ(IB_OK, core_audit_writer_create(ib_engine, &corecfg, &writer));
+
+    stall(writer, "first");
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(IB_OK,
+                  submit(writer, "r" + boost::lexical_cast<std::string>(i)));
+    }
+    EXPECT_EQ(IB_EAGAIN, submit(writer, "r4"));
+    EXPECT_EQ(IB_EAGAIN, submit(writer, "r5"));
+    EXPECT_EQ(2U, stats(writer).spilled);
+    EXPECT_EQ(0U, stats(writer).dropped);
+    EXPECT_EQ(5U, stats(writer).queued);
+
+    ASSERT_EQ(IB_OK, ib_lock_unlock(&auditlog.index_fp_lock));
+    core_audit_writer_destroy(writer);
+
+    id_counts_t segments = segment_records();
+    EXPECT_EQ(5U, segments.size());
+    EXPECT_EQ(0U, segments.count("r4"));
+}
+
+TEST_F(TestCoreAuditWriter, test_shutdown_flush)
+{
+    core_audit_writer_t *writer;
+
+    corecfg.auditlog_queue_size = 16;
+    ASSERT_EQ(IB_OK, core_audit_writer_create(ib_engine, &corecfg, &writer));
+
+    // Records still queued at shutdown are written.
+    stall(writer, "first");
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(IB_OK,
+                  submit(writer, "r" + boost::lexical_cast<std::string>(i)));
+    }
+    EXPECT_EQ(10U, stats(writer).queue_depth);
+    ASSERT_EQ(IB_OK, ib_lock_unlock(&auditlog.index_fp_lock));
+    core_audit_writer_destroy(writer);
+
+    id_counts_t segments = segment_records();
+    id_counts_t index = index_records();
+    EXPECT_EQ(11U, segments.size());
+    EXPECT_EQ(11U, index.size());
+    for (int i = 0; i < 10; ++i) {
+        std::string id = "r" + boost::lexical_cast<std::string>(i);
+        EXPECT_EQ(1, segments[id]) << id;
+        EXPECT_EQ(1, index[id]) << id;
+    }
+}
+
+TEST_F(TestCoreAuditWriter, test_fork)
+{
+    const int num_records = 10;
+    int status;
+    pid_t pid;
+
+    // The writer is started when the configuration is done, before the
+    // fork; its queue is smaller than the number of records written.
+    configureIronBeeByString(
+        "LogLevel 4\n"
+        "LoadModule \"ibmod_htp.so\"\n"
+        "Set parser \"htp\"\n"
+        "SensorId B9C1B52B-C24A-4309-B9F9-0EF4CD577A3E\n"
+        "SensorName UnitTesting\n"
+        "SensorHostname unit-testing.sensor.tld\n"
+        "AuditEngine On\n"
+        "AuditLogIndex None\n"
+        "AuditLogBaseDir " + dir + "\n"
+        "AuditLogWriter Async\n"
+        "AuditLogQueueSize 4\n"
+        "AuditLogQueueOverflow Block\n"
+        "<Site default>\n"
+        "  SiteId AAAABBBB-1111-2222-3333-000000000000\n"
+        "  Hostname *\n"
+        "</Site>\n");
+
+    // The child has no writer thread: its audit logs are written
+    // synchronously instead of blocking on the queue.
+    pid = fork();
+    ASSERT_NE(-1, pid);
+    if (pid == 0) {
+        alarm(30);
+        for (int i = 0; i < num_records; ++i) {
+            ib_conn_t *conn = buildIronBeeConnection();
+            sendDataIn(conn,
+                       "GET / HTTP/1.1\r\n"
+                       "Host: UnitTest\r\n"
+                       "\r\n");
+            sendDataOut(conn,
+                        "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: text/html\r\n"
+                        "\r\n");
+            ib_state_notify_conn_closed(ib_engine, conn);
+        }
+        ib_engine_destroy(ib_engine);
+        _exit(0);
+    }
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+
+    // Each transaction has its own audit log file, and none was queued.
+    int files = 0;
+    for (boost::filesystem::directory_iterator i(dir);
+         i != boost::filesystem::directory_iterator();
+         ++i)
+    {
+        std::string name = i->path().filename().string();
+
+        if ( (name.find("ironbee-audit-") != 0) &&
+             (name.rfind(".log") == name.length() - 4) )
+        {
+            ++files;
+        }
+    }
+    EXPECT_EQ(num_records, files);
+    EXPECT_TRUE(segment_records().empty());
+}
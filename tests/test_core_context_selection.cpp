@@ -0,0 +1,249 @@
+//////////////////////////////////////////////////////////////////////////////
+// Licensed to Qualys, Inc. (QUALYS) under one or more
+// contributor license agreements.  See the NOTICE file distributed with
+// this work for additional information regarding copyright ownership.
+// QUALYS licenses this file to You under the Apache License, Version 2.0
+// (the "License"); you may not use this file except in compliance with
+// the License.  You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//////////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief IronBee --- Core context selection tests
+//////////////////////////////////////////////////////////////////////////////
+
+#include "gtest/gtest.h"
+
+#include "base_fixture.h"
+
+#include <ironbee/engine.h>
+#include <ironbee/site.h>
+
+#include <string>
+
+class TestCoreContextSelection : public BaseFixture
+{
+public:
+    virtual void SetUp()
+    {
+        BaseFixture::SetUp();
+        configureIronBeeByString(
+            "LogLevel 4\n"
+            "LoadModule \"ibmod_htp.so\"\n"
+            "Set parser \"htp\"\n"
+            "SensorId B9C1B52B-C24A-4309-B9F9-0EF4CD577A3E\n"
+            "SensorName UnitTesting\n"
+            "SensorHostname unit-testing.sensor.tld\n"
+            "AuditEngine Off\n"
+
+            // Any host, but only on one IP and port.
+            "<Site exact-service>\n"
+            "  SiteId AAAABBBB-1111-2222-3333-000000000001\n"
+            "  Service 1.0.0.1:8080\n"
+            "  Hostname *\n"
+            "</Site>\n"
+
+            "<Site exact-host>\n"
+            "  SiteId AAAABBBB-1111-2222-3333-000000000002\n"
+            "  Hostname www.example.com\n"
+            "</Site>\n"
+
+            "<Site wildcard-host>\n"
+            "  SiteId AAAABBBB-1111-2222-3333-000000000003\n"
+            "  Hostname *.example.com\n"
+            "</Site>\n"
+
+            // Also matches www.example.com, but comes after exact-host.
+            "<Site shadowed>\n"
+            "  SiteId AAAABBBB-1111-2222-3333-000000000004\n"
+            "  Hostname www.example.com\n"
+            "  Hostname shadowed.example.org\n"
+            "</Site>\n"
+
+            "<Site locations>\n"
+            "  SiteId AAAABBBB-1111-2222-3333-000000000005\n"
+            "  Hostname locations.example.org\n"
+            "  <Location /app>\n"
+            "  </Location>\n"
+            "  <Location /app/admin>\n"
+            "  </Location>\n"
+            "  <Location /api/v2>\n"
+            "  </Location>\n"
+            "  <Location /api>\n"
+            "  </Location>\n"
+            "</Site>\n"
+
+            // The suffix is the whole name after the wildcard.
+            "<Site whole-suffix>\n"
+            "  SiteId AAAABBBB-1111-2222-3333-000000000007\n"
+            "  Hostname *example.net\n"
+            "</Site>\n"
+
+            "<Site default>\n"
+            "  SiteId AAAABBBB-1111-2222-3333-000000000006\n"
+            "  Hostname *\n"
+            "</Site>\n");
+    }
+
+    // Open a connection to @a ip : @a port.
+    ib_conn_t *connect(const char *ip, int port)
+    {
+        ib_conn_t *conn;
+
+        if (ib_conn_create(ib_engine, &conn, NULL) != IB_OK) {
+            throw std::runtime_error("ib_conn_create failed");
+        }
+        conn->local_ipstr = ip;
+        conn->local_port = port;
+        conn->remote_ipstr = "1.0.0.2";
+        conn->remote_port = 65534;
+        ib_state_notify_conn_opened(ib_engine, conn);
+
+        return conn;
+    }
+
+    // Send the headers of a request for @a host and @a path.
+    ib_tx_t *request(ib_conn_t *conn,
+                     const std::string& host,
+                     const std::string& path)
+    {
+        sendDataIn(conn,
+                   "GET " + path + " HTTP/1.1\r\n"
+                   "Host: " + host + "\r\n"
+                   "\r\n");
+        if (conn->tx == NULL) {
+            throw std::runtime_error("No transaction");
+        }
+        return conn->tx;
+    }
+
+    // Name of the site of @a ctx.
+    std::string site_name(const ib_context_t *ctx)
+    {
+        const ib_site_t *site = NULL;
+
+        if ( (ib_context_site_get(ctx, &site) != IB_OK) || (site == NULL) ) {
+            return "<none>";
+        }
+        return site->name;
+    }
+
+    // Site selected for a request for @a host and @a path on @a ip : @a port.
+    std::string select_site(const char *ip, int port,
+                            const std::string& host,
+                            const std::string& path = "/")
+    {
+        return site_name(request(connect(ip, port), host, path)->ctx);
+    }
+
+    // Location selected for a request for @a host and @a path.
+    std::string select_location(const std::string& host,
+                                const std::string& path)
+    {
+        ib_tx_t *tx = request(connect("1.0.0.1", 80), host, path);
+        const ib_site_location_t *location = NULL;
+
+        if ( (ib_context_location_get(tx->ctx, &location) != IB_OK) ||
+             (location == NULL) )
+        {
+            return "<none>";
+        }
+        return location->path;
+    }
+};
+
+TEST_F(TestCoreContextSelection, test_first_site_wins)
+{
+    // exact-service comes first, so it wins over exact-host.
+    EXPECT_EQ("exact-service",
+              select_site("1.0.0.1", 8080, "www.example.com"));
+
+    // shadowed is never selected for a host an earlier site has.
+    EXPECT_EQ("exact-host", select_site("1.0.0.1", 80, "www.example.com"));
+    EXPECT_EQ("shadowed",
+              select_site("1.0.0.1", 80, "shadowed.example.org"));
+}
+
+TEST_F(TestCoreContextSelection, test_hosts)
+{
+    // An exact host name wins over a later wildcard, in any case.
+    EXPECT_EQ("exact-host", select_site("1.0.0.1", 80, "www.example.com"));
+    EXPECT_EQ("exact-host", select_site("1.0.0.1", 80, "WWW.Example.COM"));
+
+    // Wildcard suffixes match any number of labels.
+    EXPECT_EQ("wildcard-host",
+              select_site("1.0.0.1", 80, "foo.example.com"));
+    EXPECT_EQ("wildcard-host",
+              select_site("1.0.0.1", 80, "a.b.EXAMPLE.com"));
+
+    // Only the suffix matches.
+    EXPECT_EQ("default", select_site("1.0.0.1", 80, "foo.example.co"));
+    EXPECT_EQ("default", select_site("1.0.0.1", 80, "fooexample.com"));
+}
+
+TEST_F(TestCoreContextSelection, test_whole_suffix)
+{
+    // The wildcard matches any prefix, including an empty one.
+    EXPECT_EQ("whole-suffix", select_site("1.0.0.1", 80, "example.net"));
+    EXPECT_EQ("whole-suffix", select_site("1.0.0.1", 80, "EXAMPLE.net"));
+    EXPECT_EQ("whole-suffix", select_site("1.0.0.1", 80, "www.example.net"));
+    EXPECT_EQ("whole-suffix", select_site("1.0.0.1", 80, "myexample.net"));
+
+    // Shorter host names only share a part of the suffix.
+    EXPECT_EQ("default", select_site("1.0.0.1", 80, "xample.net"));
+    EXPECT_EQ("default", select_site("1.0.0.1", 80, "net"));
+}
+
+TEST_F(TestCoreContextSelection, test_services)
+{
+    ib_conn_t *conn;
+
+    // The connection context is that of the first site for the service.
+    conn = connect("1.0.0.1", 8080);
+    EXPECT_EQ("exact-service", site_name(conn->ctx));
+    conn = connect("1.0.0.1", 80);
+    EXPECT_EQ("exact-host", site_name(conn->ctx));
+
+    // Both the IP address and port must match.
+    EXPECT_EQ("exact-service", select_site("1.0.0.1", 8080, "other.org"));
+    EXPECT_EQ("default", select_site("1.0.0.1", 8081, "other.org"));
+    EXPECT_EQ("default", select_site("1.0.0.2", 8080, "other.org"));
+
+    // The whole IP address must match, not just a prefix of it.
+    EXPECT_EQ("default", select_site("1.0.0.10", 8080, "other.org"));
+    EXPECT_EQ("default", select_site("1.0.0.", 8080, "other.org"));
+}
+
+TEST_F(TestCoreContextSelection, test_locations)
+{
+    // The first declared location that is a prefix of the path wins, even
+    // over a longer one declared later.
+    EXPECT_EQ("/app", select_location("locations.example.org", "/app"));
+    EXPECT_EQ("/app",
+              select_location("locations.example.org", "/app/admin/x"));
+    EXPECT_EQ("/api/v2",
+              select_location("locations.example.org", "/api/v2/x"));
+    EXPECT_EQ("/api", select_location("locations.example.org", "/api/v1"));
+
+    // Anything else goes to the site's default location.
+    EXPECT_EQ("/", select_location("locations.example.org", "/other"));
+    EXPECT_EQ("/", select_location("locations.example.org", "/ap"));
+    EXPECT_EQ("locations",
+              select_site("1.0.0.1", 80, "locations.example.org", "/x"));
+}
+
+TEST_F(TestCoreContextSelection, test_default_site)
+{
+    // A request no other site matches goes to the catch-all site.
+    EXPECT_EQ("default", select_site("1.0.0.1", 80, "unknown.org"));
+    EXPECT_EQ("default", select_site("10.0.0.1", 443, "example.org", "/x"));
+    EXPECT_EQ("/", select_location("unknown.org", "/app"));
+}
@@ -0,0 +1,238 @@
+//////////////////////////////////////////////////////////////////////////////
+// Licensed to Qualys, Inc. (QUALYS) under one or more
+// contributor license agreements.  See the NOTICE file distributed with
+// this work for additional information regarding copyright ownership.
+// QUALYS licenses this file to You under the Apache License, Version 2.0
+// (the "License"); you may not use this file except in compliance with
+// the License.  You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//////////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief IronBee --- Asynchronous logger tests
+//////////////////////////////////////////////////////////////////////////////
+
+#include "gtest/gtest.h"
+
+#include "base_fixture.h"
+
+extern "C" {
+#include "core_private.h"
+}
+
+#include <ironbee/log.h>
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#define LOG_PATH "TestCoreLogWriter.log"
+
+// Log through @a writer, as the core logger does.
+static ib_status_t log_line(core_log_writer_t *writer,
+                            ib_log_level_t level,
+                            const char *fmt, ...)
+{
+    va_list ap;
+    ib_status_t rc;
+
+    va_start(ap, fmt);
+    rc = core_log_writer_vlog(writer, level, "", fmt, ap);
+    va_end(ap);
+
+    return rc;
+}
+
+// Messages of the lines in @a fp, from after the "[pid] " prefix.
+static std::vector<std::string> read_messages(FILE *fp)
+{
+    std::vector<std::string> messages;
+    char buf[2048];
+
+    rewind(fp);
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        std::string line(buf);
+        size_t pos = line.find("] ");
+
+        EXPECT_EQ('\n', line[line.length() - 1]);
+        EXPECT_NE(std::string::npos, pos);
+        messages.push_back(line.substr(pos + 2, line.length() - pos - 3));
+    }
+    return messages;
+}
+
+struct producer_t {
+    core_log_writer_t *writer;
+    int thread;
+    int lines;
+};
+
+static void *producer(void *arg)
+{
+    producer_t *p = static_cast<producer_t *>(arg);
+
+    for (int i = 0; i < p->lines; ++i) {
+        EXPECT_EQ(IB_OK, log_line(p->writer, IB_LOG_INFO,
+                                  "thread %d line %d", p->thread, i));
+    }
+    return NULL;
+}
+
+TEST(TestCoreLogWriter, test_order)
+{
+    core_log_writer_t *writer;
+    FILE *fp = tmpfile();
+
+    ASSERT_TRUE(fp);
+    ASSERT_EQ(IB_OK, core_log_writer_create(fp, &writer));
+
+    // Many times the ring size: the thread waits for the writer.
+    for (int i = 0; i < 2000; ++i) {
+        ASSERT_EQ(IB_OK, log_line(writer, IB_LOG_INFO, "line %d", i));
+    }
+    core_log_writer_destroy(writer);
+
+    std::vector<std::string> messages = read_messages(fp);
+    ASSERT_EQ(2000U, messages.size());
+    for (int i = 0; i < 2000; ++i) {
+        EXPECT_EQ("line " + boost::lexical_cast<std::string>(i),
+                  messages[i]);
+    }
+    fclose(fp);
+}
+
+TEST(TestCoreLogWriter, test_threads)
+{
+    const int num_threads = 8;
+    const int num_lines = 2000;
+    core_log_writer_t *writer;
+    pthread_t threads[num_threads];
+    producer_t producers[num_threads];
+    std::vector<int> next(num_threads, 0);
+    FILE *fp = tmpfile();
+
+    ASSERT_TRUE(fp);
+    ASSERT_EQ(IB_OK, core_log_writer_create(fp, &writer));
+
+    for (int t = 0; t < num_threads; ++t) {
+        producers[t].writer = writer;
+        producers[t].thread = t;
+        producers[t].lines = num_lines;
+        ASSERT_EQ(0, pthread_create(&threads[t], NULL,
+                                    producer, &producers[t]));
+    }
+    for (int t = 0; t < num_threads; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+    core_log_writer_destroy(writer);
+
+    // No line is lost, and each thread's lines are in order.
+    std::vector<std::string> messages = read_messages(fp);
+    ASSERT_EQ(size_t(num_threads * num_lines), messages.size());
+    for (size_t i = 0; i < messages.size(); ++i) {
+        int t;
+        int n;
+
+        ASSERT_EQ(2, sscanf(messages[i].c_str(), "thread %d line %d",
+                            &t, &n));
+        ASSERT_LE(0, t);
+        ASSERT_GT(num_threads, t);
+        EXPECT_EQ(next[t], n);
+        next[t] = n + 1;
+    }
+    for (int t = 0; t < num_threads; ++t) {
+        EXPECT_EQ(num_lines, next[t]);
+    }
+    fclose(fp);
+}
+
+TEST(TestCoreLogWriter, test_destroy_flush)
+{
+    core_log_writer_t *writer;
+    FILE *fp = tmpfile();
+
+    ASSERT_TRUE(fp);
+    ASSERT_EQ(IB_OK, core_log_writer_create(fp, &writer));
+
+    // Destroyed well within the flush interval: all lines are written.
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(IB_OK, log_line(writer, IB_LOG_DEBUG, "line %d", i));
+    }
+    core_log_writer_destroy(writer);
+
+    std::vector<std::string> messages = read_messages(fp);
+    ASSERT_EQ(10U, messages.size());
+    EXPECT_EQ("line 9", messages[9]);
+    fclose(fp);
+}
+
+class TestCoreLogWriterEngine : public BaseFixture
+{
+public:
+    virtual void SetUp()
+    {
+        unlink(LOG_PATH);
+        BaseFixture::SetUp();
+        configureIronBeeByString(
+            "LogLevel error\n"
+            "Log " LOG_PATH "\n"
+            "LogWriter Async\n"
+            "SensorId B9C1B52B-C24A-4309-B9F9-0EF4CD577A3E\n"
+            "SensorName UnitTesting\n"
+            "SensorHostname unit-testing.sensor.tld\n"
+            "AuditEngine Off\n");
+    }
+
+    virtual void TearDown()
+    {
+        if (ib_engine != NULL) {
+            BaseFixture::TearDown();
+        }
+        unlink(LOG_PATH);
+    }
+
+    // Shut down the engine, writing out the log, and read the log.
+    std::string shutdown()
+    {
+        std::string text;
+        std::string line;
+
+        ib_engine_destroy(ib_engine);
+        ib_shutdown();
+        ib_engine = NULL;
+
+        std::ifstream log(LOG_PATH);
+        while (std::getline(log, line)) {
+            text += line + "\n";
+        }
+        return text;
+    }
+};
+
+TEST_F(TestCoreLogWriterEngine, test_level)
+{
+    // Messages above the log level are dropped before they are formatted
+    // or reach the asynchronous logger.
+    for (int i = 0; i < 1000; ++i) {
+        ib_log_debug(ib_engine, "hidden %d", i);
+        ib_log_info(ib_engine, "hidden %d", i);
+    }
+    ib_log_error(ib_engine, "shown %d", 1);
+
+    std::string text = shutdown();
+    EXPECT_EQ(std::string::npos, text.find("hidden"));
+    EXPECT_NE(std::string::npos, text.find("shown 1\n"));
+}
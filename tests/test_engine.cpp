@@ -32,9 +32,17 @@
 #include <ironbee/transformation.h>
 #include <ironbee/provider.h>
 
+#include <ironbee/action.h>
+#include <ironbee/operator.h>
+
 #include "config-parser.h"
 #include "ibtest_util.hpp"
 #include "engine_private.h"
+#include "rule_engine_private.h"
+
+#include <map>
+#include <string>
+#include <vector>
 
 /// @test Test ironbee library - ib_engine_create()
 TEST(TestIronBee, test_engine_create_null_server)
@@ -214,6 +222,697 @@ TEST(TestIronBee, test_tfn)
     ibtest_engine_destroy(ib);
 }
 
+static ib_status_t foo2bar_inplace(ib_engine_t *ib,
+                                   ib_mpool_t *mp,
+                                   void *fndata,
+                                   uint8_t *data_in,
+                                   size_t dlen_in,
+                                   uint8_t **data_out,
+                                   size_t *dlen_out,
+                                   ib_flags_t *pflags)
+{
+    *data_out = data_in;
+    *dlen_out = dlen_in;
+    *pflags = IB_TFN_NONE;
+    if ( (dlen_in == 3) && (memcmp(data_in, "foo", 3) == 0) ) {
+        memcpy(data_in, "bar", 3);
+        *pflags = IB_TFN_FMODIFIED;
+    }
+
+    return IB_OK;
+}
+
+/// @test Test ironbee library - in-place transformation registration
+TEST(TestIronBee, test_tfn_inplace)
+{
+    ib_engine_t *ib;
+    ib_tfn_t *tfn = NULL;
+    ib_flags_t flags;
+    uint8_t data[8];
+    uint8_t *data_out;
+    size_t dlen_out;
+
+    ibtest_engine_create(&ib);
+
+    /* Transformations without an in-place function */
+    ASSERT_EQ(IB_OK, ib_tfn_register(ib, "foo2bar", foo2bar,
+                                     IB_TFN_FLAG_NONE, NULL));
+    ASSERT_EQ(IB_OK, ib_tfn_lookup(ib, "foo2bar", &tfn));
+    memcpy(data, "foo", 3);
+    ASSERT_EQ(IB_ENOTIMPL,
+              ib_tfn_transform_inplace(ib, ib->mp, tfn, data, 3,
+                                       &data_out, &dlen_out, &flags));
+
+    ASSERT_EQ(IB_OK, ib_tfn_register_inplace(ib, "foo2bar_inplace",
+                                             foo2bar, foo2bar_inplace,
+                                             IB_TFN_FLAG_NONE, NULL));
+    ASSERT_EQ(IB_OK, ib_tfn_lookup(ib, "foo2bar_inplace", &tfn));
+
+    flags = 0;
+    ASSERT_EQ(IB_OK,
+              ib_tfn_transform_inplace(ib, ib->mp, tfn, data, 3,
+                                       &data_out, &dlen_out, &flags));
+    ASSERT_TRUE(IB_TFN_CHECK_FMODIFIED(flags));
+    ASSERT_EQ(data, data_out);
+    ASSERT_EQ(3UL, dlen_out);
+    ASSERT_EQ(0, memcmp(data, "bar", 3));
+
+    ASSERT_EQ(IB_OK,
+              ib_tfn_transform_inplace(ib, ib->mp, tfn, data, 3,
+                                       &data_out, &dlen_out, &flags));
+    ASSERT_FALSE(IB_TFN_CHECK_FMODIFIED(flags));
+
+    ibtest_engine_destroy(ib);
+}
+
+// Value of a string field.
+static std::string tfn_field_string(const ib_field_t *f)
+{
+    if (f->type == IB_FTYPE_NULSTR) {
+        const char *s;
+
+        if ( (ib_field_value(f, ib_ftype_nulstr_out(&s)) != IB_OK) ||
+             (s == NULL) )
+        {
+            return "<error>";
+        }
+        return s;
+    }
+    if (f->type == IB_FTYPE_BYTESTR) {
+        const ib_bytestr_t *bs;
+
+        if ( (ib_field_value(f, ib_ftype_bytestr_out(&bs)) != IB_OK) ||
+             (bs == NULL) )
+        {
+            return "<error>";
+        }
+        return std::string(
+            reinterpret_cast<const char *>(ib_bytestr_const_ptr(bs)),
+            ib_bytestr_length(bs));
+    }
+    return "<type>";
+}
+
+// Copying only transformation that appends a '+': changes the length.
+static ib_status_t tfn_test_grow(ib_engine_t *ib,
+                                 ib_mpool_t *mp,
+                                 void *fndata,
+                                 const ib_field_t *fin,
+                                 ib_field_t **fout,
+                                 ib_flags_t *pflags)
+{
+    std::string s = tfn_field_string(fin) + "+";
+    uint8_t *d = (uint8_t *)ib_mpool_memdup(mp, s.data(), s.length());
+
+    if (d == NULL) {
+        return IB_EALLOC;
+    }
+    *pflags = IB_TFN_FMODIFIED;
+    if (fin->type == IB_FTYPE_NULSTR) {
+        return ib_field_create(fout, mp, fin->name, fin->nlen,
+                               IB_FTYPE_NULSTR,
+                               ib_ftype_nulstr_in(
+                                   ib_mpool_memdup_to_str(mp, d,
+                                                          s.length())));
+    }
+    return ib_field_create_bytestr_alias(fout, mp, fin->name, fin->nlen,
+                                         d, s.length());
+}
+
+// Transformation that drops the first byte: the result starts after the
+// input, and is shorter.
+static ib_status_t tfn_test_shrink(ib_engine_t *ib,
+                                   ib_mpool_t *mp,
+                                   void *fndata,
+                                   const ib_field_t *fin,
+                                   ib_field_t **fout,
+                                   ib_flags_t *pflags)
+{
+    std::string s = tfn_field_string(fin);
+
+    if (s.empty()) {
+        *fout = (ib_field_t *)fin;
+        *pflags = IB_TFN_NONE;
+        return IB_OK;
+    }
+    s = s.substr(1);
+    *pflags = IB_TFN_FMODIFIED;
+    if (fin->type == IB_FTYPE_NULSTR) {
+        return ib_field_create(fout, mp, fin->name, fin->nlen,
+                               IB_FTYPE_NULSTR,
+                               ib_ftype_nulstr_in(
+                                   ib_mpool_strdup(mp, s.c_str())));
+    }
+    return ib_field_create_bytestr_alias(
+        fout, mp, fin->name, fin->nlen,
+        (uint8_t *)ib_mpool_memdup(mp, s.data(), s.length()),
+        s.length());
+}
+
+static ib_status_t tfn_test_shrink_inplace(ib_engine_t *ib,
+                                           ib_mpool_t *mp,
+                                           void *fndata,
+                                           uint8_t *data_in,
+                                           size_t dlen_in,
+                                           uint8_t **data_out,
+                                           size_t *dlen_out,
+                                           ib_flags_t *pflags)
+{
+    if (dlen_in == 0) {
+        *data_out = data_in;
+        *dlen_out = 0;
+        *pflags = IB_TFN_NONE;
+        return IB_OK;
+    }
+    *data_out = data_in + 1;
+    *dlen_out = dlen_in - 1;
+    *pflags = IB_TFN_FMODIFIED;
+    return IB_OK;
+}
+
+// Values seen by the tfn_capture operator, by operator parameter.
+static std::map<std::string, std::vector<std::string> > tfn_captured;
+
+static ib_status_t tfn_capture_create(ib_engine_t *ib,
+                                      ib_context_t *ctx,
+                                      const ib_rule_t *rule,
+                                      ib_mpool_t *pool,
+                                      const char *parameters,
+                                      ib_operator_inst_t *op_inst)
+{
+    op_inst->data = ib_mpool_strdup(pool, parameters);
+    return (op_inst->data == NULL) ? IB_EALLOC : IB_OK;
+}
+
+static ib_status_t tfn_capture_execute(const ib_rule_exec_t *rule_exec,
+                                       void *data,
+                                       ib_flags_t flags,
+                                       ib_field_t *field,
+                                       ib_num_t *result)
+{
+    tfn_captured[(const char *)data].push_back(tfn_field_string(field));
+    *result = 1;
+    return IB_OK;
+}
+
+// Read-only inputs: string literals, which in-place transformations would
+// fault on.
+#define TFN_NULSTR  "  /A/./b/../C%41  &lt;X&gt;  "
+#define TFN_BYTESTR "  MiXeD\t\tCase&amp;  "
+
+static ib_status_t tfn_tx_started(ib_engine_t *ib,
+                                  ib_tx_t *tx,
+                                  ib_state_event_type_t event,
+                                  void *cbdata)
+{
+    ib_field_t *f;
+    ib_status_t rc;
+
+    rc = ib_data_add_nulstr(tx->data, "tfn_nulstr", TFN_NULSTR, NULL);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    rc = ib_field_create_bytestr_alias(&f, tx->mp,
+                                       IB_FIELD_NAME("tfn_bytestr"),
+                                       (uint8_t *)TFN_BYTESTR,
+                                       sizeof(TFN_BYTESTR) - 1);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    return ib_data_add(tx->data, f);
+}
+
+/// @test Rule targets with transformation chains: the in-place runs give
+/// the results of the copying transformations.
+class TestTfnChain : public BaseFixture
+{
+public:
+    virtual void SetUp()
+    {
+        BaseFixture::SetUp();
+        tfn_captured.clear();
+
+        ASSERT_EQ(IB_OK, ib_tfn_register(ib_engine, "test_grow",
+                                         tfn_test_grow,
+                                         IB_TFN_FLAG_NONE, NULL));
+        ASSERT_EQ(IB_OK, ib_tfn_register_inplace(ib_engine, "test_shrink",
+                                                 tfn_test_shrink,
+                                                 tfn_test_shrink_inplace,
+                                                 IB_TFN_FLAG_NONE, NULL));
+        ASSERT_EQ(IB_OK, ib_operator_register(ib_engine, "tfn_capture",
+                                              IB_OP_FLAG_PHASE,
+                                              tfn_capture_create, NULL,
+                                              NULL, NULL,
+                                              tfn_capture_execute, NULL));
+        ASSERT_EQ(IB_OK, ib_hook_tx_register(ib_engine, tx_started_event,
+                                             tfn_tx_started, NULL));
+
+        configureIronBeeByString(
+            "LogLevel 4\n"
+            "LoadModule \"ibmod_htp.so\"\n"
+            "LoadModule \"ibmod_rules.so\"\n"
+            "Set parser \"htp\"\n"
+            "SensorId B9C1B52B-C24A-4309-B9F9-0EF4CD577A3E\n"
+            "SensorName UnitTesting\n"
+            "SensorHostname unit-testing.sensor.tld\n"
+            "AuditEngine Off\n"
+            // Transformation logging needs every intermediate value, so
+            // it turns off the in-place runs.
+            "RuleEngineLogData " + std::string(log_data()) + "\n"
+            "<Site test-site>\n"
+            "  SiteId AAAABBBB-1111-2222-3333-000000000000\n"
+            "  Hostname *\n"
+            // Runs of in-place transformations, some of them sharing a
+            // cached prefix.
+            "  Rule tfn_nulstr.trim().urlDecode().lowercase() "
+            "@tfn_capture nulstr_inplace id:tfn/1 phase:REQUEST_HEADER\n"
+            "  Rule tfn_bytestr.lowercase().trim().compressWhitespace() "
+            "@tfn_capture bytestr_inplace id:tfn/2 phase:REQUEST_HEADER\n"
+            "  Rule request_uri.urlDecode().normalizePath().lowercase() "
+            "@tfn_capture uri_inplace id:tfn/3 phase:REQUEST_HEADER\n"
+            // Length changing transformations.
+            "  Rule tfn_nulstr.test_shrink().trim().test_shrink()"
+            ".htmlEntityDecode().removeWhitespace() "
+            "@tfn_capture nulstr_length id:tfn/4 phase:REQUEST_HEADER\n"
+            "  Rule tfn_bytestr.htmlEntityDecode().test_shrink().trim() "
+            "@tfn_capture bytestr_length id:tfn/5 phase:REQUEST_HEADER\n"
+            // Mixed in-place and copying transformations.
+            "  Rule tfn_bytestr.lowercase().trim().test_grow()"
+            ".compressWhitespace().removeWhitespace().test_grow() "
+            "@tfn_capture bytestr_mixed id:tfn/6 phase:REQUEST_HEADER\n"
+            "  Rule tfn_nulstr.test_grow().test_shrink().normalizePath()"
+            ".test_grow().trim() "
+            "@tfn_capture nulstr_mixed id:tfn/7 phase:REQUEST_HEADER\n"
+            "  Rule request_headers:X-Test.lowercase().trim().test_grow()"
+            ".compressWhitespace() "
+            "@tfn_capture header_mixed id:tfn/8 phase:REQUEST_HEADER\n"
+            // Nothing to change.
+            "  Rule request_headers:X-Plain.lowercase().trim() "
+            "@tfn_capture header_plain id:tfn/9 phase:REQUEST_HEADER\n"
+            "  Rule tfn_bytestr.test_grow().test_shrink().trimLeft() "
+            "@tfn_capture bytestr_grow_shrink id:tfn/10 "
+            "phase:REQUEST_HEADER\n"
+            // The inputs after all of the above.
+            "  Rule tfn_nulstr @tfn_capture nulstr_raw "
+            "id:tfn/11 phase:REQUEST_HEADER\n"
+            "  Rule tfn_bytestr @tfn_capture bytestr_raw "
+            "id:tfn/12 phase:REQUEST_HEADER\n"
+            "  Rule request_uri @tfn_capture uri_raw "
+            "id:tfn/13 phase:REQUEST_HEADER\n"
+            "  Rule request_headers:X-Test @tfn_capture header_raw "
+            "id:tfn/14 phase:REQUEST_HEADER\n"
+            "</Site>\n");
+
+        ib_conn_t *conn = buildIronBeeConnection();
+        sendDataIn(conn,
+                   "GET /Foo/./Bar/../%41bc%20D HTTP/1.1\r\n"
+                   "Host: UnitTest\r\n"
+                   "X-Test: MiXeD   Case  Value\r\n"
+                   "X-Plain: plain\r\n"
+                   "\r\n");
+        ASSERT_TRUE(conn->tx);
+        tx = conn->tx;
+    }
+
+    // Rule engine log data setting.
+    virtual const char *log_data() const
+    {
+        return "-transformation";
+    }
+
+    // Result of the copying transformations @a tfns on @a value.
+    std::string copying(const std::string& value,
+                        ib_ftype_t type,
+                        const char *tfns[])
+    {
+        ib_field_t *f;
+        ib_status_t rc;
+
+        if (type == IB_FTYPE_NULSTR) {
+            rc = ib_field_create(&f, tx->mp, IB_FIELD_NAME("expected"),
+                                 IB_FTYPE_NULSTR,
+                                 ib_ftype_nulstr_in(
+                                     ib_mpool_strdup(tx->mp,
+                                                     value.c_str())));
+        }
+        else {
+            rc = ib_field_create_bytestr_alias(
+                &f, tx->mp, IB_FIELD_NAME("expected"),
+                (uint8_t *)ib_mpool_memdup(tx->mp, value.data(),
+                                           value.length()),
+                value.length());
+        }
+        if (rc != IB_OK) {
+            return "<error>";
+        }
+
+        for (const char **name = tfns; *name != NULL; ++name) {
+            ib_tfn_t *tfn;
+            ib_field_t *out;
+            ib_flags_t flags = 0;
+
+            if (ib_tfn_lookup(ib_engine, *name, &tfn) != IB_OK) {
+                return "<no tfn>";
+            }
+            if (ib_tfn_transform(ib_engine, tx->mp, tfn, f,
+                                 &out, &flags) != IB_OK)
+            {
+                return "<error>";
+            }
+            f = out;
+        }
+
+        return tfn_field_string(f);
+    }
+
+    // The single value captured by the rule with operator parameter @a key.
+    std::string captured(const char *key)
+    {
+        const std::vector<std::string>& values = tfn_captured[key];
+
+        if (values.size() != 1) {
+            return "<" + boost::lexical_cast<std::string>(values.size()) +
+                " values>";
+        }
+        return values[0];
+    }
+
+    ib_tx_t *tx;
+};
+
+TEST_F(TestTfnChain, test_inplace)
+{
+    const char *nulstr[] = { "trim", "urlDecode", "lowercase", NULL };
+    const char *bytestr[] = { "lowercase", "trim", "compressWhitespace",
+                              NULL };
+    const char *uri[] = { "urlDecode", "normalizePath", "lowercase", NULL };
+
+    EXPECT_EQ("/a/./b/../ca  &lt;x&gt;", captured("nulstr_inplace"));
+    EXPECT_EQ(copying(TFN_NULSTR, IB_FTYPE_NULSTR, nulstr),
+              captured("nulstr_inplace"));
+    EXPECT_EQ("mixed case&amp;", captured("bytestr_inplace"));
+    EXPECT_EQ(copying(TFN_BYTESTR, IB_FTYPE_BYTESTR, bytestr),
+              captured("bytestr_inplace"));
+    EXPECT_EQ("/foo/abc d", captured("uri_inplace"));
+    EXPECT_EQ(copying("/Foo/./Bar/../%41bc%20D", IB_FTYPE_BYTESTR, uri),
+              captured("uri_inplace"));
+}
+
+TEST_F(TestTfnChain, test_length)
+{
+    const char *nulstr[] = { "test_shrink", "trim", "test_shrink",
+                             "htmlEntityDecode", "removeWhitespace", NULL };
+    const char *bytestr[] = { "htmlEntityDecode", "test_shrink", "trim",
+                              NULL };
+
+    EXPECT_EQ("A/./b/../C%41<X>", captured("nulstr_length"));
+    EXPECT_EQ(copying(TFN_NULSTR, IB_FTYPE_NULSTR, nulstr),
+              captured("nulstr_length"));
+    EXPECT_EQ("MiXeD\t\tCase&", captured("bytestr_length"));
+    EXPECT_EQ(copying(TFN_BYTESTR, IB_FTYPE_BYTESTR, bytestr),
+              captured("bytestr_length"));
+}
+
+TEST_F(TestTfnChain, test_mixed)
+{
+    const char *bytestr[] = { "lowercase", "trim", "test_grow",
+                              "compressWhitespace", "removeWhitespace",
+                              "test_grow", NULL };
+    const char *nulstr[] = { "test_grow", "test_shrink", "normalizePath",
+                             "test_grow", "trim", NULL };
+    const char *header[] = { "lowercase", "trim", "test_grow",
+                             "compressWhitespace", NULL };
+
+    EXPECT_EQ("mixedcase&amp;++", captured("bytestr_mixed"));
+    EXPECT_EQ(copying(TFN_BYTESTR, IB_FTYPE_BYTESTR, bytestr),
+              captured("bytestr_mixed"));
+    EXPECT_EQ(copying(TFN_NULSTR, IB_FTYPE_NULSTR, nulstr),
+              captured("nulstr_mixed"));
+    EXPECT_EQ("mixed case value+", captured("header_mixed"));
+    EXPECT_EQ(copying("MiXeD   Case  Value", IB_FTYPE_BYTESTR, header),
+              captured("header_mixed"));
+}
+
+TEST_F(TestTfnChain, test_unmodified)
+{
+    const char *bytestr[] = { "test_grow", "test_shrink", "trimLeft", NULL };
+
+    EXPECT_EQ("plain", captured("header_plain"));
+    EXPECT_EQ(copying(TFN_BYTESTR, IB_FTYPE_BYTESTR, bytestr),
+              captured("bytestr_grow_shrink"));
+}
+
+TEST_F(TestTfnChain, test_inputs)
+{
+    // The transformations did not modify their inputs.
+    EXPECT_EQ(TFN_NULSTR, captured("nulstr_raw"));
+    EXPECT_EQ(TFN_BYTESTR, captured("bytestr_raw"));
+    EXPECT_EQ("/Foo/./Bar/../%41bc%20D", captured("uri_raw"));
+    EXPECT_EQ("MiXeD   Case  Value", captured("header_raw"));
+}
+
+/// @test Rule targets with transformation chains, with transformation
+/// logging on: every transformation copies its input.
+class TestTfnChainLogged : public TestTfnChain
+{
+public:
+    virtual const char *log_data() const
+    {
+        return "+transformation";
+    }
+};
+
+TEST_F(TestTfnChainLogged, test_copying)
+{
+    EXPECT_EQ("/a/./b/../ca  &lt;x&gt;", captured("nulstr_inplace"));
+    EXPECT_EQ("mixed case&amp;", captured("bytestr_inplace"));
+    EXPECT_EQ("/foo/abc d", captured("uri_inplace"));
+    EXPECT_EQ("A/./b/../C%41<X>", captured("nulstr_length"));
+    EXPECT_EQ("MiXeD\t\tCase&", captured("bytestr_length"));
+    EXPECT_EQ("mixedcase&amp;++", captured("bytestr_mixed"));
+    EXPECT_EQ("mixed case value+", captured("header_mixed"));
+    EXPECT_EQ("plain", captured("header_plain"));
+    EXPECT_EQ(TFN_NULSTR, captured("nulstr_raw"));
+    EXPECT_EQ(TFN_BYTESTR, captured("bytestr_raw"));
+    EXPECT_EQ("/Foo/./Bar/../%41bc%20D", captured("uri_raw"));
+}
+
+// Number of times test_count was run.
+static int tfn_count_calls;
+
+// Transformation that copies its input, counting its calls.
+static ib_status_t tfn_test_count(ib_engine_t *ib,
+                                  ib_mpool_t *mp,
+                                  void *fndata,
+                                  const ib_field_t *fin,
+                                  ib_field_t **fout,
+                                  ib_flags_t *pflags)
+{
+    ++tfn_count_calls;
+    *pflags = IB_TFN_NONE;
+    return ib_field_copy(fout, mp, fin->name, fin->nlen, fin);
+}
+
+// Action that changes the value of the tfn_bytestr field in place.
+static ib_status_t tfn_modify_execute(const ib_rule_exec_t *rule_exec,
+                                      void *data,
+                                      ib_flags_t flags,
+                                      void *cbdata)
+{
+    ib_tx_t *tx = rule_exec->tx;
+    ib_bytestr_t *bs;
+    ib_field_t *f;
+    ib_status_t rc;
+
+    rc = ib_data_get(tx->data, "tfn_bytestr", &f);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    rc = ib_bytestr_alias_nulstr(&bs, tx->mp, "  NEW  ");
+    if (rc != IB_OK) {
+        return rc;
+    }
+    return ib_field_setv(f, ib_ftype_bytestr_in(bs));
+}
+
+/// @test Transformation result cache: results are shared by the rules of
+/// a transaction, for the same field value and transformations.
+class TestTfnCache : public BaseFixture
+{
+public:
+    virtual void SetUp()
+    {
+        BaseFixture::SetUp();
+        tfn_captured.clear();
+        tfn_count_calls = 0;
+
+        ASSERT_EQ(IB_OK, ib_tfn_register(ib_engine, "test_count",
+                                         tfn_test_count,
+                                         IB_TFN_FLAG_NONE, NULL));
+        ASSERT_EQ(IB_OK, ib_tfn_register_inplace(ib_engine, "test_shrink",
+                                                 tfn_test_shrink,
+                                                 tfn_test_shrink_inplace,
+                                                 IB_TFN_FLAG_NONE, NULL));
+        ASSERT_EQ(IB_OK, ib_operator_register(ib_engine, "tfn_capture",
+                                              IB_OP_FLAG_PHASE,
+                                              tfn_capture_create, NULL,
+                                              NULL, NULL,
+                                              tfn_capture_execute, NULL));
+        ASSERT_EQ(IB_OK, ib_action_register(ib_engine, "tfn_modify",
+                                            IB_ACT_FLAG_NONE,
+                                            NULL, NULL,
+                                            NULL, NULL,
+                                            tfn_modify_execute, NULL));
+        ASSERT_EQ(IB_OK, ib_hook_tx_register(ib_engine, tx_started_event,
+                                             tfn_tx_started, NULL));
+
+        configureIronBeeByString(
+            "LogLevel 4\n"
+            "LoadModule \"ibmod_htp.so\"\n"
+            "LoadModule \"ibmod_rules.so\"\n"
+            "Set parser \"htp\"\n"
+            "SensorId B9C1B52B-C24A-4309-B9F9-0EF4CD577A3E\n"
+            "SensorName UnitTesting\n"
+            "SensorHostname unit-testing.sensor.tld\n"
+            "AuditEngine Off\n"
+            "RuleEngineLogData " + std::string(log_data()) + "\n"
+            "<Site test-site>\n"
+            "  SiteId AAAABBBB-1111-2222-3333-000000000000\n"
+            "  Hostname *\n"
+            // The same chain twice.
+            "  Rule tfn_nulstr.test_count().lowercase() "
+            "@tfn_capture count_1 id:cache/1 phase:REQUEST_HEADER\n"
+            "  Rule tfn_nulstr.test_count().lowercase() "
+            "@tfn_capture count_2 id:cache/2 phase:REQUEST_HEADER\n"
+            // The same transformations in another order, and a longer
+            // chain with a cached prefix.
+            "  Rule tfn_nulstr.test_shrink().trim() "
+            "@tfn_capture shrink_trim id:cache/3 phase:REQUEST_HEADER\n"
+            "  Rule tfn_nulstr.trim().test_shrink() "
+            "@tfn_capture trim_shrink id:cache/4 phase:REQUEST_HEADER\n"
+            "  Rule tfn_nulstr.test_shrink().trim().lowercase() "
+            "@tfn_capture prefix id:cache/5 phase:REQUEST_HEADER\n"
+            // The field is replaced.
+            "  Action id:cache/6 phase:REQUEST_HEADER setvar:tfn_nulstr=NEW\n"
+            "  Rule tfn_nulstr.test_count().lowercase() "
+            "@tfn_capture count_3 id:cache/7 phase:REQUEST_HEADER\n"
+            // The field's value is modified.
+            "  Rule tfn_bytestr.lowercase().trim() "
+            "@tfn_capture before id:cache/8 phase:REQUEST_HEADER\n"
+            "  Action id:cache/9 phase:REQUEST_HEADER tfn_modify\n"
+            "  Rule tfn_bytestr.lowercase().trim() "
+            "@tfn_capture after id:cache/10 phase:REQUEST_HEADER\n"
+            "</Site>\n");
+
+        ib_conn_t *conn = buildIronBeeConnection();
+        sendDataIn(conn,
+                   "GET / HTTP/1.1\r\n"
+                   "Host: UnitTest\r\n"
+                   "\r\n");
+        ASSERT_TRUE(conn->tx);
+        ASSERT_TRUE(conn->tx->rule_exec);
+        tx_log = conn->tx->rule_exec->tx_log;
+        ASSERT_TRUE(tx_log);
+    }
+
+    // Rule engine log data setting.
+    virtual const char *log_data() const
+    {
+        return "+transformation";
+    }
+
+    // The single value captured by the rule with operator parameter @a key.
+    std::string captured(const char *key)
+    {
+        const std::vector<std::string>& values = tfn_captured[key];
+
+        if (values.size() != 1) {
+            return "<" + boost::lexical_cast<std::string>(values.size()) +
+                " values>";
+        }
+        return values[0];
+    }
+
+    const ib_rule_log_tx_t *tx_log;
+};
+
+/// @test Transformation result cache, with in-place runs of
+/// transformations cached as a whole.
+class TestTfnCacheInplace : public TestTfnCache
+{
+public:
+    virtual const char *log_data() const
+    {
+        return "-transformation";
+    }
+};
+
+TEST_F(TestTfnCache, test_hit)
+{
+    // The second rule got the first one's result.
+    EXPECT_EQ("  /a/./b/../c%41  &lt;x&gt;  ", captured("count_1"));
+    EXPECT_EQ(captured("count_1"), captured("count_2"));
+
+    // Run for count_1 and count_3, but not for count_2.
+    EXPECT_EQ(2, tfn_count_calls);
+}
+
+TEST_F(TestTfnCache, test_chain)
+{
+    EXPECT_EQ("/A/./b/../C%41  &lt;X&gt;", captured("shrink_trim"));
+    EXPECT_EQ("A/./b/../C%41  &lt;X&gt;", captured("trim_shrink"));
+    EXPECT_EQ("/a/./b/../c%41  &lt;x&gt;", captured("prefix"));
+}
+
+TEST_F(TestTfnCache, test_invalidate)
+{
+    EXPECT_EQ("new", captured("count_3"));
+    EXPECT_EQ("mixed\t\tcase&amp;", captured("before"));
+    EXPECT_EQ("new", captured("after"));
+}
+
+TEST_F(TestTfnCache, test_counters)
+{
+    // Hits: count_2 (2), prefix (2).
+    // Misses: count_1 (2), shrink_trim (2), trim_shrink (2), prefix (1),
+    // count_3 (2), before (2), after (2).
+    EXPECT_EQ(4, tx_log->tfn_hits);
+    EXPECT_EQ(13, tx_log->tfn_misses);
+}
+
+TEST_F(TestTfnCacheInplace, test_hit)
+{
+    EXPECT_EQ("  /a/./b/../c%41  &lt;x&gt;  ", captured("count_1"));
+    EXPECT_EQ(captured("count_1"), captured("count_2"));
+
+    // Run for count_1 and count_3, but not for count_2.
+    EXPECT_EQ(2, tfn_count_calls);
+}
+
+TEST_F(TestTfnCacheInplace, test_chain)
+{
+    EXPECT_EQ("/A/./b/../C%41  &lt;X&gt;", captured("shrink_trim"));
+    EXPECT_EQ("A/./b/../C%41  &lt;X&gt;", captured("trim_shrink"));
+    EXPECT_EQ("/a/./b/../c%41  &lt;x&gt;", captured("prefix"));
+}
+
+TEST_F(TestTfnCacheInplace, test_invalidate)
+{
+    EXPECT_EQ("new", captured("count_3"));
+    EXPECT_EQ("mixed\t\tcase&amp;", captured("before"));
+    EXPECT_EQ("new", captured("after"));
+}
+
+TEST_F(TestTfnCacheInplace, test_counters)
+{
+    // Each run of in-place transformations is one lookup.
+    // Hits: count_2 (2), prefix (1).
+    // Misses: count_1 (2), shrink_trim (1), trim_shrink (1), count_3 (2),
+    // before (1), after (1).
+    EXPECT_EQ(3, tx_log->tfn_hits);
+    EXPECT_EQ(8, tx_log->tfn_misses);
+}
+
 static ib_status_t dyn_get(
     const ib_field_t *f,
     void *out_value,
@@ -399,3 +1098,134 @@ TEST(TestIronBee, test_data_pcre)
 
     ibtest_engine_destroy(ib);
 }
+
+// Test precompiled selectors.
+TEST(TestIronBee, test_data_selector)
+{
+    ib_engine_t *ib;
+    ib_data_t *data;
+    ib_mpool_t *mp;
+    ib_field_t *list_field;
+    ib_field_t *out_field;
+    ib_list_t *list;
+    ib_list_t *out_list;
+    ib_data_selector_t *sel_all;
+    ib_data_selector_t *sel_name;
+    ib_data_selector_t *sel_pattern;
+    ib_data_selector_t *sel;
+    char name[32];
+
+    ibtest_engine_create(&ib);
+    mp = ib_engine_pool_main_get(ib);
+
+    ASSERT_EQ(IB_OK, ib_data_create(mp, &data));
+    ASSERT_IB_OK(ib_data_add_list(data, "ARGV", &list_field));
+    ASSERT_IB_OK(ib_field_value(list_field, &list));
+
+    ASSERT_IB_OK(ib_data_selector_create(mp, NULL, IB_FIELD_NAME("ARGV"),
+                                         &sel_all));
+    ASSERT_IB_OK(ib_data_selector_create(mp, NULL, IB_FIELD_NAME("ARGV:Field3"),
+                                         &sel_name));
+    ASSERT_IB_OK(ib_data_selector_create(mp, NULL, IB_FIELD_NAME("ARGV:/^f.*1/"),
+                                         &sel_pattern));
+
+    /* Malformed names are rejected up front. */
+    ASSERT_EQ(IB_EINVAL,
+              ib_data_selector_create(mp, NULL, IB_FIELD_NAME("ARGV:"), &sel));
+    ASSERT_EQ(IB_EINVAL,
+              ib_data_selector_create(mp, NULL, IB_FIELD_NAME("ARGV://"), &sel));
+    ASSERT_EQ(IB_EINVAL,
+              ib_data_selector_create(mp, NULL, IB_FIELD_NAME("ARGV:/(/"), &sel));
+
+    ASSERT_IB_OK(ib_data_get_selected(data, sel_all, &out_field));
+    ASSERT_EQ(list_field, out_field);
+
+    /* Lists large enough to be indexed, and the index following
+     * additions to the list. */
+    for (int n = 0; n < 3; ++n) {
+        for (int i = 0; i < 10; ++i) {
+            ib_field_t *f;
+            ib_num_t num = i;
+
+            snprintf(name, sizeof(name), "field%d", i);
+            ASSERT_IB_OK(ib_field_create(&f, mp, IB_FIELD_NAME(name),
+                                         IB_FTYPE_NUM, &num));
+            ASSERT_IB_OK(ib_list_push(list, f));
+        }
+
+        ASSERT_IB_OK(ib_data_get_selected(data, sel_name, &out_field));
+        ASSERT_IB_OK(ib_field_value(out_field, &out_list));
+        ASSERT_EQ(n + 1U, IB_LIST_ELEMENTS(out_list));
+
+        ASSERT_IB_OK(ib_data_get_ex(data, IB_FIELD_NAME("ARGV:field3"),
+                                    &out_field));
+        ASSERT_IB_OK(ib_field_value(out_field, &out_list));
+        ASSERT_EQ(n + 1U, IB_LIST_ELEMENTS(out_list));
+
+        ASSERT_IB_OK(ib_data_get_selected(data, sel_pattern, &out_field));
+        ASSERT_IB_OK(ib_field_value(out_field, &out_list));
+        ASSERT_EQ(n + 1U, IB_LIST_ELEMENTS(out_list));
+    }
+
+    /* Removing elements is noticed too. */
+    for (int i = 0; i < 7; ++i) {
+        ASSERT_IB_OK(ib_list_pop(list, NULL));
+    }
+    ASSERT_IB_OK(ib_data_get_selected(data, sel_name, &out_field));
+    ASSERT_IB_OK(ib_field_value(out_field, &out_list));
+    ASSERT_EQ(2U, IB_LIST_ELEMENTS(out_list));
+
+    ibtest_engine_destroy(ib);
+}
+
+// Test indexed field names.
+TEST(TestIronBee, test_data_indexed)
+{
+    ib_engine_t *ib;
+    ib_mpool_t *mp;
+    ib_data_config_t *config;
+    ib_data_t *data;
+    ib_data_selector_t *sel;
+    ib_field_t *f;
+    ib_field_t *out_field;
+    size_t index;
+    size_t late_index;
+
+    ibtest_engine_create(&ib);
+    mp = ib_engine_pool_main_get(ib);
+
+    ASSERT_IB_OK(ib_data_config_create(mp, &config));
+    ASSERT_IB_OK(ib_data_register_indexed(config, "ARGV"));
+    ASSERT_IB_OK(ib_data_lookup_index_ex(config, IB_FIELD_NAME("argv"),
+                                         &index));
+    ASSERT_EQ(IB_ENOENT,
+              ib_data_lookup_index_ex(config, IB_FIELD_NAME("nope"),
+                                      &late_index));
+
+    ASSERT_IB_OK(ib_data_create_indexed(config, mp, &data));
+
+    /* Registered after the data was created. */
+    ASSERT_IB_OK(ib_data_register_indexed_ex(config, IB_FIELD_NAME("late"),
+                                             &late_index));
+    ASSERT_NE(index, late_index);
+
+    ASSERT_EQ(IB_ENOENT, ib_data_get_indexed(data, index, &out_field));
+    ASSERT_IB_OK(ib_data_add_list(data, "ARGV", &f));
+    ASSERT_IB_OK(ib_data_get_indexed(data, index, &out_field));
+    ASSERT_EQ(f, out_field);
+
+    ASSERT_IB_OK(ib_data_add_num(data, "late", 5, &f));
+    ASSERT_IB_OK(ib_data_get_indexed(data, late_index, &out_field));
+    ASSERT_EQ(f, out_field);
+
+    /* Selectors registered with the registry use the index. */
+    ASSERT_IB_OK(ib_data_selector_create(mp, config,
+                                         IB_FIELD_NAME("Argv:x"), &sel));
+    ASSERT_IB_OK(ib_data_get_selected(data, sel, &out_field));
+
+    ASSERT_IB_OK(ib_data_remove(data, "ARGV", NULL));
+    ASSERT_EQ(IB_ENOENT, ib_data_get_indexed(data, index, &out_field));
+    ASSERT_EQ(IB_ENOENT, ib_data_get_selected(data, sel, &out_field));
+
+    ibtest_engine_destroy(ib);
+}
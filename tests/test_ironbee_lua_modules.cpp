@@ -22,10 +22,14 @@
 #include <stdexcept>
 #include "base_fixture.h"
 
+#include <pthread.h>
+#include <time.h>
+
 extern "C" {
 #include "engine_private.h"
 #include "rule_engine_private.h"
 #include <ironbee/release.h>
+#include <ironbee/action.h>
 #include <ironbee/engine.h>
 #include <ironbee/field.h>
 #include <ironbee/mpool.h>
@@ -114,6 +118,7 @@ const char * IronBeeLuaModules::c_ib_conf =
     "LoadModule \"ibmod_rules.so\"\n"
     "LoadModule \"ibmod_lua.so\"\n"
     "ModuleBasePath \".\"\n"
+    "LuaVMPoolSize 2\n"
     "LuaLoadModule \"test_ironbee_lua_modules.lua\"\n"
     "Set parser \"htp\"\n"
     "MyLuaDirective param1\n"
@@ -143,3 +148,216 @@ TEST_F(IronBeeLuaModules, test_site_directive){
     ASSERT_TRUE(field1_val);
     ASSERT_STREQ("param2", field1_val);
 }
+
+/**
+ * Two-party barrier, used as the @c test_vm_pool_barrier action.
+ *
+ * A thread running the action holds its Lua VM until the other thread runs
+ * the action too, so the two threads use two VMs at once.
+ */
+static pthread_mutex_t vm_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vm_pool_cond = PTHREAD_COND_INITIALIZER;
+static int vm_pool_waiting = 0;
+static int vm_pool_round = 0;
+
+static ib_status_t vm_pool_barrier(
+    const ib_rule_exec_t *rule_exec,
+    void *data,
+    ib_flags_t flags,
+    void *cbdata)
+{
+    struct timespec deadline;
+    ib_status_t rc = IB_OK;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 10;
+
+    pthread_mutex_lock(&vm_pool_mutex);
+    int round = vm_pool_round;
+    if (++vm_pool_waiting == 2) {
+        vm_pool_waiting = 0;
+        ++vm_pool_round;
+        pthread_cond_broadcast(&vm_pool_cond);
+    }
+    else {
+        while (round == vm_pool_round) {
+            if (pthread_cond_timedwait(&vm_pool_cond, &vm_pool_mutex,
+                                       &deadline) != 0)
+            {
+                /* The other thread could not get a VM. */
+                --vm_pool_waiting;
+                rc = IB_ETIMEDOUT;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&vm_pool_mutex);
+
+    return rc;
+}
+
+/**
+ * @class IronBeeLuaVmPool test_ironbee_lua_modules.cpp test_ironbee_lua_modules.cpp
+ *
+ * Run a Lua module and a Lua rule on two Lua VMs at once.
+ *
+ * The second VM is built by replaying the configuration, so each
+ * transaction checks that the module, its directives, its action and
+ * operator, and the rule behave the same on both VMs.
+ */
+struct IronBeeLuaVmPool : public BaseFixture {
+
+    static const char *c_ib_conf;
+
+    virtual void SetUp()
+    {
+        BaseFixture::SetUp();
+
+        /* Used by the module and the rule, so registered before them. */
+        ASSERT_EQ(IB_OK, ib_action_register(ib_engine,
+                                            "test_vm_pool_barrier",
+                                            IB_ACT_FLAG_NONE,
+                                            NULL, NULL,
+                                            NULL, NULL,
+                                            vm_pool_barrier, NULL));
+
+        configureIronBeeByString(c_ib_conf);
+    }
+
+    /**
+     * Run a transaction on a new connection.
+     *
+     * @returns The connection, to be closed after the values are read.
+     */
+    ib_conn_t *run_tx()
+    {
+        ib_conn_t *conn = buildIronBeeConnection();
+
+        sendDataIn(conn, "GET / HTTP/1.1\r\nHost: UnitTest\r\n\r\n");
+        sendDataOut(conn, "HTTP/1.1 200 OK\r\n"
+                          "Content-Type: text/html\r\n\r\n");
+
+        return conn;
+    }
+
+    /* Value of the data field @a name of @a tx, as a string. */
+    std::string get(ib_tx_t *tx, const char *name)
+    {
+        ib_field_t *field;
+        const ib_bytestr_t *bs;
+        const char *s;
+        ib_num_t n;
+
+        if (ib_data_get(tx->data, name, &field) != IB_OK) {
+            return "<none>";
+        }
+        switch (field->type) {
+            case IB_FTYPE_NUM:
+                if (ib_field_value(field, ib_ftype_num_out(&n)) != IB_OK) {
+                    return "<error>";
+                }
+                return boost::lexical_cast<std::string>(n);
+            case IB_FTYPE_BYTESTR:
+                if (ib_field_value(field, ib_ftype_bytestr_out(&bs)) != IB_OK) {
+                    return "<error>";
+                }
+                return std::string(
+                    reinterpret_cast<const char *>(ib_bytestr_const_ptr(bs)),
+                    ib_bytestr_length(bs));
+            case IB_FTYPE_NULSTR:
+                if (ib_field_value(field, ib_ftype_nulstr_out(&s)) != IB_OK) {
+                    return "<error>";
+                }
+                return s;
+            default:
+                return "<type>";
+        }
+    }
+};
+
+const char *IronBeeLuaVmPool::c_ib_conf =
+    "LogLevel 4\n"
+    "SensorId AAAABBBB-1111-2222-3333-FFFF00000023\n"
+    "SensorName ExampleSensorName\n"
+    "SensorHostname example.sensor.tld\n"
+    "LoadModule \"ibmod_htp.so\"\n"
+    "LoadModule \"ibmod_pcre.so\"\n"
+    "LoadModule \"ibmod_rules.so\"\n"
+    "LoadModule \"ibmod_lua.so\"\n"
+    "ModuleBasePath \".\"\n"
+    "LuaVMPoolSize 2\n"
+    "LuaLoadModule \"test_ironbee_lua_vm_pool.lua\"\n"
+    "Set parser \"htp\"\n"
+    "<Site default>\n"
+        "SiteId AAAABBBB-1111-2222-3333-000000000000\n"
+        "Hostname *\n"
+        "VmPoolDirective site\n"
+        "RuleExt lua:test_ironbee_lua_vm_pool_rule.lua "
+            "id:vmpool/1 phase:REQUEST_HEADER setvar:VmPoolRuleAction=1\n"
+    "</Site>\n";
+
+struct vm_pool_thread_t {
+    IronBeeLuaVmPool *fixture;
+    ib_conn_t *conn;
+    bool failed;
+};
+
+static void *vm_pool_thread(void *arg)
+{
+    vm_pool_thread_t *t = static_cast<vm_pool_thread_t *>(arg);
+
+    try {
+        t->conn = t->fixture->run_tx();
+        t->failed = false;
+    }
+    catch (const std::exception&) {
+        t->failed = true;
+    }
+    return NULL;
+}
+
+TEST_F(IronBeeLuaVmPool, test_two_vms)
+{
+    pthread_t threads[2];
+    vm_pool_thread_t args[2];
+
+    for (int i = 0; i < 2; ++i) {
+        args[i].fixture = this;
+        args[i].conn = NULL;
+        args[i].failed = true;
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+                                    vm_pool_thread, &args[i]));
+    }
+    for (int i = 0; i < 2; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    ASSERT_FALSE(args[0].failed);
+    ASSERT_FALSE(args[1].failed);
+
+    ib_tx_t *tx[2] = { args[0].conn->tx, args[1].conn->tx };
+    ASSERT_TRUE(tx[0]);
+    ASSERT_TRUE(tx[1]);
+
+    for (int i = 0; i < 2; ++i) {
+        /* Both threads held a VM at the same time. */
+        EXPECT_EQ("0", get(tx[i], "VmPoolRuleBarrier"));
+        EXPECT_EQ("0", get(tx[i], "VmPoolModuleBarrier"));
+
+        /* The rule and its actions. */
+        EXPECT_EQ("1", get(tx[i], "VmPoolRuleAction"));
+
+        /* The module, its directive, action and operator. */
+        EXPECT_EQ("site", get(tx[i], "VmPoolDirective"));
+        EXPECT_EQ("0", get(tx[i], "VmPoolActionRc"));
+        EXPECT_EQ("yes", get(tx[i], "VmPoolAction"));
+        EXPECT_EQ("1", get(tx[i], "VmPoolOperator"));
+    }
+
+    /* Each transaction ran on its own VM, one of them replayed. */
+    EXPECT_NE(get(tx[0], "VmPoolRuleVm"), get(tx[1], "VmPoolRuleVm"));
+    EXPECT_NE(get(tx[0], "VmPoolModuleVm"), get(tx[1], "VmPoolModuleVm"));
+
+    for (int i = 0; i < 2; ++i) {
+        ib_state_notify_conn_closed(ib_engine, args[i].conn);
+    }
+}
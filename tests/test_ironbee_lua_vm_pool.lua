@@ -0,0 +1,36 @@
+-- A Lua module run on two Lua VMs at once.
+local t = ...
+
+-- Created again on each VM, from the VM's memory pool.
+local barrier = t:action("test_vm_pool_barrier", "", 0)
+local setvar = t:action("setvar", "VmPoolAction=yes", 0)
+local rx = t:operator("rx", "^yes$", 0)
+
+if barrier == nil or setvar == nil or rx == nil then
+    return ffi.C.IB_EOTHER
+end
+
+t:register_param1_directive(
+    "VmPoolDirective",
+    function(mod, cfg, name, param1)
+        cfg[name] = param1
+    end)
+
+t:handle_request_event(function(ib)
+    local rule_exec = ffi.cast("ib_tx_t*", ib.ib_tx).rule_exec
+    local rc
+    local result
+
+    -- Hold this VM until the other transaction holds one too.
+    ib:set("VmPoolModuleBarrier", tonumber(barrier(rule_exec)))
+    ib:set("VmPoolModuleVm", tostring(_G))
+
+    ib:set("VmPoolDirective", ib.config["VmPoolDirective"])
+    ib:set("VmPoolActionRc", setvar(rule_exec))
+    rc, result = rx(rule_exec, ib:getDataField("VmPoolAction"))
+    ib:set("VmPoolOperator", result)
+
+    return 0
+end)
+
+return 0
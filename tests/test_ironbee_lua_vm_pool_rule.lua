@@ -0,0 +1,22 @@
+-- A Lua rule run on two Lua VMs at once.
+local t = ...
+
+local tx = ffi.cast("ib_tx_t*", t.ib_tx)
+local inst = ffi.new("ib_action_inst_t*[1]")
+local rc = ffi.C.ib_action_inst_create_ex(
+    t.ib_engine,
+    tx.mp,
+    ffi.C.ib_context_main(t.ib_engine),
+    "test_vm_pool_barrier",
+    "",
+    0,
+    inst)
+
+-- Hold this VM until the other transaction holds one too.
+if rc == ffi.C.IB_OK then
+    rc = ffi.C.ib_action_execute(t.ib_rule_exec, inst[0])
+end
+t.ib:set("VmPoolRuleBarrier", tonumber(rc))
+t.ib:set("VmPoolRuleVm", tostring(_G))
+
+return 1
@@ -0,0 +1,380 @@
+//////////////////////////////////////////////////////////////////////////////
+// Licensed to Qualys, Inc. (QUALYS) under one or more
+// contributor license agreements.  See the NOTICE file distributed with
+// this work for additional information regarding copyright ownership.
+// QUALYS licenses this file to You under the Apache License, Version 2.0
+// (the "License"); you may not use this file except in compliance with
+// the License.  You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//////////////////////////////////////////////////////////////////////////////
+
+extern "C" {
+#include "ironbee_config_auto.h"
+
+#include <ironbee/kvstore.h>
+#include <ironbee/kvstore_cache.h>
+#include <ironbee/util.h>
+
+#include <unistd.h>
+}
+
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+
+namespace {
+
+// In-memory backend counting the calls made to it.
+struct Backend
+{
+    std::map<std::string, std::string> values;
+    int gets;
+    int sets;
+    int removes;
+    ib_status_t get_error;
+
+    Backend() : gets(0), sets(0), removes(0), get_error(IB_OK) {}
+};
+
+ib_status_t backend_connect(ib_kvstore_t *, ib_kvstore_cbdata_t *)
+{
+    return IB_OK;
+}
+
+ib_status_t backend_get(
+    ib_kvstore_t *kvstore,
+    const ib_kvstore_key_t *key,
+    ib_kvstore_value_t ***values,
+    size_t *values_length,
+    ib_kvstore_cbdata_t *)
+{
+    Backend *b = reinterpret_cast<Backend *>(kvstore->server);
+    std::string k((const char *)key->key, key->length);
+
+    ++b->gets;
+    if (b->get_error != IB_OK) {
+        return b->get_error;
+    }
+    if (b->values.count(k) == 0) {
+        return IB_ENOENT;
+    }
+    const std::string& v = b->values[k];
+
+    ib_kvstore_value_t *value =
+        (ib_kvstore_value_t *)calloc(1, sizeof(*value));
+    value->value = malloc(v.length() + 1);
+    memcpy(value->value, v.data(), v.length());
+    value->value_length = v.length();
+    value->type = strdup("txt");
+    value->type_length = 3;
+    value->expiration = 0;
+
+    *values = (ib_kvstore_value_t **)malloc(sizeof(*values));
+    (*values)[0] = value;
+    *values_length = 1;
+    return IB_OK;
+}
+
+ib_status_t backend_set(
+    ib_kvstore_t *kvstore,
+    ib_kvstore_merge_policy_fn_t,
+    const ib_kvstore_key_t *key,
+    ib_kvstore_value_t *value,
+    ib_kvstore_cbdata_t *)
+{
+    Backend *b = reinterpret_cast<Backend *>(kvstore->server);
+
+    ++b->sets;
+    b->values[std::string((const char *)key->key, key->length)] =
+        std::string((const char *)value->value, value->value_length);
+    return IB_OK;
+}
+
+ib_status_t backend_remove(
+    ib_kvstore_t *kvstore,
+    const ib_kvstore_key_t *key,
+    ib_kvstore_cbdata_t *)
+{
+    Backend *b = reinterpret_cast<Backend *>(kvstore->server);
+
+    ++b->removes;
+    b->values.erase(std::string((const char *)key->key, key->length));
+    return IB_OK;
+}
+
+void backend_destroy(ib_kvstore_t *, ib_kvstore_cbdata_t *)
+{
+}
+
+}
+
+class TestKVStoreCache : public testing::Test
+{
+    public:
+
+    Backend backend;
+    ib_kvstore_t backend_kvstore;
+    ib_kvstore_t kvstore;
+    ib_kvstore_cache_config_t config;
+    bool initialized;
+
+    virtual void SetUp() {
+        ib_kvstore_init(&backend_kvstore);
+        backend_kvstore.server = (ib_kvstore_server_t *)&backend;
+        backend_kvstore.connect = backend_connect;
+        backend_kvstore.disconnect = backend_connect;
+        backend_kvstore.get = backend_get;
+        backend_kvstore.set = backend_set;
+        backend_kvstore.remove = backend_remove;
+        backend_kvstore.destroy = backend_destroy;
+
+        ib_kvstore_cache_config_default(&config);
+        initialized = false;
+    }
+
+    void init() {
+        ASSERT_EQ(IB_OK,
+                  ib_kvstore_cache_init(&kvstore, &backend_kvstore, &config));
+        ASSERT_EQ(IB_OK, ib_kvstore_connect(&kvstore));
+        initialized = true;
+    }
+
+    virtual void TearDown() {
+        if (initialized) {
+            ib_kvstore_disconnect(&kvstore);
+            ib_kvstore_destroy(&kvstore);
+        }
+    }
+
+    ib_status_t set(const std::string& k, const std::string& v,
+                    uint32_t expiration = 0)
+    {
+        ib_kvstore_key_t key;
+        ib_kvstore_value_t val;
+
+        key.key = k.data();
+        key.length = k.length();
+        memset(&val, 0, sizeof(val));
+        val.value = (void *)v.data();
+        val.value_length = v.length();
+        val.type = (char *)"txt";
+        val.type_length = 3;
+        val.expiration = expiration;
+
+        return ib_kvstore_set(&kvstore, NULL, &key, &val);
+    }
+
+    // Returns the value of @a k, or "<none>".
+    std::string get(const std::string& k)
+    {
+        ib_kvstore_key_t key;
+        ib_kvstore_value_t *result;
+        std::string v;
+
+        key.key = k.data();
+        key.length = k.length();
+
+        if (ib_kvstore_get(&kvstore, NULL, &key, &result) != IB_OK) {
+            return "<none>";
+        }
+        v.assign((const char *)result->value, result->value_length);
+        EXPECT_EQ(std::string("txt"),
+                  std::string(result->type, result->type_length));
+        ib_kvstore_free_value(&kvstore, result);
+        return v;
+    }
+
+    ib_kvstore_cache_stats_t stats()
+    {
+        ib_kvstore_cache_stats_t s;
+        ib_kvstore_cache_stats(&kvstore, &s);
+        return s;
+    }
+};
+
+TEST_F(TestKVStoreCache, test_read_through) {
+    init();
+    backend.values["k1"] = "A key";
+
+    ASSERT_EQ("A key", get("k1"));
+    ASSERT_EQ("A key", get("k1"));
+    ASSERT_EQ("A key", get("k1"));
+    ASSERT_EQ(1, backend.gets);
+
+    ib_kvstore_cache_stats_t s = stats();
+    ASSERT_EQ(2U, s.hits);
+    ASSERT_EQ(1U, s.misses);
+}
+
+TEST_F(TestKVStoreCache, test_negative) {
+    init();
+
+    ASSERT_EQ("<none>", get("k1"));
+    ASSERT_EQ("<none>", get("k1"));
+    ASSERT_EQ(1, backend.gets);
+    ASSERT_EQ(1U, stats().negative_hits);
+
+    /* A set replaces the cached miss. */
+    ASSERT_EQ(IB_OK, set("k1", "A key"));
+    ASSERT_EQ("A key", get("k1"));
+    ASSERT_EQ(1, backend.gets);
+}
+
+TEST_F(TestKVStoreCache, test_negative_disabled) {
+    config.negative_ttl = 0;
+    init();
+
+    ASSERT_EQ("<none>", get("k1"));
+    ASSERT_EQ("<none>", get("k1"));
+    ASSERT_EQ(2, backend.gets);
+}
+
+TEST_F(TestKVStoreCache, test_max_age) {
+    config.max_age = 1;
+    init();
+    backend.values["k1"] = "A key";
+
+    ASSERT_EQ("A key", get("k1"));
+    backend.values["k1"] = "Changed";
+    ASSERT_EQ("A key", get("k1"));
+    sleep(2);
+    ASSERT_EQ("Changed", get("k1"));
+    ASSERT_EQ(2, backend.gets);
+}
+
+TEST_F(TestKVStoreCache, test_expiration) {
+    config.max_age = 0;
+    init();
+
+    ASSERT_EQ(IB_OK, set("k1", "A key", 1));
+    ASSERT_EQ("A key", get("k1"));
+    backend.values.erase("k1");
+    sleep(2);
+    ASSERT_EQ("<none>", get("k1"));
+    ASSERT_EQ(1U, stats().expirations);
+}
+
+TEST_F(TestKVStoreCache, test_write_through) {
+    init();
+
+    ASSERT_EQ(IB_OK, set("k1", "A key"));
+    ASSERT_EQ(1, backend.sets);
+    ASSERT_EQ("A key", backend.values["k1"]);
+    ASSERT_EQ("A key", get("k1"));
+    ASSERT_EQ(0, backend.gets);
+
+    ib_kvstore_key_t key = { "k1", 2 };
+    ASSERT_EQ(IB_OK, ib_kvstore_remove(&kvstore, &key));
+    ASSERT_EQ(1, backend.removes);
+    ASSERT_EQ("<none>", get("k1"));
+}
+
+TEST_F(TestKVStoreCache, test_write_behind) {
+    config.write_delay = 60;
+    init();
+
+    ASSERT_EQ(IB_OK, set("k1", "A"));
+    ASSERT_EQ(IB_OK, set("k1", "B"));
+    ASSERT_EQ(IB_OK, set("k1", "C"));
+    ASSERT_EQ(IB_OK, set("k2", "D"));
+    ASSERT_EQ(0, backend.sets);
+    ASSERT_EQ("C", get("k1"));
+    ASSERT_EQ(2U, stats().coalesced);
+
+    ASSERT_EQ(IB_OK, ib_kvstore_cache_flush(&kvstore));
+    ASSERT_EQ(2, backend.sets);
+    ASSERT_EQ("C", backend.values["k1"]);
+    ASSERT_EQ("D", backend.values["k2"]);
+
+    /* Nothing left to write. */
+    ASSERT_EQ(IB_OK, ib_kvstore_cache_flush(&kvstore));
+    ASSERT_EQ(2, backend.sets);
+}
+
+TEST_F(TestKVStoreCache, test_write_behind_due) {
+    config.write_delay = 1;
+    init();
+
+    ASSERT_EQ(IB_OK, set("k1", "A"));
+    ASSERT_EQ(0, backend.sets);
+    sleep(2);
+    ASSERT_EQ("A", get("k1"));
+    ASSERT_EQ(1, backend.sets);
+}
+
+TEST_F(TestKVStoreCache, test_write_behind_disconnect) {
+    config.write_delay = 60;
+    init();
+
+    ASSERT_EQ(IB_OK, set("k1", "A"));
+    ASSERT_EQ(IB_OK, ib_kvstore_disconnect(&kvstore));
+    ASSERT_EQ("A", backend.values["k1"]);
+}
+
+TEST_F(TestKVStoreCache, test_eviction) {
+    char k[32];
+
+    config.max_bytes = 16 * 1024;
+    config.shards = 2;
+    config.write_delay = 60;
+    init();
+
+    for (int i = 0; i < 1000; ++i) {
+        snprintf(k, sizeof(k), "key%d", i);
+        ASSERT_EQ(IB_OK, set(k, std::string(100, 'v')));
+    }
+    ASSERT_LT(0U, stats().evictions);
+
+    /* Evicted pending sets were written, so nothing was lost. */
+    ASSERT_EQ(IB_OK, ib_kvstore_cache_flush(&kvstore));
+    ASSERT_EQ(1000U, backend.values.size());
+    ASSERT_EQ(1000, backend.sets);
+    ASSERT_EQ(std::string(100, 'v'), get("key0"));
+}
+
+TEST_F(TestKVStoreCache, test_stale_if_error) {
+    config.max_age = 1;
+    config.stale_if_error = 2;
+    init();
+    backend.values["k1"] = "A key";
+
+    ASSERT_EQ("A key", get("k1"));
+    sleep(2);
+
+    /* The backend fails; the stale value is used. */
+    backend.get_error = IB_ETIMEDOUT;
+    ASSERT_EQ("A key", get("k1"));
+    ASSERT_EQ(1U, stats().stale_hits);
+
+    /* Until it is too stale. */
+    sleep(2);
+    ASSERT_EQ("<none>", get("k1"));
+
+    /* The backend recovers. */
+    backend.get_error = IB_OK;
+    backend.values["k1"] = "Changed";
+    ASSERT_EQ("Changed", get("k1"));
+}
+
+TEST_F(TestKVStoreCache, test_stale_if_error_disabled) {
+    config.max_age = 1;
+    init();
+    backend.values["k1"] = "A key";
+
+    ASSERT_EQ("A key", get("k1"));
+    sleep(2);
+    backend.get_error = IB_ETIMEDOUT;
+    ASSERT_EQ("<none>", get("k1"));
+    ASSERT_EQ(0U, stats().stale_hits);
+}
@@ -0,0 +1,506 @@
+//////////////////////////////////////////////////////////////////////////////
+// Licensed to Qualys, Inc. (QUALYS) under one or more
+// contributor license agreements.  See the NOTICE file distributed with
+// this work for additional information regarding copyright ownership.
+// QUALYS licenses this file to You under the Apache License, Version 2.0
+// (the "License"); you may not use this file except in compliance with
+// the License.  You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//////////////////////////////////////////////////////////////////////////////
+
+extern "C" {
+#include "ironbee_config_auto.h"
+
+#include <ironbee/kvstore.h>
+#include <ironbee/kvstore_riak.h>
+#include <ironbee/mpool.h>
+#include <ironbee/util.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+}
+
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Minimal HTTP/1.1 server standing in for Riak.
+class StubRiak
+{
+public:
+    int port;
+    int connections;
+    int requests;
+    int delay_ms;
+
+    StubRiak() :
+        port(0), connections(0), requests(0), delay_ms(0), m_fd(-1)
+    {
+        pthread_mutex_init(&m_lock, NULL);
+    }
+
+    ~StubRiak()
+    {
+        pthread_mutex_destroy(&m_lock);
+    }
+
+    bool start()
+    {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+
+        m_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (m_fd < 0) {
+            return false;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if ( (bind(m_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+             (listen(m_fd, 64) != 0) ||
+             (getsockname(m_fd, (struct sockaddr *)&addr, &len) != 0) )
+        {
+            return false;
+        }
+        port = ntohs(addr.sin_port);
+
+        return pthread_create(&m_thread, NULL, accept_main, this) == 0;
+    }
+
+    void stop()
+    {
+        shutdown(m_fd, SHUT_RDWR);
+        close(m_fd);
+        pthread_join(m_thread, NULL);
+
+        pthread_mutex_lock(&m_lock);
+        for (size_t i = 0; i < m_conns.size(); ++i) {
+            shutdown(m_conns[i], SHUT_RDWR);
+        }
+        pthread_mutex_unlock(&m_lock);
+        for (size_t i = 0; i < m_threads.size(); ++i) {
+            pthread_join(m_threads[i], NULL);
+        }
+        for (size_t i = 0; i < m_conns.size(); ++i) {
+            close(m_conns[i]);
+        }
+    }
+
+    void put(const std::string& key, const std::string& value)
+    {
+        pthread_mutex_lock(&m_lock);
+        m_values[key] = value;
+        pthread_mutex_unlock(&m_lock);
+    }
+
+    bool has(const std::string& key)
+    {
+        pthread_mutex_lock(&m_lock);
+        bool r = m_values.count(key) > 0;
+        pthread_mutex_unlock(&m_lock);
+        return r;
+    }
+
+private:
+    struct Conn {
+        StubRiak *server;
+        int fd;
+    };
+
+    int m_fd;
+    pthread_t m_thread;
+    pthread_mutex_t m_lock;
+    std::vector<int> m_conns;
+    std::vector<pthread_t> m_threads;
+    std::map<std::string, std::string> m_values;
+
+    static void *accept_main(void *arg)
+    {
+        StubRiak *self = reinterpret_cast<StubRiak *>(arg);
+
+        for (;;) {
+            int fd = accept(self->m_fd, NULL, NULL);
+            if (fd < 0) {
+                return NULL;
+            }
+            Conn *conn = new Conn;
+            conn->server = self;
+            conn->fd = fd;
+
+            pthread_t thread;
+            pthread_mutex_lock(&self->m_lock);
+            ++self->connections;
+            self->m_conns.push_back(fd);
+            pthread_create(&thread, NULL, conn_main, conn);
+            self->m_threads.push_back(thread);
+            pthread_mutex_unlock(&self->m_lock);
+        }
+    }
+
+    static void *conn_main(void *arg)
+    {
+        Conn *conn = reinterpret_cast<Conn *>(arg);
+        StubRiak *self = conn->server;
+        int fd = conn->fd;
+        std::string in;
+        char buf[4096];
+
+        delete conn;
+
+        for (;;) {
+            size_t end;
+            ssize_t n;
+
+            // Read the request head.
+            while ((end = in.find("\r\n\r\n")) == std::string::npos) {
+                n = read(fd, buf, sizeof(buf));
+                if (n <= 0) {
+                    return NULL;
+                }
+                in.append(buf, n);
+            }
+            std::string head = in.substr(0, end + 2);
+            in.erase(0, end + 4);
+
+            std::string method = head.substr(0, head.find(' '));
+            size_t path_start = method.length() + 1;
+            std::string path = head.substr(
+                path_start, head.find(' ', path_start) - path_start);
+
+            size_t length = 0;
+            size_t cl = head.find("Content-Length: ");
+            if (cl != std::string::npos) {
+                length = atoi(head.c_str() + cl + 16);
+            }
+            if (head.find("Expect: 100-continue") != std::string::npos) {
+                const char *cont = "HTTP/1.1 100 Continue\r\n\r\n";
+                if (send(fd, cont, strlen(cont), MSG_NOSIGNAL) < 0) {
+                    return NULL;
+                }
+            }
+            while (in.length() < length) {
+                n = read(fd, buf, sizeof(buf));
+                if (n <= 0) {
+                    return NULL;
+                }
+                in.append(buf, n);
+            }
+            std::string body = in.substr(0, length);
+            in.erase(0, length);
+
+            std::string response = self->handle(method, path, body);
+            if (send(fd, response.data(), response.length(),
+                     MSG_NOSIGNAL) < 0)
+            {
+                return NULL;
+            }
+        }
+    }
+
+    std::string handle(
+        const std::string& method,
+        const std::string& path,
+        const std::string& body)
+    {
+        const std::string prefix = "/buckets/bucket/keys/";
+        std::string status = "404 Not Found";
+        std::string headers;
+        std::string out;
+
+        pthread_mutex_lock(&m_lock);
+        ++requests;
+        int delay = delay_ms;
+        if (path == "/ping") {
+            status = "200 OK";
+            out = "OK";
+        }
+        else if (path.compare(0, prefix.length(), prefix) == 0) {
+            std::string key = path.substr(prefix.length());
+            if (method == "PUT") {
+                m_values[key] = body;
+                status = "204 No Content";
+            }
+            else if (method == "DELETE") {
+                m_values.erase(key);
+                status = "204 No Content";
+            }
+            else if (m_values.count(key) > 0) {
+                status = "200 OK";
+                headers = "ETag: etag-" + key + "\r\n";
+                out = m_values[key];
+            }
+        }
+        pthread_mutex_unlock(&m_lock);
+
+        if (delay > 0) {
+            usleep(delay * 1000);
+        }
+
+        char length[32];
+        snprintf(length, sizeof(length), "%zu", out.length());
+        return "HTTP/1.1 " + status + "\r\n"
+               "Content-Type: text/plain\r\n" + headers +
+               "Content-Length: " + length + "\r\n"
+               "\r\n" + out;
+    }
+};
+
+}
+
+class TestKVStoreRiak : public testing::Test
+{
+    public:
+
+    StubRiak server;
+    ib_kvstore_t kvstore;
+    ib_mpool_t *mp;
+
+    TestKVStoreRiak() : mp(NULL) {}
+
+    virtual void SetUp() {
+        ASSERT_TRUE(server.start());
+        connect(NULL);
+    }
+
+    virtual void TearDown() {
+        ib_kvstore_disconnect(&kvstore);
+        ib_kvstore_destroy(&kvstore);
+        if (mp != NULL) {
+            ib_mpool_destroy(mp);
+        }
+        server.stop();
+    }
+
+    // Initializes and connects kvstore, allocating from @a pool if not NULL.
+    void connect(ib_mpool_t *pool)
+    {
+        char url[64];
+
+        snprintf(url, sizeof(url), "http://127.0.0.1:%d", server.port);
+        ASSERT_EQ(IB_OK,
+                  ib_kvstore_riak_init(&kvstore, "test", url, "bucket", pool));
+        ASSERT_EQ(IB_OK, ib_kvstore_connect(&kvstore));
+    }
+
+    ib_status_t set(const std::string& k, const std::string& v)
+    {
+        ib_kvstore_key_t key;
+        ib_kvstore_value_t val;
+
+        key.key = k.data();
+        key.length = k.length();
+        memset(&val, 0, sizeof(val));
+        val.value = (void *)v.data();
+        val.value_length = v.length();
+        val.type = (char *)"text/plain";
+        val.type_length = 10;
+
+        return ib_kvstore_set(&kvstore, NULL, &key, &val);
+    }
+
+    // Returns the value of @a k, or "<none>".
+    std::string get(const std::string& k, ib_status_t *rc = NULL)
+    {
+        ib_kvstore_key_t key;
+        ib_kvstore_value_t *result;
+        ib_status_t status;
+        std::string v;
+
+        key.key = k.data();
+        key.length = k.length();
+
+        status = ib_kvstore_get(&kvstore, NULL, &key, &result);
+        if (rc != NULL) {
+            *rc = status;
+        }
+        if (status != IB_OK) {
+            return "<none>";
+        }
+        v.assign((const char *)result->value, result->value_length);
+        ib_kvstore_free_value(&kvstore, result);
+        return v;
+    }
+};
+
+TEST_F(TestKVStoreRiak, test_set_get_remove) {
+    ib_kvstore_key_t key = { "k1", 2 };
+    ib_status_t rc;
+
+    ASSERT_EQ(1, ib_kvstore_riak_ping(&kvstore));
+
+    ASSERT_EQ(IB_OK, set("k1", "A key"));
+    ASSERT_TRUE(server.has("k1"));
+    ASSERT_EQ("A key", get("k1"));
+
+    ASSERT_EQ(IB_OK, ib_kvstore_remove(&kvstore, &key));
+    ASSERT_EQ("<none>", get("k1", &rc));
+    ASSERT_EQ(IB_ENOENT, rc);
+}
+
+TEST_F(TestKVStoreRiak, test_key_not_terminated) {
+    // Keys are not NUL terminated; only the length is used.
+    ib_kvstore_key_t key = { "k1junk", 2 };
+    ib_kvstore_value_t *result;
+
+    server.put("k1", "A key");
+    ASSERT_EQ(IB_OK, ib_kvstore_get(&kvstore, NULL, &key, &result));
+    ib_kvstore_free_value(&kvstore, result);
+}
+
+TEST_F(TestKVStoreRiak, test_connection_reuse) {
+    ASSERT_EQ(IB_OK, set("k1", "A key"));
+    for (int i = 0; i < 20; ++i) {
+        ASSERT_EQ("A key", get("k1"));
+    }
+    ASSERT_EQ(21, server.requests);
+    ASSERT_EQ(1, server.connections);
+}
+
+TEST_F(TestKVStoreRiak, test_no_pool) {
+    ASSERT_EQ(IB_OK, ib_kvstore_riak_set_pool_size(&kvstore, 0));
+    ASSERT_EQ(IB_OK, set("k1", "A key"));
+    ASSERT_EQ("A key", get("k1"));
+    ASSERT_EQ(2, server.connections);
+}
+
+TEST_F(TestKVStoreRiak, test_timeout) {
+    ib_status_t rc;
+
+    server.put("k1", "A key");
+    server.delay_ms = 500;
+    ib_kvstore_riak_set_timeout(&kvstore, 100, 100);
+    ASSERT_EQ("<none>", get("k1", &rc));
+    ASSERT_EQ(IB_ETIMEDOUT, rc);
+
+    server.delay_ms = 0;
+    ib_kvstore_riak_set_timeout(&kvstore, 1000, 100);
+    ASSERT_EQ("A key", get("k1"));
+}
+
+TEST_F(TestKVStoreRiak, test_get_multi) {
+    const size_t n = 16;
+    ib_kvstore_key_t keys[n];
+    ib_kvstore_value_t *values[n];
+    ib_status_t results[n];
+    char names[n][8];
+
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(names[i], sizeof(names[i]), "key%zu", i);
+        keys[i].key = names[i];
+        keys[i].length = strlen(names[i]);
+        if (i % 2 == 0) {
+            server.put(names[i], std::string("value ") + names[i]);
+        }
+    }
+
+    // Requests run concurrently, so this takes about one delay.
+    server.delay_ms = 200;
+    ASSERT_EQ(IB_OK,
+              ib_kvstore_riak_get_multi(&kvstore, keys, n, values, results));
+    for (size_t i = 0; i < n; ++i) {
+        if (i % 2 == 0) {
+            ASSERT_EQ(IB_OK, results[i]);
+            ASSERT_EQ(std::string("value ") + names[i],
+                      std::string((const char *)values[i]->value,
+                                  values[i]->value_length));
+            ib_kvstore_free_value(&kvstore, values[i]);
+        }
+        else {
+            ASSERT_EQ(IB_ENOENT, results[i]);
+            ASSERT_TRUE(values[i] == NULL);
+        }
+    }
+    ASSERT_EQ(static_cast<int>(n), server.connections);
+
+    // The etag is left as after fetching the keys in order.
+    ASSERT_STREQ("etag-key14", ib_kvstore_riak_get_etag(&kvstore));
+
+    // A timeout fails the keys, not the process.
+    ib_kvstore_riak_set_timeout(&kvstore, 50, 100);
+    ASSERT_EQ(IB_EOTHER,
+              ib_kvstore_riak_get_multi(&kvstore, keys, 2, values, results));
+    ASSERT_EQ(IB_ETIMEDOUT, results[0]);
+    ASSERT_EQ(IB_ETIMEDOUT, results[1]);
+}
+
+namespace {
+
+struct ThreadArg {
+    TestKVStoreRiak *test;
+    int failures;
+};
+
+extern "C" void *get_thread(void *arg)
+{
+    ThreadArg *a = reinterpret_cast<ThreadArg *>(arg);
+
+    for (int i = 0; i < 50; ++i) {
+        if (a->test->get("k1") != "A key") {
+            ++a->failures;
+        }
+    }
+    return NULL;
+}
+
+}
+
+TEST_F(TestKVStoreRiak, test_threads) {
+    const int nthreads = 4;
+    pthread_t threads[nthreads];
+    ThreadArg args[nthreads];
+
+    server.put("k1", "A key");
+    for (int i = 0; i < nthreads; ++i) {
+        args[i].test = this;
+        args[i].failures = 0;
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, get_thread, &args[i]));
+    }
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(threads[i], NULL);
+        ASSERT_EQ(0, args[i].failures);
+    }
+
+    // Connections are reused across threads.
+    ASSERT_GE(nthreads, server.connections);
+}
+
+TEST_F(TestKVStoreRiak, test_threads_mpool) {
+    const int nthreads = 4;
+    pthread_t threads[nthreads];
+    ThreadArg args[nthreads];
+
+    // Values are allocated from a pool shared by all threads.
+    ib_kvstore_disconnect(&kvstore);
+    ib_kvstore_destroy(&kvstore);
+    ASSERT_EQ(IB_OK, ib_mpool_create(&mp, "TestKVStoreRiak", NULL));
+    connect(mp);
+
+    server.put("k1", "A key");
+    for (int i = 0; i < nthreads; ++i) {
+        args[i].test = this;
+        args[i].failures = 0;
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, get_thread, &args[i]));
+    }
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(threads[i], NULL);
+        ASSERT_EQ(0, args[i].failures);
+    }
+    ASSERT_STREQ("etag-k1", ib_kvstore_riak_get_etag(&kvstore));
+}
@@ -0,0 +1,263 @@
+//////////////////////////////////////////////////////////////////////////////
+// Licensed to Qualys, Inc. (QUALYS) under one or more
+// contributor license agreements.  See the NOTICE file distributed with
+// this work for additional information regarding copyright ownership.
+// QUALYS licenses this file to You under the Apache License, Version 2.0
+// (the "License"); you may not use this file except in compliance with
+// the License.  You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//////////////////////////////////////////////////////////////////////////////
+
+extern "C" {
+#include "ironbee_config_auto.h"
+
+#include <ironbee/kvstore.h>
+#include <ironbee/kvstore_shm.h>
+#include <ironbee/mpool.h>
+#include <ironbee/util.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+}
+
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#define SHM_PATH "TestKVStoreShm.shm"
+
+class TestKVStoreShm : public testing::Test
+{
+    public:
+
+    ib_kvstore_t kvstore;
+    ib_mpool_t *mp;
+
+    virtual void SetUp() {
+        unlink(SHM_PATH);
+        ASSERT_EQ(IB_OK, ib_kvstore_shm_init(&kvstore, SHM_PATH, 256 * 1024));
+        ASSERT_EQ(IB_OK, ib_kvstore_connect(&kvstore));
+        ib_mpool_create(&mp, "TestKVStoreShm", NULL);
+    }
+
+    virtual void TearDown() {
+        ib_kvstore_disconnect(&kvstore);
+        ib_kvstore_destroy(&kvstore);
+        ib_mpool_destroy(mp);
+        unlink(SHM_PATH);
+    }
+
+    ib_status_t set(ib_kvstore_t *kv, const std::string& k,
+                    const std::string& v, uint32_t expiration = 0)
+    {
+        ib_kvstore_key_t key;
+        ib_kvstore_value_t val;
+
+        key.key = k.data();
+        key.length = k.length();
+        memset(&val, 0, sizeof(val));
+        val.value = (void *)v.data();
+        val.value_length = v.length();
+        val.type = (char *)"txt";
+        val.type_length = 3;
+        val.expiration = expiration;
+
+        return ib_kvstore_set(kv, NULL, &key, &val);
+    }
+
+    // Returns the value of @a k, or "<none>".
+    std::string get(ib_kvstore_t *kv, const std::string& k)
+    {
+        ib_kvstore_key_t key;
+        ib_kvstore_value_t *result;
+        std::string v;
+
+        key.key = k.data();
+        key.length = k.length();
+
+        if (ib_kvstore_get(kv, NULL, &key, &result) != IB_OK) {
+            return "<none>";
+        }
+        v.assign((const char *)result->value, result->value_length);
+        EXPECT_EQ(std::string("txt"),
+                  std::string(result->type, result->type_length));
+        ib_kvstore_free_value(kv, result);
+        return v;
+    }
+};
+
+TEST_F(TestKVStoreShm, test_set_get) {
+    ASSERT_EQ(IB_OK, set(&kvstore, "k1", "A key"));
+    ASSERT_EQ("A key", get(&kvstore, "k1"));
+    ASSERT_EQ("<none>", get(&kvstore, "k2"));
+
+    /* Values spanning several blocks. */
+    std::string big(1000, 'x');
+    big[999] = 'y';
+    ASSERT_EQ(IB_OK, set(&kvstore, "big", big));
+    ASSERT_EQ(big, get(&kvstore, "big"));
+
+    /* Empty value. */
+    ASSERT_EQ(IB_OK, set(&kvstore, "empty", ""));
+    ASSERT_EQ("", get(&kvstore, "empty"));
+}
+
+TEST_F(TestKVStoreShm, test_replace) {
+    ASSERT_EQ(IB_OK, set(&kvstore, "k1", "A key"));
+    ASSERT_EQ(IB_OK, set(&kvstore, "k1", "Another key"));
+    ASSERT_EQ("Another key", get(&kvstore, "k1"));
+}
+
+TEST_F(TestKVStoreShm, test_remove) {
+    ib_kvstore_key_t key = { "k1", 2 };
+
+    ASSERT_EQ(IB_OK, set(&kvstore, "k1", "A key"));
+    ASSERT_EQ(IB_OK, set(&kvstore, "k2", "B key"));
+    ASSERT_EQ(IB_OK, ib_kvstore_remove(&kvstore, &key));
+    ASSERT_EQ("<none>", get(&kvstore, "k1"));
+    ASSERT_EQ("B key", get(&kvstore, "k2"));
+}
+
+TEST_F(TestKVStoreShm, test_expiration) {
+    ib_kvstore_key_t key = { "k1", 2 };
+    ib_kvstore_value_t *result;
+
+    ASSERT_EQ(IB_OK, set(&kvstore, "k1", "A key", 100));
+    ASSERT_EQ(IB_OK, ib_kvstore_get(&kvstore, NULL, &key, &result));
+    ASSERT_LE(99U, result->expiration);
+    ASSERT_GE(100U, result->expiration);
+    ASSERT_NE(0U, result->creation.tv_sec);
+    ib_kvstore_free_value(&kvstore, result);
+
+    ASSERT_EQ(IB_OK, set(&kvstore, "k1", "A key", 1));
+    sleep(2);
+    ASSERT_EQ("<none>", get(&kvstore, "k1"));
+}
+
+TEST_F(TestKVStoreShm, test_eviction) {
+    char k[32];
+    std::string v(200, 'v');
+
+    /* Far more than fits; old values are evicted, recent ones kept. */
+    for (int i = 0; i < 5000; ++i) {
+        snprintf(k, sizeof(k), "key%d", i);
+        ASSERT_EQ(IB_OK, set(&kvstore, k, v));
+    }
+    ASSERT_EQ("<none>", get(&kvstore, "key0"));
+    ASSERT_EQ(v, get(&kvstore, "key4999"));
+
+    /* A value larger than a stripe is refused. */
+    ASSERT_EQ(IB_EINVAL, set(&kvstore, "huge", std::string(256 * 1024, 'h')));
+}
+
+TEST_F(TestKVStoreShm, test_shared) {
+    ib_kvstore_t other;
+
+    /* A second store on the same file sees the same values. */
+    ASSERT_EQ(IB_OK, ib_kvstore_shm_init(&other, SHM_PATH, 0));
+    ASSERT_EQ(IB_OK, ib_kvstore_connect(&other));
+    ASSERT_EQ(IB_OK, set(&kvstore, "k1", "A key"));
+    ASSERT_EQ("A key", get(&other, "k1"));
+
+    /* So does a child process, in both directions. */
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+    if (pid == 0) {
+        bool ok = (get(&kvstore, "k1") == "A key") &&
+                  (set(&kvstore, "k2", "From child") == IB_OK);
+        _exit(ok ? 0 : 1);
+    }
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+    ASSERT_EQ("From child", get(&other, "k2"));
+
+    ib_kvstore_disconnect(&other);
+    ib_kvstore_destroy(&other);
+}
+
+TEST_F(TestKVStoreShm, test_reinitialize) {
+    ib_kvstore_t other;
+    int fd;
+
+    ASSERT_EQ(IB_OK, set(&kvstore, "k1", "A key"));
+    ib_kvstore_disconnect(&kvstore);
+
+    /* Reconnecting keeps the contents. */
+    ASSERT_EQ(IB_OK, ib_kvstore_connect(&kvstore));
+    ASSERT_EQ("A key", get(&kvstore, "k1"));
+    ib_kvstore_disconnect(&kvstore);
+
+    /* A damaged header causes the file to be reinitialized. */
+    fd = open(SHM_PATH, O_WRONLY);
+    ASSERT_LE(0, fd);
+    ASSERT_EQ(4, pwrite(fd, "junk", 4, 0));
+    close(fd);
+
+    ASSERT_EQ(IB_OK, ib_kvstore_shm_init(&other, SHM_PATH, 128 * 1024));
+    ASSERT_EQ(IB_OK, ib_kvstore_connect(&other));
+    ASSERT_EQ("<none>", get(&other, "k1"));
+    ASSERT_EQ(IB_OK, set(&other, "k1", "B key"));
+    ASSERT_EQ("B key", get(&other, "k1"));
+    ib_kvstore_disconnect(&other);
+    ib_kvstore_destroy(&other);
+
+    ASSERT_EQ(IB_OK, ib_kvstore_connect(&kvstore));
+    ASSERT_EQ("B key", get(&kvstore, "k1"));
+}
+
+TEST_F(TestKVStoreShm, test_too_small) {
+    ib_kvstore_t other;
+
+    unlink(SHM_PATH ".small");
+    ASSERT_EQ(IB_OK, ib_kvstore_shm_init(&other, SHM_PATH ".small", 64));
+    ASSERT_EQ(IB_EINVAL, ib_kvstore_connect(&other));
+    ib_kvstore_destroy(&other);
+    unlink(SHM_PATH ".small");
+}
+
+TEST_F(TestKVStoreShm, test_replace_mapped) {
+    ib_kvstore_t other;
+    struct stat before;
+    struct stat after;
+    int fd;
+
+    ASSERT_EQ(IB_OK, set(&kvstore, "k1", "A key"));
+    ASSERT_EQ(0, stat(SHM_PATH, &before));
+
+    /* Damage the header under a connected store. */
+    fd = open(SHM_PATH, O_WRONLY);
+    ASSERT_LE(0, fd);
+    ASSERT_EQ(4, pwrite(fd, "\xff\xff\xff\xff", 4, 8));
+    close(fd);
+
+    /* A new connection replaces the file rather than truncating it... */
+    ASSERT_EQ(IB_OK, ib_kvstore_shm_init(&other, SHM_PATH, 128 * 1024));
+    ASSERT_EQ(IB_OK, ib_kvstore_connect(&other));
+    ASSERT_EQ(0, stat(SHM_PATH, &after));
+    ASSERT_NE(before.st_ino, after.st_ino);
+    ASSERT_EQ(128 * 1024, after.st_size);
+    ASSERT_EQ("<none>", get(&other, "k1"));
+    ASSERT_EQ(IB_OK, set(&other, "k2", "B key"));
+
+    /* ...and the connected store moves to the new file. */
+    ASSERT_EQ("<none>", get(&kvstore, "k1"));
+    ASSERT_EQ("B key", get(&kvstore, "k2"));
+    ASSERT_EQ(IB_OK, set(&kvstore, "k3", "C key"));
+    ASSERT_EQ("C key", get(&other, "k3"));
+
+    ib_kvstore_disconnect(&other);
+    ib_kvstore_destroy(&other);
+}
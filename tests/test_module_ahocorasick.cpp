@@ -226,3 +226,53 @@ TEST_F(AhoCorasickModuleTest, test_pmf_rule)
     // This time we should succeed.
     ASSERT_TRUE(result);
 }
+
+class AhoCorasickModuleStreamTest : public BaseFixture {
+public:
+    virtual void SetUp() {
+        BaseFixture::SetUp();
+        configureIronBee("AhoCorasickModuleStreamTest.config");
+    }
+
+    // Value of the counter @a name, or 0 if it was never set.
+    ib_num_t counter(ib_tx_t *tx, const char *name)
+    {
+        ib_field_t *f;
+        ib_num_t n = 0;
+
+        if (ib_data_get(tx->data, name, &f) != IB_OK) {
+            return 0;
+        }
+        EXPECT_EQ(IB_FTYPE_NUM, f->type);
+        EXPECT_EQ(IB_OK, ib_field_value(f, ib_ftype_num_out(&n)));
+        return n;
+    }
+};
+
+TEST_F(AhoCorasickModuleStreamTest, test_split_body)
+{
+    ib_conn_t *conn = buildIronBeeConnection();
+
+    // The pattern is split between headers and between body chunks.
+    sendDataIn(conn,
+               "POST / HTTP/1.1\r\n"
+               "Host: UnitTest\r\n"
+               "X-Split-A: aaaastri\r\n"
+               "X-Split-B: ng2bbbb\r\n"
+               "Content-Length: 19\r\n"
+               "\r\n"
+               "aaaastri");
+    sendDataIn(conn, "ng2bbbb");
+    sendDataIn(conn, "cccc");
+
+    sendDataOut(conn,
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Length: 0\r\n"
+                "\r\n");
+
+    ASSERT_TRUE(conn->tx);
+    EXPECT_EQ(1, counter(conn->tx, "pm_body"));
+    EXPECT_EQ(1, counter(conn->tx, "pmf_body"));
+    EXPECT_EQ(0, counter(conn->tx, "pm_header"));
+    EXPECT_EQ(0, counter(conn->tx, "pm_phase"));
+}
@@ -76,3 +76,58 @@ TEST_F(DfaModuleTest, matches)
     /* If we do not crash, we are generally OK. */
     ASSERT_TRUE(ib_tx);
 }
+
+class DfaModuleStreamTest : public BaseModuleFixture {
+public:
+    DfaModuleStreamTest() : BaseModuleFixture("ibmod_pcre.so")
+    {
+    }
+
+    virtual void SetUp() {
+        BaseModuleFixture::SetUp();
+        configureIronBee("DfaModuleStreamTest.config");
+    }
+
+    // Value of the counter @a name, or 0 if it was never set.
+    ib_num_t counter(ib_tx_t *tx, const char *name)
+    {
+        ib_field_t *f;
+        ib_num_t n = 0;
+
+        if (ib_data_get(tx->data, name, &f) != IB_OK) {
+            return 0;
+        }
+        EXPECT_EQ(IB_FTYPE_NUM, f->type);
+        EXPECT_EQ(IB_OK, ib_field_value(f, ib_ftype_num_out(&n)));
+        return n;
+    }
+};
+
+TEST_F(DfaModuleStreamTest, split_body)
+{
+    ib_conn_t *conn = buildIronBeeConnection();
+
+    // The pattern is split between headers and between body chunks.  The
+    // second chunk also holds "qq" while "ax..." is still a partial match.
+    sendDataIn(conn,
+               "POST / HTTP/1.1\r\n"
+               "Host: UnitTest\r\n"
+               "X-Split-A: xaxstring_to\r\n"
+               "X-Split-B: _matchyy\r\n"
+               "Content-Length: 33\r\n"
+               "\r\n"
+               "xaxstring_to");
+    sendDataIn(conn, "_matchyyqqbb");
+    sendDataIn(conn, "ccccccccc");
+
+    sendDataOut(conn,
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Length: 0\r\n"
+                "\r\n");
+
+    ASSERT_TRUE(conn->tx);
+    EXPECT_EQ(1, counter(conn->tx, "dfa_body"));
+    EXPECT_EQ(1, counter(conn->tx, "dfa_restart"));
+    EXPECT_EQ(0, counter(conn->tx, "dfa_header"));
+    EXPECT_EQ(0, counter(conn->tx, "dfa_phase"));
+}
@@ -135,3 +135,57 @@ TEST_F(EeOperModuleTest, test_ee_match_any_fail)
     ib_field_value(f, ib_ftype_num_out(&n));
     EXPECT_EQ(0, n);
 }
+
+class EeOperModuleStreamTest : public BaseModuleFixture {
+public:
+    EeOperModuleStreamTest() : BaseModuleFixture("ibmod_ee.so")
+    {
+    }
+
+    virtual void SetUp() {
+        BaseModuleFixture::SetUp();
+
+        configureIronBee("EeOperModuleStreamTest.config");
+    }
+
+    // Value of the counter @a name, or 0 if it was never set.
+    ib_num_t counter(ib_tx_t *tx, const char *name)
+    {
+        ib_field_t *f;
+        ib_num_t n = 0;
+
+        if (ib_data_get(tx->data, name, &f) != IB_OK) {
+            return 0;
+        }
+        EXPECT_EQ(IB_FTYPE_NUM, f->type);
+        EXPECT_EQ(IB_OK, ib_field_value(f, ib_ftype_num_out(&n)));
+        return n;
+    }
+};
+
+TEST_F(EeOperModuleStreamTest, test_split_body)
+{
+    ib_conn_t *ib_conn = buildIronBeeConnection();
+
+    // The pattern is split between headers and between body chunks.
+    sendDataIn(ib_conn,
+               "POST / HTTP/1.1\r\n"
+               "Host: UnitTest\r\n"
+               "X-Split-A: xxstring_to\r\n"
+               "X-Split-B: _matchyy\r\n"
+               "Content-Length: 28\r\n"
+               "\r\n"
+               "xxstring_to");
+    sendDataIn(ib_conn, "_matchyy");
+    sendDataIn(ib_conn, "ccccccccc");
+
+    sendDataOut(ib_conn,
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Length: 0\r\n"
+                "\r\n");
+
+    ASSERT_TRUE(ib_conn->tx);
+    EXPECT_EQ(1, counter(ib_conn->tx, "ee_body"));
+    EXPECT_EQ(0, counter(ib_conn->tx, "ee_header"));
+    EXPECT_EQ(0, counter(ib_conn->tx, "ee_phase"));
+}
@@ -33,6 +33,13 @@
 #include <ironbee/field.h>
 #include <ironbee/bytestr.h>
 
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+
 // @todo Remove once ib_engine_operator_get() is available.
 #include "engine_private.h"
 
@@ -353,3 +360,252 @@ TEST_F(PcreModuleTest, test_match_capture)
     ib_field_value(ib_field, ib_ftype_list_out(&ib_list));
     ASSERT_EQ(0U, IB_LIST_ELEMENTS(ib_list));
 }
+
+TEST_F(PcreModuleTest, test_prefilter)
+{
+    ib_field_t *ib_field;
+
+    // Literal present: the regex ran and matched.
+    ASSERT_EQ(IB_OK, ib_data_get(ib_tx->data, "pf_hit", &ib_field));
+
+    // Literal absent: the rule did not match.
+    ASSERT_EQ(IB_ENOENT, ib_data_get(ib_tx->data, "pf_miss", &ib_field));
+    ASSERT_EQ(IB_OK, ib_data_get(ib_tx->data, "pf_invert", &ib_field));
+}
+
+#define JIT_LOG_PATH "PcreJitStackTest.log"
+
+// Arguments of a thread running a JIT pattern.
+struct jit_thread_t {
+    ib_rule_exec_t      rule_exec;
+    ib_operator_inst_t *op_inst;
+    ib_field_t         *field;
+    int                 runs;
+    int                 matched;
+};
+
+static void *jit_thread(void *arg)
+{
+    jit_thread_t *t = static_cast<jit_thread_t *>(arg);
+
+    for (int i = 0; i < t->runs; ++i) {
+        ib_num_t result = 0;
+
+        if ( (t->op_inst->op->fn_execute(&t->rule_exec,
+                                         t->op_inst->data,
+                                         t->op_inst->flags,
+                                         t->field,
+                                         &result) == IB_OK) &&
+             result )
+        {
+            ++t->matched;
+        }
+    }
+    return NULL;
+}
+
+class PcreJitStackTest : public BaseFixture {
+public:
+    ib_tx_t *ib_tx;
+    ib_rule_t *rule;
+    ib_rule_exec_t rule_exec;
+
+    virtual void SetUp()
+    {
+        unlink(JIT_LOG_PATH);
+        BaseFixture::SetUp();
+
+        // Small JIT stacks in the main context, larger ones in the site.
+        configureIronBeeByString(
+            "LogLevel info\n"
+            "Log " JIT_LOG_PATH "\n"
+            "LoadModule \"ibmod_htp.so\"\n"
+            "LoadModule \"ibmod_pcre.so\"\n"
+            "Set parser \"htp\"\n"
+            "SensorId B9C1B52B-C24A-4309-B9F9-0EF4CD577A3E\n"
+            "SensorName UnitTesting\n"
+            "SensorHostname unit-testing.sensor.tld\n"
+            "AuditEngine Off\n"
+            "PcreUseJit On\n"
+            "PcrePrefilter Off\n"
+            "PcreMatchLimit 100000\n"
+            "PcreMatchLimitRecursion 100000\n"
+            "PcreJitStackStart 4096\n"
+            "PcreJitStackMax 4096\n"
+            "<Site test-site>\n"
+            "  SiteId AAAABBBB-1111-2222-3333-000000000000\n"
+            "  Hostname *\n"
+            "  PcreJitStackStart 32768\n"
+            "  PcreJitStackMax 1048576\n"
+            "</Site>\n");
+
+        ib_conn_t *conn = buildIronBeeConnection();
+        sendDataIn(conn,
+                   "GET / HTTP/1.1\r\n"
+                   "Host: UnitTest\r\n"
+                   "\r\n");
+        ASSERT_TRUE(conn->tx);
+        ib_tx = conn->tx;
+
+        ASSERT_EQ(IB_OK, ib_rule_create(ib_engine,
+                                        ib_context_engine(ib_engine),
+                                        __FILE__, __LINE__, true, &rule));
+        ASSERT_EQ(IB_OK, ib_rule_set_id(ib_engine, rule, "jit_rule"));
+
+        memset(&rule_exec, 0, sizeof(rule_exec));
+        rule_exec.ib = ib_engine;
+        rule_exec.tx = ib_tx;
+        rule_exec.rule = rule;
+    }
+
+    virtual void TearDown()
+    {
+        if (ib_engine != NULL) {
+            BaseFixture::TearDown();
+        }
+        unlink(JIT_LOG_PATH);
+    }
+
+    // Create an rx operator instance for @a pattern in @a ctx.
+    ib_operator_inst_t *rx(ib_context_t *ctx, const char *pattern)
+    {
+        ib_operator_inst_t *op_inst = NULL;
+
+        if (ib_operator_inst_create(ib_engine, ctx, rule,
+                                    IB_OP_FLAG_PHASE, "rx", pattern,
+                                    IB_OPINST_FLAG_NONE,
+                                    &op_inst) != IB_OK)
+        {
+            throw std::runtime_error("Could not create rx operator.");
+        }
+        return op_inst;
+    }
+
+    // A bytestr field holding @a value.
+    ib_field_t *field(const std::string& value)
+    {
+        ib_field_t *f;
+
+        if (ib_field_create_bytestr_alias(
+                &f, ib_tx->mp, IB_FIELD_NAME("subject"),
+                (uint8_t *)ib_mpool_memdup(ib_tx->mp, value.data(),
+                                           value.length()),
+                value.length()) != IB_OK)
+        {
+            throw std::runtime_error("Could not create field.");
+        }
+        return f;
+    }
+
+    // Run @a op_inst on @a f in this thread.
+    ib_num_t run(ib_operator_inst_t *op_inst, ib_field_t *f)
+    {
+        ib_num_t result = 0;
+
+        if (op_inst->op->fn_execute(&rule_exec, op_inst->data,
+                                    op_inst->flags, f, &result) != IB_OK)
+        {
+            return -1;
+        }
+        return result;
+    }
+
+    // Shut down the engine, and read the JIT stack counters the module
+    // logs when it is finalized.  Returns false if they were not logged
+    // (PCRE without JIT support).
+    bool jit_counters(int *created, int *grown, int *failed, int *fallbacks)
+    {
+        std::string line;
+
+        ib_engine_destroy(ib_engine);
+        ib_shutdown();
+        ib_engine = NULL;
+
+        std::ifstream log(JIT_LOG_PATH);
+        while (std::getline(log, line)) {
+            size_t pos = line.find("PCRE JIT stacks: ");
+
+            if (pos != std::string::npos) {
+                return sscanf(line.c_str() + pos,
+                              "PCRE JIT stacks: created=%d grown=%d "
+                              "failed=%d interpreter-fallbacks=%d",
+                              created, grown, failed, fallbacks) == 4;
+            }
+        }
+        return false;
+    }
+};
+
+TEST_F(PcreJitStackTest, test_threads)
+{
+    const int num_threads = 4;
+    const int runs = 200;
+    pthread_t threads[num_threads];
+    jit_thread_t args[num_threads];
+    ib_operator_inst_t *op_inst = rx(ib_tx->ctx, "^(?:a|b)*c$");
+    int created, grown, failed, fallbacks;
+
+    for (int t = 0; t < num_threads; ++t) {
+        args[t].rule_exec = rule_exec;
+        args[t].op_inst = op_inst;
+        args[t].field = field(std::string(100 + t, 'a') + "c");
+        args[t].runs = runs;
+        args[t].matched = 0;
+        ASSERT_EQ(0, pthread_create(&threads[t], NULL, jit_thread, &args[t]));
+    }
+    for (int t = 0; t < num_threads; ++t) {
+        pthread_join(threads[t], NULL);
+        EXPECT_EQ(runs, args[t].matched);
+    }
+
+    // One stack per thread, reused for all of the thread's matches.
+    if (jit_counters(&created, &grown, &failed, &fallbacks)) {
+        EXPECT_EQ(num_threads, created);
+        EXPECT_EQ(0, grown);
+        EXPECT_EQ(0, failed);
+        EXPECT_EQ(0, fallbacks);
+    }
+}
+
+TEST_F(PcreJitStackTest, test_grow)
+{
+    ib_operator_inst_t *small = rx(ib_context_main(ib_engine), "^(?:a|b)*c$");
+    ib_operator_inst_t *large = rx(ib_tx->ctx, "^(?:a|b)*c$");
+    ib_field_t *f = field("abac");
+    int created, grown, failed, fallbacks;
+
+    EXPECT_EQ(1, run(small, f));
+    EXPECT_EQ(1, run(large, f));
+    EXPECT_EQ(1, run(small, f));
+    EXPECT_EQ(1, run(large, f));
+
+    // The small stack is replaced once, by the large one.
+    if (jit_counters(&created, &grown, &failed, &fallbacks)) {
+        EXPECT_EQ(1, created);
+        EXPECT_EQ(1, grown);
+        EXPECT_EQ(0, failed);
+        EXPECT_EQ(0, fallbacks);
+    }
+}
+
+TEST_F(PcreJitStackTest, test_stack_limit)
+{
+    ib_operator_inst_t *small = rx(ib_context_main(ib_engine), "^(?:a|b)*c$");
+    ib_field_t *deep = field(std::string(3000, 'a') + "c");
+    ib_field_t *deep_miss = field(std::string(3000, 'a') + "d");
+    int created, grown, failed, fallbacks;
+
+    // Too deep for the JIT stack: the interpreter gives the result.
+    EXPECT_EQ(1, run(small, deep));
+    EXPECT_EQ(0, run(small, deep_miss));
+
+    // Fits in the JIT stack.
+    EXPECT_EQ(1, run(small, field("abc")));
+
+    if (jit_counters(&created, &grown, &failed, &fallbacks)) {
+        EXPECT_EQ(1, created);
+        EXPECT_EQ(0, grown);
+        EXPECT_EQ(0, failed);
+        EXPECT_EQ(2, fallbacks);
+    }
+}
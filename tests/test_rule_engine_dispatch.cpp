@@ -0,0 +1,269 @@
+//////////////////////////////////////////////////////////////////////////////
+// Licensed to Qualys, Inc. (QUALYS) under one or more
+// contributor license agreements.  See the NOTICE file distributed with
+// this work for additional information regarding copyright ownership.
+// QUALYS licenses this file to You under the Apache License, Version 2.0
+// (the "License"); you may not use this file except in compliance with
+// the License.  You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//////////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief IronBee --- Rule engine phase rule dispatch tests
+//////////////////////////////////////////////////////////////////////////////
+
+#include "gtest/gtest.h"
+
+#include "base_fixture.h"
+
+#include <ironbee/action.h>
+#include <ironbee/engine.h>
+#include <ironbee/operator.h>
+
+#include <string>
+#include <vector>
+
+// Fields to add to the data of the next transaction.
+static std::vector<std::string> dispatch_fields;
+
+// Labels of the rules that fired, in order.
+static std::vector<std::string> dispatch_fired;
+
+static ib_status_t dispatch_tx_started(ib_engine_t *ib,
+                                       ib_tx_t *tx,
+                                       ib_state_event_type_t event,
+                                       void *cbdata)
+{
+    for (size_t n = 0; n < dispatch_fields.size(); ++n) {
+        ib_status_t rc = ib_data_add_nulstr(tx->data,
+                                            dispatch_fields[n].c_str(),
+                                            "x", NULL);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+    return IB_OK;
+}
+
+// True for any value; unlike nop, it is not called for absent fields.
+static ib_status_t dispatch_true_execute(const ib_rule_exec_t *rule_exec,
+                                         void *data,
+                                         ib_flags_t flags,
+                                         ib_field_t *field,
+                                         ib_num_t *result)
+{
+    *result = 1;
+    return IB_OK;
+}
+
+static ib_status_t dispatch_record_create(ib_engine_t *ib,
+                                          ib_context_t *ctx,
+                                          ib_mpool_t *pool,
+                                          const char *data,
+                                          ib_action_inst_t *act_inst,
+                                          void *cbdata)
+{
+    act_inst->data = ib_mpool_strdup(pool, data);
+    return (act_inst->data == NULL) ? IB_EALLOC : IB_OK;
+}
+
+static ib_status_t dispatch_record_execute(const ib_rule_exec_t *rule_exec,
+                                           void *data,
+                                           ib_flags_t flags,
+                                           void *cbdata)
+{
+    dispatch_fired.push_back((const char *)data);
+    return IB_OK;
+}
+
+class TestRuleEngineDispatch : public BaseFixture
+{
+public:
+    virtual void SetUp()
+    {
+        BaseFixture::SetUp();
+        dispatch_fields.clear();
+        dispatch_fired.clear();
+
+        ASSERT_EQ(IB_OK, ib_operator_register(ib_engine, "dispatch_true",
+                                              IB_OP_FLAG_PHASE,
+                                              NULL, NULL,
+                                              NULL, NULL,
+                                              dispatch_true_execute, NULL));
+        ASSERT_EQ(IB_OK, ib_action_register(ib_engine, "dispatch_record",
+                                            IB_ACT_FLAG_NONE,
+                                            dispatch_record_create, NULL,
+                                            NULL, NULL,
+                                            dispatch_record_execute, NULL));
+        ASSERT_EQ(IB_OK, ib_hook_tx_register(ib_engine, tx_started_event,
+                                             dispatch_tx_started, NULL));
+
+        configureIronBeeByString(
+            "LogLevel 4\n"
+            "LoadModule \"ibmod_htp.so\"\n"
+            "LoadModule \"ibmod_rules.so\"\n"
+            "Set parser \"htp\"\n"
+            "SensorId B9C1B52B-C24A-4309-B9F9-0EF4CD577A3E\n"
+            "SensorName UnitTesting\n"
+            "SensorHostname unit-testing.sensor.tld\n"
+            "AuditEngine Off\n"
+
+            // Main context rules only run where they are enabled.
+            "Rule fa @dispatch_true x id:main/1 phase:REQUEST_HEADER "
+            "dispatch_record:main_1\n"
+            "Rule fa @dispatch_true x id:main/2 phase:REQUEST_HEADER "
+            "dispatch_record:main_2\n"
+
+            "<Site site-a>\n"
+            "  SiteId AAAABBBB-1111-2222-3333-000000000001\n"
+            "  Hostname a.test\n"
+            "  RuleEnable id:main/1\n"
+            "  Rule fb @dispatch_true x id:a/1 phase:REQUEST_HEADER "
+            "dispatch_record:fb_1\n"
+            // Not indexed: no target, inverted, and ALLOW_NULL operator.
+            "  Action id:a/2 phase:REQUEST_HEADER dispatch_record:action_2\n"
+            "  Rule fa @dispatch_true x id:a/3 phase:REQUEST_HEADER "
+            "dispatch_record:fa_3\n"
+            "  Rule fmissing @dispatch_true x id:a/4 phase:REQUEST_HEADER "
+            "dispatch_record:missing_4\n"
+            "  Rule fmissing !@dispatch_true x id:a/5 phase:REQUEST_HEADER "
+            "dispatch_record:inverted_5\n"
+            "  Rule fmissing @nop x id:a/6 phase:REQUEST_HEADER "
+            "dispatch_record:nop_6\n"
+            // A field created by an action is seen by the rules after it.
+            "  Rule fnew @dispatch_true x id:a/7 phase:REQUEST_HEADER "
+            "dispatch_record:new_7\n"
+            "  Rule fb @dispatch_true x id:a/8 phase:REQUEST_HEADER "
+            "dispatch_record:setter_8 setvar:fnew=1\n"
+            "  Rule fnew @dispatch_true x id:a/9 phase:REQUEST_HEADER "
+            "dispatch_record:new_9\n"
+            "  Rule fc @dispatch_true x id:a/10 phase:REQUEST_HEADER "
+            "dispatch_record:fc_10\n"
+            "  Rule fa @dispatch_true x id:a/11 phase:REQUEST_HEADER "
+            "dispatch_record:disabled_11\n"
+            "  Rule fc fa @dispatch_true x id:a/12 phase:REQUEST_HEADER "
+            "dispatch_record:multi_12\n"
+            "  RuleDisable id:a/11\n"
+            "  <Location /disabled>\n"
+            "    RuleDisable id:a/3\n"
+            "  </Location>\n"
+            "  <Location /enabled>\n"
+            "    RuleEnable id:main/2\n"
+            "  </Location>\n"
+            "</Site>\n"
+
+            "<Site site-b>\n"
+            "  SiteId AAAABBBB-1111-2222-3333-000000000002\n"
+            "  Hostname b.test\n"
+            "  RuleEnable id:main/2\n"
+            "  Rule fa @dispatch_true x id:b/1 phase:REQUEST_HEADER "
+            "dispatch_record:b_1\n"
+            "</Site>\n");
+    }
+
+    // Labels of the rules fired by a request for @a host and @a path,
+    // with the top-level fields @a fields in the transaction data.
+    std::string fired(const std::string& host,
+                      const std::string& path,
+                      const std::vector<std::string>& fields)
+    {
+        std::string labels;
+
+        dispatch_fields = fields;
+        dispatch_fired.clear();
+
+        ib_conn_t *conn = buildIronBeeConnection();
+        sendDataIn(conn,
+                   "GET " + path + " HTTP/1.1\r\n"
+                   "Host: " + host + "\r\n"
+                   "\r\n");
+
+        for (size_t n = 0; n < dispatch_fired.size(); ++n) {
+            labels += (n == 0 ? "" : " ") + dispatch_fired[n];
+        }
+        return labels;
+    }
+
+    // Fields @a a, @a b (if given).
+    std::vector<std::string> fields(const char *a = NULL,
+                                    const char *b = NULL)
+    {
+        std::vector<std::string> v;
+
+        if (a != NULL) {
+            v.push_back(a);
+        }
+        if (b != NULL) {
+            v.push_back(b);
+        }
+        return v;
+    }
+};
+
+TEST_F(TestRuleEngineDispatch, test_order)
+{
+    // Indexed and non-indexed rules fire in configuration order.
+    EXPECT_EQ("main_1 fb_1 action_2 fa_3 inverted_5 nop_6 "
+              "setter_8 new_9 multi_12",
+              fired("a.test", "/", fields("fa", "fb")));
+    EXPECT_EQ("main_1 fb_1 action_2 fa_3 inverted_5 nop_6 "
+              "setter_8 new_9 multi_12",
+              fired("a.test", "/", fields("fb", "fa")));
+}
+
+TEST_F(TestRuleEngineDispatch, test_absent)
+{
+    // Only the rules that are not indexed fire.
+    EXPECT_EQ("action_2 inverted_5 nop_6",
+              fired("a.test", "/", fields()));
+
+    // Any one target field present is enough.
+    EXPECT_EQ("action_2 inverted_5 nop_6 fc_10 multi_12",
+              fired("a.test", "/", fields("fc")));
+}
+
+TEST_F(TestRuleEngineDispatch, test_created)
+{
+    // A field present from the start is seen by all rules.
+    EXPECT_EQ("main_1 action_2 fa_3 inverted_5 nop_6 new_7 new_9 multi_12",
+              fired("a.test", "/", fields("fa", "fnew")));
+
+    // A field created by an action is only seen by the rules after it.
+    EXPECT_EQ("fb_1 action_2 inverted_5 nop_6 setter_8 new_9",
+              fired("a.test", "/", fields("fb")));
+}
+
+TEST_F(TestRuleEngineDispatch, test_contexts)
+{
+    // Rules disabled in a location; site rules are inherited.
+    EXPECT_EQ("main_1 fb_1 action_2 inverted_5 nop_6 "
+              "setter_8 new_9 multi_12",
+              fired("a.test", "/disabled", fields("fa", "fb")));
+
+    // Main context rules enabled in a location run in main context order.
+    EXPECT_EQ("main_1 main_2 action_2 fa_3 inverted_5 nop_6 multi_12",
+              fired("a.test", "/enabled", fields("fa")));
+
+    // Another site only has its own rules and those it enables.
+    EXPECT_EQ("main_2 b_1", fired("b.test", "/", fields("fa")));
+    EXPECT_EQ("", fired("b.test", "/", fields("fb")));
+}
+
+TEST_F(TestRuleEngineDispatch, test_repeat)
+{
+    // The index holds no per-transaction state.
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ("action_2 inverted_5 nop_6 fc_10 multi_12",
+                  fired("a.test", "/", fields("fc")));
+        EXPECT_EQ("main_1 action_2 fa_3 inverted_5 nop_6 multi_12",
+                  fired("a.test", "/", fields("fa")));
+    }
+}
@@ -411,8 +411,68 @@ TEST_F(TestIBUtilAhoCorasick, ib_ac_consume_multiple_common_prefix)
     );
     ASSERT_EQ(IB_OK, rc);
 
+    /* expen, pen, expensive, sive, ve */
     ASSERT_TRUE(ac_mctx.match_list);
-    ASSERT_EQ(4UL, ib_list_elements(ac_mctx.match_list));
+    ASSERT_EQ(5UL, ib_list_elements(ac_mctx.match_list));
+}
+
+/// @test Check patterns reachable only through the fail chain
+TEST_F(TestIBUtilAhoCorasick, ib_ac_consume_fail_chain)
+{
+    ib_status_t rc;
+    const char *text = "xabcyzbcdz";
+    ib_ac_t *ac_tree = NULL;
+    ib_ac_context_t ac_mctx;
+    ib_ac_match_t *mt = NULL;
+
+    rc = ib_ac_create(&ac_tree, 0, m_pool);
+    ASSERT_EQ(IB_OK, rc);
+
+    /* "bc" ends inside "abcd", which is never completed */
+    rc = ib_ac_add_pattern(ac_tree, "abcd", callback, (void *)"abcd", 0);
+    ASSERT_EQ(IB_OK, rc);
+
+    rc = ib_ac_add_pattern(ac_tree, "bc", callback, (void *)"bc", 0);
+    ASSERT_EQ(IB_OK, rc);
+
+    /* "cdz" must be found after failing from "bcd" */
+    rc = ib_ac_add_pattern(ac_tree, "bcde", callback, (void *)"bcde", 0);
+    ASSERT_EQ(IB_OK, rc);
+
+    rc = ib_ac_add_pattern(ac_tree, "cdz", callback, (void *)"cdz", 0);
+    ASSERT_EQ(IB_OK, rc);
+
+    rc = ib_ac_build_links(ac_tree);
+    ASSERT_EQ(IB_OK, rc);
+    ib_ac_init_ctx(&ac_mctx, ac_tree);
+
+    rc = ib_ac_consume(
+        &ac_mctx,
+        text,
+        strlen(text),
+        IB_AC_FLAG_CONSUME_DOLIST | IB_AC_FLAG_CONSUME_MATCHALL,
+        m_pool
+    );
+    ASSERT_EQ(IB_OK, rc);
+
+    /* bc (offset 2), bc (offset 6), cdz (offset 7) */
+    ASSERT_TRUE(ac_mctx.match_list);
+    ASSERT_EQ(3UL, ib_list_elements(ac_mctx.match_list));
+
+    rc = ib_list_dequeue(ac_mctx.match_list, (void *)&mt);
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_EQ(0, strcmp("bc", (const char *)mt->data));
+    ASSERT_EQ(2UL, mt->offset);
+
+    rc = ib_list_dequeue(ac_mctx.match_list, (void *)&mt);
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_EQ(0, strcmp("bc", (const char *)mt->data));
+    ASSERT_EQ(6UL, mt->offset);
+
+    rc = ib_list_dequeue(ac_mctx.match_list, (void *)&mt);
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_EQ(0, strcmp("cdz", (const char *)mt->data));
+    ASSERT_EQ(7UL, mt->offset);
 }
 
 /// @test Check the list of matches
@@ -547,3 +607,83 @@ TEST_F(TestIBUtilAhoCorasick, ib_ac_consume_contained_patterns)
     ASSERT_TRUE(ac_mctx.match_list != NULL);
     ASSERT_EQ(9UL, ib_list_elements(ac_mctx.match_list));
 }
+
+/// @test Check the flat state table against a naive search
+TEST_F(TestIBUtilAhoCorasick, ib_ac_consume_table)
+{
+    ib_status_t rc;
+    ib_ac_t *ac_tree = NULL;
+    ib_ac_context_t ac_mctx;
+    char patterns[200][8];
+    char text[4096];
+    size_t expected = 0;
+    size_t i;
+    size_t j;
+
+    /* A small alphabet gives many overlapping patterns, and enough
+     * states to have both dense and sparse ones */
+    srand(42);
+    for (i = 0; i < 200; ++i) {
+        size_t len = 2 + rand() % 5;
+        for (j = 0; j < len; ++j) {
+            patterns[i][j] = "abcdEF\xf0"[rand() % 7];
+        }
+        patterns[i][len] = '\0';
+    }
+    for (i = 0; i < sizeof(text); ++i) {
+        text[i] = "abcdefABCDEF\xf0"[rand() % 13];
+    }
+
+    rc = ib_ac_create(&ac_tree, IB_AC_FLAG_PARSER_NOCASE, m_pool);
+    ASSERT_EQ(IB_OK, rc);
+
+    for (i = 0; i < 200; ++i) {
+        rc = ib_ac_add_pattern(ac_tree, patterns[i], callback,
+                               (void *)patterns[i], 0);
+        ASSERT_EQ(IB_OK, rc);
+    }
+
+    rc = ib_ac_build_links(ac_tree);
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_TRUE(ac_tree->table);
+    ASSERT_LT(static_cast<uint32_t>(IB_AC_TABLE_DENSE_MAX),
+              ac_tree->table->num_states);
+
+    /* Count the occurrences of the distinct patterns */
+    for (i = 0; i < 200; ++i) {
+        size_t len = strlen(patterns[i]);
+
+        for (j = 0; j < i; ++j) {
+            if (strcasecmp(patterns[i], patterns[j]) == 0) {
+                break;
+            }
+        }
+        if (j < i) {
+            continue;
+        }
+        for (j = 0; j + len <= sizeof(text); ++j) {
+            if (strncasecmp(text + j, patterns[i], len) == 0) {
+                ++expected;
+            }
+        }
+    }
+
+    /* Consume the text in chunks of different sizes */
+    ib_ac_init_ctx(&ac_mctx, ac_tree);
+    for (i = 0, j = 1; i < sizeof(text); i += j, j = j * 3 % 61) {
+        size_t len = (i + j > sizeof(text)) ? sizeof(text) - i : j;
+
+        rc = ib_ac_consume(
+            &ac_mctx,
+            text + i,
+            len,
+            IB_AC_FLAG_CONSUME_DOLIST | IB_AC_FLAG_CONSUME_MATCHALL,
+            m_pool
+        );
+        ASSERT_TRUE(rc == IB_OK || rc == IB_ENOENT);
+    }
+
+    ASSERT_TRUE(ac_mctx.match_list);
+    ASSERT_EQ(expected, ib_list_elements(ac_mctx.match_list));
+    ASSERT_EQ(expected, ac_mctx.match_cnt);
+}
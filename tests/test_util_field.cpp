@@ -531,3 +531,87 @@ TEST_F(TestIBUtilField, AliasBytestr)
     ASSERT_EQ(0, memcmp(s2,
                         ib_bytestr_const_ptr(obs), ib_bytestr_length(obs)) );
 }
+
+TEST_F(TestIBUtilField, CopyIsIndependent)
+{
+    char s[] = "hello";
+    std::string big(1000, 'x');
+    const char *nulout;
+    const ib_bytestr_t *obs;
+    ib_bytestr_t *mbs;
+    ib_bytestr_t *bs;
+    ib_field_t *f;
+    ib_field_t *g;
+    ib_field_t *h;
+    ib_status_t rc;
+
+    rc = ib_field_create(&f, MemPool(), IB_FIELD_NAME("f"),
+                         IB_FTYPE_NULSTR, ib_ftype_nulstr_in(s));
+    ASSERT_EQ(IB_OK, rc);
+    rc = ib_bytestr_dup_nulstr(&bs, MemPool(), s);
+    ASSERT_EQ(IB_OK, rc);
+    rc = ib_field_create(&g, MemPool(), IB_FIELD_NAME("g"),
+                         IB_FTYPE_BYTESTR, ib_ftype_bytestr_in(bs));
+    ASSERT_EQ(IB_OK, rc);
+    s[0] = 'j';
+    ib_bytestr_ptr(bs)[0] = 'j';
+
+    rc = ib_field_value(f, ib_ftype_nulstr_out(&nulout));
+    ASSERT_EQ(IB_OK, rc);
+    EXPECT_STREQ("hello", nulout);
+    rc = ib_field_value(g, ib_ftype_bytestr_out(&obs));
+    ASSERT_EQ(IB_OK, rc);
+    EXPECT_EQ("hello", std::string((const char *)ib_bytestr_const_ptr(obs),
+                                   ib_bytestr_length(obs)));
+
+    /* Copies may grow past the field allocation. */
+    rc = ib_field_mutable_value(g, ib_ftype_bytestr_mutable_out(&mbs));
+    ASSERT_EQ(IB_OK, rc);
+    rc = ib_bytestr_append_nulstr(mbs, " world");
+    ASSERT_EQ(IB_OK, rc);
+    rc = ib_field_value(g, ib_ftype_bytestr_out(&obs));
+    ASSERT_EQ(IB_OK, rc);
+    EXPECT_EQ("hello world",
+              std::string((const char *)ib_bytestr_const_ptr(obs),
+                          ib_bytestr_length(obs)));
+    EXPECT_EQ(1UL, g->nlen);
+    EXPECT_EQ('g', g->name[0]);
+
+    /* Large values are copied too. */
+    rc = ib_field_create(&h, MemPool(), IB_FIELD_NAME("h"),
+                         IB_FTYPE_NULSTR, ib_ftype_nulstr_in(big.c_str()));
+    ASSERT_EQ(IB_OK, rc);
+    rc = ib_field_value(h, ib_ftype_nulstr_out(&nulout));
+    ASSERT_EQ(IB_OK, rc);
+    EXPECT_EQ(big, nulout);
+    EXPECT_NE(big.c_str(), nulout);
+
+    rc = ib_field_from_string_ex(MemPool(), IB_FIELD_NAME("i"),
+                                 big.data(), big.size(), &h, NULL);
+    ASSERT_EQ(IB_OK, rc);
+    rc = ib_field_value_type(h, ib_ftype_bytestr_out(&obs), IB_FTYPE_BYTESTR);
+    ASSERT_EQ(IB_OK, rc);
+    EXPECT_EQ(big, std::string((const char *)ib_bytestr_const_ptr(obs),
+                               ib_bytestr_length(obs)));
+}
+
+TEST_F(TestIBUtilField, BytestrAliasIsReadOnly)
+{
+    uint8_t data[] = "abc";
+    const ib_bytestr_t *obs;
+    ib_field_t *f;
+    ib_status_t rc;
+
+    rc = ib_field_create_bytestr_alias(&f, MemPool(), IB_FIELD_NAME("foo"),
+                                       data, 3);
+    ASSERT_EQ(IB_OK, rc);
+    rc = ib_field_value(f, ib_ftype_bytestr_out(&obs));
+    ASSERT_EQ(IB_OK, rc);
+    EXPECT_EQ(data, ib_bytestr_const_ptr(obs));
+    EXPECT_EQ(3UL, ib_bytestr_length(obs));
+    EXPECT_TRUE(ib_bytestr_read_only(obs));
+
+    rc = ib_field_create_bytestr_alias(&f, MemPool(), IB_FIELD_NAME("foo"),
+                                       NULL, 0);
+    EXPECT_EQ(IB_EINVAL, rc);
+}
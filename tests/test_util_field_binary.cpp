@@ -0,0 +1,307 @@
+//////////////////////////////////////////////////////////////////////////////
+// Licensed to Qualys, Inc. (QUALYS) under one or more
+// contributor license agreements.  See the NOTICE file distributed with
+// this work for additional information regarding copyright ownership.
+// QUALYS licenses this file to You under the Apache License, Version 2.0
+// (the "License"); you may not use this file except in compliance with
+// the License.  You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//////////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief IronBee --- Binary Field Encoding Test Functions
+//////////////////////////////////////////////////////////////////////////////
+
+#include "ironbee_config_auto.h"
+
+#include <ironbee/field_binary.h>
+
+#include <ironbee/bytestr.h>
+#include <ironbee/field.h>
+#include <ironbee/list.h>
+
+#include "gtest/gtest.h"
+
+#include "simple_fixture.hpp"
+
+#include <string.h>
+
+class TestIBUtilFieldBinary : public SimpleFixture
+{
+public:
+    ib_list_t *NewList()
+    {
+        ib_list_t *list;
+        if (ib_list_create(&list, MemPool()) != IB_OK) {
+            throw std::runtime_error("Could not create list.");
+        }
+        return list;
+    }
+
+    void Add(ib_list_t *list, const char *name, ib_num_t num)
+    {
+        ib_field_t *f;
+        ASSERT_EQ(IB_OK, ib_field_create(&f, MemPool(), name, strlen(name),
+                                         IB_FTYPE_NUM, ib_ftype_num_in(&num)));
+        ASSERT_EQ(IB_OK, ib_list_push(list, f));
+    }
+
+    void Add(ib_list_t *list, const char *name, ib_float_t fnum)
+    {
+        ib_field_t *f;
+        ASSERT_EQ(IB_OK, ib_field_create(&f, MemPool(), name, strlen(name),
+                                         IB_FTYPE_FLOAT,
+                                         ib_ftype_float_in(&fnum)));
+        ASSERT_EQ(IB_OK, ib_list_push(list, f));
+    }
+
+    void Add(ib_list_t *list, const char *name, const char *str)
+    {
+        ib_field_t *f;
+        ASSERT_EQ(IB_OK, ib_field_create(&f, MemPool(), name, strlen(name),
+                                         IB_FTYPE_NULSTR,
+                                         ib_ftype_nulstr_in(str)));
+        ASSERT_EQ(IB_OK, ib_list_push(list, f));
+    }
+
+    void Add(ib_list_t *list, const char *name,
+             const uint8_t *data, size_t dlen)
+    {
+        ib_field_t *f;
+        ib_bytestr_t *bs;
+        ASSERT_EQ(IB_OK, ib_bytestr_dup_mem(&bs, MemPool(), data, dlen));
+        ASSERT_EQ(IB_OK, ib_field_create(&f, MemPool(), name, strlen(name),
+                                         IB_FTYPE_BYTESTR,
+                                         ib_ftype_bytestr_in(bs)));
+        ASSERT_EQ(IB_OK, ib_list_push(list, f));
+    }
+
+    void Add(ib_list_t *list, const char *name, ib_list_t *sublist)
+    {
+        ib_field_t *f;
+        ASSERT_EQ(IB_OK, ib_field_create(&f, MemPool(), name, strlen(name),
+                                         IB_FTYPE_LIST,
+                                         ib_ftype_list_in(sublist)));
+        ASSERT_EQ(IB_OK, ib_list_push(list, f));
+    }
+
+    const ib_field_t *Field(const ib_list_t *list, size_t n)
+    {
+        const ib_list_node_t *node = ib_list_first_const(list);
+        while (n-- > 0 && node != NULL) {
+            node = ib_list_node_next_const(node);
+        }
+        if (node == NULL) {
+            throw std::runtime_error("List too short.");
+        }
+        return (const ib_field_t *)ib_list_node_data_const(node);
+    }
+
+    void CheckName(const ib_field_t *f, const char *name)
+    {
+        ASSERT_EQ(strlen(name), f->nlen);
+        ASSERT_EQ(0, memcmp(name, f->name, f->nlen));
+    }
+
+    ib_status_t Decode(const uint8_t *buf, size_t len, bool alias,
+                       ib_list_t **list)
+    {
+        const char *error = NULL;
+        *list = NewList();
+        return ib_field_binary_decode(MemPool(), buf, len, alias,
+                                      *list, &error);
+    }
+};
+
+/// @test Round trip of every encoded field type.
+TEST_F(TestIBUtilFieldBinary, RoundTrip)
+{
+    static const uint8_t bytes[] = { 'a', 0, 0xff, '\n', 'z' };
+    ib_list_t *list = NewList();
+    ib_list_t *sublist = NewList();
+    uint8_t *buf;
+    size_t len;
+
+    Add(list, "zero", (ib_num_t)0);
+    Add(list, "neg", (ib_num_t)-1234567);
+    Add(list, "max", (ib_num_t)INT64_MAX);
+    Add(list, "min", (ib_num_t)INT64_MIN);
+    Add(list, "f", (ib_float_t)-2.5);
+    Add(list, "s", "hello");
+    Add(list, "empty", "");
+    Add(list, "b", bytes, sizeof(bytes));
+    Add(sublist, "inner", (ib_num_t)7);
+    Add(sublist, "innerstr", "value");
+    Add(list, "sub", sublist);
+
+    ASSERT_EQ(IB_OK, ib_field_binary_encode(MemPool(), list, &buf, &len));
+    ASSERT_TRUE(ib_field_binary_is_encoded(buf, len));
+
+    for (int alias = 0; alias <= 1; ++alias) {
+        ib_list_t *out;
+        const ib_field_t *f;
+        ib_num_t num;
+        ib_float_t fnum;
+        const char *str;
+        const ib_bytestr_t *bs;
+        const ib_list_t *l;
+
+        SCOPED_TRACE(alias ? "alias" : "copy");
+        ASSERT_EQ(IB_OK, Decode(buf, len, alias, &out));
+        ASSERT_EQ(9U, ib_list_elements(out));
+
+        static const ib_num_t nums[] = { 0, -1234567, INT64_MAX, INT64_MIN };
+        for (size_t i = 0; i < 4; ++i) {
+            f = Field(out, i);
+            ASSERT_EQ(IB_FTYPE_NUM, f->type);
+            ASSERT_EQ(IB_OK, ib_field_value(f, ib_ftype_num_out(&num)));
+            ASSERT_EQ(nums[i], num);
+        }
+        CheckName(Field(out, 1), "neg");
+
+        f = Field(out, 4);
+        ASSERT_EQ(IB_FTYPE_FLOAT, f->type);
+        ASSERT_EQ(IB_OK, ib_field_value(f, ib_ftype_float_out(&fnum)));
+        ASSERT_DOUBLE_EQ(-2.5, fnum);
+
+        f = Field(out, 5);
+        CheckName(f, "s");
+        ASSERT_EQ(IB_FTYPE_NULSTR, f->type);
+        ASSERT_EQ(IB_OK, ib_field_value(f, ib_ftype_nulstr_out(&str)));
+        ASSERT_STREQ("hello", str);
+        ASSERT_EQ(alias != 0,
+                  (const uint8_t *)str >= buf &&
+                  (const uint8_t *)str < buf + len);
+
+        f = Field(out, 6);
+        ASSERT_EQ(IB_OK, ib_field_value(f, ib_ftype_nulstr_out(&str)));
+        ASSERT_STREQ("", str);
+
+        f = Field(out, 7);
+        ASSERT_EQ(IB_FTYPE_BYTESTR, f->type);
+        ASSERT_EQ(IB_OK, ib_field_value(f, ib_ftype_bytestr_out(&bs)));
+        ASSERT_EQ(sizeof(bytes), ib_bytestr_length(bs));
+        ASSERT_EQ(0, memcmp(bytes, ib_bytestr_const_ptr(bs), sizeof(bytes)));
+        ASSERT_EQ(alias != 0,
+                  ib_bytestr_const_ptr(bs) >= buf &&
+                  ib_bytestr_const_ptr(bs) < buf + len);
+
+        f = Field(out, 8);
+        CheckName(f, "sub");
+        ASSERT_EQ(IB_FTYPE_LIST, f->type);
+        ASSERT_EQ(IB_OK, ib_field_value(f, ib_ftype_list_out(&l)));
+        ASSERT_EQ(2U, ib_list_elements(l));
+        CheckName(Field(l, 0), "inner");
+        ASSERT_EQ(IB_OK, ib_field_value(Field(l, 0), ib_ftype_num_out(&num)));
+        ASSERT_EQ(7, num);
+        ASSERT_EQ(IB_OK,
+                  ib_field_value(Field(l, 1), ib_ftype_nulstr_out(&str)));
+        ASSERT_STREQ("value", str);
+    }
+}
+
+/// @test Empty lists and unencoded field types.
+TEST_F(TestIBUtilFieldBinary, EmptyAndSkipped)
+{
+    ib_list_t *list = NewList();
+    ib_list_t *out;
+    ib_field_t *f;
+    uint8_t *buf;
+    size_t len;
+
+    ASSERT_EQ(IB_OK, ib_field_binary_encode(MemPool(), list, &buf, &len));
+    ASSERT_EQ(5U, len);
+    ASSERT_EQ(IB_OK, Decode(buf, len, true, &out));
+    ASSERT_EQ(0U, ib_list_elements(out));
+
+    ASSERT_EQ(IB_OK, ib_field_create(&f, MemPool(), "g", 1,
+                                     IB_FTYPE_GENERIC,
+                                     ib_ftype_generic_in(list)));
+    ASSERT_EQ(IB_OK, ib_list_push(list, f));
+    Add(list, "n", (ib_num_t)1);
+
+    ASSERT_EQ(IB_OK, ib_field_binary_encode(MemPool(), list, &buf, &len));
+    ASSERT_EQ(IB_OK, Decode(buf, len, true, &out));
+    ASSERT_EQ(1U, ib_list_elements(out));
+    CheckName(Field(out, 0), "n");
+}
+
+/// @test Malformed data is rejected without reading past the buffer.
+TEST_F(TestIBUtilFieldBinary, Malformed)
+{
+    ib_list_t *list = NewList();
+    ib_list_t *sublist = NewList();
+    ib_list_t *out;
+    uint8_t *buf;
+    uint8_t *copy;
+    size_t len;
+
+    Add(list, "num", (ib_num_t)300);
+    Add(list, "str", "some string");
+    Add(sublist, "f", (ib_float_t)1.0);
+    Add(list, "sub", sublist);
+    ASSERT_EQ(IB_OK, ib_field_binary_encode(MemPool(), list, &buf, &len));
+
+    // Every truncation fails; each copy is exactly sized so that a read
+    // past the end is caught by memory checkers.
+    for (size_t n = 0; n < len; ++n) {
+        copy = (uint8_t *)malloc(n + 1);
+        memcpy(copy, buf, n);
+        EXPECT_NE(IB_OK, Decode(copy, n, false, &out)) << "length " << n;
+        free(copy);
+    }
+
+    copy = (uint8_t *)MemPoolAlloc(len + 1);
+    memcpy(copy, buf, len);
+    copy[len] = 0;
+    EXPECT_EQ(IB_EINVAL, Decode(copy, len + 1, false, &out));
+
+    memcpy(copy, buf, len);
+    copy[0] = '{';
+    EXPECT_FALSE(ib_field_binary_is_encoded(copy, len));
+    EXPECT_EQ(IB_EINVAL, Decode(copy, len, false, &out));
+
+    memcpy(copy, buf, len);
+    copy[3] = IB_FIELD_BINARY_VERSION + 1;
+    EXPECT_EQ(IB_ENOTIMPL, Decode(copy, len, false, &out));
+
+    // Unknown field type.
+    memcpy(copy, buf, len);
+    copy[5] = 0x7f;
+    EXPECT_EQ(IB_EINVAL, Decode(copy, len, false, &out));
+}
+
+/// @test Deeply nested lists are rejected.
+TEST_F(TestIBUtilFieldBinary, Nesting)
+{
+    ib_list_t *list = NewList();
+    ib_list_t *out;
+    uint8_t *buf;
+    size_t len;
+
+    for (int i = 0; i < 40; ++i) {
+        ib_list_t *outer = NewList();
+        Add(outer, "l", list);
+        list = outer;
+    }
+    ASSERT_EQ(IB_EINVAL, ib_field_binary_encode(MemPool(), list, &buf, &len));
+
+    // Hand built: header and 40 nested single-element lists.
+    uint8_t data[4 + 40 * 4 + 1] = { 'I', 'B', 'F', IB_FIELD_BINARY_VERSION };
+    for (int i = 0; i < 40; ++i) {
+        data[4 + i * 4 + 0] = 1;
+        data[4 + i * 4 + 1] = IB_FTYPE_LIST;
+        data[4 + i * 4 + 2] = 1;
+        data[4 + i * 4 + 3] = 'l';
+    }
+    data[sizeof(data) - 1] = 0;
+    ASSERT_EQ(IB_EINVAL, Decode(data, sizeof(data), false, &out));
+}
@@ -0,0 +1,405 @@
+//////////////////////////////////////////////////////////////////////////////
+// Licensed to Qualys, Inc. (QUALYS) under one or more
+// contributor license agreements.  See the NOTICE file distributed with
+// this work for additional information regarding copyright ownership.
+// QUALYS licenses this file to You under the Apache License, Version 2.0
+// (the "License"); you may not use this file except in compliance with
+// the License.  You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//////////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief IronBee --- IP Trie tests
+//////////////////////////////////////////////////////////////////////////////
+
+#include "ironbee_config_auto.h"
+#include "gtest/gtest.h"
+
+#include <ironbee/iptrie.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdelete-non-virtual-dtor"
+#endif
+#include <boost/random.hpp>
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+using namespace std;
+
+class TestIPTrie : public ::testing::Test
+{
+protected:
+    ib_iptrie_builder_t *builder;
+    ib_iptrie_t *trie;
+    vector<string> files;
+
+    virtual void SetUp()
+    {
+        trie = NULL;
+        ASSERT_EQ(IB_OK, ib_iptrie_builder_create(&builder));
+    }
+
+    virtual void TearDown()
+    {
+        ib_iptrie_destroy(trie);
+        ib_iptrie_builder_destroy(builder);
+        for (size_t i = 0; i < files.size(); ++i) {
+            unlink(files[i].c_str());
+        }
+    }
+
+    /** Chose a random integer uniformly from [@a min, @a max]. */
+    uint32_t random(uint32_t min, uint32_t max)
+    {
+        static boost::random::mt19937 rng;
+        return boost::random::uniform_int_distribution<uint32_t>(min, max)(rng);
+    }
+
+    /** Temporary file name, removed at tear down. */
+    string tmpfile(const string& contents = "")
+    {
+        char name[] = "test_util_iptrie.XXXXXX";
+        int fd = mkstemp(name);
+        EXPECT_LE(0, fd);
+        close(fd);
+        files.push_back(name);
+        if (! contents.empty()) {
+            ofstream out(name);
+            out << contents;
+        }
+        return name;
+    }
+
+    /** Replace the contents of the file @a path with @a contents. */
+    void write_file(const string& path, const string& contents)
+    {
+        ofstream out(path.c_str(), ios::binary);
+        out << contents;
+    }
+
+    void add4(const char *s, uint32_t value)
+    {
+        ib_ip4_network_t net;
+        ASSERT_EQ(IB_OK, ib_ip4_str_to_net(s, &net));
+        ASSERT_EQ(IB_OK, ib_iptrie_builder_add4(builder, &net, value));
+    }
+
+    void add6(const char *s, uint32_t value)
+    {
+        ib_ip6_network_t net;
+        ASSERT_EQ(IB_OK, ib_ip6_str_to_net(s, &net));
+        ASSERT_EQ(IB_OK, ib_iptrie_builder_add6(builder, &net, value));
+    }
+
+    void finish()
+    {
+        ib_iptrie_destroy(trie);
+        trie = NULL;
+        ASSERT_EQ(IB_OK, ib_iptrie_builder_finish(builder, &trie));
+    }
+
+    /** Value of @a s in trie, or 0. */
+    uint32_t query4(const char *s)
+    {
+        ib_ip4_t ip;
+        uint32_t value = 0;
+        EXPECT_EQ(IB_OK, ib_ip4_str_to_ip(s, &ip));
+        ib_status_t rc = ib_iptrie_query4(trie, ip, &value);
+        EXPECT_TRUE(rc == IB_OK || rc == IB_ENOENT);
+        return rc == IB_OK ? value : 0;
+    }
+
+    /** Value of @a s in trie, or 0. */
+    uint32_t query6(const char *s)
+    {
+        ib_ip6_t ip;
+        uint32_t value = 0;
+        EXPECT_EQ(IB_OK, ib_ip6_str_to_ip(s, &ip));
+        ib_status_t rc = ib_iptrie_query6(trie, &ip, &value);
+        EXPECT_TRUE(rc == IB_OK || rc == IB_ENOENT);
+        return rc == IB_OK ? value : 0;
+    }
+};
+
+TEST_F(TestIPTrie, Empty)
+{
+    finish();
+    EXPECT_EQ(0U, query4("1.2.3.4"));
+    EXPECT_EQ(0U, query4("0.0.0.0"));
+    EXPECT_EQ(0U, query6("::1"));
+}
+
+TEST_F(TestIPTrie, Basic4)
+{
+    add4("10.0.0.0/8", 1);
+    add4("10.1.0.0/16", 2);
+    add4("10.1.2.0/24", 3);
+    add4("10.1.2.3/32", 4);
+    add4("192.168.0.0/17", 5);
+    finish();
+
+    EXPECT_EQ(1U, query4("10.200.0.1"));
+    EXPECT_EQ(2U, query4("10.1.200.1"));
+    EXPECT_EQ(3U, query4("10.1.2.4"));
+    EXPECT_EQ(4U, query4("10.1.2.3"));
+    EXPECT_EQ(5U, query4("192.168.127.255"));
+    EXPECT_EQ(0U, query4("192.168.128.0"));
+    EXPECT_EQ(0U, query4("11.0.0.0"));
+    EXPECT_EQ(0U, query6("::a01:203"));
+}
+
+TEST_F(TestIPTrie, DefaultAndReplace)
+{
+    add4("0.0.0.0/0", 7);
+    add4("1.0.0.0/8", 1);
+    add4("1.0.0.0/8", 9);
+    finish();
+
+    EXPECT_EQ(7U, query4("255.255.255.255"));
+    EXPECT_EQ(9U, query4("1.2.3.4"));
+}
+
+TEST_F(TestIPTrie, Basic6)
+{
+    add6("2001:db8::/32", 1);
+    add6("2001:db8:1::/48", 2);
+    add6("2001:db8:1::1/128", 3);
+    finish();
+
+    EXPECT_EQ(1U, query6("2001:db8:ffff::1"));
+    EXPECT_EQ(2U, query6("2001:db8:1::2"));
+    EXPECT_EQ(3U, query6("2001:db8:1::1"));
+    EXPECT_EQ(0U, query6("2001:db9::"));
+    EXPECT_EQ(0U, query4("32.1.13.184"));
+}
+
+TEST_F(TestIPTrie, Invalid)
+{
+    ib_ip4_network_t net4 = { 0, 33 };
+    ib_ip6_network_t net6 = { { { 0, 0, 0, 0 } }, 129 };
+
+    EXPECT_EQ(IB_EINVAL, ib_iptrie_builder_add4(builder, &net4, 1));
+    EXPECT_EQ(IB_EINVAL, ib_iptrie_builder_add6(builder, &net6, 1));
+    net4.size = 8;
+    EXPECT_EQ(IB_EINVAL, ib_iptrie_builder_add4(builder, &net4, 0));
+}
+
+// Compare with a linear search for the longest match.
+TEST_F(TestIPTrie, Random4)
+{
+    vector<ib_ip4_network_t> nets;
+    vector<uint32_t> values;
+
+    for (int i = 0; i < 3000; ++i) {
+        ib_ip4_network_t net;
+        net.size = random(0, 4) == 0 ? random(0, 32) : random(8, 28);
+        /* Cluster the networks so that they nest. */
+        net.ip = (random(0, 15) << 28) | random(0, 0xfffffff);
+        if (net.size < 32) {
+            net.ip &= ~(0xffffffffU >> net.size);
+        }
+        nets.push_back(net);
+        values.push_back(i + 1);
+        ASSERT_EQ(IB_OK, ib_iptrie_builder_add4(builder, &net, i + 1));
+    }
+    finish();
+
+    for (int i = 0; i < 30000; ++i) {
+        ib_ip4_t ip = (random(0, 15) << 28) | random(0, 0xfffffff);
+        if (i % 2 == 0) {
+            /* An address in or next to a network. */
+            const ib_ip4_network_t& net = nets[random(0, nets.size() - 1)];
+            ip = net.ip + random(0, 2) - 1;
+        }
+
+        uint32_t expected = 0;
+        int best = -1;
+        for (size_t k = 0; k < nets.size(); ++k) {
+            uint32_t mask =
+                nets[k].size == 0 ? 0 : 0xffffffffU << (32 - nets[k].size);
+            /* Later additions replace equal networks. */
+            if ((ip & mask) == nets[k].ip && nets[k].size >= best) {
+                best = nets[k].size;
+                expected = values[k];
+            }
+        }
+
+        uint32_t value = 0;
+        ib_status_t rc = ib_iptrie_query4(trie, ip, &value);
+        ASSERT_EQ(expected != 0 ? IB_OK : IB_ENOENT, rc) << hex << ip;
+        ASSERT_EQ(expected, value) << hex << ip;
+    }
+}
+
+TEST_F(TestIPTrie, Random6)
+{
+    vector<ib_ip6_network_t> nets;
+
+    for (int i = 0; i < 1000; ++i) {
+        ib_ip6_network_t net;
+        net.size = random(0, 128);
+        net.ip.ip[0] = 0x20010db8;
+        for (int w = 1; w < 4; ++w) {
+            net.ip.ip[w] = random(0, 3) << 30 | random(0, 0x3fffffff);
+        }
+        for (int b = net.size; b < 128; ++b) {
+            net.ip.ip[b / 32] &= ~(1U << (31 - b % 32));
+        }
+        nets.push_back(net);
+        ASSERT_EQ(IB_OK, ib_iptrie_builder_add6(builder, &net, i + 1));
+    }
+    finish();
+
+    for (int i = 0; i < 10000; ++i) {
+        ib_ip6_t ip = nets[random(0, nets.size() - 1)].ip;
+        ip.ip[3] ^= random(0, 3);
+        if (i % 3 == 0) {
+            ip.ip[random(0, 3)] ^= 1U << random(0, 31);
+        }
+
+        uint32_t expected = 0;
+        int best = -1;
+        for (size_t k = 0; k < nets.size(); ++k) {
+            bool match = true;
+            for (int b = 0; b < nets[k].size && match; ++b) {
+                uint32_t bit = 1U << (31 - b % 32);
+                match = (ip.ip[b / 32] & bit) == (nets[k].ip.ip[b / 32] & bit);
+            }
+            if (match && nets[k].size >= best) {
+                best = nets[k].size;
+                expected = k + 1;
+            }
+        }
+
+        uint32_t value = 0;
+        ib_status_t rc = ib_iptrie_query6(trie, &ip, &value);
+        ASSERT_EQ(expected != 0 ? IB_OK : IB_ENOENT, rc);
+        ASSERT_EQ(expected, value);
+    }
+}
+
+TEST_F(TestIPTrie, File)
+{
+    string path = tmpfile(
+        "# Reputation list\n"
+        "\n"
+        "10.0.0.0/8\n"
+        "  10.1.2.3   42  \n"
+        "2001:db8::/32 7\n"
+        "::1\n"
+    );
+    ASSERT_EQ(IB_OK, ib_iptrie_builder_add_file(builder, path.c_str(), NULL));
+    finish();
+
+    EXPECT_EQ(1U, query4("10.9.9.9"));
+    EXPECT_EQ(42U, query4("10.1.2.3"));
+    EXPECT_EQ(7U, query6("2001:db8::5"));
+    EXPECT_EQ(1U, query6("::1"));
+    EXPECT_EQ(0U, query6("::2"));
+}
+
+TEST_F(TestIPTrie, FileErrors)
+{
+    size_t line = 0;
+
+    EXPECT_EQ(IB_ENOENT, ib_iptrie_builder_add_file(
+        builder, "/nonexistent/iptrie.txt", &line));
+
+    string path = tmpfile("10.0.0.0/8\n1.2.3.4/33\n");
+    EXPECT_EQ(IB_EINVAL, ib_iptrie_builder_add_file(
+        builder, path.c_str(), &line));
+    EXPECT_EQ(2U, line);
+
+    path = tmpfile("10.0.0.0/8 0\n");
+    EXPECT_EQ(IB_EINVAL, ib_iptrie_builder_add_file(
+        builder, path.c_str(), &line));
+    EXPECT_EQ(1U, line);
+
+    path = tmpfile("# ok\n10.0.0.0/8 1 2\n");
+    EXPECT_EQ(IB_EINVAL, ib_iptrie_builder_add_file(
+        builder, path.c_str(), &line));
+    EXPECT_EQ(2U, line);
+}
+
+TEST_F(TestIPTrie, Image)
+{
+    add4("10.0.0.0/8", 1);
+    add4("10.1.2.3/32", 2);
+    add6("2001:db8::/32", 3);
+    finish();
+
+    string path = tmpfile();
+    ASSERT_EQ(IB_OK, ib_iptrie_write(trie, path.c_str()));
+    EXPECT_TRUE(ib_iptrie_is_image(path.c_str()));
+
+    size_t size = ib_iptrie_size(trie);
+    ib_iptrie_destroy(trie);
+    trie = NULL;
+
+    ASSERT_EQ(IB_OK, ib_iptrie_load(&trie, path.c_str()));
+    EXPECT_EQ(size, ib_iptrie_size(trie));
+    EXPECT_EQ(1U, query4("10.200.0.1"));
+    EXPECT_EQ(2U, query4("10.1.2.3"));
+    EXPECT_EQ(3U, query6("2001:db8::1"));
+    EXPECT_EQ(0U, query4("11.0.0.0"));
+}
+
+TEST_F(TestIPTrie, ImageErrors)
+{
+    ib_iptrie_t *loaded = NULL;
+
+    EXPECT_EQ(IB_ENOENT, ib_iptrie_load(&loaded, "/nonexistent/iptrie"));
+
+    string list = tmpfile("10.0.0.0/8\n");
+    EXPECT_FALSE(ib_iptrie_is_image(list.c_str()));
+    EXPECT_EQ(IB_EINVAL, ib_iptrie_load(&loaded, list.c_str()));
+
+    add4("10.1.2.3/32", 2);
+    finish();
+    string path = tmpfile();
+    ASSERT_EQ(IB_OK, ib_iptrie_write(trie, path.c_str()));
+
+    string image;
+    {
+        ifstream in(path.c_str(), ios::binary);
+        image.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+
+    /* Truncated. */
+    write_file(path, image.substr(0, image.size() - 8));
+    EXPECT_EQ(IB_EINVAL, ib_iptrie_load(&loaded, path.c_str()));
+
+    /* Child out of bounds: base1 of the IPv4 root. */
+    string corrupt = image;
+    corrupt[32 + 20] = '\x7f';
+    write_file(path, corrupt);
+    EXPECT_EQ(IB_EINVAL, ib_iptrie_load(&loaded, path.c_str()));
+
+    /* Leaf run missing: leafvec of the IPv4 root. */
+    corrupt = image;
+    corrupt.replace(32 + 8, 8, 8, '\0');
+    write_file(path, corrupt);
+    EXPECT_EQ(IB_EINVAL, ib_iptrie_load(&loaded, path.c_str()));
+
+    /* Intact. */
+    write_file(path, image);
+    ASSERT_EQ(IB_OK, ib_iptrie_load(&loaded, path.c_str()));
+    ib_iptrie_destroy(loaded);
+}
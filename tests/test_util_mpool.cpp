@@ -31,6 +31,7 @@
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdelete-non-virtual-dtor"
 #endif
+#include <boost/lexical_cast.hpp>
 #include <boost/random.hpp>
 #include <boost/thread.hpp>
 #ifdef __clang__
@@ -605,6 +606,54 @@ TEST(TestMpool, Multithreading)
     ib_mpool_destroy(mp);
 }
 
+namespace {
+
+void create_release_children(ib_mpool_t* parent, size_t num_children)
+{
+    ib_mpool_t* mp;
+
+    for (size_t i = 0; i < num_children; ++i) {
+        ib_mpool_create(&mp, NULL, parent);
+        ib_mpool_alloc(mp, 100);
+        ib_mpool_release(mp);
+    }
+}
+
+}
+
+// Children of one parent created and released by several threads land
+// on different child lists; the parent must stay consistent and release
+// all of them.  See bench_util_mpool for timings.
+TEST(TestMpool, MultithreadingChildren)
+{
+    static const size_t num_threads = 8;
+    static const size_t num_children = 1000;
+
+    ib_mpool_t* mp = NULL;
+    ib_status_t rc = ib_mpool_create(&mp, NULL, NULL);
+
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_TRUE(mp);
+
+    boost::thread_group threads;
+    for (size_t i = 0; i < num_threads; ++i) {
+        threads.create_thread(boost::bind(
+            create_release_children, mp, num_children
+        ));
+    }
+    threads.join_all();
+
+    EXPECT_VALID(mp);
+
+    // Children are recycled, not freed; the parent keeps working.
+    ib_mpool_t* child = NULL;
+    ASSERT_EQ(IB_OK, ib_mpool_create(&child, "child", mp));
+    EXPECT_TRUE(ib_mpool_alloc(child, 100));
+    EXPECT_VALID(mp);
+
+    ib_mpool_destroy(mp);
+}
+
 TEST(TestMpool, ZeroLength)
 {
     ib_mpool_t* mp = NULL;
@@ -839,3 +888,70 @@ TEST(TestMpool, ReleaseComplex)
     ASSERT_EQ(g_malloc_calls, g_free_calls);
     ASSERT_EQ(g_malloc_bytes, g_free_bytes);
 }
+
+TEST(TestMpool, PageCache)
+{
+    reset_test();
+
+    ib_mpool_t* mp = NULL;
+    ib_mpool_t* child = NULL;
+    ib_status_t rc =
+        ib_mpool_create_ex(&mp, "page_cache", NULL, 0,
+            &test_malloc, &test_free);
+
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_TRUE(mp);
+
+    EXPECT_EQ(IB_EINVAL, ib_mpool_enable_page_cache(NULL, 4));
+    EXPECT_EQ(IB_EINVAL, ib_mpool_enable_page_cache(mp, 0));
+    ASSERT_EQ(IB_OK, ib_mpool_enable_page_cache(mp, 4));
+    EXPECT_EQ(IB_EINVAL, ib_mpool_enable_page_cache(mp, 4));
+
+    // No lookups yet: the hit rate is 0, not NaN.
+    char* report = ib_mpool_analyze(mp);
+    ASSERT_TRUE(report);
+    EXPECT_TRUE(strstr(report, "hits=0 misses=0 ") != NULL) << report;
+    EXPECT_TRUE(strstr(report, "hitrate= 0.0%") != NULL) << report;
+    free(report);
+
+    // Two pages, one for each track.
+    rc = ib_mpool_create(&child, NULL, mp);
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_TRUE(ib_mpool_alloc(child, 10));
+    ASSERT_TRUE(ib_mpool_alloc(child, 1000));
+    EXPECT_VALID(mp);
+    ib_mpool_destroy(child);
+    EXPECT_VALID(mp);
+
+    // Pages come from the cache: only the pool itself is malloced.
+    size_t saved_malloc_calls = g_malloc_calls;
+    size_t saved_free_calls   = g_free_calls;
+    rc = ib_mpool_create(&child, NULL, mp);
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_TRUE(ib_mpool_alloc(child, 10));
+    ASSERT_TRUE(ib_mpool_alloc(child, 1000));
+    EXPECT_EQ(saved_malloc_calls + 1, g_malloc_calls);
+    ib_mpool_destroy(child);
+    EXPECT_EQ(saved_free_calls + 1, g_free_calls);
+
+    // Of six pages, the cache takes four; the released pool keeps the rest.
+    rc = ib_mpool_create(&child, NULL, mp);
+    ASSERT_EQ(IB_OK, rc);
+    for (size_t i = 0; i < 24; ++i) {
+        ASSERT_TRUE(ib_mpool_alloc(child, 1000));
+    }
+    ib_mpool_release(child);
+    EXPECT_VALID(mp);
+
+    report = ib_mpool_analyze(mp);
+    ASSERT_TRUE(report);
+    EXPECT_TRUE(strstr(report, "PageCache:") != NULL) << report;
+    EXPECT_TRUE(strstr(report, "hits=4 misses=6 ") != NULL) << report;
+    EXPECT_TRUE(strstr(report, "overflows=1 ") != NULL) << report;
+    free(report);
+
+    ib_mpool_destroy(mp);
+
+    ASSERT_EQ(g_malloc_calls, g_free_calls);
+    ASSERT_EQ(g_malloc_bytes, g_free_bytes);
+}
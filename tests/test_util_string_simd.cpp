@@ -0,0 +1,228 @@
+//////////////////////////////////////////////////////////////////////////////
+// Licensed to Qualys, Inc. (QUALYS) under one or more
+// contributor license agreements.  See the NOTICE file distributed with
+// this work for additional information regarding copyright ownership.
+// QUALYS licenses this file to You under the Apache License, Version 2.0
+// (the "License"); you may not use this file except in compliance with
+// the License.  You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//////////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief IronBee --- Vectorized String Kernel Tests
+///
+/// Every kernel implementation supported by the CPU is checked against a
+/// simple reference implementation, and the string functions built on
+/// them are checked against the plain C kernels.
+//////////////////////////////////////////////////////////////////////////////
+
+#include "ironbee_config_auto.h"
+
+#include <ironbee/decode.h>
+#include <ironbee/mpool.h>
+#include <ironbee/string.h>
+
+#include "util/string_simd_private.h"
+
+#include "gtest/gtest.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+const size_t MaxLen = 200;
+
+// Alphabet biased towards the characters the kernels look for
+const char Alphabet[] = "aZ AzM\t\n\v\f\r%+09%41+x";
+
+std::string random_string(size_t len)
+{
+    std::string s;
+    for (size_t i = 0; i < len; ++i) {
+        s += Alphabet[rand() % (sizeof(Alphabet) - 1)];
+    }
+    return s;
+}
+
+size_t ref_find(const std::string &s, bool (*pred)(uint8_t))
+{
+    size_t i;
+    for (i = 0; i < s.size(); ++i) {
+        if (pred(s[i])) {
+            break;
+        }
+    }
+    return i;
+}
+
+bool is_upper(uint8_t c)    { return isupper(c) != 0; }
+bool is_space(uint8_t c)    { return isspace(c) != 0; }
+bool is_nonspace(uint8_t c) { return isspace(c) == 0; }
+bool is_pct_plus(uint8_t c) { return c == '%' || c == '+'; }
+
+const uint8_t *bytes(const std::string &s)
+{
+    return reinterpret_cast<const uint8_t *>(s.data());
+}
+
+std::string format_result(const uint8_t *out, size_t olen, ib_flags_t result)
+{
+    std::ostringstream os;
+    os << std::string(reinterpret_cast<const char *>(out), olen)
+       << "/" << result;
+    return os.str();
+}
+
+std::string run_strmod(ib_mpool_t *mp,
+                       ib_strmod_ex_fn_t fn,
+                       ib_strop_t op,
+                       const std::string &s)
+{
+    std::vector<uint8_t> in(s.begin(), s.end());
+    in.push_back('\0');
+    uint8_t *out;
+    size_t olen;
+    ib_flags_t result;
+
+    EXPECT_EQ(IB_OK, fn(op, mp, &in[0], s.size(), &out, &olen, &result));
+    return format_result(out, olen, result);
+}
+
+std::string run_url_decode(const std::string &s)
+{
+    std::vector<uint8_t> in(s.begin(), s.end());
+    in.push_back('\0');
+    size_t olen;
+    ib_flags_t result;
+
+    EXPECT_EQ(IB_OK, ib_util_decode_url_ex(&in[0], s.size(), &olen, &result));
+    return format_result(&in[0], olen, result);
+}
+
+std::string run_url_decode_cow(ib_mpool_t *mp, const std::string &s)
+{
+    uint8_t *out;
+    size_t olen;
+    ib_flags_t result;
+
+    EXPECT_EQ(IB_OK, ib_util_decode_url_cow_ex(mp, bytes(s), s.size(), false,
+                                               &out, &olen, &result));
+    return format_result(out, olen, result);
+}
+
+class TestStringSimd : public ::testing::TestWithParam<ib_simd_level_t>
+{
+public:
+    void SetUp()
+    {
+        ASSERT_EQ(IB_OK, ib_mpool_create(&m_mp, "test", NULL));
+        m_supported = (ib_simd_set_level(GetParam()) == GetParam());
+    }
+
+    void TearDown()
+    {
+        ib_simd_set_level(IB_SIMD_AVX2);
+        ib_mpool_destroy(m_mp);
+    }
+
+protected:
+    ib_mpool_t *m_mp;
+    bool        m_supported;
+};
+
+}
+
+TEST_P(TestStringSimd, Kernels)
+{
+    if (! m_supported) {
+        return;
+    }
+    srand(1);
+    for (size_t len = 0; len < MaxLen; ++len) {
+        for (int n = 0; n < 8; ++n) {
+            std::string s = random_string(len);
+            const uint8_t *data = bytes(s);
+
+            ASSERT_EQ(ref_find(s, is_upper), ib_simd_find_upper(data, len));
+            ASSERT_EQ(ref_find(s, is_space), ib_simd_find_space(data, len));
+            ASSERT_EQ(ref_find(s, is_nonspace),
+                      ib_simd_find_nonspace(data, len));
+            ASSERT_EQ(ref_find(s, is_pct_plus),
+                      ib_simd_find_byte2(data, len, '%', '+'));
+
+            size_t end = len;
+            while (end > 0 && isspace(s[end - 1])) {
+                --end;
+            }
+            ASSERT_EQ(end, ib_simd_rfind_nonspace(data, len));
+
+            std::string lower = s;
+            std::string ref = s;
+            for (size_t i = 0; i < len; ++i) {
+                ref[i] = tolower(ref[i]);
+            }
+            ASSERT_EQ(ref != s,
+                      ib_simd_lower(reinterpret_cast<uint8_t *>(&lower[0]),
+                                    len));
+            ASSERT_EQ(ref, lower);
+        }
+    }
+}
+
+TEST_P(TestStringSimd, StringFunctions)
+{
+    static const ib_strmod_ex_fn_t fns[] = {
+        ib_strlower_ex,
+        ib_strtrim_left_ex,
+        ib_strtrim_right_ex,
+        ib_strtrim_lr_ex,
+        ib_str_wspc_remove_ex,
+        ib_str_wspc_compress_ex
+    };
+    static const ib_strop_t ops[] = {
+        IB_STROP_INPLACE,
+        IB_STROP_COPY,
+        IB_STROP_COW
+    };
+
+    if (! m_supported) {
+        return;
+    }
+    srand(2);
+    for (size_t len = 0; len < MaxLen; ++len) {
+        std::string s = random_string(len);
+        std::vector<std::string> expected;
+        std::vector<std::string> actual;
+
+        for (int pass = 0; pass < 2; ++pass) {
+            std::vector<std::string> &r = (pass == 0) ? expected : actual;
+
+            ib_simd_set_level(pass == 0 ? IB_SIMD_NONE : GetParam());
+            for (size_t f = 0; f < sizeof(fns) / sizeof(fns[0]); ++f) {
+                for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); ++o) {
+                    r.push_back(run_strmod(m_mp, fns[f], ops[o], s));
+                }
+            }
+            r.push_back(run_url_decode(s));
+            r.push_back(run_url_decode_cow(m_mp, s));
+        }
+        ASSERT_EQ(expected, actual) << "input \"" << s << "\"";
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(Levels, TestStringSimd,
+                        ::testing::Values(IB_SIMD_NONE,
+                                          IB_SIMD_SSE2,
+                                          IB_SIMD_AVX2));
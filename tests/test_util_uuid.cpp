@@ -29,7 +29,13 @@
 #include "gtest/gtest.h"
 #include "gtest/gtest-spi.h"
 
+#include <set>
+#include <string>
+
+#include <pthread.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 namespace OSSPUUID {
 #include <uuid.h>
@@ -124,3 +130,121 @@ TEST(TestIBUtilUUID, random)
     free(str);
     ib_uuid_shutdown();
 }
+
+/// @test ib_uuid_bin_to_ascii() formats known UUIDs.
+TEST(TestIBUtilUUID, format)
+{
+    char str[UUID_LEN_STR+1];
+
+    ib_uuid_initialize();
+
+    for (struct testval *rec = &uuidstr[0]; rec->str != NULL; ++rec) {
+        if (rec->ret != IB_OK) {
+            continue;
+        }
+        ASSERT_EQ(IB_OK, ib_uuid_bin_to_ascii(str, &rec->val));
+        EXPECT_STREQ(rec->str, str);
+    }
+
+    ib_uuid_shutdown();
+}
+
+/// @test ib_uuid_create_v4() makes version 4, RFC 4122 variant UUIDs.
+TEST(TestIBUtilUUID, version)
+{
+    ib_uuid_t uuid;
+    char str[UUID_LEN_STR+1];
+
+    ib_uuid_initialize();
+
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(IB_OK, ib_uuid_create_v4(&uuid));
+        EXPECT_EQ(0x40, uuid.byte[6] & 0xf0);
+        EXPECT_EQ(0x80, uuid.byte[8] & 0xc0);
+
+        ASSERT_EQ(IB_OK, ib_uuid_bin_to_ascii(str, &uuid));
+        EXPECT_EQ('4', str[14]);
+        EXPECT_TRUE(strchr("89ab", str[19]) != NULL);
+    }
+
+    ib_uuid_shutdown();
+}
+
+namespace {
+
+const int c_per_thread = 1000;
+
+extern "C" void *make_uuids(void *arg)
+{
+    std::set<std::string> *ids = static_cast<std::set<std::string> *>(arg);
+    ib_uuid_t uuid;
+    char str[UUID_LEN_STR+1];
+
+    for (int i = 0; i < c_per_thread; ++i) {
+        if (ib_uuid_create_v4(&uuid) != IB_OK) {
+            break;
+        }
+        ib_uuid_bin_to_ascii(str, &uuid);
+        ids->insert(str);
+    }
+
+    return NULL;
+}
+
+}
+
+/// @test Threads make distinct UUIDs.
+TEST(TestIBUtilUUID, threads)
+{
+    const int num_threads = 8;
+    pthread_t threads[num_threads];
+    std::set<std::string> ids[num_threads];
+    std::set<std::string> all;
+
+    ib_uuid_initialize();
+
+    for (int i = 0; i < num_threads; ++i) {
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, make_uuids, &ids[i]));
+    }
+    for (int i = 0; i < num_threads; ++i) {
+        pthread_join(threads[i], NULL);
+        EXPECT_EQ(size_t(c_per_thread), ids[i].size());
+        all.insert(ids[i].begin(), ids[i].end());
+    }
+    EXPECT_EQ(size_t(num_threads * c_per_thread), all.size());
+
+    ib_uuid_shutdown();
+}
+
+/// @test A child process does not repeat its parent's UUIDs.
+TEST(TestIBUtilUUID, fork)
+{
+    ib_uuid_t uuid;
+    ib_uuid_t parent;
+    ib_uuid_t child;
+    int fds[2];
+    pid_t pid;
+    int status;
+
+    ib_uuid_initialize();
+
+    /* Seed this thread's generator before forking. */
+    ASSERT_EQ(IB_OK, ib_uuid_create_v4(&uuid));
+    ASSERT_EQ(0, pipe(fds));
+
+    pid = ::fork();
+    ASSERT_NE(-1, pid);
+    if (pid == 0) {
+        ib_uuid_create_v4(&child);
+        _exit(write(fds[1], &child, sizeof(child)) == sizeof(child) ? 0 : 1);
+    }
+    ASSERT_EQ(IB_OK, ib_uuid_create_v4(&parent));
+    ASSERT_EQ(ssize_t(sizeof(child)), read(fds[0], &child, sizeof(child)));
+    waitpid(pid, &status, 0);
+    close(fds[0]);
+    close(fds[1]);
+
+    EXPECT_NE(0, memcmp(&parent, &child, sizeof(parent)));
+
+    ib_uuid_shutdown();
+}
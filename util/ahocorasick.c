@@ -267,65 +267,6 @@ static void ib_ac_link_outputs(ib_ac_t *ac_tree,
     return;
 }
 
-/**
- * Remove unuseful failure links to skip using an invalid transition
- *
- * @param ac_tree the matcher that holds the patterns
- * @param state the state where it should start (it's used recursively)
- *
- */
-static void ib_ac_unlink_unuseful(ib_ac_t *ac_tree,
-                               ib_ac_state_t *state)
-{
-    ib_ac_state_t *child = NULL;
-    ib_ac_state_t *fail_state = NULL;
-    ib_ac_state_t *found = NULL;
-
-    for (child = state->child;
-         child != NULL;
-         child = child->sibling)
-    {
-        if (child->fail == NULL ||
-            child->fail->child == NULL ||
-            child->child == NULL)
-        {
-            continue;
-        }
-
-        for (fail_state = child->fail->child;
-             fail_state != ac_tree->root && fail_state != NULL;
-             fail_state = fail_state->sibling)
-        {
-            found = ib_ac_child_for_code(child, fail_state->letter);
-            if (found == NULL) {
-                break;
-            }
-        }
-
-        if (found != NULL) {
-            /* There's no transition in the fail state that will
-             * success, since the fail state doesn't have any letter not
-             * present at the goto() of the main state. So let's
-             * change the fail state to parent. Consider that this is
-             * different to the output links (they'll still valid) */
-             child->fail = ac_tree->root;
-
-             /* printf("Removing invalid fails\n"); */
-        }
-    }
-
-    for (child = state->child;
-         child != NULL;
-         child = child->sibling)
-    {
-        if (child->child != NULL) {
-            ib_ac_unlink_unuseful(ac_tree, child);
-        }
-    }
-
-    return;
-}
-
 /**
  * Add items to the bintree for fast goto() transitions. Recursive calls
  *
@@ -483,6 +424,7 @@ static ib_status_t ib_ac_link_fail_states(ib_ac_t *ac_tree)
     ib_ac_state_t *child = NULL;
     ib_ac_state_t *state = NULL;
     ib_ac_state_t *goto_state = NULL;
+    ib_ac_state_t *fail_state = NULL;
 
     ib_list_t *iter_queue = NULL;
 
@@ -519,11 +461,22 @@ static ib_status_t ib_ac_link_fail_states(ib_ac_t *ac_tree)
 
         state->fail = ac_tree->root;
 
+        /* Follow the fail chain of the parent until a state with a
+         * transition for this letter is found (or root is reached) */
         if (state->parent != ac_tree->root) {
-            goto_state = ib_ac_child_for_code(state->parent->fail,
-                                             state->letter);
-            if (goto_state != NULL) {
-                state->fail = goto_state;
+            for (fail_state = state->parent->fail;
+                 fail_state != NULL;
+                 fail_state = fail_state->fail)
+            {
+                goto_state = ib_ac_child_for_code(fail_state,
+                                                  state->letter);
+                if (goto_state != NULL) {
+                    state->fail = goto_state;
+                    break;
+                }
+                if (fail_state == ac_tree->root) {
+                    break;
+                }
             }
         }
 
@@ -541,10 +494,6 @@ static ib_status_t ib_ac_link_fail_states(ib_ac_t *ac_tree)
     /* Link common outputs of subpatterns present in the branch*/
     ib_ac_link_outputs(ac_tree, ac_tree->root);
 
-    /* Unlink invalid fail transitions. This guarantees that there will
-     * be at least one letter with transition in each fail state*/
-    ib_ac_unlink_unuseful(ac_tree, ac_tree->root);
-
     if (ac_tree->root->child != NULL) {
         ib_ac_build_bintree(ac_tree, ac_tree->root);
     }
@@ -554,6 +503,229 @@ static ib_status_t ib_ac_link_fail_states(ib_ac_t *ac_tree)
     return IB_OK;
 }
 
+/**
+ * Counts the states, transitions and outputs of the trie. Recursive calls
+ *
+ * @param state the state where it should start
+ * @param num_states incremented by the number of states
+ * @param num_trans incremented by the number of goto() transitions
+ * @param num_outputs incremented by the number of (state, output) pairs
+ */
+static void ib_ac_count_states(const ib_ac_state_t *state,
+                               uint32_t *num_states,
+                               uint32_t *num_trans,
+                               uint32_t *num_outputs)
+{
+    const ib_ac_state_t *child = NULL;
+    const ib_ac_state_t *outs = NULL;
+
+    ++(*num_states);
+
+    if (state->flags & IB_AC_FLAG_STATE_OUTPUT) {
+        ++(*num_outputs);
+    }
+    for (outs = state->outputs; outs != NULL; outs = outs->outputs) {
+        ++(*num_outputs);
+    }
+
+    for (child = state->child; child != NULL; child = child->sibling) {
+        ++(*num_trans);
+        ib_ac_count_states(child, num_states, num_trans, num_outputs);
+    }
+
+    return;
+}
+
+/**
+ * Resolves the transition of a state of the flat state table
+ *
+ * @param table the flat state table
+ * @param state the current state
+ * @param letter the input letter
+ *
+ * @return the next state, with IB_AC_TABLE_OUTPUT set if it has outputs
+ */
+static inline uint32_t ib_ac_table_goto(const ib_ac_table_t *table,
+                                        uint32_t state,
+                                        uint8_t letter)
+{
+    for (;;) {
+        const uint32_t *header = table->code + state;
+        const uint32_t info = header[1];
+        const uint8_t *letters = NULL;
+        uint32_t i;
+
+        if (info & IB_AC_TABLE_DENSE) {
+            return table->dense[(size_t)(info & ~IB_AC_TABLE_DENSE) * 256 +
+                                letter];
+        }
+
+        /* Sorted letters; most states have only a few transitions */
+        letters = (const uint8_t *)(header + IB_AC_TABLE_HEADER);
+        for (i = 0; i < info && letters[i] < letter; ++i) {
+            /* nothing */
+        }
+        if (i < info && letters[i] == letter) {
+            return header[IB_AC_TABLE_HEADER + (info + 3) / 4 + i];
+        }
+
+        state = header[0];
+    }
+}
+
+/**
+ * Freezes the trie into a flat state table (see ib_ac_table_t). Fail
+ * links and output links must be built already
+ *
+ * @param ac_tree the ac tree matcher
+ *
+ * @return ib_status_t status of the operation
+ */
+static ib_status_t ib_ac_build_table(ib_ac_t *ac_tree)
+{
+    ib_ac_table_t *table = NULL;
+    ib_ac_state_t *state = NULL;
+    ib_ac_state_t *child = NULL;
+    ib_ac_state_t *outs = NULL;
+
+    uint8_t letters[256];
+    uint32_t targets[256];
+
+    uint32_t num_states = 0;
+    uint32_t num_trans = 0;
+    uint32_t num_outputs = 0;
+    uint32_t num_dense = 0;
+    uint32_t num_words = 0;
+    uint32_t outputs = 0;
+    uint32_t head = 0;
+    uint32_t tail = 0;
+    uint32_t ntrans = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    unsigned int c = 0;
+
+    ib_ac_count_states(ac_tree->root, &num_states, &num_trans, &num_outputs);
+    num_dense = (num_states < IB_AC_TABLE_DENSE_MAX) ?
+                num_states : IB_AC_TABLE_DENSE_MAX;
+
+    table = (ib_ac_table_t *)ib_mpool_calloc(ac_tree->mp, 1,
+                                             sizeof(ib_ac_table_t));
+    if (table == NULL) {
+        return IB_EALLOC;
+    }
+
+    table->num_states = num_states;
+    table->nodes = (ib_ac_state_t **)ib_mpool_calloc(ac_tree->mp,
+                                 num_states, sizeof(ib_ac_state_t *));
+    table->state_outputs = (ib_ac_table_outputs_t *)ib_mpool_calloc(
+                                 ac_tree->mp,
+                                 num_states, sizeof(ib_ac_table_outputs_t));
+    table->dense = (uint32_t *)ib_mpool_calloc(ac_tree->mp,
+                                 (size_t)num_dense * 256, sizeof(uint32_t));
+    table->outputs = (ib_ac_state_t **)ib_mpool_calloc(ac_tree->mp,
+                                 num_outputs + 1, sizeof(ib_ac_state_t *));
+    if (table->nodes == NULL || table->state_outputs == NULL ||
+        table->dense == NULL || table->outputs == NULL)
+    {
+        return IB_EALLOC;
+    }
+
+    /* Order the states breadth first, using the node array as the
+     * queue, and assign the offsets of the states */
+    table->nodes[tail++] = ac_tree->root;
+    while (head < tail) {
+        state = table->nodes[head];
+
+        ntrans = 0;
+        for (child = state->child; child != NULL; child = child->sibling) {
+            table->nodes[tail++] = child;
+            ++ntrans;
+        }
+
+        state->id = num_words;
+        num_words += IB_AC_TABLE_HEADER;
+        if (head >= num_dense) {
+            num_words += (ntrans + 3) / 4 + ntrans;
+        }
+        ++head;
+    }
+
+    table->code = (uint32_t *)ib_mpool_calloc(ac_tree->mp,
+                                              num_words, sizeof(uint32_t));
+    if (table->code == NULL) {
+        return IB_EALLOC;
+    }
+
+    for (i = 0; i < num_states; ++i) {
+        uint32_t *header = NULL;
+
+        state = table->nodes[i];
+        header = table->code + state->id;
+
+        header[0] = (state->fail != NULL) ? state->fail->id : 0;
+        header[2] = i;
+
+        /* Sorted goto() transitions */
+        ntrans = 0;
+        for (child = state->child; child != NULL; child = child->sibling) {
+            uint8_t letter = (uint8_t)child->letter;
+            uint32_t target = child->id;
+
+            if ((child->flags & IB_AC_FLAG_STATE_OUTPUT) ||
+                child->outputs != NULL)
+            {
+                target |= IB_AC_TABLE_OUTPUT;
+            }
+
+            for (j = ntrans; j > 0 && letters[j - 1] > letter; --j) {
+                letters[j] = letters[j - 1];
+                targets[j] = targets[j - 1];
+            }
+            letters[j] = letter;
+            targets[j] = target;
+            ++ntrans;
+        }
+
+        if (i < num_dense) {
+            /* Dense rows hold the complete transition function. The
+             * fail state is closer to the root, so its row (or the rows
+             * its fail chain resolves to) is complete at this point */
+            uint32_t *row = table->dense + (size_t)i * 256;
+
+            for (c = 0; c < 256; ++c) {
+                row[c] = (i == 0) ? 0 : ib_ac_table_goto(table, header[0],
+                                                         (uint8_t)c);
+            }
+            for (j = 0; j < ntrans; ++j) {
+                row[letters[j]] = targets[j];
+            }
+            header[1] = IB_AC_TABLE_DENSE | i;
+        }
+        else {
+            header[1] = ntrans;
+            memcpy(header + IB_AC_TABLE_HEADER, letters, ntrans);
+            memcpy(header + IB_AC_TABLE_HEADER + (ntrans + 3) / 4, targets,
+                   ntrans * sizeof(uint32_t));
+        }
+
+        /* Patterns matching at this state: its own, then the
+         * subpatterns of the branch */
+        table->state_outputs[i].first = outputs;
+        if (state->flags & IB_AC_FLAG_STATE_OUTPUT) {
+            table->outputs[outputs++] = state;
+        }
+        for (outs = state->outputs; outs != NULL; outs = outs->outputs) {
+            table->outputs[outputs++] = outs;
+        }
+        table->state_outputs[i].count =
+            outputs - table->state_outputs[i].first;
+    }
+
+    ac_tree->table = table;
+
+    return IB_OK;
+}
+
 /**
  * Search the state to go to for the given state and letter. It represents
  * the goto() function of aho corasick using a balanced binary tree for
@@ -588,9 +760,9 @@ static inline ib_ac_state_t *ib_ac_bintree_goto(ib_ac_state_t *state,
 
 /**
  * Builds links between states (the AC failure function)
- * It also link outputs of subpatterns found between branches,
- * and removes unuseful transitions. It MUST be called after patterns
- * are added
+ * It also link outputs of subpatterns found between branches, and
+ * freezes the trie into the flat state table used for matching.
+ * It MUST be called after patterns are added
  *
  * @param ac_tree pointer to store the matcher
  *
@@ -606,6 +778,13 @@ ib_status_t ib_ac_build_links(ib_ac_t *ac_tree)
         return st;
     }
 
+    if (ac_tree->table == NULL) {
+        st = ib_ac_build_table(ac_tree);
+        if (st != IB_OK) {
+            return st;
+        }
+    }
+
     ac_tree->flags |= IB_AC_FLAG_PARSER_READY;
 
     return IB_OK;
@@ -635,6 +814,136 @@ static void ib_ac_do_callback(ib_ac_context_t *ac_ctx,
     return;
 }
 
+/**
+ * Account for an output state reached while consuming data. Updates the
+ * match counters and, depending on @a flags, calls the pattern callback
+ * and/or appends an entry to the match list of the context
+ *
+ * @param ac_ctx the matching context
+ * @param state the output state (pattern) that matched
+ * @param flags options used for matching
+ * @param mp memory pool to use for the match list
+ *
+ * @returns Status code
+ */
+static ib_status_t ib_ac_add_match(ib_ac_context_t *ac_ctx,
+                                   ib_ac_state_t *state,
+                                   uint8_t flags,
+                                   ib_mpool_t *mp)
+{
+    ib_status_t rc;
+    ib_ac_match_t *mt = NULL;
+
+    ++ac_ctx->match_cnt;
+
+    if (flags & IB_AC_FLAG_CONSUME_DOCALLBACK) {
+        ib_ac_do_callback(ac_ctx, state);
+    }
+    else {
+        ++state->match_cnt;
+    }
+
+    if ((flags & IB_AC_FLAG_CONSUME_DOLIST) == 0) {
+        return IB_OK;
+    }
+
+    /* If list is not created yet, create it */
+    if (ac_ctx->match_list == NULL) {
+        rc = ib_list_create(&ac_ctx->match_list, mp);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+
+    mt = (ib_ac_match_t *)ib_mpool_calloc(mp, 1, sizeof(ib_ac_match_t));
+    if (mt == NULL) {
+        return IB_EALLOC;
+    }
+
+    mt->pattern = state->pattern;
+    mt->data = state->data;
+    mt->pattern_len = state->level + 1;
+    mt->offset = ac_ctx->processed - (state->level + 1);
+    mt->relative_offset = ac_ctx->current_offset - (state->level + 1);
+
+    return ib_list_enqueue(ac_ctx->match_list, (void *)mt);
+}
+
+/**
+ * Search patterns using the flat state table of the matcher.
+ * See ib_ac_consume()
+ *
+ * @param ac_ctx pointer to the matching context
+ * @param data pointer to the buffer to search in
+ * @param len the length of the data
+ * @param flags options to use while matching
+ * @param mp memory pool to use
+ *
+ * @returns Status code
+ */
+static ib_status_t ib_ac_consume_table(ib_ac_context_t *ac_ctx,
+                                       const char *data,
+                                       size_t len,
+                                       uint8_t flags,
+                                       ib_mpool_t *mp)
+{
+    const ib_ac_table_t *table = ac_ctx->ac_tree->table;
+    const uint8_t *start = (const uint8_t *)data;
+    const uint8_t *p = start;
+    const uint8_t *end = p + len;
+    const size_t processed = ac_ctx->processed;
+    const int nocase = ac_ctx->ac_tree->flags & IB_AC_FLAG_PARSER_NOCASE;
+
+    uint32_t state = ac_ctx->current->id;
+    int flag_match = 0;
+
+    while (p < end) {
+        uint8_t letter = *p++;
+
+        if (nocase) {
+            letter = (uint8_t)tolower(letter);
+        }
+
+        state = ib_ac_table_goto(table, state, letter);
+
+        if (state & IB_AC_TABLE_OUTPUT) {
+            const ib_ac_table_outputs_t *outs = NULL;
+            uint32_t i;
+
+            state &= ~IB_AC_TABLE_OUTPUT;
+            outs = &table->state_outputs[table->code[state + 2]];
+            flag_match = 1;
+            ac_ctx->current = table->nodes[table->code[state + 2]];
+            ac_ctx->current_offset = p - start;
+            ac_ctx->processed = processed + ac_ctx->current_offset;
+
+            for (i = outs->first; i < outs->first + outs->count; ++i) {
+                ib_status_t rc;
+
+                rc = ib_ac_add_match(ac_ctx, table->outputs[i], flags, mp);
+                if (rc != IB_OK) {
+                    return rc;
+                }
+
+                if ( !(flags & IB_AC_FLAG_CONSUME_MATCHALL)) {
+                    return IB_OK;
+                }
+            }
+        }
+    }
+
+    ac_ctx->current = table->nodes[table->code[state + 2]];
+    ac_ctx->current_offset = len;
+    ac_ctx->processed = processed + len;
+
+    /* If we have a match, return ok. Otherwise return IB_ENOENT */
+    if (flag_match == 1) {
+        return IB_OK;
+    }
+
+    return IB_ENOENT;
+}
+
 /**
  * Search patterns of the ac_tree matcher in the given buffer using a
  * matching context. The matching context stores offsets used to process
@@ -677,6 +986,10 @@ ib_status_t ib_ac_consume(ib_ac_context_t *ac_ctx,
         ac_ctx->current = ac_tree->root;
     }
 
+    if (ac_tree->table != NULL) {
+        return ib_ac_consume_table(ac_ctx, data, len, flags, mp);
+    }
+
     state = ac_ctx->current;
     end = data + len;
 
@@ -694,103 +1007,43 @@ ib_status_t ib_ac_consume(ib_ac_context_t *ac_ctx,
             fgoto = ib_ac_bintree_goto(state, letter);
 
             if (fgoto != NULL) {
+                ib_ac_state_t *outs = NULL;
+                ib_status_t rc;
+
+                ac_ctx->current = fgoto;
 
                 if (fgoto->flags & IB_AC_FLAG_STATE_OUTPUT) {
                     flag_match = 1;
 
-                    ++fgoto->match_cnt;
-                    ++ac_ctx->match_cnt;
-
-                    ac_ctx->current = fgoto;
-                    state = fgoto;
-
-                    if (flags & IB_AC_FLAG_CONSUME_DOCALLBACK)
-                    {
-                        ib_ac_do_callback(ac_ctx, state);
-                    }
-
-                    if (flags & IB_AC_FLAG_CONSUME_DOLIST)
-                    {
-                        /* If list is not created yet, create it */
-                        if (ac_ctx->match_list == NULL)
-                        {
-                            ib_status_t rc;
-                            rc = ib_list_create(&ac_ctx->match_list, mp);
-                            if (rc != IB_OK) {
-                                return rc;
-                            }
-                        }
-
-                        ib_ac_match_t *mt = NULL;
-                        mt = (ib_ac_match_t *)ib_mpool_calloc(mp,
-                                          1, sizeof(ib_ac_match_t));
-                        if (mt == NULL) {
-                            return IB_EALLOC;
-                        }
-
-                        mt->pattern = state->pattern;
-                        mt->data = state->data;
-                        mt->pattern_len = state->level + 1;
-                        mt->offset = ac_ctx->processed - (fgoto->level + 1);
-                        mt->relative_offset = ac_ctx->current_offset -
-                                                         (fgoto->level + 1);
-
-                        ib_list_enqueue(ac_ctx->match_list, (void *) mt);
+                    rc = ib_ac_add_match(ac_ctx, fgoto, flags, mp);
+                    if (rc != IB_OK) {
+                        return rc;
                     }
 
                     if ( !(flags & IB_AC_FLAG_CONSUME_MATCHALL))
                     {
                         return IB_OK;
                     }
+                }
+
+                for (outs = fgoto->outputs;
+                     outs != NULL;
+                     outs = outs->outputs)
+                {
+                    /* This are subpatterns of the current walked branch
+                     * that are present as independent patterns as well
+                     * in the tree. They must be reported even if the
+                     * current state is not an output itself. */
+                    flag_match = 1;
 
-                    ib_ac_state_t *outs = NULL;
+                    rc = ib_ac_add_match(ac_ctx, outs, flags, mp);
+                    if (rc != IB_OK) {
+                        return rc;
+                    }
 
-                    for (outs = state->outputs;
-                         outs != NULL;
-                         outs = outs->outputs)
+                    if ( !(flags & IB_AC_FLAG_CONSUME_MATCHALL))
                     {
-                        /* This are subpatterns of the current walked branch
-                         * that are present as independent patterns as well
-                         * in the tree */
-
-                        ++outs->match_cnt;
-                        ++ac_ctx->match_cnt;
-
-                        if (flags & IB_AC_FLAG_CONSUME_DOCALLBACK)
-                        {
-                            ib_ac_do_callback(ac_ctx, outs);
-                        }
-
-                        if (flags & IB_AC_FLAG_CONSUME_DOLIST)
-                        {
-                            /* If list is not created yet, create it */
-                            if (ac_ctx->match_list == NULL)
-                            {
-                                ib_status_t rc;
-                                rc = ib_list_create(&ac_ctx->match_list, mp);
-                                if (rc != IB_OK) {
-                                    return rc;
-                                }
-                            }
-
-                            ib_ac_match_t *mt = NULL;
-                            mt = (ib_ac_match_t *)ib_mpool_calloc(mp,
-                                              1, sizeof(ib_ac_match_t));
-                            if (mt == NULL) {
-                                return IB_EALLOC;
-                            }
-
-                            mt->pattern = outs->pattern;
-                            mt->data = state->data;
-                            mt->pattern_len = outs->level + 1;
-                            mt->offset =
-                                ac_ctx->processed - (outs->level + 1);
-                            mt->relative_offset = ac_ctx->current_offset -
-                                                         (outs->level + 1);
-
-                            ib_list_enqueue(ac_ctx->match_list,
-                                            (void *) mt);
-                        }
+                        return IB_OK;
                     }
                 }
             }
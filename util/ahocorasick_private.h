@@ -63,6 +63,7 @@ struct ib_ac_state_t {
     ib_ac_callback_t   callback;  /**< callback function for matches */
     void              *data;   /**< callback (or match entry) extra params */
 
+    uint32_t           id;        /**< offset in the flat state table */
 };
 
 /**
@@ -77,6 +78,60 @@ struct ib_ac_bintree_t {
     ib_ac_bintree_t   *right;     /**< chars greater than current */
 };
 
+/**
+ * Number of states (in breadth first order, starting at the root) that
+ * get a dense transition row in the flat state table
+ */
+#define IB_AC_TABLE_DENSE_MAX  256
+
+/** Set in the info word of a state that has a dense transition row */
+#define IB_AC_TABLE_DENSE      0x80000000U
+
+/** Set in transition targets that are states with outputs */
+#define IB_AC_TABLE_OUTPUT     0x80000000U
+
+/** Words in the header of a state of the flat state table */
+#define IB_AC_TABLE_HEADER     3
+
+/**
+ * Outputs of a state of the flat state table
+ */
+typedef struct ib_ac_table_outputs_t {
+    uint32_t           first;     /**< first output */
+    uint32_t           count;     /**< number of outputs */
+} ib_ac_table_outputs_t;
+
+/**
+ * Flat state table, built from the trie by ib_ac_build_links().
+ *
+ * All states are laid out, in breadth first order, in one array of
+ * 32 bit words and are referenced by their offset in it (the root is at
+ * offset 0). Each state is a header followed by its transitions:
+ *
+ *   - fail:  offset of the state to go to if goto() fail
+ *   - info:  IB_AC_TABLE_DENSE | row, or the number of transitions
+ *   - index: index of the state in @c nodes and @c state_outputs
+ *   - sorted transition letters, four per word (sparse states only)
+ *   - transition targets, in the same order (sparse states only)
+ *
+ * The first IB_AC_TABLE_DENSE_MAX states have a dense row of 256 entries
+ * holding the complete transition function (failures resolved). Since
+ * the root is dense, resolving a transition of a sparse state ends at
+ * the latest at the root. Transition targets have IB_AC_TABLE_OUTPUT
+ * set if the target state has outputs, so the outputs are only looked
+ * at on a match. Each state has the precomputed list of all the
+ * patterns that match when it is reached.
+ */
+struct ib_ac_table_t {
+    uint32_t             num_states;  /**< number of states */
+    uint32_t            *code;        /**< states */
+    uint32_t            *dense;       /**< dense rows, 256 entries each */
+
+    ib_ac_state_t      **nodes;       /**< trie state, by state index */
+    ib_ac_table_outputs_t *state_outputs; /**< outputs, by state index */
+    ib_ac_state_t      **outputs;     /**< output states */
+};
+
 #ifdef __cplusplus
 }
 #endif
@@ -120,6 +120,29 @@ failed:
     return rc;
 }
 
+size_t ib_bytestr_struct_size(void)
+{
+    return sizeof(ib_bytestr_t);
+}
+
+ib_bytestr_t *ib_bytestr_init(
+    void       *mem,
+    ib_mpool_t *pool
+) {
+    assert(mem != NULL);
+    assert(pool != NULL);
+
+    ib_bytestr_t *bs = (ib_bytestr_t *)mem;
+
+    bs->data   = NULL;
+    bs->mp     = pool;
+    bs->flags  = 0;
+    bs->size   = 0;
+    bs->length = 0;
+
+    return bs;
+}
+
 ib_status_t ib_bytestr_dup(
     ib_bytestr_t       **pdst,
     ib_mpool_t          *pool,
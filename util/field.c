@@ -56,6 +56,167 @@ struct ib_field_val_t {
     ib_field_val_union_t  u;             /**< Union of value types */
 };
 
+/**
+ * Field storage.
+ *
+ * A field, its value structure and its name are a single allocation,
+ * followed by the name:
+ *
+ * @code
+ * field_storage_t | extra | name
+ * @endcode
+ *
+ * Byte string fields place their ib_bytestr_t in @c extra and, for copies
+ * of at most FIELD_INLINE_MAX bytes, the data after it.  String copies of
+ * at most FIELD_INLINE_MAX bytes are placed there too.  Values set later
+ * are allocated separately as before.
+ */
+typedef struct {
+    ib_field_t      field;               /**< Field */
+    ib_field_val_t  val;                 /**< Value */
+} field_storage_t;
+
+/** Largest value copied into the field allocation. */
+#define FIELD_INLINE_MAX 128
+
+/** Field allocations are rounded up to a multiple of this. */
+#define FIELD_ALIGN 16
+
+/**
+ * Allocate a field, its value and its name at once.
+ *
+ * The value is zeroed: the field is dynamic until its value storage is set.
+ *
+ * @param[out] pf     Address to write new field to.
+ * @param[in]  mp     Memory pool.
+ * @param[in]  name   Field name.
+ * @param[in]  nlen   Field name length.
+ * @param[in]  type   Field type.
+ * @param[in]  extra  Bytes to allocate after the value.
+ * @param[out] pextra If not NULL, set to the @a extra bytes.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation failure.
+ */
+static ib_status_t field_alloc(
+    ib_field_t **pf,
+    ib_mpool_t  *mp,
+    const char  *name,
+    size_t       nlen,
+    ib_ftype_t   type,
+    size_t       extra,
+    void       **pextra
+)
+{
+    field_storage_t *fs;
+    size_t size;
+    char *p;
+
+    /* Keep the memory pool aligned for the next field. */
+    size = sizeof(*fs) + extra + nlen;
+    size = (size + FIELD_ALIGN - 1) & ~(size_t)(FIELD_ALIGN - 1);
+
+    fs = (field_storage_t *)ib_mpool_alloc(mp, size);
+    if (fs == NULL) {
+        *pf = NULL;
+        return IB_EALLOC;
+    }
+    memset(&fs->val, 0, sizeof(fs->val));
+
+    p = (char *)(fs + 1);
+    if (pextra != NULL) {
+        *pextra = p;
+    }
+    if (nlen > 0) {
+        memcpy(p + extra, name, nlen);
+    }
+
+    fs->field.mp = mp;
+    fs->field.type = type;
+    fs->field.name = p + extra;
+    fs->field.nlen = nlen;
+    fs->field.tfn = NULL;
+    fs->field.val = &fs->val;
+
+    *pf = &fs->field;
+
+    return IB_OK;
+}
+
+/**
+ * Create a byte string field with its byte string in the field allocation.
+ *
+ * @param[out] pf       Address to write new field to.
+ * @param[in]  mp       Memory pool.
+ * @param[in]  name     Field name.
+ * @param[in]  nlen     Field name length.
+ * @param[in]  data     Value data.
+ * @param[in]  dlen     Length of @a data.
+ * @param[in]  copy     Copy @a data rather than alias it read-only.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation failure.
+ */
+static ib_status_t field_create_bytestr(
+    ib_field_t    **pf,
+    ib_mpool_t     *mp,
+    const char     *name,
+    size_t          nlen,
+    const uint8_t  *data,
+    size_t          dlen,
+    bool            copy
+)
+{
+    ib_status_t rc;
+    ib_bytestr_t *bs;
+    uint8_t *copy_data;
+    size_t bs_size = ib_bytestr_struct_size();
+    size_t inline_len = 0;
+    void *extra;
+
+    if (copy && dlen <= FIELD_INLINE_MAX) {
+        inline_len = dlen;
+    }
+
+    rc = field_alloc(pf, mp, name, nlen, IB_FTYPE_BYTESTR,
+                     bs_size + inline_len, &extra);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    bs = ib_bytestr_init(extra, mp);
+
+    if (! copy) {
+        rc = ib_bytestr_setv_const(bs, data, dlen);
+    }
+    else {
+        if (dlen <= FIELD_INLINE_MAX) {
+            copy_data = (uint8_t *)extra + bs_size;
+        }
+        else {
+            copy_data = (uint8_t *)ib_mpool_alloc(mp, dlen);
+            if (copy_data == NULL) {
+                *pf = NULL;
+                return IB_EALLOC;
+            }
+        }
+        if (dlen > 0) {
+            memcpy(copy_data, data, dlen);
+        }
+        rc = ib_bytestr_setv(bs, copy_data, dlen);
+    }
+    if (rc != IB_OK) {
+        *pf = NULL;
+        return rc;
+    }
+
+    (*pf)->val->pval = &((*pf)->val->u);
+    (*pf)->val->u.bytestr = bs;
+
+    return IB_OK;
+}
+
 const char *ib_field_type_name(
     ib_ftype_t ftype
 )
@@ -305,15 +466,10 @@ static ib_status_t field_from_string_internal(
                                  ib_ftype_nulstr_in(vstr));
         }
         else {
-            ib_bytestr_t *bs;
-            rc = ib_bytestr_dup_mem(&bs, mp, (const uint8_t *)vstr, vlen);
-            if (rc != IB_OK) {
-                return rc;
-            }
-            rc = ib_field_create(&field, mp,
-                                 name, nlen,
-                                 IB_FTYPE_BYTESTR,
-                                 ib_ftype_bytestr_in(bs));
+            rc = field_create_bytestr(&field, mp,
+                                      name, nlen,
+                                      (const uint8_t *)vstr, vlen,
+                                      true);
         }
         if (pvalue != NULL) {
             pvalue->nulstr = (char *)vstr;
@@ -478,7 +634,44 @@ ib_status_t ib_field_create(
 {
     ib_status_t rc;
 
-    rc = ib_field_create_alias(pf, mp, name, nlen, type, NULL);
+    if (type == IB_FTYPE_BYTESTR && in_pval != NULL) {
+        const ib_bytestr_t *bs = (const ib_bytestr_t *)in_pval;
+
+        rc = field_create_bytestr(pf, mp, name, nlen,
+                                  ib_bytestr_const_ptr(bs),
+                                  ib_bytestr_length(bs),
+                                  true);
+        if (rc != IB_OK) {
+            goto failed;
+        }
+
+        ib_field_util_log_debug("FIELD_CREATE", (*pf));
+
+        return IB_OK;
+    }
+
+    if (type == IB_FTYPE_NULSTR && in_pval != NULL) {
+        const char *str = (const char *)in_pval;
+        size_t len = strlen(str) + 1;
+
+        if (len <= FIELD_INLINE_MAX) {
+            void *extra;
+
+            rc = field_alloc(pf, mp, name, nlen, type, len, &extra);
+            if (rc != IB_OK) {
+                goto failed;
+            }
+            memcpy(extra, str, len);
+            (*pf)->val->pval = &((*pf)->val->u);
+            (*pf)->val->u.nulstr = (char *)extra;
+
+            ib_field_util_log_debug("FIELD_CREATE", (*pf));
+
+            return IB_OK;
+        }
+    }
+
+    rc = field_alloc(pf, mp, name, nlen, type, 0, NULL);
     if (rc != IB_OK) {
         goto failed;
     }
@@ -513,7 +706,7 @@ ib_status_t ib_field_create_no_copy(
 {
     ib_status_t rc;
 
-    rc = ib_field_create_alias(pf, mp, name, nlen, type, NULL);
+    rc = field_alloc(pf, mp, name, nlen, type, 0, NULL);
     if (rc != IB_OK) {
         goto failed;
     }
@@ -547,46 +740,16 @@ ib_status_t ib_field_create_alias(
 )
 {
     ib_status_t rc;
-    char *name_copy;
 
-    /* Allocate the field structure. */
-    *pf = (ib_field_t *)ib_mpool_alloc(mp, sizeof(**pf));
-    if (*pf == NULL) {
-        rc = IB_EALLOC;
-        goto failed;
-    }
-    (*pf)->mp = mp;
-    (*pf)->type = type;
-    (*pf)->tfn = NULL;
-
-    /* Copy the name. */
-    (*pf)->nlen = nlen;
-    name_copy = (char *)ib_mpool_alloc(mp, nlen);
-    if (name_copy == NULL) {
-        rc = IB_EALLOC;
-        goto failed;
-    }
-    memcpy(name_copy, name, nlen);
-    (*pf)->name = (const char *)name_copy;
-
-    (*pf)->val = (ib_field_val_t *)ib_mpool_calloc(mp,
-        1, sizeof(*((*pf)->val))
-    );
-    if ((*pf)->val == NULL) {
-        rc = IB_EALLOC;
-        goto failed;
+    rc = field_alloc(pf, mp, name, nlen, type, 0, NULL);
+    if (rc != IB_OK) {
+        return rc;
     }
 
     (*pf)->val->pval = storage_pval;
 
     ib_field_util_log_debug("FIELD_CREATE_ALIAS", (*pf));
     return IB_OK;
-
-failed:
-    /* Make sure everything is cleaned up on failure. */
-    *pf = NULL;
-
-    return rc;
 }
 
 ib_status_t ib_field_create_dynamic(
@@ -738,18 +901,13 @@ ib_status_t ib_field_create_bytestr_alias(
 )
 {
     ib_status_t rc;
-    ib_bytestr_t *bs;
 
-    rc = ib_bytestr_alias_mem(&bs, mp, val, vlen);
-    if (rc != IB_OK) {
+    if (val == NULL) {
+        rc = IB_EINVAL;
         goto failed;
     }
 
-    rc = ib_field_create_no_copy(
-        pf, mp, name, nlen,
-        IB_FTYPE_BYTESTR,
-        ib_ftype_bytestr_mutable_in(bs)
-    );
+    rc = field_create_bytestr(pf, mp, name, nlen, val, vlen, false);
     if (rc != IB_OK) {
         goto failed;
     }
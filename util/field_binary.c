@@ -0,0 +1,696 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+/**
+ * @file
+ * @brief IronBee --- Binary Field List Encoding
+ */
+
+#include "ironbee_config_auto.h"
+
+#include <ironbee/field_binary.h>
+
+#include <ironbee/bytestr.h>
+#include <ironbee/field.h>
+
+#include <assert.h>
+#include <string.h>
+
+/** Encoding header; the version byte follows. */
+static const uint8_t header[] = { 'I', 'B', 'F' };
+
+/** Length of the header, including the version byte. */
+#define HEADER_LEN (sizeof(header) + 1)
+
+/** Maximum list nesting, to bound the recursion on untrusted data. */
+#define MAX_DEPTH 32
+
+/** Maximum encoded length of a 64 bit variable length integer. */
+#define VARINT_MAX 10
+
+/** Encoded length of a float. */
+#define FLOAT_LEN 8
+
+/** Value of a field being encoded. */
+typedef struct {
+    ib_num_t             num;      /**< IB_FTYPE_NUM value */
+    ib_float_t           fnum;     /**< IB_FTYPE_FLOAT value */
+    const char          *nulstr;   /**< IB_FTYPE_NULSTR value */
+    const ib_bytestr_t  *bytestr;  /**< IB_FTYPE_BYTESTR value */
+    const ib_list_t     *list;     /**< IB_FTYPE_LIST value */
+} field_value_t;
+
+/**
+ * Is a field of this type encoded?
+ *
+ * @param[in] type Field type.
+ *
+ * @returns True if @a type is encoded.
+ */
+static bool type_is_encoded(ib_ftype_t type)
+{
+    switch (type) {
+    case IB_FTYPE_NUM:
+    case IB_FTYPE_FLOAT:
+    case IB_FTYPE_NULSTR:
+    case IB_FTYPE_BYTESTR:
+    case IB_FTYPE_LIST:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Length of an encoded unsigned variable length integer.
+ *
+ * @param[in] v Value.
+ *
+ * @returns Encoded length of @a v.
+ */
+static size_t varint_len(uint64_t v)
+{
+    size_t len = 1;
+
+    while (v >= 0x80) {
+        v >>= 7;
+        ++len;
+    }
+    return len;
+}
+
+/**
+ * Write an unsigned variable length integer.
+ *
+ * @param[in] out Output position.
+ * @param[in] v Value.
+ *
+ * @returns Position after the encoded value.
+ */
+static uint8_t *varint_put(uint8_t *out, uint64_t v)
+{
+    while (v >= 0x80) {
+        *out++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *out++ = (uint8_t)v;
+    return out;
+}
+
+/**
+ * Zig-zag encode a signed number, so small magnitudes encode short.
+ *
+ * @param[in] num Number.
+ *
+ * @returns Zig-zag encoding of @a num.
+ */
+static uint64_t zigzag(ib_num_t num)
+{
+    return ((uint64_t)num << 1) ^ (uint64_t)(num >> 63);
+}
+
+/**
+ * Reverse zigzag().
+ *
+ * @param[in] v Zig-zag encoded number.
+ *
+ * @returns Decoded number.
+ */
+static ib_num_t unzigzag(uint64_t v)
+{
+    return (ib_num_t)(v >> 1) ^ -(ib_num_t)(v & 1);
+}
+
+/**
+ * Get the value of an encoded field, and its encoded value length.
+ *
+ * @param[in] field Field.
+ * @param[out] value Field value.
+ * @param[out] vlen Encoded value length; for lists, only the count.
+ *
+ * @returns Status code
+ */
+static ib_status_t field_value_len(
+    const ib_field_t     *field,
+    field_value_t        *value,
+    size_t               *vlen)
+{
+    ib_status_t rc;
+    size_t      len;
+
+    switch (field->type) {
+    case IB_FTYPE_NUM:
+        rc = ib_field_value(field, ib_ftype_num_out(&value->num));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        *vlen = varint_len(zigzag(value->num));
+        return IB_OK;
+
+    case IB_FTYPE_FLOAT:
+        rc = ib_field_value(field, ib_ftype_float_out(&value->fnum));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        *vlen = FLOAT_LEN;
+        return IB_OK;
+
+    case IB_FTYPE_NULSTR:
+        rc = ib_field_value(field, ib_ftype_nulstr_out(&value->nulstr));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        len = (value->nulstr == NULL) ? 0 : strlen(value->nulstr);
+        *vlen = varint_len(len) + len + 1;
+        return IB_OK;
+
+    case IB_FTYPE_BYTESTR:
+        rc = ib_field_value(field, ib_ftype_bytestr_out(&value->bytestr));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        len = ib_bytestr_length(value->bytestr);
+        *vlen = varint_len(len) + len;
+        return IB_OK;
+
+    case IB_FTYPE_LIST:
+        rc = ib_field_value(field, ib_ftype_list_out(&value->list));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        *vlen = 0;
+        return IB_OK;
+
+    default:
+        return IB_EINVAL;
+    }
+}
+
+/**
+ * Compute the encoded length of a list.
+ *
+ * @param[in] list List to encode.
+ * @param[in] depth Nesting depth of @a list.
+ * @param[out] plen Encoded length.
+ *
+ * @returns Status code
+ */
+static ib_status_t list_len(
+    const ib_list_t *list,
+    int              depth,
+    size_t          *plen)
+{
+    const ib_list_node_t *node;
+    size_t                count = 0;
+    size_t                len = 0;
+    ib_status_t           rc;
+
+    if (depth > MAX_DEPTH) {
+        return IB_EINVAL;
+    }
+
+    IB_LIST_LOOP_CONST(list, node) {
+        const ib_field_t     *field = (const ib_field_t *)node->data;
+        field_value_t         value;
+        size_t                vlen;
+
+        if (! type_is_encoded(field->type)) {
+            continue;
+        }
+        rc = field_value_len(field, &value, &vlen);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        if (field->type == IB_FTYPE_LIST) {
+            rc = list_len(value.list, depth + 1, &vlen);
+            if (rc != IB_OK) {
+                return rc;
+            }
+        }
+        len += 1 + varint_len(field->nlen) + field->nlen + vlen;
+        ++count;
+    }
+
+    *plen = varint_len(count) + len;
+    return IB_OK;
+}
+
+/**
+ * Encode a list.
+ *
+ * The space needed is computed by list_len(), but values are fetched again
+ * here, so every write is still checked against @a end in case a dynamic
+ * field's value changed in between.
+ *
+ * @param[in] list List to encode.
+ * @param[in,out] pout Output position.
+ * @param[in] end End of the output buffer.
+ *
+ * @returns Status code:
+ *  - IB_OK - All OK
+ *  - IB_EOTHER - A field value changed since list_len()
+ *  - Errors from ib_field_value()
+ */
+static ib_status_t list_put(
+    const ib_list_t *list,
+    uint8_t        **pout,
+    const uint8_t   *end)
+{
+    const ib_list_node_t *node;
+    size_t                count = 0;
+    uint8_t              *out = *pout;
+    ib_status_t           rc;
+
+    IB_LIST_LOOP_CONST(list, node) {
+        const ib_field_t *field = (const ib_field_t *)node->data;
+        if (type_is_encoded(field->type)) {
+            ++count;
+        }
+    }
+    if ((size_t)(end - out) < varint_len(count)) {
+        return IB_EOTHER;
+    }
+    out = varint_put(out, count);
+
+    IB_LIST_LOOP_CONST(list, node) {
+        const ib_field_t     *field = (const ib_field_t *)node->data;
+        field_value_t         value;
+        size_t                vlen;
+        size_t                len;
+
+        if (! type_is_encoded(field->type)) {
+            continue;
+        }
+        rc = field_value_len(field, &value, &vlen);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        if ((size_t)(end - out) < 1 + varint_len(field->nlen) + field->nlen + vlen) {
+            return IB_EOTHER;
+        }
+
+        *out++ = (uint8_t)field->type;
+        out = varint_put(out, field->nlen);
+        memcpy(out, field->name, field->nlen);
+        out += field->nlen;
+
+        switch (field->type) {
+        case IB_FTYPE_NUM:
+            out = varint_put(out, zigzag(value.num));
+            break;
+
+        case IB_FTYPE_FLOAT:
+        {
+            double   d = (double)value.fnum;
+            uint64_t bits;
+            int      i;
+
+            memcpy(&bits, &d, sizeof(bits));
+            for (i = 0; i < FLOAT_LEN; ++i) {
+                *out++ = (uint8_t)(bits >> (8 * i));
+            }
+            break;
+        }
+
+        case IB_FTYPE_NULSTR:
+            len = (value.nulstr == NULL) ? 0 : strlen(value.nulstr);
+            out = varint_put(out, len);
+            if (len > 0) {
+                memcpy(out, value.nulstr, len);
+            }
+            out += len;
+            *out++ = '\0';
+            break;
+
+        case IB_FTYPE_BYTESTR:
+            len = ib_bytestr_length(value.bytestr);
+            out = varint_put(out, len);
+            if (len > 0) {
+                memcpy(out, ib_bytestr_const_ptr(value.bytestr), len);
+            }
+            out += len;
+            break;
+
+        case IB_FTYPE_LIST:
+            rc = list_put(value.list, &out, end);
+            if (rc != IB_OK) {
+                return rc;
+            }
+            break;
+
+        default:
+            return IB_EINVAL;
+        }
+    }
+
+    *pout = out;
+    return IB_OK;
+}
+
+bool ib_field_binary_is_encoded(
+    const uint8_t *data,
+    size_t         dlen)
+{
+    return (data != NULL) &&
+           (dlen >= HEADER_LEN) &&
+           (memcmp(data, header, sizeof(header)) == 0);
+}
+
+ib_status_t ib_field_binary_encode(
+    ib_mpool_t       *mp,
+    const ib_list_t  *list,
+    uint8_t         **obuf,
+    size_t           *olen)
+{
+    assert(mp != NULL);
+    assert(list != NULL);
+    assert(obuf != NULL);
+    assert(olen != NULL);
+
+    ib_status_t  rc;
+    size_t       len;
+    uint8_t     *buf;
+    uint8_t     *out;
+
+    rc = list_len(list, 0, &len);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    len += HEADER_LEN;
+
+    buf = ib_mpool_alloc(mp, len);
+    if (buf == NULL) {
+        return IB_EALLOC;
+    }
+
+    memcpy(buf, header, sizeof(header));
+    buf[sizeof(header)] = IB_FIELD_BINARY_VERSION;
+    out = buf + HEADER_LEN;
+    rc = list_put(list, &out, buf + len);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    if ((size_t)(out - buf) != len) {
+        return IB_EOTHER;
+    }
+
+    *obuf = buf;
+    *olen = len;
+    return IB_OK;
+}
+
+/** Decoding state. */
+typedef struct {
+    ib_mpool_t     *mp;     /**< Memory pool for allocations */
+    const uint8_t  *cur;    /**< Current position */
+    const uint8_t  *end;    /**< End of the data */
+    bool            alias;  /**< Alias string values? */
+    const char     *error;  /**< Error description */
+} decode_t;
+
+/**
+ * Read an unsigned variable length integer.
+ *
+ * @param[in,out] decode Decoding state.
+ * @param[out] pv Value.
+ *
+ * @returns IB_OK or IB_EINVAL if truncated or overlong.
+ */
+static ib_status_t varint_get(decode_t *decode, uint64_t *pv)
+{
+    uint64_t v = 0;
+    int      shift;
+
+    for (shift = 0; shift < 7 * VARINT_MAX; shift += 7) {
+        uint8_t b;
+
+        if (decode->cur >= decode->end) {
+            decode->error = "Truncated integer";
+            return IB_EINVAL;
+        }
+        b = *decode->cur++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            *pv = v;
+            return IB_OK;
+        }
+    }
+
+    decode->error = "Overlong integer";
+    return IB_EINVAL;
+}
+
+/**
+ * Read a length, checking that that many bytes remain.
+ *
+ * @param[in,out] decode Decoding state.
+ * @param[out] plen Length.
+ *
+ * @returns IB_OK or IB_EINVAL.
+ */
+static ib_status_t length_get(decode_t *decode, size_t *plen)
+{
+    uint64_t    v;
+    ib_status_t rc;
+
+    rc = varint_get(decode, &v);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    if (v > (uint64_t)(decode->end - decode->cur)) {
+        decode->error = "Length exceeds data";
+        return IB_EINVAL;
+    }
+    *plen = (size_t)v;
+    return IB_OK;
+}
+
+/**
+ * Decode a list.
+ *
+ * @param[in,out] decode Decoding state.
+ * @param[in] list List to add decoded fields to.
+ * @param[in] depth Nesting depth of @a list.
+ *
+ * @returns Status code
+ */
+static ib_status_t list_get(decode_t *decode, ib_list_t *list, int depth)
+{
+    uint64_t    count;
+    uint64_t    n;
+    ib_status_t rc;
+
+    if (depth > MAX_DEPTH) {
+        decode->error = "Lists nested too deeply";
+        return IB_EINVAL;
+    }
+
+    rc = varint_get(decode, &count);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    for (n = 0; n < count; ++n) {
+        ib_ftype_t  type;
+        const char *name;
+        size_t      nlen;
+        size_t      len;
+        ib_field_t *field;
+
+        if (decode->cur >= decode->end) {
+            decode->error = "Truncated field";
+            return IB_EINVAL;
+        }
+        type = (ib_ftype_t)*decode->cur++;
+
+        rc = length_get(decode, &nlen);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        name = (const char *)decode->cur;
+        decode->cur += nlen;
+
+        switch (type) {
+        case IB_FTYPE_NUM:
+        {
+            uint64_t v;
+            ib_num_t num;
+
+            rc = varint_get(decode, &v);
+            if (rc != IB_OK) {
+                return rc;
+            }
+            num = unzigzag(v);
+            rc = ib_field_create(&field, decode->mp, name, nlen,
+                                 IB_FTYPE_NUM, ib_ftype_num_in(&num));
+            break;
+        }
+
+        case IB_FTYPE_FLOAT:
+        {
+            uint64_t   bits = 0;
+            double     d;
+            ib_float_t fnum;
+            int        i;
+
+            if (decode->end - decode->cur < FLOAT_LEN) {
+                decode->error = "Truncated float";
+                return IB_EINVAL;
+            }
+            for (i = 0; i < FLOAT_LEN; ++i) {
+                bits |= (uint64_t)decode->cur[i] << (8 * i);
+            }
+            decode->cur += FLOAT_LEN;
+            memcpy(&d, &bits, sizeof(d));
+            fnum = d;
+            rc = ib_field_create(&field, decode->mp, name, nlen,
+                                 IB_FTYPE_FLOAT, ib_ftype_float_in(&fnum));
+            break;
+        }
+
+        case IB_FTYPE_NULSTR:
+        {
+            const char *str;
+
+            rc = length_get(decode, &len);
+            if (rc != IB_OK) {
+                return rc;
+            }
+            str = (const char *)decode->cur;
+            if ( (len == (size_t)(decode->end - decode->cur)) ||
+                 (decode->cur[len] != '\0') ||
+                 (memchr(str, '\0', len) != NULL) )
+            {
+                decode->error = "Malformed string";
+                return IB_EINVAL;
+            }
+            decode->cur += len + 1;
+            if (decode->alias) {
+                rc = ib_field_create_no_copy(
+                    &field, decode->mp, name, nlen, IB_FTYPE_NULSTR,
+                    ib_ftype_nulstr_mutable_in((char *)str));
+            }
+            else {
+                rc = ib_field_create(&field, decode->mp, name, nlen,
+                                     IB_FTYPE_NULSTR,
+                                     ib_ftype_nulstr_in(str));
+            }
+            break;
+        }
+
+        case IB_FTYPE_BYTESTR:
+        {
+            ib_bytestr_t *bs;
+
+            rc = length_get(decode, &len);
+            if (rc != IB_OK) {
+                return rc;
+            }
+            if (decode->alias) {
+                rc = ib_bytestr_alias_mem(&bs, decode->mp, decode->cur, len);
+            }
+            else {
+                rc = ib_bytestr_dup_mem(&bs, decode->mp, decode->cur, len);
+            }
+            if (rc != IB_OK) {
+                return rc;
+            }
+            decode->cur += len;
+            rc = ib_field_create_no_copy(&field, decode->mp, name, nlen,
+                                         IB_FTYPE_BYTESTR,
+                                         ib_ftype_bytestr_mutable_in(bs));
+            break;
+        }
+
+        case IB_FTYPE_LIST:
+        {
+            ib_list_t *sublist;
+
+            rc = ib_list_create(&sublist, decode->mp);
+            if (rc != IB_OK) {
+                return rc;
+            }
+            rc = list_get(decode, sublist, depth + 1);
+            if (rc != IB_OK) {
+                return rc;
+            }
+            rc = ib_field_create(&field, decode->mp, name, nlen,
+                                 IB_FTYPE_LIST, ib_ftype_list_in(sublist));
+            break;
+        }
+
+        default:
+            decode->error = "Unknown field type";
+            return IB_EINVAL;
+        }
+
+        if (rc != IB_OK) {
+            return rc;
+        }
+        rc = ib_list_push(list, field);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+
+    return IB_OK;
+}
+
+ib_status_t ib_field_binary_decode(
+    ib_mpool_t     *mp,
+    const uint8_t  *data,
+    size_t          dlen,
+    bool            alias,
+    ib_list_t      *list_out,
+    const char    **error)
+{
+    assert(mp != NULL);
+    assert(list_out != NULL);
+
+    decode_t    decode;
+    ib_status_t rc;
+
+    if (! ib_field_binary_is_encoded(data, dlen)) {
+        if (error != NULL) {
+            *error = "Not binary encoded fields";
+        }
+        return IB_EINVAL;
+    }
+    if (data[sizeof(header)] != IB_FIELD_BINARY_VERSION) {
+        if (error != NULL) {
+            *error = "Unsupported encoding version";
+        }
+        return IB_ENOTIMPL;
+    }
+
+    decode.mp = mp;
+    decode.cur = data + HEADER_LEN;
+    decode.end = data + dlen;
+    decode.alias = alias;
+    decode.error = NULL;
+
+    rc = list_get(&decode, list_out, 0);
+    if ( (rc == IB_OK) && (decode.cur != decode.end) ) {
+        decode.error = "Trailing data";
+        rc = IB_EINVAL;
+    }
+    if ( (rc != IB_OK) && (error != NULL) ) {
+        *error = decode.error;
+    }
+
+    return rc;
+}
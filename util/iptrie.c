@@ -0,0 +1,981 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+/**
+ * @file
+ * @brief IronBee --- IP Trie Implementation
+ *
+ * The builder inserts networks in a binary trie.  Finishing walks the
+ * binary trie @ref IB_IPTRIE_STRIDE levels at a time and emits a poptrie
+ * node for each walk: a child whose subtree holds longer networks becomes
+ * a node, any other child a leaf holding the value of the longest network
+ * on its path.  Children nodes of a node are contiguous in the node array,
+ * and consecutive equal leaves of a node are stored once in the leaf
+ * array, so a node only needs the base index of each.
+ *
+ * Image layout, all in host byte order and 8 byte aligned:
+ * - iptrie_header_t.
+ * - IPv4 nodes (iptrie_node_t), then IPv4 leaves (uint32_t).
+ * - IPv6 nodes, then IPv6 leaves.
+ */
+
+#include "ironbee_config_auto.h"
+
+#include <ironbee/iptrie.h>
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* -- Image -- */
+
+/** Image magic. */
+static const char iptrie_magic[8] = { 'I', 'B', 'I', 'P', 'T', 'R', 'I', 'E' };
+
+/** Image format version. */
+#define IPTRIE_VERSION    1
+
+/** Written in host order to reject images of another byte order. */
+#define IPTRIE_BYTE_ORDER 0x01020304
+
+/** Index of the IPv4 family. */
+#define IPTRIE_V4 0
+/** Index of the IPv6 family. */
+#define IPTRIE_V6 1
+
+/** Address bits of each family. */
+static const size_t iptrie_bits[2] = { 32, 128 };
+
+/** Image header. */
+typedef struct {
+    char     magic[8];       /**< iptrie_magic. */
+    uint32_t version;        /**< IPTRIE_VERSION. */
+    uint32_t byte_order;     /**< IPTRIE_BYTE_ORDER. */
+    uint32_t num_nodes[2];   /**< Nodes of each family. */
+    uint32_t num_leaves[2];  /**< Leaves of each family. */
+} iptrie_header_t;
+
+/**
+ * A trie node.
+ *
+ * Child @c v of the node, for the next IB_IPTRIE_STRIDE bits @c v of the
+ * address, is a node if bit @c v of @c vector is set, and a leaf
+ * otherwise.  Its index is the number of node (resp. leaf) run bits set
+ * up to @c v, minus one, plus @c base1 (resp. @c base0).
+ */
+typedef struct {
+    uint64_t vector;   /**< Children that are nodes. */
+    uint64_t leafvec;  /**< Children that start a run of equal leaves. */
+    uint32_t base0;    /**< Index of the first leaf. */
+    uint32_t base1;    /**< Index of the first child node. */
+} iptrie_node_t;
+
+/** A family (IPv4 or IPv6) of a trie. */
+typedef struct {
+    const iptrie_node_t *nodes;       /**< Nodes; the root is first. */
+    const uint32_t      *leaves;      /**< Leaf values; 0 for none. */
+    uint32_t             num_nodes;   /**< Number of nodes. */
+    uint32_t             num_leaves;  /**< Number of leaves. */
+} iptrie_family_t;
+
+/** See ib_iptrie_t. */
+struct ib_iptrie_t {
+    void            *image;      /**< Image. */
+    size_t           size;       /**< Image size. */
+    bool             mapped;     /**< Image is mapped, else malloced. */
+    iptrie_family_t  family[2];  /**< Families in the image. */
+};
+
+/** Round @a n up to a multiple of 8. */
+static size_t iptrie_align(size_t n)
+{
+    return (n + 7) & ~(size_t)7;
+}
+
+/**
+ * Compute the layout of an image.
+ *
+ * @param[in] header Header of the image.
+ * @param[out] nodes Offset of the nodes of each family.
+ * @param[out] leaves Offset of the leaves of each family.
+ *
+ * @returns The image size.
+ */
+static size_t iptrie_layout(
+    const iptrie_header_t *header,
+    size_t                 nodes[2],
+    size_t                 leaves[2]
+)
+{
+    size_t offset = iptrie_align(sizeof(*header));
+
+    for (int f = 0; f < 2; ++f) {
+        nodes[f] = offset;
+        offset += (size_t)header->num_nodes[f] * sizeof(iptrie_node_t);
+        leaves[f] = offset;
+        offset = iptrie_align(
+            offset + (size_t)header->num_leaves[f] * sizeof(uint32_t));
+    }
+
+    return offset;
+}
+
+/**
+ * Point the families of @a trie into its image.
+ *
+ * @param[in,out] trie Trie with @c image and @c size set.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EINVAL if the image is too small for its header.
+ */
+static ib_status_t iptrie_attach(ib_iptrie_t *trie)
+{
+    const iptrie_header_t *header = trie->image;
+    size_t nodes[2];
+    size_t leaves[2];
+
+    if (trie->size < sizeof(*header)) {
+        return IB_EINVAL;
+    }
+    if (iptrie_layout(header, nodes, leaves) != trie->size) {
+        return IB_EINVAL;
+    }
+
+    for (int f = 0; f < 2; ++f) {
+        trie->family[f].nodes =
+            (const iptrie_node_t *)((const char *)trie->image + nodes[f]);
+        trie->family[f].leaves =
+            (const uint32_t *)((const char *)trie->image + leaves[f]);
+        trie->family[f].num_nodes = header->num_nodes[f];
+        trie->family[f].num_leaves = header->num_leaves[f];
+    }
+
+    return IB_OK;
+}
+
+/* -- Query -- */
+
+/** Bits up to and including bit @a v. */
+static inline uint64_t iptrie_mask(unsigned v)
+{
+    /* For v = 63, 2 << 63 is 0, and the mask all ones. */
+    return (UINT64_C(2) << v) - 1;
+}
+
+/** Number of bits set in @a x. */
+static inline unsigned iptrie_popcount(uint64_t x)
+{
+    return __builtin_popcountll(x);
+}
+
+/**
+ * The IB_IPTRIE_STRIDE bits of @a key starting at bit @a offset.
+ *
+ * @param[in] key Address as 32 bit words, most significant first, followed
+ *                by a zero word.
+ * @param[in] offset Bit offset; bits past the address are zero.
+ */
+static inline unsigned iptrie_chunk(const uint32_t *key, size_t offset)
+{
+    size_t   w = offset / 32;
+    uint64_t bits = ((uint64_t)key[w] << 32) | key[w + 1];
+
+    return (bits >> (64 - IB_IPTRIE_STRIDE - offset % 32)) & 0x3f;
+}
+
+/**
+ * Find the value of @a key in @a family.
+ *
+ * @param[in] family Family.
+ * @param[in] key Address, as for iptrie_chunk().
+ *
+ * @returns The value, 0 if none.
+ */
+static uint32_t iptrie_lookup(
+    const iptrie_family_t *family,
+    const uint32_t        *key
+)
+{
+    const iptrie_node_t *node = &family->nodes[0];
+    size_t offset = 0;
+    unsigned v = iptrie_chunk(key, 0);
+
+    while (node->vector & (UINT64_C(1) << v)) {
+        node = &family->nodes[
+            node->base1 + iptrie_popcount(node->vector & iptrie_mask(v)) - 1
+        ];
+        offset += IB_IPTRIE_STRIDE;
+        v = iptrie_chunk(key, offset);
+    }
+
+    return family->leaves[
+        node->base0 + iptrie_popcount(node->leafvec & iptrie_mask(v)) - 1
+    ];
+}
+
+ib_status_t ib_iptrie_query4(
+    const ib_iptrie_t *trie,
+    ib_ip4_t           ip,
+    uint32_t          *value
+)
+{
+    assert(trie != NULL);
+
+    uint32_t key[5] = { ip, 0, 0, 0, 0 };
+    uint32_t found;
+
+    found = iptrie_lookup(&trie->family[IPTRIE_V4], key);
+    if (found == 0) {
+        return IB_ENOENT;
+    }
+    if (value != NULL) {
+        *value = found;
+    }
+
+    return IB_OK;
+}
+
+ib_status_t ib_iptrie_query6(
+    const ib_iptrie_t *trie,
+    const ib_ip6_t    *ip,
+    uint32_t          *value
+)
+{
+    assert(trie != NULL);
+    assert(ip   != NULL);
+
+    uint32_t key[5] = { ip->ip[0], ip->ip[1], ip->ip[2], ip->ip[3], 0 };
+    uint32_t found;
+
+    found = iptrie_lookup(&trie->family[IPTRIE_V6], key);
+    if (found == 0) {
+        return IB_ENOENT;
+    }
+    if (value != NULL) {
+        *value = found;
+    }
+
+    return IB_OK;
+}
+
+/* -- Builder -- */
+
+/** A node of the binary trie of a builder. */
+typedef struct {
+    uint32_t child[2];  /**< Children indices; 0 for none. */
+    uint32_t value;     /**< Value of the network ending here; 0 if none. */
+} iptrie_bnode_t;
+
+/** Binary trie of a family. */
+typedef struct {
+    iptrie_bnode_t *nodes;     /**< Nodes; the root is first. */
+    size_t          num_nodes; /**< Nodes in use. */
+    size_t          capacity;  /**< Nodes allocated. */
+} iptrie_btrie_t;
+
+/** See ib_iptrie_builder_t. */
+struct ib_iptrie_builder_t {
+    iptrie_btrie_t family[2];  /**< Binary tries of each family. */
+};
+
+/**
+ * Insert the first @a size bits of @a key with @a value.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on memory allocation failure.
+ */
+static ib_status_t iptrie_btrie_insert(
+    iptrie_btrie_t *btrie,
+    const uint32_t *key,
+    size_t          size,
+    uint32_t        value
+)
+{
+    uint32_t b = 0;
+
+    for (size_t i = 0; i < size; ++i) {
+        unsigned bit = (key[i / 32] >> (31 - i % 32)) & 1;
+
+        if (btrie->nodes[b].child[bit] == 0) {
+            if (btrie->num_nodes == btrie->capacity) {
+                size_t capacity = btrie->capacity * 2;
+                iptrie_bnode_t *nodes;
+
+                if (capacity > UINT32_MAX) {
+                    return IB_EALLOC;
+                }
+                nodes = realloc(btrie->nodes, capacity * sizeof(*nodes));
+                if (nodes == NULL) {
+                    return IB_EALLOC;
+                }
+                btrie->nodes = nodes;
+                btrie->capacity = capacity;
+            }
+            memset(&btrie->nodes[btrie->num_nodes], 0, sizeof(*btrie->nodes));
+            btrie->nodes[b].child[bit] = btrie->num_nodes++;
+        }
+        b = btrie->nodes[b].child[bit];
+    }
+    btrie->nodes[b].value = value;
+
+    return IB_OK;
+}
+
+ib_status_t ib_iptrie_builder_create(
+    ib_iptrie_builder_t **builder
+)
+{
+    assert(builder != NULL);
+
+    *builder = calloc(1, sizeof(**builder));
+    if (*builder == NULL) {
+        return IB_EALLOC;
+    }
+
+    for (int f = 0; f < 2; ++f) {
+        iptrie_btrie_t *btrie = &(*builder)->family[f];
+
+        btrie->capacity = 1024;
+        btrie->nodes = malloc(btrie->capacity * sizeof(*btrie->nodes));
+        if (btrie->nodes == NULL) {
+            ib_iptrie_builder_destroy(*builder);
+            *builder = NULL;
+            return IB_EALLOC;
+        }
+        memset(&btrie->nodes[0], 0, sizeof(*btrie->nodes));
+        btrie->num_nodes = 1;
+    }
+
+    return IB_OK;
+}
+
+void ib_iptrie_builder_destroy(
+    ib_iptrie_builder_t *builder
+)
+{
+    if (builder != NULL) {
+        free(builder->family[IPTRIE_V4].nodes);
+        free(builder->family[IPTRIE_V6].nodes);
+        free(builder);
+    }
+}
+
+ib_status_t ib_iptrie_builder_add4(
+    ib_iptrie_builder_t    *builder,
+    const ib_ip4_network_t *net,
+    uint32_t                value
+)
+{
+    assert(builder != NULL);
+    assert(net     != NULL);
+
+    uint32_t key[1] = { net->ip };
+
+    if (value == 0 || net->size > 32) {
+        return IB_EINVAL;
+    }
+
+    return iptrie_btrie_insert(
+        &builder->family[IPTRIE_V4], key, net->size, value);
+}
+
+ib_status_t ib_iptrie_builder_add6(
+    ib_iptrie_builder_t    *builder,
+    const ib_ip6_network_t *net,
+    uint32_t                value
+)
+{
+    assert(builder != NULL);
+    assert(net     != NULL);
+
+    if (value == 0 || net->size > 128) {
+        return IB_EINVAL;
+    }
+
+    return iptrie_btrie_insert(
+        &builder->family[IPTRIE_V6], net->ip.ip, net->size, value);
+}
+
+/**
+ * Parse and add a line of a list file.
+ *
+ * @param[in] builder Builder.
+ * @param[in,out] line Line, without its end of line; modified.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EINVAL if the line is not valid.
+ * - IB_EALLOC on memory allocation failure.
+ */
+static ib_status_t iptrie_builder_add_line(
+    ib_iptrie_builder_t *builder,
+    char                *line
+)
+{
+    ib_status_t rc;
+    char *net = line;
+    char *end;
+    unsigned long value = 1;
+
+    while (isspace((unsigned char)*net)) {
+        ++net;
+    }
+    if (*net == '\0' || *net == '#') {
+        return IB_OK;
+    }
+
+    end = net;
+    while (*end != '\0' && ! isspace((unsigned char)*end)) {
+        ++end;
+    }
+    if (*end != '\0') {
+        char *rest = end + 1;
+
+        *end = '\0';
+        while (isspace((unsigned char)*rest)) {
+            ++rest;
+        }
+        if (*rest != '\0') {
+            if (! isdigit((unsigned char)*rest)) {
+                return IB_EINVAL;
+            }
+            errno = 0;
+            value = strtoul(rest, &rest, 10);
+            if (errno != 0 || value == 0 || value > UINT32_MAX) {
+                return IB_EINVAL;
+            }
+            while (isspace((unsigned char)*rest)) {
+                ++rest;
+            }
+            if (*rest != '\0') {
+                return IB_EINVAL;
+            }
+        }
+    }
+
+    if (strchr(net, ':') != NULL) {
+        ib_ip6_network_t net6;
+
+        if (strchr(net, '/') != NULL) {
+            rc = ib_ip6_str_to_net(net, &net6);
+        }
+        else {
+            rc = ib_ip6_str_to_ip(net, &net6.ip);
+            net6.size = 128;
+        }
+        if (rc != IB_OK) {
+            return IB_EINVAL;
+        }
+        return ib_iptrie_builder_add6(builder, &net6, value);
+    }
+    else {
+        ib_ip4_network_t net4;
+
+        if (strchr(net, '/') != NULL) {
+            rc = ib_ip4_str_to_net(net, &net4);
+        }
+        else {
+            rc = ib_ip4_str_to_ip(net, &net4.ip);
+            net4.size = 32;
+        }
+        if (rc != IB_OK) {
+            return IB_EINVAL;
+        }
+        return ib_iptrie_builder_add4(builder, &net4, value);
+    }
+}
+
+ib_status_t ib_iptrie_builder_add_file(
+    ib_iptrie_builder_t *builder,
+    const char          *path,
+    size_t              *line
+)
+{
+    assert(builder != NULL);
+    assert(path    != NULL);
+
+    ib_status_t rc = IB_OK;
+    char buffer[256];
+    size_t lineno = 0;
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return IB_ENOENT;
+    }
+
+    while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+        size_t len = strlen(buffer);
+
+        ++lineno;
+        if (len > 0 && buffer[len - 1] == '\n') {
+            buffer[--len] = '\0';
+        }
+        else if (! feof(fp)) {
+            /* Longer than any valid line. */
+            rc = IB_EINVAL;
+            break;
+        }
+
+        rc = iptrie_builder_add_line(builder, buffer);
+        if (rc != IB_OK) {
+            break;
+        }
+    }
+    fclose(fp);
+
+    if (rc == IB_EINVAL && line != NULL) {
+        *line = lineno;
+    }
+
+    return rc;
+}
+
+/** Growable array of the image being built. */
+typedef struct {
+    void   *data;      /**< Elements. */
+    size_t  count;     /**< Elements in use. */
+    size_t  capacity;  /**< Elements allocated. */
+    size_t  size;      /**< Element size. */
+} iptrie_array_t;
+
+/**
+ * Append @a n zeroed elements to @a array.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on memory allocation failure or if the array would hold
+ *   more than UINT32_MAX elements.
+ */
+static ib_status_t iptrie_array_grow(iptrie_array_t *array, size_t n)
+{
+    if (array->count + n > array->capacity) {
+        size_t capacity = array->capacity == 0 ? 1024 : array->capacity;
+        void *data;
+
+        while (capacity < array->count + n) {
+            capacity *= 2;
+        }
+        if (capacity > UINT32_MAX) {
+            capacity = UINT32_MAX;
+            if (capacity < array->count + n) {
+                return IB_EALLOC;
+            }
+        }
+        data = realloc(array->data, capacity * array->size);
+        if (data == NULL) {
+            return IB_EALLOC;
+        }
+        array->data = data;
+        array->capacity = capacity;
+    }
+    memset((char *)array->data + array->count * array->size, 0,
+           n * array->size);
+    array->count += n;
+
+    return IB_OK;
+}
+
+/**
+ * Emit the node @a index for the binary trie node @a b.
+ *
+ * @param[in] btrie Binary trie.
+ * @param[in] b Binary trie node at a multiple of IB_IPTRIE_STRIDE bits.
+ * @param[in] inherited Value of the longest network above @a b.
+ * @param[in] index Index of the node to emit, already allocated.
+ * @param[in,out] nodes Nodes.
+ * @param[in,out] leaves Leaves.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on memory allocation failure.
+ */
+static ib_status_t iptrie_emit(
+    const iptrie_btrie_t *btrie,
+    uint32_t              b,
+    uint32_t              inherited,
+    uint32_t              index,
+    iptrie_array_t       *nodes,
+    iptrie_array_t       *leaves
+)
+{
+    ib_status_t rc;
+    uint32_t values[64];
+    uint32_t children[64];
+    unsigned num_children = 0;
+    uint64_t vector = 0;
+    uint64_t leafvec = 0;
+    uint32_t base0 = leaves->count;
+    uint32_t base1;
+    iptrie_node_t *node;
+
+    for (unsigned v = 0; v < 64; ++v) {
+        uint32_t c = b;
+        uint32_t value = inherited;
+
+        /* Index 0 is the root, which is never a child. */
+        for (int i = IB_IPTRIE_STRIDE - 1; i >= 0; --i) {
+            c = btrie->nodes[c].child[(v >> i) & 1];
+            if (c == 0) {
+                break;
+            }
+            if (btrie->nodes[c].value != 0) {
+                value = btrie->nodes[c].value;
+            }
+        }
+
+        if (
+            c != 0 &&
+            (btrie->nodes[c].child[0] != 0 || btrie->nodes[c].child[1] != 0)
+        ) {
+            vector |= UINT64_C(1) << v;
+            children[num_children] = c;
+            values[num_children] = value;
+            ++num_children;
+        }
+        else if (
+            leafvec == 0 ||
+            value != ((const uint32_t *)leaves->data)[leaves->count - 1]
+        ) {
+            leafvec |= UINT64_C(1) << v;
+            rc = iptrie_array_grow(leaves, 1);
+            if (rc != IB_OK) {
+                return rc;
+            }
+            ((uint32_t *)leaves->data)[leaves->count - 1] = value;
+        }
+    }
+
+    base1 = nodes->count;
+    rc = iptrie_array_grow(nodes, num_children);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    node = &((iptrie_node_t *)nodes->data)[index];
+    node->vector = vector;
+    node->leafvec = leafvec;
+    node->base0 = base0;
+    node->base1 = base1;
+
+    for (unsigned k = 0; k < num_children; ++k) {
+        rc = iptrie_emit(
+            btrie, children[k], values[k], base1 + k, nodes, leaves);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+
+    return IB_OK;
+}
+
+ib_status_t ib_iptrie_builder_finish(
+    const ib_iptrie_builder_t  *builder,
+    ib_iptrie_t               **trie
+)
+{
+    assert(builder != NULL);
+    assert(trie    != NULL);
+
+    ib_status_t rc = IB_OK;
+    iptrie_array_t nodes[2];
+    iptrie_array_t leaves[2];
+    iptrie_header_t header;
+    size_t nodes_offset[2];
+    size_t leaves_offset[2];
+    ib_iptrie_t *result = NULL;
+
+    memset(nodes, 0, sizeof(nodes));
+    memset(leaves, 0, sizeof(leaves));
+
+    for (int f = 0; f < 2; ++f) {
+        const iptrie_btrie_t *btrie = &builder->family[f];
+
+        nodes[f].size = sizeof(iptrie_node_t);
+        leaves[f].size = sizeof(uint32_t);
+
+        rc = iptrie_array_grow(&nodes[f], 1);
+        if (rc != IB_OK) {
+            goto finish;
+        }
+        rc = iptrie_emit(
+            btrie, 0, btrie->nodes[0].value, 0, &nodes[f], &leaves[f]);
+        if (rc != IB_OK) {
+            goto finish;
+        }
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, iptrie_magic, sizeof(header.magic));
+    header.version = IPTRIE_VERSION;
+    header.byte_order = IPTRIE_BYTE_ORDER;
+    for (int f = 0; f < 2; ++f) {
+        header.num_nodes[f] = nodes[f].count;
+        header.num_leaves[f] = leaves[f].count;
+    }
+
+    result = calloc(1, sizeof(*result));
+    if (result == NULL) {
+        rc = IB_EALLOC;
+        goto finish;
+    }
+    result->size = iptrie_layout(&header, nodes_offset, leaves_offset);
+    result->image = calloc(1, result->size);
+    if (result->image == NULL) {
+        free(result);
+        result = NULL;
+        rc = IB_EALLOC;
+        goto finish;
+    }
+    memcpy(result->image, &header, sizeof(header));
+    for (int f = 0; f < 2; ++f) {
+        memcpy((char *)result->image + nodes_offset[f],
+               nodes[f].data, nodes[f].count * nodes[f].size);
+        memcpy((char *)result->image + leaves_offset[f],
+               leaves[f].data, leaves[f].count * leaves[f].size);
+    }
+
+    rc = iptrie_attach(result);
+    assert(rc == IB_OK);
+    *trie = result;
+
+finish:
+    for (int f = 0; f < 2; ++f) {
+        free(nodes[f].data);
+        free(leaves[f].data);
+    }
+
+    return rc;
+}
+
+/* -- Image Files -- */
+
+ib_status_t ib_iptrie_write(
+    const ib_iptrie_t *trie,
+    const char        *path
+)
+{
+    assert(trie != NULL);
+    assert(path != NULL);
+
+    FILE *fp;
+    size_t written;
+
+    fp = fopen(path, "wb");
+    if (fp == NULL) {
+        return IB_EOTHER;
+    }
+    written = fwrite(trie->image, 1, trie->size, fp);
+    if (fclose(fp) != 0 || written != trie->size) {
+        return IB_EOTHER;
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Check that the families of @a trie are well formed.
+ *
+ * Queries of a well formed trie stay within its image: every child index
+ * is in bounds and greater than its parent's, nodes are no deeper than the
+ * address, and every leaf child is covered by a leaf run.
+ *
+ * @returns
+ * - IB_OK if @a trie is well formed.
+ * - IB_EINVAL if not.
+ * - IB_EALLOC on memory allocation failure.
+ */
+static ib_status_t iptrie_check(const ib_iptrie_t *trie)
+{
+    for (int f = 0; f < 2; ++f) {
+        const iptrie_family_t *family = &trie->family[f];
+        size_t max_depth =
+            (iptrie_bits[f] + IB_IPTRIE_STRIDE - 1) / IB_IPTRIE_STRIDE;
+        uint8_t *depth;
+
+        if (family->num_nodes == 0 || family->num_leaves == 0) {
+            return IB_EINVAL;
+        }
+
+        depth = calloc(family->num_nodes, sizeof(*depth));
+        if (depth == NULL) {
+            return IB_EALLOC;
+        }
+        depth[0] = 1;
+
+        for (uint32_t i = 0; i < family->num_nodes; ++i) {
+            const iptrie_node_t *node = &family->nodes[i];
+            uint64_t leaves = ~node->vector;
+            uint64_t num_children = iptrie_popcount(node->vector);
+
+            if (depth[i] == 0) {
+                /* Unreachable. */
+                continue;
+            }
+            if (
+                (node->leafvec & node->vector) != 0 ||
+                (leaves != 0 && (node->leafvec & (leaves & -leaves)) == 0) ||
+                (uint64_t)node->base0 + iptrie_popcount(node->leafvec) >
+                    family->num_leaves
+            ) {
+                free(depth);
+                return IB_EINVAL;
+            }
+            if (num_children == 0) {
+                continue;
+            }
+            if (
+                depth[i] >= max_depth ||
+                node->base1 <= i ||
+                (uint64_t)node->base1 + num_children > family->num_nodes
+            ) {
+                free(depth);
+                return IB_EINVAL;
+            }
+            for (uint64_t k = 0; k < num_children; ++k) {
+                if (depth[node->base1 + k] < depth[i] + 1) {
+                    depth[node->base1 + k] = depth[i] + 1;
+                }
+            }
+        }
+
+        free(depth);
+    }
+
+    return IB_OK;
+}
+
+bool ib_iptrie_is_image(
+    const char *path
+)
+{
+    assert(path != NULL);
+
+    char magic[sizeof(iptrie_magic)];
+    FILE *fp;
+    bool is_image;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    is_image =
+        fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+        memcmp(magic, iptrie_magic, sizeof(magic)) == 0;
+    fclose(fp);
+
+    return is_image;
+}
+
+ib_status_t ib_iptrie_load(
+    ib_iptrie_t **trie,
+    const char   *path
+)
+{
+    assert(trie != NULL);
+    assert(path != NULL);
+
+    ib_status_t rc;
+    const iptrie_header_t *header;
+    ib_iptrie_t *result;
+    struct stat st;
+    void *image;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return IB_ENOENT;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return IB_EOTHER;
+    }
+    if ((size_t)st.st_size < sizeof(*header)) {
+        close(fd);
+        return IB_EINVAL;
+    }
+    image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        return IB_EOTHER;
+    }
+
+    header = image;
+    if (
+        memcmp(header->magic, iptrie_magic, sizeof(header->magic)) != 0 ||
+        header->version != IPTRIE_VERSION ||
+        header->byte_order != IPTRIE_BYTE_ORDER
+    ) {
+        munmap(image, st.st_size);
+        return IB_EINVAL;
+    }
+
+    result = calloc(1, sizeof(*result));
+    if (result == NULL) {
+        munmap(image, st.st_size);
+        return IB_EALLOC;
+    }
+    result->image = image;
+    result->size = st.st_size;
+    result->mapped = true;
+
+    rc = iptrie_attach(result);
+    if (rc == IB_OK) {
+        rc = iptrie_check(result);
+    }
+    if (rc != IB_OK) {
+        ib_iptrie_destroy(result);
+        return rc;
+    }
+
+    *trie = result;
+
+    return IB_OK;
+}
+
+size_t ib_iptrie_size(
+    const ib_iptrie_t *trie
+)
+{
+    assert(trie != NULL);
+
+    return trie->size;
+}
+
+void ib_iptrie_destroy(
+    ib_iptrie_t *trie
+)
+{
+    if (trie != NULL) {
+        if (trie->mapped) {
+            munmap(trie->image, trie->size);
+        }
+        else {
+            free(trie->image);
+        }
+        free(trie);
+    }
+}
@@ -126,6 +126,7 @@ static ib_kvstore_value_t * kvstore_value_dup(
 
     /* Copy in all data. */
     new_value->expiration = value->expiration;
+    new_value->creation = value->creation;
 
     return new_value;
 
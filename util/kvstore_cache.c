@@ -0,0 +1,1200 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+/**
+ * @file
+ * @brief IronBee --- Key-Value Store Cache Implementation
+ *
+ * Keys are hashed to shards, each with its own lock, hash table, LRU list
+ * and list of pending (dirty) sets, oldest first.  An entry is a single
+ * allocation holding the key, the value and the type.  The backend is
+ * never called with a shard locked, except to write pending sets.
+ */
+
+#include "ironbee_config_auto.h"
+
+#include <ironbee/kvstore_cache.h>
+
+#include <ironbee/clock.h>
+#include <ironbee/lock.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Expected average entry size, used to size the hash tables. */
+#define CACHE_ENTRY_ESTIMATE 256
+
+/** Microseconds per second. */
+#define CACHE_USEC 1000000
+
+typedef struct cache_entry_t cache_entry_t;
+
+/** Cache entry. */
+struct cache_entry_t {
+    cache_entry_t *next;          /**< Bucket chain */
+    cache_entry_t *lru_prev;      /**< More recently used */
+    cache_entry_t *lru_next;      /**< Less recently used */
+    cache_entry_t *dirty_prev;    /**< Older pending set */
+    cache_entry_t *dirty_next;    /**< Newer pending set */
+    uint64_t       hash;          /**< Hash of the key */
+    size_t         cost;          /**< Bytes charged to the shard */
+    ib_time_t      expires;       /**< Value expiration; 0 for never */
+    ib_time_t      stale;         /**< Refetch time; 0 for never */
+    ib_time_t      dirty_since;   /**< Time the pending set was made */
+    bool           negative;      /**< Key is known to be missing */
+    bool           dirty;         /**< Set not written to the backend */
+    ib_kvstore_merge_policy_fn_t merge_policy; /**< Of the pending set */
+    ib_kvstore_value_t value;     /**< Value, pointing into data */
+    size_t         key_length;    /**< Key length */
+    uint8_t        data[];        /**< Key, value, type and NUL */
+};
+
+/** Cache shard. */
+typedef struct {
+    ib_lock_t       lock;         /**< Protects the shard */
+    cache_entry_t **buckets;      /**< Hash table */
+    size_t          nbuckets;     /**< Size of buckets; a power of 2 */
+    cache_entry_t  *lru_head;     /**< Most recently used */
+    cache_entry_t  *lru_tail;     /**< Least recently used */
+    cache_entry_t  *dirty_head;   /**< Oldest pending set */
+    cache_entry_t  *dirty_tail;   /**< Newest pending set */
+    size_t          bytes;        /**< Bytes used */
+    size_t          limit;        /**< Bytes allowed */
+    ib_kvstore_cache_stats_t stats; /**< Counters */
+} cache_shard_t;
+
+/** The cache server object. */
+typedef struct {
+    ib_kvstore_t              *backend; /**< Cached kvstore */
+    ib_kvstore_cache_config_t  config;  /**< Configuration */
+    cache_shard_t             *shards;  /**< Shards */
+} cache_server_t;
+
+void ib_kvstore_cache_config_default(ib_kvstore_cache_config_t *config)
+{
+    assert(config != NULL);
+
+    config->max_bytes = 4 * 1024 * 1024;
+    config->shards = 16;
+    config->max_age = 5;
+    config->negative_ttl = 5;
+    config->write_delay = 0;
+    config->stale_if_error = 0;
+    config->merge_policy = NULL;
+}
+
+/**
+ * Hash a key (64 bit FNV-1a).
+ *
+ * @param[in] key Key.
+ * @returns Hash of @a key.
+ */
+static uint64_t cache_hash(const ib_kvstore_key_t *key)
+{
+    const uint8_t *p = (const uint8_t *)key->key;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < key->length; ++i) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Shard of a hash.
+ *
+ * @param[in] server Server.
+ * @param[in] hash Key hash.
+ * @returns The shard.
+ */
+static cache_shard_t *cache_shard_of(cache_server_t *server, uint64_t hash)
+{
+    return &server->shards[hash % server->config.shards];
+}
+
+/**
+ * Bucket of a hash.
+ *
+ * @param[in] shard Shard.
+ * @param[in] hash Key hash.
+ * @returns The bucket.
+ */
+static cache_entry_t **cache_bucket_of(cache_shard_t *shard, uint64_t hash)
+{
+    return &shard->buckets[(hash >> 32) & (shard->nbuckets - 1)];
+}
+
+/**
+ * Find an entry.
+ *
+ * @param[in] shard Shard.
+ * @param[in] hash Key hash.
+ * @param[in] key Key.
+ * @returns The entry or NULL.
+ */
+static cache_entry_t *cache_find(
+    cache_shard_t *shard,
+    uint64_t hash,
+    const ib_kvstore_key_t *key)
+{
+    cache_entry_t *entry;
+
+    for (entry = *cache_bucket_of(shard, hash);
+         entry != NULL;
+         entry = entry->next)
+    {
+        if ( (entry->hash == hash) &&
+             (entry->key_length == key->length) &&
+             (memcmp(entry->data, key->key, key->length) == 0) )
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Remove an entry from the shard's LRU list.
+ *
+ * @param[in] shard Shard.
+ * @param[in] entry Entry.
+ */
+static void cache_lru_unlink(cache_shard_t *shard, cache_entry_t *entry)
+{
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    }
+    else {
+        shard->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    }
+    else {
+        shard->lru_tail = entry->lru_prev;
+    }
+}
+
+/**
+ * Make an entry the most recently used of the shard.
+ *
+ * @param[in] shard Shard.
+ * @param[in] entry Entry, not on the LRU list.
+ */
+static void cache_lru_push(cache_shard_t *shard, cache_entry_t *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = shard->lru_head;
+    if (shard->lru_head != NULL) {
+        shard->lru_head->lru_prev = entry;
+    }
+    else {
+        shard->lru_tail = entry;
+    }
+    shard->lru_head = entry;
+}
+
+/**
+ * Remove an entry from the shard's pending sets and mark it clean.
+ *
+ * @param[in] shard Shard.
+ * @param[in] entry Dirty entry.
+ */
+static void cache_dirty_unlink(cache_shard_t *shard, cache_entry_t *entry)
+{
+    assert(entry->dirty);
+
+    if (entry->dirty_prev != NULL) {
+        entry->dirty_prev->dirty_next = entry->dirty_next;
+    }
+    else {
+        shard->dirty_head = entry->dirty_next;
+    }
+    if (entry->dirty_next != NULL) {
+        entry->dirty_next->dirty_prev = entry->dirty_prev;
+    }
+    else {
+        shard->dirty_tail = entry->dirty_prev;
+    }
+    entry->dirty = false;
+}
+
+/**
+ * Make an entry the newest pending set of the shard.
+ *
+ * @param[in] shard Shard.
+ * @param[in] entry Clean entry.
+ * @param[in] now Current time.
+ */
+static void cache_dirty_push(
+    cache_shard_t *shard,
+    cache_entry_t *entry,
+    ib_time_t now)
+{
+    assert(! entry->dirty);
+
+    entry->dirty = true;
+    entry->dirty_since = now;
+    entry->dirty_next = NULL;
+    entry->dirty_prev = shard->dirty_tail;
+    if (shard->dirty_tail != NULL) {
+        shard->dirty_tail->dirty_next = entry;
+    }
+    else {
+        shard->dirty_head = entry;
+    }
+    shard->dirty_tail = entry;
+}
+
+/**
+ * Give a new entry the place of a dirty entry in the shard's pending sets.
+ *
+ * @param[in] shard Shard.
+ * @param[in] old Dirty entry; marked clean.
+ * @param[in] entry New entry, not yet in the shard.
+ */
+static void cache_dirty_replace(
+    cache_shard_t *shard,
+    cache_entry_t *old,
+    cache_entry_t *entry)
+{
+    assert(old->dirty);
+
+    entry->dirty = true;
+    entry->dirty_since = old->dirty_since;
+    entry->dirty_prev = old->dirty_prev;
+    entry->dirty_next = old->dirty_next;
+    if (entry->dirty_prev != NULL) {
+        entry->dirty_prev->dirty_next = entry;
+    }
+    else {
+        shard->dirty_head = entry;
+    }
+    if (entry->dirty_next != NULL) {
+        entry->dirty_next->dirty_prev = entry;
+    }
+    else {
+        shard->dirty_tail = entry;
+    }
+    old->dirty = false;
+}
+
+/**
+ * Unlink an entry from the shard and free it.
+ *
+ * @param[in] shard Shard.
+ * @param[in] entry Entry.
+ */
+static void cache_entry_remove(cache_shard_t *shard, cache_entry_t *entry)
+{
+    cache_entry_t **link = cache_bucket_of(shard, entry->hash);
+
+    while (*link != entry) {
+        assert(*link != NULL);
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+
+    cache_lru_unlink(shard, entry);
+    if (entry->dirty) {
+        cache_dirty_unlink(shard, entry);
+    }
+    shard->bytes -= entry->cost;
+    free(entry);
+}
+
+/**
+ * Link a new entry into the shard.
+ *
+ * @param[in] shard Shard.
+ * @param[in] entry Entry; its key must not be in the shard.
+ */
+static void cache_entry_insert(cache_shard_t *shard, cache_entry_t *entry)
+{
+    cache_entry_t **bucket = cache_bucket_of(shard, entry->hash);
+
+    entry->next = *bucket;
+    *bucket = entry;
+    cache_lru_push(shard, entry);
+    shard->bytes += entry->cost;
+}
+
+/**
+ * Create an entry.
+ *
+ * @param[in] hash Key hash.
+ * @param[in] key Key.
+ * @param[in] value Value, or NULL for a negative entry.
+ * @param[in] now Current time.
+ *
+ * @returns The entry or NULL on allocation failure.
+ */
+static cache_entry_t *cache_entry_create(
+    uint64_t hash,
+    const ib_kvstore_key_t *key,
+    const ib_kvstore_value_t *value,
+    ib_time_t now)
+{
+    size_t value_length = (value == NULL) ? 0 : value->value_length;
+    size_t type_length = (value == NULL || value->type == NULL) ?
+                         0 : value->type_length;
+    size_t size = sizeof(cache_entry_t) + key->length + value_length +
+                  type_length + 1;
+    cache_entry_t *entry = malloc(size);
+
+    if (entry == NULL) {
+        return NULL;
+    }
+    memset(entry, 0, sizeof(*entry));
+
+    entry->hash = hash;
+    entry->cost = size;
+    entry->key_length = key->length;
+    memcpy(entry->data, key->key, key->length);
+
+    entry->value.value = entry->data + key->length;
+    entry->value.value_length = value_length;
+    entry->value.type = (char *)entry->data + key->length + value_length;
+    entry->value.type_length = type_length;
+    if (value != NULL) {
+        memcpy(entry->value.value, value->value, value_length);
+        if (type_length > 0) {
+            memcpy(entry->value.type, value->type, type_length);
+        }
+        entry->value.creation = value->creation;
+        if (value->expiration > 0) {
+            entry->expires = now + (ib_time_t)value->expiration * CACHE_USEC;
+        }
+    }
+    else {
+        entry->negative = true;
+    }
+    entry->value.type[type_length] = '\0';
+
+    return entry;
+}
+
+/**
+ * Set an entry's refetch time.
+ *
+ * @param[in] entry Entry.
+ * @param[in] ttl Seconds the entry may be used; 0 for no limit.
+ * @param[in] now Current time.
+ */
+static void cache_entry_ttl(cache_entry_t *entry, uint32_t ttl, ib_time_t now)
+{
+    entry->stale = (ttl == 0) ? 0 : now + (ib_time_t)ttl * CACHE_USEC;
+}
+
+/**
+ * Seconds until an entry's value expires.
+ *
+ * @param[in] entry Entry.
+ * @param[in] now Current time.
+ * @returns Seconds, rounded up; 0 if the value does not expire.
+ */
+static uint32_t cache_entry_expiration(
+    const cache_entry_t *entry,
+    ib_time_t now)
+{
+    if (entry->expires == 0) {
+        return 0;
+    }
+    if (entry->expires <= now) {
+        return 1;
+    }
+    return (uint32_t)((entry->expires - now + CACHE_USEC - 1) / CACHE_USEC);
+}
+
+/**
+ * Write an entry's pending set to the backend.
+ *
+ * Expired values are dropped rather than written.
+ *
+ * @param[in] server Server.
+ * @param[in] shard Shard.
+ * @param[in] entry Dirty entry; marked clean on success.
+ * @param[in] now Current time.
+ *
+ * @returns Status of the backend set.
+ */
+static ib_status_t cache_write(
+    cache_server_t *server,
+    cache_shard_t *shard,
+    cache_entry_t *entry,
+    ib_time_t now)
+{
+    ib_kvstore_key_t key;
+    ib_kvstore_value_t value;
+    ib_status_t rc;
+
+    if ( (entry->expires != 0) && (entry->expires <= now) ) {
+        cache_dirty_unlink(shard, entry);
+        return IB_OK;
+    }
+
+    key.key = entry->data;
+    key.length = entry->key_length;
+    value = entry->value;
+    value.expiration = cache_entry_expiration(entry, now);
+
+    rc = ib_kvstore_set(server->backend, entry->merge_policy, &key, &value);
+    if (rc != IB_OK) {
+        ++shard->stats.write_errors;
+        return rc;
+    }
+    ++shard->stats.writes;
+    cache_dirty_unlink(shard, entry);
+    cache_entry_ttl(entry, server->config.max_age, now);
+
+    return IB_OK;
+}
+
+/**
+ * Write the shard's pending sets that are due.
+ *
+ * @param[in] server Server.
+ * @param[in] shard Shard.
+ * @param[in] now Current time.
+ * @param[in] all Write all pending sets, due or not.
+ *
+ * @returns The first backend error, or IB_OK.
+ */
+static ib_status_t cache_write_due(
+    cache_server_t *server,
+    cache_shard_t *shard,
+    ib_time_t now,
+    bool all)
+{
+    ib_time_t delay = (ib_time_t)server->config.write_delay * CACHE_USEC;
+    cache_entry_t *entry;
+    ib_status_t first_rc = IB_OK;
+    ib_status_t rc;
+
+    /* The list is in order of dirty_since; failures are requeued. */
+    while ( ((entry = shard->dirty_head) != NULL) &&
+            (all || entry->dirty_since + delay <= now) )
+    {
+        if (entry->dirty_since > now) {
+            /* Requeued by this pass. */
+            break;
+        }
+        rc = cache_write(server, shard, entry, now);
+        if (rc != IB_OK) {
+            if (first_rc == IB_OK) {
+                first_rc = rc;
+            }
+            cache_dirty_unlink(shard, entry);
+            cache_dirty_push(shard, entry, now + 1);
+            if (! all) {
+                break;
+            }
+        }
+    }
+
+    return first_rc;
+}
+
+/**
+ * Evict least recently used entries until @a cost more bytes fit.
+ *
+ * Pending sets of evicted entries are written first.
+ *
+ * @param[in] server Server.
+ * @param[in] shard Shard.
+ * @param[in] cost Bytes needed.
+ * @param[in] now Current time.
+ */
+static void cache_make_room(
+    cache_server_t *server,
+    cache_shard_t *shard,
+    size_t cost,
+    ib_time_t now)
+{
+    while ( (shard->bytes + cost > shard->limit) &&
+            (shard->lru_tail != NULL) )
+    {
+        cache_entry_t *entry = shard->lru_tail;
+
+        if (entry->dirty) {
+            /* A failed write is counted and the set is lost. */
+            cache_write(server, shard, entry, now);
+        }
+        cache_entry_remove(shard, entry);
+        ++shard->stats.evictions;
+    }
+}
+
+/**
+ * Replace the shard's entry for a key, if any, with a new entry.
+ *
+ * @param[in] server Server.
+ * @param[in] shard Shard.
+ * @param[in] entry New entry.
+ * @param[in] now Current time.
+ */
+static void cache_entry_replace(
+    cache_server_t *server,
+    cache_shard_t *shard,
+    cache_entry_t *entry,
+    ib_time_t now)
+{
+    ib_kvstore_key_t key;
+    cache_entry_t *old;
+
+    key.key = entry->data;
+    key.length = entry->key_length;
+    old = cache_find(shard, entry->hash, &key);
+    if (old != NULL) {
+        cache_entry_remove(shard, old);
+    }
+    cache_make_room(server, shard, entry->cost, now);
+    cache_entry_insert(shard, entry);
+}
+
+/**
+ * Copy a value for return from a get.
+ *
+ * @param[in] kvstore The cache.
+ * @param[in] src Value.
+ * @param[in] expiration Expiration to return.
+ * @param[out] values Array of one value.
+ * @param[out] values_length 1.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on allocation failure.
+ */
+static ib_status_t cache_value_out(
+    ib_kvstore_t *kvstore,
+    const ib_kvstore_value_t *src,
+    uint32_t expiration,
+    ib_kvstore_value_t ***values,
+    size_t *values_length)
+{
+    ib_kvstore_value_t **array;
+    ib_kvstore_value_t *value;
+
+    array = kvstore->malloc(kvstore, sizeof(*array), kvstore->malloc_cbdata);
+    value = kvstore->malloc(kvstore, sizeof(*value), kvstore->malloc_cbdata);
+    if ( (array == NULL) || (value == NULL) ) {
+        goto failure;
+    }
+    memset(value, 0, sizeof(*value));
+
+    value->value = kvstore->malloc(
+        kvstore,
+        src->value_length > 0 ? src->value_length : 1,
+        kvstore->malloc_cbdata);
+    value->type = kvstore->malloc(
+        kvstore,
+        src->type_length + 1,
+        kvstore->malloc_cbdata);
+    if ( (value->value == NULL) || (value->type == NULL) ) {
+        goto failure;
+    }
+
+    if (src->value_length > 0) {
+        memcpy(value->value, src->value, src->value_length);
+    }
+    value->value_length = src->value_length;
+    if (src->type_length > 0) {
+        memcpy(value->type, src->type, src->type_length);
+    }
+    value->type[src->type_length] = '\0';
+    value->type_length = src->type_length;
+    value->expiration = expiration;
+    value->creation = src->creation;
+
+    array[0] = value;
+    *values = array;
+    *values_length = 1;
+    return IB_OK;
+
+failure:
+    if (value != NULL) {
+        if (value->value != NULL) {
+            kvstore->free(kvstore, value->value, kvstore->free_cbdata);
+        }
+        if (value->type != NULL) {
+            kvstore->free(kvstore, value->type, kvstore->free_cbdata);
+        }
+        kvstore->free(kvstore, value, kvstore->free_cbdata);
+    }
+    if (array != NULL) {
+        kvstore->free(kvstore, array, kvstore->free_cbdata);
+    }
+    return IB_EALLOC;
+}
+
+static ib_status_t kvconnect(
+    ib_kvstore_t *kvstore,
+    ib_kvstore_cbdata_t *cbdata)
+{
+    assert(kvstore);
+
+    cache_server_t *server = (cache_server_t *)kvstore->server;
+
+    return ib_kvstore_connect(server->backend);
+}
+
+static ib_status_t kvdisconnect(
+    ib_kvstore_t *kvstore,
+    ib_kvstore_cbdata_t *cbdata)
+{
+    assert(kvstore);
+
+    cache_server_t *server = (cache_server_t *)kvstore->server;
+
+    ib_kvstore_cache_flush(kvstore);
+
+    return ib_kvstore_disconnect(server->backend);
+}
+
+/**
+ * Remove the stale entry of a key that the backend no longer has.
+ *
+ * @param[in] server Server.
+ * @param[in] shard Shard of @a key, not locked.
+ * @param[in] hash Key hash.
+ * @param[in] key Key.
+ */
+static void cache_stale_remove(
+    cache_server_t *server,
+    cache_shard_t *shard,
+    uint64_t hash,
+    const ib_kvstore_key_t *key)
+{
+    cache_entry_t *entry;
+
+    if ( (server->config.stale_if_error == 0) ||
+         (ib_lock_lock(&shard->lock) != IB_OK) )
+    {
+        return;
+    }
+    entry = cache_find(shard, hash, key);
+    if ( (entry != NULL) && (! entry->dirty) ) {
+        cache_entry_remove(shard, entry);
+    }
+    ib_lock_unlock(&shard->lock);
+}
+
+/**
+ * Answer a get with a stale entry after the backend failed.
+ *
+ * @param[in] kvstore The cache.
+ * @param[in] shard Shard of @a key, not locked.
+ * @param[in] hash Key hash.
+ * @param[in] key Key.
+ * @param[in] now Current time.
+ * @param[in] error Error of the backend.
+ * @param[out] values Result array.
+ * @param[out] values_length Length of @a values.
+ *
+ * @returns
+ *   - IB_OK or IB_ENOENT if a stale entry was used.
+ *   - @a error otherwise.
+ */
+static ib_status_t cache_stale_out(
+    ib_kvstore_t *kvstore,
+    cache_shard_t *shard,
+    uint64_t hash,
+    const ib_kvstore_key_t *key,
+    ib_time_t now,
+    ib_status_t error,
+    ib_kvstore_value_t ***values,
+    size_t *values_length)
+{
+    cache_server_t *server = (cache_server_t *)kvstore->server;
+    ib_time_t limit = (ib_time_t)server->config.stale_if_error * CACHE_USEC;
+    cache_entry_t *entry;
+    ib_status_t rc = error;
+
+    if ( (limit == 0) || (ib_lock_lock(&shard->lock) != IB_OK) ) {
+        return error;
+    }
+
+    entry = cache_find(shard, hash, key);
+    if ( (entry != NULL) &&
+         ( (entry->expires == 0) || (entry->expires > now) ) &&
+         ( (entry->stale == 0) || (entry->stale + limit >= now) ) )
+    {
+        ++shard->stats.stale_hits;
+        if (entry->negative) {
+            rc = IB_ENOENT;
+        }
+        else {
+            rc = cache_value_out(kvstore, &entry->value,
+                                 cache_entry_expiration(entry, now),
+                                 values, values_length);
+        }
+    }
+    ib_lock_unlock(&shard->lock);
+
+    return rc;
+}
+
+/**
+ * Get callback.
+ *
+ * @param[in] kvstore The cache.
+ * @param[in] key The key to fetch.
+ * @param[out] values The value, if found, as an array of length 1.
+ * @param[out] values_length The length of @a values.
+ * @param[in,out] cbdata Callback data for the user.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_ENOENT if the key is not found.
+ *   - IB_EALLOC on memory allocation error.
+ *   - IB_EUNKNOWN if the shard could not be locked.
+ *   - Errors of the backend get.
+ */
+static ib_status_t kvget(
+    ib_kvstore_t *kvstore,
+    const ib_kvstore_key_t *key,
+    ib_kvstore_value_t ***values,
+    size_t *values_length,
+    ib_kvstore_cbdata_t *cbdata)
+{
+    assert(kvstore);
+    assert(key);
+    assert(values);
+    assert(values_length);
+
+    cache_server_t *server = (cache_server_t *)kvstore->server;
+    uint64_t hash = cache_hash(key);
+    cache_shard_t *shard = cache_shard_of(server, hash);
+    ib_time_t now = ib_clock_get_time();
+    ib_kvstore_value_t *fetched;
+    cache_entry_t *entry;
+    ib_status_t rc;
+
+    *values = NULL;
+    *values_length = 0;
+
+    rc = ib_lock_lock(&shard->lock);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    cache_write_due(server, shard, now, false);
+
+    entry = cache_find(shard, hash, key);
+    if (entry != NULL) {
+        if ( (entry->expires != 0) && (entry->expires <= now) ) {
+            cache_entry_remove(shard, entry);
+            ++shard->stats.expirations;
+            entry = NULL;
+        }
+        else if ( (! entry->dirty) &&
+                  (entry->stale != 0) &&
+                  (entry->stale <= now) )
+        {
+            /* Kept to fall back to if the fetch fails. */
+            if (server->config.stale_if_error == 0) {
+                cache_entry_remove(shard, entry);
+            }
+            entry = NULL;
+        }
+    }
+
+    if (entry != NULL) {
+        cache_lru_unlink(shard, entry);
+        cache_lru_push(shard, entry);
+        if (entry->negative) {
+            ++shard->stats.negative_hits;
+            rc = IB_ENOENT;
+        }
+        else {
+            ++shard->stats.hits;
+            rc = cache_value_out(kvstore, &entry->value,
+                                 cache_entry_expiration(entry, now),
+                                 values, values_length);
+        }
+        ib_lock_unlock(&shard->lock);
+        return rc;
+    }
+
+    ++shard->stats.misses;
+    ib_lock_unlock(&shard->lock);
+
+    /* Fetch and merge without holding the lock. */
+    rc = ib_kvstore_get(server->backend, server->config.merge_policy,
+                        key, &fetched);
+    if (rc == IB_ENOENT) {
+        if (server->config.negative_ttl == 0) {
+            cache_stale_remove(server, shard, hash, key);
+            return IB_ENOENT;
+        }
+        fetched = NULL;
+    }
+    else if (rc != IB_OK) {
+        return cache_stale_out(kvstore, shard, hash, key, now, rc,
+                               values, values_length);
+    }
+    else {
+        rc = cache_value_out(kvstore, fetched, fetched->expiration,
+                             values, values_length);
+        if (rc != IB_OK) {
+            ib_kvstore_free_value(server->backend, fetched);
+            return rc;
+        }
+    }
+
+    entry = cache_entry_create(hash, key, fetched, now);
+    if (fetched != NULL) {
+        ib_kvstore_free_value(server->backend, fetched);
+    }
+    if ( (entry == NULL) || (entry->cost > shard->limit) ) {
+        /* Not cached; the result is still good. */
+        free(entry);
+        return (*values_length > 0) ? IB_OK : IB_ENOENT;
+    }
+    cache_entry_ttl(entry,
+                    entry->negative ?
+                        server->config.negative_ttl : server->config.max_age,
+                    now);
+
+    if (ib_lock_lock(&shard->lock) != IB_OK) {
+        free(entry);
+        return (*values_length > 0) ? IB_OK : IB_ENOENT;
+    }
+    {
+        /* Don't replace a set made while fetching. */
+        cache_entry_t *current = cache_find(shard, hash, key);
+        if ( (current != NULL) && current->dirty ) {
+            free(entry);
+        }
+        else {
+            cache_entry_replace(server, shard, entry, now);
+        }
+    }
+    ib_lock_unlock(&shard->lock);
+
+    return (*values_length > 0) ? IB_OK : IB_ENOENT;
+}
+
+/**
+ * Set callback.
+ *
+ * @param[in] kvstore The cache.
+ * @param[in] merge_policy Passed to the backend set.
+ * @param[in] key The key to set.
+ * @param[in] value The value to write.
+ * @param[in,out] cbdata Callback data for the user.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on memory allocation error.
+ *   - IB_EUNKNOWN if the shard could not be locked.
+ *   - Errors of the backend set, when writing through.
+ */
+static ib_status_t kvset(
+    ib_kvstore_t *kvstore,
+    ib_kvstore_merge_policy_fn_t merge_policy,
+    const ib_kvstore_key_t *key,
+    ib_kvstore_value_t *value,
+    ib_kvstore_cbdata_t *cbdata)
+{
+    assert(kvstore);
+    assert(key);
+    assert(value);
+
+    cache_server_t *server = (cache_server_t *)kvstore->server;
+    uint64_t hash = cache_hash(key);
+    cache_shard_t *shard = cache_shard_of(server, hash);
+    ib_time_t now = ib_clock_get_time();
+    bool write_through = (server->config.write_delay == 0);
+    cache_entry_t *entry;
+    cache_entry_t *old;
+    ib_status_t rc;
+
+    if (write_through) {
+        rc = ib_kvstore_set(server->backend, merge_policy, key, value);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+
+    entry = cache_entry_create(hash, key, value, now);
+    if (entry == NULL) {
+        return IB_EALLOC;
+    }
+    entry->value.creation.tv_sec = now / CACHE_USEC;
+    entry->value.creation.tv_usec = now % CACHE_USEC;
+    entry->merge_policy = merge_policy;
+    cache_entry_ttl(entry, server->config.max_age, now);
+
+    rc = ib_lock_lock(&shard->lock);
+    if (rc != IB_OK) {
+        free(entry);
+        return rc;
+    }
+
+    old = cache_find(shard, hash, key);
+    if (entry->cost > shard->limit) {
+        /* Too big to cache; drop any older value, and write it now. */
+        if (old != NULL) {
+            cache_entry_remove(shard, old);
+        }
+        free(entry);
+        ib_lock_unlock(&shard->lock);
+        return write_through ?
+               IB_OK :
+               ib_kvstore_set(server->backend, merge_policy, key, value);
+    }
+
+    if (write_through) {
+        ++shard->stats.writes;
+    }
+    else if ( (old != NULL) && old->dirty ) {
+        /* Coalesce with the pending set, keeping its place in line. */
+        cache_dirty_replace(shard, old, entry);
+        ++shard->stats.coalesced;
+    }
+    cache_entry_replace(server, shard, entry, now);
+    if ( (! write_through) && (! entry->dirty) ) {
+        cache_dirty_push(shard, entry, now);
+    }
+    cache_write_due(server, shard, now, false);
+
+    ib_lock_unlock(&shard->lock);
+
+    return IB_OK;
+}
+
+/**
+ * Remove callback.
+ *
+ * @param[in] kvstore The cache.
+ * @param[in] key The key to remove.
+ * @param[in,out] cbdata Callback data.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EUNKNOWN if the shard could not be locked.
+ *   - Errors of the backend remove.
+ */
+static ib_status_t kvremove(
+    ib_kvstore_t *kvstore,
+    const ib_kvstore_key_t *key,
+    ib_kvstore_cbdata_t *cbdata)
+{
+    assert(kvstore);
+    assert(key);
+
+    cache_server_t *server = (cache_server_t *)kvstore->server;
+    uint64_t hash = cache_hash(key);
+    cache_shard_t *shard = cache_shard_of(server, hash);
+    cache_entry_t *entry;
+    ib_status_t rc;
+
+    rc = ib_lock_lock(&shard->lock);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    entry = cache_find(shard, hash, key);
+    if (entry != NULL) {
+        /* Also drops a pending set. */
+        cache_entry_remove(shard, entry);
+    }
+    ib_lock_unlock(&shard->lock);
+
+    return ib_kvstore_remove(server->backend, key);
+}
+
+/**
+ * Destroy the cache, writing pending sets.
+ *
+ * @param[in] kvstore The cache.
+ * @param[in] cbdata Unused.
+ */
+static void kvdestroy(ib_kvstore_t *kvstore, ib_kvstore_cbdata_t *cbdata)
+{
+    assert(kvstore);
+
+    cache_server_t *server = (cache_server_t *)kvstore->server;
+    size_t s;
+
+    ib_kvstore_cache_flush(kvstore);
+
+    for (s = 0; s < server->config.shards; ++s) {
+        cache_shard_t *shard = &server->shards[s];
+
+        while (shard->lru_head != NULL) {
+            cache_entry_remove(shard, shard->lru_head);
+        }
+        free(shard->buckets);
+        ib_lock_destroy(&shard->lock);
+    }
+    free(server->shards);
+    free(server);
+    kvstore->server = NULL;
+}
+
+ib_status_t ib_kvstore_cache_init(
+    ib_kvstore_t *kvstore,
+    ib_kvstore_t *backend,
+    const ib_kvstore_cache_config_t *config)
+{
+    assert(kvstore != NULL);
+    assert(backend != NULL);
+
+    cache_server_t *server;
+    size_t nbuckets;
+    size_t s;
+    ib_status_t rc;
+
+    server = calloc(1, sizeof(*server));
+    if (server == NULL) {
+        return IB_EALLOC;
+    }
+    if (config != NULL) {
+        server->config = *config;
+    }
+    else {
+        ib_kvstore_cache_config_default(&server->config);
+    }
+    if ( (server->config.max_bytes == 0) || (server->config.shards == 0) ) {
+        free(server);
+        return IB_EINVAL;
+    }
+    server->backend = backend;
+
+    server->shards = calloc(server->config.shards, sizeof(cache_shard_t));
+    if (server->shards == NULL) {
+        free(server);
+        return IB_EALLOC;
+    }
+
+    /* Size the tables for about one entry per bucket. */
+    nbuckets = 16;
+    while ( (nbuckets < 65536) &&
+            (nbuckets * CACHE_ENTRY_ESTIMATE * server->config.shards <
+             server->config.max_bytes) )
+    {
+        nbuckets *= 2;
+    }
+
+    for (s = 0; s < server->config.shards; ++s) {
+        cache_shard_t *shard = &server->shards[s];
+
+        shard->limit = server->config.max_bytes / server->config.shards;
+        shard->nbuckets = nbuckets;
+        shard->buckets = calloc(nbuckets, sizeof(*shard->buckets));
+        if (shard->buckets == NULL) {
+            rc = IB_EALLOC;
+            goto failure;
+        }
+        rc = ib_lock_init(&shard->lock);
+        if (rc != IB_OK) {
+            free(shard->buckets);
+            goto failure;
+        }
+    }
+
+    ib_kvstore_init(kvstore);
+    kvstore->server = (ib_kvstore_server_t *)server;
+    kvstore->get = kvget;
+    kvstore->set = kvset;
+    kvstore->remove = kvremove;
+    kvstore->connect = kvconnect;
+    kvstore->disconnect = kvdisconnect;
+    kvstore->destroy = kvdestroy;
+
+    kvstore->malloc_cbdata = NULL;
+    kvstore->free_cbdata = NULL;
+    kvstore->connect_cbdata = NULL;
+    kvstore->disconnect_cbdata = NULL;
+    kvstore->get_cbdata = NULL;
+    kvstore->set_cbdata = NULL;
+    kvstore->remove_cbdata = NULL;
+    kvstore->merge_policy_cbdata = NULL;
+    kvstore->destroy_cbdata = NULL;
+
+    return IB_OK;
+
+failure:
+    while (s-- > 0) {
+        free(server->shards[s].buckets);
+        ib_lock_destroy(&server->shards[s].lock);
+    }
+    free(server->shards);
+    free(server);
+    return rc;
+}
+
+ib_status_t ib_kvstore_cache_flush(ib_kvstore_t *kvstore)
+{
+    assert(kvstore != NULL);
+
+    cache_server_t *server = (cache_server_t *)kvstore->server;
+    ib_time_t now = ib_clock_get_time();
+    ib_status_t first_rc = IB_OK;
+    ib_status_t rc;
+    size_t s;
+
+    for (s = 0; s < server->config.shards; ++s) {
+        cache_shard_t *shard = &server->shards[s];
+
+        rc = ib_lock_lock(&shard->lock);
+        if (rc == IB_OK) {
+            rc = cache_write_due(server, shard, now, true);
+            ib_lock_unlock(&shard->lock);
+        }
+        if ( (rc != IB_OK) && (first_rc == IB_OK) ) {
+            first_rc = rc;
+        }
+    }
+
+    return first_rc;
+}
+
+void ib_kvstore_cache_stats(
+    ib_kvstore_t *kvstore,
+    ib_kvstore_cache_stats_t *stats)
+{
+    assert(kvstore != NULL);
+    assert(stats != NULL);
+
+    cache_server_t *server = (cache_server_t *)kvstore->server;
+    size_t s;
+
+    memset(stats, 0, sizeof(*stats));
+    for (s = 0; s < server->config.shards; ++s) {
+        cache_shard_t *shard = &server->shards[s];
+
+        if (ib_lock_lock(&shard->lock) != IB_OK) {
+            continue;
+        }
+        stats->hits += shard->stats.hits;
+        stats->negative_hits += shard->stats.negative_hits;
+        stats->stale_hits += shard->stats.stale_hits;
+        stats->misses += shard->stats.misses;
+        stats->evictions += shard->stats.evictions;
+        stats->expirations += shard->stats.expirations;
+        stats->writes += shard->stats.writes;
+        stats->coalesced += shard->stats.coalesced;
+        stats->write_errors += shard->stats.write_errors;
+        ib_lock_unlock(&shard->lock);
+    }
+}
@@ -21,6 +21,7 @@
 
 #include <ctype.h>
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -67,7 +68,7 @@ static void cleanup_membuffer(membuffer_t *membuffer)
     membuffer->read = 0;
 
     if (membuffer->buffer) {
-        kvfree(membuffer->kvstore, membuffer->buffer);
+        free(membuffer->buffer);
     }
 }
 
@@ -130,13 +131,13 @@ static void cleanup_riak_headers(riak_headers_t *riak_headers)
     riak_headers->creation.tv_usec = 0;
 
     if (riak_headers->content_type) {
-        kvfree(riak_headers->kvstore, riak_headers->content_type);
+        free(riak_headers->content_type);
     }
     if (riak_headers->etag) {
-        kvfree(riak_headers->kvstore, riak_headers->etag);
+        free(riak_headers->etag);
     }
     if (riak_headers->x_riak_vclock) {
-        kvfree(riak_headers->kvstore, riak_headers->x_riak_vclock);
+        free(riak_headers->x_riak_vclock);
     }
 }
 
@@ -229,7 +230,7 @@ static ib_status_t cond_copy_header(
 
     value_sz = ptr_len - header_len + 1;
 
-    *dest = kvmalloc(kvstore, value_sz);
+    *dest = malloc(value_sz);
     if (*dest == NULL) {
         return IB_EALLOC;
     }
@@ -274,14 +275,17 @@ static struct curl_slist* build_custom_headers(
         return NULL;
     }
 
-    if (riak->vclock) {
-        snprintf(header, buffer_len, VCLOCK ": %s", riak->vclock);
-        slist = curl_slist_append(slist, header);
-    }
+    if (ib_lock_lock(&riak->lock) == IB_OK) {
+        if (riak->vclock) {
+            snprintf(header, buffer_len, VCLOCK ": %s", riak->vclock);
+            slist = curl_slist_append(slist, header);
+        }
 
-    if (riak->etag) {
-        snprintf(header, buffer_len, ETAG ": %s", riak->etag);
-        slist = curl_slist_append(slist, header);
+        if (riak->etag) {
+            snprintf(header, buffer_len, ETAG ": %s", riak->etag);
+            slist = curl_slist_append(slist, header);
+        }
+        ib_lock_unlock(&riak->lock);
     }
 
     if (riak->client_id) {
@@ -387,13 +391,12 @@ static size_t membuffer_writefunction(
 {
 
     membuffer_t *mb = (membuffer_t *)userdata;
-    ib_kvstore_t *kvstore = mb->kvstore;
 
     /* Resize mb. */
     if (size * nmemb > mb->size - mb->read) {
         size_t new_size = size * nmemb + mb->size + 4096;
 
-        char *buffer_tmp = kvmalloc(kvstore, new_size);
+        char *buffer_tmp = malloc(new_size);
         if (!buffer_tmp) {
             return 0;
         }
@@ -404,7 +407,7 @@ static size_t membuffer_writefunction(
                 memcpy(buffer_tmp, mb->buffer, mb->read);
             }
 
-            kvfree(kvstore, mb->buffer);
+            free(mb->buffer);
         }
 
         mb->buffer = buffer_tmp;
@@ -464,9 +467,9 @@ static size_t membuffer_readfunction(
 }
 
 /**
- * Allocates new string using kvstore->malloc representing a riak key url.
+ * Allocates new string using malloc representing a riak key url.
  *
- * Caller should free this with kvstore->free.
+ * Caller should free this with free.
  *
  * @param[in] kvstore Key-value store.
  * @param[in] riak The riak server data already pulled out of kvstore.
@@ -489,16 +492,25 @@ static char * build_key_url(
 
     /* bucket + /keys/ + key */
     url_len = riak->bucket_url_len + 6 + key->length;
-    url = kvmalloc(kvstore, url_len + 1);
+    url = malloc(url_len + 1);
     if (!url) {
         return NULL;
     }
 
-    snprintf(url, url_len, "%s/keys/%s", riak->bucket_url, (char *)key->key);
+    snprintf(url, url_len + 1, "%s/keys/%.*s",
+             riak->bucket_url, (int)key->length, (const char *)key->key);
 
     return url;
 }
 
+/**
+ * Allocate from the memory pool.
+ *
+ * Only values returned to the caller and the server itself are allocated
+ * with kvstore->malloc; per-request buffers use malloc so that a long lived
+ * pool does not grow with each request.  Requests may run in several
+ * threads, so allocations from the pool are serialized.
+ */
 static void * mp_malloc(ib_kvstore_t *kvstore,
                         size_t size,
                         ib_kvstore_cbdata_t *cbdata)
@@ -508,8 +520,21 @@ static void * mp_malloc(ib_kvstore_t *kvstore,
 
     ib_kvstore_riak_server_t *riak =
         (ib_kvstore_riak_server_t *)kvstore->server;
+    ib_mpool_t *mp = (ib_mpool_t *)cbdata;
+    void *ptr;
+
+    /* The server is set once initialization is done. */
+    if (riak == NULL) {
+        return ib_mpool_alloc(mp, size);
+    }
+
+    if (ib_lock_lock(&riak->mp_lock) != IB_OK) {
+        return NULL;
+    }
+    ptr = ib_mpool_alloc(mp, size);
+    ib_lock_unlock(&riak->mp_lock);
 
-    return ib_mpool_alloc(riak->mp, size);
+    return ptr;
 }
 
 static void mp_free(ib_kvstore_t *kvstore,
@@ -521,23 +546,141 @@ static void mp_free(ib_kvstore_t *kvstore,
 }
 
 /**
- * Does a simple get of a Riak object.
+ * Set the options common to all requests on @a curl.
+ *
+ * @param[in] riak The riak server.
+ * @param[in] curl Handle, freshly created or reset.
+ */
+static void riak_curl_defaults(ib_kvstore_riak_server_t *riak, CURL *curl)
+{
+    /* Signals can't be used for timeouts in threaded servers. */
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    if (riak->timeout > 0) {
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, riak->timeout);
+    }
+    if (riak->connect_timeout > 0) {
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS,
+                         riak->connect_timeout);
+    }
+}
+
+/**
+ * Take an idle curl handle from the pool, or create one.
+ *
+ * The handle's connection to the server, if any, is kept open between
+ * requests, so reusing a handle avoids a new connection.
+ *
+ * @param[in] riak The riak server.
+ *
+ * @returns A curl handle or NULL on failure.
+ */
+static CURL * riak_checkout(ib_kvstore_riak_server_t *riak)
+{
+    CURL *curl = NULL;
+
+    if (ib_lock_lock(&riak->lock) == IB_OK) {
+        if (riak->pool_idle > 0) {
+            curl = riak->pool[--riak->pool_idle];
+        }
+        ib_lock_unlock(&riak->lock);
+    }
+
+    if (curl == NULL) {
+        curl = curl_easy_init();
+        if (curl == NULL) {
+            return NULL;
+        }
+    }
+
+    riak_curl_defaults(riak, curl);
+
+    return curl;
+}
+
+/**
+ * Return a curl handle to the pool, or close it if the pool is full.
+ *
+ * @param[in] riak The riak server.
+ * @param[in] curl Handle from riak_checkout().
+ */
+static void riak_checkin(ib_kvstore_riak_server_t *riak, CURL *curl)
+{
+    if (curl == NULL) {
+        return;
+    }
+
+    /* Resetting options keeps the connection. */
+    curl_easy_reset(curl);
+
+    if (ib_lock_lock(&riak->lock) == IB_OK) {
+        if (riak->pool_idle < riak->pool_size) {
+            riak->pool[riak->pool_idle++] = curl;
+            curl = NULL;
+        }
+        ib_lock_unlock(&riak->lock);
+    }
+
+    if (curl != NULL) {
+        curl_easy_cleanup(curl);
+    }
+}
+
+/**
+ * Close all idle curl handles.
+ *
+ * @param[in] riak The riak server.
+ */
+static void riak_pool_clear(ib_kvstore_riak_server_t *riak)
+{
+    if (ib_lock_lock(&riak->lock) != IB_OK) {
+        return;
+    }
+    while (riak->pool_idle > 0) {
+        curl_easy_cleanup(riak->pool[--riak->pool_idle]);
+    }
+    ib_lock_unlock(&riak->lock);
+}
+
+/**
+ * Map a failed curl request to a status.
+ *
+ * @param[in] curl_rc Curl result.
+ *
+ * @returns IB_ETIMEDOUT for timeouts, IB_EOTHER otherwise.
+ */
+static ib_status_t riak_curl_status(CURLcode curl_rc)
+{
+    return (curl_rc == CURLE_OPERATION_TIMEDOUT) ? IB_ETIMEDOUT : IB_EOTHER;
+}
+
+/**
+ * Set up a simple get of a Riak object on @a curl.
  *
  * This will call riak_headers_init and membuffer_init on
  * @a riak_headers and @a response.
  *
+ * @param[in] kvstore Key-value store.
+ * @param[in] riak The riak server.
+ * @param[in] curl Handle to set up.
+ * @param[in] url URL to get.
+ * @param[out] response Receives the body.
+ * @param[out] riak_headers Receives the headers.
+ * @param[out] header_list Custom headers, to be freed with
+ *             curl_slist_free_all() after the request.
  */
-static ib_status_t riak_get(
+static ib_status_t riak_get_setup(
     ib_kvstore_t *kvstore,
     ib_kvstore_riak_server_t *riak,
+    CURL *curl,
     const char *url,
     membuffer_t *response,
-    riak_headers_t *riak_headers)
+    riak_headers_t *riak_headers,
+    struct curl_slist **header_list)
 {
 
     CURLcode curl_rc;
 
-    struct curl_slist *header_list = NULL;
+    *header_list = NULL;
 
     /* Callback data for reading in the body. */
     membuffer_init(kvstore, response);
@@ -546,56 +689,95 @@ static ib_status_t riak_get(
     riak_headers_init(kvstore, riak_headers);
 
     /* Set url. */
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_URL, url);
+    curl_rc = curl_easy_setopt(curl, CURLOPT_URL, url);
     if (curl_rc) {
         return IB_EOTHER;
     }
 
     /* Use HTTP GET. */
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_HTTPGET, 1);
+    curl_rc = curl_easy_setopt(curl, CURLOPT_HTTPGET, 1);
     if (curl_rc) {
         return IB_EOTHER;
     }
 
     curl_rc = curl_easy_setopt(
-        riak->curl,
+        curl,
         CURLOPT_WRITEFUNCTION,
         membuffer_writefunction);
     if (curl_rc) {
         return IB_EOTHER;
     }
 
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_WRITEDATA, response);
+    curl_rc = curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
     if (curl_rc) {
         return IB_EOTHER;
     }
 
     curl_rc = curl_easy_setopt(
-        riak->curl,
+        curl,
         CURLOPT_HEADERFUNCTION,
         &riak_header_capture);
     if (curl_rc) {
         return IB_EOTHER;
     }
 
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_WRITEHEADER, riak_headers);
+    curl_rc = curl_easy_setopt(curl, CURLOPT_WRITEHEADER, riak_headers);
     if (curl_rc) {
         return IB_EOTHER;
     }
 
-    header_list = build_custom_headers(kvstore, riak, NULL);
-    if (header_list) {
+    *header_list = build_custom_headers(kvstore, riak, NULL);
+    if (*header_list) {
         curl_rc = curl_easy_setopt(
-            riak->curl,
+            curl,
             CURLOPT_HTTPHEADER,
-            header_list);
+            *header_list);
         if (curl_rc) {
             return IB_EOTHER;
         }
     }
 
+    return IB_OK;
+}
+
+/**
+ * Does a simple get of a Riak object.
+ *
+ * This will call riak_headers_init and membuffer_init on
+ * @a riak_headers and @a response.
+ *
+ */
+static ib_status_t riak_get(
+    ib_kvstore_t *kvstore,
+    ib_kvstore_riak_server_t *riak,
+    CURL *curl,
+    const char *url,
+    membuffer_t *response,
+    riak_headers_t *riak_headers)
+{
+
+    CURLcode curl_rc;
+    ib_status_t rc;
+
+    struct curl_slist *header_list = NULL;
+
+    rc = riak_get_setup(
+        kvstore,
+        riak,
+        curl,
+        url,
+        response,
+        riak_headers,
+        &header_list);
+    if (rc != IB_OK) {
+        if (header_list) {
+            curl_slist_free_all(header_list);
+        }
+        return rc;
+    }
+
     /* Perform the transaction. */
-    curl_rc = curl_easy_perform(riak->curl);
+    curl_rc = curl_easy_perform(curl);
 
     if (riak_headers->etag) {
         ib_kvstore_riak_set_etag(kvstore, riak_headers->etag);
@@ -611,7 +793,7 @@ static ib_status_t riak_get(
     }
 
     if (curl_rc) {
-        return IB_EOTHER;
+        return riak_curl_status(curl_rc);
     }
 
     return IB_OK;
@@ -626,23 +808,35 @@ static ib_status_t kvget(
 {
     ib_status_t rc;
     ib_kvstore_riak_server_t *riak;
+    CURL *curl;
     char *url;
     membuffer_t response;
     riak_headers_t riak_headers;
 
+    *values = NULL;
+    *values_length = 0;
+
     membuffer_init(kvstore, &response);
     riak_headers_init(kvstore, &riak_headers);
     riak = (ib_kvstore_riak_server_t *)kvstore->server;
 
     url = build_key_url(kvstore, riak, key);
+    if (url == NULL) {
+        return IB_EALLOC;
+    }
 
-    rc = riak_get(kvstore, riak, url, &response, &riak_headers);
+    curl = riak_checkout(riak);
+    if (curl == NULL) {
+        free(url);
+        return IB_EOTHER;
+    }
+
+    rc = riak_get(kvstore, riak, curl, url, &response, &riak_headers);
     if (rc != IB_OK) {
         goto exit;
     }
 
     if (riak_headers.status == 200) {
-        *values_length = 1;
 
         /* Build 1-element array. */
         *values = kvmalloc(kvstore, sizeof(**values));
@@ -653,7 +847,9 @@ static ib_status_t kvget(
 
         /* Allocate kvstore value. */
         (*values)[0] = kvmalloc(kvstore, sizeof(*((*values)[0])));
-        if (*values[0] == NULL) {
+        if ((*values)[0] == NULL) {
+            kvfree(kvstore, *values);
+            *values = NULL;
             rc = IB_EALLOC;
             goto exit;
         }
@@ -664,6 +860,13 @@ static ib_status_t kvget(
             &response,
             &riak_headers,
             (*values)[0]);
+        if (rc != IB_OK) {
+            kvfree(kvstore, (*values)[0]);
+            kvfree(kvstore, *values);
+            *values = NULL;
+            goto exit;
+        }
+        *values_length = 1;
         goto exit;
     }
 
@@ -671,8 +874,7 @@ static ib_status_t kvget(
     else if (riak_headers.status == 300) {
         /* Current line. */
         char *cur;
-
-        *values_length = 0;
+        size_t siblings = 0;
 
         /* Count the siblings returned in the buffer. */
         for (size_t i = 0;
@@ -682,12 +884,12 @@ static ib_status_t kvget(
             /* Every sibling etag is preceded by a '\n' */
             if (response.buffer[i] == '\n' && isalnum(response.buffer[i+1]))
             {
-                ++(*values_length);
+                ++siblings;
             }
         }
 
-        /* Build a *values_length element array. */
-        *values = kvmalloc(kvstore, sizeof(**values) * *values_length);
+        /* Build a siblings element array. */
+        *values = kvmalloc(kvstore, sizeof(**values) * siblings);
         if (*values == NULL) {
             rc = IB_EALLOC;
             goto exit;
@@ -696,7 +898,7 @@ static ib_status_t kvget(
         /* For each sibling, fetch it to be merged. */
         /* Skip the first line which is always "Siblings:\n". */
         cur = index(response.buffer, '\n') + 1;
-        for (size_t i = 0; i < *values_length; ++i) {
+        for (size_t i = 0; i < siblings; ++i) {
 
             /* URL containing ?vtag=<ETag> from response. */
             char *vtag_url;
@@ -712,54 +914,73 @@ static ib_status_t kvget(
             membuffer_init(kvstore, &tmp_buf);
             riak_headers_init(kvstore, &tmp_headers);
 
-            vtag_url = kvmalloc(
-                kvstore,
-                strlen(url) + strlen(vtag) + strlen(cur) + 1);
+            vtag_url = malloc(strlen(url) + strlen(vtag) + strlen(cur) + 1);
             if (!vtag_url) {
                 rc = IB_EALLOC;
                 goto exit;
             }
             sprintf(vtag_url, "%s%s%s", url, vtag, cur);
+            cur = eol+1;
 
-            rc = riak_get(kvstore, riak, vtag_url, &tmp_buf, &tmp_headers);
-            if (rc != IB_OK) {
-                /* Nop - just skip this and decrement the results. */
-                --(*values_length);
+            /* The handle is reused for each sibling. */
+            curl_easy_reset(curl);
+            riak_curl_defaults(riak, curl);
+
+            rc = riak_get(kvstore, riak, curl, vtag_url, &tmp_buf,
+                          &tmp_headers);
+            if (rc != IB_OK || tmp_headers.status != 200) {
+                /* Nop - just skip this sibling. */
                 cleanup_membuffer(&tmp_buf);
-                kvfree(kvstore, vtag_url);
+                cleanup_riak_headers(&tmp_headers);
+                free(vtag_url);
+                rc = IB_OK;
                 continue;
             }
 
-            (*values)[i] = kvmalloc(kvstore, sizeof(*(*values)[i]));
-            if ((*values)[i] == NULL) {
-                /* On failure, free allocated keys. */
-                for(size_t j = 0; j < i; j++) {
-                    ib_kvstore_free_value(kvstore, (*values)[i]);
-                }
-                kvfree(kvstore, vtag_url);
+            (*values)[*values_length] =
+                kvmalloc(kvstore, sizeof(*(*values)[*values_length]));
+            if ((*values)[*values_length] == NULL) {
                 rc = IB_EALLOC;
-                goto exit;
             }
-
-            /* Convert the retrieved buffer data into a kvstore value. */
-            rc = http_to_kvstore_value(
-                kvstore,
-                riak,
-                &tmp_buf,
-                &tmp_headers,
-                (*values)[i]);
+            else {
+                /* Convert the retrieved buffer data into a kvstore value. */
+                rc = http_to_kvstore_value(
+                    kvstore,
+                    riak,
+                    &tmp_buf,
+                    &tmp_headers,
+                    (*values)[*values_length]);
+                if (rc == IB_OK) {
+                    ++(*values_length);
+                }
+                else {
+                    kvfree(kvstore, (*values)[*values_length]);
+                }
+            }
 
             cleanup_membuffer(&tmp_buf);
             cleanup_riak_headers(&tmp_headers);
-            kvfree(kvstore, vtag_url);
-            cur = eol+1;
+            free(vtag_url);
+
+            if (rc != IB_OK) {
+                /* On failure, free the values fetched so far. */
+                for (size_t j = 0; j < *values_length; ++j) {
+                    ib_kvstore_free_value(kvstore, (*values)[j]);
+                }
+                kvfree(kvstore, *values);
+                *values = NULL;
+                *values_length = 0;
+                goto exit;
+            }
         }
     }
     else if (riak_headers.status == 404) {
-        *values_length = 0;
-        *values = NULL;
-        goto exit;
         rc = IB_ENOENT;
+        goto exit;
+    }
+    else {
+        rc = IB_EOTHER;
+        goto exit;
     }
 
     /* Before cleanly existing, set the riak etag and vclock to that of
@@ -777,8 +998,8 @@ exit:
     cleanup_membuffer(&response);
     cleanup_riak_headers(&riak_headers);
 
-    curl_easy_reset(riak->curl);
-    kvfree(kvstore, url);
+    riak_checkin(riak, curl);
+    free(url);
     return rc;
 }
 
@@ -794,6 +1015,7 @@ static ib_status_t kvset(
     ib_status_t rc;
     CURLcode curl_rc;
     ib_kvstore_riak_server_t *riak;
+    CURL *curl;
     struct curl_slist *header_list = NULL;
 
     membuffer_t response;
@@ -814,29 +1036,38 @@ static ib_status_t kvset(
     riak = (ib_kvstore_riak_server_t *)kvstore->server;
     rc = IB_OK;
     url = build_key_url(kvstore, riak, key);
+    if (url == NULL) {
+        return IB_EALLOC;
+    }
+
+    curl = riak_checkout(riak);
+    if (curl == NULL) {
+        free(url);
+        return IB_EOTHER;
+    }
 
     /* Set url. */
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_URL, url);
+    curl_rc = curl_easy_setopt(curl, CURLOPT_URL, url);
     if (curl_rc) {
         rc = IB_EOTHER;
         goto exit;
     }
 
     /* Use PUT action. */
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_UPLOAD, 1);
+    curl_rc = curl_easy_setopt(curl, CURLOPT_UPLOAD, 1);
     if (curl_rc) {
         rc = IB_EOTHER;
         goto exit;
     }
 
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_READDATA, &value_buffer);
+    curl_rc = curl_easy_setopt(curl, CURLOPT_READDATA, &value_buffer);
     if (curl_rc) {
         rc = IB_EOTHER;
         goto exit;
     }
 
     curl_rc = curl_easy_setopt(
-        riak->curl,
+        curl,
         CURLOPT_INFILESIZE,
         value_buffer.size);
     if (curl_rc) {
@@ -845,7 +1076,7 @@ static ib_status_t kvset(
     }
 
     curl_rc = curl_easy_setopt(
-        riak->curl,
+        curl,
         CURLOPT_READFUNCTION,
         membuffer_readfunction);
     if (curl_rc) {
@@ -854,7 +1085,7 @@ static ib_status_t kvset(
     }
 
     curl_rc = curl_easy_setopt(
-        riak->curl,
+        curl,
         CURLOPT_WRITEFUNCTION,
         membuffer_writefunction);
     if (curl_rc) {
@@ -862,14 +1093,14 @@ static ib_status_t kvset(
         goto exit;
     }
 
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_WRITEDATA, &response);
+    curl_rc = curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
     if (curl_rc) {
         rc = IB_EOTHER;
         goto exit;
     }
 
     curl_rc = curl_easy_setopt(
-        riak->curl,
+        curl,
         CURLOPT_HEADERFUNCTION,
         &riak_header_capture);
     if (curl_rc) {
@@ -877,7 +1108,7 @@ static ib_status_t kvset(
         goto exit;
     }
 
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_WRITEHEADER, &riak_headers);
+    curl_rc = curl_easy_setopt(curl, CURLOPT_WRITEHEADER, &riak_headers);
     if (curl_rc) {
         rc = IB_EOTHER;
         goto exit;
@@ -886,7 +1117,7 @@ static ib_status_t kvset(
     header_list = build_custom_headers(kvstore, riak, value);
     if (header_list) {
         curl_rc = curl_easy_setopt(
-            riak->curl,
+            curl,
             CURLOPT_HTTPHEADER,
             header_list);
         if (curl_rc) {
@@ -896,9 +1127,9 @@ static ib_status_t kvset(
     }
 
     /* Perform the transaction. */
-    curl_rc = curl_easy_perform(riak->curl);
+    curl_rc = curl_easy_perform(curl);
     if (curl_rc) {
-        rc = IB_EOTHER;
+        rc = riak_curl_status(curl_rc);
         goto exit;
     }
 
@@ -909,13 +1140,13 @@ exit:
     }
 
     if (response.buffer) {
-        kvfree(kvstore, response.buffer);
+        free(response.buffer);
     }
 
     cleanup_riak_headers(&riak_headers);
 
-    curl_easy_reset(riak->curl);
-    kvfree(kvstore, url);
+    riak_checkin(riak, curl);
+    free(url);
     return rc;
 }
 
@@ -932,32 +1163,42 @@ static ib_status_t kvremove(
     ib_status_t rc;
     CURLcode curl_rc;
     ib_kvstore_riak_server_t *riak;
+    CURL *curl;
 
     rc = IB_OK;
     riak = (ib_kvstore_riak_server_t *)kvstore->server;
     url = build_key_url(kvstore, riak, key);
+    if (url == NULL) {
+        return IB_EALLOC;
+    }
 
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_URL, url);
+    curl = riak_checkout(riak);
+    if (curl == NULL) {
+        free(url);
+        return IB_EOTHER;
+    }
+
+    curl_rc = curl_easy_setopt(curl, CURLOPT_URL, url);
     if (curl_rc) {
         rc =IB_EOTHER;
         goto exit;
     }
 
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+    curl_rc = curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
     if (curl_rc) {
         rc =IB_EOTHER;
         goto exit;
     }
 
-    curl_rc = curl_easy_perform(riak->curl);
+    curl_rc = curl_easy_perform(curl);
     if (curl_rc) {
-        rc =IB_EOTHER;
+        rc = riak_curl_status(curl_rc);
         goto exit;
     }
 
 exit:
-    curl_easy_reset(riak->curl);
-    kvfree(kvstore, url);
+    riak_checkin(riak, curl);
+    free(url);
     return rc;
 }
 static ib_status_t kvconnect(
@@ -968,10 +1209,13 @@ static ib_status_t kvconnect(
     assert(kvstore->server);
     ib_kvstore_riak_server_t *riak =
         (ib_kvstore_riak_server_t *)kvstore->server;
-    riak->curl = curl_easy_init();
-    if (riak->curl == NULL) {
+
+    /* Connections are made on demand; check that handles can be made. */
+    CURL *curl = riak_checkout(riak);
+    if (curl == NULL) {
         return IB_EOTHER;
     }
+    riak_checkin(riak, curl);
     return IB_OK;
 }
 static ib_status_t kvdisconnect(
@@ -982,7 +1226,7 @@ static ib_status_t kvdisconnect(
     assert(kvstore->server);
     ib_kvstore_riak_server_t *riak =
         (ib_kvstore_riak_server_t *)kvstore->server;
-    curl_easy_cleanup(riak->curl);
+    riak_pool_clear(riak);
     return IB_OK;
 }
 static void kvdestroy(
@@ -992,6 +1236,11 @@ static void kvdestroy(
     ib_kvstore_riak_server_t *riak =
         (ib_kvstore_riak_server_t *)kvstore->server;
 
+    riak_pool_clear(riak);
+    free(riak->pool);
+    ib_lock_destroy(&riak->lock);
+    ib_lock_destroy(&riak->mp_lock);
+
     kvfree(kvstore, riak->riak_url);
     kvfree(kvstore, riak->bucket_url);
     kvfree(kvstore, riak->bucket);
@@ -999,10 +1248,10 @@ static void kvdestroy(
         kvfree(kvstore, riak->client_id);
     }
     if (riak->etag) {
-        kvfree(kvstore, riak->etag);
+        free(riak->etag);
     }
     if (riak->vclock) {
-        kvfree(kvstore, riak->vclock);
+        free(riak->vclock);
     }
     kvfree(kvstore, riak);
 }
@@ -1028,20 +1277,45 @@ ib_status_t ib_kvstore_riak_init(
     }
 
     /* If the user gave us a memory pool, use memory pools allocator. */
+    kvstore->server = NULL;
+    kvstore->malloc_cbdata = NULL;
     if (mp) {
         kvstore->malloc = mp_malloc;
         kvstore->free = mp_free;
+        kvstore->malloc_cbdata = (ib_kvstore_cbdata_t *)mp;
     }
 
     server = kvmalloc(kvstore, sizeof(*server));
     if (!server) {
         return IB_EALLOC;
     }
+    server->mp = mp;
     server->vclock = NULL;
     server->etag = NULL;
     server->riak_url_len = strlen(riak_url);
     server->bucket_len = strlen(bucket);
 
+    /* The pool is shared between threads, so it is not allocated from mp. */
+    server->pool_idle = 0;
+    server->pool_size = IB_KVSTORE_RIAK_DEFAULT_POOL_SIZE;
+    server->timeout = IB_KVSTORE_RIAK_DEFAULT_TIMEOUT;
+    server->connect_timeout = IB_KVSTORE_RIAK_DEFAULT_CONNECT_TIMEOUT;
+    server->pool = calloc(server->pool_size, sizeof(*server->pool));
+    if (server->pool == NULL) {
+        return IB_EALLOC;
+    }
+    rc = ib_lock_init(&server->lock);
+    if (rc != IB_OK) {
+        free(server->pool);
+        return rc;
+    }
+    rc = ib_lock_init(&server->mp_lock);
+    if (rc != IB_OK) {
+        ib_lock_destroy(&server->lock);
+        free(server->pool);
+        return rc;
+    }
+
     /* +10 for the intermediate string constant "/buckets/" in the url. */
     server->bucket_url_len = server->riak_url_len + 10 + server->bucket_len;
 
@@ -1090,7 +1364,6 @@ ib_status_t ib_kvstore_riak_init(
     kvstore->disconnect = kvdisconnect;
     kvstore->destroy = kvdestroy;
 
-    kvstore->malloc_cbdata = NULL;
     kvstore->free_cbdata = NULL;
     kvstore->connect_cbdata = NULL;
     kvstore->disconnect_cbdata = NULL;
@@ -1103,17 +1376,240 @@ ib_status_t ib_kvstore_riak_init(
     return IB_OK;
 }
 
+ib_status_t ib_kvstore_riak_set_pool_size(
+    ib_kvstore_t *kvstore,
+    size_t pool_size)
+{
+    assert(kvstore);
+
+    ib_kvstore_riak_server_t *riak =
+        (ib_kvstore_riak_server_t *)kvstore->server;
+    CURL **pool;
+    ib_status_t rc;
+
+    rc = ib_lock_lock(&riak->lock);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    /* Close handles that no longer fit. */
+    while (riak->pool_idle > pool_size) {
+        curl_easy_cleanup(riak->pool[--riak->pool_idle]);
+    }
+
+    pool = realloc(riak->pool, (pool_size > 0 ? pool_size : 1) *
+                               sizeof(*riak->pool));
+    if (pool == NULL) {
+        ib_lock_unlock(&riak->lock);
+        return IB_EALLOC;
+    }
+    riak->pool = pool;
+    riak->pool_size = pool_size;
+
+    ib_lock_unlock(&riak->lock);
+
+    return IB_OK;
+}
+
+void ib_kvstore_riak_set_timeout(
+    ib_kvstore_t *kvstore,
+    long timeout,
+    long connect_timeout)
+{
+    assert(kvstore);
+
+    ib_kvstore_riak_server_t *riak =
+        (ib_kvstore_riak_server_t *)kvstore->server;
+
+    riak->timeout = timeout;
+    riak->connect_timeout = connect_timeout;
+}
+
+/**
+ * A request of ib_kvstore_riak_get_multi().
+ */
+struct riak_multi_request_t {
+    CURL *curl;                      /**< Handle, or NULL. */
+    char *url;                       /**< URL of the key. */
+    membuffer_t response;            /**< Body. */
+    riak_headers_t headers;          /**< Headers. */
+    struct curl_slist *header_list;  /**< Custom headers. */
+    bool done;                       /**< Request has completed. */
+};
+typedef struct riak_multi_request_t riak_multi_request_t;
+
+ib_status_t ib_kvstore_riak_get_multi(
+    ib_kvstore_t *kvstore,
+    const ib_kvstore_key_t *keys,
+    size_t nkeys,
+    ib_kvstore_value_t **values,
+    ib_status_t *results)
+{
+    assert(kvstore);
+    assert(keys || nkeys == 0);
+    assert(values || nkeys == 0);
+    assert(results || nkeys == 0);
+
+    ib_kvstore_riak_server_t *riak =
+        (ib_kvstore_riak_server_t *)kvstore->server;
+    riak_multi_request_t *requests;
+    CURLM *multi;
+    CURLMsg *msg;
+    int running;
+    int msgs;
+    ib_status_t rc = IB_OK;
+    size_t i;
+
+    for (i = 0; i < nkeys; ++i) {
+        values[i] = NULL;
+        results[i] = IB_EOTHER;
+    }
+    if (nkeys == 0) {
+        return IB_OK;
+    }
+
+    requests = calloc(nkeys, sizeof(*requests));
+    if (requests == NULL) {
+        for (i = 0; i < nkeys; ++i) {
+            results[i] = IB_EALLOC;
+        }
+        return IB_EOTHER;
+    }
+    multi = curl_multi_init();
+    if (multi == NULL) {
+        free(requests);
+        return IB_EOTHER;
+    }
+
+    /* Start all requests. */
+    for (i = 0; i < nkeys; ++i) {
+        riak_multi_request_t *req = &requests[i];
+
+        membuffer_init(kvstore, &req->response);
+        riak_headers_init(kvstore, &req->headers);
+        req->url = build_key_url(kvstore, riak, &keys[i]);
+        if (req->url == NULL) {
+            results[i] = IB_EALLOC;
+            continue;
+        }
+        req->curl = riak_checkout(riak);
+        if (req->curl == NULL) {
+            continue;
+        }
+        if ( (riak_get_setup(kvstore, riak, req->curl, req->url,
+                             &req->response, &req->headers,
+                             &req->header_list) != IB_OK) ||
+             (curl_easy_setopt(req->curl, CURLOPT_PRIVATE, req) != CURLE_OK) ||
+             (curl_multi_add_handle(multi, req->curl) != CURLM_OK) )
+        {
+            continue;
+        }
+    }
+
+    /* Run them to completion. */
+    do {
+        if (curl_multi_perform(multi, &running) != CURLM_OK) {
+            break;
+        }
+        while ((msg = curl_multi_info_read(multi, &msgs)) != NULL) {
+            riak_multi_request_t *req;
+
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+                              (char **)&req);
+            req->done = true;
+            i = req - requests;
+            if (msg->data.result != CURLE_OK) {
+                results[i] = riak_curl_status(msg->data.result);
+            }
+            else if (req->headers.status == 404) {
+                results[i] = IB_ENOENT;
+            }
+            else if (req->headers.status == 200) {
+                values[i] = kvmalloc(kvstore, sizeof(*values[i]));
+                if (values[i] == NULL) {
+                    results[i] = IB_EALLOC;
+                }
+                else {
+                    results[i] = http_to_kvstore_value(
+                        kvstore, riak, &req->response, &req->headers,
+                        values[i]);
+                    if (results[i] != IB_OK) {
+                        kvfree(kvstore, values[i]);
+                        values[i] = NULL;
+                    }
+                }
+            }
+            else if (req->headers.status == 300) {
+                /* Siblings; fetched and merged below. */
+                results[i] = IB_EAGAIN;
+            }
+        }
+        if ( (running > 0) &&
+             (curl_multi_wait(multi, NULL, 0, 100, NULL) != CURLM_OK) )
+        {
+            break;
+        }
+    } while (running > 0);
+
+    for (i = 0; i < nkeys; ++i) {
+        riak_multi_request_t *req = &requests[i];
+
+        if (req->curl != NULL) {
+            curl_multi_remove_handle(multi, req->curl);
+            riak_checkin(riak, req->curl);
+        }
+        if (req->header_list != NULL) {
+            curl_slist_free_all(req->header_list);
+        }
+
+        /* Update the etag and vclock in key order, as kvget would. */
+        if (req->done && (results[i] != IB_EAGAIN)) {
+            if (req->headers.etag) {
+                ib_kvstore_riak_set_etag(kvstore, req->headers.etag);
+            }
+            if (req->headers.x_riak_vclock) {
+                ib_kvstore_riak_set_vclock(kvstore,
+                                           req->headers.x_riak_vclock);
+            }
+        }
+        cleanup_membuffer(&req->response);
+        cleanup_riak_headers(&req->headers);
+        if (req->url != NULL) {
+            free(req->url);
+        }
+
+        if (results[i] == IB_EAGAIN) {
+            results[i] = ib_kvstore_get(kvstore, NULL, &keys[i], &values[i]);
+        }
+        if ( (results[i] != IB_OK) && (results[i] != IB_ENOENT) ) {
+            rc = IB_EOTHER;
+        }
+    }
+
+    curl_multi_cleanup(multi);
+    free(requests);
+
+    return rc;
+}
+
 void ib_kvstore_riak_set_vclock(ib_kvstore_t *kvstore, char *vclock) {
     ib_kvstore_riak_server_t *riak;
 
     riak = (ib_kvstore_riak_server_t *)kvstore->server;
 
+    if (ib_lock_lock(&riak->lock) != IB_OK) {
+        return;
+    }
+
     if (riak->vclock) {
-        kvfree(kvstore, riak->vclock);
+        free(riak->vclock);
     }
 
     if (vclock) {
-        riak->vclock = kvmalloc(kvstore, strlen(vclock)+1);
+        riak->vclock = malloc(strlen(vclock)+1);
 
         if (riak->vclock) {
             strcpy(riak->vclock, vclock);
@@ -1122,6 +1618,8 @@ void ib_kvstore_riak_set_vclock(ib_kvstore_t *kvstore, char *vclock) {
     else {
         riak->vclock = NULL;
     }
+
+    ib_lock_unlock(&riak->lock);
 }
 
 void ib_kvstore_riak_set_etag(ib_kvstore_t *kvstore, char *etag) {
@@ -1129,12 +1627,16 @@ void ib_kvstore_riak_set_etag(ib_kvstore_t *kvstore, char *etag) {
 
     riak = (ib_kvstore_riak_server_t *)kvstore->server;
 
+    if (ib_lock_lock(&riak->lock) != IB_OK) {
+        return;
+    }
+
     if (riak->etag) {
-        kvfree(kvstore, riak->etag);
+        free(riak->etag);
     }
 
     if (etag) {
-        riak->etag = kvmalloc(kvstore, strlen(etag)+1);
+        riak->etag = malloc(strlen(etag)+1);
 
         if (riak->etag) {
             strcpy(riak->etag, etag);
@@ -1143,6 +1645,8 @@ void ib_kvstore_riak_set_etag(ib_kvstore_t *kvstore, char *etag) {
     else {
         riak->etag = NULL;
     }
+
+    ib_lock_unlock(&riak->lock);
 }
 
 char * ib_kvstore_riak_get_vclock(ib_kvstore_t *kvstore) {
@@ -1164,16 +1668,24 @@ int ib_kvstore_riak_ping(ib_kvstore_t *kvstore) {
     membuffer_t resp;
     riak_headers_t headers;
     char *url;
+    CURL *curl;
     riak = (ib_kvstore_riak_server_t *)kvstore->server;
     int result;
 
-    url = kvmalloc(kvstore, riak->riak_url_len + 7);
+    url = malloc(riak->riak_url_len + 7);
     if (!url) {
         return 0;
     }
     sprintf(url, "%s/ping", riak->riak_url);
 
-    rc = riak_get(kvstore, riak, url, &resp, &headers);
+    curl = riak_checkout(riak);
+    if (curl == NULL) {
+        free(url);
+        return 0;
+    }
+
+    rc = riak_get(kvstore, riak, curl, url, &resp, &headers);
+    riak_checkin(riak, curl);
     if (rc != IB_OK) {
         result = 0;
     }
@@ -1181,7 +1693,7 @@ int ib_kvstore_riak_ping(ib_kvstore_t *kvstore) {
         result =
             (resp.read == 2 && resp.buffer[0] == 'O' && resp.buffer[1] == 'K');
     }
-    kvfree(kvstore, url);
+    free(url);
     cleanup_membuffer(&resp);
     cleanup_riak_headers(&headers);
 
@@ -1206,6 +1718,7 @@ static ib_status_t ib_kvstore_riak_set_bucket_property(
 
     ib_kvstore_riak_server_t *riak;
 
+    CURL *curl = NULL;
     CURLcode curl_rc;
     struct curl_slist *header_list = NULL;
     size_t url_length;
@@ -1222,7 +1735,7 @@ static ib_status_t ib_kvstore_riak_set_bucket_property(
 
     url_length = riak->bucket_url_len + strlen(props_path);
 
-    url = kvmalloc(kvstore, url_length + 1);
+    url = malloc(url_length + 1);
     if (!url) {
         rc = IB_EALLOC;
         goto exit;
@@ -1230,29 +1743,35 @@ static ib_status_t ib_kvstore_riak_set_bucket_property(
 
     snprintf(url, url_length+1, "%s%s", riak->bucket_url, props_path);
 
+    curl = riak_checkout(riak);
+    if (curl == NULL) {
+        rc = IB_EOTHER;
+        goto exit;
+    }
+
     /* Set url. */
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_URL, url);
+    curl_rc = curl_easy_setopt(curl, CURLOPT_URL, url);
     if (curl_rc) {
         rc = IB_EOTHER;
         goto exit;
     }
 
     /* Use PUT action. */
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_UPLOAD, 1);
+    curl_rc = curl_easy_setopt(curl, CURLOPT_UPLOAD, 1);
     if (curl_rc) {
         rc = IB_EOTHER;
         goto exit;
     }
 
     /* Set request data. */
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_READDATA, request);
+    curl_rc = curl_easy_setopt(curl, CURLOPT_READDATA, request);
     if (curl_rc) {
         rc = IB_EOTHER;
         goto exit;
     }
 
     /* Set request data size. */
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_INFILESIZE, request->size);
+    curl_rc = curl_easy_setopt(curl, CURLOPT_INFILESIZE, request->size);
     if (curl_rc) {
         rc = IB_EOTHER;
         goto exit;
@@ -1260,7 +1779,7 @@ static ib_status_t ib_kvstore_riak_set_bucket_property(
 
     /* Define how to read the request. */
     curl_rc = curl_easy_setopt(
-        riak->curl,
+        curl,
         CURLOPT_READFUNCTION,
         membuffer_readfunction);
     if (curl_rc) {
@@ -1270,7 +1789,7 @@ static ib_status_t ib_kvstore_riak_set_bucket_property(
 
     /* Define how to write the response. */
     curl_rc = curl_easy_setopt(
-        riak->curl,
+        curl,
         CURLOPT_WRITEFUNCTION,
         membuffer_writefunction);
     if (curl_rc) {
@@ -1279,7 +1798,7 @@ static ib_status_t ib_kvstore_riak_set_bucket_property(
     }
 
     /* Set the response buffer. */
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_WRITEDATA, &response);
+    curl_rc = curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
     if (curl_rc) {
         rc = IB_EOTHER;
         goto exit;
@@ -1287,7 +1806,7 @@ static ib_status_t ib_kvstore_riak_set_bucket_property(
 
     /* How are headers captures. */
     curl_rc = curl_easy_setopt(
-        riak->curl,
+        curl,
         CURLOPT_HEADERFUNCTION,
         &riak_header_capture);
     if (curl_rc) {
@@ -1296,7 +1815,7 @@ static ib_status_t ib_kvstore_riak_set_bucket_property(
     }
 
     /* Where are headers captures. */
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_WRITEHEADER, &headers);
+    curl_rc = curl_easy_setopt(curl, CURLOPT_WRITEHEADER, &headers);
     if (curl_rc) {
         rc = IB_EOTHER;
         goto exit;
@@ -1308,16 +1827,16 @@ static ib_status_t ib_kvstore_riak_set_bucket_property(
         goto exit;
     }
 
-    curl_rc = curl_easy_setopt(riak->curl, CURLOPT_HTTPHEADER, header_list);
+    curl_rc = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header_list);
     if (curl_rc) {
         rc = IB_EOTHER;
         goto exit;
     }
 
     /* Perform the transaction. */
-    curl_rc = curl_easy_perform(riak->curl);
+    curl_rc = curl_easy_perform(curl);
     if (curl_rc) {
-        rc = IB_EOTHER;
+        rc = riak_curl_status(curl_rc);
         goto exit;
     }
 
@@ -1331,8 +1850,10 @@ exit:
     cleanup_membuffer(&response);
     cleanup_riak_headers(&headers);
 
-    curl_easy_reset(riak->curl);
-    kvfree(kvstore, url);
+    riak_checkin(riak, curl);
+    if (url) {
+        free(url);
+    }
     return rc;
 }
 
@@ -1356,7 +1877,7 @@ ib_status_t ib_kvstore_riak_set_bucket_property_str(
         strlen(post_fmt) - 4; /* post_fmt - %s and %s. */
 
     /* Note: size+1 so we can use sprintf below. */
-    request.buffer = kvmalloc(kvstore, request.size+1);
+    request.buffer = malloc(request.size+1);
     if (!request.buffer) {
         return IB_EALLOC;
     }
@@ -1394,7 +1915,7 @@ ib_status_t ib_kvstore_riak_set_bucket_property_int(
     membuffer_init(kvstore, &request);
     request.read = 0;
     size = strlen(property) + digits + strlen(post_fmt)-4;
-    request.buffer = kvmalloc(kvstore, size+1);
+    request.buffer = malloc(size+1);
     if (!request.buffer) {
         return IB_EALLOC;
     }
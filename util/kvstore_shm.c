@@ -0,0 +1,1424 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+/**
+ * @file
+ * @brief IronBee --- Key-Value Shared Memory Store Implementation
+ *
+ * The mapped file starts with a header and the stripe array, followed by
+ * the entry array, the bucket array and the block array.  Each stripe owns
+ * an equal, contiguous share of the entries, buckets and blocks, so a
+ * stripe's lock protects everything it touches.
+ *
+ * An entry records a key's hash, lengths and times, and the chain of
+ * blocks holding the key, the type and the value, in that order.  Entries
+ * are chained from their bucket, and linked into the stripe's least
+ * recently used list.  Free entries and blocks are kept on per-stripe free
+ * lists.  All links are array indexes, as the file is mapped at different
+ * addresses in different processes.
+ *
+ * A file in use is never truncated, as other processes would fault on
+ * their next access.  A file that must be reinitialized is replaced: a new
+ * file is built next to it and renamed over it, and the old file is marked
+ * stale.  Each operation checks the state of its mapping, and a process
+ * that finds its mapping stale maps the new file.  Old mappings are kept
+ * until disconnect, as other threads may still be using them.
+ */
+
+#include "ironbee_config_auto.h"
+
+#include <ironbee/kvstore_shm.h>
+
+#include <ironbee/clock.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* Robust mutexes let a stripe be recovered if its lock holder dies. */
+#if defined(__GLIBC__)
+#define KVSTORE_SHM_ROBUST 1
+#endif
+
+/** Magic number identifying the file. */
+static const char kvstore_shm_magic[8] = "IBKVSHM";
+
+/** Layout version; bumped on any change to the file layout. */
+#define KVSTORE_SHM_VERSION 1
+
+/** Value of shm_header_t::state once the file is initialized. */
+#define KVSTORE_SHM_READY 0x52454459
+
+/** Value of shm_header_t::state once the file was replaced by another. */
+#define KVSTORE_SHM_STALE 0x5354414c
+
+/** Number of lock stripes. */
+#define KVSTORE_SHM_STRIPES 16
+
+/** Size of a block. */
+#define KVSTORE_SHM_BLOCK_SIZE 128
+
+/** Blocks per entry, used to size the table. */
+#define KVSTORE_SHM_BLOCKS_PER_ENTRY 4
+
+/** Alignment of the arrays in the file. */
+#define KVSTORE_SHM_ALIGN 64
+
+/** Null entry or block index. */
+#define SHM_NIL UINT32_MAX
+
+/**
+ * File header.
+ *
+ * The magic, version and state fields must stay first in all versions, so
+ * that a file of any version can be marked stale.
+ */
+typedef struct {
+    char     magic[8];            /**< kvstore_shm_magic */
+    uint32_t version;             /**< KVSTORE_SHM_VERSION */
+    uint32_t state;               /**< KVSTORE_SHM_READY when initialized */
+    uint64_t size;                /**< Size of the file */
+    uint32_t stripes;             /**< Number of stripes */
+    uint32_t entries_per_stripe;  /**< Entries (and buckets) per stripe */
+    uint32_t blocks_per_stripe;   /**< Blocks per stripe */
+    uint32_t block_size;          /**< Size of a block */
+    uint64_t entries_offset;      /**< Offset of the entry array */
+    uint64_t buckets_offset;      /**< Offset of the bucket array */
+    uint64_t blocks_offset;       /**< Offset of the block array */
+} shm_header_t;
+
+/** Lock stripe. */
+typedef struct {
+    pthread_mutex_t lock;         /**< Protects the stripe */
+    uint32_t        free_entries; /**< Free entry list */
+    uint32_t        free_blocks;  /**< Free block list */
+    uint32_t        nfree_blocks; /**< Length of free_blocks */
+    uint32_t        lru_head;     /**< Most recently used entry */
+    uint32_t        lru_tail;     /**< Least recently used entry */
+} shm_stripe_t;
+
+/** Entry. */
+typedef struct {
+    uint64_t hash;                /**< Hash of the key */
+    uint64_t creation_sec;        /**< Creation time, seconds */
+    uint32_t creation_usec;       /**< Creation time, microseconds */
+    uint32_t expiration;          /**< Absolute expiration; 0 for never */
+    uint32_t next;                /**< Bucket chain or free list */
+    uint32_t lru_prev;            /**< More recently used entry */
+    uint32_t lru_next;            /**< Less recently used entry */
+    uint32_t first_block;         /**< First data block */
+    uint32_t key_length;          /**< Key length */
+    uint32_t type_length;         /**< Type length */
+    uint32_t value_length;        /**< Value length */
+} shm_entry_t;
+
+/** Data carried by a block. */
+#define KVSTORE_SHM_BLOCK_DATA (KVSTORE_SHM_BLOCK_SIZE - sizeof(uint32_t))
+
+/** Block. */
+typedef struct {
+    uint32_t next;                         /**< Next block */
+    uint8_t  data[KVSTORE_SHM_BLOCK_DATA]; /**< Data */
+} shm_block_t;
+
+/** A mapping of the file. */
+typedef struct shm_map_t shm_map_t;
+struct shm_map_t {
+    uint8_t      *base;           /**< Mapping */
+    size_t        mapped;         /**< Size of the mapping */
+    shm_header_t *header;         /**< Header (at base) */
+    shm_stripe_t *stripes;        /**< Stripe array */
+    shm_entry_t  *entries;        /**< Entry array */
+    uint32_t     *buckets;        /**< Bucket array */
+    shm_block_t  *blocks;         /**< Block array */
+    shm_map_t    *retired;        /**< Mapping this one replaced, or NULL */
+};
+
+/** The shared memory server object. */
+typedef struct {
+    char            *path;        /**< Path of the mapped file */
+    size_t           size;        /**< Size to create the file with */
+    pthread_mutex_t  lock;        /**< Serializes remapping */
+    shm_map_t       *map;         /**< Current mapping, or NULL */
+} kvstore_shm_server_t;
+
+/**
+ * Round up to KVSTORE_SHM_ALIGN.
+ *
+ * @param[in] n Number.
+ * @returns @a n rounded up.
+ */
+static uint64_t shm_align(uint64_t n)
+{
+    return (n + KVSTORE_SHM_ALIGN - 1) & ~(uint64_t)(KVSTORE_SHM_ALIGN - 1);
+}
+
+/**
+ * Compute the layout of a file of a given size.
+ *
+ * @param[in] size File size.
+ * @param[out] layout Header with the layout fields set.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EINVAL if @a size is too small.
+ */
+static ib_status_t shm_layout(uint64_t size, shm_header_t *layout)
+{
+    uint64_t header_size;
+    uint64_t unit;
+    uint64_t per_stripe;
+    uint64_t nentries;
+
+    header_size = shm_align(
+        shm_align(sizeof(shm_header_t)) +
+        KVSTORE_SHM_STRIPES * sizeof(shm_stripe_t));
+    unit = sizeof(shm_entry_t) + sizeof(uint32_t) +
+           KVSTORE_SHM_BLOCKS_PER_ENTRY * sizeof(shm_block_t);
+
+    /* Leave room for the alignment of the bucket and block arrays. */
+    if (size < header_size + 2 * KVSTORE_SHM_ALIGN) {
+        return IB_EINVAL;
+    }
+    per_stripe = (size - header_size - 2 * KVSTORE_SHM_ALIGN) /
+                 (unit * KVSTORE_SHM_STRIPES);
+    if (per_stripe < 1) {
+        return IB_EINVAL;
+    }
+    if (per_stripe * KVSTORE_SHM_BLOCKS_PER_ENTRY >= SHM_NIL /
+                                                     KVSTORE_SHM_STRIPES) {
+        per_stripe = (SHM_NIL / KVSTORE_SHM_STRIPES - 1) /
+                     KVSTORE_SHM_BLOCKS_PER_ENTRY;
+    }
+    nentries = per_stripe * KVSTORE_SHM_STRIPES;
+
+    memset(layout, 0, sizeof(*layout));
+    layout->version = KVSTORE_SHM_VERSION;
+    layout->size = size;
+    layout->stripes = KVSTORE_SHM_STRIPES;
+    layout->entries_per_stripe = (uint32_t)per_stripe;
+    layout->blocks_per_stripe =
+        (uint32_t)(per_stripe * KVSTORE_SHM_BLOCKS_PER_ENTRY);
+    layout->block_size = KVSTORE_SHM_BLOCK_SIZE;
+    layout->entries_offset = header_size;
+    layout->buckets_offset =
+        shm_align(header_size + nentries * sizeof(shm_entry_t));
+    layout->blocks_offset =
+        shm_align(layout->buckets_offset + nentries * sizeof(uint32_t));
+
+    return IB_OK;
+}
+
+/**
+ * Does the mapped header describe a valid, initialized file?
+ *
+ * @param[in] header Mapped header.
+ * @param[in] size Size of the file.
+ *
+ * @returns True if the file can be used as is.
+ */
+static bool shm_header_valid(const shm_header_t *header, uint64_t size)
+{
+    shm_header_t layout;
+
+    if ( (memcmp(header->magic, kvstore_shm_magic, sizeof(header->magic)) != 0)
+         || (header->state != KVSTORE_SHM_READY)
+         || (header->size != size)
+         || (shm_layout(size, &layout) != IB_OK) )
+    {
+        return false;
+    }
+
+    return (header->version == layout.version) &&
+           (header->stripes == layout.stripes) &&
+           (header->entries_per_stripe == layout.entries_per_stripe) &&
+           (header->blocks_per_stripe == layout.blocks_per_stripe) &&
+           (header->block_size == layout.block_size) &&
+           (header->entries_offset == layout.entries_offset) &&
+           (header->buckets_offset == layout.buckets_offset) &&
+           (header->blocks_offset == layout.blocks_offset);
+}
+
+/**
+ * Point the mapping's array pointers into the file.
+ *
+ * @param[in,out] map Mapping with base and header set.
+ */
+static void shm_attach(shm_map_t *map)
+{
+    const shm_header_t *header = map->header;
+
+    map->stripes = (shm_stripe_t *)
+        (map->base + shm_align(sizeof(shm_header_t)));
+    map->entries = (shm_entry_t *)(map->base + header->entries_offset);
+    map->buckets = (uint32_t *)(map->base + header->buckets_offset);
+    map->blocks = (shm_block_t *)(map->base + header->blocks_offset);
+}
+
+/**
+ * Empty a stripe.
+ *
+ * @param[in] map Mapping.
+ * @param[in] s Stripe index.
+ */
+static void shm_stripe_reset(shm_map_t *map, uint32_t s)
+{
+    const shm_header_t *header = map->header;
+    shm_stripe_t *stripe = &map->stripes[s];
+    uint32_t first_entry = s * header->entries_per_stripe;
+    uint32_t first_block = s * header->blocks_per_stripe;
+    uint32_t i;
+
+    for (i = 0; i < header->entries_per_stripe; ++i) {
+        map->buckets[first_entry + i] = SHM_NIL;
+        map->entries[first_entry + i].next =
+            (i + 1 < header->entries_per_stripe) ? first_entry + i + 1 : SHM_NIL;
+    }
+    for (i = 0; i < header->blocks_per_stripe; ++i) {
+        map->blocks[first_block + i].next =
+            (i + 1 < header->blocks_per_stripe) ? first_block + i + 1 : SHM_NIL;
+    }
+
+    stripe->free_entries = first_entry;
+    stripe->free_blocks = first_block;
+    stripe->nfree_blocks = header->blocks_per_stripe;
+    stripe->lru_head = SHM_NIL;
+    stripe->lru_tail = SHM_NIL;
+}
+
+/**
+ * Initialize a newly mapped file.
+ *
+ * @param[in] map Mapping of the file.
+ * @param[in] layout Layout of the file.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EOTHER if a mutex could not be initialized.
+ */
+static ib_status_t shm_format(
+    shm_map_t *map,
+    const shm_header_t *layout)
+{
+    pthread_mutexattr_t attr;
+    ib_status_t rc = IB_OK;
+    uint32_t s;
+
+    /* Mark the file uninitialized until everything is in place. */
+    memcpy(map->header, layout, sizeof(*layout));
+    map->header->state = 0;
+    shm_attach(map);
+
+    if (pthread_mutexattr_init(&attr) != 0) {
+        return IB_EOTHER;
+    }
+    if (pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0) {
+        rc = IB_EOTHER;
+        goto cleanup;
+    }
+#ifdef KVSTORE_SHM_ROBUST
+    if (pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) != 0) {
+        rc = IB_EOTHER;
+        goto cleanup;
+    }
+#endif
+
+    for (s = 0; s < layout->stripes; ++s) {
+        if (pthread_mutex_init(&map->stripes[s].lock, &attr) != 0) {
+            rc = IB_EOTHER;
+            goto cleanup;
+        }
+        shm_stripe_reset(map, s);
+    }
+
+    memcpy(map->header->magic, kvstore_shm_magic, sizeof(kvstore_shm_magic));
+    __sync_synchronize();
+    map->header->state = KVSTORE_SHM_READY;
+
+cleanup:
+    pthread_mutexattr_destroy(&attr);
+    return rc;
+}
+
+/**
+ * Lock a stripe, recovering it if the previous holder died.
+ *
+ * @param[in] map Mapping.
+ * @param[in] s Stripe index.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EOTHER if the lock could not be taken.
+ */
+static ib_status_t shm_lock(shm_map_t *map, uint32_t s)
+{
+    int sys_rc = pthread_mutex_lock(&map->stripes[s].lock);
+
+#ifdef KVSTORE_SHM_ROBUST
+    if (sys_rc == EOWNERDEAD) {
+        /* The stripe may have been left half modified; start over. */
+        shm_stripe_reset(map, s);
+        if (pthread_mutex_consistent(&map->stripes[s].lock) != 0) {
+            pthread_mutex_unlock(&map->stripes[s].lock);
+            return IB_EOTHER;
+        }
+        return IB_OK;
+    }
+#endif
+
+    return (sys_rc == 0) ? IB_OK : IB_EOTHER;
+}
+
+/**
+ * Unlock a stripe.
+ *
+ * @param[in] map Mapping.
+ * @param[in] s Stripe index.
+ */
+static void shm_unlock(shm_map_t *map, uint32_t s)
+{
+    pthread_mutex_unlock(&map->stripes[s].lock);
+}
+
+/**
+ * Hash a key (64 bit FNV-1a).
+ *
+ * @param[in] key Key.
+ * @returns Hash of @a key.
+ */
+static uint64_t shm_hash(const ib_kvstore_key_t *key)
+{
+    const uint8_t *p = (const uint8_t *)key->key;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < key->length; ++i) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Stripe of a hash.
+ *
+ * @param[in] map Mapping.
+ * @param[in] hash Key hash.
+ * @returns Stripe index.
+ */
+static uint32_t shm_stripe_of(const shm_map_t *map, uint64_t hash)
+{
+    return (uint32_t)(hash % map->header->stripes);
+}
+
+/**
+ * Bucket of a hash.
+ *
+ * @param[in] map Mapping.
+ * @param[in] s Stripe index.
+ * @param[in] hash Key hash.
+ * @returns Bucket index.
+ */
+static uint32_t shm_bucket_of(
+    const shm_map_t *map,
+    uint32_t s,
+    uint64_t hash)
+{
+    uint32_t n = map->header->entries_per_stripe;
+
+    return s * n + (uint32_t)((hash >> 32) % n);
+}
+
+/**
+ * Compare data with the data stored in a block chain.
+ *
+ * @param[in] map Mapping.
+ * @param[in] block First block.
+ * @param[in] data Data to compare with.
+ * @param[in] len Length of @a data.
+ *
+ * @returns True if the first @a len bytes of the chain equal @a data.
+ */
+static bool shm_blocks_equal(
+    const shm_map_t *map,
+    uint32_t block,
+    const uint8_t *data,
+    size_t len)
+{
+    while (len > 0) {
+        size_t n = (len < KVSTORE_SHM_BLOCK_DATA) ?
+                   len : KVSTORE_SHM_BLOCK_DATA;
+
+        if (block == SHM_NIL) {
+            return false;
+        }
+        if (memcmp(map->blocks[block].data, data, n) != 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+        block = map->blocks[block].next;
+    }
+    return true;
+}
+
+/**
+ * Copy data out of a block chain.
+ *
+ * @param[in] map Mapping.
+ * @param[in] block First block.
+ * @param[in] offset Offset into the chain's data.
+ * @param[out] dst Destination.
+ * @param[in] len Length to copy.
+ */
+static void shm_blocks_read(
+    const shm_map_t *map,
+    uint32_t block,
+    size_t offset,
+    uint8_t *dst,
+    size_t len)
+{
+    while (offset >= KVSTORE_SHM_BLOCK_DATA) {
+        block = map->blocks[block].next;
+        offset -= KVSTORE_SHM_BLOCK_DATA;
+    }
+    while (len > 0) {
+        size_t n = KVSTORE_SHM_BLOCK_DATA - offset;
+
+        if (n > len) {
+            n = len;
+        }
+        memcpy(dst, map->blocks[block].data + offset, n);
+        dst += n;
+        len -= n;
+        offset = 0;
+        block = map->blocks[block].next;
+    }
+}
+
+/**
+ * Copy data into a block chain.
+ *
+ * @param[in] map Mapping.
+ * @param[in,out] pblock Current block; advanced as blocks fill.
+ * @param[in,out] poffset Offset in the current block.
+ * @param[in] src Source.
+ * @param[in] len Length to copy.
+ */
+static void shm_blocks_write(
+    shm_map_t *map,
+    uint32_t *pblock,
+    size_t *poffset,
+    const uint8_t *src,
+    size_t len)
+{
+    while (len > 0) {
+        size_t n;
+
+        if (*poffset == KVSTORE_SHM_BLOCK_DATA) {
+            *pblock = map->blocks[*pblock].next;
+            *poffset = 0;
+        }
+        n = KVSTORE_SHM_BLOCK_DATA - *poffset;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(map->blocks[*pblock].data + *poffset, src, n);
+        src += n;
+        len -= n;
+        *poffset += n;
+    }
+}
+
+/**
+ * Remove an entry from its stripe's LRU list.
+ *
+ * @param[in] map Mapping.
+ * @param[in] stripe Stripe.
+ * @param[in] e Entry index.
+ */
+static void shm_lru_unlink(
+    shm_map_t *map,
+    shm_stripe_t *stripe,
+    uint32_t e)
+{
+    shm_entry_t *entry = &map->entries[e];
+
+    if (entry->lru_prev != SHM_NIL) {
+        map->entries[entry->lru_prev].lru_next = entry->lru_next;
+    }
+    else {
+        stripe->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != SHM_NIL) {
+        map->entries[entry->lru_next].lru_prev = entry->lru_prev;
+    }
+    else {
+        stripe->lru_tail = entry->lru_prev;
+    }
+}
+
+/**
+ * Make an entry the most recently used in its stripe.
+ *
+ * @param[in] map Mapping.
+ * @param[in] stripe Stripe.
+ * @param[in] e Entry index, not on the LRU list.
+ */
+static void shm_lru_push(
+    shm_map_t *map,
+    shm_stripe_t *stripe,
+    uint32_t e)
+{
+    shm_entry_t *entry = &map->entries[e];
+
+    entry->lru_prev = SHM_NIL;
+    entry->lru_next = stripe->lru_head;
+    if (stripe->lru_head != SHM_NIL) {
+        map->entries[stripe->lru_head].lru_prev = e;
+    }
+    else {
+        stripe->lru_tail = e;
+    }
+    stripe->lru_head = e;
+}
+
+/**
+ * Remove an entry, returning its blocks and itself to the free lists.
+ *
+ * @param[in] map Mapping.
+ * @param[in] s Stripe index.
+ * @param[in] e Entry index.
+ */
+static void shm_entry_remove(
+    shm_map_t *map,
+    uint32_t s,
+    uint32_t e)
+{
+    shm_stripe_t *stripe = &map->stripes[s];
+    shm_entry_t *entry = &map->entries[e];
+    uint32_t *link = &map->buckets[shm_bucket_of(map, s, entry->hash)];
+    uint32_t block;
+    uint32_t nblocks;
+
+    /* Unlink from the bucket chain. */
+    while (*link != e) {
+        assert(*link != SHM_NIL);
+        link = &map->entries[*link].next;
+    }
+    *link = entry->next;
+
+    shm_lru_unlink(map, stripe, e);
+
+    /* Splice the block chain onto the free block list. */
+    block = entry->first_block;
+    if (block != SHM_NIL) {
+        nblocks = 1;
+        while (map->blocks[block].next != SHM_NIL) {
+            block = map->blocks[block].next;
+            ++nblocks;
+        }
+        map->blocks[block].next = stripe->free_blocks;
+        stripe->free_blocks = entry->first_block;
+        stripe->nfree_blocks += nblocks;
+    }
+
+    entry->next = stripe->free_entries;
+    stripe->free_entries = e;
+}
+
+/**
+ * Find an entry.
+ *
+ * @param[in] map Mapping.
+ * @param[in] s Stripe index.
+ * @param[in] hash Key hash.
+ * @param[in] key Key.
+ *
+ * @returns Entry index or SHM_NIL.
+ */
+static uint32_t shm_find(
+    const shm_map_t *map,
+    uint32_t s,
+    uint64_t hash,
+    const ib_kvstore_key_t *key)
+{
+    uint32_t e = map->buckets[shm_bucket_of(map, s, hash)];
+
+    while (e != SHM_NIL) {
+        const shm_entry_t *entry = &map->entries[e];
+
+        if ( (entry->hash == hash) &&
+             (entry->key_length == key->length) &&
+             shm_blocks_equal(map, entry->first_block,
+                              key->key, key->length) )
+        {
+            return e;
+        }
+        e = entry->next;
+    }
+
+    return SHM_NIL;
+}
+
+/**
+ * Is an entry expired?
+ *
+ * @param[in] entry Entry.
+ * @param[in] now Current time in seconds.
+ *
+ * @returns True if @a entry has expired.
+ */
+static bool shm_expired(const shm_entry_t *entry, uint32_t now)
+{
+    return (entry->expiration != 0) && (entry->expiration <= now);
+}
+
+/**
+ * Evict the least recently used entry of a stripe.
+ *
+ * @param[in] map Mapping.
+ * @param[in] s Stripe index.
+ *
+ * @returns True if an entry was evicted.
+ */
+static bool shm_evict(shm_map_t *map, uint32_t s)
+{
+    uint32_t e = map->stripes[s].lru_tail;
+
+    if (e == SHM_NIL) {
+        return false;
+    }
+    shm_entry_remove(map, s, e);
+    return true;
+}
+
+/**
+ * Mark the file mapped at @a base stale, if it is a store file.
+ *
+ * @param[in] base Mapping.
+ * @param[in] size Size of the mapping.
+ */
+static void shm_mark_stale(uint8_t *base, size_t size)
+{
+    shm_header_t *header = (shm_header_t *)base;
+
+    if ( (size >= sizeof(*header)) &&
+         (memcmp(header->magic, kvstore_shm_magic,
+                 sizeof(header->magic)) == 0) )
+    {
+        __atomic_store_n(&header->state, KVSTORE_SHM_STALE, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Create a mapping of a file descriptor.
+ *
+ * @param[in] fd File descriptor.
+ * @param[in] size Size to map.
+ * @param[out] pmap The new mapping; its arrays are not attached.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on memory allocation failure.
+ *   - IB_EOTHER if the file could not be mapped.
+ */
+static ib_status_t shm_map_create(int fd, size_t size, shm_map_t **pmap)
+{
+    shm_map_t *map;
+    void *base;
+
+    map = calloc(1, sizeof(*map));
+    if (map == NULL) {
+        return IB_EALLOC;
+    }
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        free(map);
+        return IB_EOTHER;
+    }
+    map->base = base;
+    map->mapped = size;
+    map->header = (shm_header_t *)base;
+
+    *pmap = map;
+    return IB_OK;
+}
+
+/**
+ * Destroy a mapping and the mappings it replaced.
+ *
+ * @param[in] map Mapping, or NULL.
+ */
+static void shm_map_destroy(shm_map_t *map)
+{
+    while (map != NULL) {
+        shm_map_t *retired = map->retired;
+
+        munmap(map->base, map->mapped);
+        free(map);
+        map = retired;
+    }
+}
+
+/**
+ * Build and initialize a new file next to @a path and rename it over it.
+ *
+ * @param[in] server Server.
+ * @param[in] layout Layout of the new file.
+ * @param[out] pmap Mapping of the new file.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on memory allocation failure.
+ *   - IB_EOTHER on system call failure.
+ */
+static ib_status_t shm_replace(
+    kvstore_shm_server_t *server,
+    const shm_header_t *layout,
+    shm_map_t **pmap)
+{
+    shm_map_t *map = NULL;
+    size_t len = strlen(server->path);
+    ib_status_t rc;
+    char *tmp;
+    int fd;
+
+    tmp = malloc(len + sizeof(".XXXXXX"));
+    if (tmp == NULL) {
+        return IB_EALLOC;
+    }
+    memcpy(tmp, server->path, len);
+    memcpy(tmp + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+        free(tmp);
+        return IB_EOTHER;
+    }
+    if (ftruncate(fd, layout->size) != 0) {
+        rc = IB_EOTHER;
+        goto failure;
+    }
+    rc = shm_map_create(fd, layout->size, &map);
+    if (rc != IB_OK) {
+        goto failure;
+    }
+    rc = shm_format(map, layout);
+    if (rc != IB_OK) {
+        goto failure;
+    }
+    if (rename(tmp, server->path) != 0) {
+        rc = IB_EOTHER;
+        goto failure;
+    }
+
+    close(fd);
+    free(tmp);
+    *pmap = map;
+    return IB_OK;
+
+failure:
+    shm_map_destroy(map);
+    unlink(tmp);
+    close(fd);
+    free(tmp);
+    return rc;
+}
+
+/**
+ * Map the file, creating or replacing it if needed.
+ *
+ * @param[in] server Server.
+ * @param[out] pmap Mapping of the file.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on memory allocation failure.
+ *   - IB_EINVAL if the file must be created and the size is too small.
+ *   - IB_EOTHER on system call failure.
+ */
+static ib_status_t shm_map_open(
+    kvstore_shm_server_t *server,
+    shm_map_t **pmap)
+{
+    shm_map_t *map = NULL;
+    shm_map_t *old = NULL;
+    ib_status_t rc = IB_OK;
+    shm_header_t layout;
+    struct stat sb;
+    struct stat sp;
+    size_t size;
+    int fd;
+
+    for (;;) {
+        fd = open(server->path, O_RDWR | O_CREAT, 0600);
+        if (fd < 0) {
+            return IB_EOTHER;
+        }
+
+        /* Serialize initialization between processes. */
+        if ( (flock(fd, LOCK_EX) != 0) || (fstat(fd, &sb) != 0) ) {
+            close(fd);
+            return IB_EOTHER;
+        }
+
+        /* Start over if the file was replaced while waiting for the lock. */
+        if ( (stat(server->path, &sp) == 0) &&
+             (sp.st_dev == sb.st_dev) &&
+             (sp.st_ino == sb.st_ino) )
+        {
+            break;
+        }
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+
+    /* Use an existing file as it is, whatever size was asked for. */
+    if ((size_t)sb.st_size >= sizeof(shm_header_t)) {
+        rc = shm_map_create(fd, sb.st_size, &map);
+        if (rc != IB_OK) {
+            goto cleanup;
+        }
+        if (shm_header_valid(map->header, sb.st_size)) {
+            shm_attach(map);
+            goto cleanup;
+        }
+        old = map;
+        map = NULL;
+    }
+
+    size = server->size;
+    rc = shm_layout(size, &layout);
+    if (rc != IB_OK) {
+        goto cleanup;
+    }
+
+    if (sb.st_size == 0) {
+        /* A new file, which no one else can be using: format it in place. */
+        if (ftruncate(fd, size) != 0) {
+            rc = IB_EOTHER;
+            goto cleanup;
+        }
+        rc = shm_map_create(fd, size, &map);
+        if (rc != IB_OK) {
+            goto cleanup;
+        }
+        rc = shm_format(map, &layout);
+    }
+    else {
+        /* Other processes may have the file mapped: replace it. */
+        rc = shm_replace(server, &layout, &map);
+        if ( (rc == IB_OK) && (old != NULL) ) {
+            shm_mark_stale(old->base, old->mapped);
+        }
+    }
+    if (rc != IB_OK) {
+        shm_map_destroy(map);
+        map = NULL;
+    }
+
+cleanup:
+    shm_map_destroy(old);
+    flock(fd, LOCK_UN);
+    close(fd);
+    if (rc == IB_OK) {
+        *pmap = map;
+    }
+    return rc;
+}
+
+/**
+ * Fetch the current mapping, mapping the new file if the file was replaced.
+ *
+ * @param[in] server Server.
+ * @param[out] pmap Current mapping.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EINVAL if the store is not connected.
+ *   - Other errors of shm_map_open() if the new file could not be mapped.
+ */
+static ib_status_t shm_current(kvstore_shm_server_t *server, shm_map_t **pmap)
+{
+    shm_map_t *map = __atomic_load_n(&server->map, __ATOMIC_ACQUIRE);
+    shm_map_t *fresh;
+    ib_status_t rc = IB_OK;
+
+    if (map == NULL) {
+        return IB_EINVAL;
+    }
+    if ( __atomic_load_n(&map->header->state, __ATOMIC_ACQUIRE) ==
+         KVSTORE_SHM_READY )
+    {
+        *pmap = map;
+        return IB_OK;
+    }
+
+    /* Another process replaced the file. */
+    pthread_mutex_lock(&server->lock);
+    map = server->map;
+    if ( (map != NULL) &&
+         (__atomic_load_n(&map->header->state, __ATOMIC_ACQUIRE) !=
+          KVSTORE_SHM_READY) )
+    {
+        rc = shm_map_open(server, &fresh);
+        if (rc == IB_OK) {
+            /* Other threads may still be using the old mapping. */
+            fresh->retired = map;
+            __atomic_store_n(&server->map, fresh, __ATOMIC_RELEASE);
+            map = fresh;
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (map == NULL) {
+        return IB_EINVAL;
+    }
+    *pmap = map;
+    return rc;
+}
+
+static ib_status_t kvconnect(
+    ib_kvstore_t *kvstore,
+    ib_kvstore_cbdata_t *cbdata)
+{
+    assert(kvstore);
+
+    kvstore_shm_server_t *server = (kvstore_shm_server_t *)kvstore->server;
+    shm_map_t *map;
+    ib_status_t rc;
+
+    if (server->map != NULL) {
+        return IB_OK;
+    }
+
+    rc = shm_map_open(server, &map);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    __atomic_store_n(&server->map, map, __ATOMIC_RELEASE);
+
+    return IB_OK;
+}
+
+static ib_status_t kvdisconnect(
+    ib_kvstore_t *kvstore,
+    ib_kvstore_cbdata_t *cbdata)
+{
+    assert(kvstore);
+
+    kvstore_shm_server_t *server = (kvstore_shm_server_t *)kvstore->server;
+
+    shm_map_destroy(server->map);
+    server->map = NULL;
+
+    return IB_OK;
+}
+
+/**
+ * Get callback.
+ *
+ * @param[in] kvstore Key-value store.
+ * @param[in] key The key to fetch.
+ * @param[out] values The value, if found, as an array of length 1.
+ * @param[out] values_length The length of @a values.
+ * @param[in,out] cbdata Callback data for the user.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_ENOENT if the key is not found or has expired.
+ *   - IB_EALLOC on memory allocation error.
+ *   - IB_EINVAL if the store is not connected.
+ *   - IB_EOTHER if the stripe could not be locked, or the file was
+ *     replaced and the new file could not be mapped.
+ */
+static ib_status_t kvget(
+    ib_kvstore_t *kvstore,
+    const ib_kvstore_key_t *key,
+    ib_kvstore_value_t ***values,
+    size_t *values_length,
+    ib_kvstore_cbdata_t *cbdata)
+{
+    assert(kvstore);
+    assert(key);
+    assert(values);
+    assert(values_length);
+
+    kvstore_shm_server_t *server = (kvstore_shm_server_t *)kvstore->server;
+    ib_kvstore_value_t **array = NULL;
+    ib_kvstore_value_t *value = NULL;
+    ib_timeval_t now;
+    const shm_entry_t *entry;
+    uint64_t hash;
+    uint32_t s;
+    uint32_t e;
+    shm_map_t *map;
+    ib_status_t rc;
+
+    *values = NULL;
+    *values_length = 0;
+
+    rc = shm_current(server, &map);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    hash = shm_hash(key);
+    s = shm_stripe_of(map, hash);
+    ib_clock_gettimeofday(&now);
+
+    /* Allocate before locking, to keep the critical section short. */
+    array = kvstore->malloc(kvstore, sizeof(*array), kvstore->malloc_cbdata);
+    value = kvstore->malloc(kvstore, sizeof(*value), kvstore->malloc_cbdata);
+    if ( (array == NULL) || (value == NULL) ) {
+        rc = IB_EALLOC;
+        goto failure;
+    }
+    memset(value, 0, sizeof(*value));
+
+    rc = shm_lock(map, s);
+    if (rc != IB_OK) {
+        goto failure;
+    }
+
+    e = shm_find(map, s, hash, key);
+    if (e == SHM_NIL) {
+        shm_unlock(map, s);
+        rc = IB_ENOENT;
+        goto failure;
+    }
+    entry = &map->entries[e];
+    if (shm_expired(entry, now.tv_sec)) {
+        shm_entry_remove(map, s, e);
+        shm_unlock(map, s);
+        rc = IB_ENOENT;
+        goto failure;
+    }
+
+    value->value = kvstore->malloc(
+        kvstore,
+        entry->value_length > 0 ? entry->value_length : 1,
+        kvstore->malloc_cbdata);
+    value->type = kvstore->malloc(
+        kvstore,
+        entry->type_length + 1,
+        kvstore->malloc_cbdata);
+    if ( (value->value == NULL) || (value->type == NULL) ) {
+        shm_unlock(map, s);
+        rc = IB_EALLOC;
+        goto failure;
+    }
+
+    shm_blocks_read(map, entry->first_block, entry->key_length,
+                    (uint8_t *)value->type, entry->type_length);
+    value->type[entry->type_length] = '\0';
+    value->type_length = entry->type_length;
+    shm_blocks_read(map, entry->first_block,
+                    entry->key_length + entry->type_length,
+                    value->value, entry->value_length);
+    value->value_length = entry->value_length;
+    value->expiration = (entry->expiration == 0) ?
+                        0 : entry->expiration - now.tv_sec;
+    value->creation.tv_sec = entry->creation_sec;
+    value->creation.tv_usec = entry->creation_usec;
+
+    shm_lru_unlink(map, &map->stripes[s], e);
+    shm_lru_push(map, &map->stripes[s], e);
+
+    shm_unlock(map, s);
+
+    array[0] = value;
+    *values = array;
+    *values_length = 1;
+    return IB_OK;
+
+failure:
+    if (value != NULL) {
+        if (value->value != NULL) {
+            kvstore->free(kvstore, value->value, kvstore->free_cbdata);
+        }
+        if (value->type != NULL) {
+            kvstore->free(kvstore, value->type, kvstore->free_cbdata);
+        }
+        kvstore->free(kvstore, value, kvstore->free_cbdata);
+    }
+    if (array != NULL) {
+        kvstore->free(kvstore, array, kvstore->free_cbdata);
+    }
+    return rc;
+}
+
+/**
+ * Set callback.
+ *
+ * @param[in] kvstore Key-value store.
+ * @param[in] merge_policy Unused; a set replaces any existing value.
+ * @param[in] key The key to set.
+ * @param[in] value The value to write.
+ * @param[in,out] cbdata Callback data for the user.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EINVAL if the store is not connected, the key is empty, or the
+ *     key, type and value do not fit in a stripe.
+ *   - IB_EOTHER if the stripe could not be locked, or the file was
+ *     replaced and the new file could not be mapped.
+ */
+static ib_status_t kvset(
+    ib_kvstore_t *kvstore,
+    ib_kvstore_merge_policy_fn_t merge_policy,
+    const ib_kvstore_key_t *key,
+    ib_kvstore_value_t *value,
+    ib_kvstore_cbdata_t *cbdata)
+{
+    assert(kvstore);
+    assert(key);
+    assert(value);
+
+    kvstore_shm_server_t *server = (kvstore_shm_server_t *)kvstore->server;
+    shm_stripe_t *stripe;
+    shm_entry_t *entry;
+    ib_timeval_t now;
+    uint64_t hash;
+    uint64_t total;
+    uint32_t nblocks;
+    uint32_t s;
+    uint32_t e;
+    uint32_t block;
+    size_t offset;
+    uint32_t i;
+    shm_map_t *map;
+    ib_status_t rc;
+
+    if (key->length == 0) {
+        return IB_EINVAL;
+    }
+    rc = shm_current(server, &map);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    total = (uint64_t)key->length + value->type_length + value->value_length;
+    nblocks = (uint32_t)((total + KVSTORE_SHM_BLOCK_DATA - 1) /
+                         KVSTORE_SHM_BLOCK_DATA);
+    if ( (total > UINT32_MAX) ||
+         (nblocks > map->header->blocks_per_stripe) )
+    {
+        return IB_EINVAL;
+    }
+
+    hash = shm_hash(key);
+    s = shm_stripe_of(map, hash);
+    stripe = &map->stripes[s];
+    ib_clock_gettimeofday(&now);
+
+    rc = shm_lock(map, s);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    /* Replace any existing value. */
+    e = shm_find(map, s, hash, key);
+    if (e != SHM_NIL) {
+        shm_entry_remove(map, s, e);
+    }
+
+    /* Make room. */
+    while ( (stripe->nfree_blocks < nblocks) ||
+            (stripe->free_entries == SHM_NIL) )
+    {
+        if (! shm_evict(map, s)) {
+            shm_unlock(map, s);
+            return IB_EINVAL;
+        }
+    }
+
+    e = stripe->free_entries;
+    entry = &map->entries[e];
+    stripe->free_entries = entry->next;
+
+    /* Take the blocks, terminating the chain after the last. */
+    entry->first_block = stripe->free_blocks;
+    block = stripe->free_blocks;
+    for (i = 1; i < nblocks; ++i) {
+        block = map->blocks[block].next;
+    }
+    stripe->free_blocks = map->blocks[block].next;
+    stripe->nfree_blocks -= nblocks;
+    map->blocks[block].next = SHM_NIL;
+
+    entry->hash = hash;
+    entry->key_length = key->length;
+    entry->type_length = (value->type == NULL) ? 0 : value->type_length;
+    entry->value_length = value->value_length;
+    entry->expiration = (value->expiration == 0) ?
+                        0 : now.tv_sec + value->expiration;
+    entry->creation_sec = now.tv_sec;
+    entry->creation_usec = now.tv_usec;
+
+    block = entry->first_block;
+    offset = 0;
+    shm_blocks_write(map, &block, &offset,
+                     key->key, key->length);
+    shm_blocks_write(map, &block, &offset,
+                     (const uint8_t *)value->type, entry->type_length);
+    shm_blocks_write(map, &block, &offset,
+                     value->value, value->value_length);
+
+    i = shm_bucket_of(map, s, hash);
+    entry->next = map->buckets[i];
+    map->buckets[i] = e;
+    shm_lru_push(map, stripe, e);
+
+    shm_unlock(map, s);
+
+    return IB_OK;
+}
+
+/**
+ * Remove a key from the store.
+ *
+ * @param[in] kvstore
+ * @param[in] key
+ * @param[in,out] cbdata Callback data.
+ * @returns
+ *   - IB_OK on success, whether or not the key was present.
+ *   - IB_EINVAL if the store is not connected.
+ *   - IB_EOTHER if the stripe could not be locked, or the file was
+ *     replaced and the new file could not be mapped.
+ */
+static ib_status_t kvremove(
+    ib_kvstore_t *kvstore,
+    const ib_kvstore_key_t *key,
+    ib_kvstore_cbdata_t *cbdata)
+{
+    assert(kvstore);
+    assert(key);
+
+    kvstore_shm_server_t *server = (kvstore_shm_server_t *)kvstore->server;
+    uint64_t hash;
+    uint32_t s;
+    uint32_t e;
+    shm_map_t *map;
+    ib_status_t rc;
+
+    rc = shm_current(server, &map);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    hash = shm_hash(key);
+    s = shm_stripe_of(map, hash);
+
+    rc = shm_lock(map, s);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    e = shm_find(map, s, hash, key);
+    if (e != SHM_NIL) {
+        shm_entry_remove(map, s, e);
+    }
+    shm_unlock(map, s);
+
+    return IB_OK;
+}
+
+/**
+ * Destroy any allocated elements of the kvstore structure.
+ * @param[out] kvstore to be destroyed. The mapped file is untouched
+ *             and another init of kvstore pointing at that file
+ *             will operate correctly.
+ * @param[in] cbdata Unused.
+ */
+static void kvdestroy(ib_kvstore_t *kvstore, ib_kvstore_cbdata_t *cbdata)
+{
+    assert(kvstore);
+
+    kvstore_shm_server_t *server = (kvstore_shm_server_t *)kvstore->server;
+
+    shm_map_destroy(server->map);
+    pthread_mutex_destroy(&server->lock);
+    free(server->path);
+    free(server);
+    kvstore->server = NULL;
+
+    return;
+}
+
+ib_status_t ib_kvstore_shm_init(
+    ib_kvstore_t *kvstore,
+    const char *path,
+    size_t size)
+{
+    assert(kvstore);
+    assert(path);
+
+    /* There is no callback data used for this implementation. */
+    ib_kvstore_init(kvstore);
+
+    kvstore_shm_server_t *server = calloc(1, sizeof(*server));
+
+    if ( server == NULL ) {
+        return IB_EALLOC;
+    }
+
+    server->path = strdup(path);
+    server->size = size;
+
+    if ( server->path == NULL ) {
+        free(server);
+        return IB_EALLOC;
+    }
+
+    if (pthread_mutex_init(&server->lock, NULL) != 0) {
+        free(server->path);
+        free(server);
+        return IB_EOTHER;
+    }
+
+    kvstore->server = (ib_kvstore_server_t *) server;
+    kvstore->get = kvget;
+    kvstore->set = kvset;
+    kvstore->remove = kvremove;
+    kvstore->connect = kvconnect;
+    kvstore->disconnect = kvdisconnect;
+    kvstore->destroy = kvdestroy;
+
+    kvstore->malloc_cbdata = NULL;
+    kvstore->free_cbdata = NULL;
+    kvstore->connect_cbdata = NULL;
+    kvstore->disconnect_cbdata = NULL;
+    kvstore->get_cbdata = NULL;
+    kvstore->set_cbdata = NULL;
+    kvstore->remove_cbdata = NULL;
+    kvstore->merge_policy_cbdata = NULL;
+    kvstore->destroy_cbdata = NULL;
+
+    return IB_OK;
+}
@@ -28,6 +28,8 @@
 #include <ironbee/string.h>
 #include <ironbee/util.h>
 
+#include "string_simd_private.h"
+
 #include <assert.h>
 #include <ctype.h>
 #include <libgen.h>
@@ -94,6 +96,20 @@ ib_status_t ib_util_decode_url_ex(uint8_t *data_in,
     bool modified = false;
 
     while (in < end) {
+        /* Skip (or move) the run of characters that aren't encoded */
+        size_t n = ib_simd_find_byte2(in, end - in, '%', '+');
+        if (n > 0) {
+            if (out != in) {
+                memmove(out, in, n);
+                modified = true;
+            }
+            out += n;
+            in += n;
+            if (in == end) {
+                break;
+            }
+        }
+
         if (*in == '%') {
             /* Character is a percent sign. */
 
@@ -177,6 +193,19 @@ ib_status_t ib_util_decode_url_cow_ex(ib_mpool_t *mp,
     *data_out = NULL;
 
     while (in < end) {
+        /* Skip (or copy) the run of characters that aren't encoded */
+        size_t n = ib_simd_find_byte2(in, end - in, '%', '+');
+        if (n > 0) {
+            if (out != NULL) {
+                memcpy(out, in, n);
+                out += n;
+            }
+            in += n;
+            if (in == end) {
+                break;
+            }
+        }
+
         if (*in == '%') {
             /* Character is a percent sign. */
 
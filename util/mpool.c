@@ -36,10 +36,13 @@
 #endif
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 /**
@@ -142,8 +145,28 @@ static char s_zero_length_buffer[1];
  **/
 #define IB_MPOOL_TRACK_ZERO_SIZE 5
 
+/**
+ * The number of child lists of a pool; actually log2 of the number.
+ *
+ * The children of a pool are spread over several lists, each with its own
+ * lock, by the thread that creates them.  Threads that create and destroy
+ * children of a common parent, e.g., connection pools of the engine pool,
+ * thus rarely contend for the same lock.
+ *
+ * The lists are only allocated once a pool gets its first child and cost
+ * about 64 bytes each.
+ **/
+#define IB_MPOOL_CHILD_LISTS_SIZE 4
+
 /**@}*/
 
+/**
+ * The number of child lists of a pool.
+ *
+ * This macro is calculated from IB_MPOOL_CHILD_LISTS_SIZE.  Do not change it.
+ **/
+#define IB_MPOOL_NUM_CHILD_LISTS (1 << IB_MPOOL_CHILD_LISTS_SIZE)
+
 /* Basic Sanity Check -- Otherwise track number calculation fails. */
 #if IB_MPOOL_NUM_TRACKS - IB_MPOOL_TRACK_ZERO_SIZE > 32
     #error "IB_MPOOL_NUM_TRACKS - IB_MPOOL_TRACK_ZERO_SIZE > 32"
@@ -157,6 +180,12 @@ typedef struct ib_mpool_page_t ib_mpool_page_t;
 typedef struct ib_mpool_pointer_page_t ib_mpool_pointer_page_t;
 /** See struct ib_mpool_cleanup_t */
 typedef struct ib_mpool_cleanup_t ib_mpool_cleanup_t;
+/** See struct ib_mpool_child_list_t */
+typedef struct ib_mpool_child_list_t ib_mpool_child_list_t;
+/** See struct ib_mpool_page_cache_list_t */
+typedef struct ib_mpool_page_cache_list_t ib_mpool_page_cache_list_t;
+/** See struct ib_mpool_page_cache_t */
+typedef struct ib_mpool_page_cache_t ib_mpool_page_cache_t;
 
 /**
  * A page to hold small allocations.
@@ -217,6 +246,106 @@ struct ib_mpool_cleanup_t {
     void                  *function_data;
 };
 
+/**
+ * A list of children of a memory pool.
+ *
+ * @sa IB_MPOOL_CHILD_LISTS_SIZE
+ **/
+struct ib_mpool_child_list_t
+{
+    /**
+     * Lock protecting the lists.
+     *
+     * Creation, release, and destruction of children modify these lists
+     * and must hold this lock.
+     **/
+    ib_lock_t lock;
+
+    /**
+     * Singly linked list of child pools.
+     **/
+    ib_mpool_t *children;
+    /**
+     * End of children list.
+     **/
+    ib_mpool_t *children_end;
+
+    /**
+     * Singly linked list of free children.
+     *
+     * @sa ib_mpool_t
+     **/
+    ib_mpool_t *free_children;
+};
+
+/**
+ * Pages of a page cache used by one thread (or a few threads).
+ *
+ * @sa ib_mpool_page_cache_t
+ **/
+struct ib_mpool_page_cache_list_t
+{
+    /**
+     * Lock protecting this list and its statistics.
+     **/
+    ib_lock_t lock;
+
+    /**
+     * Singly linked list of cached pages.
+     **/
+    ib_mpool_page_t *pages;
+
+    /**
+     * Number of pages in @c pages.
+     **/
+    size_t num_pages;
+
+    /** @name Statistics
+     * Reported by ib_mpool_analyze().
+     */
+    /**@{*/
+    /** Pages acquired from the cache. */
+    size_t hits;
+    /** Pages malloced as the cache was empty. */
+    size_t misses;
+    /** Pages returned to the cache. */
+    size_t returns;
+    /** Pages freed as the cache was full. */
+    size_t overflows;
+    /**@}*/
+};
+
+/**
+ * A page cache.
+ *
+ * Created by ib_mpool_enable_page_cache() and shared by its owner and all
+ * descendants with the same page size, malloc, and free function.  When
+ * such a descendant is destroyed or released, its pages are returned to the
+ * cache instead of being freed, and when it needs a new page, it takes one
+ * from the cache instead of calling malloc.
+ *
+ * As with child lists, the cache is split into IB_MPOOL_NUM_CHILD_LISTS
+ * lists picked by the current thread, each holding at most @c max_pages
+ * pages.
+ **/
+struct ib_mpool_page_cache_t
+{
+    /**
+     * Pool that created the cache; the cache is destroyed with it.
+     **/
+    const ib_mpool_t *owner;
+
+    /**
+     * Maximum number of pages per list.
+     **/
+    size_t max_pages;
+
+    /**
+     * Lists of pages.
+     **/
+    ib_mpool_page_cache_list_t lists[IB_MPOOL_NUM_CHILD_LISTS];
+};
+
 /**
  * A memory pool.
  *
@@ -280,6 +409,16 @@ struct ib_mpool_cleanup_t {
  * the pool is cleared and added to the free children list of the parent
  * pool.
  *
+ * A pool can also be given a page cache (ib_mpool_enable_page_cache()) that
+ * its descendants return pages to on destroy and release and acquire pages
+ * from before calling malloc.  With it, a steady stream of short lived
+ * pools, e.g., transaction pools, does next to no mallocs or frees.
+ *
+ * Children are kept in IB_MPOOL_NUM_CHILD_LISTS child lists, each with its
+ * own lock.  A child is put on the list picked by the thread creating it and
+ * reuses free children of that list only.  Many threads can thus create and
+ * release children of a common parent in parallel.
+ *
  * Finally, cleanup functions can be registered with a pool to be called on
  * clear or destroy.  It is assumed that these are relatively rare.  They are
  * thus stored in a simple singly linked list, with a new node being allocated
@@ -360,30 +499,43 @@ struct ib_mpool_t
     /**
      * The next sibling.
      *
-     * This pointer is considered to be part of the parent in terms of
-     * locking.  I.e., to modify this, the parent should be locked.
+     * This pointer is considered to be part of the parent's child list in
+     * terms of locking.  I.e., to modify this, the child list should be
+     * locked.
      **/
     ib_mpool_t *next;
 
     /**
-     * Singly linked list of all child pools.
+     * Index of the child list of the parent this pool is on.
      **/
-    ib_mpool_t *children;
+    size_t child_list;
+
     /**
-     * End of children list.
+     * Child lists.
+     *
+     * NULL until the first child is created.
+     *
+     * @sa ib_mpool_child_list_t
      **/
-    ib_mpool_t *children_end;
+    ib_mpool_child_list_t *child_lists;
 
     /**
      * Lock for multithreading support.
      *
-     * This lock is only used in creation and destruction to allow
-     * simultaneous creation/destruction of memory pools with a common
-     * parent.  Both operations must modify the parents children list and
-     * this lock protects it.
+     * This lock is only used to allocate @c child_lists.  The lists
+     * themselves have their own locks.
      **/
     ib_lock_t lock;
 
+    /**
+     * Page cache to acquire pages from and return pages to.
+     *
+     * NULL if none.
+     *
+     * @sa ib_mpool_page_cache_t
+     **/
+    ib_mpool_page_cache_t *page_cache;
+
     /**
      * Tracks of pages.
      *
@@ -432,12 +584,6 @@ struct ib_mpool_t
      * @sa ib_mpool_t
      **/
     ib_mpool_cleanup_t      *free_cleanups;
-    /**
-     * Singly linked list of free children.
-     *
-     * @sa ib_mpool_t
-     **/
-    ib_mpool_t              *free_children;
 };
 
 /**
@@ -468,9 +614,8 @@ struct ib_mpool_t
  * @a var to be safely changed or removed.
  *
  * @code
- * IB_MPOOL_FOREACH(ib_mpool_t, child, mp->children) {
- *   child->parent = NULL;
- *   ib_mpool_destroy(child);
+ * IB_MPOOL_FOREACH(ib_mpool_page_t, mpage, mp->free_pages) {
+ *   mp->free_fn(mpage);
  * }
  * @endcode
  *
@@ -485,6 +630,31 @@ struct ib_mpool_t
         (var) = imf_next \
     )
 
+/**
+ * Loop through a list of all child lists of a pool allowing for mutation.
+ *
+ * As IB_MPOOL_FOREACH() but for the @a list (@c children or
+ * @c free_children) of each child list of @a mp in turn.
+ *
+ * @code
+ * IB_MPOOL_FOREACH_CHILD(ib_mpool_t, child, mp, children) {
+ *   ib_mpool_clear(child);
+ * }
+ * @endcode
+ *
+ * @param[in] vartype The *base type* of a node of @a list.
+ * @param[in] var     The *name* of a variable to a pointer to each node.
+ * @param[in] mp      Memory pool.
+ * @param[in] list    The name of the list member of ib_mpool_child_list_t.
+ **/
+#define IB_MPOOL_FOREACH_CHILD(vartype, var, mp, list) \
+    for ( \
+        size_t imfc_list = 0; \
+        (mp)->child_lists != NULL && imfc_list < IB_MPOOL_NUM_CHILD_LISTS; \
+        ++imfc_list \
+    ) \
+        IB_MPOOL_FOREACH(vartype, var, (mp)->child_lists[imfc_list].list)
+
 /**
  * The maximum size of an allocation for a page of track @a track_num.
  *
@@ -555,37 +725,130 @@ size_t ib_mpool_track_number(size_t size)
 /**
  * Remove a child pool from a parent pools child list.
  *
- * The parent should usually be locked before calling this.
+ * The child list of @a child should usually be locked before calling this.
  *
  * @param[in] child Child to remove from parent pool.
  */
 static
 void ib_mpool_remove_child_from_parent(const ib_mpool_t *child)
 {
-    assert(child         != NULL);
-    assert(child->parent != NULL);
+    assert(child                      != NULL);
+    assert(child->parent              != NULL);
+    assert(child->parent->child_lists != NULL);
+
+    ib_mpool_child_list_t *list =
+        &(child->parent->child_lists[child->child_list]);
 
-    if (child->parent->children == child) {
-        child->parent->children = child->next;
+    if (list->children == child) {
+        list->children = child->next;
         if (child->next == NULL) {
-            child->parent->children_end = NULL;
+            list->children_end = NULL;
         }
     }
     else {
         /* Find node whose next node is child. */
-        ib_mpool_t *before_child = child->parent->children;
+        ib_mpool_t *before_child = list->children;
         while (before_child->next != child) {
             before_child = before_child->next;
         }
         before_child->next = child->next;
         if (child->next == NULL) {
-            child->parent->children_end = before_child;
+            list->children_end = before_child;
         }
     }
 
     return;
 }
 
+/**
+ * Index of the child list for children created by the current thread.
+ *
+ * The thread id is hashed (Fibonacci hashing) so that threads are spread
+ * evenly over the child lists.
+ *
+ * @return Index of child list.
+ */
+static
+size_t ib_mpool_child_list_index(void)
+{
+    pthread_t self = pthread_self();
+    uint64_t  hash = 0;
+
+    memcpy(
+        &hash, &self,
+        sizeof(self) < sizeof(hash) ? sizeof(self) : sizeof(hash)
+    );
+    hash *= UINT64_C(0x9e3779b97f4a7c15);
+
+    return (size_t)(hash >> (64 - IB_MPOOL_CHILD_LISTS_SIZE));
+}
+
+/**
+ * Fetch the child lists of @a mp, allocating them if needed.
+ *
+ * The child lists are allocated once and never change afterwards, so
+ * @c mp->lock is only needed to allocate them.  The pointer is published
+ * with release semantics, and read with acquire semantics, so that a thread
+ * seeing it also sees the initialized locks.
+ *
+ * @param[in] mp Memory pool.
+ * @return Child lists of @a mp or NULL on allocation or lock failure.
+ */
+static
+ib_mpool_child_list_t *ib_mpool_child_lists(ib_mpool_t *mp)
+{
+    assert(mp != NULL);
+
+    ib_mpool_child_list_t *child_lists;
+    ib_status_t            rc;
+
+    /* Once set, child_lists does not change until the pool is destroyed,
+     * so a non-NULL value can be used without the lock. */
+    child_lists = __atomic_load_n(&(mp->child_lists), __ATOMIC_ACQUIRE);
+    if (child_lists != NULL) {
+        return child_lists;
+    }
+
+    rc = ib_lock_lock(&(mp->lock));
+    if (rc != IB_OK) {
+        return NULL;
+    }
+
+    child_lists = mp->child_lists;
+    if (child_lists == NULL) {
+        child_lists = (ib_mpool_child_list_t *)mp->malloc_fn(
+            IB_MPOOL_NUM_CHILD_LISTS * sizeof(*child_lists)
+        );
+        if (child_lists != NULL) {
+            memset(
+                child_lists, 0,
+                IB_MPOOL_NUM_CHILD_LISTS * sizeof(*child_lists)
+            );
+            for (size_t i = 0; i < IB_MPOOL_NUM_CHILD_LISTS; ++i) {
+                rc = ib_lock_init(&(child_lists[i].lock));
+                if (rc != IB_OK) {
+                    while (i > 0) {
+                        --i;
+                        ib_lock_destroy(&(child_lists[i].lock));
+                    }
+                    mp->free_fn(child_lists);
+                    child_lists = NULL;
+                    break;
+                }
+            }
+        }
+        if (child_lists != NULL) {
+            __atomic_store_n(
+                &(mp->child_lists), child_lists, __ATOMIC_RELEASE
+            );
+        }
+    }
+
+    ib_lock_unlock(&(mp->lock));
+
+    return child_lists;
+}
+
 /**@}*/
 
 /**
@@ -593,11 +856,117 @@ void ib_mpool_remove_child_from_parent(const ib_mpool_t *child)
  */
 /**@{*/
 
+/**
+ * Acquire a page from a page cache.
+ *
+ * @param[in] cache Page cache.
+ * @return Page or NULL if the list of the current thread is empty.
+ **/
+static
+ib_mpool_page_t *ib_mpool_page_cache_acquire(
+    ib_mpool_page_cache_t *cache
+)
+{
+    assert(cache != NULL);
+
+    ib_mpool_page_cache_list_t *list =
+        &(cache->lists[ib_mpool_child_list_index()]);
+    ib_mpool_page_t *mpage = NULL;
+
+    if (ib_lock_lock(&(list->lock)) != IB_OK) {
+        return NULL;
+    }
+    if (list->pages != NULL) {
+        mpage = list->pages;
+        list->pages = mpage->next;
+        --list->num_pages;
+        ++list->hits;
+    }
+    else {
+        ++list->misses;
+    }
+    ib_lock_unlock(&(list->lock));
+
+    return mpage;
+}
+
+/**
+ * Return a page of @a mp to its page cache.
+ *
+ * Pages are not returned to the cache of which @a mp is the owner; they
+ * would be freed with the cache.
+ *
+ * @param[in] mp    Memory pool @a mpage belongs to.
+ * @param[in] mpage Page to return.
+ * @return true iff @a mpage is now owned by the cache.
+ **/
+static
+bool ib_mpool_page_cache_return(
+    ib_mpool_t      *mp,
+    ib_mpool_page_t *mpage
+)
+{
+    assert(mp    != NULL);
+    assert(mpage != NULL);
+
+    ib_mpool_page_cache_t *cache = mp->page_cache;
+    ib_mpool_page_cache_list_t *list = NULL;
+    bool cached = false;
+
+    if (cache == NULL || cache->owner == mp) {
+        return false;
+    }
+
+    list = &(cache->lists[ib_mpool_child_list_index()]);
+    if (ib_lock_lock(&(list->lock)) != IB_OK) {
+        return false;
+    }
+    if (list->num_pages < cache->max_pages) {
+        mpage->next = list->pages;
+        list->pages = mpage;
+        ++list->num_pages;
+        ++list->returns;
+        cached = true;
+    }
+    else {
+        ++list->overflows;
+    }
+    ib_lock_unlock(&(list->lock));
+
+    return cached;
+}
+
+/**
+ * Destroy a page cache, freeing all its pages.
+ *
+ * @param[in] mp    Owner of @a cache.
+ * @param[in] cache Page cache to destroy.
+ **/
+static
+void ib_mpool_page_cache_destroy(
+    ib_mpool_t            *mp,
+    ib_mpool_page_cache_t *cache
+)
+{
+    assert(mp    != NULL);
+    assert(cache != NULL);
+    assert(cache->owner == mp);
+
+    for (size_t i = 0; i < IB_MPOOL_NUM_CHILD_LISTS; ++i) {
+        IB_MPOOL_FOREACH(ib_mpool_page_t, mpage, cache->lists[i].pages) {
+            mp->free_fn(mpage);
+        }
+        ib_lock_destroy(&(cache->lists[i].lock));
+    }
+    mp->free_fn(cache);
+}
+
 /**
  * Acquire a new page.
  *
- * Pops a page from the free list if available or allocates a new page if
- * not.  The page returned should be considered uninitialized.
+ * Pops a page from the free list if available, takes one from the page
+ * cache if there is one, or allocates a new page if not.  The page
+ * returned should be considered uninitialized.
  *
  * @param[in] mp Memory pool to acquire page for.
  * @return Uninitialized page or NULL on allocation error.
@@ -616,7 +985,12 @@ ib_mpool_page_t *ib_mpool_acquire_page(
         mp->free_pages = mp->free_pages->next;
     }
     else {
-        mpage = mp->malloc_fn(sizeof(ib_mpool_page_t) + mp->pagesize - 1);
+        if (mp->page_cache != NULL) {
+            mpage = ib_mpool_page_cache_acquire(mp->page_cache);
+        }
+        if (mpage == NULL) {
+            mpage = mp->malloc_fn(sizeof(ib_mpool_page_t) + mp->pagesize - 1);
+        }
     }
 
 #ifdef IB_MPOOL_VALGRIND
@@ -970,9 +1344,10 @@ bool ib_mpool_debug_report_helper(
     IMR_PRINTF("  large_allocation_inuse = %zd\n",
         mp->large_allocation_inuse);
     IMR_PRINTF("  next                   = %p\n",  mp->next);
-    IMR_PRINTF("  children               = %p\n",  mp->children);
-    IMR_PRINTF("  children_end           = %p\n",  mp->children_end);
+    IMR_PRINTF("  child_list             = %zd\n", mp->child_list);
+    IMR_PRINTF("  child_lists            = %p\n",  mp->child_lists);
     IMR_PRINTF("  lock                   = %p\n",  &(mp->lock));
+    IMR_PRINTF("  page_cache             = %p\n",  mp->page_cache);
     IMR_PRINTF("  tracks                 = %p\n",  mp->tracks);
     IMR_PRINTF("  large_allocations      = %p\n",  mp->large_allocations);
     IMR_PRINTF("  large_allocations_end  = %p\n",  mp->large_allocations_end);
@@ -981,7 +1356,6 @@ bool ib_mpool_debug_report_helper(
     IMR_PRINTF("  free_pages             = %p\n",  mp->free_pages);
     IMR_PRINTF("  free_pointer_pages     = %p\n",  mp->free_pointer_pages);
     IMR_PRINTF("  free_cleanups          = %p\n",  mp->free_cleanups);
-    IMR_PRINTF("  free_children          = %p\n",  mp->free_children);
 
     IMR_PRINTF("%s", "Tracks:\n");
     for (size_t track_num = 0; track_num < IB_MPOOL_NUM_TRACKS; ++track_num) {
@@ -1043,9 +1417,9 @@ bool ib_mpool_debug_report_helper(
 
     IMR_PRINTF("Done with %p.  Moving on to free children.\n\n", mp);
 
-    IB_MPOOL_FOREACH(
+    IB_MPOOL_FOREACH_CHILD(
         const ib_mpool_t, free_child,
-        mp->free_children
+        mp, free_children
     ) {
         bool result = ib_mpool_debug_report_helper(free_child, report);
         if (! result) {
@@ -1055,9 +1429,9 @@ bool ib_mpool_debug_report_helper(
 
     IMR_PRINTF("Done with %p.  Moving on to children.\n\n", mp);
 
-    IB_MPOOL_FOREACH(
+    IB_MPOOL_FOREACH_CHILD(
         const ib_mpool_t, child,
-        mp->children
+        mp, children
     ) {
         bool result = ib_mpool_debug_report_helper(child, report);
         if (! result) {
@@ -1100,6 +1474,11 @@ bool ib_mpool_analyze_free_child(
 
     size_t total_used = sizeof(*free_child);
 
+    if (free_child->child_lists != NULL) {
+        total_used +=
+            IB_MPOOL_NUM_CHILD_LISTS * sizeof(ib_mpool_child_list_t);
+    }
+
     IB_MPOOL_FOREACH(
         const ib_mpool_page_t, mpage,
         free_child->free_pages
@@ -1128,20 +1507,21 @@ bool ib_mpool_analyze_free_child(
 
     total_used += free_page + free_cleanup + free_pointer_page;
 
-    if (free_child->free_children != NULL) {
-        IMR_PRINTF("%s", " + [");
-        IB_MPOOL_FOREACH(
+    {
+        bool first = true;
+        IB_MPOOL_FOREACH_CHILD(
             const ib_mpool_t, free_subchild,
-            free_child->free_children
+            free_child, free_children
         ) {
             size_t child_use = 0;
+            IMR_PRINTF("%s", first ? " + [" : " + ");
+            first = false;
             ib_mpool_analyze_free_child(free_subchild, report, &child_use);
             total_used += child_use;
-            if (free_subchild->next != NULL) {
-                IMR_PRINTF("%s", " + ");
-            }
         }
-        IMR_PRINTF("%s", "]");
+        if (! first) {
+            IMR_PRINTF("%s", "]");
+        }
     }
 
     *free_child_use = total_used;
@@ -1294,15 +1674,44 @@ bool ib_mpool_analyze_helper(
         );
     }
 
-    if (mp->free_children != NULL) {
-        IMR_PRINTF("%s", "Free children: ");
+    if (mp->page_cache != NULL && mp->page_cache->owner == mp) {
+        size_t pages     = 0;
+        size_t hits      = 0;
+        size_t misses    = 0;
+        size_t returns   = 0;
+        size_t overflows = 0;
+
+        for (size_t i = 0; i < IB_MPOOL_NUM_CHILD_LISTS; ++i) {
+            ib_mpool_page_cache_list_t *list = &(mp->page_cache->lists[i]);
 
+            ib_lock_lock(&(list->lock));
+            pages     += list->num_pages;
+            hits      += list->hits;
+            misses    += list->misses;
+            returns   += list->returns;
+            overflows += list->overflows;
+            ib_lock_unlock(&(list->lock));
+        }
+        IMR_PRINTF(
+            "PageCache:        pages=%10zd limit=%10zd free=%12zd "
+            "hits=%zd misses=%zd returns=%zd overflows=%zd "
+            "hitrate=%4.1f%%\n",
+            pages, mp->page_cache->max_pages * IB_MPOOL_NUM_CHILD_LISTS,
+            pages * unit_page_cost, hits, misses, returns, overflows,
+            (hits + misses) == 0 ? 0.0 : 100*(double)hits / (hits + misses)
+        );
+    }
+
+    {
         size_t total_free_child_use = 0;
-        IB_MPOOL_FOREACH(
+        bool   first                = true;
+        IB_MPOOL_FOREACH_CHILD(
             const ib_mpool_t, free_child,
-            mp->free_children
+            mp, free_children
         ) {
             size_t free_child_use = 0;
+            IMR_PRINTF("%s", first ? "Free children: " : " + ");
+            first = false;
             bool result = ib_mpool_analyze_free_child(
                 free_child,
                 report,
@@ -1312,20 +1721,22 @@ bool ib_mpool_analyze_helper(
                 goto failure;
             }
             total_free_child_use += free_child_use;
-            if (free_child->next != NULL) {
-                IMR_PRINTF("%s", " + ");
-            }
         }
-        IMR_PRINTF("\nTotal Free Child Use=%zd\n", total_free_child_use);
+        if (! first) {
+            IMR_PRINTF("\nTotal Free Child Use=%zd\n", total_free_child_use);
+        }
     }
 
-    if (mp->children != NULL) {
-        IMR_PRINTF("Done with %p.  Moving on to children.\n\n", mp);
-
-        IB_MPOOL_FOREACH(
+    {
+        bool first = true;
+        IB_MPOOL_FOREACH_CHILD(
             const ib_mpool_t, child,
-            mp->children
+            mp, children
         ) {
+            if (first) {
+                IMR_PRINTF("Done with %p.  Moving on to children.\n\n", mp);
+                first = false;
+            }
             bool result = ib_mpool_analyze_helper(child, report);
             if (! result) {
                 goto failure;
@@ -1383,8 +1794,11 @@ ib_status_t ib_mpool_create_ex(
     ib_mpool_free_fn_t     free_fn
 )
 {
-    ib_status_t rc;
-    ib_mpool_t *mp = NULL;
+    ib_status_t            rc;
+    ib_mpool_t            *mp          = NULL;
+    ib_mpool_child_list_t *child_lists = NULL;
+    ib_mpool_child_list_t *list        = NULL;
+    size_t                 list_index  = 0;
 
     if (pmp == NULL) {
         return IB_EINVAL;
@@ -1420,21 +1834,31 @@ ib_status_t ib_mpool_create_ex(
         }
     }
 
-    if (
-        parent != NULL &&
-        parent->free_children != NULL &&
-        parent->free_children->pagesize  == pagesize &&
-        parent->free_children->malloc_fn == malloc_fn &&
-        parent->free_children->free_fn   == free_fn
-    ) {
-        rc = ib_lock_lock(&(parent->lock));
+    if (parent != NULL) {
+        list_index = ib_mpool_child_list_index();
+        child_lists = ib_mpool_child_lists(parent);
+        if (child_lists == NULL) {
+            return IB_EALLOC;
+        }
+        list = &(child_lists[list_index]);
+
+        rc = ib_lock_lock(&(list->lock));
         if (rc != IB_OK) {
-            goto failure;
+            return rc;
+        }
+        if (
+            list->free_children != NULL &&
+            list->free_children->pagesize  == pagesize &&
+            list->free_children->malloc_fn == malloc_fn &&
+            list->free_children->free_fn   == free_fn
+        ) {
+            mp = list->free_children;
+            list->free_children = mp->next;
         }
-        mp = parent->free_children;
-        parent->free_children = mp->next;
-        ib_lock_unlock(&(parent->lock));
+        ib_lock_unlock(&(list->lock));
+    }
 
+    if (mp != NULL) {
         mp->next = NULL;
         assert(mp->inuse                  == 0);
         assert(mp->large_allocation_inuse == 0);
@@ -1459,6 +1883,23 @@ ib_status_t ib_mpool_create_ex(
     mp->inuse                  = 0;
     mp->large_allocation_inuse = 0;
     mp->parent                 = parent;
+    mp->child_list             = list_index;
+
+    /* Share the page cache of the parent if the pages fit.  A reused pool
+     * keeps a page cache it owns. */
+    if (mp->page_cache != NULL && mp->page_cache->owner != mp) {
+        mp->page_cache = NULL;
+    }
+    if (
+        mp->page_cache == NULL &&
+        parent != NULL &&
+        parent->page_cache != NULL &&
+        pagesize  == parent->page_cache->owner->pagesize &&
+        malloc_fn == parent->page_cache->owner->malloc_fn &&
+        free_fn   == parent->page_cache->owner->free_fn
+    ) {
+        mp->page_cache = parent->page_cache;
+    }
 
     rc = ib_mpool_setname(mp, name);
     if (rc != IB_OK) {
@@ -1466,16 +1907,16 @@ ib_status_t ib_mpool_create_ex(
     }
 
     if (parent != NULL) {
-        rc = ib_lock_lock(&(parent->lock));
+        rc = ib_lock_lock(&(list->lock));
         if (rc != IB_OK) {
             goto failure;
         }
-        mp->next = parent->children;
-        if (parent->children == NULL) {
-            parent->children_end = mp;
+        mp->next = list->children;
+        if (list->children == NULL) {
+            list->children_end = mp;
         }
-        parent->children = mp;
-        ib_lock_unlock(&(parent->lock));
+        list->children = mp;
+        ib_lock_unlock(&(list->lock));
     }
 
 #ifdef IB_MPOOL_VALGRIND
@@ -1692,7 +2133,7 @@ void ib_mpool_clear(
     mp->inuse                  = 0;
     mp->large_allocation_inuse = 0;
 
-    IB_MPOOL_FOREACH(ib_mpool_t, child, mp->children) {
+    IB_MPOOL_FOREACH_CHILD(ib_mpool_t, child, mp, children) {
         ib_mpool_clear(child);
     }
 
@@ -1713,7 +2154,9 @@ void ib_mpool_destroy(
 
     for (size_t track_num = 0; track_num < IB_MPOOL_NUM_TRACKS; ++track_num) {
         IB_MPOOL_FOREACH(ib_mpool_page_t, mpage, mp->tracks[track_num]) {
-            mp->free_fn(mpage);
+            if (! ib_mpool_page_cache_return(mp, mpage)) {
+                mp->free_fn(mpage);
+            }
         }
     }
 
@@ -1726,7 +2169,9 @@ void ib_mpool_destroy(
     }
 
     IB_MPOOL_FOREACH(ib_mpool_page_t, mpage, mp->free_pages) {
-        mp->free_fn(mpage);
+        if (! ib_mpool_page_cache_return(mp, mpage)) {
+            mp->free_fn(mpage);
+        }
     }
 
     IB_MPOOL_FOREACH(ib_mpool_pointer_page_t, ppage, mp->free_pointer_pages) {
@@ -1741,22 +2186,36 @@ void ib_mpool_destroy(
     * worry about us as we also face imminent destruction.
     */
 
-    IB_MPOOL_FOREACH(ib_mpool_t, free_child, mp->free_children) {
+    IB_MPOOL_FOREACH_CHILD(ib_mpool_t, free_child, mp, free_children) {
         free_child->parent = NULL;
         ib_mpool_destroy(free_child);
     }
-    IB_MPOOL_FOREACH(ib_mpool_t, child, mp->children) {
+    IB_MPOOL_FOREACH_CHILD(ib_mpool_t, child, mp, children) {
         child->parent = NULL;
         ib_mpool_destroy(child);
     }
+    if (mp->child_lists != NULL) {
+        for (size_t i = 0; i < IB_MPOOL_NUM_CHILD_LISTS; ++i) {
+            ib_lock_destroy(&(mp->child_lists[i].lock));
+        }
+        mp->free_fn(mp->child_lists);
+    }
+
+    /* Destroyed descendants have returned their pages by now. */
+    if (mp->page_cache != NULL && mp->page_cache->owner == mp) {
+        ib_mpool_page_cache_destroy(mp, mp->page_cache);
+    }
 
     if (mp->parent) {
+        ib_lock_t *lock =
+            &(mp->parent->child_lists[mp->child_list].lock);
+
         /* We have no good options if lock or unlock fails, so we hope. */
-        ib_lock_lock(&(mp->parent->lock));
+        ib_lock_lock(lock);
 
         ib_mpool_remove_child_from_parent(mp);
 
-        ib_lock_unlock(&(mp->parent->lock));
+        ib_lock_unlock(lock);
     }
 
     if (mp->name) {
@@ -1779,6 +2238,8 @@ void ib_mpool_release(
     ib_mpool_t *mp
 )
 {
+    ib_mpool_child_list_t *list = NULL;
+
     if (mp == NULL) {
         return;
     }
@@ -1791,21 +2252,35 @@ void ib_mpool_release(
     /* Clear pool and all subpools. */
     ib_mpool_clear(mp);
 
+    /* Hand pages to the page cache, if any, rather than keeping them for
+     * a future reuse of this pool only. */
+    while (mp->free_pages != NULL) {
+        ib_mpool_page_t *mpage = mp->free_pages;
+        ib_mpool_page_t *next  = mpage->next;
+
+        if (! ib_mpool_page_cache_return(mp, mpage)) {
+            break;
+        }
+        mp->free_pages = next;
+    }
+
     /* Release all subpools. */
-    IB_MPOOL_FOREACH(ib_mpool_t, child, mp->children) {
+    IB_MPOOL_FOREACH_CHILD(ib_mpool_t, child, mp, children) {
         ib_mpool_release(child);
     }
 
-    ib_lock_lock(&(mp->parent->lock));
+    list = &(mp->parent->child_lists[mp->child_list]);
+
+    ib_lock_lock(&(list->lock));
 
     /* Remove from parent child list. */
     ib_mpool_remove_child_from_parent(mp);
 
     /* Add to parent free children list. */
-    mp->next = mp->parent->free_children;
-    mp->parent->free_children = mp;
+    mp->next = list->free_children;
+    list->free_children = mp;
 
-    ib_lock_unlock(&(mp->parent->lock));
+    ib_lock_unlock(&(list->lock));
 
 #ifdef IB_MPOOL_VALGRIND
     VALGRIND_DESTROY_MEMPOOL(mp);
@@ -1814,6 +2289,43 @@ void ib_mpool_release(
     return;
 }
 
+ib_status_t ib_mpool_enable_page_cache(
+    ib_mpool_t *mp,
+    size_t      max_pages
+)
+{
+    ib_mpool_page_cache_t *cache = NULL;
+    ib_status_t            rc;
+
+    if (mp == NULL || max_pages == 0 || mp->page_cache != NULL) {
+        return IB_EINVAL;
+    }
+
+    cache = (ib_mpool_page_cache_t *)mp->malloc_fn(sizeof(*cache));
+    if (cache == NULL) {
+        return IB_EALLOC;
+    }
+    memset(cache, 0, sizeof(*cache));
+
+    cache->owner     = mp;
+    cache->max_pages = max_pages;
+    for (size_t i = 0; i < IB_MPOOL_NUM_CHILD_LISTS; ++i) {
+        rc = ib_lock_init(&(cache->lists[i].lock));
+        if (rc != IB_OK) {
+            while (i > 0) {
+                --i;
+                ib_lock_destroy(&(cache->lists[i].lock));
+            }
+            mp->free_fn(cache);
+            return rc;
+        }
+    }
+
+    mp->page_cache = cache;
+
+    return IB_OK;
+}
+
 ib_status_t ib_mpool_cleanup_register(
     ib_mpool_t            *mp,
     ib_mpool_cleanup_fn_t  cleanup_function,
@@ -1981,12 +2493,24 @@ ib_status_t ib_mpool_validate(
 
     /* Validate child of parent */
     if (mp->parent) {
-        ib_mpool_t *child = mp->parent->children;
+        const ib_mpool_child_list_t *list = NULL;
+        ib_mpool_t *child = NULL;
+        if (
+            mp->parent->child_lists == NULL ||
+            mp->child_list >= IB_MPOOL_NUM_CHILD_LISTS
+        ) {
+            VALIDATE_ERROR(
+                "Not on a child list of my parent: %zd",
+                mp->child_list
+            );
+        }
+        list  = &(mp->parent->child_lists[mp->child_list]);
+        child = list->children;
         while (child != NULL && child != mp) {
             child = child->next;
         }
         if (child == NULL) {
-            child = mp->parent->free_children;
+            child = list->free_children;
             while (child != NULL && child != mp) {
                 child = child->next;
             }
@@ -2044,7 +2568,15 @@ ib_status_t ib_mpool_validate(
         } \
     }
 /** @endcond */
-    VALIDATE_END(ib_mpool_t, mp->children, mp->children_end, "children");
+    if (mp->child_lists != NULL) {
+        for (size_t i = 0; i < IB_MPOOL_NUM_CHILD_LISTS; ++i) {
+            VALIDATE_END(
+                ib_mpool_t,
+                mp->child_lists[i].children, mp->child_lists[i].children_end,
+                "children"
+            );
+        }
+    }
     for (
         size_t track_num = 0;
         track_num < IB_MPOOL_NUM_TRACKS;
@@ -2068,8 +2600,29 @@ ib_status_t ib_mpool_validate(
     );
 #undef VALIDATE_END
 
+    /* Validate page cache */
+    if (mp->page_cache != NULL && mp->page_cache->owner == mp) {
+        for (size_t i = 0; i < IB_MPOOL_NUM_CHILD_LISTS; ++i) {
+            const ib_mpool_page_cache_list_t *list =
+                &(mp->page_cache->lists[i]);
+            size_t num_pages = 0;
+            IB_MPOOL_FOREACH(ib_mpool_page_t, mpage, list->pages) {
+                ++num_pages;
+            }
+            if (
+                num_pages != list->num_pages ||
+                num_pages > mp->page_cache->max_pages
+            ) {
+                VALIDATE_ERROR(
+                    "Inconsistent page cache: %zd %zd %zd",
+                    i, num_pages, list->num_pages
+                );
+            }
+        }
+    }
+
     /* Validate children */
-    IB_MPOOL_FOREACH(ib_mpool_t, child, mp->children) {
+    IB_MPOOL_FOREACH_CHILD(ib_mpool_t, child, mp, children) {
         if (child->parent != mp) {
             VALIDATE_ERROR(
                 "Child does not consider me its parent: %p %p",
@@ -2086,7 +2639,7 @@ ib_status_t ib_mpool_validate(
     }
 
     /* Validate free children */
-    IB_MPOOL_FOREACH(ib_mpool_t, free_child, mp->free_children) {
+    IB_MPOOL_FOREACH_CHILD(ib_mpool_t, free_child, mp, free_children) {
         if (free_child->parent != mp) {
             VALIDATE_ERROR(
                 "Free Child does not consider me its parent: %p %p",
@@ -2094,7 +2647,10 @@ ib_status_t ib_mpool_validate(
             );
         }
         /* Free child specific checks. */
-        if (free_child->children != NULL) {
+        IB_MPOOL_FOREACH_CHILD(
+            const ib_mpool_t, free_subchild,
+            free_child, children
+        ) {
             VALIDATE_ERROR(
                 "Free Child has children: %p",
                 free_child
@@ -0,0 +1,517 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+/**
+ * @file
+ * @brief IronBee --- Vectorized string scanning kernels
+ *
+ * See string_simd_private.h.
+ */
+
+#include "ironbee_config_auto.h"
+
+#include "string_simd_private.h"
+
+#include <assert.h>
+
+#if defined(IB_SIMD) && defined(__x86_64__) && defined(__GNUC__)
+#define SIMD_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+/**
+ * Set of kernels.
+ */
+typedef struct {
+    ib_simd_level_t level;
+    size_t (*find_upper)(const uint8_t *, size_t);
+    bool   (*lower)(uint8_t *, size_t);
+    size_t (*find_space)(const uint8_t *, size_t);
+    size_t (*find_nonspace)(const uint8_t *, size_t);
+    size_t (*rfind_nonspace)(const uint8_t *, size_t);
+    size_t (*find_byte2)(const uint8_t *, size_t, uint8_t, uint8_t);
+} simd_kernels_t;
+
+/* -- Plain C -- */
+
+/**
+ * Is @a c ASCII uppercase?
+ */
+static inline bool is_upper(uint8_t c)
+{
+    return (c >= 'A') && (c <= 'Z');
+}
+
+/**
+ * Is @a c whitespace (' ', '\\t', '\\n', '\\v', '\\f' or '\\r')?
+ */
+static inline bool is_space(uint8_t c)
+{
+    return (c == ' ') || ( (c >= '\t') && (c <= '\r') );
+}
+
+static size_t find_upper_c(const uint8_t *data, size_t dlen)
+{
+    size_t i;
+
+    for (i = 0;  i < dlen;  ++i) {
+        if (is_upper(data[i])) {
+            break;
+        }
+    }
+    return i;
+}
+
+static bool lower_c(uint8_t *data, size_t dlen)
+{
+    bool modified = false;
+    size_t i;
+
+    for (i = 0;  i < dlen;  ++i) {
+        if (is_upper(data[i])) {
+            data[i] |= 0x20;
+            modified = true;
+        }
+    }
+    return modified;
+}
+
+static size_t find_space_c(const uint8_t *data, size_t dlen)
+{
+    size_t i;
+
+    for (i = 0;  i < dlen;  ++i) {
+        if (is_space(data[i])) {
+            break;
+        }
+    }
+    return i;
+}
+
+static size_t find_nonspace_c(const uint8_t *data, size_t dlen)
+{
+    size_t i;
+
+    for (i = 0;  i < dlen;  ++i) {
+        if (! is_space(data[i])) {
+            break;
+        }
+    }
+    return i;
+}
+
+static size_t rfind_nonspace_c(const uint8_t *data, size_t dlen)
+{
+    while ( (dlen > 0) && is_space(data[dlen - 1]) ) {
+        --dlen;
+    }
+    return dlen;
+}
+
+static size_t find_byte2_c(const uint8_t *data, size_t dlen,
+                           uint8_t c1, uint8_t c2)
+{
+    size_t i;
+
+    for (i = 0;  i < dlen;  ++i) {
+        if ( (data[i] == c1) || (data[i] == c2) ) {
+            break;
+        }
+    }
+    return i;
+}
+
+static const simd_kernels_t kernels_c = {
+    IB_SIMD_NONE,
+    find_upper_c,
+    lower_c,
+    find_space_c,
+    find_nonspace_c,
+    rfind_nonspace_c,
+    find_byte2_c
+};
+
+#ifdef SIMD_X86
+
+/*
+ * Character classes are tested with a single signed compare: adding
+ * (0x80 - lo) maps the range [lo, hi] to [-128, -128 + hi - lo].
+ */
+
+/* -- SSE2 -- */
+
+/** Mask of the uppercase characters of @a v */
+static inline __m128i sse2_upper(__m128i v)
+{
+    __m128i x = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 'A')));
+    return _mm_cmplt_epi8(x, _mm_set1_epi8((char)(0x80 + 26)));
+}
+
+/** Mask of the whitespace characters of @a v */
+static inline __m128i sse2_space(__m128i v)
+{
+    __m128i x = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - '\t')));
+    return _mm_or_si128(
+        _mm_cmplt_epi8(x, _mm_set1_epi8((char)(0x80 + 5))),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+static size_t find_upper_sse2(const uint8_t *data, size_t dlen)
+{
+    size_t i;
+
+    for (i = 0;  i + 16 <= dlen;  i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        unsigned m = _mm_movemask_epi8(sse2_upper(v));
+        if (m != 0) {
+            return i + __builtin_ctz(m);
+        }
+    }
+    return i + find_upper_c(data + i, dlen - i);
+}
+
+static bool lower_sse2(uint8_t *data, size_t dlen)
+{
+    bool modified = false;
+    size_t i;
+
+    for (i = 0;  i + 16 <= dlen;  i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i m = sse2_upper(v);
+        if (_mm_movemask_epi8(m) != 0) {
+            v = _mm_or_si128(v, _mm_and_si128(m, _mm_set1_epi8(0x20)));
+            _mm_storeu_si128((__m128i *)(data + i), v);
+            modified = true;
+        }
+    }
+    return lower_c(data + i, dlen - i) || modified;
+}
+
+static size_t find_space_sse2(const uint8_t *data, size_t dlen)
+{
+    size_t i;
+
+    for (i = 0;  i + 16 <= dlen;  i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        unsigned m = _mm_movemask_epi8(sse2_space(v));
+        if (m != 0) {
+            return i + __builtin_ctz(m);
+        }
+    }
+    return i + find_space_c(data + i, dlen - i);
+}
+
+static size_t find_nonspace_sse2(const uint8_t *data, size_t dlen)
+{
+    size_t i;
+
+    for (i = 0;  i + 16 <= dlen;  i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        unsigned m = _mm_movemask_epi8(sse2_space(v)) ^ 0xffff;
+        if (m != 0) {
+            return i + __builtin_ctz(m);
+        }
+    }
+    return i + find_nonspace_c(data + i, dlen - i);
+}
+
+static size_t rfind_nonspace_sse2(const uint8_t *data, size_t dlen)
+{
+    while (dlen >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + dlen - 16));
+        unsigned m = _mm_movemask_epi8(sse2_space(v)) ^ 0xffff;
+        if (m != 0) {
+            return dlen - 16 + (32 - __builtin_clz(m));
+        }
+        dlen -= 16;
+    }
+    return rfind_nonspace_c(data, dlen);
+}
+
+static size_t find_byte2_sse2(const uint8_t *data, size_t dlen,
+                              uint8_t c1, uint8_t c2)
+{
+    __m128i v1 = _mm_set1_epi8((char)c1);
+    __m128i v2 = _mm_set1_epi8((char)c2);
+    size_t i;
+
+    for (i = 0;  i + 16 <= dlen;  i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        unsigned m = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, v1), _mm_cmpeq_epi8(v, v2)));
+        if (m != 0) {
+            return i + __builtin_ctz(m);
+        }
+    }
+    return i + find_byte2_c(data + i, dlen - i, c1, c2);
+}
+
+static const simd_kernels_t kernels_sse2 = {
+    IB_SIMD_SSE2,
+    find_upper_sse2,
+    lower_sse2,
+    find_space_sse2,
+    find_nonspace_sse2,
+    rfind_nonspace_sse2,
+    find_byte2_sse2
+};
+
+/* -- AVX2 -- */
+
+/*
+ * The kernels clear the upper halves of the AVX registers before
+ * returning or falling back to the SSE2 kernels for the tail; the
+ * compiler only does so itself when optimizing, and mixing dirty AVX
+ * state with SSE code is very slow on some CPUs.
+ */
+#define AVX2 __attribute__((target("avx2")))
+
+/** Mask of the uppercase characters of @a v */
+static inline AVX2 __m256i avx2_upper(__m256i v)
+{
+    __m256i x = _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - 'A')));
+    return _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + 26)), x);
+}
+
+/** Mask of the whitespace characters of @a v */
+static inline AVX2 __m256i avx2_space(__m256i v)
+{
+    __m256i x = _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - '\t')));
+    return _mm256_or_si256(
+        _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + 5)), x),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+}
+
+static AVX2 size_t find_upper_avx2(const uint8_t *data, size_t dlen)
+{
+    size_t i;
+
+    for (i = 0;  i + 32 <= dlen;  i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(avx2_upper(v));
+        if (m != 0) {
+            _mm256_zeroupper();
+            return i + __builtin_ctz(m);
+        }
+    }
+    _mm256_zeroupper();
+    return i + find_upper_sse2(data + i, dlen - i);
+}
+
+static AVX2 bool lower_avx2(uint8_t *data, size_t dlen)
+{
+    bool modified = false;
+    size_t i;
+
+    for (i = 0;  i + 32 <= dlen;  i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i m = avx2_upper(v);
+        if (_mm256_movemask_epi8(m) != 0) {
+            v = _mm256_or_si256(v,
+                                _mm256_and_si256(m, _mm256_set1_epi8(0x20)));
+            _mm256_storeu_si256((__m256i *)(data + i), v);
+            modified = true;
+        }
+    }
+    _mm256_zeroupper();
+    return lower_sse2(data + i, dlen - i) || modified;
+}
+
+static AVX2 size_t find_space_avx2(const uint8_t *data, size_t dlen)
+{
+    size_t i;
+
+    for (i = 0;  i + 32 <= dlen;  i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(avx2_space(v));
+        if (m != 0) {
+            _mm256_zeroupper();
+            return i + __builtin_ctz(m);
+        }
+    }
+    _mm256_zeroupper();
+    return i + find_space_sse2(data + i, dlen - i);
+}
+
+static AVX2 size_t find_nonspace_avx2(const uint8_t *data, size_t dlen)
+{
+    size_t i;
+
+    for (i = 0;  i + 32 <= dlen;  i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        uint32_t m = ~(uint32_t)_mm256_movemask_epi8(avx2_space(v));
+        if (m != 0) {
+            _mm256_zeroupper();
+            return i + __builtin_ctz(m);
+        }
+    }
+    _mm256_zeroupper();
+    return i + find_nonspace_sse2(data + i, dlen - i);
+}
+
+static AVX2 size_t rfind_nonspace_avx2(const uint8_t *data, size_t dlen)
+{
+    while (dlen >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + dlen - 32));
+        uint32_t m = ~(uint32_t)_mm256_movemask_epi8(avx2_space(v));
+        if (m != 0) {
+            _mm256_zeroupper();
+            return dlen - 32 + (32 - __builtin_clz(m));
+        }
+        dlen -= 32;
+    }
+    _mm256_zeroupper();
+    return rfind_nonspace_sse2(data, dlen);
+}
+
+static AVX2 size_t find_byte2_avx2(const uint8_t *data, size_t dlen,
+                                   uint8_t c1, uint8_t c2)
+{
+    __m256i v1 = _mm256_set1_epi8((char)c1);
+    __m256i v2 = _mm256_set1_epi8((char)c2);
+    size_t i;
+
+    for (i = 0;  i + 32 <= dlen;  i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, v1),
+                            _mm256_cmpeq_epi8(v, v2)));
+        if (m != 0) {
+            _mm256_zeroupper();
+            return i + __builtin_ctz(m);
+        }
+    }
+    _mm256_zeroupper();
+    return i + find_byte2_sse2(data + i, dlen - i, c1, c2);
+}
+
+static const simd_kernels_t kernels_avx2 = {
+    IB_SIMD_AVX2,
+    find_upper_avx2,
+    lower_avx2,
+    find_space_avx2,
+    find_nonspace_avx2,
+    rfind_nonspace_avx2,
+    find_byte2_avx2
+};
+
+#endif /* SIMD_X86 */
+
+/* -- Dispatch -- */
+
+/**
+ * Kernels in use; selected by ib_simd_set_level() on first use.
+ *
+ * Selection is idempotent, so threads racing to select store the same
+ * value.
+ */
+static const simd_kernels_t *simd_kernels = NULL;
+
+/**
+ * Get the kernels in use.
+ */
+static inline const simd_kernels_t *kernels(void)
+{
+    const simd_kernels_t *k = simd_kernels;
+
+    if (k == NULL) {
+        ib_simd_set_level(IB_SIMD_AVX2);
+        k = simd_kernels;
+    }
+    return k;
+}
+
+ib_simd_level_t ib_simd_set_level(ib_simd_level_t max)
+{
+    const simd_kernels_t *k = &kernels_c;
+
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if ( (max >= IB_SIMD_AVX2) && __builtin_cpu_supports("avx2") ) {
+        k = &kernels_avx2;
+    }
+    else if (max >= IB_SIMD_SSE2) {
+        /* SSE2 is part of x86-64 */
+        k = &kernels_sse2;
+    }
+#endif
+
+    simd_kernels = k;
+    return k->level;
+}
+
+ib_simd_level_t ib_simd_level(void)
+{
+    return kernels()->level;
+}
+
+const char *ib_simd_level_name(ib_simd_level_t level)
+{
+    switch (level) {
+    case IB_SIMD_NONE:
+        return "none";
+    case IB_SIMD_SSE2:
+        return "sse2";
+    case IB_SIMD_AVX2:
+        return "avx2";
+    }
+    return "unknown";
+}
+
+size_t ib_simd_find_upper(const uint8_t *data, size_t dlen)
+{
+    assert(data != NULL || dlen == 0);
+
+    return kernels()->find_upper(data, dlen);
+}
+
+bool ib_simd_lower(uint8_t *data, size_t dlen)
+{
+    assert(data != NULL || dlen == 0);
+
+    return kernels()->lower(data, dlen);
+}
+
+size_t ib_simd_find_space(const uint8_t *data, size_t dlen)
+{
+    assert(data != NULL || dlen == 0);
+
+    return kernels()->find_space(data, dlen);
+}
+
+size_t ib_simd_find_nonspace(const uint8_t *data, size_t dlen)
+{
+    assert(data != NULL || dlen == 0);
+
+    return kernels()->find_nonspace(data, dlen);
+}
+
+size_t ib_simd_rfind_nonspace(const uint8_t *data, size_t dlen)
+{
+    assert(data != NULL || dlen == 0);
+
+    return kernels()->rfind_nonspace(data, dlen);
+}
+
+size_t ib_simd_find_byte2(const uint8_t *data, size_t dlen,
+                          uint8_t c1, uint8_t c2)
+{
+    assert(data != NULL || dlen == 0);
+
+    return kernels()->find_byte2(data, dlen, c1, c2);
+}
@@ -0,0 +1,148 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+#ifndef _IB_STRING_SIMD_PRIVATE_H_
+#define _IB_STRING_SIMD_PRIVATE_H_
+
+/**
+ * @file
+ * @brief IronBee --- Vectorized string scanning kernels
+ *
+ * The string functions (lowercase, trim, whitespace removal/compression
+ * and URL decoding) use these kernels to skip over the parts of their
+ * input that they don't need to modify.  The kernels are implemented with
+ * SSE2 and AVX2 on x86 (when built with IB_SIMD) and in plain C; the best
+ * implementation supported by the CPU is selected at run time.
+ *
+ * Whitespace is what isspace() considers whitespace in the "C" locale.
+ */
+
+#include <ironbee/types.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Kernel implementations, in order of preference.
+ */
+typedef enum {
+    IB_SIMD_NONE,          /**< Plain C */
+    IB_SIMD_SSE2,          /**< SSE2 (16 bytes at a time) */
+    IB_SIMD_AVX2,          /**< AVX2 (32 bytes at a time) */
+} ib_simd_level_t;
+
+/**
+ * Get the kernel implementation in use.
+ *
+ * @returns The kernel implementation in use.
+ */
+ib_simd_level_t ib_simd_level(void);
+
+/**
+ * Select the best kernel implementation supported by the CPU, up to @a max.
+ *
+ * This is used by tests and benchmarks to compare implementations.
+ *
+ * @param[in] max Best implementation to use.
+ *
+ * @returns The kernel implementation in use.
+ */
+ib_simd_level_t ib_simd_set_level(ib_simd_level_t max);
+
+/**
+ * Get the name of a kernel implementation.
+ *
+ * @param[in] level Kernel implementation.
+ *
+ * @returns Name of @a level.
+ */
+const char *ib_simd_level_name(ib_simd_level_t level);
+
+/**
+ * Find the first ASCII uppercase character.
+ *
+ * @param[in] data Data to search.
+ * @param[in] dlen Length of @a data.
+ *
+ * @returns Offset of the first uppercase character or @a dlen if none.
+ */
+size_t ib_simd_find_upper(const uint8_t *data, size_t dlen);
+
+/**
+ * Convert ASCII uppercase characters to lowercase in-place.
+ *
+ * @param[in,out] data Data to convert.
+ * @param[in] dlen Length of @a data.
+ *
+ * @returns true if @a data was modified.
+ */
+bool ib_simd_lower(uint8_t *data, size_t dlen);
+
+/**
+ * Find the first whitespace character.
+ *
+ * @param[in] data Data to search.
+ * @param[in] dlen Length of @a data.
+ *
+ * @returns Offset of the first whitespace character or @a dlen if none.
+ */
+size_t ib_simd_find_space(const uint8_t *data, size_t dlen);
+
+/**
+ * Find the first non-whitespace character.
+ *
+ * @param[in] data Data to search.
+ * @param[in] dlen Length of @a data.
+ *
+ * @returns Offset of the first non-whitespace character or @a dlen if none.
+ */
+size_t ib_simd_find_nonspace(const uint8_t *data, size_t dlen);
+
+/**
+ * Find the last non-whitespace character.
+ *
+ * @param[in] data Data to search.
+ * @param[in] dlen Length of @a data.
+ *
+ * @returns Offset just past the last non-whitespace character, or 0 if
+ * @a data is all whitespace.
+ */
+size_t ib_simd_rfind_nonspace(const uint8_t *data, size_t dlen);
+
+/**
+ * Find the first occurrence of either of two bytes.
+ *
+ * @param[in] data Data to search.
+ * @param[in] dlen Length of @a data.
+ * @param[in] c1 First byte to look for.
+ * @param[in] c2 Second byte to look for.
+ *
+ * @returns Offset of the first @a c1 or @a c2, or @a dlen if none.
+ */
+size_t ib_simd_find_byte2(const uint8_t *data, size_t dlen,
+                          uint8_t c1, uint8_t c2);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _IB_STRING_SIMD_PRIVATE_H_ */
@@ -28,12 +28,15 @@
 #include <ironbee/types.h>
 #include <ironbee/util.h>
 
+#include "string_simd_private.h"
+
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /**
  * Simple in-place ASCII lowercase function.
@@ -50,23 +53,11 @@ static ib_status_t inplace(ib_flags_t inflags,
                            size_t dlen,
                            ib_flags_t *result)
 {
-    size_t i = 0;
-    int modcount = 0;
-
     assert(data != NULL);
     assert(result != NULL);
 
-    while(i < dlen) {
-        int c = *(data+i);
-        *(data+i) = tolower(c);
-        if (c != *(data+i)) {
-            ++modcount;
-        }
-        ++i;
-    }
-
     /* Note if any modifications were made. */
-    if (modcount != 0) {
+    if (ib_simd_lower(data, dlen)) {
         *result = (inflags | IB_STRFLAG_MODIFIED);
     }
     else {
@@ -95,10 +86,8 @@ static ib_status_t copy_on_write(ib_mpool_t *mp,
                                  size_t *dlen_out,
                                  ib_flags_t *result)
 {
-    const uint8_t *iptr;
-    const uint8_t *iend;
-    uint8_t *optr;
     uint8_t *obuf;
+    size_t off;
 
     assert(mp != NULL);
     assert(data_in != NULL);
@@ -106,51 +95,29 @@ static ib_status_t copy_on_write(ib_mpool_t *mp,
     assert(result != NULL);
 
     /* Initializations */
-    iend = data_in + dlen_in;
     *result = IB_STRFLAG_ALIAS;
     *data_out = (uint8_t *)data_in;
     if (dlen_out != NULL) {
         *dlen_out = dlen_in;
     }
-    obuf = NULL;    /* Output buffer; NULL until output buffer allocated */
-    optr = NULL;    /* Output pointer; NULL until obuf is allocated */
 
-    /*
-     * Loop through all of the input, using the input pointer as loop
-     * variable.
-     */
-    for (iptr = data_in;  iptr < iend;  ++iptr) {
-        int c = *iptr;
-        if (isupper(c)) {
-            if (obuf == NULL) {
-                /* Output buffer not previously allocated;
-                 * allocate it now, and copy into it */
-                size_t off;
-                obuf = ib_mpool_alloc(mp, dlen_in);
-                if (obuf == NULL) {
-                    return IB_EALLOC;
-                }
-                *data_out = obuf;
-                *result = (IB_STRFLAG_NEWBUF|IB_STRFLAG_MODIFIED);
-                off = (iptr - data_in);
-                if (off == 1) {
-                    *obuf = *data_in;
-                }
-                else if (off != 0) {
-                    memcpy(obuf, data_in, off);
-                }
-                optr = obuf+off;
-            }
-            *optr = tolower(c);
-        }
-        else if (optr != NULL) {
-            *optr = *iptr;
-        }
-        if (optr != NULL) {
-            ++optr;
-        }
+    /* Nothing to do if there are no uppercase characters */
+    off = ib_simd_find_upper(data_in, dlen_in);
+    if (off == dlen_in) {
+        return IB_OK;
     }
 
+    /* Copy the input, and convert it from the first uppercase character */
+    obuf = ib_mpool_alloc(mp, dlen_in);
+    if (obuf == NULL) {
+        return IB_EALLOC;
+    }
+    memcpy(obuf, data_in, dlen_in);
+    ib_simd_lower(obuf + off, dlen_in - off);
+
+    *data_out = obuf;
+    *result = (IB_STRFLAG_NEWBUF|IB_STRFLAG_MODIFIED);
+
     return IB_OK;
 }
 
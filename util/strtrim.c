@@ -27,6 +27,8 @@
 #include <ironbee/string.h>
 #include <ironbee/types.h>
 
+#include "string_simd_private.h"
+
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
@@ -52,19 +54,17 @@ static size_t find_nonws_left(const uint8_t *str,
                               size_t len)
 {
     assert (str != NULL);
-    const uint8_t *cur;
-    const uint8_t *end = (str + len);
+    size_t offset;
 
     /* Special case: length of zero */
     if (len == 0) {
         return 0;
     }
 
-    /* Loop through all of the input until we find the first non-space */
-    for (cur = str;  cur < end;  ++cur) {
-        if (isspace(*cur) == 0) {
-            return cur - str;
-        }
+    /* Find the first non-space */
+    offset = ib_simd_find_nonspace(str, len);
+    if (offset < len) {
+        return offset;
     }
 
     /* No non-whitespace found */
@@ -238,18 +238,17 @@ static size_t find_nonws_right(const uint8_t *str,
                                size_t len)
 {
     assert (str != NULL);
-    const uint8_t *cur;
+    size_t end;
 
     /* Special case: length of zero */
     if (len == 0) {
         return 0;
     }
 
-    /* Loop through all of the input until we find the first non-space */
-    for (cur = str + len - 1;  cur >= str;  --cur) {
-        if (isspace(*cur) == 0) {
-            return cur - str;
-        }
+    /* Find the last non-space */
+    end = ib_simd_rfind_nonspace(str, len);
+    if (end > 0) {
+        return end - 1;
     }
 
     /* No non-whitespace found */
@@ -301,7 +300,7 @@ static ib_status_t trim_right_ex(ib_strop_t op,
         if (*data_out == NULL) {
             return IB_EALLOC;
         }
-        memcpy(data_out, data_in, *dlen_out);
+        memcpy(*data_out, data_in, *dlen_out);
         flags |= IB_STRFLAG_NEWBUF;
         break;
 
@@ -435,7 +434,7 @@ ib_status_t ib_strtrim_left_ex(ib_strop_t op,
         if (*data_out == NULL) {
             return IB_EALLOC;
         }
-        memcpy(data_out, data_in + offset, *dlen_out);
+        memcpy(*data_out, data_in + offset, *dlen_out);
         flags |= IB_STRFLAG_NEWBUF;
         break;
 
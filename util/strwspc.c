@@ -27,6 +27,8 @@
 #include <ironbee/string.h>
 #include <ironbee/types.h>
 
+#include "string_simd_private.h"
+
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
@@ -34,6 +36,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /**
  * Count the amount of whitespace in a string function
@@ -101,25 +104,27 @@ static void ws_count(bool force_other_zero,
     const uint8_t *end;
     size_t icount = 0;     /* Internal count */
     size_t iother = 0;     /* Internal other */
-    size_t runlen = 0;
 
-    /* Loop through the whole string */
+    /* Loop through the runs of whitespace in the string */
     end = data + dlen;
-    while (data <= end) {
-        uint8_t c = *data;
-        if (isspace(c) == 0) {
-            runlen = 0;
+    while (data < end) {
+        size_t runlen;
+        size_t n;
+
+        data += ib_simd_find_space(data, end - data);
+        if (data == end) {
+            break;
         }
-        else {
-            ++runlen;
-            if (runlen >= minlen) {
-                ++icount;
-            }
-            if (c != ' ') {
+        runlen = ib_simd_find_nonspace(data, end - data);
+        if (runlen >= minlen) {
+            icount += (runlen - minlen + 1);
+        }
+        for (n = 0;  n < runlen;  ++n) {
+            if (data[n] != ' ') {
                 ++iother;
             }
         }
-        ++data;
+        data += runlen;
     }
 
     *count = icount;
@@ -177,17 +182,18 @@ static ib_status_t ws_remove_inplace(uint8_t *buf,
         return IB_OK;
     }
 
-    /* Loop through all of the input */
+    /* Loop through all of the input, moving the non-whitespace runs */
     optr = buf;
     iptr = buf;
     iend = buf + dlen_in;
     while (iptr < iend) {
-        uint8_t c = *iptr;
-        if (isspace(c) == 0) {
-            *optr = c;
-            ++optr;
+        size_t n = ib_simd_find_space(iptr, iend - iptr);
+        if (optr != iptr) {
+            memmove(optr, iptr, n);
         }
-        ++iptr;
+        optr += n;
+        iptr += n;
+        iptr += ib_simd_find_nonspace(iptr, iend - iptr);
     }
 
     /* Store the output length & result */
@@ -226,18 +232,17 @@ static ib_status_t ws_remove(const uint8_t *data_in,
         return IB_OK;
     }
 
-    /* Loop through all of the input */
+    /* Loop through all of the input, copying the non-whitespace runs */
     optr = data_out;
     oend = data_out + dlen_out;
     iend = data_in + dlen_in;
     while (data_in < iend) {
-        assert (optr <= oend);
-        uint8_t c = *data_in;
-        if (isspace(c) == 0) {
-            *optr = c;
-            ++optr;
-        }
-        ++data_in;
+        size_t n = ib_simd_find_space(data_in, iend - data_in);
+        assert (optr + n <= oend);
+        memcpy(optr, data_in, n);
+        optr += n;
+        data_in += n;
+        data_in += ib_simd_find_nonspace(data_in, iend - data_in);
     }
 
     return IB_OK;
@@ -280,7 +285,6 @@ static ib_status_t ws_compress_inplace(uint8_t *buf,
     const uint8_t *iend;
     const uint8_t *iptr;
     uint8_t *optr;
-    bool in_wspc = false;
     bool modified = false;
 
     assert(buf != NULL);
@@ -300,24 +304,24 @@ static ib_status_t ws_compress_inplace(uint8_t *buf,
     iptr = buf;
     iend = buf + dlen_in;
     while (iptr < iend) {
-        uint8_t c = *iptr;
-        if (isspace(c) == 0) {
-            *optr = c;
-            ++optr;
-            in_wspc = false;
+        size_t n = ib_simd_find_space(iptr, iend - iptr);
+        if (optr != iptr) {
+            memmove(optr, iptr, n);
         }
-        else if (in_wspc) {
-            modified = true;
+        optr += n;
+        iptr += n;
+        if (iptr == iend) {
+            break;
         }
-        else if (! in_wspc) {
-            *optr = ' ';
-            ++optr;
-            in_wspc = true;
-            if (c != ' ') {
-                modified = true;
-            }
+
+        /* Replace the whitespace run with a single space */
+        n = ib_simd_find_nonspace(iptr, iend - iptr);
+        if ( (n > 1) || (*iptr != ' ') ) {
+            modified = true;
         }
-        ++iptr;
+        *optr = ' ';
+        ++optr;
+        iptr += n;
     }
 
     /* Store the output length & result */
@@ -346,7 +350,6 @@ static ib_status_t ws_compress(const uint8_t *data_in,
     const uint8_t *iend;
     const uint8_t *oend;
     uint8_t *optr;
-    bool in_wspc = false;
 
     assert(data_in != NULL);
     assert(data_out != NULL);
@@ -362,20 +365,20 @@ static ib_status_t ws_compress(const uint8_t *data_in,
     oend = data_out + dlen_out;
     iend = data_in + dlen_in;
     while (data_in < iend) {
-        uint8_t c = *data_in;
-        if (isspace(c) == 0) {
-            assert (optr < oend);
-            *optr = c;
-            ++optr;
-            in_wspc = false;
-        }
-        else if (! in_wspc) {
-            assert (optr < oend);
-            *optr = ' ';
-            ++optr;
-            in_wspc = true;
+        size_t n = ib_simd_find_space(data_in, iend - data_in);
+        assert (optr + n <= oend);
+        memcpy(optr, data_in, n);
+        optr += n;
+        data_in += n;
+        if (data_in == iend) {
+            break;
         }
-        ++data_in;
+
+        /* Replace the whitespace run with a single space */
+        assert (optr < oend);
+        *optr = ' ';
+        ++optr;
+        data_in += ib_simd_find_nonspace(data_in, iend - data_in);
     }
 
     return IB_OK;
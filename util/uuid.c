@@ -19,7 +19,6 @@
  * @file
  * @brief UUID helper functions
  * @author Christopher Alfeld <calfeld@qualys.com>
- * @todo Add bin to ascii
  */
 
 #include "ironbee_config_auto.h"
@@ -31,17 +30,241 @@
 #include <uuid.h>
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 /*
- * These are initialized by ib_uuid_init();
+ * These are initialized by ib_uuid_initialize();
  * OSSP UUID is ... generous .. in what it creates for a UUID.  E.g., it will
  * do multiple allocations, check its MAC (it may have changed?), etc. for
  * every creation.  So we only keep one at reuse it.
+ *
+ * It is only used to parse UUIDs and, if /dev/urandom can't be read, to seed
+ * the per-thread generators below.
  */
 static ib_lock_t  g_uuid_lock;
 uuid_t           *g_ossp_uuid;
 
+/**
+ * Per-thread random UUID generator.
+ *
+ * Each thread seeds a ChaCha20 key from the kernel once, then makes UUIDs
+ * from the keystream, four per block, without locking or system calls.
+ */
+typedef struct {
+    uint32_t key[8];      /**< ChaCha20 key */
+    uint64_t counter;     /**< Next block number */
+    ib_uuid_t block[4];   /**< Current keystream block */
+    unsigned next;        /**< Next UUID of @c block to use */
+    unsigned forks;       /**< Fork count when seeded */
+} uuid_rng_t;
+
+/** Thread's generator; initialized by ib_uuid_initialize(). */
+static pthread_key_t g_uuid_rng_key;
+
+/**
+ * Number of times this process has forked.
+ *
+ * A child process inherits the generators of its parent, so they are
+ * seeded again after a fork rather than repeat the parent's UUIDs.
+ */
+static unsigned g_uuid_forks = 0;
+
+/** Registers uuid_atfork_child() once. */
+static pthread_once_t g_uuid_atfork_once = PTHREAD_ONCE_INIT;
+
+/** Count forks. */
+static void uuid_atfork_child(void)
+{
+    ++g_uuid_forks;
+}
+
+/** Register uuid_atfork_child(). */
+static void uuid_atfork_register(void)
+{
+    pthread_atfork(NULL, NULL, uuid_atfork_child);
+}
+
+/**
+ * Destroy a thread's generator when the thread exits.
+ *
+ * @param[in] arg Generator
+ */
+static void uuid_rng_destroy(void *arg)
+{
+    uuid_rng_t *rng = (uuid_rng_t *)arg;
+
+    memset(rng, 0, sizeof(*rng));
+    free(rng);
+}
+
+/**
+ * Fill @a buf with random bytes from the kernel.
+ *
+ * @param[out] buf Buffer.
+ * @param[in]  len Length of @a buf.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EOTHER if /dev/urandom can't be read.
+ */
+static ib_status_t uuid_seed_urandom(void *buf, size_t len)
+{
+    uint8_t *p = (uint8_t *)buf;
+    int fd;
+
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd == -1) {
+        return IB_EOTHER;
+    }
+
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            close(fd);
+            return IB_EOTHER;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+
+    close(fd);
+    return IB_OK;
+}
+
+/**
+ * Fill @a buf with OSSP random UUIDs.
+ *
+ * @param[out] buf Buffer.
+ * @param[in]  len Length of @a buf; a multiple of UUID_LEN_BIN.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation failure.
+ * - IB_EOTHER on other failure.
+ */
+static ib_status_t uuid_seed_ossp(void *buf, size_t len)
+{
+    uint8_t *p = (uint8_t *)buf;
+    ib_status_t rc = IB_OK;
+
+    assert(len % UUID_LEN_BIN == 0);
+
+    rc = ib_lock_lock(&g_uuid_lock);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    for (size_t i = 0; i < len; i += UUID_LEN_BIN) {
+        uuid_rc_t uuid_rc;
+        size_t uuid_len = UUID_LEN_BIN;
+        void *out = p + i;
+
+        uuid_rc = uuid_make(g_ossp_uuid, UUID_MAKE_V4);
+        if (uuid_rc == UUID_RC_OK) {
+            uuid_rc = uuid_export(g_ossp_uuid, UUID_FMT_BIN, &out, &uuid_len);
+        }
+        if (uuid_rc == UUID_RC_MEM) {
+            rc = IB_EALLOC;
+            break;
+        }
+        else if (uuid_rc != UUID_RC_OK || uuid_len != UUID_LEN_BIN) {
+            rc = IB_EOTHER;
+            break;
+        }
+    }
+
+    if (ib_lock_unlock(&g_uuid_lock) != IB_OK) {
+        return IB_EOTHER;
+    }
+
+    return rc;
+}
+
+/**
+ * Seed @a rng.
+ *
+ * @param[in] rng Generator.
+ *
+ * @returns Status code
+ */
+static ib_status_t uuid_rng_seed(uuid_rng_t *rng)
+{
+    ib_status_t rc;
+
+    rc = uuid_seed_urandom(rng->key, sizeof(rng->key));
+    if (rc != IB_OK) {
+        rc = uuid_seed_ossp(rng->key, sizeof(rng->key));
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+
+    rng->counter = 0;
+    rng->next = sizeof(rng->block) / sizeof(rng->block[0]);
+    rng->forks = g_uuid_forks;
+
+    return IB_OK;
+}
+
+/** ChaCha quarter round. */
+#define UUID_QR(a, b, c, d) \
+    do { \
+        a += b; d ^= a; d = (d << 16) | (d >> 16); \
+        c += d; b ^= c; b = (b << 12) | (b >> 20); \
+        a += b; d ^= a; d = (d <<  8) | (d >> 24); \
+        c += d; b ^= c; b = (b <<  7) | (b >> 25); \
+    } while (0)
+
+/**
+ * Compute the next ChaCha20 keystream block of @a rng.
+ *
+ * @param[in] rng Generator.
+ */
+static void uuid_rng_block(uuid_rng_t *rng)
+{
+    uint32_t in[16];
+    uint32_t x[16];
+
+    in[0] = 0x61707865;
+    in[1] = 0x3320646e;
+    in[2] = 0x79622d32;
+    in[3] = 0x6b206574;
+    memcpy(&in[4], rng->key, sizeof(rng->key));
+    in[12] = (uint32_t)rng->counter;
+    in[13] = (uint32_t)(rng->counter >> 32);
+    in[14] = 0;
+    in[15] = 0;
+    ++rng->counter;
+
+    memcpy(x, in, sizeof(x));
+    for (int i = 0; i < 10; ++i) {
+        UUID_QR(x[0], x[4], x[ 8], x[12]);
+        UUID_QR(x[1], x[5], x[ 9], x[13]);
+        UUID_QR(x[2], x[6], x[10], x[14]);
+        UUID_QR(x[3], x[7], x[11], x[15]);
+        UUID_QR(x[0], x[5], x[10], x[15]);
+        UUID_QR(x[1], x[6], x[11], x[12]);
+        UUID_QR(x[2], x[7], x[ 8], x[13]);
+        UUID_QR(x[3], x[4], x[ 9], x[14]);
+    }
+    for (int i = 0; i < 16; ++i) {
+        x[i] += in[i];
+    }
+
+    memcpy(rng->block, x, sizeof(rng->block));
+    rng->next = 0;
+}
+
+#undef UUID_QR
+
 ib_status_t ib_uuid_initialize(void)
 {
     ib_status_t rc;
@@ -51,13 +274,33 @@ ib_status_t ib_uuid_initialize(void)
     }
 
     rc = ib_lock_init(&g_uuid_lock);
+    if (rc != IB_OK) {
+        uuid_destroy(g_ossp_uuid);
+        return rc;
+    }
 
-    return rc;
+    if (pthread_key_create(&g_uuid_rng_key, uuid_rng_destroy) != 0) {
+        ib_lock_destroy(&g_uuid_lock);
+        uuid_destroy(g_ossp_uuid);
+        return IB_EALLOC;
+    }
+
+    pthread_once(&g_uuid_atfork_once, uuid_atfork_register);
+
+    return IB_OK;
 }
 
 ib_status_t ib_uuid_shutdown(void)
 {
     ib_status_t rc;
+    uuid_rng_t *rng;
+
+    /* Other threads' generators are only freed when those threads exit. */
+    rng = pthread_getspecific(g_uuid_rng_key);
+    if (rng != NULL) {
+        uuid_rng_destroy(rng);
+    }
+    pthread_key_delete(g_uuid_rng_key);
 
     rc = ib_lock_destroy(&g_uuid_lock);
     uuid_destroy(g_ossp_uuid);
@@ -125,84 +368,67 @@ ib_status_t ib_uuid_bin_to_ascii(
     const ib_uuid_t *uuid
 )
 {
-    uuid_rc_t uuid_rc;
-    size_t uuid_len = UUID_LEN_STR+1;
-    ib_status_t rc = IB_OK;
+    static const char hex[] = "0123456789abcdef";
+    char *p = str;
 
     if (uuid == NULL || str == NULL) {
         return IB_EINVAL;
     }
 
-    rc = ib_lock_lock(&g_uuid_lock);
-    if (rc != IB_OK) {
-        return rc;
-    }
-
-    uuid_rc = uuid_import(g_ossp_uuid, UUID_FMT_BIN, uuid, UUID_LEN_BIN);
-    if (uuid_rc == UUID_RC_MEM) {
-        rc = IB_EALLOC;
-        goto finish;
-    }
-    else if (uuid_rc != UUID_RC_OK) {
-        rc = IB_EINVAL;
-        goto finish;
-    }
-
-    uuid_rc = uuid_export(g_ossp_uuid, UUID_FMT_STR, (void *)&str, &uuid_len);
-    if (uuid_rc == UUID_RC_MEM) {
-        rc = IB_EALLOC;
-        goto finish;
-    }
-    else if (uuid_rc != UUID_RC_OK || uuid_len != UUID_LEN_STR+1) {
-        rc = IB_EOTHER;
-        goto finish;
+    for (int i = 0; i < 16; ++i) {
+        if (i == 4 || i == 6 || i == 8 || i == 10) {
+            *p++ = '-';
+        }
+        *p++ = hex[uuid->byte[i] >> 4];
+        *p++ = hex[uuid->byte[i] & 0x0f];
     }
+    *p = '\0';
 
-finish:
-    if (ib_lock_unlock(&g_uuid_lock) != IB_OK) {
-        return IB_EOTHER;
-    }
+    assert(p - str == UUID_LEN_STR);
 
-    return rc;
+    return IB_OK;
 }
 
 ib_status_t ib_uuid_create_v4(ib_uuid_t *uuid)
 {
-    uuid_rc_t uuid_rc;
-    size_t uuid_len = UUID_LEN_BIN;
-    ib_status_t rc = IB_OK;
+    uuid_rng_t *rng;
+    ib_status_t rc;
 
-    rc = ib_lock_lock(&g_uuid_lock);
-    if (rc != IB_OK) {
-        return rc;
+    assert(uuid != NULL);
+
+    rng = pthread_getspecific(g_uuid_rng_key);
+    if (rng == NULL) {
+        rng = malloc(sizeof(*rng));
+        if (rng == NULL) {
+            return IB_EALLOC;
+        }
+        rc = uuid_rng_seed(rng);
+        if (rc != IB_OK) {
+            free(rng);
+            return rc;
+        }
+        if (pthread_setspecific(g_uuid_rng_key, rng) != 0) {
+            uuid_rng_destroy(rng);
+            return IB_EALLOC;
+        }
     }
-
-    uuid_rc = uuid_make(g_ossp_uuid, UUID_MAKE_V4);
-    if (uuid_rc == UUID_RC_MEM) {
-        rc = IB_EALLOC;
-        goto finish;
-    }
-    else if (uuid_rc != UUID_RC_OK) {
-        rc = IB_EOTHER;
-        goto finish;
+    else if (rng->forks != g_uuid_forks) {
+        rc = uuid_rng_seed(rng);
+        if (rc != IB_OK) {
+            return rc;
+        }
     }
 
-    uuid_rc = uuid_export(g_ossp_uuid,
-        UUID_FMT_BIN, (void *)&uuid, &uuid_len
-    );
-    if (uuid_rc == UUID_RC_MEM) {
-        rc = IB_EALLOC;
-        goto finish;
-    }
-    else if (uuid_rc != UUID_RC_OK || uuid_len != UUID_LEN_BIN) {
-        rc = IB_EOTHER;
-        goto finish;
+    if (rng->next == sizeof(rng->block) / sizeof(rng->block[0])) {
+        uuid_rng_block(rng);
     }
+    *uuid = rng->block[rng->next];
+    memset(&rng->block[rng->next], 0, sizeof(rng->block[0]));
+    ++rng->next;
 
-finish:
-    if (ib_lock_unlock(&g_uuid_lock) != IB_OK) {
-        return IB_EOTHER;
-    }
+    /* Version 4, variant RFC 4122. */
+    uuid->byte[6] = (uuid->byte[6] & 0x0f) | 0x40;
+    uuid->byte[8] = (uuid->byte[8] & 0x3f) | 0x80;
 
-    return rc;
+    return IB_OK;
 }